@@ -0,0 +1,165 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ *
+ * Copyright © 2018 Endless Mobile, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#include "config.h"
+
+#include <errno.h>
+#include <malloc.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <libglib-testing/alloc-shim.h>
+
+
+/* This is an `LD_PRELOAD` shim which interposes the malloc() family of
+ * functions to count the number of allocations and frees, and the number of
+ * bytes allocated, both per-thread and for the whole process. #GtAllocTracker
+ * reads the counts using gt_alloc_shim_get_counts().
+ *
+ * The real allocator is called through the `__libc_*()` entry points which
+ * glibc exports, rather than through dlsym(RTLD_NEXT, …), since dlsym() itself
+ * may allocate memory. For the same reason, the thread-local counts use the
+ * initial-exec TLS model, which never allocates; that is safe because the shim
+ * is always loaded at startup. */
+
+extern void *__libc_malloc (size_t size);
+extern void *__libc_calloc (size_t n_members, size_t size);
+extern void *__libc_realloc (void *ptr, size_t size);
+extern void *__libc_memalign (size_t alignment, size_t size);
+extern void __libc_free (void *ptr);
+
+static __thread GtAllocShimCounts thread_counts __attribute__((tls_model ("initial-exec")));
+static GtAllocShimCounts process_counts;  /* (atomic) */
+
+static inline void
+count_alloc (size_t size)
+{
+  thread_counts.n_allocs++;
+  thread_counts.n_bytes += size;
+  __atomic_fetch_add (&process_counts.n_allocs, 1, __ATOMIC_RELAXED);
+  __atomic_fetch_add (&process_counts.n_bytes, size, __ATOMIC_RELAXED);
+}
+
+static inline void
+count_free (void)
+{
+  thread_counts.n_frees++;
+  __atomic_fetch_add (&process_counts.n_frees, 1, __ATOMIC_RELAXED);
+}
+
+void
+gt_alloc_shim_get_counts (int                thread_only,
+                          GtAllocShimCounts *out_counts)
+{
+  if (thread_only)
+    {
+      *out_counts = thread_counts;
+    }
+  else
+    {
+      out_counts->n_allocs = __atomic_load_n (&process_counts.n_allocs, __ATOMIC_RELAXED);
+      out_counts->n_frees = __atomic_load_n (&process_counts.n_frees, __ATOMIC_RELAXED);
+      out_counts->n_bytes = __atomic_load_n (&process_counts.n_bytes, __ATOMIC_RELAXED);
+    }
+}
+
+void *
+malloc (size_t size)
+{
+  void *ptr = __libc_malloc (size);
+  if (ptr != NULL)
+    count_alloc (size);
+  return ptr;
+}
+
+void *
+calloc (size_t n_members,
+        size_t size)
+{
+  void *ptr = __libc_calloc (n_members, size);
+  if (ptr != NULL)
+    count_alloc (n_members * size);
+  return ptr;
+}
+
+/* A realloc() which may move the block counts as an allocation and a free. */
+void *
+realloc (void   *ptr,
+         size_t  size)
+{
+  void *new_ptr = __libc_realloc (ptr, size);
+
+  if (ptr != NULL && (new_ptr != NULL || size == 0))
+    count_free ();
+  if (new_ptr != NULL)
+    count_alloc (size);
+
+  return new_ptr;
+}
+
+void
+free (void *ptr)
+{
+  if (ptr != NULL)
+    count_free ();
+  __libc_free (ptr);
+}
+
+int
+posix_memalign (void   **memptr,
+                size_t   alignment,
+                size_t   size)
+{
+  void *ptr;
+
+  if (alignment % sizeof (void *) != 0 ||
+      (alignment & (alignment - 1)) != 0 ||
+      alignment == 0)
+    return EINVAL;
+
+  ptr = __libc_memalign (alignment, size);
+  if (ptr == NULL)
+    return ENOMEM;
+
+  count_alloc (size);
+  *memptr = ptr;
+
+  return 0;
+}
+
+void *
+aligned_alloc (size_t alignment,
+               size_t size)
+{
+  void *ptr = __libc_memalign (alignment, size);
+  if (ptr != NULL)
+    count_alloc (size);
+  return ptr;
+}
+
+void *
+memalign (size_t alignment,
+          size_t size)
+{
+  void *ptr = __libc_memalign (alignment, size);
+  if (ptr != NULL)
+    count_alloc (size);
+  return ptr;
+}
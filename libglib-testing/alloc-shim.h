@@ -0,0 +1,45 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ *
+ * Copyright © 2018 Endless Mobile, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#pragma once
+
+#include <stdint.h>
+
+/* Interface between the allocation counting shim, which is preloaded into test
+ * processes using `LD_PRELOAD`, and #GtAllocTracker, which finds it at runtime
+ * using dlsym(). The shim must not depend on GLib, as GLib itself allocates
+ * memory. */
+
+/*< private >*/
+typedef struct
+{
+  uint64_t n_allocs;
+  uint64_t n_frees;
+  uint64_t n_bytes;
+} GtAllocShimCounts;
+
+/*< private >*/
+typedef void (*GtAllocShimGetCountsFunc) (int                thread_only,
+                                          GtAllocShimCounts *out_counts);
+
+#define GT_ALLOC_SHIM_GET_COUNTS_SYMBOL "gt_alloc_shim_get_counts"
+
+void gt_alloc_shim_get_counts (int                thread_only,
+                               GtAllocShimCounts *out_counts);
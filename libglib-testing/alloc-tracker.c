@@ -0,0 +1,496 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ *
+ * Copyright © 2018 Endless Mobile, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#include "config.h"
+
+#include <glib.h>
+#include <libglib-testing/alloc-shim.h>
+#include <libglib-testing/alloc-tracker.h>
+
+#ifdef HAVE_DLSYM
+#include <dlfcn.h>
+#endif
+#ifdef HAVE_MALLINFO2
+#include <malloc.h>
+#endif
+
+
+/**
+ * SECTION:alloc-tracker
+ * @short_description: Allocation counting and budget assertions
+ * @stability: Unstable
+ * @include: libglib-testing/alloc-tracker.h
+ *
+ * #GtAllocTracker counts the heap allocations made within a scope, delimited
+ * by gt_alloc_tracker_start() and gt_alloc_tracker_stop(), either by the
+ * calling thread or by the whole process. It is intended to be used to prove
+ * that hot paths don’t allocate, or allocate no more than expected, using
+ * gt_assert_allocs_at_most() and gt_assert_alloc_bytes_at_most():
+ * |[<!-- language="C" -->
+ * g_autoptr(GtAllocTracker) tracker = gt_alloc_tracker_new (GT_ALLOC_TRACKER_SCOPE_THREAD);
+ *
+ * gt_alloc_tracker_start (tracker);
+ * my_hot_path ();
+ * gt_alloc_tracker_stop (tracker);
+ *
+ * gt_assert_allocs_at_most (tracker, 0);
+ * ]|
+ *
+ * Individual allocations can only be counted if the allocation shim,
+ * `libglib-testing-alloc-shim.so`, is loaded into the test process using
+ * `LD_PRELOAD`. It interposes the `malloc()` family of functions. Otherwise,
+ * on platforms with `mallinfo2()`, the tracker falls back to measuring the
+ * net change in the number of bytes in use by the whole process, which is
+ * much less precise. Use gt_alloc_tracker_get_backend() to check which is in
+ * use; the assertion macros are written to pass when they can’t be checked,
+ * so tests using them can still run everywhere.
+ *
+ * Since: 0.2.0
+ */
+
+/* Backend to use if the shim is not loaded. */
+#ifdef HAVE_MALLINFO2
+#define FALLBACK_BACKEND GT_ALLOC_TRACKER_BACKEND_MALLINFO
+#else
+#define FALLBACK_BACKEND GT_ALLOC_TRACKER_BACKEND_NONE
+#endif
+
+/**
+ * GtAllocTracker:
+ *
+ * A tracker for the allocations made within a scope.
+ *
+ * Since: 0.2.0
+ */
+struct _GtAllocTracker
+{
+  GtAllocTrackerScope scope;
+  GtAllocTrackerBackend backend;
+  GtAllocShimGetCountsFunc get_counts;  /* (nullable) */
+
+  gboolean running;
+  /* The thread which called gt_alloc_tracker_start(). */
+  GThread *thread;  /* (unowned) (nullable) */
+  /* Counts when gt_alloc_tracker_start() was called. For the mallinfo
+   * backend, only @n_bytes is used, and is the number of bytes in use. */
+  GtAllocShimCounts start_counts;
+  /* Differences between the start and stop counts, once stopped. */
+  GtAllocShimCounts counts;
+};
+
+/* Look up the shim, if it has been preloaded. This is only done once, as the
+ * shim can’t be loaded later. */
+static GtAllocShimGetCountsFunc
+get_shim_func (void)
+{
+  static gsize shim_func = 0;
+
+  if (g_once_init_enter (&shim_func))
+    {
+      gpointer sym = NULL;
+
+#ifdef HAVE_DLSYM
+      sym = dlsym (RTLD_DEFAULT, GT_ALLOC_SHIM_GET_COUNTS_SYMBOL);
+#endif
+
+      /* Use 1 to mean ‘not found’, as g_once_init_leave() needs a non-zero
+       * value. */
+      g_once_init_leave (&shim_func, (sym != NULL) ? GPOINTER_TO_SIZE (sym) : 1);
+    }
+
+  return (shim_func != 1) ? (GtAllocShimGetCountsFunc) GSIZE_TO_POINTER (shim_func) : NULL;
+}
+
+static void
+read_counts (GtAllocTracker    *self,
+             GtAllocShimCounts *out_counts)
+{
+  switch (self->backend)
+    {
+    case GT_ALLOC_TRACKER_BACKEND_SHIM:
+      self->get_counts (self->scope == GT_ALLOC_TRACKER_SCOPE_THREAD, out_counts);
+      break;
+    case GT_ALLOC_TRACKER_BACKEND_MALLINFO:
+      {
+        out_counts->n_allocs = 0;
+        out_counts->n_frees = 0;
+#ifdef HAVE_MALLINFO2
+        struct mallinfo2 info = mallinfo2 ();
+        out_counts->n_bytes = info.uordblks + info.hblkhd;
+#else
+        g_assert_not_reached ();
+#endif
+        break;
+      }
+    case GT_ALLOC_TRACKER_BACKEND_NONE:
+      out_counts->n_allocs = 0;
+      out_counts->n_frees = 0;
+      out_counts->n_bytes = 0;
+      break;
+    default:
+      g_assert_not_reached ();
+    }
+}
+
+/* Get the difference between @start and @end, according to the backend. The
+ * mallinfo backend measures bytes in use, which can shrink. */
+static void
+diff_counts (const GtAllocShimCounts *start,
+             const GtAllocShimCounts *end,
+             GtAllocShimCounts       *out_counts)
+{
+  out_counts->n_allocs = end->n_allocs - start->n_allocs;
+  out_counts->n_frees = end->n_frees - start->n_frees;
+  out_counts->n_bytes = (end->n_bytes > start->n_bytes) ? end->n_bytes - start->n_bytes : 0;
+}
+
+/* Get the counts so far: live ones if the tracker is still running and this
+ * is the thread it’s tracking, or the final ones if it’s stopped. */
+static void
+get_counts (GtAllocTracker    *self,
+            GtAllocShimCounts *out_counts)
+{
+  if (self->running &&
+      (self->scope == GT_ALLOC_TRACKER_SCOPE_PROCESS ||
+       self->thread == g_thread_self ()))
+    {
+      GtAllocShimCounts now;
+
+      read_counts (self, &now);
+      diff_counts (&self->start_counts, &now, out_counts);
+    }
+  else
+    {
+      *out_counts = self->counts;
+    }
+}
+
+/**
+ * gt_alloc_tracker_new:
+ * @scope: which allocations to count
+ *
+ * Create a new #GtAllocTracker. It does not count anything until
+ * gt_alloc_tracker_start() is called.
+ *
+ * If the allocation shim is not loaded, per-thread counts are not available,
+ * and %GT_ALLOC_TRACKER_SCOPE_THREAD behaves like
+ * %GT_ALLOC_TRACKER_SCOPE_PROCESS.
+ *
+ * Returns: (transfer full): a new #GtAllocTracker
+ * Since: 0.2.0
+ */
+GtAllocTracker *
+gt_alloc_tracker_new (GtAllocTrackerScope scope)
+{
+  g_autoptr(GtAllocTracker) self = g_new0 (GtAllocTracker, 1);
+
+  self->scope = scope;
+  self->get_counts = get_shim_func ();
+
+  self->backend = (self->get_counts != NULL) ? GT_ALLOC_TRACKER_BACKEND_SHIM : FALLBACK_BACKEND;
+
+  return g_steal_pointer (&self);
+}
+
+/**
+ * gt_alloc_tracker_free:
+ * @self: (transfer full): a #GtAllocTracker
+ *
+ * Free a #GtAllocTracker.
+ *
+ * Since: 0.2.0
+ */
+void
+gt_alloc_tracker_free (GtAllocTracker *self)
+{
+  g_return_if_fail (self != NULL);
+
+  g_free (self);
+}
+
+/**
+ * gt_alloc_tracker_get_backend:
+ * @self: a #GtAllocTracker
+ *
+ * Get the mechanism @self uses to track allocations.
+ *
+ * Returns: the backend in use
+ * Since: 0.2.0
+ */
+GtAllocTrackerBackend
+gt_alloc_tracker_get_backend (GtAllocTracker *self)
+{
+  g_return_val_if_fail (self != NULL, GT_ALLOC_TRACKER_BACKEND_NONE);
+
+  return self->backend;
+}
+
+/**
+ * gt_alloc_tracker_start:
+ * @self: a #GtAllocTracker
+ *
+ * Reset the counts to zero and start counting allocations. With
+ * %GT_ALLOC_TRACKER_SCOPE_THREAD, allocations made by the calling thread are
+ * counted, and gt_alloc_tracker_stop() must be called from the same thread.
+ *
+ * Since: 0.2.0
+ */
+void
+gt_alloc_tracker_start (GtAllocTracker *self)
+{
+  g_return_if_fail (self != NULL);
+  g_return_if_fail (!self->running);
+
+  self->running = TRUE;
+  self->thread = g_thread_self ();
+  read_counts (self, &self->start_counts);
+}
+
+/**
+ * gt_alloc_tracker_stop:
+ * @self: a #GtAllocTracker
+ *
+ * Stop counting allocations. The counts can then be read using
+ * gt_alloc_tracker_get_n_allocs() and similar, or checked using
+ * gt_assert_allocs_at_most().
+ *
+ * Since: 0.2.0
+ */
+void
+gt_alloc_tracker_stop (GtAllocTracker *self)
+{
+  GtAllocShimCounts now;
+
+  g_return_if_fail (self != NULL);
+  g_return_if_fail (self->running);
+  g_return_if_fail (self->scope == GT_ALLOC_TRACKER_SCOPE_PROCESS ||
+                    self->thread == g_thread_self ());
+
+  read_counts (self, &now);
+  diff_counts (&self->start_counts, &now, &self->counts);
+  self->running = FALSE;
+}
+
+/**
+ * gt_alloc_tracker_get_n_allocs:
+ * @self: a #GtAllocTracker
+ *
+ * Get the number of allocations made since gt_alloc_tracker_start() was
+ * called, including calls to `realloc()`. This is only available with
+ * %GT_ALLOC_TRACKER_BACKEND_SHIM; otherwise it is always zero.
+ *
+ * Returns: number of allocations
+ * Since: 0.2.0
+ */
+guint64
+gt_alloc_tracker_get_n_allocs (GtAllocTracker *self)
+{
+  GtAllocShimCounts counts;
+
+  g_return_val_if_fail (self != NULL, 0);
+
+  get_counts (self, &counts);
+  return counts.n_allocs;
+}
+
+/**
+ * gt_alloc_tracker_get_n_frees:
+ * @self: a #GtAllocTracker
+ *
+ * Get the number of blocks freed since gt_alloc_tracker_start() was called.
+ * This is only available with %GT_ALLOC_TRACKER_BACKEND_SHIM; otherwise it is
+ * always zero.
+ *
+ * Returns: number of frees
+ * Since: 0.2.0
+ */
+guint64
+gt_alloc_tracker_get_n_frees (GtAllocTracker *self)
+{
+  GtAllocShimCounts counts;
+
+  g_return_val_if_fail (self != NULL, 0);
+
+  get_counts (self, &counts);
+  return counts.n_frees;
+}
+
+/**
+ * gt_alloc_tracker_get_n_bytes:
+ * @self: a #GtAllocTracker
+ *
+ * Get the number of bytes allocated since gt_alloc_tracker_start() was
+ * called. With %GT_ALLOC_TRACKER_BACKEND_SHIM, this is the total size of all
+ * the allocations, regardless of whether they have since been freed. With
+ * %GT_ALLOC_TRACKER_BACKEND_MALLINFO, it is the net growth in the number of
+ * bytes in use by the process (or zero if that has shrunk).
+ *
+ * Returns: number of bytes allocated
+ * Since: 0.2.0
+ */
+guint64
+gt_alloc_tracker_get_n_bytes (GtAllocTracker *self)
+{
+  GtAllocShimCounts counts;
+
+  g_return_val_if_fail (self != NULL, 0);
+
+  get_counts (self, &counts);
+  return counts.n_bytes;
+}
+
+/**
+ * gt_alloc_tracker_format:
+ * @self: a #GtAllocTracker
+ *
+ * Format the counts from @self in a human readable form, typically for
+ * logging them to some debug output. The returned string does not end in a
+ * newline character (`\n`).
+ *
+ * Returns: (transfer full): human readable counts
+ * Since: 0.2.0
+ */
+gchar *
+gt_alloc_tracker_format (GtAllocTracker *self)
+{
+  GtAllocShimCounts counts;
+
+  g_return_val_if_fail (self != NULL, NULL);
+
+  get_counts (self, &counts);
+
+  switch (self->backend)
+    {
+    case GT_ALLOC_TRACKER_BACKEND_SHIM:
+      return g_strdup_printf ("%" G_GUINT64_FORMAT " allocations, "
+                              "%" G_GUINT64_FORMAT " frees, "
+                              "%" G_GUINT64_FORMAT " bytes allocated",
+                              counts.n_allocs, counts.n_frees, counts.n_bytes);
+    case GT_ALLOC_TRACKER_BACKEND_MALLINFO:
+      return g_strdup_printf ("%" G_GUINT64_FORMAT " bytes net growth in use "
+                              "by the process (allocation shim not loaded)",
+                              counts.n_bytes);
+    case GT_ALLOC_TRACKER_BACKEND_NONE:
+      return g_strdup ("Allocation tracking not available");
+    default:
+      g_assert_not_reached ();
+    }
+}
+
+/**
+ * gt_alloc_tracker_assert_allocs_at_most_impl:
+ * @self: a #GtAllocTracker
+ * @macro_log_domain: #G_LOG_DOMAIN from the call site
+ * @macro_file: C file containing the call site
+ * @macro_line: line number of the call site
+ * @macro_function: function containing the call site
+ * @max_allocs: maximum number of allocations expected
+ *
+ * Internal function which implements the gt_assert_allocs_at_most() macro.
+ *
+ * Since: 0.2.0
+ */
+void
+gt_alloc_tracker_assert_allocs_at_most_impl (GtAllocTracker *self,
+                                             const gchar    *macro_log_domain,
+                                             const gchar    *macro_file,
+                                             gint            macro_line,
+                                             const gchar    *macro_function,
+                                             guint64         max_allocs)
+{
+  GtAllocShimCounts counts;
+  gboolean exceeded;
+
+  g_return_if_fail (self != NULL);
+  g_return_if_fail (macro_file != NULL);
+  g_return_if_fail (macro_line >= 0);
+  g_return_if_fail (macro_function != NULL);
+
+  get_counts (self, &counts);
+
+  switch (self->backend)
+    {
+    case GT_ALLOC_TRACKER_BACKEND_SHIM:
+      exceeded = (counts.n_allocs > max_allocs);
+      break;
+    case GT_ALLOC_TRACKER_BACKEND_MALLINFO:
+      /* Individual allocations can’t be counted, but growth in the bytes in
+       * use means there must have been at least one. */
+      exceeded = (max_allocs == 0 && counts.n_bytes > 0);
+      break;
+    case GT_ALLOC_TRACKER_BACKEND_NONE:
+      exceeded = FALSE;
+      break;
+    default:
+      g_assert_not_reached ();
+    }
+
+  if (exceeded)
+    {
+      g_autofree gchar *formatted = gt_alloc_tracker_format (self);
+      g_autofree gchar *message =
+          g_strdup_printf ("Expected at most %" G_GUINT64_FORMAT " allocations, "
+                           "but saw: %s", max_allocs, formatted);
+      g_assertion_message (macro_log_domain, macro_file, macro_line,
+                           macro_function, message);
+    }
+}
+
+/**
+ * gt_alloc_tracker_assert_alloc_bytes_at_most_impl:
+ * @self: a #GtAllocTracker
+ * @macro_log_domain: #G_LOG_DOMAIN from the call site
+ * @macro_file: C file containing the call site
+ * @macro_line: line number of the call site
+ * @macro_function: function containing the call site
+ * @max_bytes: maximum number of bytes expected to be allocated
+ *
+ * Internal function which implements the gt_assert_alloc_bytes_at_most()
+ * macro.
+ *
+ * Since: 0.2.0
+ */
+void
+gt_alloc_tracker_assert_alloc_bytes_at_most_impl (GtAllocTracker *self,
+                                                  const gchar    *macro_log_domain,
+                                                  const gchar    *macro_file,
+                                                  gint            macro_line,
+                                                  const gchar    *macro_function,
+                                                  guint64         max_bytes)
+{
+  GtAllocShimCounts counts;
+
+  g_return_if_fail (self != NULL);
+  g_return_if_fail (macro_file != NULL);
+  g_return_if_fail (macro_line >= 0);
+  g_return_if_fail (macro_function != NULL);
+
+  get_counts (self, &counts);
+
+  if (counts.n_bytes > max_bytes)
+    {
+      g_autofree gchar *formatted = gt_alloc_tracker_format (self);
+      g_autofree gchar *message =
+          g_strdup_printf ("Expected at most %" G_GUINT64_FORMAT " bytes to be "
+                           "allocated, but saw: %s", max_bytes, formatted);
+      g_assertion_message (macro_log_domain, macro_file, macro_line,
+                           macro_function, message);
+    }
+}
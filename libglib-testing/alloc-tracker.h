@@ -0,0 +1,138 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ *
+ * Copyright © 2018 Endless Mobile, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#pragma once
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/**
+ * GtAllocTrackerScope:
+ * @GT_ALLOC_TRACKER_SCOPE_THREAD: count allocations made by the thread which
+ *    calls gt_alloc_tracker_start()
+ * @GT_ALLOC_TRACKER_SCOPE_PROCESS: count allocations made by all threads in
+ *    the process
+ *
+ * Which allocations a #GtAllocTracker counts.
+ *
+ * Since: 0.2.0
+ */
+typedef enum
+{
+  GT_ALLOC_TRACKER_SCOPE_THREAD,
+  GT_ALLOC_TRACKER_SCOPE_PROCESS,
+} GtAllocTrackerScope;
+
+/**
+ * GtAllocTrackerBackend:
+ * @GT_ALLOC_TRACKER_BACKEND_NONE: allocations cannot be tracked on this
+ *    platform
+ * @GT_ALLOC_TRACKER_BACKEND_MALLINFO: only the net change in the number of
+ *    bytes in use by the whole process can be tracked, using `mallinfo2()`
+ * @GT_ALLOC_TRACKER_BACKEND_SHIM: individual allocations are counted by the
+ *    allocation shim, which has been loaded using `LD_PRELOAD`
+ *
+ * The mechanism a #GtAllocTracker uses to track allocations, which determines
+ * how precise it can be.
+ *
+ * Since: 0.2.0
+ */
+typedef enum
+{
+  GT_ALLOC_TRACKER_BACKEND_NONE,
+  GT_ALLOC_TRACKER_BACKEND_MALLINFO,
+  GT_ALLOC_TRACKER_BACKEND_SHIM,
+} GtAllocTrackerBackend;
+
+typedef struct _GtAllocTracker GtAllocTracker;
+
+GtAllocTracker *gt_alloc_tracker_new  (GtAllocTrackerScope scope);
+void            gt_alloc_tracker_free (GtAllocTracker     *self);
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC (GtAllocTracker, gt_alloc_tracker_free)
+
+GtAllocTrackerBackend gt_alloc_tracker_get_backend (GtAllocTracker *self);
+
+void    gt_alloc_tracker_start         (GtAllocTracker *self);
+void    gt_alloc_tracker_stop          (GtAllocTracker *self);
+guint64 gt_alloc_tracker_get_n_allocs  (GtAllocTracker *self);
+guint64 gt_alloc_tracker_get_n_frees   (GtAllocTracker *self);
+guint64 gt_alloc_tracker_get_n_bytes   (GtAllocTracker *self);
+gchar  *gt_alloc_tracker_format        (GtAllocTracker *self);
+
+/**
+ * gt_assert_allocs_at_most:
+ * @self: a #GtAllocTracker
+ * @max_allocs: maximum number of allocations expected
+ *
+ * Assert that at most @max_allocs allocations have been made in the scope
+ * tracked by @self.
+ *
+ * If the allocation shim is not loaded, individual allocations cannot be
+ * counted. With %GT_ALLOC_TRACKER_BACKEND_MALLINFO, and if @max_allocs is
+ * zero, this instead asserts that the number of bytes in use by the process
+ * has not grown. That can’t prove that no allocations were made, but will
+ * catch most leaks and caches. Otherwise, the assertion always passes.
+ *
+ * If the assertion fails, the counts are printed.
+ *
+ * Since: 0.2.0
+ */
+#define gt_assert_allocs_at_most(self, max_allocs) \
+  gt_alloc_tracker_assert_allocs_at_most_impl (self, G_LOG_DOMAIN, __FILE__, \
+                                               __LINE__, G_STRFUNC, \
+                                               max_allocs)
+
+/**
+ * gt_assert_alloc_bytes_at_most:
+ * @self: a #GtAllocTracker
+ * @max_bytes: maximum number of bytes expected to be allocated
+ *
+ * Assert that at most @max_bytes bytes have been allocated in the scope
+ * tracked by @self. See gt_alloc_tracker_get_n_bytes() for what that means
+ * with each #GtAllocTrackerBackend.
+ *
+ * If the assertion fails, the counts are printed.
+ *
+ * Since: 0.2.0
+ */
+#define gt_assert_alloc_bytes_at_most(self, max_bytes) \
+  gt_alloc_tracker_assert_alloc_bytes_at_most_impl (self, G_LOG_DOMAIN, \
+                                                    __FILE__, __LINE__, \
+                                                    G_STRFUNC, max_bytes)
+
+/* Private implementations of the assertion functions above. */
+
+/*< private >*/
+void gt_alloc_tracker_assert_allocs_at_most_impl      (GtAllocTracker *self,
+                                                       const gchar    *macro_log_domain,
+                                                       const gchar    *macro_file,
+                                                       gint            macro_line,
+                                                       const gchar    *macro_function,
+                                                       guint64         max_allocs);
+void gt_alloc_tracker_assert_alloc_bytes_at_most_impl (GtAllocTracker *self,
+                                                       const gchar    *macro_log_domain,
+                                                       const gchar    *macro_file,
+                                                       gint            macro_line,
+                                                       const gchar    *macro_function,
+                                                       guint64         max_bytes);
+
+G_END_DECLS
@@ -0,0 +1,702 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ *
+ * Copyright © 2018 Endless Mobile, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#include "config.h"
+
+#include <gio/gio.h>
+#include <glib.h>
+#include <glib-object.h>
+#include <libglib-testing/async-tracker.h>
+#include <libglib-testing/object-tracker.h>
+#include <libglib-testing/object-tracker-private.h>
+#include <libglib-testing/symbols-private.h>
+
+
+/**
+ * SECTION:async-tracker
+ * @short_description: Tracker for in-flight asynchronous operations
+ * @stability: Unstable
+ * @include: libglib-testing/async-tracker.h
+ *
+ * #GtAsyncTracker counts the asynchronous operations which are in flight while
+ * it exists, so that a test can wait for all the asynchronous work started by
+ * the code under test to finish, using gt_async_tracker_wait_idle(), rather
+ * than iterating the main context an arbitrary number of times or sleeping.
+ *
+ * Every #GTask created while the tracker exists, in any thread, is tracked
+ * automatically, from its creation until it completes (see
+ * #GTask:completed) or is finalized. Tasks are identified by their source tag
+ * (see g_task_set_source_tag()), so code under test should set one for
+ * diagnostics to be useful.
+ *
+ * Operations which are not implemented using #GTask can be tracked if they are
+ * scoped to a #GCancellable: pass the cancellable to
+ * gt_async_tracker_track_cancellable(), and the operation is considered to be
+ * in flight until the cancellable is cancelled or finalized.
+ *
+ * Any operation which is in flight for longer than the slow threshold (see
+ * gt_async_tracker_set_slow_threshold()) is recorded as slow, and can be
+ * listed using gt_async_tracker_format() or asserted against using
+ * gt_async_tracker_assert_no_slow_operations().
+ *
+ * A #GtAsyncTracker must not be freed while tracked operations could be
+ * starting or completing in other threads.
+ *
+ * Since: 0.2.0
+ */
+
+/**
+ * GtAsyncTracker:
+ *
+ * A tracker for in-flight asynchronous operations.
+ *
+ * Since: 0.2.0
+ */
+struct _GtAsyncTracker
+{
+  GtObjectTracker *task_tracker;  /* (owned) */
+
+  GMutex lock;
+  GHashTable *in_flight;  /* (owned) (element-type GObject Operation) (locked-by lock) */
+  guint n_completed;  /* (locked-by lock) */
+  guint slow_threshold_ms;  /* (locked-by lock) */
+  GPtrArray *slow_operations;  /* (owned) (element-type SlowOperation) (locked-by lock) */
+  GPtrArray *waiting_contexts;  /* (owned) (element-type GMainContext) (locked-by lock) */
+};
+
+/* An operation which is in flight. */
+typedef struct
+{
+  GtAsyncTracker *tracker;  /* (unowned) */
+  GObject *obj;  /* (unowned); a #GTask or #GCancellable */
+  gboolean is_task;
+  gchar *name;  /* (owned) (nullable); only for cancellables */
+  gint64 start_time;  /* monotonic, in microseconds */
+  gulong handler_id;
+  gboolean setting_up;  /* (locked-by tracker->lock) */
+  gboolean finished_during_setup;  /* (locked-by tracker->lock) */
+} Operation;
+
+/* An operation which was in flight for longer than the slow threshold. */
+typedef struct
+{
+  gchar *description;  /* (owned) */
+  gint64 duration;  /* in microseconds */
+} SlowOperation;
+
+static void
+operation_free (Operation *op)
+{
+  g_free (op->name);
+  g_free (op);
+}
+
+static void
+slow_operation_free (SlowOperation *slow)
+{
+  g_free (slow->description);
+  g_free (slow);
+}
+
+/* Describe @op for showing to the user. Its object must still be alive, though
+ * it may be being disposed. */
+static gchar *
+operation_dup_description (const Operation *op)
+{
+  gpointer source_tag;
+  g_autofree gchar *tag_name = NULL;
+
+  if (!op->is_task)
+    return g_strdup_printf ("GCancellable %p (%s)", op->obj,
+                            (op->name != NULL) ? op->name : "unnamed");
+
+  source_tag = g_task_get_source_tag (G_TASK (op->obj));
+  if (source_tag == NULL)
+    return g_strdup_printf ("GTask %p (no source tag)", op->obj);
+
+  tag_name = gt_symbol_dup_name (source_tag);
+
+  return g_strdup_printf ("GTask %p (%s)", op->obj, tag_name);
+}
+
+/* Stop tracking the operation for @obj, recording whether it was slow, and
+ * wake up anything waiting for the tracker to become idle. Returns the
+ * #Operation, which the caller must free, or %NULL if it was not being
+ * tracked (because it had already finished). If the operation is still being
+ * set up by gt_async_tracker_add_operation(), %NULL is returned and that
+ * function frees it instead. */
+static Operation *
+gt_async_tracker_finish_operation (GtAsyncTracker *self,
+                                   GObject        *obj)
+{
+  Operation *op;
+  gint64 duration;
+
+  g_mutex_lock (&self->lock);
+
+  op = g_hash_table_lookup (self->in_flight, obj);
+  if (op == NULL)
+    {
+      g_mutex_unlock (&self->lock);
+      return NULL;
+    }
+
+  g_hash_table_steal (self->in_flight, obj);
+  self->n_completed++;
+
+  duration = g_get_monotonic_time () - op->start_time;
+  if (duration > (gint64) self->slow_threshold_ms * 1000)
+    {
+      SlowOperation *slow = g_new0 (SlowOperation, 1);
+      slow->description = operation_dup_description (op);
+      slow->duration = duration;
+      g_ptr_array_add (self->slow_operations, slow);
+    }
+
+  for (gsize i = 0; i < self->waiting_contexts->len; i++)
+    g_main_context_wakeup (g_ptr_array_index (self->waiting_contexts, i));
+
+  if (op->setting_up)
+    {
+      op->finished_during_setup = TRUE;
+      op = NULL;
+    }
+
+  g_mutex_unlock (&self->lock);
+
+  return op;
+}
+
+static void
+operation_finalized_cb (gpointer  user_data,
+                        GObject  *where_the_object_was)
+{
+  Operation *op = user_data;
+  Operation *finished_op;
+
+  /* The object can no longer complete, so stop waiting for it. Its signal
+   * handlers are disconnected automatically. */
+  finished_op = gt_async_tracker_finish_operation (op->tracker, where_the_object_was);
+  g_assert (finished_op == NULL || finished_op == op);
+
+  if (finished_op != NULL)
+    operation_free (finished_op);
+}
+
+/* Called when the operation for @obj completes, from whichever thread it
+ * completed in. The #Operation is only looked up with the lock held, as it may
+ * be freed concurrently by operation_finalized_cb(). */
+static void
+operation_completed (GtAsyncTracker *self,
+                     GObject        *obj)
+{
+  Operation *finished_op;
+
+  finished_op = gt_async_tracker_finish_operation (self, obj);
+
+  if (finished_op == NULL)
+    return;
+
+  g_signal_handler_disconnect (obj, finished_op->handler_id);
+  g_object_weak_unref (obj, operation_finalized_cb, finished_op);
+  operation_free (finished_op);
+}
+
+static void
+task_completed_cb (GObject    *obj,
+                   GParamSpec *pspec,
+                   gpointer    user_data)
+{
+  GtAsyncTracker *self = user_data;
+
+  if (g_task_get_completed (G_TASK (obj)))
+    operation_completed (self, obj);
+}
+
+static void
+cancellable_cancelled_cb (GCancellable *cancellable,
+                          gpointer      user_data)
+{
+  GtAsyncTracker *self = user_data;
+
+  operation_completed (self, G_OBJECT (cancellable));
+}
+
+/* Start tracking an operation for @obj, which finishes when the #GTask
+ * completes or the #GCancellable is cancelled, or when @obj is finalized. The
+ * caller must hold a reference to @obj.
+ *
+ * The operation is added to the in-flight table in the same critical section
+ * as checking it is not already tracked, before connecting to @obj, so
+ * concurrent calls cannot both track it and a completion cannot be missed. If
+ * it completes (in any thread) before setup is finished,
+ * gt_async_tracker_finish_operation() leaves it to be freed here. */
+static void
+gt_async_tracker_add_operation (GtAsyncTracker *self,
+                                GObject        *obj,
+                                gboolean        is_task,
+                                const gchar    *name)
+{
+  Operation *op;
+  gulong handler_id;
+  gboolean finished_during_setup;
+
+  op = g_new0 (Operation, 1);
+  op->tracker = self;
+  op->obj = obj;
+  op->is_task = is_task;
+  op->name = g_strdup (name);
+  op->start_time = g_get_monotonic_time ();
+  op->setting_up = TRUE;
+
+  g_mutex_lock (&self->lock);
+  if (g_hash_table_contains (self->in_flight, obj))
+    {
+      g_mutex_unlock (&self->lock);
+      operation_free (op);
+      return;
+    }
+  g_hash_table_insert (self->in_flight, obj, op);
+  g_mutex_unlock (&self->lock);
+
+  g_object_weak_ref (obj, operation_finalized_cb, op);
+
+  /* g_cancellable_connect() calls the callback immediately (and returns 0) if
+   * the cancellable is already cancelled. */
+  if (is_task)
+    handler_id = g_signal_connect (obj, "notify::completed",
+                                   G_CALLBACK (task_completed_cb), self);
+  else
+    handler_id = g_cancellable_connect (G_CANCELLABLE (obj),
+                                        G_CALLBACK (cancellable_cancelled_cb),
+                                        self, NULL);
+
+  g_mutex_lock (&self->lock);
+  op->handler_id = handler_id;
+  op->setting_up = FALSE;
+  finished_during_setup = op->finished_during_setup;
+  g_mutex_unlock (&self->lock);
+
+  if (finished_during_setup)
+    {
+      if (handler_id != 0)
+        g_signal_handler_disconnect (obj, handler_id);
+      g_object_weak_unref (obj, operation_finalized_cb, op);
+      operation_free (op);
+    }
+}
+
+static void
+task_created_cb (GObject  *obj,
+                 gpointer  user_data)
+{
+  GtAsyncTracker *self = user_data;
+
+  gt_async_tracker_add_operation (self, obj, TRUE, NULL);
+}
+
+/**
+ * gt_async_tracker_new:
+ *
+ * Create a new #GtAsyncTracker, and start tracking all the #GTasks which are
+ * created from now on. The slow threshold defaults to 1000ms.
+ *
+ * Returns: (transfer full): a new #GtAsyncTracker
+ * Since: 0.2.0
+ */
+GtAsyncTracker *
+gt_async_tracker_new (void)
+{
+  g_autoptr(GtAsyncTracker) self = g_new0 (GtAsyncTracker, 1);
+
+  g_mutex_init (&self->lock);
+  self->in_flight = g_hash_table_new (NULL, NULL);
+  self->slow_threshold_ms = 1000;
+  self->slow_operations = g_ptr_array_new_with_free_func ((GDestroyNotify) slow_operation_free);
+  self->waiting_contexts = g_ptr_array_new_with_free_func ((GDestroyNotify) g_main_context_unref);
+
+  self->task_tracker = gt_object_tracker_new ();
+  gt_object_tracker_set_created_func (self->task_tracker, task_created_cb, self);
+  gt_object_tracker_track_type (self->task_tracker, G_TYPE_TASK);
+
+  return g_steal_pointer (&self);
+}
+
+/**
+ * gt_async_tracker_free:
+ * @self: (transfer full): a #GtAsyncTracker
+ *
+ * Free a #GtAsyncTracker. Any operations which are still in flight stop being
+ * tracked.
+ *
+ * Since: 0.2.0
+ */
+void
+gt_async_tracker_free (GtAsyncTracker *self)
+{
+  g_autoptr(GPtrArray) ops = NULL;
+  GHashTableIter iter;
+  Operation *op;
+
+  g_return_if_fail (self != NULL);
+
+  /* Stop tracking new tasks. */
+  g_clear_pointer (&self->task_tracker, gt_object_tracker_free);
+
+  ops = g_ptr_array_new_with_free_func ((GDestroyNotify) operation_free);
+
+  g_mutex_lock (&self->lock);
+  g_hash_table_iter_init (&iter, self->in_flight);
+  while (g_hash_table_iter_next (&iter, NULL, (gpointer *) &op))
+    {
+      g_ptr_array_add (ops, op);
+      g_hash_table_iter_steal (&iter);
+    }
+  g_mutex_unlock (&self->lock);
+
+  /* Remove the weak refs without holding the lock, as weak notify callbacks
+   * take it. */
+  for (gsize i = 0; i < ops->len; i++)
+    {
+      op = g_ptr_array_index (ops, i);
+      g_signal_handler_disconnect (op->obj, op->handler_id);
+      g_object_weak_unref (op->obj, operation_finalized_cb, op);
+    }
+
+  g_assert (self->waiting_contexts->len == 0);
+  g_clear_pointer (&self->waiting_contexts, g_ptr_array_unref);
+  g_clear_pointer (&self->slow_operations, g_ptr_array_unref);
+  g_clear_pointer (&self->in_flight, g_hash_table_unref);
+  g_mutex_clear (&self->lock);
+
+  g_free (self);
+}
+
+/**
+ * gt_async_tracker_track_cancellable:
+ * @self: a #GtAsyncTracker
+ * @cancellable: a #GCancellable which scopes an operation
+ * @name: (nullable): name of the operation, for diagnostics
+ *
+ * Track an operation which is scoped to @cancellable. It is considered to be in
+ * flight until @cancellable is cancelled or finalized. This is for operations
+ * which are not implemented using #GTask, whose owner keeps a #GCancellable
+ * for as long as they are running.
+ *
+ * If @cancellable is already cancelled, the operation completes immediately.
+ * If @cancellable is already being tracked, nothing more is tracked.
+ *
+ * Since: 0.2.0
+ */
+void
+gt_async_tracker_track_cancellable (GtAsyncTracker *self,
+                                    GCancellable   *cancellable,
+                                    const gchar    *name)
+{
+  g_return_if_fail (self != NULL);
+  g_return_if_fail (G_IS_CANCELLABLE (cancellable));
+
+  gt_async_tracker_add_operation (self, G_OBJECT (cancellable), FALSE, name);
+}
+
+/**
+ * gt_async_tracker_set_slow_threshold:
+ * @self: a #GtAsyncTracker
+ * @threshold_ms: slow threshold, in milliseconds
+ *
+ * Set how long an operation may be in flight for before it is recorded as
+ * slow. This only affects operations which finish after it is changed. The
+ * default is 1000ms.
+ *
+ * Since: 0.2.0
+ */
+void
+gt_async_tracker_set_slow_threshold (GtAsyncTracker *self,
+                                     guint           threshold_ms)
+{
+  g_return_if_fail (self != NULL);
+
+  g_mutex_lock (&self->lock);
+  self->slow_threshold_ms = threshold_ms;
+  g_mutex_unlock (&self->lock);
+}
+
+/**
+ * gt_async_tracker_get_n_in_flight:
+ * @self: a #GtAsyncTracker
+ *
+ * Get the number of tracked operations which are currently in flight.
+ *
+ * This may be called from any thread.
+ *
+ * Returns: number of in-flight operations
+ * Since: 0.2.0
+ */
+guint
+gt_async_tracker_get_n_in_flight (GtAsyncTracker *self)
+{
+  guint n_in_flight;
+
+  g_return_val_if_fail (self != NULL, 0);
+
+  g_mutex_lock (&self->lock);
+  n_in_flight = g_hash_table_size (self->in_flight);
+  g_mutex_unlock (&self->lock);
+
+  return n_in_flight;
+}
+
+/**
+ * gt_async_tracker_get_n_completed:
+ * @self: a #GtAsyncTracker
+ *
+ * Get the number of tracked operations which have completed (or whose
+ * #GTask or #GCancellable was finalized before they completed).
+ *
+ * This may be called from any thread.
+ *
+ * Returns: number of completed operations
+ * Since: 0.2.0
+ */
+guint
+gt_async_tracker_get_n_completed (GtAsyncTracker *self)
+{
+  guint n_completed;
+
+  g_return_val_if_fail (self != NULL, 0);
+
+  g_mutex_lock (&self->lock);
+  n_completed = self->n_completed;
+  g_mutex_unlock (&self->lock);
+
+  return n_completed;
+}
+
+/* Count the in-flight operations which have already been in flight for longer
+ * than the slow threshold. */
+static guint
+gt_async_tracker_count_slow_in_flight_locked (GtAsyncTracker *self,
+                                              gint64          now)
+{
+  GHashTableIter iter;
+  Operation *op;
+  guint n_slow = 0;
+
+  g_hash_table_iter_init (&iter, self->in_flight);
+  while (g_hash_table_iter_next (&iter, NULL, (gpointer *) &op))
+    {
+      if (now - op->start_time > (gint64) self->slow_threshold_ms * 1000)
+        n_slow++;
+    }
+
+  return n_slow;
+}
+
+/**
+ * gt_async_tracker_get_n_slow:
+ * @self: a #GtAsyncTracker
+ *
+ * Get the number of tracked operations which have been in flight for longer
+ * than the slow threshold (see gt_async_tracker_set_slow_threshold()). This
+ * includes both completed operations and those still in flight.
+ *
+ * This may be called from any thread.
+ *
+ * Returns: number of slow operations
+ * Since: 0.2.0
+ */
+guint
+gt_async_tracker_get_n_slow (GtAsyncTracker *self)
+{
+  guint n_slow;
+
+  g_return_val_if_fail (self != NULL, 0);
+
+  g_mutex_lock (&self->lock);
+  n_slow = self->slow_operations->len +
+           gt_async_tracker_count_slow_in_flight_locked (self, g_get_monotonic_time ());
+  g_mutex_unlock (&self->lock);
+
+  return n_slow;
+}
+
+/* A source which becomes ready at a given real time. Unlike a timeout source,
+ * it is not affected by a #GtVirtualClock on the context. */
+static gboolean
+deadline_source_dispatch (GSource     *source,
+                          GSourceFunc  callback,
+                          gpointer     user_data)
+{
+  g_source_set_ready_time (source, -1);
+
+  return callback (user_data);
+}
+
+static GSourceFuncs deadline_source_funcs =
+{
+  NULL,
+  NULL,
+  deadline_source_dispatch,
+  NULL,
+  NULL,
+  NULL,
+};
+
+static gboolean
+deadline_cb (gpointer user_data)
+{
+  gboolean *timed_out = user_data;
+
+  *timed_out = TRUE;
+
+  return G_SOURCE_REMOVE;
+}
+
+/**
+ * gt_async_tracker_wait_idle:
+ * @self: a #GtAsyncTracker
+ * @context: (nullable): a #GMainContext to iterate, or %NULL to use the global
+ *    default main context
+ * @timeout_ms: maximum time to wait, in milliseconds
+ *
+ * Iterate @context until none of the operations tracked by @self are in
+ * flight, or until @timeout_ms has elapsed. The operations may complete in
+ * @context or in any other thread.
+ *
+ * The timeout is in real time, so is not affected by a #GtVirtualClock
+ * installed on @context.
+ *
+ * @context must be owned by, or acquirable by, the calling thread.
+ *
+ * Returns: %TRUE if no operations are in flight, %FALSE if the timeout was
+ *    reached first
+ * Since: 0.2.0
+ */
+gboolean
+gt_async_tracker_wait_idle (GtAsyncTracker *self,
+                            GMainContext   *context,
+                            guint           timeout_ms)
+{
+  g_autoptr(GSource) deadline_source = NULL;
+  gboolean timed_out = FALSE;
+  gboolean idle;
+
+  g_return_val_if_fail (self != NULL, FALSE);
+
+  if (context == NULL)
+    context = g_main_context_default ();
+
+  deadline_source = g_source_new (&deadline_source_funcs, sizeof (GSource));
+  g_source_set_callback (deadline_source, deadline_cb, &timed_out, NULL);
+  g_source_set_ready_time (deadline_source,
+                           g_get_monotonic_time () + (gint64) timeout_ms * 1000);
+  g_source_set_name (deadline_source, "GtAsyncTracker deadline");
+  g_source_attach (deadline_source, context);
+
+  g_mutex_lock (&self->lock);
+
+  while (g_hash_table_size (self->in_flight) > 0 && !timed_out)
+    {
+      /* Register @context to be woken up when an operation finishes in another
+       * thread, and block until then. */
+      g_ptr_array_add (self->waiting_contexts, g_main_context_ref (context));
+      g_mutex_unlock (&self->lock);
+
+      g_main_context_iteration (context, TRUE);
+
+      g_mutex_lock (&self->lock);
+      g_ptr_array_remove (self->waiting_contexts, context);
+    }
+
+  idle = (g_hash_table_size (self->in_flight) == 0);
+
+  g_mutex_unlock (&self->lock);
+
+  g_source_destroy (deadline_source);
+
+  return idle;
+}
+
+/* Sort #Operations by decreasing age. */
+static gint
+compare_operations_by_age (gconstpointer a,
+                           gconstpointer b)
+{
+  const Operation *op_a = *((const Operation **) a);
+  const Operation *op_b = *((const Operation **) b);
+
+  return (op_a->start_time > op_b->start_time) - (op_a->start_time < op_b->start_time);
+}
+
+/**
+ * gt_async_tracker_format:
+ * @self: a #GtAsyncTracker
+ *
+ * Format the tracked operations which are in flight (oldest first) and the
+ * operations which completed but were slow, as a human-readable list.
+ *
+ * This may be called from any thread.
+ *
+ * Returns: (transfer full): human-readable list of operations
+ * Since: 0.2.0
+ */
+gchar *
+gt_async_tracker_format (GtAsyncTracker *self)
+{
+  g_autoptr(GString) str = g_string_new ("");
+  g_autoptr(GPtrArray) sorted_ops = g_ptr_array_new ();
+  GHashTableIter iter;
+  Operation *op;
+  gint64 now = g_get_monotonic_time ();
+
+  g_return_val_if_fail (self != NULL, NULL);
+
+  g_mutex_lock (&self->lock);
+
+  g_hash_table_iter_init (&iter, self->in_flight);
+  while (g_hash_table_iter_next (&iter, NULL, (gpointer *) &op))
+    g_ptr_array_add (sorted_ops, op);
+  g_ptr_array_sort (sorted_ops, compare_operations_by_age);
+
+  for (gsize i = 0; i < sorted_ops->len; i++)
+    {
+      g_autofree gchar *description = NULL;
+
+      op = g_ptr_array_index (sorted_ops, i);
+      description = operation_dup_description (op);
+
+      g_string_append_printf (str, "  In flight for %.3fs: %s\n",
+                              (gdouble) (now - op->start_time) / G_USEC_PER_SEC,
+                              description);
+    }
+
+  for (gsize i = 0; i < self->slow_operations->len; i++)
+    {
+      const SlowOperation *slow = g_ptr_array_index (self->slow_operations, i);
+
+      g_string_append_printf (str, "  Slow, took %.3fs: %s\n",
+                              (gdouble) slow->duration / G_USEC_PER_SEC,
+                              slow->description);
+    }
+
+  g_mutex_unlock (&self->lock);
+
+  return g_string_free (g_steal_pointer (&str), FALSE);
+}
@@ -0,0 +1,109 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ *
+ * Copyright © 2018 Endless Mobile, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#pragma once
+
+#include <gio/gio.h>
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+typedef struct _GtAsyncTracker GtAsyncTracker;
+
+GtAsyncTracker *gt_async_tracker_new  (void);
+void            gt_async_tracker_free (GtAsyncTracker *self);
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC (GtAsyncTracker, gt_async_tracker_free)
+
+void     gt_async_tracker_track_cancellable  (GtAsyncTracker *self,
+                                              GCancellable   *cancellable,
+                                              const gchar    *name);
+void     gt_async_tracker_set_slow_threshold (GtAsyncTracker *self,
+                                              guint           threshold_ms);
+
+guint    gt_async_tracker_get_n_in_flight    (GtAsyncTracker *self);
+guint    gt_async_tracker_get_n_completed    (GtAsyncTracker *self);
+guint    gt_async_tracker_get_n_slow         (GtAsyncTracker *self);
+
+gboolean gt_async_tracker_wait_idle          (GtAsyncTracker *self,
+                                              GMainContext   *context,
+                                              guint           timeout_ms);
+
+gchar   *gt_async_tracker_format             (GtAsyncTracker *self);
+
+/**
+ * gt_async_tracker_assert_wait_idle:
+ * @self: a #GtAsyncTracker
+ * @context: (nullable): a #GMainContext to iterate, or %NULL to use the global
+ *    default main context
+ * @timeout_ms: maximum time to wait, in milliseconds
+ *
+ * Wait for all the operations tracked by @self to complete, using
+ * gt_async_tracker_wait_idle(), and assert that they did so within
+ * @timeout_ms.
+ *
+ * If they did not, an assertion fails and the operations which are still in
+ * flight are printed, using gt_async_tracker_format().
+ *
+ * Since: 0.2.0
+ */
+#define gt_async_tracker_assert_wait_idle(self, context, timeout_ms) \
+  G_STMT_START { \
+    if (!gt_async_tracker_wait_idle (self, context, timeout_ms)) \
+      { \
+        g_autofree gchar *awi_list = gt_async_tracker_format (self); \
+        g_autofree gchar *awi_message = \
+            g_strdup_printf ("Timed out after %ums waiting for %u async " \
+                             "operations to complete:\n%s", \
+                             (guint) (timeout_ms), \
+                             gt_async_tracker_get_n_in_flight (self), \
+                             awi_list); \
+        g_assertion_message (G_LOG_DOMAIN, __FILE__, __LINE__, G_STRFUNC, \
+                             awi_message); \
+      } \
+  } G_STMT_END
+
+/**
+ * gt_async_tracker_assert_no_slow_operations:
+ * @self: a #GtAsyncTracker
+ *
+ * Assert that none of the operations tracked by @self have been in flight for
+ * longer than the slow threshold (see gt_async_tracker_set_slow_threshold()).
+ *
+ * If any have, an assertion fails and the slow operations are printed, using
+ * gt_async_tracker_format().
+ *
+ * Since: 0.2.0
+ */
+#define gt_async_tracker_assert_no_slow_operations(self) \
+  G_STMT_START { \
+    guint anso_n_slow = gt_async_tracker_get_n_slow (self); \
+    if (anso_n_slow > 0) \
+      { \
+        g_autofree gchar *anso_list = gt_async_tracker_format (self); \
+        g_autofree gchar *anso_message = \
+            g_strdup_printf ("Expected no slow async operations, but saw " \
+                             "%u:\n%s", anso_n_slow, anso_list); \
+        g_assertion_message (G_LOG_DOMAIN, __FILE__, __LINE__, G_STRFUNC, \
+                             anso_message); \
+      } \
+  } G_STMT_END
+
+G_END_DECLS
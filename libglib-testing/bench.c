@@ -0,0 +1,762 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ *
+ * Copyright © 2018 Endless Mobile, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#include "config.h"
+
+#include <glib.h>
+#include <libglib-testing/bench.h>
+#include <libglib-testing/perf-counters.h>
+#include <libglib-testing/time-private.h>
+#include <stdlib.h>
+#include <string.h>
+
+
+/**
+ * SECTION:bench
+ * @short_description: Microbenchmark harness for GTest programs
+ * @stability: Unstable
+ * @include: libglib-testing/bench.h
+ *
+ * GtBench is a harness for writing microbenchmarks as part of a normal GTest
+ * program. Benchmarks are registered with gt_bench_add(), gt_bench_add_func()
+ * or gt_bench_add_vtable(), in the same style as g_test_add(), and are run as
+ * normal test cases by gt_bench_run().
+ *
+ * When the test program is run in performance mode (`-m perf`, see
+ * g_test_perf()), each benchmark is warmed up, then the number of iterations
+ * per sample is calibrated so that each sample takes a reasonable amount of
+ * time to measure, then a number of samples are taken. The median and median
+ * absolute deviation (MAD) of the time per iteration are reported, and samples
+ * more than three (scaled) MADs from the median are rejected as outliers when
+ * computing the other statistics. See gt_bench_stats_compute().
+ *
+ * When not run in performance mode, each benchmark is run for a single
+ * iteration, as a quick check that it works. This means benchmark programs
+ * can be run as part of a normal `meson test` run.
+ *
+ * If a per-iteration setup or teardown function is given to
+ * gt_bench_add_vtable(), it is run before or after each iteration, and is
+ * excluded from the timing. This requires each iteration to be timed
+ * separately, so it’s less accurate for very short iterations.
+ *
+ * The following command line options are handled by gt_bench_init(), which
+ * must be called before g_test_init():
+ *
+ *  - `--bench-report=FILE`: write a JSON report of the results to `FILE`. The
+ *    `GT_BENCH_REPORT` environment variable may be used instead.
+ *  - `--bench-samples=N`: take `N` samples of each benchmark (default: 20).
+ *  - `--bench-sample-time=MS`: calibrate the number of iterations per sample
+ *    so each sample takes at least `MS` milliseconds (default: 10).
+ *  - `--bench-warmup-time=MS`: run each benchmark for at least `MS`
+ *    milliseconds before sampling it (default: 50).
+ *
+ * The JSON report contains an object with a `benchmarks` member, which is an
+ * array of objects, one per benchmark, each containing the benchmark’s `path`,
+ * the `iterations_per_sample`, the statistics from #GtBenchStats, and the
+ * raw `samples`. All times are in nanoseconds per iteration.
+ *
+ * Each sample is also measured using #GtPerfCounters. The report contains a
+ * `counters` object for each benchmark, with a member for each available
+ * counter (named by gt_perf_counter_get_name()), containing the `median` and
+ * `mad` of the counter per iteration, and its raw `samples`. Instruction
+ * counts are much less affected by other load on the machine than times are,
+ * so they are a better choice for gating regressions on shared CI machines,
+ * where they are available.
+ *
+ * Reports can be compared against a stored baseline report using the
+ * `gt-bench-compare` tool. It compares the raw samples for each benchmark using
+ * a one-sided Mann-Whitney U test, so a benchmark is only reported as having
+ * regressed if it is significantly slower than the baseline, taking the noise
+ * in both sets of samples into account, rather than if it is slower by some
+ * fixed percentage. It prints a table of the results, and exits with a
+ * non-zero status if any benchmark has regressed. Pass `--metric=instructions`
+ * (or the name of any other counter) to compare counter samples rather than
+ * times. It can also run a benchmark
+ * program itself, so it can be used as the command in a meson `benchmark()`:
+ * |[
+ * gt-bench-compare baseline/bench-foo.json -- ./bench-foo
+ * ]|
+ *
+ * To store a new baseline, pass `--update` to `gt-bench-compare`, or copy the
+ * report from `--bench-report`.
+ *
+ * |[<!-- language="C" -->
+ * static void
+ * bench_format (gconstpointer user_data)
+ * {
+ *   g_autofree gchar *str = g_strdup_printf ("%u", 123);
+ * }
+ *
+ * int
+ * main (int argc, char *argv[])
+ * {
+ *   gt_bench_init (&argc, &argv);
+ *   g_test_init (&argc, &argv, NULL);
+ *
+ *   gt_bench_add_func ("/format", bench_format);
+ *
+ *   return gt_bench_run ();
+ * }
+ * ]|
+ *
+ * Since: 0.2.0
+ */
+
+/* Scale factor to make the MAD a consistent estimator of the standard
+ * deviation for normally distributed data. */
+#define MAD_SCALE 1.4826
+
+/* Samples further than this many scaled MADs from the median are outliers. */
+#define OUTLIER_THRESHOLD 3.0
+
+/* Upper limit on the number of iterations per sample, in case an iteration
+ * takes no measurable time. */
+#define MAX_ITERATIONS_PER_SAMPLE (G_MAXUINT / 2)
+
+typedef struct
+{
+  gchar *test_path;  /* (owned) */
+  gsize fixture_size;
+  gconstpointer user_data;
+  GDestroyNotify user_data_free;  /* (nullable) */
+  GtBenchFixtureFunc setup;  /* (nullable) */
+  GtBenchFixtureFunc iteration_setup;  /* (nullable) */
+  GtBenchFixtureFunc iteration;
+  GtBenchFixtureFunc iteration_teardown;  /* (nullable) */
+  GtBenchFixtureFunc teardown;  /* (nullable) */
+} BenchCase;
+
+typedef struct
+{
+  gchar *test_path;  /* (owned) */
+  guint iterations_per_sample;
+  GArray *samples;  /* (element-type gdouble) (owned) */
+  GtBenchStats stats;
+
+  /* Per-iteration counter samples, or %NULL where a counter is unavailable. */
+  GArray *counter_samples[GT_PERF_COUNTER_LAST + 1];  /* (element-type gdouble) (owned) (nullable) */
+  GtBenchStats counter_stats[GT_PERF_COUNTER_LAST + 1];
+} BenchResult;
+
+/* Options from the command line, and results to report. Benchmarks are run
+ * by g_test_run(), so there is nowhere else to put these. */
+static gchar *report_path = NULL;  /* (owned) (nullable) */
+static guint option_n_samples = 20;
+static guint option_sample_time_ms = 10;
+static guint option_warmup_time_ms = 50;
+static GPtrArray *results = NULL;  /* (element-type BenchResult) (owned) (nullable) */
+
+static void
+bench_case_free (BenchCase *bench_case)
+{
+  if (bench_case->user_data_free != NULL)
+    bench_case->user_data_free ((gpointer) bench_case->user_data);
+  g_free (bench_case->test_path);
+  g_free (bench_case);
+}
+
+static void
+bench_result_free (BenchResult *result)
+{
+  g_free (result->test_path);
+  g_array_unref (result->samples);
+  for (guint i = 0; i < G_N_ELEMENTS (result->counter_samples); i++)
+    g_clear_pointer (&result->counter_samples[i], g_array_unref);
+  g_free (result);
+}
+
+static gint
+compare_doubles (gconstpointer a,
+                 gconstpointer b)
+{
+  gdouble da = *((const gdouble *) a);
+  gdouble db = *((const gdouble *) b);
+
+  return (da > db) - (da < db);
+}
+
+/* Sort @values in place and return their median. @n_values must be non-zero. */
+static gdouble
+sort_and_get_median (gdouble *values,
+                     gsize    n_values)
+{
+  qsort (values, n_values, sizeof (*values), compare_doubles);
+
+  if (n_values % 2 == 1)
+    return values[n_values / 2];
+  else
+    return (values[n_values / 2 - 1] + values[n_values / 2]) / 2.0;
+}
+
+/**
+ * gt_bench_stats_compute:
+ * @samples: (array length=n_samples): samples to summarise
+ * @n_samples: number of samples; must be non-zero
+ * @out_stats: (out caller-allocates): return location for the statistics
+ *
+ * Compute summary statistics for a set of benchmark samples. The median and
+ * MAD are computed over all the samples. Any samples which are more than three
+ * scaled MADs (that is, about three standard deviations, for normally
+ * distributed samples) from the median are then rejected as outliers, and the
+ * mean, minimum and maximum are computed over the remaining samples.
+ *
+ * Since: 0.2.0
+ */
+void
+gt_bench_stats_compute (const gdouble *samples,
+                        gsize          n_samples,
+                        GtBenchStats  *out_stats)
+{
+  g_autofree gdouble *sorted = NULL;
+  g_autofree gdouble *deviations = NULL;
+  gdouble threshold, sum = 0.0;
+  gsize n_retained = 0;
+
+  g_return_if_fail (samples != NULL);
+  g_return_if_fail (n_samples > 0);
+  g_return_if_fail (out_stats != NULL);
+
+  sorted = g_new (gdouble, n_samples);
+  memcpy (sorted, samples, n_samples * sizeof (*samples));
+  deviations = g_new (gdouble, n_samples);
+
+  memset (out_stats, 0, sizeof (*out_stats));
+  out_stats->n_samples = n_samples;
+  out_stats->median = sort_and_get_median (sorted, n_samples);
+
+  for (gsize i = 0; i < n_samples; i++)
+    deviations[i] = ABS (sorted[i] - out_stats->median);
+  out_stats->mad = sort_and_get_median (deviations, n_samples);
+
+  threshold = OUTLIER_THRESHOLD * MAD_SCALE * out_stats->mad;
+
+  for (gsize i = 0; i < n_samples; i++)
+    {
+      if (ABS (sorted[i] - out_stats->median) > threshold && out_stats->mad > 0.0)
+        {
+          out_stats->n_outliers++;
+          continue;
+        }
+
+      if (n_retained == 0 || sorted[i] < out_stats->min)
+        out_stats->min = sorted[i];
+      if (n_retained == 0 || sorted[i] > out_stats->max)
+        out_stats->max = sorted[i];
+
+      sum += sorted[i];
+      n_retained++;
+    }
+
+  /* The median is always retained, so this can’t divide by zero. */
+  out_stats->mean = sum / (gdouble) n_retained;
+}
+
+/* Parse a positive integer from a command line option, or exit. */
+static guint
+parse_option_uint (const gchar *option,
+                   const gchar *value)
+{
+  guint64 parsed;
+  gchar *end = NULL;
+
+  parsed = g_ascii_strtoull (value, &end, 10);
+
+  if (end == value || *end != '\0' || parsed == 0 || parsed > G_MAXUINT)
+    {
+      g_printerr ("Invalid value ‘%s’ for %s\n", value, option);
+      exit (1);
+    }
+
+  return (guint) parsed;
+}
+
+/**
+ * gt_bench_init:
+ * @argc: pointer to the program’s argument count
+ * @argv: pointer to the program’s argument vector
+ *
+ * Initialise the benchmark harness, handling and removing the benchmark
+ * command line options from @argv (see the section documentation). This must
+ * be called before g_test_init().
+ *
+ * Since: 0.2.0
+ */
+void
+gt_bench_init (int    *argc,
+               char ***argv)
+{
+  int j = 1;
+
+  g_return_if_fail (argc != NULL);
+  g_return_if_fail (argv != NULL);
+
+  g_clear_pointer (&report_path, g_free);
+  report_path = g_strdup (g_getenv ("GT_BENCH_REPORT"));
+
+  for (int i = 1; i < *argc; i++)
+    {
+      const gchar *arg = (*argv)[i];
+
+      if (g_str_has_prefix (arg, "--bench-report="))
+        {
+          g_free (report_path);
+          report_path = g_strdup (arg + strlen ("--bench-report="));
+        }
+      else if (g_str_has_prefix (arg, "--bench-samples="))
+        option_n_samples = parse_option_uint ("--bench-samples", arg + strlen ("--bench-samples="));
+      else if (g_str_has_prefix (arg, "--bench-sample-time="))
+        option_sample_time_ms = parse_option_uint ("--bench-sample-time", arg + strlen ("--bench-sample-time="));
+      else if (g_str_has_prefix (arg, "--bench-warmup-time="))
+        option_warmup_time_ms = parse_option_uint ("--bench-warmup-time", arg + strlen ("--bench-warmup-time="));
+      else
+        (*argv)[j++] = (*argv)[i];
+    }
+
+  if (j < *argc)
+    (*argv)[j] = NULL;
+  *argc = j;
+
+  if (results == NULL)
+    results = g_ptr_array_new_with_free_func ((GDestroyNotify) bench_result_free);
+}
+
+/* Add the current values of @counters to @counts. */
+static void
+accumulate_counters (GtPerfCounters *counters,
+                     guint64        *counts)
+{
+  for (guint i = 0; i <= GT_PERF_COUNTER_LAST; i++)
+    counts[i] += gt_perf_counters_get (counters, (GtPerfCounter) i);
+}
+
+/* Run @n_iterations iterations of @bench_case, and return how long they took
+ * in nanoseconds, excluding any per-iteration setup and teardown. If
+ * @counters is non-%NULL, the counter values over the same iterations are
+ * added to @counts, which must have an element for each #GtPerfCounter. */
+static gint64
+bench_case_run_sample (const BenchCase *bench_case,
+                       gpointer         fixture,
+                       guint            n_iterations,
+                       GtPerfCounters  *counters,
+                       guint64         *counts)
+{
+  gint64 start_time, total_time = 0;
+
+  if (bench_case->iteration_setup == NULL && bench_case->iteration_teardown == NULL)
+    {
+      if (counters != NULL)
+        gt_perf_counters_start (counters);
+      start_time = gt_get_time_ns ();
+      for (guint i = 0; i < n_iterations; i++)
+        bench_case->iteration (fixture, bench_case->user_data);
+      total_time = gt_get_time_ns () - start_time;
+      if (counters != NULL)
+        {
+          gt_perf_counters_stop (counters);
+          accumulate_counters (counters, counts);
+        }
+
+      return total_time;
+    }
+
+  for (guint i = 0; i < n_iterations; i++)
+    {
+      if (bench_case->iteration_setup != NULL)
+        bench_case->iteration_setup (fixture, bench_case->user_data);
+
+      if (counters != NULL)
+        gt_perf_counters_start (counters);
+      start_time = gt_get_time_ns ();
+      bench_case->iteration (fixture, bench_case->user_data);
+      total_time += gt_get_time_ns () - start_time;
+      if (counters != NULL)
+        {
+          gt_perf_counters_stop (counters);
+          accumulate_counters (counters, counts);
+        }
+
+      if (bench_case->iteration_teardown != NULL)
+        bench_case->iteration_teardown (fixture, bench_case->user_data);
+    }
+
+  return total_time;
+}
+
+/* Warm up, calibrate and sample @bench_case, and return the results. */
+static BenchResult *
+bench_case_measure (const BenchCase *bench_case,
+                    gpointer         fixture)
+{
+  guint iterations_per_sample = 1;
+  gint64 sample_time_ns = (gint64) option_sample_time_ms * 1000000;
+  gint64 warmup_end_time;
+  BenchResult *result;
+  g_autoptr(GtPerfCounters) counters = gt_perf_counters_new ();
+
+  /* Warm up caches, lazy initialisation, CPU frequency scaling, etc. */
+  warmup_end_time = gt_get_time_ns () + (gint64) option_warmup_time_ms * 1000000;
+  while (gt_get_time_ns () < warmup_end_time)
+    bench_case_run_sample (bench_case, fixture, 1, NULL, NULL);
+
+  /* Calibrate the number of iterations so each sample is long enough to be
+   * measured accurately. */
+  while (iterations_per_sample < MAX_ITERATIONS_PER_SAMPLE &&
+         bench_case_run_sample (bench_case, fixture, iterations_per_sample, NULL, NULL) < sample_time_ns)
+    iterations_per_sample *= 2;
+
+  result = g_new0 (BenchResult, 1);
+  result->test_path = g_strdup (bench_case->test_path);
+  result->iterations_per_sample = iterations_per_sample;
+  result->samples = g_array_sized_new (FALSE, FALSE, sizeof (gdouble), option_n_samples);
+
+  for (guint i = 0; i <= GT_PERF_COUNTER_LAST; i++)
+    {
+      if (gt_perf_counters_is_available (counters, (GtPerfCounter) i))
+        result->counter_samples[i] = g_array_sized_new (FALSE, FALSE, sizeof (gdouble), option_n_samples);
+    }
+
+  for (guint i = 0; i < option_n_samples; i++)
+    {
+      guint64 counts[GT_PERF_COUNTER_LAST + 1] = { 0, };
+      gint64 elapsed_ns = bench_case_run_sample (bench_case, fixture, iterations_per_sample,
+                                                 counters, counts);
+      gdouble sample = (gdouble) elapsed_ns / (gdouble) iterations_per_sample;
+
+      g_array_append_val (result->samples, sample);
+
+      for (guint j = 0; j <= GT_PERF_COUNTER_LAST; j++)
+        {
+          gdouble counter_sample = (gdouble) counts[j] / (gdouble) iterations_per_sample;
+
+          if (result->counter_samples[j] != NULL)
+            g_array_append_val (result->counter_samples[j], counter_sample);
+        }
+    }
+
+  gt_bench_stats_compute ((const gdouble *) result->samples->data,
+                          result->samples->len, &result->stats);
+
+  for (guint i = 0; i <= GT_PERF_COUNTER_LAST; i++)
+    {
+      if (result->counter_samples[i] != NULL)
+        gt_bench_stats_compute ((const gdouble *) result->counter_samples[i]->data,
+                                result->counter_samples[i]->len,
+                                &result->counter_stats[i]);
+    }
+
+  return result;
+}
+
+static void
+bench_case_run (gconstpointer user_data)
+{
+  const BenchCase *bench_case = user_data;
+  g_autofree gpointer fixture = NULL;
+
+  fixture = g_malloc0 (MAX (bench_case->fixture_size, 1));
+
+  if (bench_case->setup != NULL)
+    bench_case->setup (fixture, bench_case->user_data);
+
+  if (g_test_perf ())
+    {
+      BenchResult *result = bench_case_measure (bench_case, fixture);
+
+      g_test_minimized_result (result->stats.median / 1e9,
+                               "%s: median %.1fns (MAD %.1fns, %" G_GSIZE_FORMAT " outliers) "
+                               "per iteration over %u×%u iterations",
+                               bench_case->test_path, result->stats.median,
+                               result->stats.mad, result->stats.n_outliers,
+                               result->samples->len, result->iterations_per_sample);
+
+      if (result->counter_samples[GT_PERF_COUNTER_INSTRUCTIONS] != NULL)
+        g_test_message ("%s: median %.1f instructions per iteration",
+                        bench_case->test_path,
+                        result->counter_stats[GT_PERF_COUNTER_INSTRUCTIONS].median);
+
+      if (results != NULL)
+        g_ptr_array_add (results, result);
+      else
+        bench_result_free (result);
+    }
+  else
+    {
+      /* Just check the benchmark works. */
+      bench_case_run_sample (bench_case, fixture, 1, NULL, NULL);
+    }
+
+  if (bench_case->teardown != NULL)
+    bench_case->teardown (fixture, bench_case->user_data);
+}
+
+/* Add a benchmark, optionally taking ownership of @user_data. */
+static void
+bench_add_internal (const gchar        *test_path,
+                    gsize               fixture_size,
+                    gconstpointer       user_data,
+                    GDestroyNotify      user_data_free,
+                    GtBenchFixtureFunc  setup,
+                    GtBenchFixtureFunc  iteration_setup,
+                    GtBenchFixtureFunc  iteration,
+                    GtBenchFixtureFunc  iteration_teardown,
+                    GtBenchFixtureFunc  teardown)
+{
+  BenchCase *bench_case;
+
+  bench_case = g_new0 (BenchCase, 1);
+  bench_case->test_path = g_strdup (test_path);
+  bench_case->fixture_size = fixture_size;
+  bench_case->user_data = user_data;
+  bench_case->user_data_free = user_data_free;
+  bench_case->setup = setup;
+  bench_case->iteration_setup = iteration_setup;
+  bench_case->iteration = iteration;
+  bench_case->iteration_teardown = iteration_teardown;
+  bench_case->teardown = teardown;
+
+  g_test_add_data_func_full (test_path, bench_case, bench_case_run,
+                             (GDestroyNotify) bench_case_free);
+}
+
+/**
+ * gt_bench_add_vtable:
+ * @test_path: the test path for the benchmark, as with g_test_add()
+ * @fixture_size: size of the fixture structure to allocate, which may be zero
+ * @user_data: user data to pass to the functions
+ * @setup: (nullable): function to set up the fixture before the benchmark,
+ *    outside the timed region
+ * @iteration_setup: (nullable): function to run before each iteration of the
+ *    benchmark, outside the timed region
+ * @iteration: function to run once per iteration of the benchmark
+ * @iteration_teardown: (nullable): function to run after each iteration of the
+ *    benchmark, outside the timed region
+ * @teardown: (nullable): function to tear down the fixture after the
+ *    benchmark, outside the timed region
+ *
+ * Add a benchmark as a test case at @test_path. The fixture is allocated and
+ * zero-filled before @setup is called, and freed after @teardown is called.
+ *
+ * Since: 0.2.0
+ */
+void
+gt_bench_add_vtable (const gchar        *test_path,
+                     gsize               fixture_size,
+                     gconstpointer       user_data,
+                     GtBenchFixtureFunc  setup,
+                     GtBenchFixtureFunc  iteration_setup,
+                     GtBenchFixtureFunc  iteration,
+                     GtBenchFixtureFunc  iteration_teardown,
+                     GtBenchFixtureFunc  teardown)
+{
+  g_return_if_fail (test_path != NULL);
+  g_return_if_fail (iteration != NULL);
+
+  bench_add_internal (test_path, fixture_size, user_data, NULL, setup,
+                      iteration_setup, iteration, iteration_teardown, teardown);
+}
+
+/* Adapt a #GTestFunc to a #GtBenchFixtureFunc. The function is passed as the
+ * user data. */
+static void
+bench_func_iteration (gpointer      fixture,
+                      gconstpointer user_data)
+{
+  const GTestFunc *func = user_data;
+
+  (*func) ();
+}
+
+/**
+ * gt_bench_add_func:
+ * @test_path: the test path for the benchmark, as with g_test_add_func()
+ * @iteration: function to run once per iteration of the benchmark
+ *
+ * Add a benchmark with no fixture as a test case at @test_path, in the same
+ * style as g_test_add_func().
+ *
+ * Since: 0.2.0
+ */
+void
+gt_bench_add_func (const gchar *test_path,
+                   GTestFunc    iteration)
+{
+  GTestFunc *func;
+
+  g_return_if_fail (test_path != NULL);
+  g_return_if_fail (iteration != NULL);
+
+  /* Function pointers can’t portably be stored in a gconstpointer, so box
+   * it. */
+  func = g_new0 (GTestFunc, 1);
+  *func = iteration;
+
+  bench_add_internal (test_path, 0, func, g_free, NULL, NULL,
+                      bench_func_iteration, NULL, NULL);
+}
+
+static void
+append_json_string (GString     *str,
+                    const gchar *value)
+{
+  g_string_append_c (str, '"');
+
+  for (const gchar *c = value; *c != '\0'; c++)
+    {
+      if (*c == '"' || *c == '\\')
+        g_string_append_printf (str, "\\%c", *c);
+      else if ((guchar) *c < 0x20)
+        g_string_append_printf (str, "\\u%04x", (guint) (guchar) *c);
+      else
+        g_string_append_c (str, *c);
+    }
+
+  g_string_append_c (str, '"');
+}
+
+static void
+append_json_double (GString *str,
+                    gdouble  value)
+{
+  gchar buf[G_ASCII_DTOSTR_BUF_SIZE];
+
+  /* Use the C locale, whatever the test program has set. */
+  g_string_append (str, g_ascii_dtostr (buf, sizeof (buf), value));
+}
+
+static void
+append_json_samples (GString      *str,
+                     const GArray *samples)
+{
+  g_string_append_c (str, '[');
+
+  for (guint i = 0; i < samples->len; i++)
+    {
+      if (i > 0)
+        g_string_append (str, ", ");
+      append_json_double (str, g_array_index (samples, gdouble, i));
+    }
+
+  g_string_append_c (str, ']');
+}
+
+static void
+append_json_counters (GString           *str,
+                      const BenchResult *result)
+{
+  gboolean first = TRUE;
+
+  g_string_append (str, ",\n      \"counters\": {");
+
+  for (guint i = 0; i <= GT_PERF_COUNTER_LAST; i++)
+    {
+      if (result->counter_samples[i] == NULL)
+        continue;
+
+      g_string_append (str, first ? "\n        " : ",\n        ");
+      first = FALSE;
+
+      append_json_string (str, gt_perf_counter_get_name ((GtPerfCounter) i));
+      g_string_append (str, ": {\"median\": ");
+      append_json_double (str, result->counter_stats[i].median);
+      g_string_append (str, ", \"mad\": ");
+      append_json_double (str, result->counter_stats[i].mad);
+      g_string_append (str, ", \"samples\": ");
+      append_json_samples (str, result->counter_samples[i]);
+      g_string_append_c (str, '}');
+    }
+
+  g_string_append (str, first ? "}" : "\n      }");
+}
+
+static gchar *
+format_report (void)
+{
+  g_autoptr(GString) str = g_string_new ("{\n");
+
+  g_string_append (str, "  \"version\": 1,\n");
+  g_string_append (str, "  \"program\": ");
+  append_json_string (str, (g_get_prgname () != NULL) ? g_get_prgname () : "");
+  g_string_append (str, ",\n  \"unit\": \"ns\",\n");
+  g_string_append (str, "  \"benchmarks\": [");
+
+  for (gsize i = 0; results != NULL && i < results->len; i++)
+    {
+      const BenchResult *result = g_ptr_array_index (results, i);
+
+      g_string_append (str, (i > 0) ? ",\n    {\n" : "\n    {\n");
+      g_string_append (str, "      \"path\": ");
+      append_json_string (str, result->test_path);
+      g_string_append_printf (str, ",\n      \"iterations_per_sample\": %u", result->iterations_per_sample);
+      g_string_append (str, ",\n      \"median\": ");
+      append_json_double (str, result->stats.median);
+      g_string_append (str, ",\n      \"mad\": ");
+      append_json_double (str, result->stats.mad);
+      g_string_append (str, ",\n      \"mean\": ");
+      append_json_double (str, result->stats.mean);
+      g_string_append (str, ",\n      \"min\": ");
+      append_json_double (str, result->stats.min);
+      g_string_append (str, ",\n      \"max\": ");
+      append_json_double (str, result->stats.max);
+      g_string_append_printf (str, ",\n      \"n_outliers\": %" G_GSIZE_FORMAT, result->stats.n_outliers);
+      g_string_append (str, ",\n      \"samples\": ");
+      append_json_samples (str, result->samples);
+      append_json_counters (str, result);
+      g_string_append (str, "\n    }");
+    }
+
+  g_string_append (str, "\n  ]\n}\n");
+
+  return g_string_free (g_steal_pointer (&str), FALSE);
+}
+
+/**
+ * gt_bench_run:
+ *
+ * Run the registered benchmarks (and any other test cases), as with
+ * g_test_run(). If a report was requested with `--bench-report`, write it
+ * afterwards.
+ *
+ * Returns: 0 on success, 1 on failure
+ * Since: 0.2.0
+ */
+int
+gt_bench_run (void)
+{
+  int retval;
+
+  retval = g_test_run ();
+
+  if (report_path != NULL && g_test_perf ())
+    {
+      g_autofree gchar *report = format_report ();
+      g_autoptr(GError) local_error = NULL;
+
+      if (!g_file_set_contents (report_path, report, -1, &local_error))
+        {
+          g_printerr ("Error writing benchmark report: %s\n", local_error->message);
+          retval = 1;
+        }
+    }
+
+  g_clear_pointer (&results, g_ptr_array_unref);
+  g_clear_pointer (&report_path, g_free);
+
+  return retval;
+}
@@ -0,0 +1,124 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ *
+ * Copyright © 2018 Endless Mobile, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#pragma once
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/**
+ * GtBenchStats:
+ * @median: median time per iteration, in nanoseconds
+ * @mad: median absolute deviation of the time per iteration, in nanoseconds
+ * @mean: mean time per iteration of the samples which are not outliers, in
+ *    nanoseconds
+ * @min: minimum time per iteration of the samples which are not outliers, in
+ *    nanoseconds
+ * @max: maximum time per iteration of the samples which are not outliers, in
+ *    nanoseconds
+ * @n_samples: total number of samples
+ * @n_outliers: number of samples which were rejected as outliers
+ *
+ * Summary statistics for the samples from a benchmark. See
+ * gt_bench_stats_compute().
+ *
+ * Since: 0.2.0
+ */
+typedef struct
+{
+  gdouble median;
+  gdouble mad;
+  gdouble mean;
+  gdouble min;
+  gdouble max;
+  gsize n_samples;
+  gsize n_outliers;
+} GtBenchStats;
+
+void gt_bench_stats_compute (const gdouble *samples,
+                             gsize          n_samples,
+                             GtBenchStats  *out_stats);
+
+/**
+ * GtBenchFixtureFunc:
+ * @fixture: the benchmark’s fixture, allocated to the size passed to
+ *    gt_bench_add_vtable()
+ * @user_data: user data passed to gt_bench_add_vtable()
+ *
+ * Function called to set up, run an iteration of, or tear down a benchmark.
+ *
+ * Since: 0.2.0
+ */
+typedef void (*GtBenchFixtureFunc) (gpointer      fixture,
+                                    gconstpointer user_data);
+
+void gt_bench_init       (int                 *argc,
+                          char              ***argv);
+void gt_bench_add_vtable (const gchar         *test_path,
+                          gsize                fixture_size,
+                          gconstpointer        user_data,
+                          GtBenchFixtureFunc   setup,
+                          GtBenchFixtureFunc   iteration_setup,
+                          GtBenchFixtureFunc   iteration,
+                          GtBenchFixtureFunc   iteration_teardown,
+                          GtBenchFixtureFunc   teardown);
+void gt_bench_add_func   (const gchar         *test_path,
+                          GTestFunc            iteration);
+int  gt_bench_run        (void);
+
+/**
+ * gt_bench_add:
+ * @test_path: the test path for the benchmark, as with g_test_add()
+ * @Fixture: the type of the fixture structure
+ * @user_data: user data to pass to the functions
+ * @setup: (nullable): function to set up the fixture before the benchmark,
+ *    outside the timed region
+ * @iteration: function to run once per iteration of the benchmark
+ * @teardown: (nullable): function to tear down the fixture after the
+ *    benchmark, outside the timed region
+ *
+ * Add a benchmark with a fixture, in the same style as g_test_add(). See
+ * gt_bench_add_vtable() for details, and to add per-iteration setup which is
+ * excluded from the timing.
+ *
+ * Since: 0.2.0
+ */
+#define gt_bench_add(test_path, Fixture, user_data, setup, iteration, teardown) \
+  G_STMT_START { \
+    void (*gba_add_vtable) (const gchar *, \
+                            gsize, \
+                            gconstpointer, \
+                            void (*) (Fixture *, gconstpointer), \
+                            void (*) (Fixture *, gconstpointer), \
+                            void (*) (Fixture *, gconstpointer), \
+                            void (*) (Fixture *, gconstpointer), \
+                            void (*) (Fixture *, gconstpointer)) = \
+        (void (*) (const gchar *, gsize, gconstpointer, \
+                   void (*) (Fixture *, gconstpointer), \
+                   void (*) (Fixture *, gconstpointer), \
+                   void (*) (Fixture *, gconstpointer), \
+                   void (*) (Fixture *, gconstpointer), \
+                   void (*) (Fixture *, gconstpointer))) gt_bench_add_vtable; \
+    gba_add_vtable (test_path, sizeof (Fixture), user_data, \
+                    setup, NULL, iteration, NULL, teardown); \
+  } G_STMT_END
+
+G_END_DECLS
@@ -22,10 +22,31 @@
 
 #include "config.h"
 
+#include <errno.h>
 #include <gio/gio.h>
 #include <glib.h>
 #include <glib-object.h>
 #include <libglib-testing/dbus-queue.h>
+#include <libglib-testing/dbus-reply-table-private.h>
+#include <libglib-testing/main-context-profiler.h>
+#include <libglib-testing/perf-counters.h>
+#include <libglib-testing/perf-counters-private.h>
+#include <libglib-testing/shaping-proxy.h>
+
+#ifdef HAVE_PTHREAD_SETAFFINITY_NP
+#include <pthread.h>
+#endif
+#if defined(HAVE_SCHED_GETCPU) || defined(HAVE_PTHREAD_SETAFFINITY_NP)
+#include <sched.h>
+#endif
+#ifdef HAVE_SETPRIORITY
+#include <sys/resource.h>
+#endif
+#ifdef __linux__
+#include <sys/syscall.h>
+#include <sys/types.h>
+#include <unistd.h>
+#endif
 
 
 /**
@@ -63,6 +84,53 @@
  * asynchronous, popping and handling messages can instead be done in the main
  * test thread, but this has no particular advantages.
  *
+ * A #GtDBusQueueServerFunc handles messages one at a time, blocking while it
+ * waits for each. To mock a service which handles several requests
+ * concurrently (for example, replying to fast method calls while a slow one is
+ * still pending), register one or more #GtDBusQueueHandlerFuncs using
+ * gt_dbus_queue_add_handler(). Each is called in the server thread as soon as
+ * a matching method call arrives, and may reply immediately, or later from
+ * another callback in the server thread (such as a timeout, or
+ * gt_dbus_queue_return_value_delayed()). Similarly,
+ * gt_dbus_queue_pop_message_async() can be used to wait for the next matching
+ * method call without blocking the server thread. Method calls which are not
+ * claimed by a pending gt_dbus_queue_pop_message_async() call or by a handler
+ * are added to the message queue as normal.
+ *
+ * The message queue can be partitioned into sub-queues, by default one per
+ * object path, or as chosen by a #GtDBusQueueClassifierFunc set using
+ * gt_dbus_queue_set_classifier_func(), which can also give messages different
+ * priorities. gt_dbus_queue_pop_message_for() and
+ * gt_dbus_queue_try_pop_message_for() pop messages from a single partition,
+ * leaving messages for other partitions in the queue.
+ *
+ * Where a real implementation of an interface is available as a
+ * #GDBusInterfaceSkeleton (for example, one generated by `gdbus-codegen`), it
+ * can be exported using gt_dbus_queue_export_skeleton(). Method calls to the
+ * skeleton are routed in the server thread: most are handled directly by the
+ * skeleton, without being queued, and only those listed when exporting it are
+ * handled by #GtDBusQueue as normal. This allows a test to mock just the few
+ * methods it is interested in.
+ *
+ * For long scripted conversations, where the method calls and their replies
+ * are known in advance, the round trip to the test thread for each method call
+ * can be avoided by registering expectations up front, using
+ * gt_dbus_queue_expect_call() and gt_dbus_queue_expect_call_error(). Matching
+ * method calls are replied to directly in the server thread as they arrive.
+ * Unexpected method calls are recorded, and can be checked at the end of the
+ * test using gt_dbus_queue_assert_expectations_met().
+ *
+ * Rather than writing a #GtDBusQueueServerFunc by hand, replies can be recorded
+ * from a real implementation of the service, and replayed in later test runs.
+ * Start the real service on the test bus, and call
+ * gt_dbus_queue_set_learn_target() with its bus name. Method calls to the mock
+ * service are then forwarded to the real service, and its replies are
+ * returned and recorded. Save them to a file using
+ * gt_dbus_queue_save_reply_table(). Later test runs can load that file using
+ * gt_dbus_queue_load_reply_table(), and method calls which match a recorded
+ * one (by object path, interface, method and parameters) are then replied to
+ * in the server thread, without the real service.
+ *
  * By default, a #GtDBusQueue will not assert that its message queue is empty
  * on destruction unless the `assert_queue_empty` argument is passed to
  * gt_dbus_queue_disconnect(). If that argument is %FALSE, it is highly
@@ -250,20 +318,240 @@ struct _GtDBusQueue
   gpointer server_func_data;  /* (unowned) (nullable) (atomic) */
   gboolean quitting;  /* (atomic) */
 
+  /* Identity of the server thread, for setting its scheduling parameters. These
+   * are set by the server thread when it starts. */
+  GCond server_started_cond;
+  gboolean server_started;  /* (locked-by lock) */
+#ifdef HAVE_PTHREAD_SETAFFINITY_NP
+  pthread_t server_pthread;  /* (locked-by lock) */
+#endif
+#ifdef __linux__
+  pid_t server_tid;  /* (locked-by lock) */
+#endif
+
   GMainContext *server_context;  /* (owned) */
   GDBusConnection *server_connection;  /* (owned) */
 
   GMutex lock;  /* (owned) */
   GArray *name_ids;  /* (owned) (element-type guint) (locked-by lock) */
   GArray *object_ids;  /* (owned) (element-type guint) (locked-by lock) */
-
-  GAsyncQueue *server_message_queue;  /* (owned) (element-type GDBusMethodInvocation) */
+  GPtrArray *handlers;  /* (owned) (element-type HandlerData) (locked-by lock) */
+  guint next_handler_id;  /* (locked-by lock) */
+  GPtrArray *pop_waiters;  /* (owned) (element-type PopWaiter) (locked-by lock) */
+  GQueue expectations;  /* (owned) (element-type Expectation) (locked-by lock) */
+  gboolean expectations_ordered;  /* (locked-by lock) */
+  GPtrArray *expectation_failures;  /* (owned) (element-type utf8) (locked-by lock) */
+
+  /* Learn mode and automatic replies. See gt_dbus_queue_set_learn_target(). */
+  gchar *learn_target;  /* (owned) (nullable) (locked-by lock) */
+  GHashTable *learnt_replies;  /* (owned) (element-type GBytes GVariant) (locked-by lock) */
+  GtDBusReplyTable *reply_table;  /* (owned) (nullable) (locked-by lock) */
+
+  /* The message queue is ordered by priority, then by arrival. Each message is
+   * also in the sub-queue for its partition, as assigned by @classifier_func,
+   * which is ordered the same way. */
+  GQueue server_messages;  /* (owned) (element-type QueuedMessage) (locked-by lock) */
+  GHashTable *server_partitions;  /* (owned) (element-type utf8 Partition) (locked-by lock) */
+  GPtrArray *waiting_contexts;  /* (owned) (element-type GMainContext) (locked-by lock) */
+
+  GtDBusQueueClassifierFunc classifier_func;  /* (nullable) */
+  gpointer classifier_data;  /* (owned) (nullable) */
+  GDestroyNotify classifier_data_free_func;  /* (nullable) */
 
   GMainContext *client_context;  /* (owned) */
   GDBusConnection *client_connection;  /* (owned) */
+
+  gboolean use_shaping_proxy;
+  GtShapingProxy *shaping_proxy;  /* (owned) (nullable) */
+
+  GtMainContextProfiler *server_profiler;  /* (owned) (nullable) */
+  GtMainContextProfiler *client_profiler;  /* (owned) (nullable) */
+};
+
+/* A method call handler registered with gt_dbus_queue_add_handler(). This is
+ * reference counted so that it can be called without holding
+ * #GtDBusQueue.lock, while another thread removes it. */
+typedef struct
+{
+  gint ref_count;  /* (atomic) */
+  guint id;
+
+  gchar *object_path;  /* (owned) (nullable) */
+  gchar *interface_name;  /* (owned) (nullable) */
+  gchar *method_name;  /* (owned) (nullable) */
+
+  GtDBusQueueHandlerFunc func;
+  gpointer user_data;  /* (owned) (nullable) */
+  GDestroyNotify user_data_free_func;  /* (nullable) */
+} HandlerData;
+
+static HandlerData *
+handler_data_ref (HandlerData *data)
+{
+  g_atomic_int_inc (&data->ref_count);
+  return data;
+}
+
+static void
+handler_data_unref (HandlerData *data)
+{
+  if (!g_atomic_int_dec_and_test (&data->ref_count))
+    return;
+
+  if (data->user_data_free_func != NULL)
+    data->user_data_free_func (data->user_data);
+
+  g_free (data->object_path);
+  g_free (data->interface_name);
+  g_free (data->method_name);
+  g_free (data);
+}
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC (HandlerData, handler_data_unref)
+
+/* A pending gt_dbus_queue_pop_message_async() call. This is reference counted
+ * as both #GtDBusQueue.pop_waiters and the #GCancellable::cancelled handler
+ * hold a reference. @task is cleared when the call is completed, to break the
+ * reference cycle through the #GCancellable. */
+typedef struct
+{
+  gint ref_count;  /* (atomic) */
+
+  GtDBusQueue *queue;  /* (unowned) */
+  GTask *task;  /* (owned) (nullable) */
+
+  gchar *object_path;  /* (owned) (nullable) */
+  gchar *interface_name;  /* (owned) (nullable) */
+  gchar *method_name;  /* (owned) (nullable) */
+
+  gulong cancelled_id;  /* (locked-by GtDBusQueue.lock); 0 if not connected */
+} PopWaiter;
+
+static PopWaiter *
+pop_waiter_ref (PopWaiter *waiter)
+{
+  g_atomic_int_inc (&waiter->ref_count);
+  return waiter;
+}
+
+static void
+pop_waiter_unref (PopWaiter *waiter)
+{
+  if (!g_atomic_int_dec_and_test (&waiter->ref_count))
+    return;
+
+  g_clear_object (&waiter->task);
+  g_free (waiter->object_path);
+  g_free (waiter->interface_name);
+  g_free (waiter->method_name);
+  g_free (waiter);
+}
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC (PopWaiter, pop_waiter_unref)
+
+/* An expected method call registered with gt_dbus_queue_expect_call() or
+ * gt_dbus_queue_expect_call_error(), along with its reply. Exactly one of
+ * @reply and @error_name is used: if @error_name is %NULL, the method call is
+ * replied to with @reply (which may itself be %NULL for an empty reply). */
+typedef struct
+{
+  gchar *object_path;  /* (owned) (not nullable) */
+  gchar *interface_name;  /* (owned) (not nullable) */
+  gchar *method_name;  /* (owned) (not nullable) */
+  GVariant *parameters;  /* (owned) (nullable) */
+
+  GVariant *reply;  /* (owned) (nullable) */
+  gchar *error_name;  /* (owned) (nullable) */
+  gchar *error_message;  /* (owned) (nullable) */
+} Expectation;
+
+static void
+expectation_free (Expectation *expectation)
+{
+  g_free (expectation->object_path);
+  g_free (expectation->interface_name);
+  g_free (expectation->method_name);
+  g_clear_pointer (&expectation->parameters, g_variant_unref);
+  g_clear_pointer (&expectation->reply, g_variant_unref);
+  g_free (expectation->error_name);
+  g_free (expectation->error_message);
+  g_free (expectation);
+}
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC (Expectation, expectation_free)
+
+/* A message in the server’s message queue. It is in both
+ * #GtDBusQueue.server_messages and the sub-queue of its @partition, and keeps
+ * pointers to its links in both so it can be removed from either in O(1). */
+typedef struct _Partition Partition;
+
+typedef struct
+{
+  GDBusMethodInvocation *invocation;  /* (owned) */
+  gint priority;
+
+  Partition *partition;  /* (unowned) */
+  GList *link;  /* (unowned) link in #GtDBusQueue.server_messages */
+  GList *partition_link;  /* (unowned) link in #Partition.messages */
+} QueuedMessage;
+
+/* A sub-queue of the server’s message queue, containing the messages which
+ * were assigned the same partition key by the #GtDBusQueueClassifierFunc. */
+struct _Partition
+{
+  gchar *key;  /* (owned) */
+  GQueue messages;  /* (element-type QueuedMessage) (unowned) */
 };
 
+static void
+partition_free (Partition *partition)
+{
+  /* The #QueuedMessages are owned by #GtDBusQueue.server_messages. */
+  g_queue_clear (&partition->messages);
+  g_free (partition->key);
+  g_free (partition);
+}
+
+/* Insert @message into @queue after all the messages with the same or a
+ * numerically lower priority, and return the new link. This is O(1) in the
+ * common case where all messages have the same priority. */
+static GList *
+message_queue_insert (GQueue        *queue,
+                      QueuedMessage *message)
+{
+  GList *sibling = NULL;
+
+  for (GList *l = queue->tail;
+       l != NULL && ((const QueuedMessage *) l->data)->priority > message->priority;
+       l = l->prev)
+    sibling = l;
+
+  g_queue_insert_before (queue, sibling, message);
+
+  return (sibling != NULL) ? sibling->prev : queue->tail;
+}
+
+/* Check whether @invocation matches the given @object_path, @interface_name
+ * and @method_name, any of which may be %NULL to match anything. */
+static gboolean
+invocation_matches (GDBusMethodInvocation *invocation,
+                    const gchar           *object_path,
+                    const gchar           *interface_name,
+                    const gchar           *method_name)
+{
+  return ((object_path == NULL ||
+           g_str_equal (g_dbus_method_invocation_get_object_path (invocation),
+                        object_path)) &&
+          (interface_name == NULL ||
+           g_str_equal (g_dbus_method_invocation_get_interface_name (invocation),
+                        interface_name)) &&
+          (method_name == NULL ||
+           g_str_equal (g_dbus_method_invocation_get_method_name (invocation),
+                        method_name)));
+}
+
 static gpointer gt_dbus_queue_server_thread_cb (gpointer user_data);
+static void gt_dbus_queue_cancel_pop_waiters (GtDBusQueue *self);
 static void gt_dbus_queue_method_call (GDBusConnection       *connection,
                                        const gchar           *sender,
                                        const gchar           *object_path,
@@ -280,6 +568,114 @@ static const GDBusInterfaceVTable gt_dbus_queue_vtable =
   .set_property = NULL,  /* handled manually */
 };
 
+/* A #GDBusInterfaceSkeleton exported using gt_dbus_queue_export_skeleton(). This
+ * is owned by its object registration, so it is freed once the object is
+ * unregistered and any method calls in progress in the server thread have
+ * returned. */
+typedef struct
+{
+  GtDBusQueue *queue;  /* (unowned) */
+  GDBusInterfaceSkeleton *skeleton;  /* (owned) */
+  GDBusInterfaceVTable *skeleton_vtable;  /* (unowned) */
+
+  /* Routing table: method calls whose names are in here are handled by
+   * gt_dbus_queue_method_call(); all others are handled by @skeleton. It is
+   * not modified after the skeleton is exported, so needs no locking. */
+  GHashTable *queued_methods;  /* (owned) (element-type utf8 utf8) */
+} ExportedSkeleton;
+
+static void
+exported_skeleton_free (ExportedSkeleton *exported)
+{
+  g_clear_object (&exported->skeleton);
+  g_clear_pointer (&exported->queued_methods, g_hash_table_unref);
+  g_free (exported);
+}
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC (ExportedSkeleton, exported_skeleton_free)
+
+/* These are called in the server thread, and pass method calls and property
+ * accesses on to the skeleton’s own vtable, unless the routing table says the
+ * method call should be queued. */
+static void
+gt_dbus_queue_skeleton_method_call (GDBusConnection       *connection,
+                                    const gchar           *sender,
+                                    const gchar           *object_path,
+                                    const gchar           *interface_name,
+                                    const gchar           *method_name,
+                                    GVariant              *parameters,
+                                    GDBusMethodInvocation *invocation,
+                                    gpointer               user_data)
+{
+  ExportedSkeleton *exported = user_data;
+
+  if (g_hash_table_contains (exported->queued_methods, method_name))
+    gt_dbus_queue_method_call (connection, sender, object_path, interface_name,
+                               method_name, parameters, invocation,
+                               exported->queue);
+  else
+    exported->skeleton_vtable->method_call (connection, sender, object_path,
+                                            interface_name, method_name,
+                                            parameters, invocation,
+                                            exported->skeleton);
+}
+
+static GVariant *
+gt_dbus_queue_skeleton_get_property (GDBusConnection  *connection,
+                                     const gchar      *sender,
+                                     const gchar      *object_path,
+                                     const gchar      *interface_name,
+                                     const gchar      *property_name,
+                                     GError          **error,
+                                     gpointer          user_data)
+{
+  ExportedSkeleton *exported = user_data;
+
+  if (exported->skeleton_vtable->get_property == NULL)
+    {
+      g_set_error (error, G_DBUS_ERROR, G_DBUS_ERROR_NOT_SUPPORTED,
+                   "Getting property ‘%s’ is not supported", property_name);
+      return NULL;
+    }
+
+  return exported->skeleton_vtable->get_property (connection, sender,
+                                                  object_path, interface_name,
+                                                  property_name, error,
+                                                  exported->skeleton);
+}
+
+static gboolean
+gt_dbus_queue_skeleton_set_property (GDBusConnection  *connection,
+                                     const gchar      *sender,
+                                     const gchar      *object_path,
+                                     const gchar      *interface_name,
+                                     const gchar      *property_name,
+                                     GVariant         *value,
+                                     GError          **error,
+                                     gpointer          user_data)
+{
+  ExportedSkeleton *exported = user_data;
+
+  if (exported->skeleton_vtable->set_property == NULL)
+    {
+      g_set_error (error, G_DBUS_ERROR, G_DBUS_ERROR_NOT_SUPPORTED,
+                   "Setting property ‘%s’ is not supported", property_name);
+      return FALSE;
+    }
+
+  return exported->skeleton_vtable->set_property (connection, sender,
+                                                  object_path, interface_name,
+                                                  property_name, value, error,
+                                                  exported->skeleton);
+}
+
+static const GDBusInterfaceVTable gt_dbus_queue_skeleton_vtable =
+{
+  .method_call = gt_dbus_queue_skeleton_method_call,
+  .get_property = gt_dbus_queue_skeleton_get_property,
+  .set_property = gt_dbus_queue_skeleton_set_property,
+};
+
 /**
  * gt_dbus_queue_new:
  *
@@ -300,10 +696,23 @@ gt_dbus_queue_new (void)
   queue->client_context = g_main_context_ref_thread_default ();
 
   queue->bus = g_test_dbus_new (G_TEST_DBUS_NONE);
-  queue->server_message_queue = g_async_queue_new_full ((GDestroyNotify) g_object_unref);
+  g_queue_init (&queue->server_messages);
+  queue->server_partitions = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                                    NULL, (GDestroyNotify) partition_free);
+  queue->waiting_contexts = g_ptr_array_new_with_free_func ((GDestroyNotify) g_main_context_unref);
   queue->name_ids = g_array_new (FALSE, FALSE, sizeof (guint));
   queue->object_ids = g_array_new (FALSE, FALSE, sizeof (guint));
+  queue->handlers = g_ptr_array_new_with_free_func ((GDestroyNotify) handler_data_unref);
+  queue->next_handler_id = 1;
+  queue->pop_waiters = g_ptr_array_new_with_free_func ((GDestroyNotify) pop_waiter_unref);
+  g_queue_init (&queue->expectations);
+  queue->expectations_ordered = TRUE;
+  queue->expectation_failures = g_ptr_array_new_with_free_func (g_free);
+  queue->learnt_replies = g_hash_table_new_full (g_bytes_hash, g_bytes_equal,
+                                                 (GDestroyNotify) g_bytes_unref,
+                                                 (GDestroyNotify) g_variant_unref);
   g_mutex_init (&queue->lock);
+  g_cond_init (&queue->server_started_cond);
 
   return g_steal_pointer (&queue);
 }
@@ -343,11 +752,40 @@ gt_dbus_queue_free (GtDBusQueue *self)
     g_assert (self->name_ids->len == 0);
   g_clear_pointer (&self->name_ids, g_array_unref);
 
-  if (self->server_message_queue != NULL)
-    g_assert (g_async_queue_try_pop (self->server_message_queue) == NULL);
-  g_clear_pointer (&self->server_message_queue, g_async_queue_unref);
+  /* Any pending pops were cancelled by gt_dbus_queue_disconnect(). */
+  if (self->pop_waiters != NULL)
+    g_assert (self->pop_waiters->len == 0);
+  g_clear_pointer (&self->pop_waiters, g_ptr_array_unref);
+  g_clear_pointer (&self->handlers, g_ptr_array_unref);
+
+  /* Unmet expectations and expectation failures are only checked by
+   * gt_dbus_queue_assert_expectations_met(). */
+  /* FIXME: Use g_queue_clear_full() once we can depend on a new enough GLib
+   * version. */
+  Expectation *expectation;
+  while ((expectation = g_queue_pop_head (&self->expectations)) != NULL)
+    expectation_free (expectation);
+  g_clear_pointer (&self->expectation_failures, g_ptr_array_unref);
+
+  g_clear_pointer (&self->learn_target, g_free);
+  g_clear_pointer (&self->learnt_replies, g_hash_table_unref);
+  g_clear_pointer (&self->reply_table, gt_dbus_reply_table_free);
+
+  g_assert (g_queue_is_empty (&self->server_messages));
+  g_clear_pointer (&self->server_partitions, g_hash_table_unref);
+  if (self->waiting_contexts != NULL)
+    g_assert (self->waiting_contexts->len == 0);
+  g_clear_pointer (&self->waiting_contexts, g_ptr_array_unref);
+
+  if (self->classifier_data_free_func != NULL)
+    self->classifier_data_free_func (self->classifier_data);
+  self->classifier_data_free_func = NULL;
+  self->classifier_data = NULL;
 
   g_clear_object (&self->bus);
+  g_clear_pointer (&self->shaping_proxy, gt_shaping_proxy_free);
+  g_clear_pointer (&self->server_profiler, gt_main_context_profiler_free);
+  g_clear_pointer (&self->client_profiler, gt_main_context_profiler_free);
 
   /* Note: We can’t assert that the @client_context is empty because we didn’t
    * construct it. */
@@ -355,6 +793,7 @@ gt_dbus_queue_free (GtDBusQueue *self)
     g_assert (!g_main_context_iteration (self->server_context, FALSE));
   g_clear_pointer (&self->server_context, g_main_context_unref);
 
+  g_cond_clear (&self->server_started_cond);
   g_mutex_clear (&self->lock);
 
   g_free (self);
@@ -379,6 +818,52 @@ gt_dbus_queue_get_client_connection (GtDBusQueue *self)
   return self->client_connection;
 }
 
+/**
+ * gt_dbus_queue_get_client_context:
+ * @self: a #GtDBusQueue
+ *
+ * Get the #GMainContext which the client connection was created in, and which
+ * is iterated by gt_dbus_queue_pop_message() and similar while they wait for
+ * a message when called from the test thread. This is the thread-default main
+ * context at the time gt_dbus_queue_new() was called.
+ *
+ * A #GtVirtualClock can be installed on this context so that timeouts in the
+ * code under test fire without delay while the test waits for messages.
+ *
+ * Returns: (transfer none): the client’s main context
+ * Since: 0.2.0
+ */
+GMainContext *
+gt_dbus_queue_get_client_context (GtDBusQueue *self)
+{
+  g_return_val_if_fail (self != NULL, NULL);
+
+  return self->client_context;
+}
+
+/**
+ * gt_dbus_queue_get_server_context:
+ * @self: a #GtDBusQueue
+ *
+ * Get the #GMainContext which is iterated by the server thread, in which
+ * #GtDBusQueueServerFunc functions are run and delayed replies (see
+ * gt_dbus_queue_return_value_delayed()) are scheduled.
+ *
+ * A #GtVirtualClock can be installed on this context so that delayed replies
+ * are sent without waiting for their delay in real time, while still being
+ * sent in the order of their delays.
+ *
+ * Returns: (transfer none): the server’s main context
+ * Since: 0.2.0
+ */
+GMainContext *
+gt_dbus_queue_get_server_context (GtDBusQueue *self)
+{
+  g_return_val_if_fail (self != NULL, NULL);
+
+  return self->server_context;
+}
+
 /* Run on all messages seen (incoming or outgoing) by the server thread. Do some
  * debug output from it. We do this here, rather than in any of the message
  * handling functions, since it sees messages which the client might have
@@ -409,6 +894,129 @@ gt_dbus_queue_server_filter_cb (GDBusConnection *connection,
   return message;
 }
 
+/**
+ * gt_dbus_queue_set_use_shaping_proxy:
+ * @self: a #GtDBusQueue
+ * @use_shaping_proxy: %TRUE to put a #GtShapingProxy between the client
+ *    connection and the bus, %FALSE otherwise
+ *
+ * Set whether the client connection (as returned by
+ * gt_dbus_queue_get_client_connection()) should connect to the bus through a
+ * #GtShapingProxy, so that the latency, bandwidth and chunking of its traffic
+ * can be controlled. The server connection always connects to the bus
+ * directly. By default, no proxy is used.
+ *
+ * Once gt_dbus_queue_connect() has been called, the proxy can be configured
+ * using gt_dbus_queue_get_shaping_proxy().
+ *
+ * This must be called before gt_dbus_queue_connect().
+ *
+ * Since: 0.2.0
+ */
+void
+gt_dbus_queue_set_use_shaping_proxy (GtDBusQueue *self,
+                                     gboolean     use_shaping_proxy)
+{
+  g_return_if_fail (self != NULL);
+  g_return_if_fail (self->server_thread == NULL);
+
+  self->use_shaping_proxy = use_shaping_proxy;
+}
+
+/**
+ * gt_dbus_queue_get_shaping_proxy:
+ * @self: a #GtDBusQueue
+ *
+ * Get the #GtShapingProxy which the client connection is connected through.
+ * This will be %NULL unless gt_dbus_queue_set_use_shaping_proxy() was called
+ * before gt_dbus_queue_connect(). After gt_dbus_queue_disconnect() is called,
+ * the proxy is stopped, but its statistics can still be queried.
+ *
+ * Returns: (nullable) (transfer none): the shaping proxy, or %NULL
+ * Since: 0.2.0
+ */
+GtShapingProxy *
+gt_dbus_queue_get_shaping_proxy (GtDBusQueue *self)
+{
+  g_return_val_if_fail (self != NULL, NULL);
+
+  return self->shaping_proxy;
+}
+
+/**
+ * gt_dbus_queue_set_profiling:
+ * @self: a #GtDBusQueue
+ * @profiling: %TRUE to profile the server and client contexts, %FALSE to stop
+ *    profiling them
+ *
+ * Set whether to install a #GtMainContextProfiler on each of the server and
+ * client contexts (see gt_dbus_queue_get_server_context() and
+ * gt_dbus_queue_get_client_context()). The server context only runs the test
+ * harness, so comparing the two profiles separates the harness’s overhead from
+ * the time spent in the code under test. The profilers can be retrieved using
+ * gt_dbus_queue_get_server_profiler() and gt_dbus_queue_get_client_profiler().
+ *
+ * Enabling profiling when it is already enabled does nothing; disabling it
+ * frees the profilers and their statistics. As only one #GtMainContextProfiler
+ * may be installed on a #GMainContext at once, no other profiler may be
+ * installed on the client context while profiling is enabled.
+ *
+ * Since: 0.2.0
+ */
+void
+gt_dbus_queue_set_profiling (GtDBusQueue *self,
+                             gboolean     profiling)
+{
+  g_return_if_fail (self != NULL);
+
+  if (profiling && self->server_profiler == NULL)
+    {
+      self->server_profiler = gt_main_context_profiler_new (self->server_context);
+      self->client_profiler = gt_main_context_profiler_new (self->client_context);
+    }
+  else if (!profiling)
+    {
+      g_clear_pointer (&self->server_profiler, gt_main_context_profiler_free);
+      g_clear_pointer (&self->client_profiler, gt_main_context_profiler_free);
+    }
+}
+
+/**
+ * gt_dbus_queue_get_server_profiler:
+ * @self: a #GtDBusQueue
+ *
+ * Get the #GtMainContextProfiler for the server context. This will be %NULL
+ * unless profiling has been enabled using gt_dbus_queue_set_profiling().
+ *
+ * Returns: (nullable) (transfer none): the server context profiler, or %NULL
+ * Since: 0.2.0
+ */
+GtMainContextProfiler *
+gt_dbus_queue_get_server_profiler (GtDBusQueue *self)
+{
+  g_return_val_if_fail (self != NULL, NULL);
+
+  return self->server_profiler;
+}
+
+/**
+ * gt_dbus_queue_get_client_profiler:
+ * @self: a #GtDBusQueue
+ *
+ * Get the #GtMainContextProfiler for the client context. This will be %NULL
+ * unless profiling has been enabled using gt_dbus_queue_set_profiling().
+ *
+ * Returns: (nullable) (transfer none): the client context profiler, or %NULL
+ * Since: 0.2.0
+ */
+GtMainContextProfiler *
+gt_dbus_queue_get_client_profiler (GtDBusQueue *self)
+{
+  g_return_val_if_fail (self != NULL, NULL);
+
+  return self->client_profiler;
+}
+
 /**
  * gt_dbus_queue_connect:
  * @self: a #GtDBusQueue
@@ -416,8 +1024,8 @@ gt_dbus_queue_server_filter_cb (GDBusConnection *connection,
  *
  * Create a private bus, mock D-Bus service, and a client #GDBusConnection to be
  * used by the code under test. Once this function has been called, the test
- * harness may call gt_dbus_queue_own_name() and gt_dbus_queue_export_object()
- * and then run the code under test.
+ * harness may call gt_dbus_queue_own_name(), gt_dbus_queue_export_object() and
+ * gt_dbus_queue_export_skeleton(), and then run the code under test.
  *
  * This must be called from the thread which constructed the #GtDBusQueue.
  *
@@ -432,11 +1040,29 @@ gt_dbus_queue_connect (GtDBusQueue  *self,
   g_return_val_if_fail (self->server_thread == NULL, FALSE);
   g_return_val_if_fail (error == NULL || *error == NULL, FALSE);
 
+  const gchar *client_address;
+
   g_main_context_push_thread_default (self->client_context);
   g_test_dbus_up (self->bus);
 
+  client_address = g_test_dbus_get_bus_address (self->bus);
+
+  if (self->use_shaping_proxy)
+    {
+      g_clear_pointer (&self->shaping_proxy, gt_shaping_proxy_free);
+      self->shaping_proxy = gt_shaping_proxy_new (client_address);
+
+      if (!gt_shaping_proxy_start (self->shaping_proxy, error))
+        {
+          g_main_context_pop_thread_default (self->client_context);
+          return FALSE;
+        }
+
+      client_address = gt_shaping_proxy_get_address (self->shaping_proxy);
+    }
+
   self->client_connection =
-      g_dbus_connection_new_for_address_sync (g_test_dbus_get_bus_address (self->bus),
+      g_dbus_connection_new_for_address_sync (client_address,
                                               G_DBUS_CONNECTION_FLAGS_AUTHENTICATION_CLIENT |
                                               G_DBUS_CONNECTION_FLAGS_MESSAGE_BUS_CONNECTION,
                                               NULL,
@@ -468,6 +1094,13 @@ gt_dbus_queue_connect (GtDBusQueue  *self,
                                       gt_dbus_queue_server_thread_cb,
                                       self);
 
+  /* Wait for the server thread to record its identity, so its scheduling
+   * parameters can be changed. */
+  g_mutex_lock (&self->lock);
+  while (!self->server_started)
+    g_cond_wait (&self->server_started_cond, &self->lock);
+  g_mutex_unlock (&self->lock);
+
   return TRUE;
 }
 
@@ -498,6 +1131,10 @@ gt_dbus_queue_disconnect (GtDBusQueue *self,
     g_dbus_connection_close_sync (self->client_connection, NULL, NULL);
   g_clear_object (&self->client_connection);
 
+  /* Keep the proxy around so its statistics can still be queried. */
+  if (self->shaping_proxy != NULL)
+    gt_shaping_proxy_stop (self->shaping_proxy);
+
   g_mutex_lock (&self->lock);
 
   for (gsize i = 0; i < self->name_ids->len; i++)
@@ -528,10 +1165,18 @@ gt_dbus_queue_disconnect (GtDBusQueue *self,
 
   g_test_dbus_down (self->bus);
 
+  /* Fail any gt_dbus_queue_pop_message_async() calls which are still pending;
+   * no more messages will arrive. */
+  gt_dbus_queue_cancel_pop_waiters (self);
+
   /* Pack up the server thread. */
   g_atomic_int_set (&self->quitting, TRUE);
   g_main_context_wakeup (self->server_context);
   g_thread_join (g_steal_pointer (&self->server_thread));
+
+  g_mutex_lock (&self->lock);
+  self->server_started = FALSE;
+  g_mutex_unlock (&self->lock);
 }
 
 typedef struct
@@ -667,6 +1312,9 @@ typedef struct
 
   const gchar *object_path;  /* (unowned) */
   const GDBusInterfaceInfo *interface_info;  /* (unowned) */
+  const GDBusInterfaceVTable *vtable;  /* (unowned) */
+  gpointer vtable_data;  /* (owned) (nullable) */
+  GDestroyNotify vtable_data_free_func;  /* (nullable) */
 
   guint id;
   GError *error;  /* (nullable) (owned) */
@@ -685,53 +1333,41 @@ export_object_cb (gpointer user_data)
   g_debug ("%s: Exporting ‘%s’", G_STRFUNC, data->object_path);
   data->id = g_dbus_connection_register_object (queue->server_connection,
                                                 data->object_path,
-                                                data->interface_info,
-                                                &gt_dbus_queue_vtable,
-                                                queue,
-                                                NULL,
+                                                (GDBusInterfaceInfo *) data->interface_info,
+                                                data->vtable,
+                                                data->vtable_data,
+                                                data->vtable_data_free_func,
                                                 &data->error);
 
+  /* The registration owns @vtable_data if it succeeded. Otherwise,
+   * @vtable_data_free_func is not called, so it is still ours to free. */
+  if (data->id != 0)
+    {
+      data->vtable_data = NULL;
+      data->vtable_data_free_func = NULL;
+    }
+
   g_cond_signal (&data->cond);
   g_mutex_unlock (&data->lock);
 
   return G_SOURCE_REMOVE;
 }
 
-/**
- * gt_dbus_queue_export_object:
- * @self: a #GtDBusQueue
- * @object_path: the path to export an object on
- * @interface_info: (transfer none): definition of the interface to export
- * @error: return location for a #GError, or %NULL
- *
- * Make the mock D-Bus service export an interface matching @interface_info at
- * the given @object_path, so that code under test can call methods at that
- * @object_path. This behaves similarly to g_dbus_connection_register_object().
- *
- * This may be called from any thread after gt_dbus_queue_connect() has been
- * called.
- *
- * Returns: ID for the exported object, which may be passed to
- *    gt_dbus_queue_unexport_object() to release it in future; guaranteed to be
- *    non-zero
- * Since: 0.1.0
- */
-guint
-gt_dbus_queue_export_object (GtDBusQueue         *self,
-                             const gchar         *object_path,
-                             GDBusInterfaceInfo  *interface_info,
-                             GError             **error)
+/* Register an object on the server connection from the server thread, block
+ * until that’s done, and track its ID. This takes ownership of @vtable_data. */
+static guint
+gt_dbus_queue_register_object (GtDBusQueue                 *self,
+                               const gchar                 *object_path,
+                               const GDBusInterfaceInfo    *interface_info,
+                               const GDBusInterfaceVTable  *vtable,
+                               gpointer                     vtable_data,
+                               GDestroyNotify               vtable_data_free_func,
+                               GError                     **error)
 {
   ExportObjectData data = { NULL, };
   g_autoptr(GError) local_error = NULL;
   guint id;
 
-  g_return_val_if_fail (self != NULL, 0);
-  g_return_val_if_fail (self->server_thread != NULL, 0);
-  g_return_val_if_fail (object_path != NULL && g_variant_is_object_path (object_path), 0);
-  g_return_val_if_fail (interface_info != NULL, 0);
-  g_return_val_if_fail (error == NULL || *error == NULL, 0);
-
   /* The object has to be exported from the server thread, so invoke a callback
    * there to do that, and block on a result. */
   g_mutex_init (&data.lock);
@@ -739,6 +1375,9 @@ gt_dbus_queue_export_object (GtDBusQueue         *self,
   data.queue = self;
   data.object_path = object_path;
   data.interface_info = interface_info;
+  data.vtable = vtable;
+  data.vtable_data = vtable_data;
+  data.vtable_data_free_func = vtable_data_free_func;
   data.id = 0;
   data.error = NULL;
 
@@ -758,6 +1397,12 @@ gt_dbus_queue_export_object (GtDBusQueue         *self,
 
   g_mutex_unlock (&data.lock);
 
+  g_mutex_clear (&data.lock);
+  g_cond_clear (&data.cond);
+
+  if (data.vtable_data_free_func != NULL)
+    data.vtable_data_free_func (data.vtable_data);
+
   if (local_error != NULL)
     {
       g_propagate_error (error, g_steal_pointer (&local_error));
@@ -774,26 +1419,142 @@ gt_dbus_queue_export_object (GtDBusQueue         *self,
 }
 
 /**
- * gt_dbus_queue_unexport_object:
+ * gt_dbus_queue_export_object:
  * @self: a #GtDBusQueue
- * @id: the name ID returned by gt_dbus_queue_export_object()
+ * @object_path: the path to export an object on
+ * @interface_info: (transfer none): definition of the interface to export
+ * @error: return location for a #GError, or %NULL
  *
- * Make the mock D-Bus service unexport an object on the private bus previously
- * exported using gt_dbus_queue_export_object(). This behaves similarly to
- * g_dbus_connection_unregister_object().
+ * Make the mock D-Bus service export an interface matching @interface_info at
+ * the given @object_path, so that code under test can call methods at that
+ * @object_path. This behaves similarly to g_dbus_connection_register_object().
  *
  * This may be called from any thread after gt_dbus_queue_connect() has been
  * called.
  *
+ * Returns: ID for the exported object, which may be passed to
+ *    gt_dbus_queue_unexport_object() to release it in future; guaranteed to be
+ *    non-zero
  * Since: 0.1.0
  */
-void
-gt_dbus_queue_unexport_object (GtDBusQueue *self,
-                               guint        id)
+guint
+gt_dbus_queue_export_object (GtDBusQueue         *self,
+                             const gchar         *object_path,
+                             GDBusInterfaceInfo  *interface_info,
+                             GError             **error)
 {
-  g_return_if_fail (self != NULL);
-  g_return_if_fail (self->server_thread != NULL);
-  g_return_if_fail (id != 0);
+  g_return_val_if_fail (self != NULL, 0);
+  g_return_val_if_fail (self->server_thread != NULL, 0);
+  g_return_val_if_fail (object_path != NULL && g_variant_is_object_path (object_path), 0);
+  g_return_val_if_fail (interface_info != NULL, 0);
+  g_return_val_if_fail (error == NULL || *error == NULL, 0);
+
+  return gt_dbus_queue_register_object (self, object_path, interface_info,
+                                        &gt_dbus_queue_vtable, self, NULL,
+                                        error);
+}
+
+/**
+ * gt_dbus_queue_export_skeleton:
+ * @self: a #GtDBusQueue
+ * @object_path: the path to export @skeleton on
+ * @skeleton: (transfer none): an implementation of the interface to export
+ * @queued_methods: (nullable) (array zero-terminated=1): names of the methods
+ *    to handle using the #GtDBusQueue, or %NULL to handle all methods using
+ *    @skeleton
+ * @error: return location for a #GError, or %NULL
+ *
+ * Make the mock D-Bus service export @skeleton at the given @object_path, so
+ * that code under test can call its methods and access its properties.
+ *
+ * Each method call is routed in the server thread as it arrives. Calls to
+ * methods in @queued_methods are handled exactly as if the interface had been
+ * exported using gt_dbus_queue_export_object(): they are passed to a pending
+ * gt_dbus_queue_pop_message_async() call, a handler or an expectation, or are
+ * added to the message queue. All other method calls, and all property
+ * accesses, are passed directly to @skeleton’s #GDBusInterfaceVTable, without
+ * being queued. This allows the mock service to use a real implementation of
+ * most of an interface, while the test controls a few of its methods.
+ *
+ * @skeleton is not exported in its own right, so its
+ * #GDBusInterfaceSkeleton::g-authorize-method signal and
+ * #GDBusInterfaceSkeletonFlags are ignored, and it handles method calls in the
+ * server thread. Signals emitted by @skeleton are not sent on the bus.
+ *
+ * This may be called from any thread after gt_dbus_queue_connect() has been
+ * called.
+ *
+ * Returns: ID for the exported object, which may be passed to
+ *    gt_dbus_queue_unexport_object() to release it in future; guaranteed to be
+ *    non-zero
+ * Since: 0.2.0
+ */
+guint
+gt_dbus_queue_export_skeleton (GtDBusQueue             *self,
+                               const gchar             *object_path,
+                               GDBusInterfaceSkeleton  *skeleton,
+                               const gchar * const     *queued_methods,
+                               GError                 **error)
+{
+  g_autoptr(ExportedSkeleton) exported = NULL;
+  GDBusInterfaceVTable *skeleton_vtable;
+  GDBusInterfaceInfo *interface_info;
+
+  g_return_val_if_fail (self != NULL, 0);
+  g_return_val_if_fail (self->server_thread != NULL, 0);
+  g_return_val_if_fail (object_path != NULL && g_variant_is_object_path (object_path), 0);
+  g_return_val_if_fail (G_IS_DBUS_INTERFACE_SKELETON (skeleton), 0);
+  g_return_val_if_fail (error == NULL || *error == NULL, 0);
+
+  interface_info = g_dbus_interface_skeleton_get_info (skeleton);
+  skeleton_vtable = g_dbus_interface_skeleton_get_vtable (skeleton);
+  g_return_val_if_fail (interface_info != NULL, 0);
+  g_return_val_if_fail (skeleton_vtable != NULL && skeleton_vtable->method_call != NULL, 0);
+
+  exported = g_new0 (ExportedSkeleton, 1);
+  exported->queue = self;
+  exported->skeleton = g_object_ref (skeleton);
+  exported->skeleton_vtable = skeleton_vtable;
+  exported->queued_methods = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                                    g_free, NULL);
+
+  for (gsize i = 0; queued_methods != NULL && queued_methods[i] != NULL; i++)
+    {
+      g_return_val_if_fail (g_dbus_interface_info_lookup_method (interface_info,
+                                                                 queued_methods[i]) != NULL, 0);
+      g_hash_table_add (exported->queued_methods, g_strdup (queued_methods[i]));
+    }
+
+  return gt_dbus_queue_register_object (self, object_path, interface_info,
+                                        &gt_dbus_queue_skeleton_vtable,
+                                        g_steal_pointer (&exported),
+                                        (GDestroyNotify) exported_skeleton_free,
+                                        error);
+}
+
+/**
+ * gt_dbus_queue_unexport_object:
+ * @self: a #GtDBusQueue
+ * @id: the name ID returned by gt_dbus_queue_export_object() or
+ *    gt_dbus_queue_export_skeleton()
+ *
+ * Make the mock D-Bus service unexport an object on the private bus previously
+ * exported using gt_dbus_queue_export_object() or
+ * gt_dbus_queue_export_skeleton(). This behaves similarly to
+ * g_dbus_connection_unregister_object().
+ *
+ * This may be called from any thread after gt_dbus_queue_connect() has been
+ * called.
+ *
+ * Since: 0.1.0
+ */
+void
+gt_dbus_queue_unexport_object (GtDBusQueue *self,
+                               guint        id)
+{
+  g_return_if_fail (self != NULL);
+  g_return_if_fail (self->server_thread != NULL);
+  g_return_if_fail (id != 0);
 
   g_mutex_lock (&self->lock);
 
@@ -862,49 +1623,1306 @@ gt_dbus_queue_set_server_func (GtDBusQueue           *self,
   g_main_context_wakeup (self->server_context);
 }
 
-/* The main thread function for the server thread. This will run until
- * #GtDBusQueue.quitting is set. It will wait for a #GtDBusQueueServerFunc to
- * be set, call it, and then continue to run the #GtDBusQueue.server_context
- * until instructed to quit.
- *
- * Acquires #GtDBusQueue.server_context. */
-static gpointer
-gt_dbus_queue_server_thread_cb (gpointer user_data)
+/**
+ * gt_dbus_queue_set_thread_affinity:
+ * @self: a #GtDBusQueue
+ * @thread: which thread to pin
+ * @cpu: index of the CPU to pin the thread to
+ * @error: return location for a #GError, or %NULL
+ *
+ * Pin the given @thread to run only on @cpu. Pinning the server thread and the
+ * test thread to chosen CPUs stops them migrating between CPUs and competing
+ * with each other, which makes latency measurements more stable.
+ *
+ * If @thread is %GT_DBUS_QUEUE_THREAD_SERVER, this must be called after
+ * gt_dbus_queue_connect(). If it is %GT_DBUS_QUEUE_THREAD_CALLER, the calling
+ * thread is pinned.
+ *
+ * If CPU affinity is not supported on this platform, %G_IO_ERROR_NOT_SUPPORTED
+ * is returned. If @cpu is not available to the process, %G_IO_ERROR_INVALID_ARGUMENT
+ * is returned.
+ *
+ * Returns: %TRUE on success, %FALSE otherwise
+ * Since: 0.2.0
+ */
+gboolean
+gt_dbus_queue_set_thread_affinity (GtDBusQueue        *self,
+                                   GtDBusQueueThread   thread,
+                                   guint               cpu,
+                                   GError            **error)
+{
+  g_return_val_if_fail (self != NULL, FALSE);
+  g_return_val_if_fail (thread != GT_DBUS_QUEUE_THREAD_SERVER ||
+                        self->server_thread != NULL, FALSE);
+  g_return_val_if_fail (error == NULL || *error == NULL, FALSE);
+
+#ifdef HAVE_PTHREAD_SETAFFINITY_NP
+  pthread_t target;
+  cpu_set_t cpu_set;
+  int r;
+
+  switch (thread)
+    {
+    case GT_DBUS_QUEUE_THREAD_SERVER:
+      g_mutex_lock (&self->lock);
+      target = self->server_pthread;
+      g_mutex_unlock (&self->lock);
+      break;
+    case GT_DBUS_QUEUE_THREAD_CALLER:
+      target = pthread_self ();
+      break;
+    default:
+      g_assert_not_reached ();
+    }
+
+  if (cpu >= (guint) CPU_SETSIZE)
+    {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_ARGUMENT,
+                   "CPU %u is out of range", cpu);
+      return FALSE;
+    }
+
+  CPU_ZERO (&cpu_set);
+  CPU_SET (cpu, &cpu_set);
+
+  r = pthread_setaffinity_np (target, sizeof (cpu_set), &cpu_set);
+  if (r != 0)
+    {
+      g_set_error (error, G_IO_ERROR, g_io_error_from_errno (r),
+                   "Error pinning thread to CPU %u: %s", cpu, g_strerror (r));
+      return FALSE;
+    }
+
+  return TRUE;
+#else  /* if !HAVE_PTHREAD_SETAFFINITY_NP */
+  g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED,
+                       "Setting thread CPU affinity is not supported on this platform");
+  return FALSE;
+#endif  /* !HAVE_PTHREAD_SETAFFINITY_NP */
+}
+
+/**
+ * gt_dbus_queue_set_thread_nice:
+ * @self: a #GtDBusQueue
+ * @thread: which thread to change
+ * @nice_level: new nice level for the thread, from -20 (highest priority) to
+ *    19 (lowest priority)
+ * @error: return location for a #GError, or %NULL
+ *
+ * Set the nice level of the given @thread. Typically, unprivileged processes
+ * may only increase the nice level of their threads.
+ *
+ * If @thread is %GT_DBUS_QUEUE_THREAD_SERVER, this must be called after
+ * gt_dbus_queue_connect(). If it is %GT_DBUS_QUEUE_THREAD_CALLER, the nice
+ * level of the calling thread is set.
+ *
+ * Setting the nice level of individual threads is only supported on Linux.
+ * %G_IO_ERROR_NOT_SUPPORTED is returned on other platforms.
+ *
+ * Returns: %TRUE on success, %FALSE otherwise
+ * Since: 0.2.0
+ */
+gboolean
+gt_dbus_queue_set_thread_nice (GtDBusQueue        *self,
+                               GtDBusQueueThread   thread,
+                               gint                nice_level,
+                               GError            **error)
+{
+  g_return_val_if_fail (self != NULL, FALSE);
+  g_return_val_if_fail (thread != GT_DBUS_QUEUE_THREAD_SERVER ||
+                        self->server_thread != NULL, FALSE);
+  g_return_val_if_fail (error == NULL || *error == NULL, FALSE);
+
+#if defined(HAVE_SETPRIORITY) && defined(__linux__)
+  pid_t tid;
+
+  switch (thread)
+    {
+    case GT_DBUS_QUEUE_THREAD_SERVER:
+      g_mutex_lock (&self->lock);
+      tid = self->server_tid;
+      g_mutex_unlock (&self->lock);
+      break;
+    case GT_DBUS_QUEUE_THREAD_CALLER:
+      tid = (pid_t) syscall (SYS_gettid);
+      break;
+    default:
+      g_assert_not_reached ();
+    }
+
+  /* On Linux, setpriority() applies to a single thread when given its TID. */
+  if (setpriority (PRIO_PROCESS, (id_t) tid, nice_level) != 0)
+    {
+      int errsv = errno;
+      g_set_error (error, G_IO_ERROR, g_io_error_from_errno (errsv),
+                   "Error setting thread nice level to %d: %s",
+                   nice_level, g_strerror (errsv));
+      return FALSE;
+    }
+
+  return TRUE;
+#else  /* if !HAVE_SETPRIORITY || !__linux__ */
+  g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED,
+                       "Setting thread nice level is not supported on this platform");
+  return FALSE;
+#endif  /* !HAVE_SETPRIORITY || !__linux__ */
+}
+
+/**
+ * gt_dbus_queue_new_perf_counters:
+ * @self: a #GtDBusQueue
+ * @thread: the thread to measure
+ *
+ * Create a new #GtPerfCounters to measure the given @thread. This allows the
+ * work done by the server thread in handling method calls to be measured
+ * separately from the work done by the code under test in the caller thread.
+ *
+ * The counters are not running until gt_perf_counters_start() is called. For
+ * %GT_DBUS_QUEUE_THREAD_SERVER, they may be started and stopped from the
+ * calling thread.
+ *
+ * Measuring the server thread is only supported on Linux. On other platforms,
+ * none of the returned counters will be available.
+ *
+ * Returns: (transfer full): a new #GtPerfCounters
+ * Since: 0.2.0
+ */
+GtPerfCounters *
+gt_dbus_queue_new_perf_counters (GtDBusQueue       *self,
+                                 GtDBusQueueThread  thread)
+{
+  g_return_val_if_fail (self != NULL, NULL);
+  g_return_val_if_fail (thread != GT_DBUS_QUEUE_THREAD_SERVER ||
+                        self->server_thread != NULL, NULL);
+
+  switch (thread)
+    {
+    case GT_DBUS_QUEUE_THREAD_SERVER:
+      {
+#ifdef __linux__
+        pid_t tid;
+
+        g_mutex_lock (&self->lock);
+        tid = self->server_tid;
+        g_mutex_unlock (&self->lock);
+
+        return gt_perf_counters_new_for_thread_id ((gint) tid);
+#else  /* if !__linux__ */
+        /* Thread IDs are not available, so return counters which are not
+         * available rather than measuring the wrong thread. */
+        return gt_perf_counters_new_for_thread_id (-1);
+#endif  /* !__linux__ */
+      }
+    case GT_DBUS_QUEUE_THREAD_CALLER:
+      return gt_perf_counters_new ();
+    default:
+      g_assert_not_reached ();
+    }
+}
+
+/* Quark for the CPU which a #GDBusMethodInvocation was received on. It’s stored
+ * as qdata on the invocation, as (CPU index + 1) so that %NULL means unknown. */
+static GQuark
+message_cpu_quark (void)
+{
+  static GQuark quark = 0;
+
+  if (G_UNLIKELY (quark == 0))
+    quark = g_quark_from_static_string ("gt-dbus-queue-message-cpu");
+
+  return quark;
+}
+
+/**
+ * gt_dbus_queue_get_message_cpu:
+ * @invocation: a #GDBusMethodInvocation received by a #GtDBusQueue
+ *
+ * Get the index of the CPU which the server thread was running on when it
+ * received @invocation. This is also included in the output of
+ * gt_dbus_queue_format_message().
+ *
+ * Returns: CPU index, or -1 if it is unknown (for example, if querying the
+ *    current CPU is not supported on this platform)
+ * Since: 0.2.0
+ */
+gint
+gt_dbus_queue_get_message_cpu (GDBusMethodInvocation *invocation)
+{
+  g_return_val_if_fail (G_IS_DBUS_METHOD_INVOCATION (invocation), -1);
+
+  return GPOINTER_TO_INT (g_object_get_qdata (G_OBJECT (invocation),
+                                              message_cpu_quark ())) - 1;
+}
+
+/**
+ * gt_dbus_queue_set_classifier_func:
+ * @self: a #GtDBusQueue
+ * @func: (nullable): a #GtDBusQueueClassifierFunc, or %NULL to use the default
+ * @user_data: data to pass to @func
+ * @user_data_free_func: (nullable): function to free @user_data when the
+ *    #GtDBusQueue is freed or the classifier is replaced, or %NULL
+ *
+ * Set the function used to partition the server’s message queue. Each message
+ * which is added to the message queue is passed to @func in the server thread,
+ * which returns a partition key and a priority for it.
+ *
+ * The message queue as a whole is ordered by priority (numerically lower
+ * priorities first, as with #GMainContext), then by arrival. It is what
+ * gt_dbus_queue_pop_message() and gt_dbus_queue_try_pop_message() pop from.
+ * Each partition is a sub-queue ordered the same way, which can be popped from
+ * in O(1) using gt_dbus_queue_pop_message_for() and
+ * gt_dbus_queue_try_pop_message_for(), leaving messages for other partitions
+ * in the queue. This allows a test to concentrate on the messages for one
+ * object without first draining the messages for all other objects, or allows
+ * several threads to each handle their own partition in parallel.
+ *
+ * If @func is %NULL, the default classifier is used, which uses the object
+ * path of each message as its partition key, and gives all messages
+ * %G_PRIORITY_DEFAULT.
+ *
+ * This must be called before gt_dbus_queue_connect().
+ *
+ * Since: 0.2.0
+ */
+void
+gt_dbus_queue_set_classifier_func (GtDBusQueue               *self,
+                                   GtDBusQueueClassifierFunc  func,
+                                   gpointer                   user_data,
+                                   GDestroyNotify             user_data_free_func)
+{
+  g_return_if_fail (self != NULL);
+  g_return_if_fail (self->server_thread == NULL);
+
+  if (self->classifier_data_free_func != NULL)
+    self->classifier_data_free_func (self->classifier_data);
+
+  self->classifier_func = func;
+  self->classifier_data = user_data;
+  self->classifier_data_free_func = user_data_free_func;
+}
+
+/**
+ * gt_dbus_queue_add_handler:
+ * @self: a #GtDBusQueue
+ * @object_path: (nullable): object path to handle method calls on, or %NULL
+ *    to match any object path
+ * @interface_name: (nullable): interface name to handle method calls on, or
+ *    %NULL to match any interface name
+ * @method_name: (nullable): method name to handle, or %NULL to match any method
+ * @func: (not nullable): a #GtDBusQueueHandlerFunc to run in the server thread
+ * @user_data: data to pass to @func
+ * @user_data_free_func: (nullable): function to free @user_data when the
+ *    handler is removed, or %NULL
+ *
+ * Register a handler for incoming method calls which match @object_path,
+ * @interface_name and @method_name. When a matching method call arrives, @func
+ * is called in the server thread with the #GDBusMethodInvocation, rather than
+ * the method call being added to the message queue.
+ *
+ * @func must reply to the invocation exactly once, using
+ * g_dbus_method_invocation_return_value() or a similar function. It does not
+ * have to reply before it returns: it may instead reply later from another
+ * callback in the server thread, such as a timeout, or by using
+ * gt_dbus_queue_return_value_delayed(). This allows a mock service to have
+ * several method calls in flight at once, without blocking on any of them.
+ *
+ * If more than one handler matches a method call, the one which was registered
+ * first is used. Pending gt_dbus_queue_pop_message_async() calls take priority
+ * over handlers.
+ *
+ * This may be called from any thread.
+ *
+ * Returns: ID for the handler, which may be passed to
+ *    gt_dbus_queue_remove_handler() to remove it in future; guaranteed to be
+ *    non-zero
+ * Since: 0.2.0
+ */
+guint
+gt_dbus_queue_add_handler (GtDBusQueue            *self,
+                           const gchar            *object_path,
+                           const gchar            *interface_name,
+                           const gchar            *method_name,
+                           GtDBusQueueHandlerFunc  func,
+                           gpointer                user_data,
+                           GDestroyNotify          user_data_free_func)
+{
+  HandlerData *data;
+  guint id;
+
+  g_return_val_if_fail (self != NULL, 0);
+  g_return_val_if_fail (object_path == NULL || g_variant_is_object_path (object_path), 0);
+  g_return_val_if_fail (interface_name == NULL || g_dbus_is_interface_name (interface_name), 0);
+  g_return_val_if_fail (method_name == NULL || g_dbus_is_member_name (method_name), 0);
+  g_return_val_if_fail (func != NULL, 0);
+
+  data = g_new0 (HandlerData, 1);
+  data->ref_count = 1;
+  data->object_path = g_strdup (object_path);
+  data->interface_name = g_strdup (interface_name);
+  data->method_name = g_strdup (method_name);
+  data->func = func;
+  data->user_data = user_data;
+  data->user_data_free_func = user_data_free_func;
+
+  g_mutex_lock (&self->lock);
+  id = data->id = self->next_handler_id++;
+  g_ptr_array_add (self->handlers, data);
+  g_mutex_unlock (&self->lock);
+
+  return id;
+}
+
+/**
+ * gt_dbus_queue_remove_handler:
+ * @self: a #GtDBusQueue
+ * @id: the handler ID returned by gt_dbus_queue_add_handler()
+ *
+ * Remove a handler previously registered using gt_dbus_queue_add_handler().
+ * Method calls which arrive after this returns will not be passed to the
+ * handler. If the handler is currently running in the server thread, its user
+ * data will be freed once it returns.
+ *
+ * This may be called from any thread.
+ *
+ * Since: 0.2.0
+ */
+void
+gt_dbus_queue_remove_handler (GtDBusQueue *self,
+                              guint        id)
+{
+  g_return_if_fail (self != NULL);
+  g_return_if_fail (id != 0);
+
+  g_mutex_lock (&self->lock);
+
+  for (gsize i = 0; i < self->handlers->len; i++)
+    {
+      const HandlerData *data = g_ptr_array_index (self->handlers, i);
+
+      if (data->id == id)
+        {
+          /* Keep the handlers in registration order. */
+          g_ptr_array_remove_index (self->handlers, i);
+          g_mutex_unlock (&self->lock);
+          return;
+        }
+    }
+
+  g_mutex_unlock (&self->lock);
+
+  /* @id wasn’t found. */
+  g_assert_not_reached ();
+}
+
+typedef struct
+{
+  GDBusMethodInvocation *invocation;  /* (owned) (nullable) */
+  GVariant *parameters;  /* (owned) (nullable) */
+} DelayedReplyData;
+
+static void
+delayed_reply_data_free (DelayedReplyData *data)
+{
+  /* If the reply was never sent (because the #GtDBusQueue was disconnected
+   * before the timeout fired), drop the invocation without replying. */
+  g_clear_object (&data->invocation);
+  g_clear_pointer (&data->parameters, g_variant_unref);
+  g_free (data);
+}
+
+static gboolean
+delayed_reply_cb (gpointer user_data)
+{
+  DelayedReplyData *data = user_data;
+
+  /* This consumes the invocation, but takes its own reference to the
+   * parameters, which are freed with @data. */
+  g_dbus_method_invocation_return_value (g_steal_pointer (&data->invocation),
+                                         data->parameters);
+
+  return G_SOURCE_REMOVE;
+}
+
+/**
+ * gt_dbus_queue_return_value_delayed:
+ * @self: a #GtDBusQueue
+ * @invocation: (transfer full): invocation to reply to
+ * @parameters: (nullable): a #GVariant tuple with out parameters for the
+ *    method, or %NULL if not passing any parameters
+ * @delay_ms: delay before sending the reply, in milliseconds
+ *
+ * Reply to @invocation with @parameters, as with
+ * g_dbus_method_invocation_return_value(), but only after @delay_ms have
+ * elapsed. The reply is sent from the server thread, and the calling thread is
+ * not blocked while waiting.
+ *
+ * This is useful for simulating slow method calls in a
+ * #GtDBusQueueHandlerFunc, so that other method calls can be handled while the
+ * slow one is in progress.
+ *
+ * If @parameters is floating, it is consumed.
+ *
+ * The delay is measured in the virtual time of any #GtVirtualClock installed
+ * on the server context (see gt_dbus_queue_get_server_context()).
+ *
+ * This may be called from any thread after gt_dbus_queue_connect() has been
+ * called.
+ *
+ * Since: 0.2.0
+ */
+void
+gt_dbus_queue_return_value_delayed (GtDBusQueue           *self,
+                                    GDBusMethodInvocation *invocation,
+                                    GVariant              *parameters,
+                                    guint                  delay_ms)
+{
+  g_autoptr(GSource) source = NULL;
+  DelayedReplyData *data;
+
+  g_return_if_fail (self != NULL);
+  g_return_if_fail (self->server_thread != NULL);
+  g_return_if_fail (G_IS_DBUS_METHOD_INVOCATION (invocation));
+
+  data = g_new0 (DelayedReplyData, 1);
+  data->invocation = invocation;
+  data->parameters = (parameters != NULL) ? g_variant_ref_sink (parameters) : NULL;
+
+  source = g_timeout_source_new (delay_ms);
+  g_source_set_name (source, "GtDBusQueue delayed reply");
+  g_source_set_callback (source, delayed_reply_cb, data,
+                         (GDestroyNotify) delayed_reply_data_free);
+  g_source_attach (source, self->server_context);
+}
+
+/**
+ * gt_dbus_queue_set_expectations_ordered:
+ * @self: a #GtDBusQueue
+ * @ordered: %TRUE if expected method calls must arrive in the order they were
+ *    registered, %FALSE if they may arrive in any order
+ *
+ * Set whether the expectations registered with gt_dbus_queue_expect_call() and
+ * gt_dbus_queue_expect_call_error() must be met in the order they were
+ * registered. By default, they must.
+ *
+ * If @ordered is %TRUE, each incoming method call is matched against the
+ * oldest unmet expectation only. If @ordered is %FALSE, it is matched against
+ * all unmet expectations, and the oldest matching one is used.
+ *
+ * This may only be called while there are no unmet expectations.
+ *
+ * This may be called from any thread.
+ *
+ * Since: 0.2.0
+ */
+void
+gt_dbus_queue_set_expectations_ordered (GtDBusQueue *self,
+                                        gboolean     ordered)
+{
+  g_return_if_fail (self != NULL);
+
+  g_mutex_lock (&self->lock);
+  g_assert (g_queue_is_empty (&self->expectations));
+  self->expectations_ordered = ordered;
+  g_mutex_unlock (&self->lock);
+}
+
+static void
+gt_dbus_queue_add_expectation (GtDBusQueue *self,
+                               Expectation *expectation)
+{
+  g_mutex_lock (&self->lock);
+  g_queue_push_tail (&self->expectations, expectation);
+  g_mutex_unlock (&self->lock);
+}
+
+static Expectation *
+expectation_new (const gchar *object_path,
+                 const gchar *interface_name,
+                 const gchar *method_name,
+                 const gchar *parameters_string)
+{
+  g_autoptr(Expectation) expectation = g_new0 (Expectation, 1);
+
+  expectation->object_path = g_strdup (object_path);
+  expectation->interface_name = g_strdup (interface_name);
+  expectation->method_name = g_strdup (method_name);
+
+  if (parameters_string != NULL)
+    expectation->parameters = g_variant_ref_sink (g_variant_new_parsed (parameters_string));
+
+  return g_steal_pointer (&expectation);
+}
+
+/**
+ * gt_dbus_queue_expect_call:
+ * @self: a #GtDBusQueue
+ * @object_path: object path the method call is expected to be calling
+ * @interface_name: interface name the method call is expected to be calling
+ * @method_name: method name the method call is expected to be calling
+ * @parameters_string: (nullable): parameters the method call is expected to
+ *    have, in the format accepted by g_variant_new_parsed(), or %NULL to accept
+ *    any parameters
+ * @reply_string: (nullable): parameters to reply to the method call with, in
+ *    the format accepted by g_variant_new_parsed(), or %NULL to reply with no
+ *    parameters
+ *
+ * Register an expected method call, and the reply to send to it. When a method
+ * call arrives which matches the expectation, the reply is sent immediately
+ * from the server thread, and the method call is not added to the message
+ * queue. This avoids handing each method call over to the test thread and
+ * back, so a long scripted conversation between the code under test and the
+ * mock service can run at full speed.
+ *
+ * While there are unmet expectations, every incoming method call is matched
+ * against them (see gt_dbus_queue_set_expectations_ordered()). A method call
+ * which does not match is recorded as a failure, and is replied to with a
+ * `org.freedesktop.DBus.Error.Failed` error. Failures and unmet expectations
+ * can be checked using gt_dbus_queue_assert_expectations_met() at the end of
+ * the test. Once all expectations have been met, method calls are handled
+ * as normal again.
+ *
+ * Expectations take priority over pending gt_dbus_queue_pop_message_async()
+ * calls and handlers registered with gt_dbus_queue_add_handler().
+ *
+ * @parameters_string and @reply_string are parsed when this function is
+ * called. It is a programmer error to provide a string which doesn’t parse
+ * correctly. @reply_string must parse to a tuple.
+ *
+ * This may be called from any thread.
+ *
+ * Since: 0.2.0
+ */
+void
+gt_dbus_queue_expect_call (GtDBusQueue *self,
+                           const gchar *object_path,
+                           const gchar *interface_name,
+                           const gchar *method_name,
+                           const gchar *parameters_string,
+                           const gchar *reply_string)
+{
+  g_autoptr(Expectation) expectation = NULL;
+
+  g_return_if_fail (self != NULL);
+  g_return_if_fail (g_variant_is_object_path (object_path));
+  g_return_if_fail (g_dbus_is_interface_name (interface_name));
+  g_return_if_fail (g_dbus_is_member_name (method_name));
+
+  expectation = expectation_new (object_path, interface_name, method_name,
+                                 parameters_string);
+
+  if (reply_string != NULL)
+    {
+      expectation->reply = g_variant_ref_sink (g_variant_new_parsed (reply_string));
+      g_return_if_fail (g_variant_is_of_type (expectation->reply, G_VARIANT_TYPE_TUPLE));
+    }
+
+  gt_dbus_queue_add_expectation (self, g_steal_pointer (&expectation));
+}
+
+/**
+ * gt_dbus_queue_expect_call_error:
+ * @self: a #GtDBusQueue
+ * @object_path: object path the method call is expected to be calling
+ * @interface_name: interface name the method call is expected to be calling
+ * @method_name: method name the method call is expected to be calling
+ * @parameters_string: (nullable): parameters the method call is expected to
+ *    have, in the format accepted by g_variant_new_parsed(), or %NULL to accept
+ *    any parameters
+ * @error_name: D-Bus error name to reply to the method call with
+ * @error_message: error message to reply to the method call with
+ *
+ * Register an expected method call, and an error to reply to it with. This is
+ * the same as gt_dbus_queue_expect_call(), except that the method call is
+ * replied to using g_dbus_method_invocation_return_dbus_error().
+ *
+ * This may be called from any thread.
+ *
+ * Since: 0.2.0
+ */
+void
+gt_dbus_queue_expect_call_error (GtDBusQueue *self,
+                                 const gchar *object_path,
+                                 const gchar *interface_name,
+                                 const gchar *method_name,
+                                 const gchar *parameters_string,
+                                 const gchar *error_name,
+                                 const gchar *error_message)
+{
+  g_autoptr(Expectation) expectation = NULL;
+
+  g_return_if_fail (self != NULL);
+  g_return_if_fail (g_variant_is_object_path (object_path));
+  g_return_if_fail (g_dbus_is_interface_name (interface_name));
+  g_return_if_fail (g_dbus_is_member_name (method_name));
+  g_return_if_fail (g_dbus_is_interface_name (error_name));
+  g_return_if_fail (error_message != NULL);
+
+  expectation = expectation_new (object_path, interface_name, method_name,
+                                 parameters_string);
+  expectation->error_name = g_strdup (error_name);
+  expectation->error_message = g_strdup (error_message);
+
+  gt_dbus_queue_add_expectation (self, g_steal_pointer (&expectation));
+}
+
+/**
+ * gt_dbus_queue_get_n_expectations:
+ * @self: a #GtDBusQueue
+ *
+ * Get the number of expectations registered with gt_dbus_queue_expect_call()
+ * or gt_dbus_queue_expect_call_error() which have not yet been met.
+ *
+ * This may be called from any thread.
+ *
+ * Returns: number of unmet expectations
+ * Since: 0.2.0
+ */
+gsize
+gt_dbus_queue_get_n_expectations (GtDBusQueue *self)
+{
+  gsize n_expectations;
+
+  g_return_val_if_fail (self != NULL, 0);
+
+  g_mutex_lock (&self->lock);
+  n_expectations = g_queue_get_length (&self->expectations);
+  g_mutex_unlock (&self->lock);
+
+  return n_expectations;
+}
+
+/**
+ * gt_dbus_queue_get_n_expectation_failures:
+ * @self: a #GtDBusQueue
+ *
+ * Get the number of method calls which have arrived while there were unmet
+ * expectations, but which did not match any of them.
+ *
+ * This may be called from any thread.
+ *
+ * Returns: number of unexpected method calls
+ * Since: 0.2.0
+ */
+gsize
+gt_dbus_queue_get_n_expectation_failures (GtDBusQueue *self)
+{
+  gsize n_failures;
+
+  g_return_val_if_fail (self != NULL, 0);
+
+  g_mutex_lock (&self->lock);
+  n_failures = self->expectation_failures->len;
+  g_mutex_unlock (&self->lock);
+
+  return n_failures;
+}
+
+static gchar *
+expectation_format (const Expectation *expectation)
+{
+  g_autofree gchar *parameters = NULL;
+
+  if (expectation->parameters != NULL)
+    parameters = g_variant_print (expectation->parameters, TRUE);
+
+  return g_strdup_printf ("%s.%s on %s with parameters %s",
+                          expectation->interface_name,
+                          expectation->method_name,
+                          expectation->object_path,
+                          (parameters != NULL) ? parameters : "(any)");
+}
+
+/**
+ * gt_dbus_queue_format_expectations:
+ * @self: a #GtDBusQueue
+ *
+ * Format all the unmet expectations and expectation failures in a human
+ * readable way. This format is not intended to be stable or machine parsable.
+ *
+ * If all expectations have been met and there have been no failures, an empty
+ * string will be returned.
+ *
+ * This may be called from any thread.
+ *
+ * Returns: (transfer full): human readable version of the expectation state
+ * Since: 0.2.0
+ */
+gchar *
+gt_dbus_queue_format_expectations (GtDBusQueue *self)
+{
+  g_autoptr(GString) output = NULL;
+
+  g_return_val_if_fail (self != NULL, NULL);
+
+  output = g_string_new ("");
+
+  g_mutex_lock (&self->lock);
+
+  for (const GList *l = self->expectations.head; l != NULL; l = l->next)
+    {
+      g_autofree gchar *formatted = expectation_format (l->data);
+      g_string_append_printf (output, "Unmet expectation: %s\n", formatted);
+    }
+
+  for (gsize i = 0; i < self->expectation_failures->len; i++)
+    g_string_append_printf (output, "%s\n",
+                            (const gchar *) g_ptr_array_index (self->expectation_failures, i));
+
+  g_mutex_unlock (&self->lock);
+
+  return g_string_free (g_steal_pointer (&output), FALSE);
+}
+
+/* Check whether @invocation matches @expectation. */
+static gboolean
+expectation_matches (const Expectation     *expectation,
+                     GDBusMethodInvocation *invocation)
+{
+  return (invocation_matches (invocation, expectation->object_path,
+                              expectation->interface_name,
+                              expectation->method_name) &&
+          (expectation->parameters == NULL ||
+           g_variant_equal (g_dbus_method_invocation_get_parameters (invocation),
+                            expectation->parameters)));
+}
+
+/* Match @invocation against the unmet expectations, and take the matching one
+ * out of #GtDBusQueue.expectations if there is one. If there are unmet
+ * expectations but none of them match, record a failure, and set
+ * @out_unexpected to %TRUE.
+ *
+ * Must be called with #GtDBusQueue.lock held. */
+static Expectation *
+gt_dbus_queue_steal_expectation_locked (GtDBusQueue           *self,
+                                        GDBusMethodInvocation *invocation,
+                                        gboolean              *out_unexpected)
+{
+  g_autofree gchar *invocation_formatted = NULL;
+  g_autofree gchar *invocation_parameters = NULL;
+
+  *out_unexpected = FALSE;
+
+  if (g_queue_is_empty (&self->expectations))
+    return NULL;
+
+  for (GList *l = self->expectations.head; l != NULL; l = l->next)
+    {
+      if (expectation_matches (l->data, invocation))
+        {
+          Expectation *expectation = l->data;
+          g_queue_delete_link (&self->expectations, l);
+          return expectation;
+        }
+
+      if (self->expectations_ordered)
+        break;
+    }
+
+  /* Record the failure for gt_dbus_queue_assert_expectations_met(). */
+  invocation_parameters = g_variant_print (g_dbus_method_invocation_get_parameters (invocation), TRUE);
+  invocation_formatted = g_strdup_printf ("%s.%s on %s with parameters %s",
+                                          g_dbus_method_invocation_get_interface_name (invocation),
+                                          g_dbus_method_invocation_get_method_name (invocation),
+                                          g_dbus_method_invocation_get_object_path (invocation),
+                                          invocation_parameters);
+
+  if (self->expectations_ordered)
+    {
+      g_autofree gchar *expectation_formatted =
+          expectation_format (g_queue_peek_head (&self->expectations));
+      g_ptr_array_add (self->expectation_failures,
+                       g_strdup_printf ("Unexpected method call %s; expected %s",
+                                        invocation_formatted,
+                                        expectation_formatted));
+    }
+  else
+    {
+      g_ptr_array_add (self->expectation_failures,
+                       g_strdup_printf ("Unexpected method call %s; it matched "
+                                        "none of the %u unmet expectations",
+                                        invocation_formatted,
+                                        g_queue_get_length (&self->expectations)));
+    }
+
+  *out_unexpected = TRUE;
+
+  return NULL;
+}
+
+/* Reply to @invocation as specified by @expectation. */
+static void
+expectation_reply (const Expectation     *expectation,
+                   GDBusMethodInvocation *invocation)
+{
+  if (expectation->error_name != NULL)
+    g_dbus_method_invocation_return_dbus_error (invocation,
+                                                expectation->error_name,
+                                                expectation->error_message);
+  else
+    g_dbus_method_invocation_return_value (invocation, expectation->reply);
+}
+
+/* The main thread function for the server thread. This will run until
+ * #GtDBusQueue.quitting is set. It will wait for a #GtDBusQueueServerFunc to
+ * be set, call it, and then continue to run the #GtDBusQueue.server_context
+ * until instructed to quit.
+ *
+ * Acquires #GtDBusQueue.server_context. */
+static gpointer
+gt_dbus_queue_server_thread_cb (gpointer user_data)
+{
+  GtDBusQueue *self = user_data;
+  GtDBusQueueServerFunc server_func;
+  gpointer server_func_data;
+
+  g_main_context_push_thread_default (self->server_context);
+
+  g_mutex_lock (&self->lock);
+#ifdef HAVE_PTHREAD_SETAFFINITY_NP
+  self->server_pthread = pthread_self ();
+#endif
+#ifdef __linux__
+  self->server_tid = (pid_t) syscall (SYS_gettid);
+#endif
+  self->server_started = TRUE;
+  g_cond_broadcast (&self->server_started_cond);
+  g_mutex_unlock (&self->lock);
+
+  /* Wait for the client to provide message handling. */
+  while (!g_atomic_int_get (&self->quitting) &&
+         g_atomic_pointer_get (&self->server_func) == NULL)
+    g_main_context_iteration (self->server_context, TRUE);
+
+  server_func = g_atomic_pointer_get (&self->server_func);
+  server_func_data = g_atomic_pointer_get (&self->server_func_data);
+
+  if (server_func != NULL)
+    server_func (self, server_func_data);
+
+  /* Wait for the process to signal to quit. This is also the main message
+   * handling loop if no @server_func has been provided. */
+  while (!g_atomic_int_get (&self->quitting))
+    g_main_context_iteration (self->server_context, TRUE);
+
+  /* Process any remaining sources while quitting, without blocking. */
+  while (g_main_context_iteration (self->server_context, FALSE));
+
+  g_main_context_pop_thread_default (self->server_context);
+
+  return NULL;
+}
+
+/* Take the oldest pending gt_dbus_queue_pop_message_async() call which matches
+ * @invocation out of #GtDBusQueue.pop_waiters, if there is one.
+ *
+ * Must be called with #GtDBusQueue.lock held. */
+static PopWaiter *
+gt_dbus_queue_steal_pop_waiter_locked (GtDBusQueue           *self,
+                                       GDBusMethodInvocation *invocation)
+{
+  for (gsize i = 0; i < self->pop_waiters->len; i++)
+    {
+      PopWaiter *waiter = g_ptr_array_index (self->pop_waiters, i);
+
+      if (invocation_matches (invocation, waiter->object_path,
+                              waiter->interface_name, waiter->method_name))
+        {
+          /* FIXME: Use g_ptr_array_steal_index() once we can depend on a new
+           * enough GLib version. */
+          g_ptr_array_set_free_func (self->pop_waiters, NULL);
+          g_ptr_array_remove_index (self->pop_waiters, i);
+          g_ptr_array_set_free_func (self->pop_waiters, (GDestroyNotify) pop_waiter_unref);
+
+          return waiter;
+        }
+    }
+
+  return NULL;
+}
+
+/* Find the first handler registered with gt_dbus_queue_add_handler() which
+ * matches @invocation, if there is one.
+ *
+ * Must be called with #GtDBusQueue.lock held. */
+static HandlerData *
+gt_dbus_queue_ref_handler_locked (GtDBusQueue           *self,
+                                  GDBusMethodInvocation *invocation)
+{
+  for (gsize i = 0; i < self->handlers->len; i++)
+    {
+      HandlerData *handler = g_ptr_array_index (self->handlers, i);
+
+      if (invocation_matches (invocation, handler->object_path,
+                              handler->interface_name, handler->method_name))
+        return handler_data_ref (handler);
+    }
+
+  return NULL;
+}
+
+/* Disconnect the #GCancellable::cancelled handler for a pending
+ * gt_dbus_queue_pop_message_async() call which has been removed from
+ * #GtDBusQueue.pop_waiters. @cancelled_id must have been read while the waiter
+ * was still in the list.
+ *
+ * This blocks until any concurrent pop_waiter_cancelled_cb() call has
+ * returned; that call will not find the waiter in #GtDBusQueue.pop_waiters,
+ * since it’s already been removed. */
+static void
+pop_waiter_disconnect (PopWaiter *waiter,
+                       gulong     cancelled_id)
+{
+  if (cancelled_id != 0)
+    g_cancellable_disconnect (g_task_get_cancellable (waiter->task),
+                              cancelled_id);
+}
+
+/* Add @invocation to the server’s message queue, and to the sub-queue for
+ * @partition_key, creating it if needed. Wake up any threads which are blocked
+ * in gt_dbus_queue_pop_message() or similar.
+ *
+ * Must be called with #GtDBusQueue.lock held. */
+static void
+gt_dbus_queue_push_message_locked (GtDBusQueue           *self,
+                                   GDBusMethodInvocation *invocation,
+                                   const gchar           *partition_key,
+                                   gint                   priority)
+{
+  Partition *partition;
+  QueuedMessage *queued;
+
+  /* The key is only copied when a new partition is created, so the common
+   * case of pushing to an existing partition allocates as little as
+   * possible. */
+  partition = g_hash_table_lookup (self->server_partitions, partition_key);
+
+  if (partition == NULL)
+    {
+      partition = g_new0 (Partition, 1);
+      partition->key = g_strdup (partition_key);
+      g_queue_init (&partition->messages);
+      g_hash_table_insert (self->server_partitions, partition->key, partition);
+    }
+
+  queued = g_new0 (QueuedMessage, 1);
+  queued->invocation = g_object_ref (invocation);
+  queued->priority = priority;
+  queued->partition = partition;
+  queued->link = message_queue_insert (&self->server_messages, queued);
+  queued->partition_link = message_queue_insert (&partition->messages, queued);
+
+  /* Either the client or server context could be listening for the message,
+   * depending on whether gt_dbus_queue_pop_message() is being called in the
+   * #GtDBusQueueServerFunc, or in the thread where the #GtDBusQueue was
+   * constructed (typically the main thread of the test program). Other threads
+   * may be popping from a partition. */
+  g_main_context_wakeup (self->client_context);
+  g_main_context_wakeup (self->server_context);
+
+  for (gsize i = 0; i < self->waiting_contexts->len; i++)
+    g_main_context_wakeup (g_ptr_array_index (self->waiting_contexts, i));
+}
+
+/* Remove @queued from the server’s message queue and its partition, free it,
+ * and return its #GDBusMethodInvocation. This is O(1).
+ *
+ * Must be called with #GtDBusQueue.lock held. */
+static GDBusMethodInvocation *
+gt_dbus_queue_remove_message_locked (GtDBusQueue   *self,
+                                     QueuedMessage *queued)
+{
+  GDBusMethodInvocation *invocation = g_steal_pointer (&queued->invocation);
+
+  g_queue_delete_link (&self->server_messages, queued->link);
+  g_queue_delete_link (&queued->partition->messages, queued->partition_link);
+  g_free (queued);
+
+  return invocation;
+}
+
+/**
+ * gt_dbus_queue_set_learn_target:
+ * @self: a #GtDBusQueue
+ * @target_name: (nullable): bus name of the real service to learn replies
+ *    from, or %NULL to stop learning
+ *
+ * Put the mock service into learn mode, or take it out of learn mode if
+ * @target_name is %NULL.
+ *
+ * In learn mode, method calls which would otherwise be added to the message
+ * queue are instead forwarded to the same object path, interface and method
+ * on @target_name, which should be a real implementation of the service
+ * started on the test bus. Its reply (or D-Bus error) is returned to the
+ * caller, and is recorded against the object path, interface, method and
+ * parameters of the call. If the same call is made more than once, the most
+ * recent reply is recorded. Save the recorded replies using
+ * gt_dbus_queue_save_reply_table().
+ *
+ * Calls which are handled by an expectation, a pending
+ * gt_dbus_queue_pop_message_async() call, a handler or a reply table loaded
+ * using gt_dbus_queue_load_reply_table() are not forwarded. Unix file
+ * descriptors are not forwarded.
+ *
+ * Forwarded calls must have been replied to by the real service before the
+ * #GtDBusQueue is disconnected.
+ *
+ * This may be called from any thread.
+ *
+ * Since: 0.2.0
+ */
+void
+gt_dbus_queue_set_learn_target (GtDBusQueue *self,
+                                const gchar *target_name)
+{
+  g_return_if_fail (self != NULL);
+  g_return_if_fail (target_name == NULL || g_dbus_is_name (target_name));
+
+  g_mutex_lock (&self->lock);
+  g_free (self->learn_target);
+  self->learn_target = g_strdup (target_name);
+  g_mutex_unlock (&self->lock);
+}
+
+/**
+ * gt_dbus_queue_get_n_learnt_replies:
+ * @self: a #GtDBusQueue
+ *
+ * Get the number of distinct method calls whose replies have been recorded in
+ * learn mode. See gt_dbus_queue_set_learn_target().
+ *
+ * This may be called from any thread.
+ *
+ * Returns: number of recorded replies
+ * Since: 0.2.0
+ */
+gsize
+gt_dbus_queue_get_n_learnt_replies (GtDBusQueue *self)
+{
+  gsize n_replies;
+
+  g_return_val_if_fail (self != NULL, 0);
+
+  g_mutex_lock (&self->lock);
+  n_replies = g_hash_table_size (self->learnt_replies);
+  g_mutex_unlock (&self->lock);
+
+  return n_replies;
+}
+
+/**
+ * gt_dbus_queue_save_reply_table:
+ * @self: a #GtDBusQueue
+ * @path: file to save the reply table to
+ * @error: return location for a #GError, or %NULL
+ *
+ * Save the replies recorded in learn mode (see
+ * gt_dbus_queue_set_learn_target()) to a reply table file at @path, which can
+ * be loaded in later test runs using gt_dbus_queue_load_reply_table(). The
+ * file is replaced atomically, and is the same for the same recorded replies.
+ *
+ * The file format is specific to this library, and is an indexed hash table
+ * which is memory-mapped when loaded. It can be loaded on machines of either
+ * endianness.
+ *
+ * This may be called from any thread.
+ *
+ * Returns: %TRUE on success, %FALSE otherwise
+ * Since: 0.2.0
+ */
+gboolean
+gt_dbus_queue_save_reply_table (GtDBusQueue  *self,
+                                const gchar  *path,
+                                GError      **error)
+{
+  g_autoptr(GHashTable) replies = NULL;
+  GHashTableIter iter;
+  gpointer key, value;
+
+  g_return_val_if_fail (self != NULL, FALSE);
+  g_return_val_if_fail (path != NULL, FALSE);
+  g_return_val_if_fail (error == NULL || *error == NULL, FALSE);
+
+  /* Copy the replies so the file can be written without holding the lock. */
+  replies = g_hash_table_new_full (g_bytes_hash, g_bytes_equal,
+                                   (GDestroyNotify) g_bytes_unref,
+                                   (GDestroyNotify) g_variant_unref);
+
+  g_mutex_lock (&self->lock);
+  g_hash_table_iter_init (&iter, self->learnt_replies);
+  while (g_hash_table_iter_next (&iter, &key, &value))
+    g_hash_table_insert (replies, g_bytes_ref (key), g_variant_ref (value));
+  g_mutex_unlock (&self->lock);
+
+  return gt_dbus_reply_table_write (replies, path, error);
+}
+
+/**
+ * gt_dbus_queue_load_reply_table:
+ * @self: a #GtDBusQueue
+ * @path: (nullable): reply table file to load, or %NULL to unload the current
+ *    one
+ * @error: return location for a #GError, or %NULL
+ *
+ * Load a reply table saved using gt_dbus_queue_save_reply_table(), replacing
+ * any which was previously loaded. The file is memory-mapped, rather than read
+ * into memory.
+ *
+ * Method calls which would otherwise be added to the message queue are then
+ * looked up in the table, by their object path, interface, method and
+ * parameters. If a recorded reply is found, it is returned directly from the
+ * server thread, and the method call is not queued. Expectations, pending
+ * gt_dbus_queue_pop_message_async() calls and handlers take priority over the
+ * reply table.
+ *
+ * This may be called from any thread.
+ *
+ * Returns: %TRUE on success, %FALSE otherwise
+ * Since: 0.2.0
+ */
+gboolean
+gt_dbus_queue_load_reply_table (GtDBusQueue  *self,
+                                const gchar  *path,
+                                GError      **error)
+{
+  g_autoptr(GtDBusReplyTable) table = NULL;
+  GtDBusReplyTable *old_table;
+
+  g_return_val_if_fail (self != NULL, FALSE);
+  g_return_val_if_fail (error == NULL || *error == NULL, FALSE);
+
+  if (path != NULL)
+    {
+      table = gt_dbus_reply_table_new_from_file (path, error);
+      if (table == NULL)
+        return FALSE;
+
+      g_debug ("%s: Loaded %" G_GSIZE_FORMAT " replies from ‘%s’",
+               G_STRFUNC, gt_dbus_reply_table_get_n_entries (table), path);
+    }
+
+  g_mutex_lock (&self->lock);
+  old_table = self->reply_table;
+  self->reply_table = g_steal_pointer (&table);
+  g_mutex_unlock (&self->lock);
+
+  /* Replies looked up from the old table hold a reference to its file, so it
+   * can be freed straight away. */
+  table = old_table;
+
+  return TRUE;
+}
+
+/* A method call which is being forwarded to the learn target. */
+typedef struct
 {
-  GtDBusQueue *self = user_data;
-  GtDBusQueueServerFunc server_func;
-  gpointer server_func_data;
+  GtDBusQueue *queue;  /* (unowned) */
+  GDBusMethodInvocation *invocation;  /* (owned) (nullable) */
+  GBytes *key;  /* (owned) */
+} LearnData;
 
-  g_main_context_push_thread_default (self->server_context);
+static void
+learn_data_free (LearnData *data)
+{
+  /* @invocation is cleared when it’s replied to. */
+  g_assert (data->invocation == NULL);
 
-  /* Wait for the client to provide message handling. */
-  while (!g_atomic_int_get (&self->quitting) &&
-         g_atomic_pointer_get (&self->server_func) == NULL)
-    g_main_context_iteration (self->server_context, TRUE);
+  g_clear_pointer (&data->key, g_bytes_unref);
+  g_free (data);
+}
 
-  server_func = g_atomic_pointer_get (&self->server_func);
-  server_func_data = g_atomic_pointer_get (&self->server_func_data);
+G_DEFINE_AUTOPTR_CLEANUP_FUNC (LearnData, learn_data_free)
 
-  if (server_func != NULL)
-    server_func (self, server_func_data);
+/* This is run in the server thread. */
+static void
+learn_reply_cb (GObject      *obj,
+                GAsyncResult *result,
+                gpointer      user_data)
+{
+  GDBusConnection *connection = G_DBUS_CONNECTION (obj);
+  g_autoptr(LearnData) data = user_data;
+  GtDBusQueue *self = data->queue;
+  g_autoptr(GVariant) parameters = NULL;
+  g_autoptr(GVariant) reply = NULL;
+  g_autoptr(GError) local_error = NULL;
 
-  /* Wait for the process to signal to quit. This is also the main message
-   * handling loop if no @server_func has been provided. */
-  while (!g_atomic_int_get (&self->quitting))
-    g_main_context_iteration (self->server_context, TRUE);
+  parameters = g_dbus_connection_call_finish (connection, result, &local_error);
 
-  /* Process any remaining sources while quitting, without blocking. */
-  while (g_main_context_iteration (self->server_context, FALSE));
+  if (parameters != NULL)
+    {
+      reply = gt_dbus_reply_new_value (parameters);
+    }
+  else if (g_dbus_error_is_remote_error (local_error))
+    {
+      g_autofree gchar *error_name = g_dbus_error_get_remote_error (local_error);
+      g_dbus_error_strip_remote_error (local_error);
+      reply = gt_dbus_reply_new_error (error_name, local_error->message);
+    }
 
-  g_main_context_pop_thread_default (self->server_context);
+  if (reply != NULL)
+    {
+      g_debug ("%s: Server recording reply to forwarded message %s.%s",
+               G_STRFUNC,
+               g_dbus_method_invocation_get_interface_name (data->invocation),
+               g_dbus_method_invocation_get_method_name (data->invocation));
 
-  return NULL;
+      g_mutex_lock (&self->lock);
+      g_hash_table_replace (self->learnt_replies, g_bytes_ref (data->key),
+                            g_variant_ref (reply));
+      g_mutex_unlock (&self->lock);
+
+      gt_dbus_reply_send (reply, g_steal_pointer (&data->invocation));
+    }
+  else
+    {
+      /* The learn target couldn’t be reached, which says nothing about how
+       * the real service behaves, so don’t record it. */
+      g_dbus_method_invocation_return_gerror (g_steal_pointer (&data->invocation),
+                                              local_error);
+    }
+}
+
+/* Forward @invocation to the learn target, @target_name, and reply to it with
+ * the result. This takes ownership of @invocation and @key.
+ *
+ * This is run in the server thread, under #GtDBusQueue.server_context, which
+ * is where learn_reply_cb() will be called. */
+static void
+gt_dbus_queue_forward_message (GtDBusQueue           *self,
+                               GDBusMethodInvocation *invocation,
+                               const gchar           *target_name,
+                               GBytes                *key)
+{
+  LearnData *data;
+
+  data = g_new0 (LearnData, 1);
+  data->queue = self;
+  data->invocation = invocation;
+  data->key = key;
+
+  g_dbus_connection_call (self->server_connection,
+                          target_name,
+                          g_dbus_method_invocation_get_object_path (invocation),
+                          g_dbus_method_invocation_get_interface_name (invocation),
+                          g_dbus_method_invocation_get_method_name (invocation),
+                          g_dbus_method_invocation_get_parameters (invocation),
+                          NULL,  /* reply type */
+                          G_DBUS_CALL_FLAGS_NONE,
+                          -1,  /* timeout (ms) */
+                          NULL,  /* cancellable */
+                          learn_reply_cb,
+                          data);
 }
 
 /* Handle an incoming method call to the mock service. This is run in the server
- * thread, under #GtDBusQueue.server_context. It pushes the received message
- * onto the server’s message queue and wakes up any #GMainContext which is
- * potentially blocking on a gt_dbus_queue_pop_message() call. */
+ * thread, under #GtDBusQueue.server_context. If there are unmet expectations,
+ * it replies to the message directly, according to the matching expectation.
+ * Otherwise, it passes the received message to a pending
+ * gt_dbus_queue_pop_message_async() call or a registered handler if one
+ * matches. Otherwise, it replies to the message from the reply table if it
+ * contains a matching reply, or forwards it to the learn target if one is set.
+ * Otherwise, it pushes the message onto the server’s message queue and
+ * wakes up any #GMainContext which is potentially blocking on a
+ * gt_dbus_queue_pop_message() call. */
 static void
 gt_dbus_queue_method_call (GDBusConnection       *connection,
                            const gchar           *sender,
@@ -917,17 +2935,121 @@ gt_dbus_queue_method_call (GDBusConnection       *connection,
 {
   GtDBusQueue *self = user_data;
   GDBusMessage *message = g_dbus_method_invocation_get_message (invocation);
+  g_autoptr(PopWaiter) waiter = NULL;
+  gulong waiter_cancelled_id = 0;
+  g_autoptr(HandlerData) handler = NULL;
+  g_autoptr(Expectation) expectation = NULL;
+  gboolean unexpected = FALSE;
+  g_autoptr(GBytes) key = NULL;
+  g_autoptr(GVariant) auto_reply = NULL;
+  g_autofree gchar *learn_target = NULL;
+  g_autofree gchar *classified_key = NULL;
+  const gchar *partition_key;
+  gint priority = G_PRIORITY_DEFAULT;
+
+#ifdef HAVE_SCHED_GETCPU
+  int cpu = sched_getcpu ();
+  if (cpu >= 0)
+    g_object_set_qdata (G_OBJECT (invocation), message_cpu_quark (),
+                        GINT_TO_POINTER (cpu + 1));
+#endif
+
+  /* Classify the message without holding the lock, as the classifier may call
+   * back into the #GtDBusQueue. */
+  if (self->classifier_func != NULL)
+    {
+      classified_key = self->classifier_func (self, invocation, &priority,
+                                              self->classifier_data);
+      partition_key = classified_key;
+    }
+  else
+    {
+      partition_key = object_path;
+    }
+  g_assert (partition_key != NULL);
+
+  /* Pushing onto the queue has to happen under the same lock as checking for
+   * pop waiters, otherwise a concurrent gt_dbus_queue_pop_message_async() call
+   * could miss the message. */
+  g_mutex_lock (&self->lock);
 
-  g_debug ("%s: Server pushing message serial %u",
-           G_STRFUNC, g_dbus_message_get_serial (message));
-  g_async_queue_push (self->server_message_queue, g_object_ref (invocation));
+  expectation = gt_dbus_queue_steal_expectation_locked (self, invocation, &unexpected);
 
-  /* Either of these could be listening for the message, depending on whether
-   * gt_dbus_queue_pop_message() is being called in the #GtDBusQueueServerFunc,
-   * or in the thread where the #GtDBusQueue was constructed (typically the main
-   * thread of the test program). */
-  g_main_context_wakeup (self->client_context);
-  g_main_context_wakeup (self->server_context);
+  if (expectation == NULL && !unexpected)
+    {
+      waiter = gt_dbus_queue_steal_pop_waiter_locked (self, invocation);
+      if (waiter != NULL)
+        waiter_cancelled_id = waiter->cancelled_id;
+      else
+        handler = gt_dbus_queue_ref_handler_locked (self, invocation);
+
+      if (waiter == NULL && handler == NULL &&
+          (self->reply_table != NULL || self->learn_target != NULL))
+        {
+          key = gt_dbus_reply_table_make_key (object_path, interface_name,
+                                              method_name, parameters);
+
+          if (self->reply_table != NULL)
+            auto_reply = gt_dbus_reply_table_lookup (self->reply_table, key);
+          if (auto_reply == NULL)
+            learn_target = g_strdup (self->learn_target);
+        }
+
+      if (waiter == NULL && handler == NULL && auto_reply == NULL &&
+          learn_target == NULL)
+        {
+          g_debug ("%s: Server pushing message serial %u to partition ‘%s’",
+                   G_STRFUNC, g_dbus_message_get_serial (message), partition_key);
+          gt_dbus_queue_push_message_locked (self, invocation,
+                                             partition_key, priority);
+        }
+    }
+
+  g_mutex_unlock (&self->lock);
+
+  if (expectation != NULL)
+    {
+      g_debug ("%s: Server replying to expected message serial %u",
+               G_STRFUNC, g_dbus_message_get_serial (message));
+      expectation_reply (expectation, invocation);
+    }
+  else if (unexpected)
+    {
+      g_debug ("%s: Server rejecting unexpected message serial %u",
+               G_STRFUNC, g_dbus_message_get_serial (message));
+      g_dbus_method_invocation_return_error_literal (invocation, G_DBUS_ERROR,
+                                                     G_DBUS_ERROR_FAILED,
+                                                     "Unexpected method call");
+    }
+  else if (waiter != NULL)
+    {
+      g_debug ("%s: Server passing message serial %u to async pop",
+               G_STRFUNC, g_dbus_message_get_serial (message));
+      pop_waiter_disconnect (waiter, waiter_cancelled_id);
+      g_task_return_pointer (waiter->task, g_object_ref (invocation), g_object_unref);
+      g_clear_object (&waiter->task);
+    }
+  else if (handler != NULL)
+    {
+      /* Call the handler without holding the lock, so it can call back into
+       * the #GtDBusQueue. */
+      g_debug ("%s: Server passing message serial %u to handler %u",
+               G_STRFUNC, g_dbus_message_get_serial (message), handler->id);
+      handler->func (self, invocation, handler->user_data);
+    }
+  else if (auto_reply != NULL)
+    {
+      g_debug ("%s: Server replying to message serial %u from reply table",
+               G_STRFUNC, g_dbus_message_get_serial (message));
+      gt_dbus_reply_send (auto_reply, invocation);
+    }
+  else if (learn_target != NULL)
+    {
+      g_debug ("%s: Server forwarding message serial %u to ‘%s’",
+               G_STRFUNC, g_dbus_message_get_serial (message), learn_target);
+      gt_dbus_queue_forward_message (self, invocation, learn_target,
+                                     g_steal_pointer (&key));
+    }
 }
 
 /**
@@ -948,13 +3070,47 @@ gt_dbus_queue_method_call (GDBusConnection       *connection,
 gsize
 gt_dbus_queue_get_n_messages (GtDBusQueue *self)
 {
-  gint n_messages;
+  gsize n_messages;
+
+  g_return_val_if_fail (self != NULL, 0);
+
+  g_mutex_lock (&self->lock);
+  n_messages = g_queue_get_length (&self->server_messages);
+  g_mutex_unlock (&self->lock);
+
+  return n_messages;
+}
+
+/**
+ * gt_dbus_queue_get_n_messages_for:
+ * @self: a #GtDBusQueue
+ * @partition: partition key, as returned by the #GtDBusQueueClassifierFunc
+ *
+ * Get the number of messages waiting in the given @partition of the server
+ * queue to be popped by gt_dbus_queue_pop_message_for() and processed. See
+ * gt_dbus_queue_set_classifier_func() for details of partitions.
+ *
+ * This may be called from any thread.
+ *
+ * Returns: number of messages in @partition waiting to be popped and processed
+ * Since: 0.2.0
+ */
+gsize
+gt_dbus_queue_get_n_messages_for (GtDBusQueue *self,
+                                  const gchar *partition)
+{
+  Partition *p;
+  gsize n_messages;
 
   g_return_val_if_fail (self != NULL, 0);
+  g_return_val_if_fail (partition != NULL, 0);
 
-  n_messages = g_async_queue_length (self->server_message_queue);
+  g_mutex_lock (&self->lock);
+  p = g_hash_table_lookup (self->server_partitions, partition);
+  n_messages = (p != NULL) ? g_queue_get_length (&p->messages) : 0;
+  g_mutex_unlock (&self->lock);
 
-  return MAX (n_messages, 0);
+  return n_messages;
 }
 
 /*
@@ -978,22 +3134,57 @@ gt_dbus_queue_get_n_messages (GtDBusQueue *self)
  */
 static gboolean
 gt_dbus_queue_pop_message_internal (GtDBusQueue            *self,
+                                    const gchar            *partition,
                                     gboolean                wait,
                                     GDBusMethodInvocation **out_invocation)
 {
   g_autoptr(GDBusMethodInvocation) invocation = NULL;
+  g_autoptr(GMainContext) context = NULL;
   gboolean message_popped = FALSE;
 
   g_return_val_if_fail (self != NULL, FALSE);
   g_return_val_if_fail (self->server_thread != NULL, FALSE);
 
-  while (wait && (invocation = g_async_queue_try_pop (self->server_message_queue)) == NULL)
+  /* This could be the client or server context, depending on whether we’re
+   * executing in a #GtDBusQueueServerFunc or not, or the context of some other
+   * thread which is popping from a partition. */
+  context = g_main_context_ref_thread_default ();
+
+  g_mutex_lock (&self->lock);
+
+  while (TRUE)
     {
-      /* This could be the client or server context, depending on whether we’re
-       * executing in a #GtDBusQueueServerFunc or not. */
-      g_main_context_iteration (g_main_context_get_thread_default (), TRUE);
+      GList *head;
+
+      if (partition != NULL)
+        {
+          const Partition *p = g_hash_table_lookup (self->server_partitions, partition);
+          head = (p != NULL) ? p->messages.head : NULL;
+        }
+      else
+        {
+          head = self->server_messages.head;
+        }
+
+      if (head != NULL)
+        invocation = gt_dbus_queue_remove_message_locked (self, head->data);
+
+      if (invocation != NULL || !wait)
+        break;
+
+      /* Register @context to be woken up when a message is pushed, and block
+       * until then. */
+      g_ptr_array_add (self->waiting_contexts, g_main_context_ref (context));
+      g_mutex_unlock (&self->lock);
+
+      g_main_context_iteration (context, TRUE);
+
+      g_mutex_lock (&self->lock);
+      g_ptr_array_remove (self->waiting_contexts, context);
     }
 
+  g_mutex_unlock (&self->lock);
+
   if (invocation != NULL)
     {
       GDBusMessage *message = g_dbus_method_invocation_get_message (invocation);
@@ -1031,7 +3222,7 @@ gt_dbus_queue_try_pop_message (GtDBusQueue            *self,
 {
   g_return_val_if_fail (self != NULL, FALSE);
 
-  return gt_dbus_queue_pop_message_internal (self, FALSE, out_invocation);
+  return gt_dbus_queue_pop_message_internal (self, NULL, FALSE, out_invocation);
 }
 
 /**
@@ -1057,7 +3248,292 @@ gt_dbus_queue_pop_message (GtDBusQueue            *self,
 {
   g_return_val_if_fail (self != NULL, FALSE);
 
-  return gt_dbus_queue_pop_message_internal (self, TRUE, out_invocation);
+  return gt_dbus_queue_pop_message_internal (self, NULL, TRUE, out_invocation);
+}
+
+/**
+ * gt_dbus_queue_try_pop_message_for:
+ * @self: a #GtDBusQueue
+ * @partition: partition key, as returned by the #GtDBusQueueClassifierFunc
+ * @out_invocation: (out) (transfer full) (optional) (nullable): return location
+ *    for the popped #GDBusMethodInvocation, which may be %NULL; pass %NULL to
+ *    not receive the #GDBusMethodInvocation
+ *
+ * Pop the first message in @partition off the server’s message queue, if one
+ * is ready to be popped. Otherwise, immediately return %NULL. Messages in other
+ * partitions are left in the queue. This is O(1) in the number of queued
+ * messages. See gt_dbus_queue_set_classifier_func() for details of partitions.
+ *
+ * This may be called from any thread after gt_dbus_queue_connect() has been
+ * called.
+ *
+ * Returns: %TRUE if a message was popped (and returned in @out_invocation if
+ *    @out_invocation was non-%NULL), %FALSE otherwise
+ * Since: 0.2.0
+ */
+gboolean
+gt_dbus_queue_try_pop_message_for (GtDBusQueue            *self,
+                                   const gchar            *partition,
+                                   GDBusMethodInvocation **out_invocation)
+{
+  g_return_val_if_fail (self != NULL, FALSE);
+  g_return_val_if_fail (partition != NULL, FALSE);
+
+  return gt_dbus_queue_pop_message_internal (self, partition, FALSE, out_invocation);
+}
+
+/**
+ * gt_dbus_queue_pop_message_for:
+ * @self: a #GtDBusQueue
+ * @partition: partition key, as returned by the #GtDBusQueueClassifierFunc
+ * @out_invocation: (out) (transfer full) (optional) (nullable): return location
+ *    for the popped #GDBusMethodInvocation, which may be %NULL; pass %NULL to
+ *    not receive the #GDBusMethodInvocation
+ *
+ * Pop the first message in @partition off the server’s message queue, if one
+ * is ready to be popped. Otherwise, block indefinitely until one is, iterating
+ * the thread-default #GMainContext. Messages in other partitions are left in
+ * the queue. See gt_dbus_queue_set_classifier_func() for details of
+ * partitions.
+ *
+ * Several threads may each pop from their own partition at the same time.
+ *
+ * This may be called from any thread after gt_dbus_queue_connect() has been
+ * called.
+ *
+ * Returns: %TRUE if a message was popped (and returned in @out_invocation if
+ *    @out_invocation was non-%NULL), %FALSE if the pop timed out
+ * Since: 0.2.0
+ */
+gboolean
+gt_dbus_queue_pop_message_for (GtDBusQueue            *self,
+                               const gchar            *partition,
+                               GDBusMethodInvocation **out_invocation)
+{
+  g_return_val_if_fail (self != NULL, FALSE);
+  g_return_val_if_fail (partition != NULL, FALSE);
+
+  return gt_dbus_queue_pop_message_internal (self, partition, TRUE, out_invocation);
+}
+
+/* Steal the first message in #GtDBusQueue.server_messages which matches
+ * the given @object_path, @interface_name and @method_name (any of which may be
+ * %NULL to match anything), preserving the order of the other messages.
+ *
+ * Must be called with #GtDBusQueue.lock held. */
+static GDBusMethodInvocation *
+gt_dbus_queue_steal_matching_message_locked (GtDBusQueue *self,
+                                             const gchar *object_path,
+                                             const gchar *interface_name,
+                                             const gchar *method_name)
+{
+  for (GList *l = self->server_messages.head; l != NULL; l = l->next)
+    {
+      QueuedMessage *queued = l->data;
+
+      if (invocation_matches (queued->invocation, object_path,
+                              interface_name, method_name))
+        return gt_dbus_queue_remove_message_locked (self, queued);
+    }
+
+  return NULL;
+}
+
+/* Called in an arbitrary thread when the #GCancellable for a pending
+ * gt_dbus_queue_pop_message_async() call is cancelled. */
+static void
+pop_waiter_cancelled_cb (GCancellable *cancellable,
+                         gpointer      user_data)
+{
+  PopWaiter *waiter = user_data;
+  GtDBusQueue *self = waiter->queue;
+  gboolean found;
+
+  /* The signal handler holds a reference to @waiter, but it’s only ours to
+   * complete if it’s still in the list of waiters. */
+  g_mutex_lock (&self->lock);
+  g_ptr_array_set_free_func (self->pop_waiters, NULL);
+  found = g_ptr_array_remove (self->pop_waiters, waiter);
+  g_ptr_array_set_free_func (self->pop_waiters, (GDestroyNotify) pop_waiter_unref);
+  g_mutex_unlock (&self->lock);
+
+  if (!found)
+    return;
+
+  /* We can’t call g_cancellable_disconnect() from within the signal handler,
+   * so leave it connected. Clearing the task breaks the reference cycle
+   * through the #GCancellable. */
+  g_task_return_error_if_cancelled (waiter->task);
+  g_clear_object (&waiter->task);
+
+  /* Drop the reference from #GtDBusQueue.pop_waiters. */
+  pop_waiter_unref (waiter);
+}
+
+/**
+ * gt_dbus_queue_pop_message_async:
+ * @self: a #GtDBusQueue
+ * @object_path: (nullable): object path the method call must be on, or %NULL
+ *    to match any object path
+ * @interface_name: (nullable): interface name the method call must be on, or
+ *    %NULL to match any interface name
+ * @method_name: (nullable): method name the method call must be for, or %NULL
+ *    to match any method name
+ * @cancellable: (nullable): a #GCancellable, or %NULL
+ * @callback: callback to invoke when a matching message has been popped
+ * @user_data: data to pass to @callback
+ *
+ * Asynchronously pop the first message from the server’s message queue which
+ * matches @object_path, @interface_name and @method_name. If no matching
+ * message is currently queued, the operation will complete as soon as a
+ * matching message arrives, and that message will not be added to the message
+ * queue or passed to any handlers registered with gt_dbus_queue_add_handler().
+ *
+ * Unlike gt_dbus_queue_pop_message(), this does not block the calling thread,
+ * so several method calls can be awaited at once from the same thread. This is
+ * typically used from a #GtDBusQueueServerFunc or #GtDBusQueueHandlerFunc in
+ * the server thread. @callback is invoked in the thread-default #GMainContext
+ * of the calling thread.
+ *
+ * If gt_dbus_queue_disconnect() is called before a matching message arrives,
+ * the operation fails with %G_IO_ERROR_CLOSED.
+ *
+ * This may be called from any thread after gt_dbus_queue_connect() has been
+ * called.
+ *
+ * Since: 0.2.0
+ */
+void
+gt_dbus_queue_pop_message_async (GtDBusQueue         *self,
+                                 const gchar         *object_path,
+                                 const gchar         *interface_name,
+                                 const gchar         *method_name,
+                                 GCancellable        *cancellable,
+                                 GAsyncReadyCallback  callback,
+                                 gpointer             user_data)
+{
+  g_autoptr(GTask) task = NULL;
+  g_autoptr(GDBusMethodInvocation) invocation = NULL;
+  g_autoptr(PopWaiter) waiter = NULL;
+  gulong cancelled_id;
+
+  g_return_if_fail (self != NULL);
+  g_return_if_fail (self->server_thread != NULL);
+  g_return_if_fail (object_path == NULL || g_variant_is_object_path (object_path));
+  g_return_if_fail (interface_name == NULL || g_dbus_is_interface_name (interface_name));
+  g_return_if_fail (method_name == NULL || g_dbus_is_member_name (method_name));
+  g_return_if_fail (cancellable == NULL || G_IS_CANCELLABLE (cancellable));
+
+  task = g_task_new (NULL, cancellable, callback, user_data);
+  g_task_set_source_tag (task, gt_dbus_queue_pop_message_async);
+
+  /* Check the queue and register the waiter under the same lock as
+   * gt_dbus_queue_method_call() uses, so no messages can be missed. */
+  g_mutex_lock (&self->lock);
+
+  invocation = gt_dbus_queue_steal_matching_message_locked (self, object_path,
+                                                            interface_name,
+                                                            method_name);
+
+  if (invocation != NULL)
+    {
+      g_mutex_unlock (&self->lock);
+
+      g_debug ("%s: Client popping message serial %u",
+               G_STRFUNC,
+               g_dbus_message_get_serial (g_dbus_method_invocation_get_message (invocation)));
+      g_task_return_pointer (task, g_steal_pointer (&invocation), g_object_unref);
+      return;
+    }
+
+  waiter = g_new0 (PopWaiter, 1);
+  waiter->ref_count = 1;
+  waiter->queue = self;
+  waiter->task = g_steal_pointer (&task);
+  waiter->object_path = g_strdup (object_path);
+  waiter->interface_name = g_strdup (interface_name);
+  waiter->method_name = g_strdup (method_name);
+  g_ptr_array_add (self->pop_waiters, pop_waiter_ref (waiter));
+
+  g_mutex_unlock (&self->lock);
+
+  if (cancellable == NULL)
+    return;
+
+  /* This must be done without holding the lock, as pop_waiter_cancelled_cb()
+   * is called immediately if @cancellable is already cancelled. */
+  cancelled_id = g_cancellable_connect (cancellable,
+                                        G_CALLBACK (pop_waiter_cancelled_cb),
+                                        pop_waiter_ref (waiter),
+                                        (GDestroyNotify) pop_waiter_unref);
+
+  /* If a message arrived (or we were disconnected) in the meantime, the waiter
+   * will have been removed from the list without the handler being
+   * disconnected, so do that here. */
+  g_mutex_lock (&self->lock);
+  for (gsize i = 0; i < self->pop_waiters->len; i++)
+    {
+      if (g_ptr_array_index (self->pop_waiters, i) == waiter)
+        {
+          waiter->cancelled_id = cancelled_id;
+          cancelled_id = 0;
+          break;
+        }
+    }
+  g_mutex_unlock (&self->lock);
+
+  if (cancelled_id != 0)
+    g_cancellable_disconnect (cancellable, cancelled_id);
+}
+
+/**
+ * gt_dbus_queue_pop_message_finish:
+ * @self: a #GtDBusQueue
+ * @result: a #GAsyncResult
+ * @error: return location for a #GError, or %NULL
+ *
+ * Finish an asynchronous pop operation started with
+ * gt_dbus_queue_pop_message_async().
+ *
+ * Returns: (transfer full): the popped #GDBusMethodInvocation
+ * Since: 0.2.0
+ */
+GDBusMethodInvocation *
+gt_dbus_queue_pop_message_finish (GtDBusQueue   *self,
+                                  GAsyncResult  *result,
+                                  GError       **error)
+{
+  g_return_val_if_fail (self != NULL, NULL);
+  g_return_val_if_fail (g_task_is_valid (result, NULL), NULL);
+  g_return_val_if_fail (g_async_result_is_tagged (result, gt_dbus_queue_pop_message_async), NULL);
+  g_return_val_if_fail (error == NULL || *error == NULL, NULL);
+
+  return g_task_propagate_pointer (G_TASK (result), error);
+}
+
+/* Fail all pending gt_dbus_queue_pop_message_async() calls with
+ * %G_IO_ERROR_CLOSED. Called when disconnecting. */
+static void
+gt_dbus_queue_cancel_pop_waiters (GtDBusQueue *self)
+{
+  g_autoptr(GPtrArray) waiters = NULL;
+
+  g_mutex_lock (&self->lock);
+  waiters = g_steal_pointer (&self->pop_waiters);
+  self->pop_waiters = g_ptr_array_new_with_free_func ((GDestroyNotify) pop_waiter_unref);
+  g_mutex_unlock (&self->lock);
+
+  /* The @cancelled_id values can be read unlocked, since the waiters are no
+   * longer in #GtDBusQueue.pop_waiters. */
+  for (gsize i = 0; i < waiters->len; i++)
+    {
+      PopWaiter *waiter = g_ptr_array_index (waiters, i);
+
+      pop_waiter_disconnect (waiter, waiter->cancelled_id);
+      g_task_return_new_error (waiter->task, G_IO_ERROR, G_IO_ERROR_CLOSED,
+                               "GtDBusQueue was disconnected before a matching message arrived");
+      g_clear_object (&waiter->task);
+    }
 }
 
 /**
@@ -1131,9 +3607,18 @@ gt_dbus_queue_match_client_message (GtDBusQueue           *self,
 gchar *
 gt_dbus_queue_format_message (GDBusMethodInvocation *invocation)
 {
+  g_autofree gchar *message = NULL;
+  gint cpu;
+
   g_return_val_if_fail (G_IS_DBUS_METHOD_INVOCATION (invocation), NULL);
 
-  return g_dbus_message_print (g_dbus_method_invocation_get_message (invocation), 0);
+  message = g_dbus_message_print (g_dbus_method_invocation_get_message (invocation), 0);
+  cpu = gt_dbus_queue_get_message_cpu (invocation);
+
+  if (cpu < 0)
+    return g_steal_pointer (&message);
+
+  return g_strdup_printf ("%s  Received on CPU %d\n", message, cpu);
 }
 
 /**
@@ -1153,43 +3638,21 @@ gchar *
 gt_dbus_queue_format_messages (GtDBusQueue *self)
 {
   g_autoptr(GString) output = NULL;
-  g_autoptr(GPtrArray) local_queue = NULL;
-  g_autoptr(GDBusMethodInvocation) message = NULL;
-  gsize i;
 
   g_return_val_if_fail (self != NULL, NULL);
 
-  /* Cyclically pop all the elements off the head of the queue and push them
-   * onto a local queue, printing each one as we go. Then push that lot back
-   * onto the original queue so it’s unchanged overall. Since there are no
-   * accessors to inspect the inner elements of a #GAsyncQueue, this is the best
-   * we can do. */
-  g_async_queue_lock (self->server_message_queue);
-
-  local_queue = g_ptr_array_new_with_free_func (g_object_unref);
   output = g_string_new ("");
 
-  while ((message = g_async_queue_try_pop_unlocked (self->server_message_queue)) != NULL)
-    {
-      g_autofree gchar *formatted = gt_dbus_queue_format_message (message);
-      g_string_append (output, formatted);
-
-      g_ptr_array_add (local_queue, g_steal_pointer (&message));
-    }
+  g_mutex_lock (&self->lock);
 
-  /* Reassemble the queue. */
-  for (i = 0; i < local_queue->len; i++)
+  for (const GList *l = self->server_messages.head; l != NULL; l = l->next)
     {
-      /* FIXME: Use g_ptr_array_steal() here once we can depend on a new enough
-       * GLib version. */
-      message = g_steal_pointer (&g_ptr_array_index (local_queue, i));
-      g_async_queue_push_unlocked (self->server_message_queue, g_steal_pointer (&message));
+      const QueuedMessage *queued = l->data;
+      g_autofree gchar *formatted = gt_dbus_queue_format_message (queued->invocation);
+      g_string_append (output, formatted);
     }
 
-  /* We’ve stolen all the elements. */
-  g_ptr_array_set_free_func (local_queue, NULL);
-
-  g_async_queue_unlock (self->server_message_queue);
+  g_mutex_unlock (&self->lock);
 
   return g_string_free (g_steal_pointer (&output), FALSE);
 }
@@ -1205,14 +3668,18 @@ gt_dbus_queue_format_messages (GtDBusQueue *self)
  * @expected_object_path: object path the invocation is expected to be calling
  * @expected_interface_name: interface name the invocation is expected to be calling
  * @expected_method_name: method name the invocation is expected to be calling
- * @parameters_format: g_variant_get() format string to extract the parameters
- *    from the popped #GDBusMethodInvocation into the return locations provided
- *    in @...
+ * @parameters_format: (nullable): g_variant_get() format string to extract the
+ *    parameters from the popped #GDBusMethodInvocation into the return
+ *    locations provided in @...
  * @...: return locations for the parameter placeholders given in @parameters_format
  *
  * Internal function which implements the gt_dbus_queue_assert_pop_message()
  * macro.
  *
+ * If @parameters_format is %NULL, the parameters are not extracted, and the
+ * caller can extract them from the returned #GDBusMethodInvocation itself. This
+ * is used by the C++ wrapper, which extracts them with static types.
+ *
  * An assertion failure message will be printed if a #GDBusMethodInvocation
  * can’t be popped from the queue.
  *
@@ -1240,7 +3707,6 @@ gt_dbus_queue_assert_pop_message_impl (GtDBusQueue *self,
   g_return_val_if_fail (g_variant_is_object_path (expected_object_path), NULL);
   g_return_val_if_fail (g_dbus_is_interface_name (expected_interface_name), NULL);
   g_return_val_if_fail (g_dbus_is_member_name (expected_method_name), NULL);
-  g_return_val_if_fail (parameters_format != NULL, NULL);
 
   if (!gt_dbus_queue_pop_message (self, &invocation))
     {
@@ -1271,12 +3737,15 @@ gt_dbus_queue_assert_pop_message_impl (GtDBusQueue *self,
     }
 
   /* Passed the test! */
-  va_list parameters_args;
-  GVariant *parameters = g_dbus_method_invocation_get_parameters (invocation);
+  if (parameters_format != NULL)
+    {
+      va_list parameters_args;
+      GVariant *parameters = g_dbus_method_invocation_get_parameters (invocation);
 
-  va_start (parameters_args, parameters_format);
-  g_variant_get_va (parameters, parameters_format, NULL, &parameters_args);
-  va_end (parameters_args);
+      va_start (parameters_args, parameters_format);
+      g_variant_get_va (parameters, parameters_format, NULL, &parameters_args);
+      va_end (parameters_args);
+    }
 
   return g_steal_pointer (&invocation);
 }
@@ -25,6 +25,9 @@
 #include <gio/gio.h>
 #include <glib.h>
 #include <glib-object.h>
+#include <libglib-testing/main-context-profiler.h>
+#include <libglib-testing/perf-counters.h>
+#include <libglib-testing/shaping-proxy.h>
 
 G_BEGIN_DECLS
 
@@ -36,6 +39,17 @@ void         gt_dbus_queue_free (GtDBusQueue *self);
 G_DEFINE_AUTOPTR_CLEANUP_FUNC (GtDBusQueue, gt_dbus_queue_free)
 
 GDBusConnection *gt_dbus_queue_get_client_connection (GtDBusQueue *self);
+GMainContext    *gt_dbus_queue_get_client_context    (GtDBusQueue *self);
+GMainContext    *gt_dbus_queue_get_server_context    (GtDBusQueue *self);
+
+void            gt_dbus_queue_set_use_shaping_proxy (GtDBusQueue *self,
+                                                     gboolean     use_shaping_proxy);
+GtShapingProxy *gt_dbus_queue_get_shaping_proxy     (GtDBusQueue *self);
+
+void                   gt_dbus_queue_set_profiling         (GtDBusQueue *self,
+                                                            gboolean     profiling);
+GtMainContextProfiler *gt_dbus_queue_get_server_profiler   (GtDBusQueue *self);
+GtMainContextProfiler *gt_dbus_queue_get_client_profiler   (GtDBusQueue *self);
 
 gboolean gt_dbus_queue_connect         (GtDBusQueue         *self,
                                         GError             **error);
@@ -54,6 +68,12 @@ guint    gt_dbus_queue_export_object   (GtDBusQueue         *self,
 void     gt_dbus_queue_unexport_object (GtDBusQueue         *self,
                                         guint                id);
 
+guint    gt_dbus_queue_export_skeleton (GtDBusQueue             *self,
+                                        const gchar             *object_path,
+                                        GDBusInterfaceSkeleton  *skeleton,
+                                        const gchar * const     *queued_methods,
+                                        GError                 **error);
+
 /**
  * GtDBusQueueServerFunc:
  * @queue: a #GtDBusQueue
@@ -71,12 +91,147 @@ void     gt_dbus_queue_set_server_func (GtDBusQueue           *self,
                                         GtDBusQueueServerFunc  func,
                                         gpointer               user_data);
 
+/**
+ * GtDBusQueueThread:
+ * @GT_DBUS_QUEUE_THREAD_SERVER: the #GtDBusQueue server thread
+ * @GT_DBUS_QUEUE_THREAD_CALLER: the thread calling the function
+ *
+ * A thread whose scheduling parameters can be changed using
+ * gt_dbus_queue_set_thread_affinity() or gt_dbus_queue_set_thread_nice().
+ *
+ * Since: 0.2.0
+ */
+typedef enum
+{
+  GT_DBUS_QUEUE_THREAD_SERVER,
+  GT_DBUS_QUEUE_THREAD_CALLER,
+} GtDBusQueueThread;
+
+gboolean gt_dbus_queue_set_thread_affinity (GtDBusQueue        *self,
+                                            GtDBusQueueThread   thread,
+                                            guint               cpu,
+                                            GError            **error);
+gboolean gt_dbus_queue_set_thread_nice     (GtDBusQueue        *self,
+                                            GtDBusQueueThread   thread,
+                                            gint                nice_level,
+                                            GError            **error);
+
+gint     gt_dbus_queue_get_message_cpu     (GDBusMethodInvocation *invocation);
+
+GtPerfCounters *gt_dbus_queue_new_perf_counters (GtDBusQueue       *self,
+                                                 GtDBusQueueThread  thread);
+
+/**
+ * GtDBusQueueClassifierFunc:
+ * @queue: a #GtDBusQueue
+ * @invocation: (transfer none): the incoming method call
+ * @out_priority: (out): return location for the priority of the message;
+ *    this is %G_PRIORITY_DEFAULT on entry
+ * @user_data: user data passed to gt_dbus_queue_set_classifier_func()
+ *
+ * Function called in the server thread to choose which partition of the
+ * message queue an incoming method call is added to, and its priority. See
+ * gt_dbus_queue_set_classifier_func() for details.
+ *
+ * Returns: (transfer full) (not nullable): partition key for @invocation
+ * Since: 0.2.0
+ */
+typedef gchar *(*GtDBusQueueClassifierFunc) (GtDBusQueue           *queue,
+                                             GDBusMethodInvocation *invocation,
+                                             gint                  *out_priority,
+                                             gpointer               user_data);
+
+void     gt_dbus_queue_set_classifier_func (GtDBusQueue               *self,
+                                            GtDBusQueueClassifierFunc  func,
+                                            gpointer                   user_data,
+                                            GDestroyNotify             user_data_free_func);
+
+/**
+ * GtDBusQueueHandlerFunc:
+ * @queue: a #GtDBusQueue
+ * @invocation: (transfer none): the incoming method call
+ * @user_data: user data passed to gt_dbus_queue_add_handler()
+ *
+ * Function called in the server thread to handle a single incoming method call
+ * which matches a handler registered with gt_dbus_queue_add_handler(). See
+ * gt_dbus_queue_add_handler() for details.
+ *
+ * Since: 0.2.0
+ */
+typedef void (*GtDBusQueueHandlerFunc) (GtDBusQueue           *queue,
+                                        GDBusMethodInvocation *invocation,
+                                        gpointer               user_data);
+
+guint    gt_dbus_queue_add_handler     (GtDBusQueue            *self,
+                                        const gchar            *object_path,
+                                        const gchar            *interface_name,
+                                        const gchar            *method_name,
+                                        GtDBusQueueHandlerFunc  func,
+                                        gpointer                user_data,
+                                        GDestroyNotify          user_data_free_func);
+void     gt_dbus_queue_remove_handler  (GtDBusQueue            *self,
+                                        guint                   id);
+
+void     gt_dbus_queue_return_value_delayed (GtDBusQueue           *self,
+                                             GDBusMethodInvocation *invocation,
+                                             GVariant              *parameters,
+                                             guint                  delay_ms);
+
+void     gt_dbus_queue_set_expectations_ordered   (GtDBusQueue *self,
+                                                   gboolean     ordered);
+void     gt_dbus_queue_expect_call                (GtDBusQueue *self,
+                                                   const gchar *object_path,
+                                                   const gchar *interface_name,
+                                                   const gchar *method_name,
+                                                   const gchar *parameters_string,
+                                                   const gchar *reply_string);
+void     gt_dbus_queue_expect_call_error          (GtDBusQueue *self,
+                                                   const gchar *object_path,
+                                                   const gchar *interface_name,
+                                                   const gchar *method_name,
+                                                   const gchar *parameters_string,
+                                                   const gchar *error_name,
+                                                   const gchar *error_message);
+gsize    gt_dbus_queue_get_n_expectations         (GtDBusQueue *self);
+gsize    gt_dbus_queue_get_n_expectation_failures (GtDBusQueue *self);
+gchar   *gt_dbus_queue_format_expectations        (GtDBusQueue *self);
+
+void     gt_dbus_queue_set_learn_target     (GtDBusQueue  *self,
+                                             const gchar  *target_name);
+gsize    gt_dbus_queue_get_n_learnt_replies (GtDBusQueue  *self);
+gboolean gt_dbus_queue_save_reply_table     (GtDBusQueue  *self,
+                                             const gchar  *path,
+                                             GError      **error);
+gboolean gt_dbus_queue_load_reply_table     (GtDBusQueue  *self,
+                                             const gchar  *path,
+                                             GError      **error);
+
 gsize    gt_dbus_queue_get_n_messages   (GtDBusQueue            *self);
 gboolean gt_dbus_queue_try_pop_message  (GtDBusQueue            *self,
                                          GDBusMethodInvocation **out_invocation);
 gboolean gt_dbus_queue_pop_message      (GtDBusQueue            *self,
                                          GDBusMethodInvocation **out_invocation);
 
+gsize    gt_dbus_queue_get_n_messages_for  (GtDBusQueue            *self,
+                                            const gchar            *partition);
+gboolean gt_dbus_queue_try_pop_message_for (GtDBusQueue            *self,
+                                            const gchar            *partition,
+                                            GDBusMethodInvocation **out_invocation);
+gboolean gt_dbus_queue_pop_message_for     (GtDBusQueue            *self,
+                                            const gchar            *partition,
+                                            GDBusMethodInvocation **out_invocation);
+
+void                   gt_dbus_queue_pop_message_async  (GtDBusQueue          *self,
+                                                          const gchar          *object_path,
+                                                          const gchar          *interface_name,
+                                                          const gchar          *method_name,
+                                                          GCancellable         *cancellable,
+                                                          GAsyncReadyCallback   callback,
+                                                          gpointer              user_data);
+GDBusMethodInvocation *gt_dbus_queue_pop_message_finish (GtDBusQueue          *self,
+                                                          GAsyncResult         *result,
+                                                          GError              **error);
+
 gboolean gt_dbus_queue_match_client_message (GtDBusQueue           *self,
                                              GDBusMethodInvocation *invocation,
                                              const gchar           *expected_object_path,
@@ -112,6 +267,32 @@ gchar   *gt_dbus_queue_format_messages      (GtDBusQueue           *self);
       } \
   } G_STMT_END
 
+/**
+ * gt_dbus_queue_assert_expectations_met:
+ * @self: a #GtDBusQueue
+ *
+ * Assert that all the expectations registered with gt_dbus_queue_expect_call()
+ * and gt_dbus_queue_expect_call_error() have been met, and that no unexpected
+ * method calls arrived while they were pending.
+ *
+ * If not, an assertion fails and some debug output is printed.
+ *
+ * Since: 0.2.0
+ */
+#define gt_dbus_queue_assert_expectations_met(self) \
+  G_STMT_START { \
+    if (gt_dbus_queue_get_n_expectations (self) > 0 || \
+        gt_dbus_queue_get_n_expectation_failures (self) > 0) \
+      { \
+        g_autofree gchar *aem_list = gt_dbus_queue_format_expectations (self); \
+        g_autofree gchar *aem_message = \
+            g_strdup_printf ("Expected all expectations to be met, but saw:\n%s", \
+                             aem_list); \
+        g_assertion_message (G_LOG_DOMAIN, __FILE__, __LINE__, G_STRFUNC, \
+                             aem_message); \
+      } \
+  } G_STMT_END
+
 /**
  * gt_dbus_queue_assert_pop_message:
  * @self: a #GtDBusQueue
@@ -0,0 +1,56 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ *
+ * Copyright © 2018 Endless Mobile, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#pragma once
+
+#include <gio/gio.h>
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/*< private >*/
+typedef struct _GtDBusReplyTable GtDBusReplyTable;
+
+GBytes           *gt_dbus_reply_table_make_key      (const gchar            *object_path,
+                                                     const gchar            *interface_name,
+                                                     const gchar            *method_name,
+                                                     GVariant               *parameters);
+
+GVariant         *gt_dbus_reply_new_value           (GVariant               *parameters);
+GVariant         *gt_dbus_reply_new_error           (const gchar            *error_name,
+                                                     const gchar            *error_message);
+void              gt_dbus_reply_send                (GVariant               *reply,
+                                                     GDBusMethodInvocation  *invocation);
+
+gboolean          gt_dbus_reply_table_write         (GHashTable             *replies,
+                                                     const gchar            *path,
+                                                     GError                **error);
+
+GtDBusReplyTable *gt_dbus_reply_table_new_from_file (const gchar            *path,
+                                                     GError                **error);
+void              gt_dbus_reply_table_free          (GtDBusReplyTable       *self);
+
+gsize             gt_dbus_reply_table_get_n_entries (GtDBusReplyTable       *self);
+GVariant         *gt_dbus_reply_table_lookup        (GtDBusReplyTable       *self,
+                                                     GBytes                 *key);
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC (GtDBusReplyTable, gt_dbus_reply_table_free)
+
+G_END_DECLS
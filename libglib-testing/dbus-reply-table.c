@@ -0,0 +1,572 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ *
+ * Copyright © 2018 Endless Mobile, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#include "config.h"
+
+#include <gio/gio.h>
+#include <glib.h>
+#include <libglib-testing/dbus-reply-table-private.h>
+#include <string.h>
+
+
+/* A reply table maps method calls to their replies, so that #GtDBusQueue can
+ * reply to them automatically in the server thread. Tables are built by
+ * recording the replies from a real service (see
+ * gt_dbus_queue_set_learn_target()), written to a file, and later loaded by
+ * memory-mapping the file, so that large tables are cheap to load and are
+ * never parsed as a whole.
+ *
+ * Keys are the serialised normal form of a `(sssv)` variant containing the
+ * object path, interface name, method name and parameters of a method call, so
+ * equal parameters always give equal keys. Replies are `(ssv)` variants
+ * containing an empty error name, an empty error message and the reply
+ * parameters for a successful reply; or a D-Bus error name, error message and
+ * empty tuple for an error reply. All variants are stored little-endian.
+ *
+ * The file is a hash table with chained entries. All integers are stored as
+ * little-endian 32-bit unsigned integers. It contains, in order:
+ *  - a header: the magic bytes `GtDBusRT`, the format version, the number of
+ *    buckets (a power of two) and the number of entries;
+ *  - the buckets, each the index of the first entry in its chain, or
+ *    %NO_INDEX if it’s empty;
+ *  - the entries, each containing the hash of its key, the index of the next
+ *    entry in its chain (or %NO_INDEX), and the offsets and sizes of its key
+ *    and reply in the file;
+ *  - the keys and replies, with each reply aligned to 8 bytes so it can be
+ *    used in place as a #GVariant.
+ */
+
+#define MAGIC "GtDBusRT"
+#define MAGIC_SIZE 8
+#define FORMAT_VERSION 1
+#define HEADER_SIZE (MAGIC_SIZE + 3 * sizeof (guint32))
+#define NO_INDEX G_MAXUINT32
+
+typedef enum
+{
+  ENTRY_HASH = 0,
+  ENTRY_NEXT,
+  ENTRY_KEY_OFFSET,
+  ENTRY_KEY_SIZE,
+  ENTRY_REPLY_OFFSET,
+  ENTRY_REPLY_SIZE,
+} EntryField;
+
+#define ENTRY_SIZE ((ENTRY_REPLY_SIZE + 1) * sizeof (guint32))
+
+struct _GtDBusReplyTable
+{
+  GMappedFile *file;  /* (owned) */
+  GBytes *bytes;  /* (owned) */
+  const guint8 *data;  /* (unowned) */
+  gsize size;
+
+  guint32 n_buckets;
+  guint32 n_entries;
+  gsize buckets_offset;
+  gsize entries_offset;
+};
+
+/* FNV-1a, which (unlike g_bytes_hash()) is guaranteed to be the same when the
+ * table is written and when it’s read. */
+static guint32
+hash_key (const guint8 *data,
+          gsize         size)
+{
+  guint32 hash = 2166136261u;
+
+  for (gsize i = 0; i < size; i++)
+    {
+      hash ^= data[i];
+      hash *= 16777619u;
+    }
+
+  return hash;
+}
+
+static guint32
+read_uint32 (const guint8 *data,
+             gsize         offset)
+{
+  guint32 value;
+
+  memcpy (&value, data + offset, sizeof (value));
+
+  return GUINT32_FROM_LE (value);
+}
+
+static void
+write_uint32 (GByteArray *array,
+              gsize       offset,
+              guint32     value)
+{
+  value = GUINT32_TO_LE (value);
+  memcpy (array->data + offset, &value, sizeof (value));
+}
+
+static void
+append_uint32 (GByteArray *array,
+               guint32     value)
+{
+  value = GUINT32_TO_LE (value);
+  g_byte_array_append (array, (const guint8 *) &value, sizeof (value));
+}
+
+static guint32
+read_entry_field (GtDBusReplyTable *self,
+                  guint32           index,
+                  EntryField        field)
+{
+  return read_uint32 (self->data,
+                      self->entries_offset + (gsize) index * ENTRY_SIZE +
+                      (gsize) field * sizeof (guint32));
+}
+
+/* Serialise the normal form of @variant, little-endian. */
+static GBytes *
+variant_to_le_bytes (GVariant *variant)
+{
+  g_autoptr(GVariant) normal = g_variant_get_normal_form (variant);
+
+#if G_BYTE_ORDER == G_BIG_ENDIAN
+  g_autoptr(GVariant) swapped = g_variant_byteswap (normal);
+  return g_variant_get_data_as_bytes (swapped);
+#else
+  return g_variant_get_data_as_bytes (normal);
+#endif
+}
+
+/*
+ * gt_dbus_reply_table_make_key:
+ * @object_path: object path the method was called on
+ * @interface_name: interface the method was called on
+ * @method_name: name of the method
+ * @parameters: parameters of the method call
+ *
+ * Build the reply table key for a method call.
+ *
+ * Returns: (transfer full): the key
+ * Since: 0.2.0
+ */
+GBytes *
+gt_dbus_reply_table_make_key (const gchar *object_path,
+                              const gchar *interface_name,
+                              const gchar *method_name,
+                              GVariant    *parameters)
+{
+  g_autoptr(GVariant) key = NULL;
+
+  key = g_variant_ref_sink (g_variant_new ("(sssv)", object_path,
+                                           interface_name, method_name,
+                                           parameters));
+
+  return variant_to_le_bytes (key);
+}
+
+/*
+ * gt_dbus_reply_new_value:
+ * @parameters: (nullable): tuple of reply parameters, or %NULL for an empty
+ *    reply
+ *
+ * Build a reply for a method call which succeeded.
+ *
+ * Returns: (transfer full): the reply
+ * Since: 0.2.0
+ */
+GVariant *
+gt_dbus_reply_new_value (GVariant *parameters)
+{
+  if (parameters == NULL)
+    parameters = g_variant_new ("()");
+
+  return g_variant_ref_sink (g_variant_new ("(ssv)", "", "", parameters));
+}
+
+/*
+ * gt_dbus_reply_new_error:
+ * @error_name: D-Bus error name
+ * @error_message: human readable error message
+ *
+ * Build a reply for a method call which returned an error.
+ *
+ * Returns: (transfer full): the reply
+ * Since: 0.2.0
+ */
+GVariant *
+gt_dbus_reply_new_error (const gchar *error_name,
+                         const gchar *error_message)
+{
+  return g_variant_ref_sink (g_variant_new ("(ssv)", error_name, error_message,
+                                            g_variant_new ("()")));
+}
+
+/*
+ * gt_dbus_reply_send:
+ * @reply: a reply from gt_dbus_reply_new_value(), gt_dbus_reply_new_error() or
+ *    gt_dbus_reply_table_lookup()
+ * @invocation: (transfer full): the method call to reply to
+ *
+ * Reply to @invocation with @reply. As with
+ * g_dbus_method_invocation_return_value(), this takes ownership of
+ * @invocation.
+ *
+ * Since: 0.2.0
+ */
+void
+gt_dbus_reply_send (GVariant              *reply,
+                    GDBusMethodInvocation *invocation)
+{
+  const gchar *error_name, *error_message;
+  g_autoptr(GVariant) parameters = NULL;
+
+  g_variant_get (reply, "(&s&sv)", &error_name, &error_message, &parameters);
+
+  /* Replies loaded from a file are not trusted to be valid. */
+  if (*error_name != '\0' && g_dbus_is_interface_name (error_name))
+    g_dbus_method_invocation_return_dbus_error (invocation, error_name,
+                                                error_message);
+  else if (*error_name == '\0' &&
+           g_variant_is_of_type (parameters, G_VARIANT_TYPE_TUPLE))
+    g_dbus_method_invocation_return_value (invocation, parameters);
+  else
+    g_dbus_method_invocation_return_error_literal (invocation, G_DBUS_ERROR,
+                                                   G_DBUS_ERROR_FAILED,
+                                                   "Invalid recorded reply");
+}
+
+static gint
+compare_bytes (gconstpointer a,
+               gconstpointer b)
+{
+  GBytes *bytes_a = *((GBytes **) a);
+  GBytes *bytes_b = *((GBytes **) b);
+
+  return g_bytes_compare (bytes_a, bytes_b);
+}
+
+/*
+ * gt_dbus_reply_table_write:
+ * @replies: (element-type GBytes GVariant): map of keys from
+ *    gt_dbus_reply_table_make_key() to replies
+ * @path: file to write the table to
+ * @error: return location for a #GError, or %NULL
+ *
+ * Write @replies to a reply table file at @path, replacing it atomically.
+ * Entries are written in key order, so the same @replies always give the same
+ * file.
+ *
+ * Returns: %TRUE on success, %FALSE otherwise
+ * Since: 0.2.0
+ */
+gboolean
+gt_dbus_reply_table_write (GHashTable   *replies,
+                           const gchar  *path,
+                           GError      **error)
+{
+  g_autoptr(GByteArray) file = g_byte_array_new ();
+  g_autoptr(GPtrArray) keys = g_ptr_array_new ();
+  GHashTableIter iter;
+  gpointer key;
+  guint32 n_entries, n_buckets;
+  gsize buckets_offset, entries_offset;
+
+  g_hash_table_iter_init (&iter, replies);
+  while (g_hash_table_iter_next (&iter, &key, NULL))
+    g_ptr_array_add (keys, key);
+  g_ptr_array_sort (keys, compare_bytes);
+
+  n_entries = keys->len;
+  n_buckets = 1;
+  while (n_buckets < n_entries)
+    n_buckets *= 2;
+
+  g_byte_array_append (file, (const guint8 *) MAGIC, MAGIC_SIZE);
+  append_uint32 (file, FORMAT_VERSION);
+  append_uint32 (file, n_buckets);
+  append_uint32 (file, n_entries);
+
+  buckets_offset = file->len;
+  for (guint32 i = 0; i < n_buckets; i++)
+    append_uint32 (file, NO_INDEX);
+
+  entries_offset = file->len;
+  g_byte_array_set_size (file, entries_offset + n_entries * ENTRY_SIZE);
+
+  for (guint32 i = 0; i < n_entries; i++)
+    {
+      GBytes *entry_key = g_ptr_array_index (keys, i);
+      GVariant *reply = g_hash_table_lookup (replies, entry_key);
+      g_autoptr(GBytes) reply_bytes = variant_to_le_bytes (reply);
+      const guint8 *key_data, *reply_data;
+      gsize key_size, reply_size;
+      gsize entry_offset = entries_offset + i * ENTRY_SIZE;
+      gsize bucket_offset;
+      guint32 hash;
+
+      key_data = g_bytes_get_data (entry_key, &key_size);
+      reply_data = g_bytes_get_data (reply_bytes, &reply_size);
+      hash = hash_key (key_data, key_size);
+      bucket_offset = buckets_offset + (hash & (n_buckets - 1)) * sizeof (guint32);
+
+      /* Offsets are stored as 32-bit integers, so the file can’t be bigger
+       * than that (allowing for alignment padding). */
+      if ((guint64) file->len + key_size + 8 + reply_size > G_MAXUINT32)
+        {
+          g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_NO_SPACE,
+                               "Too many replies to write to a reply table");
+          return FALSE;
+        }
+
+      /* Prepend the entry to its bucket’s chain. */
+      write_uint32 (file, entry_offset + ENTRY_HASH * sizeof (guint32), hash);
+      write_uint32 (file, entry_offset + ENTRY_NEXT * sizeof (guint32),
+                    read_uint32 (file->data, bucket_offset));
+      write_uint32 (file, bucket_offset, i);
+
+      write_uint32 (file, entry_offset + ENTRY_KEY_OFFSET * sizeof (guint32), file->len);
+      write_uint32 (file, entry_offset + ENTRY_KEY_SIZE * sizeof (guint32), key_size);
+      g_byte_array_append (file, key_data, key_size);
+
+      while (file->len % 8 != 0)
+        g_byte_array_append (file, (const guint8 *) "", 1);
+
+      write_uint32 (file, entry_offset + ENTRY_REPLY_OFFSET * sizeof (guint32), file->len);
+      write_uint32 (file, entry_offset + ENTRY_REPLY_SIZE * sizeof (guint32), reply_size);
+      g_byte_array_append (file, reply_data, reply_size);
+    }
+
+  return g_file_set_contents (path, (const gchar *) file->data, file->len, error);
+}
+
+/* Check that all the offsets in the table are in bounds, so that lookups don’t
+ * need to. */
+static gboolean
+reply_table_validate (GtDBusReplyTable  *self,
+                      GError           **error)
+{
+  guint32 version;
+  guint64 end;
+
+  if (self->size < HEADER_SIZE ||
+      memcmp (self->data, MAGIC, MAGIC_SIZE) != 0)
+    {
+      g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                           "Not a reply table");
+      return FALSE;
+    }
+
+  version = read_uint32 (self->data, MAGIC_SIZE);
+  if (version != FORMAT_VERSION)
+    {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                   "Unsupported reply table version %u", version);
+      return FALSE;
+    }
+
+  self->n_buckets = read_uint32 (self->data, MAGIC_SIZE + sizeof (guint32));
+  self->n_entries = read_uint32 (self->data, MAGIC_SIZE + 2 * sizeof (guint32));
+
+  end = HEADER_SIZE + (guint64) self->n_buckets * sizeof (guint32) +
+        (guint64) self->n_entries * ENTRY_SIZE;
+
+  if (self->n_buckets == 0 ||
+      (self->n_buckets & (self->n_buckets - 1)) != 0 ||
+      end > self->size)
+    {
+      g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                           "Invalid reply table header");
+      return FALSE;
+    }
+
+  self->buckets_offset = HEADER_SIZE;
+  self->entries_offset = HEADER_SIZE + (gsize) self->n_buckets * sizeof (guint32);
+
+  for (guint32 i = 0; i < self->n_buckets; i++)
+    {
+      guint32 index = read_uint32 (self->data,
+                                   self->buckets_offset + (gsize) i * sizeof (guint32));
+
+      if (index != NO_INDEX && index >= self->n_entries)
+        {
+          g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                       "Invalid reply table bucket %u", i);
+          return FALSE;
+        }
+    }
+
+  for (guint32 i = 0; i < self->n_entries; i++)
+    {
+      guint32 next = read_entry_field (self, i, ENTRY_NEXT);
+      guint64 key_end = (guint64) read_entry_field (self, i, ENTRY_KEY_OFFSET) +
+                        read_entry_field (self, i, ENTRY_KEY_SIZE);
+      guint32 reply_offset = read_entry_field (self, i, ENTRY_REPLY_OFFSET);
+      guint64 reply_end = (guint64) reply_offset +
+                          read_entry_field (self, i, ENTRY_REPLY_SIZE);
+
+      if ((next != NO_INDEX && next >= self->n_entries) ||
+          key_end > self->size ||
+          reply_offset % 8 != 0 ||
+          reply_end > self->size)
+        {
+          g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA,
+                       "Invalid reply table entry %u", i);
+          return FALSE;
+        }
+    }
+
+  return TRUE;
+}
+
+/*
+ * gt_dbus_reply_table_new_from_file:
+ * @path: reply table file to load
+ * @error: return location for a #GError, or %NULL
+ *
+ * Load a reply table written by gt_dbus_reply_table_write(). The file is
+ * memory-mapped, and its header and offsets are checked; the keys and replies
+ * are only read when they are looked up.
+ *
+ * Returns: (transfer full): a new #GtDBusReplyTable, or %NULL on error
+ * Since: 0.2.0
+ */
+GtDBusReplyTable *
+gt_dbus_reply_table_new_from_file (const gchar  *path,
+                                   GError      **error)
+{
+  g_autoptr(GMappedFile) file = NULL;
+  g_autoptr(GtDBusReplyTable) table = NULL;
+  g_autoptr(GError) local_error = NULL;
+
+  file = g_mapped_file_new (path, FALSE, error);
+  if (file == NULL)
+    return NULL;
+
+  table = g_new0 (GtDBusReplyTable, 1);
+  table->bytes = g_mapped_file_get_bytes (file);
+  table->file = g_steal_pointer (&file);
+  table->data = g_bytes_get_data (table->bytes, &table->size);
+
+  if (!reply_table_validate (table, &local_error))
+    {
+      g_propagate_prefixed_error (error, g_steal_pointer (&local_error),
+                                  "Error loading reply table ‘%s’: ", path);
+      return NULL;
+    }
+
+  return g_steal_pointer (&table);
+}
+
+/*
+ * gt_dbus_reply_table_free:
+ * @self: (transfer full): a #GtDBusReplyTable
+ *
+ * Free a #GtDBusReplyTable. Replies returned by gt_dbus_reply_table_lookup()
+ * remain valid afterwards.
+ *
+ * Since: 0.2.0
+ */
+void
+gt_dbus_reply_table_free (GtDBusReplyTable *self)
+{
+  g_return_if_fail (self != NULL);
+
+  g_clear_pointer (&self->bytes, g_bytes_unref);
+  g_clear_pointer (&self->file, g_mapped_file_unref);
+  g_free (self);
+}
+
+/*
+ * gt_dbus_reply_table_get_n_entries:
+ * @self: a #GtDBusReplyTable
+ *
+ * Get the number of replies in the table.
+ *
+ * Returns: number of replies
+ * Since: 0.2.0
+ */
+gsize
+gt_dbus_reply_table_get_n_entries (GtDBusReplyTable *self)
+{
+  g_return_val_if_fail (self != NULL, 0);
+
+  return self->n_entries;
+}
+
+/*
+ * gt_dbus_reply_table_lookup:
+ * @self: a #GtDBusReplyTable
+ * @key: a key from gt_dbus_reply_table_make_key()
+ *
+ * Look up the reply for @key. The reply refers to the mapped file, rather than
+ * copying it.
+ *
+ * Returns: (transfer full) (nullable): the reply, or %NULL if there is none
+ * Since: 0.2.0
+ */
+GVariant *
+gt_dbus_reply_table_lookup (GtDBusReplyTable *self,
+                            GBytes           *key)
+{
+  const guint8 *key_data;
+  gsize key_size;
+  guint32 hash, index;
+
+  g_return_val_if_fail (self != NULL, NULL);
+  g_return_val_if_fail (key != NULL, NULL);
+
+  key_data = g_bytes_get_data (key, &key_size);
+  hash = hash_key (key_data, key_size);
+  index = read_uint32 (self->data,
+                       self->buckets_offset +
+                       (gsize) (hash & (self->n_buckets - 1)) * sizeof (guint32));
+
+  /* Bound the walk, in case the file contains a cycle. */
+  for (guint32 n_visited = 0;
+       index != NO_INDEX && n_visited < self->n_entries;
+       n_visited++, index = read_entry_field (self, index, ENTRY_NEXT))
+    {
+      g_autoptr(GBytes) reply_bytes = NULL;
+      GVariant *reply;
+
+      if (read_entry_field (self, index, ENTRY_HASH) != hash ||
+          read_entry_field (self, index, ENTRY_KEY_SIZE) != key_size ||
+          memcmp (self->data + read_entry_field (self, index, ENTRY_KEY_OFFSET),
+                  key_data, key_size) != 0)
+        continue;
+
+      reply_bytes = g_bytes_new_from_bytes (self->bytes,
+                                            read_entry_field (self, index, ENTRY_REPLY_OFFSET),
+                                            read_entry_field (self, index, ENTRY_REPLY_SIZE));
+      reply = g_variant_ref_sink (g_variant_new_from_bytes (G_VARIANT_TYPE ("(ssv)"),
+                                                            reply_bytes, FALSE));
+
+#if G_BYTE_ORDER == G_BIG_ENDIAN
+      {
+        GVariant *swapped = g_variant_byteswap (reply);
+        g_variant_unref (reply);
+        reply = swapped;
+      }
+#endif
+
+      return reply;
+    }
+
+  return NULL;
+}
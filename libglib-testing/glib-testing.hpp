@@ -0,0 +1,881 @@
+/* -*- mode: C++; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ *
+ * Copyright © 2018 Endless Mobile, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#pragma once
+
+#if !defined(__cplusplus) || __cplusplus < 201703L
+#error "libglib-testing/glib-testing.hpp requires C++17 or later"
+#endif
+
+#include <cstddef>
+#include <cstring>
+#include <initializer_list>
+#include <optional>
+#include <string>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include <gio/gio.h>
+#include <glib.h>
+#include <glib-object.h>
+#include <libglib-testing/dbus-queue.h>
+#include <libglib-testing/signal-logger.h>
+
+/*
+ * Optional C++17 wrappers for #GtDBusQueue and #GtSignalLogger.
+ *
+ * The wrapper types own the C objects they wrap, and free them when they go
+ * out of scope. Parameters of signal emissions and D-Bus method calls are
+ * extracted into variables passed by reference, and the types to extract are
+ * deduced from the types of those variables, rather than from varargs and a
+ * format string. A type with no mapping is a compile error, and a type which
+ * doesn’t match the emission or method call is an assertion failure rather
+ * than undefined behaviour. The GVariant type string for a method call’s
+ * parameters is built at compile time, so checking it is a single string
+ * comparison.
+ *
+ * Assertions are reported at the call site of the wrapper method, using
+ * compiler builtins supported by GCC and Clang. Extraction failures are
+ * reported at the call site of the assertion which popped the emission or
+ * method call.
+ *
+ * For example:
+ * |[<!-- language="C++" -->
+ * Gt::DBusQueue queue;
+ * …
+ * std::string name;
+ * std::vector<guint32> ids;
+ * auto invocation = queue.assert_pop_message ("/org/example/Foo",
+ *                                             "org.example.Foo", "Bar");
+ * invocation.get_parameters (name, ids);
+ * invocation.return_values (true);
+ * ]|
+ */
+
+namespace Gt
+{
+
+/* The location of a call, filled in from the caller’s location when used as
+ * a default argument. */
+struct SourceLocation
+{
+  const char *file;
+  int line;
+  const char *function;
+
+  constexpr SourceLocation (const char *file_ = __builtin_FILE (),
+                            int         line_ = __builtin_LINE (),
+                            const char *function_ = __builtin_FUNCTION ()) noexcept
+    : file (file_), line (line_), function (function_)
+  {
+  }
+};
+
+/* A D-Bus object path, to distinguish it from a string when extracting or
+ * building #GVariants. */
+struct ObjectPath
+{
+  std::string path;
+};
+
+namespace detail
+{
+
+template <typename T>
+struct AlwaysFalse : std::false_type
+{
+};
+
+inline void
+assertion_message (const SourceLocation &location,
+                   const char           *message)
+{
+  g_assertion_message (G_LOG_DOMAIN, location.file, location.line,
+                       location.function, message);
+}
+
+/* Owns a string allocated by GLib. */
+class CString
+{
+public:
+  explicit CString (gchar *str = nullptr) noexcept : str_ (str) {}
+  ~CString () { g_free (str_); }
+
+  CString (const CString &) = delete;
+  CString &operator= (const CString &) = delete;
+
+  CString (CString &&other) noexcept : str_ (std::exchange (other.str_, nullptr)) {}
+  CString &operator= (CString &&other) noexcept
+  {
+    std::swap (str_, other.str_);
+    return *this;
+  }
+
+  const gchar *get () const noexcept { return str_; }
+
+private:
+  gchar *str_;
+};
+
+/* A #GVariant type string of length @N, which can be built at compile time. */
+template <std::size_t N>
+struct TypeString
+{
+  char chars[N + 1];
+
+  constexpr const char *c_str () const noexcept { return chars; }
+};
+
+template <std::size_t N>
+constexpr TypeString<N - 1>
+make_type_string (const char (&str)[N])
+{
+  TypeString<N - 1> out {};
+
+  for (std::size_t i = 0; i < N; i++)
+    out.chars[i] = str[i];
+
+  return out;
+}
+
+template <std::size_t N, std::size_t M>
+constexpr TypeString<N + M>
+concat (const TypeString<N> &a,
+        const TypeString<M> &b)
+{
+  TypeString<N + M> out {};
+
+  for (std::size_t i = 0; i < N; i++)
+    out.chars[i] = a.chars[i];
+  for (std::size_t i = 0; i < M; i++)
+    out.chars[N + i] = b.chars[i];
+  out.chars[N + M] = '\0';
+
+  return out;
+}
+
+constexpr TypeString<0>
+concat_all ()
+{
+  return TypeString<0> {};
+}
+
+template <std::size_t N, typename... Rest>
+constexpr auto
+concat_all (const TypeString<N> &first,
+            const Rest &...      rest)
+{
+  return concat (first, concat_all (rest...));
+}
+
+/* Mapping from a C++ type to a #GVariant type. Each specialisation has a
+ * `type` string, and a `get()` function to extract a value from a #GVariant
+ * of that type and a `build()` function to create a floating #GVariant, if
+ * those are possible. */
+template <typename T>
+struct VariantTraits
+{
+  static_assert (AlwaysFalse<T>::value,
+                 "No GVariant type is known for this C++ type");
+};
+
+template <>
+struct VariantTraits<bool>
+{
+  static constexpr auto type = make_type_string ("b");
+  static bool get (GVariant *variant) { return g_variant_get_boolean (variant) != FALSE; }
+  static GVariant *build (bool value) { return g_variant_new_boolean (value ? TRUE : FALSE); }
+};
+
+#define GT_DEFINE_VARIANT_TRAITS(CxxType, type_string, getter, builder) \
+  template <> \
+  struct VariantTraits<CxxType> \
+  { \
+    static constexpr auto type = make_type_string (type_string); \
+    static CxxType get (GVariant *variant) { return getter (variant); } \
+    static GVariant *build (CxxType value) { return builder (value); } \
+  };
+
+GT_DEFINE_VARIANT_TRAITS (guint8, "y", g_variant_get_byte, g_variant_new_byte)
+GT_DEFINE_VARIANT_TRAITS (gint16, "n", g_variant_get_int16, g_variant_new_int16)
+GT_DEFINE_VARIANT_TRAITS (guint16, "q", g_variant_get_uint16, g_variant_new_uint16)
+GT_DEFINE_VARIANT_TRAITS (gint32, "i", g_variant_get_int32, g_variant_new_int32)
+GT_DEFINE_VARIANT_TRAITS (guint32, "u", g_variant_get_uint32, g_variant_new_uint32)
+GT_DEFINE_VARIANT_TRAITS (gint64, "x", g_variant_get_int64, g_variant_new_int64)
+GT_DEFINE_VARIANT_TRAITS (guint64, "t", g_variant_get_uint64, g_variant_new_uint64)
+GT_DEFINE_VARIANT_TRAITS (gdouble, "d", g_variant_get_double, g_variant_new_double)
+
+#undef GT_DEFINE_VARIANT_TRAITS
+
+template <>
+struct VariantTraits<std::string>
+{
+  static constexpr auto type = make_type_string ("s");
+  static std::string get (GVariant *variant) { return g_variant_get_string (variant, nullptr); }
+  static GVariant *build (const std::string &value) { return g_variant_new_string (value.c_str ()); }
+};
+
+/* Strings can be built from string literals, but not extracted into them. */
+template <>
+struct VariantTraits<const char *>
+{
+  static constexpr auto type = make_type_string ("s");
+  static GVariant *build (const char *value) { return g_variant_new_string (value); }
+};
+
+template <>
+struct VariantTraits<ObjectPath>
+{
+  static constexpr auto type = make_type_string ("o");
+  static ObjectPath get (GVariant *variant) { return ObjectPath { g_variant_get_string (variant, nullptr) }; }
+  static GVariant *build (const ObjectPath &value) { return g_variant_new_object_path (value.path.c_str ()); }
+};
+
+template <typename T>
+struct VariantTraits<std::vector<T>>
+{
+  static constexpr auto type = concat (make_type_string ("a"), VariantTraits<T>::type);
+
+  static std::vector<T>
+  get (GVariant *variant)
+  {
+    std::vector<T> out;
+    gsize n_children = g_variant_n_children (variant);
+
+    out.reserve (n_children);
+
+    for (gsize i = 0; i < n_children; i++)
+      {
+        GVariant *child = g_variant_get_child_value (variant, i);
+        out.push_back (VariantTraits<T>::get (child));
+        g_variant_unref (child);
+      }
+
+    return out;
+  }
+
+  static GVariant *
+  build (const std::vector<T> &value)
+  {
+    GVariantBuilder builder;
+
+    g_variant_builder_init (&builder, G_VARIANT_TYPE (type.c_str ()));
+
+    for (const auto &element : value)
+      g_variant_builder_add_value (&builder, VariantTraits<T>::build (element));
+
+    return g_variant_builder_end (&builder);
+  }
+};
+
+/* The #GVariant type string for a tuple of @Args, such as `(sau)`. */
+template <typename... Args>
+constexpr auto
+tuple_type_string ()
+{
+  return concat (concat (make_type_string ("("),
+                         concat_all (VariantTraits<Args>::type...)),
+                 make_type_string (")"));
+}
+
+/* Mapping from a C++ type to the #GValue types it can be extracted from. Each
+ * specialisation has a `name` for error messages, a `holds()` function to
+ * check a #GValue’s type, and a `get()` function to extract its value.
+ * Pointer types are borrowed from the #GValue. */
+template <typename T>
+struct ValueTraits
+{
+  static_assert (AlwaysFalse<T>::value,
+                 "No GValue type is known for this C++ type");
+};
+
+#define GT_DEFINE_VALUE_TRAITS(CxxType, cxx_name, holds_expr, get_expr) \
+  template <> \
+  struct ValueTraits<CxxType> \
+  { \
+    static constexpr const char *name = cxx_name; \
+    static bool holds (const GValue *value) { return (holds_expr); } \
+    static CxxType get (const GValue *value) { return (get_expr); } \
+  };
+
+GT_DEFINE_VALUE_TRAITS (bool, "bool",
+                        G_VALUE_HOLDS_BOOLEAN (value),
+                        g_value_get_boolean (value) != FALSE)
+GT_DEFINE_VALUE_TRAITS (gint, "gint",
+                        G_VALUE_HOLDS_INT (value) || G_VALUE_HOLDS_ENUM (value),
+                        G_VALUE_HOLDS_INT (value) ? g_value_get_int (value) : g_value_get_enum (value))
+GT_DEFINE_VALUE_TRAITS (guint, "guint",
+                        G_VALUE_HOLDS_UINT (value) || G_VALUE_HOLDS_FLAGS (value),
+                        G_VALUE_HOLDS_UINT (value) ? g_value_get_uint (value) : g_value_get_flags (value))
+GT_DEFINE_VALUE_TRAITS (gint64, "gint64",
+                        G_VALUE_HOLDS_INT64 (value) || G_VALUE_HOLDS_LONG (value),
+                        G_VALUE_HOLDS_INT64 (value) ? g_value_get_int64 (value) : g_value_get_long (value))
+GT_DEFINE_VALUE_TRAITS (guint64, "guint64",
+                        G_VALUE_HOLDS_UINT64 (value) || G_VALUE_HOLDS_ULONG (value),
+                        G_VALUE_HOLDS_UINT64 (value) ? g_value_get_uint64 (value) : g_value_get_ulong (value))
+GT_DEFINE_VALUE_TRAITS (gdouble, "gdouble",
+                        G_VALUE_HOLDS_DOUBLE (value) || G_VALUE_HOLDS_FLOAT (value),
+                        G_VALUE_HOLDS_DOUBLE (value) ? g_value_get_double (value) : g_value_get_float (value))
+GT_DEFINE_VALUE_TRAITS (std::string, "std::string",
+                        G_VALUE_HOLDS_STRING (value),
+                        std::string (g_value_get_string (value) != nullptr ? g_value_get_string (value) : ""))
+GT_DEFINE_VALUE_TRAITS (std::optional<std::string>, "std::optional<std::string>",
+                        G_VALUE_HOLDS_STRING (value),
+                        g_value_get_string (value) != nullptr ? std::optional<std::string> (g_value_get_string (value)) : std::nullopt)
+GT_DEFINE_VALUE_TRAITS (GParamSpec *, "GParamSpec *",
+                        G_VALUE_HOLDS_PARAM (value),
+                        g_value_get_param (value))
+GT_DEFINE_VALUE_TRAITS (GObject *, "GObject *",
+                        G_VALUE_HOLDS_OBJECT (value),
+                        static_cast<GObject *> (g_value_get_object (value)))
+GT_DEFINE_VALUE_TRAITS (GVariant *, "GVariant *",
+                        G_VALUE_HOLDS_VARIANT (value),
+                        g_value_get_variant (value))
+
+#undef GT_DEFINE_VALUE_TRAITS
+
+}  /* namespace detail */
+
+/* A signal emission popped from a #SignalLogger. It is empty if there was no
+ * emission to pop, or if it didn’t match an assertion. */
+class SignalLoggerEmission
+{
+public:
+  SignalLoggerEmission () noexcept = default;
+
+  /* Takes ownership of @obj_type_name, @signal_name and @emission. */
+  SignalLoggerEmission (gpointer                obj,
+                        gchar                  *obj_type_name,
+                        gchar                  *signal_name,
+                        GtSignalLoggerEmission *emission,
+                        const SourceLocation   &location) noexcept
+    : obj_ (obj), obj_type_name_ (obj_type_name), signal_name_ (signal_name),
+      emission_ (emission), location_ (location)
+  {
+  }
+
+  ~SignalLoggerEmission ()
+  {
+    if (emission_ != nullptr)
+      gt_signal_logger_emission_free (emission_);
+  }
+
+  SignalLoggerEmission (const SignalLoggerEmission &) = delete;
+  SignalLoggerEmission &operator= (const SignalLoggerEmission &) = delete;
+
+  SignalLoggerEmission (SignalLoggerEmission &&other) noexcept
+    : obj_ (other.obj_), obj_type_name_ (std::move (other.obj_type_name_)),
+      signal_name_ (std::move (other.signal_name_)),
+      emission_ (std::exchange (other.emission_, nullptr)),
+      location_ (other.location_)
+  {
+  }
+
+  SignalLoggerEmission &
+  operator= (SignalLoggerEmission &&other) noexcept
+  {
+    std::swap (obj_, other.obj_);
+    std::swap (obj_type_name_, other.obj_type_name_);
+    std::swap (signal_name_, other.signal_name_);
+    std::swap (emission_, other.emission_);
+    std::swap (location_, other.location_);
+    return *this;
+  }
+
+  explicit operator bool () const noexcept { return emission_ != nullptr; }
+
+  GtSignalLoggerEmission *get () const noexcept { return emission_; }
+  /* Opaque pointer to the emitting object, which may have been finalised. */
+  gpointer object () const noexcept { return obj_; }
+  const char *object_type_name () const noexcept { return obj_type_name_.get (); }
+  const char *signal_name () const noexcept { return signal_name_.get (); }
+
+  std::size_t
+  n_params () const
+  {
+    return (emission_ != nullptr) ? gt_signal_logger_emission_get_n_params (emission_) : 0;
+  }
+
+  std::string
+  format () const
+  {
+    if (emission_ == nullptr)
+      return std::string ();
+
+    detail::CString formatted (gt_signal_logger_format_emission (obj_,
+                                                                 obj_type_name_.get (),
+                                                                 signal_name_.get (),
+                                                                 emission_));
+    return formatted.get ();
+  }
+
+  /* Extract the emission’s parameters into @out, which must have one variable
+   * for each parameter, of a type compatible with it. Pointers are borrowed,
+   * and are valid as long as the emission is. If the number or types of the
+   * parameters don’t match, an assertion fails and none of @out are set. */
+  template <typename... Args>
+  void
+  get_params (Args &... out) const
+  {
+    if (emission_ == nullptr)
+      return;
+
+    gsize n_params = gt_signal_logger_emission_get_n_params (emission_);
+
+    if (n_params != sizeof... (Args))
+      {
+        detail::CString message (g_strdup_printf ("Expected %" G_GSIZE_FORMAT " parameters from emission of %s::%s, but it has %" G_GSIZE_FORMAT,
+                                                  static_cast<gsize> (sizeof... (Args)),
+                                                  obj_type_name_.get (), signal_name_.get (),
+                                                  n_params));
+        detail::assertion_message (location_, message.get ());
+        return;
+      }
+
+    get_params_impl (std::index_sequence_for<Args...> {}, out...);
+  }
+
+private:
+  template <typename T>
+  bool
+  check_param (std::size_t index) const
+  {
+    const GValue *value = gt_signal_logger_emission_get_param (emission_, index);
+
+    if (detail::ValueTraits<T>::holds (value))
+      return true;
+
+    detail::CString message (g_strdup_printf ("Expected parameter %" G_GSIZE_FORMAT " of emission of %s::%s to be extractable as %s, but it is a %s",
+                                              static_cast<gsize> (index),
+                                              obj_type_name_.get (), signal_name_.get (),
+                                              detail::ValueTraits<T>::name,
+                                              G_VALUE_TYPE_NAME (value)));
+    detail::assertion_message (location_, message.get ());
+    return false;
+  }
+
+  template <std::size_t... Is, typename... Args>
+  void
+  get_params_impl (std::index_sequence<Is...>,
+                   Args &... out) const
+  {
+    /* Check all the types before setting any of the outputs. */
+    if (!(check_param<Args> (Is) && ...))
+      return;
+
+    ((out = detail::ValueTraits<Args>::get (gt_signal_logger_emission_get_param (emission_, Is))), ...);
+  }
+
+  gpointer obj_ = nullptr;
+  detail::CString obj_type_name_;
+  detail::CString signal_name_;
+  GtSignalLoggerEmission *emission_ = nullptr;
+  SourceLocation location_;
+};
+
+/* Owns a #GtSignalLogger. */
+class SignalLogger
+{
+public:
+  SignalLogger () : logger_ (gt_signal_logger_new ()) {}
+
+  ~SignalLogger ()
+  {
+    if (logger_ != nullptr)
+      gt_signal_logger_free (logger_);
+  }
+
+  SignalLogger (const SignalLogger &) = delete;
+  SignalLogger &operator= (const SignalLogger &) = delete;
+
+  SignalLogger (SignalLogger &&other) noexcept : logger_ (std::exchange (other.logger_, nullptr)) {}
+  SignalLogger &
+  operator= (SignalLogger &&other) noexcept
+  {
+    std::swap (logger_, other.logger_);
+    return *this;
+  }
+
+  GtSignalLogger *get () const noexcept { return logger_; }
+
+  gulong
+  connect (gpointer    obj,
+           const char *signal_name)
+  {
+    return gt_signal_logger_connect (logger_, obj, signal_name);
+  }
+
+  std::size_t n_emissions () const { return gt_signal_logger_get_n_emissions (logger_); }
+
+  std::string
+  format_emissions () const
+  {
+    detail::CString formatted (gt_signal_logger_format_emissions (logger_));
+    return formatted.get ();
+  }
+
+  /* Pop the oldest emission, or return an empty one if there are none. */
+  SignalLoggerEmission
+  pop_emission (const SourceLocation &location = SourceLocation ())
+  {
+    gpointer obj = nullptr;
+    gchar *obj_type_name = nullptr;
+    gchar *signal_name = nullptr;
+    GtSignalLoggerEmission *emission = nullptr;
+
+    if (!gt_signal_logger_pop_emission (logger_, &obj, &obj_type_name,
+                                        &signal_name, &emission))
+      return SignalLoggerEmission ();
+
+    return SignalLoggerEmission (obj, obj_type_name, signal_name, emission,
+                                 location);
+  }
+
+  /* As gt_signal_logger_assert_no_emissions(). */
+  void
+  assert_no_emissions (const SourceLocation &location = SourceLocation ()) const
+  {
+    gsize n_emissions = gt_signal_logger_get_n_emissions (logger_);
+
+    if (n_emissions == 0)
+      return;
+
+    detail::CString list (gt_signal_logger_format_emissions (logger_));
+    detail::CString message (g_strdup_printf ("Expected no signal emissions, but saw %" G_GSIZE_FORMAT ":\n%s",
+                                              n_emissions, list.get ()));
+    detail::assertion_message (location, message.get ());
+  }
+
+  /* As gt_signal_logger_assert_emission_pop(), but the parameters are
+   * extracted by calling SignalLoggerEmission::get_params() on the result. */
+  SignalLoggerEmission
+  assert_emission_pop (gpointer              obj,
+                       const char           *signal_name,
+                       const SourceLocation &location = SourceLocation ())
+  {
+    SignalLoggerEmission emission = pop_emission (location);
+
+    if (!emission)
+      {
+        detail::CString message (g_strdup_printf ("Expected emission of %s::%s from %p, but saw no emissions",
+                                                  G_OBJECT_TYPE_NAME (obj), signal_name, obj));
+        detail::assertion_message (location, message.get ());
+        return SignalLoggerEmission ();
+      }
+
+    if (emission.object () != obj ||
+        !g_str_equal (emission.signal_name (), signal_name))
+      {
+        std::string formatted = emission.format ();
+        detail::CString message (g_strdup_printf ("Expected emission of %s::%s from %p, but saw: %s",
+                                                  G_OBJECT_TYPE_NAME (obj), signal_name, obj,
+                                                  formatted.c_str ()));
+        detail::assertion_message (location, message.get ());
+        return SignalLoggerEmission ();
+      }
+
+    return emission;
+  }
+
+  /* As gt_signal_logger_assert_notify_emission_pop(). */
+  void
+  assert_notify_emission_pop (gpointer              obj,
+                              const char           *property_name,
+                              const SourceLocation &location = SourceLocation ())
+  {
+    SignalLoggerEmission emission = pop_emission (location);
+    GParamSpec *pspec = nullptr;
+
+    if (emission &&
+        emission.object () == obj &&
+        g_str_has_prefix (emission.signal_name (), "notify") &&
+        emission.n_params () == 1 &&
+        detail::ValueTraits<GParamSpec *>::holds (gt_signal_logger_emission_get_param (emission.get (), 0)))
+      pspec = g_value_get_param (gt_signal_logger_emission_get_param (emission.get (), 0));
+
+    if (pspec != nullptr && g_str_equal (g_param_spec_get_name (pspec), property_name))
+      return;
+
+    std::string formatted = emission ? emission.format () : std::string ("no emissions");
+    detail::CString message (g_strdup_printf ("Expected emission of %s::%s::%s from %p, but saw: %s",
+                                              G_OBJECT_TYPE_NAME (obj), "notify", property_name, obj,
+                                              formatted.c_str ()));
+    detail::assertion_message (location, message.get ());
+  }
+
+private:
+  GtSignalLogger *logger_;
+};
+
+/* A method call popped from a #DBusQueue, which must be replied to using one
+ * of the `return_*()` methods. It is empty if there was no call to pop, or if
+ * it didn’t match an assertion. */
+class MethodInvocation
+{
+public:
+  MethodInvocation () noexcept = default;
+
+  /* Takes ownership of @invocation. */
+  MethodInvocation (GDBusMethodInvocation *invocation,
+                    const SourceLocation  &location) noexcept
+    : invocation_ (invocation), location_ (location)
+  {
+  }
+
+  ~MethodInvocation ()
+  {
+    if (invocation_ != nullptr)
+      g_object_unref (invocation_);
+  }
+
+  MethodInvocation (const MethodInvocation &) = delete;
+  MethodInvocation &operator= (const MethodInvocation &) = delete;
+
+  MethodInvocation (MethodInvocation &&other) noexcept
+    : invocation_ (std::exchange (other.invocation_, nullptr)),
+      location_ (other.location_)
+  {
+  }
+
+  MethodInvocation &
+  operator= (MethodInvocation &&other) noexcept
+  {
+    std::swap (invocation_, other.invocation_);
+    std::swap (location_, other.location_);
+    return *this;
+  }
+
+  explicit operator bool () const noexcept { return invocation_ != nullptr; }
+
+  GDBusMethodInvocation *get () const noexcept { return invocation_; }
+
+  /* Give up ownership of the invocation, for passing to a C function which
+   * takes ownership of it. */
+  GDBusMethodInvocation *release () noexcept { return std::exchange (invocation_, nullptr); }
+
+  /* Extract the method call’s parameters into @out, which must have one
+   * variable for each parameter, of the matching type. The expected parameter
+   * type string is built at compile time from the types of @out. If it doesn’t
+   * match, an assertion fails and none of @out are set. */
+  template <typename... Args>
+  void
+  get_parameters (Args &... out) const
+  {
+    static constexpr auto type = detail::tuple_type_string<Args...> ();
+
+    if (invocation_ == nullptr)
+      return;
+
+    GVariant *parameters = g_dbus_method_invocation_get_parameters (invocation_);
+    const char *actual_type = g_variant_get_type_string (parameters);
+
+    if (std::strcmp (actual_type, type.c_str ()) != 0)
+      {
+        detail::CString message (g_strdup_printf ("Expected parameters of type %s to %s.%s, but saw %s",
+                                                  type.c_str (),
+                                                  g_dbus_method_invocation_get_interface_name (invocation_),
+                                                  g_dbus_method_invocation_get_method_name (invocation_),
+                                                  actual_type));
+        detail::assertion_message (location_, message.get ());
+        return;
+      }
+
+    get_parameters_impl (parameters, std::index_sequence_for<Args...> {}, out...);
+  }
+
+  /* Reply to the method call with @values, whose types give the reply type. */
+  template <typename... Args>
+  void
+  return_values (const Args &... values)
+  {
+    /* Decaying `const Args` turns string literals into `const char *`. */
+    GVariant *children[] = { detail::VariantTraits<std::decay_t<const Args>>::build (values)..., nullptr };
+
+    g_dbus_method_invocation_return_value (release (),
+                                           g_variant_new_tuple (children, sizeof... (Args)));
+  }
+
+  void
+  return_error_literal (GQuark      domain,
+                        gint        code,
+                        const char *message)
+  {
+    g_dbus_method_invocation_return_error_literal (release (), domain, code, message);
+  }
+
+  void
+  return_gerror (const GError *error)
+  {
+    g_dbus_method_invocation_return_gerror (release (), error);
+  }
+
+private:
+  template <std::size_t... Is, typename... Args>
+  static void
+  get_parameters_impl (GVariant *parameters,
+                       std::index_sequence<Is...>,
+                       Args &... out)
+  {
+    ((out = get_child<Args> (parameters, Is)), ...);
+  }
+
+  template <typename T>
+  static T
+  get_child (GVariant    *parameters,
+             std::size_t  index)
+  {
+    GVariant *child = g_variant_get_child_value (parameters, index);
+    T value = detail::VariantTraits<T>::get (child);
+    g_variant_unref (child);
+    return value;
+  }
+
+  GDBusMethodInvocation *invocation_ = nullptr;
+  SourceLocation location_;
+};
+
+/* Owns a #GtDBusQueue. */
+class DBusQueue
+{
+public:
+  DBusQueue () : queue_ (gt_dbus_queue_new ()) {}
+
+  ~DBusQueue ()
+  {
+    if (queue_ != nullptr)
+      gt_dbus_queue_free (queue_);
+  }
+
+  DBusQueue (const DBusQueue &) = delete;
+  DBusQueue &operator= (const DBusQueue &) = delete;
+
+  DBusQueue (DBusQueue &&other) noexcept : queue_ (std::exchange (other.queue_, nullptr)) {}
+  DBusQueue &
+  operator= (DBusQueue &&other) noexcept
+  {
+    std::swap (queue_, other.queue_);
+    return *this;
+  }
+
+  GtDBusQueue *get () const noexcept { return queue_; }
+
+  bool
+  connect (GError **error = nullptr)
+  {
+    return gt_dbus_queue_connect (queue_, error);
+  }
+
+  void
+  disconnect (bool assert_queue_empty = true)
+  {
+    gt_dbus_queue_disconnect (queue_, assert_queue_empty);
+  }
+
+  GDBusConnection *client_connection () const { return gt_dbus_queue_get_client_connection (queue_); }
+
+  guint own_name (const char *name) { return gt_dbus_queue_own_name (queue_, name); }
+  void unown_name (guint id) { gt_dbus_queue_unown_name (queue_, id); }
+
+  guint
+  export_object (const char          *object_path,
+                 GDBusInterfaceInfo  *interface_info,
+                 GError             **error = nullptr)
+  {
+    return gt_dbus_queue_export_object (queue_, object_path, interface_info, error);
+  }
+
+  /* Export @skeleton, handling the methods named in @queued_methods using the
+   * queue, and all others using @skeleton. */
+  guint
+  export_skeleton (const char                          *object_path,
+                   GDBusInterfaceSkeleton              *skeleton,
+                   std::initializer_list<const char *>  queued_methods = {},
+                   GError                             **error = nullptr)
+  {
+    std::vector<const char *> names (queued_methods);
+    names.push_back (nullptr);
+
+    return gt_dbus_queue_export_skeleton (queue_, object_path, skeleton,
+                                          names.data (), error);
+  }
+
+  void unexport_object (guint id) { gt_dbus_queue_unexport_object (queue_, id); }
+
+  std::size_t n_messages () const { return gt_dbus_queue_get_n_messages (queue_); }
+
+  std::string
+  format_messages () const
+  {
+    detail::CString formatted (gt_dbus_queue_format_messages (queue_));
+    return formatted.get ();
+  }
+
+  /* Pop the oldest method call, blocking until one arrives or a timeout
+   * occurs, in which case an empty invocation is returned. */
+  MethodInvocation
+  pop_message (const SourceLocation &location = SourceLocation ())
+  {
+    GDBusMethodInvocation *invocation = nullptr;
+
+    if (!gt_dbus_queue_pop_message (queue_, &invocation))
+      return MethodInvocation ();
+
+    return MethodInvocation (invocation, location);
+  }
+
+  /* As gt_dbus_queue_assert_no_messages(). */
+  void
+  assert_no_messages (const SourceLocation &location = SourceLocation ()) const
+  {
+    gsize n_messages = gt_dbus_queue_get_n_messages (queue_);
+
+    if (n_messages == 0)
+      return;
+
+    detail::CString list (gt_dbus_queue_format_messages (queue_));
+    detail::CString message (g_strdup_printf ("Expected no messages, but saw %" G_GSIZE_FORMAT ":\n%s",
+                                              n_messages, list.get ()));
+    detail::assertion_message (location, message.get ());
+  }
+
+  /* As gt_dbus_queue_assert_pop_message(), but the parameters are extracted
+   * by calling MethodInvocation::get_parameters() on the result. */
+  MethodInvocation
+  assert_pop_message (const char           *object_path,
+                      const char           *interface_name,
+                      const char           *method_name,
+                      const SourceLocation &location = SourceLocation ())
+  {
+    GDBusMethodInvocation *invocation =
+        gt_dbus_queue_assert_pop_message_impl (queue_, G_LOG_DOMAIN,
+                                               location.file, location.line,
+                                               location.function, object_path,
+                                               interface_name, method_name,
+                                               nullptr);
+
+    return MethodInvocation (invocation, location);
+  }
+
+private:
+  GtDBusQueue *queue_;
+};
+
+}  /* namespace Gt */
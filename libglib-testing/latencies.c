@@ -0,0 +1,85 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ *
+ * Copyright © 2018 Endless Mobile, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#include "config.h"
+
+#include <glib.h>
+#include <libglib-testing/latencies-private.h>
+
+
+static gint
+compare_guint64 (gconstpointer a,
+                 gconstpointer b)
+{
+  guint64 value_a = *((const guint64 *) a);
+  guint64 value_b = *((const guint64 *) b);
+
+  return (value_a > value_b) - (value_a < value_b);
+}
+
+/*
+ * gt_latencies_sort:
+ * @latencies: (element-type guint64): an array of latencies
+ *
+ * Sort @latencies into increasing order, ready for
+ * gt_latencies_get_percentile().
+ *
+ * Since: 0.2.0
+ */
+void
+gt_latencies_sort (GArray *latencies)
+{
+  g_return_if_fail (latencies != NULL);
+
+  g_array_sort (latencies, compare_guint64);
+}
+
+/*
+ * gt_latencies_get_percentile:
+ * @latencies: (element-type guint64): an array of latencies, sorted using
+ *    gt_latencies_sort()
+ * @percentile: percentile to get, between 0 and 100
+ *
+ * Get the given @percentile of @latencies, using the nearest-rank method, so
+ * the result is always one of the latencies.
+ *
+ * Returns: latency percentile, or 0 if @latencies is empty
+ * Since: 0.2.0
+ */
+guint64
+gt_latencies_get_percentile (GArray  *latencies,
+                             gdouble  percentile)
+{
+  gdouble exact_rank;
+  gsize rank;
+
+  g_return_val_if_fail (latencies != NULL, 0);
+
+  if (latencies->len == 0)
+    return 0;
+
+  exact_rank = percentile / 100.0 * latencies->len;
+  rank = (gsize) exact_rank;
+  if ((gdouble) rank < exact_rank)
+    rank++;
+  rank = CLAMP (rank, 1, latencies->len);
+
+  return g_array_index (latencies, guint64, rank - 1);
+}
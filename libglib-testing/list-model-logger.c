@@ -0,0 +1,568 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ *
+ * Copyright © 2018 Endless Mobile, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#include "config.h"
+
+#include <gio/gio.h>
+#include <glib.h>
+#include <libglib-testing/list-model-logger.h>
+#include <string.h>
+
+
+/**
+ * SECTION:list-model-logger
+ * @short_description: Checks #GListModel change notifications
+ * @stability: Unstable
+ * @include: libglib-testing/list-model-logger.h
+ *
+ * #GtListModelLogger watches the #GListModel::items-changed emissions of a
+ * #GListModel, and checks that they are both correct and efficient. While
+ * gt_signal_logger_connect() can log the emissions, it can’t tell whether they
+ * describe the change to the model, or whether a smaller change would have
+ * described it as well.
+ *
+ * The logger keeps a shadow copy of the model’s items. Each emission is
+ * applied to the shadow copy, which is then compared against the model; any
+ * differences are reported as %GT_LIST_MODEL_LOGGER_ISSUE_INCONSISTENT. Items
+ * are compared by identity, so a model which returns a new object for an
+ * unchanged item each time it is asked will be reported as inconsistent.
+ *
+ * Each emission is also checked for wasteful patterns, such as resetting the
+ * whole model to change a few items, or emitting several adjacent changes
+ * instead of one; see #GtListModelLoggerIssue for the full list. To quantify
+ * the waste, the total number of items removed and added by the emissions is
+ * available from gt_list_model_logger_get_n_items_emitted(), and the number
+ * which actually changed from gt_list_model_logger_get_n_items_minimal(). The
+ * latter trims unchanged items from the start and end of each emitted range;
+ * it doesn’t detect items which were moved.
+ *
+ * Adjacent emissions are only reported as
+ * %GT_LIST_MODEL_LOGGER_ISSUE_SPLIT_RANGE if they happen in the same iteration
+ * of the thread-default #GMainContext of the thread where the logger was
+ * created, as a single operation on the model would do. Tests should iterate
+ * that context between separate operations.
+ *
+ * A #GtListModelLogger must be used from a single thread.
+ *
+ * Since: 0.2.0
+ */
+
+/* An issue detected with an emission. */
+typedef struct
+{
+  GtListModelLoggerIssue issue;
+  gchar *message;  /* (owned) */
+} Issue;
+
+static void
+issue_free (Issue *issue)
+{
+  g_free (issue->message);
+  g_free (issue);
+}
+
+/**
+ * GtListModelLogger:
+ *
+ * An object which checks the #GListModel::items-changed emissions of a
+ * #GListModel.
+ *
+ * Since: 0.2.0
+ */
+struct _GtListModelLogger
+{
+  GListModel *model;  /* (owned) */
+  gulong items_changed_id;
+  GMainContext *context;  /* (owned) */
+
+  GPtrArray *shadow;  /* (owned) (element-type GObject) */
+
+  guint n_emissions;
+  guint64 n_items_emitted;
+  guint64 n_items_minimal;
+  guint n_issues[GT_LIST_MODEL_LOGGER_ISSUE_LAST + 1];
+  GPtrArray *issues;  /* (owned) (element-type Issue) */
+
+  /* The previous emission in the current main context iteration, if any, for
+   * detecting split ranges. @batch_source is dispatched at the end of the
+   * iteration, and clears it. */
+  GSource *batch_source;  /* (owned) (nullable) */
+  gboolean have_previous;
+  guint previous_position;
+  guint previous_removed;
+  guint previous_added;
+};
+
+/**
+ * gt_list_model_logger_issue_get_name:
+ * @issue: a #GtListModelLoggerIssue
+ *
+ * Get a short name for @issue, such as `split-range`, for use in debug output.
+ *
+ * Returns: name of the issue
+ * Since: 0.2.0
+ */
+const gchar *
+gt_list_model_logger_issue_get_name (GtListModelLoggerIssue issue)
+{
+  switch (issue)
+    {
+    case GT_LIST_MODEL_LOGGER_ISSUE_INCONSISTENT:
+      return "inconsistent";
+    case GT_LIST_MODEL_LOGGER_ISSUE_NO_OP:
+      return "no-op";
+    case GT_LIST_MODEL_LOGGER_ISSUE_RESET:
+      return "reset";
+    case GT_LIST_MODEL_LOGGER_ISSUE_OVERSIZED:
+      return "oversized";
+    case GT_LIST_MODEL_LOGGER_ISSUE_SPLIT_RANGE:
+      return "split-range";
+    default:
+      g_return_val_if_reached (NULL);
+    }
+}
+
+static void add_issue (GtListModelLogger      *self,
+                       GtListModelLoggerIssue  issue,
+                       const gchar            *format,
+                       ...) G_GNUC_PRINTF (3, 4);
+
+static void
+add_issue (GtListModelLogger      *self,
+           GtListModelLoggerIssue  issue,
+           const gchar            *format,
+           ...)
+{
+  Issue *i;
+  va_list args;
+
+  i = g_new0 (Issue, 1);
+  i->issue = issue;
+
+  va_start (args, format);
+  i->message = g_strdup_vprintf (format, args);
+  va_end (args);
+
+  g_debug ("%s: %s: %s", G_STRFUNC,
+           gt_list_model_logger_issue_get_name (issue), i->message);
+
+  g_ptr_array_add (self->issues, i);
+  self->n_issues[issue]++;
+}
+
+/* Replace the shadow copy with the current contents of the model. */
+static void
+shadow_resync (GtListModelLogger *self)
+{
+  guint n_items = g_list_model_get_n_items (self->model);
+
+  g_ptr_array_set_size (self->shadow, 0);
+
+  for (guint i = 0; i < n_items; i++)
+    g_ptr_array_add (self->shadow, g_list_model_get_item (self->model, i));
+}
+
+/* Check whether the shadow copy matches the model, which must have the same
+ * number of items. Returns the index of the first mismatch, or -1. */
+static gint
+shadow_find_mismatch (GtListModelLogger *self)
+{
+  for (guint i = 0; i < self->shadow->len; i++)
+    {
+      g_autoptr(GObject) item = g_list_model_get_item (self->model, i);
+
+      if (item != g_ptr_array_index (self->shadow, i))
+        return (gint) i;
+    }
+
+  return -1;
+}
+
+/* Whether item @shadow_index in the shadow copy is the same as item
+ * @model_index in the model. */
+static gboolean
+shadow_item_unchanged (GtListModelLogger *self,
+                       guint              shadow_index,
+                       guint              model_index)
+{
+  g_autoptr(GObject) item = g_list_model_get_item (self->model, model_index);
+
+  return (item == g_ptr_array_index (self->shadow, shadow_index));
+}
+
+static gboolean
+batch_end_cb (gpointer user_data)
+{
+  GtListModelLogger *self = user_data;
+
+  g_clear_pointer (&self->batch_source, g_source_unref);
+  self->have_previous = FALSE;
+
+  return G_SOURCE_REMOVE;
+}
+
+static void
+items_changed_cb (GListModel *model,
+                  guint       position,
+                  guint       removed,
+                  guint       added,
+                  gpointer    user_data)
+{
+  GtListModelLogger *self = user_data;
+  guint old_n_items = self->shadow->len;
+  guint n_items = g_list_model_get_n_items (model);
+  guint prefix, suffix, minimal_removed, minimal_added;
+  gint mismatch;
+
+  self->n_emissions++;
+  self->n_items_emitted += (guint64) removed + added;
+
+  /* Check the emission is in range and gives the right number of items. */
+  if (position > old_n_items || removed > old_n_items - position)
+    {
+      add_issue (self, GT_LIST_MODEL_LOGGER_ISSUE_INCONSISTENT,
+                 "items-changed (%u, %u, %u) is out of range for a model with "
+                 "%u items", position, removed, added, old_n_items);
+      shadow_resync (self);
+      return;
+    }
+
+  if (old_n_items - removed + added != n_items)
+    {
+      add_issue (self, GT_LIST_MODEL_LOGGER_ISSUE_INCONSISTENT,
+                 "items-changed (%u, %u, %u) on a model with %u items should "
+                 "leave %u items, but the model has %u",
+                 position, removed, added, old_n_items,
+                 old_n_items - removed + added, n_items);
+      shadow_resync (self);
+      return;
+    }
+
+  /* Trim unchanged items from either end of the range to find the minimal
+   * change. */
+  for (prefix = 0;
+       prefix < removed && prefix < added &&
+       shadow_item_unchanged (self, position + prefix, position + prefix);
+       prefix++);
+
+  for (suffix = 0;
+       suffix < removed - prefix && suffix < added - prefix &&
+       shadow_item_unchanged (self, position + removed - 1 - suffix,
+                              position + added - 1 - suffix);
+       suffix++);
+
+  minimal_removed = removed - prefix - suffix;
+  minimal_added = added - prefix - suffix;
+  self->n_items_minimal += (guint64) minimal_removed + minimal_added;
+
+  /* Apply the change to the shadow copy and check it now matches. */
+  g_ptr_array_remove_range (self->shadow, position, removed);
+  for (guint i = 0; i < added; i++)
+    g_ptr_array_insert (self->shadow, (gint) (position + i),
+                        g_list_model_get_item (model, position + i));
+
+  mismatch = shadow_find_mismatch (self);
+  if (mismatch >= 0)
+    {
+      add_issue (self, GT_LIST_MODEL_LOGGER_ISSUE_INCONSISTENT,
+                 "Item %d changed outside the range of items-changed "
+                 "(%u, %u, %u)", mismatch, position, removed, added);
+      shadow_resync (self);
+      return;
+    }
+
+  /* Check for wasteful emissions. */
+  if (removed == 0 && added == 0)
+    add_issue (self, GT_LIST_MODEL_LOGGER_ISSUE_NO_OP,
+               "items-changed (%u, 0, 0) changes nothing", position);
+  else if (minimal_removed == 0 && minimal_added == 0)
+    add_issue (self, GT_LIST_MODEL_LOGGER_ISSUE_NO_OP,
+               "items-changed (%u, %u, %u) replaces items with themselves",
+               position, removed, added);
+  else if (position == 0 && removed == old_n_items && added == n_items &&
+           (minimal_removed < removed || minimal_added < added))
+    add_issue (self, GT_LIST_MODEL_LOGGER_ISSUE_RESET,
+               "items-changed (0, %u, %u) resets the model, but could have "
+               "been (%u, %u, %u)", removed, added,
+               position + prefix, minimal_removed, minimal_added);
+  else if (minimal_removed < removed || minimal_added < added)
+    add_issue (self, GT_LIST_MODEL_LOGGER_ISSUE_OVERSIZED,
+               "items-changed (%u, %u, %u) could have been (%u, %u, %u)",
+               position, removed, added,
+               position + prefix, minimal_removed, minimal_added);
+
+  /* The range this emission replaced in the old list touches the range the
+   * previous one added. */
+  if (self->have_previous &&
+      position <= self->previous_position + self->previous_added &&
+      position + removed >= self->previous_position)
+    add_issue (self, GT_LIST_MODEL_LOGGER_ISSUE_SPLIT_RANGE,
+               "items-changed (%u, %u, %u) is adjacent to the previous "
+               "emission (%u, %u, %u) in the same main context iteration",
+               position, removed, added, self->previous_position,
+               self->previous_removed, self->previous_added);
+
+  self->have_previous = TRUE;
+  self->previous_position = position;
+  self->previous_removed = removed;
+  self->previous_added = added;
+
+  if (self->batch_source == NULL)
+    {
+      self->batch_source = g_idle_source_new ();
+      g_source_set_priority (self->batch_source, G_PRIORITY_HIGH);
+      g_source_set_name (self->batch_source, "GtListModelLogger batch end");
+      g_source_set_callback (self->batch_source, batch_end_cb, self, NULL);
+      g_source_attach (self->batch_source, self->context);
+    }
+}
+
+/**
+ * gt_list_model_logger_new:
+ * @model: a #GListModel to check
+ *
+ * Create a new #GtListModelLogger, which takes a copy of the current items in
+ * @model and starts checking its #GListModel::items-changed emissions.
+ *
+ * Returns: (transfer full): a new #GtListModelLogger
+ * Since: 0.2.0
+ */
+GtListModelLogger *
+gt_list_model_logger_new (GListModel *model)
+{
+  g_autoptr(GtListModelLogger) logger = NULL;
+
+  g_return_val_if_fail (G_IS_LIST_MODEL (model), NULL);
+
+  logger = g_new0 (GtListModelLogger, 1);
+  logger->model = g_object_ref (model);
+  logger->context = g_main_context_ref_thread_default ();
+  logger->shadow = g_ptr_array_new_with_free_func (g_object_unref);
+  logger->issues = g_ptr_array_new_with_free_func ((GDestroyNotify) issue_free);
+
+  shadow_resync (logger);
+
+  logger->items_changed_id = g_signal_connect (model, "items-changed",
+                                               G_CALLBACK (items_changed_cb),
+                                               logger);
+
+  return g_steal_pointer (&logger);
+}
+
+/**
+ * gt_list_model_logger_free:
+ * @self: (transfer full): a #GtListModelLogger
+ *
+ * Free a #GtListModelLogger, and stop checking its model.
+ *
+ * Since: 0.2.0
+ */
+void
+gt_list_model_logger_free (GtListModelLogger *self)
+{
+  g_return_if_fail (self != NULL);
+
+  if (self->items_changed_id != 0)
+    g_signal_handler_disconnect (self->model, self->items_changed_id);
+
+  if (self->batch_source != NULL)
+    g_source_destroy (self->batch_source);
+  g_clear_pointer (&self->batch_source, g_source_unref);
+
+  g_clear_pointer (&self->issues, g_ptr_array_unref);
+  g_clear_pointer (&self->shadow, g_ptr_array_unref);
+  g_clear_pointer (&self->context, g_main_context_unref);
+  g_clear_object (&self->model);
+
+  g_free (self);
+}
+
+/**
+ * gt_list_model_logger_get_model:
+ * @self: a #GtListModelLogger
+ *
+ * Get the model being checked by @self.
+ *
+ * Returns: (transfer none): the model
+ * Since: 0.2.0
+ */
+GListModel *
+gt_list_model_logger_get_model (GtListModelLogger *self)
+{
+  g_return_val_if_fail (self != NULL, NULL);
+
+  return self->model;
+}
+
+/**
+ * gt_list_model_logger_get_n_emissions:
+ * @self: a #GtListModelLogger
+ *
+ * Get the number of #GListModel::items-changed emissions seen since @self was
+ * created, or since gt_list_model_logger_reset() was last called.
+ *
+ * Returns: number of emissions
+ * Since: 0.2.0
+ */
+guint
+gt_list_model_logger_get_n_emissions (GtListModelLogger *self)
+{
+  g_return_val_if_fail (self != NULL, 0);
+
+  return self->n_emissions;
+}
+
+/**
+ * gt_list_model_logger_get_n_items_emitted:
+ * @self: a #GtListModelLogger
+ *
+ * Get the total number of items removed and added by the
+ * #GListModel::items-changed emissions seen by @self. This is roughly
+ * proportional to the work done by widgets showing the model.
+ *
+ * Returns: number of items emitted
+ * Since: 0.2.0
+ */
+guint64
+gt_list_model_logger_get_n_items_emitted (GtListModelLogger *self)
+{
+  g_return_val_if_fail (self != NULL, 0);
+
+  return self->n_items_emitted;
+}
+
+/**
+ * gt_list_model_logger_get_n_items_minimal:
+ * @self: a #GtListModelLogger
+ *
+ * Get the total number of items removed and added by the
+ * #GListModel::items-changed emissions seen by @self, excluding unchanged
+ * items at the start and end of each emission’s range. Compare this with
+ * gt_list_model_logger_get_n_items_emitted() to see how much work the
+ * emissions caused which was unnecessary.
+ *
+ * Returns: minimal number of items emitted
+ * Since: 0.2.0
+ */
+guint64
+gt_list_model_logger_get_n_items_minimal (GtListModelLogger *self)
+{
+  g_return_val_if_fail (self != NULL, 0);
+
+  return self->n_items_minimal;
+}
+
+/**
+ * gt_list_model_logger_get_n_issues:
+ * @self: a #GtListModelLogger
+ * @issue: type of issue to count
+ *
+ * Get the number of times @issue has been detected in the emissions seen by
+ * @self.
+ *
+ * Returns: number of issues detected
+ * Since: 0.2.0
+ */
+guint
+gt_list_model_logger_get_n_issues (GtListModelLogger      *self,
+                                   GtListModelLoggerIssue  issue)
+{
+  g_return_val_if_fail (self != NULL, 0);
+  g_return_val_if_fail ((guint) issue <= GT_LIST_MODEL_LOGGER_ISSUE_LAST, 0);
+
+  return self->n_issues[issue];
+}
+
+/**
+ * gt_list_model_logger_get_n_issues_total:
+ * @self: a #GtListModelLogger
+ *
+ * Get the number of issues of any type detected in the emissions seen by
+ * @self.
+ *
+ * Returns: number of issues detected
+ * Since: 0.2.0
+ */
+guint
+gt_list_model_logger_get_n_issues_total (GtListModelLogger *self)
+{
+  g_return_val_if_fail (self != NULL, 0);
+
+  return self->issues->len;
+}
+
+/**
+ * gt_list_model_logger_reset:
+ * @self: a #GtListModelLogger
+ *
+ * Reset all the counts and detected issues to zero, and take a new copy of the
+ * model’s items. This can be used to check a single operation on the model
+ * after setting it up.
+ *
+ * Since: 0.2.0
+ */
+void
+gt_list_model_logger_reset (GtListModelLogger *self)
+{
+  g_return_if_fail (self != NULL);
+
+  self->n_emissions = 0;
+  self->n_items_emitted = 0;
+  self->n_items_minimal = 0;
+  memset (self->n_issues, 0, sizeof (self->n_issues));
+  g_ptr_array_set_size (self->issues, 0);
+  self->have_previous = FALSE;
+
+  shadow_resync (self);
+}
+
+/**
+ * gt_list_model_logger_format_issues:
+ * @self: a #GtListModelLogger
+ *
+ * Format a summary of the emissions seen by @self, followed by the issues
+ * detected in them, one per line, as a human-readable string for debug output.
+ *
+ * Returns: (transfer full): human-readable list of issues
+ * Since: 0.2.0
+ */
+gchar *
+gt_list_model_logger_format_issues (GtListModelLogger *self)
+{
+  g_autoptr(GString) str = g_string_new ("");
+
+  g_return_val_if_fail (self != NULL, NULL);
+
+  g_string_append_printf (str, " • %u emissions of %" G_GUINT64_FORMAT
+                          " items, of which %" G_GUINT64_FORMAT " changed\n",
+                          self->n_emissions, self->n_items_emitted,
+                          self->n_items_minimal);
+
+  for (gsize i = 0; i < self->issues->len; i++)
+    {
+      const Issue *issue = g_ptr_array_index (self->issues, i);
+
+      g_string_append_printf (str, " • %s: %s\n",
+                              gt_list_model_logger_issue_get_name (issue->issue),
+                              issue->message);
+    }
+
+  return g_string_free (g_steal_pointer (&str), FALSE);
+}
@@ -0,0 +1,142 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ *
+ * Copyright © 2018 Endless Mobile, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#pragma once
+
+#include <gio/gio.h>
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/**
+ * GtListModelLoggerIssue:
+ * @GT_LIST_MODEL_LOGGER_ISSUE_INCONSISTENT: an #GListModel::items-changed
+ *    emission didn’t match the change to the model, or the model changed
+ *    without one
+ * @GT_LIST_MODEL_LOGGER_ISSUE_NO_OP: an emission didn’t change anything, as it
+ *    had no removed or added items, or replaced items with themselves
+ * @GT_LIST_MODEL_LOGGER_ISSUE_RESET: an emission removed and re-added all the
+ *    items in the model, although some of them were unchanged
+ * @GT_LIST_MODEL_LOGGER_ISSUE_OVERSIZED: an emission covered more items than
+ *    were changed, at the start or end of its range
+ * @GT_LIST_MODEL_LOGGER_ISSUE_SPLIT_RANGE: an emission was adjacent to the
+ *    previous one in the same main context iteration, so the two could have
+ *    been a single emission
+ *
+ * A problem with the #GListModel::items-changed emissions of a model, detected
+ * by #GtListModelLogger. Apart from
+ * %GT_LIST_MODEL_LOGGER_ISSUE_INCONSISTENT, these are inefficiencies rather
+ * than bugs, but they can cause widgets showing the model to do a lot of
+ * unnecessary work.
+ *
+ * Since: 0.2.0
+ */
+typedef enum
+{
+  GT_LIST_MODEL_LOGGER_ISSUE_INCONSISTENT,
+  GT_LIST_MODEL_LOGGER_ISSUE_NO_OP,
+  GT_LIST_MODEL_LOGGER_ISSUE_RESET,
+  GT_LIST_MODEL_LOGGER_ISSUE_OVERSIZED,
+  GT_LIST_MODEL_LOGGER_ISSUE_SPLIT_RANGE,
+} GtListModelLoggerIssue;
+
+/**
+ * GT_LIST_MODEL_LOGGER_ISSUE_LAST:
+ *
+ * The last valid #GtListModelLoggerIssue, for iterating over all of them.
+ *
+ * Since: 0.2.0
+ */
+#define GT_LIST_MODEL_LOGGER_ISSUE_LAST GT_LIST_MODEL_LOGGER_ISSUE_SPLIT_RANGE
+
+const gchar *gt_list_model_logger_issue_get_name (GtListModelLoggerIssue issue);
+
+typedef struct _GtListModelLogger GtListModelLogger;
+
+GtListModelLogger *gt_list_model_logger_new  (GListModel        *model);
+void               gt_list_model_logger_free (GtListModelLogger *self);
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC (GtListModelLogger, gt_list_model_logger_free)
+
+GListModel *gt_list_model_logger_get_model            (GtListModelLogger      *self);
+guint       gt_list_model_logger_get_n_emissions      (GtListModelLogger      *self);
+guint64     gt_list_model_logger_get_n_items_emitted  (GtListModelLogger      *self);
+guint64     gt_list_model_logger_get_n_items_minimal  (GtListModelLogger      *self);
+guint       gt_list_model_logger_get_n_issues         (GtListModelLogger      *self,
+                                                       GtListModelLoggerIssue  issue);
+guint       gt_list_model_logger_get_n_issues_total   (GtListModelLogger      *self);
+void        gt_list_model_logger_reset                (GtListModelLogger      *self);
+gchar      *gt_list_model_logger_format_issues        (GtListModelLogger      *self);
+
+/**
+ * gt_list_model_logger_assert_consistent:
+ * @self: a #GtListModelLogger
+ *
+ * Assert that all the #GListModel::items-changed emissions seen by @self were
+ * consistent with the changes to the model.
+ *
+ * If any weren’t, an assertion fails and some debug output is printed.
+ *
+ * Since: 0.2.0
+ */
+#define gt_list_model_logger_assert_consistent(self) \
+  G_STMT_START { \
+    guint ac_n_issues = \
+        gt_list_model_logger_get_n_issues (self, GT_LIST_MODEL_LOGGER_ISSUE_INCONSISTENT); \
+    if (ac_n_issues > 0) \
+      { \
+        g_autofree gchar *ac_issues = gt_list_model_logger_format_issues (self); \
+        g_autofree gchar *ac_message = \
+            g_strdup_printf ("Expected consistent items-changed emissions, " \
+                             "but saw %u inconsistencies:\n%s", \
+                             ac_n_issues, ac_issues); \
+        g_assertion_message (G_LOG_DOMAIN, __FILE__, __LINE__, G_STRFUNC, \
+                             ac_message); \
+      } \
+  } G_STMT_END
+
+/**
+ * gt_list_model_logger_assert_efficient:
+ * @self: a #GtListModelLogger
+ *
+ * Assert that @self has not detected any issues with the
+ * #GListModel::items-changed emissions it has seen, either inconsistencies or
+ * inefficiencies. See #GtListModelLoggerIssue.
+ *
+ * If it has, an assertion fails and some debug output is printed.
+ *
+ * Since: 0.2.0
+ */
+#define gt_list_model_logger_assert_efficient(self) \
+  G_STMT_START { \
+    guint ae_n_issues = gt_list_model_logger_get_n_issues_total (self); \
+    if (ae_n_issues > 0) \
+      { \
+        g_autofree gchar *ae_issues = gt_list_model_logger_format_issues (self); \
+        g_autofree gchar *ae_message = \
+            g_strdup_printf ("Expected efficient items-changed emissions, " \
+                             "but saw %u issues:\n%s", \
+                             ae_n_issues, ae_issues); \
+        g_assertion_message (G_LOG_DOMAIN, __FILE__, __LINE__, G_STRFUNC, \
+                             ae_message); \
+      } \
+  } G_STMT_END
+
+G_END_DECLS
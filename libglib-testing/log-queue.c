@@ -0,0 +1,975 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ *
+ * Copyright © 2018 Endless Mobile, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#include "config.h"
+
+#include <glib.h>
+#include <libglib-testing/log-queue.h>
+#include <string.h>
+
+
+/**
+ * SECTION:log-queue
+ * @short_description: Structured log message capture and checking
+ * @stability: Unstable
+ * @include: libglib-testing/log-queue.h
+ *
+ * #GtLogQueue captures log messages emitted from any thread, through either
+ * g_log() or g_log_structured(), and queues them for later comparison against
+ * what was expected to be logged. Unlike g_test_expect_message(), expectations
+ * do not have to be registered before the messages are logged, and entries can
+ * be popped by domain and level, in any order.
+ *
+ * Testing of the logged messages is performed by popping entries off the queue
+ * and comparing them to what was expected. Macros are provided to assert that
+ * the next entry for a given domain and level matches a pattern — or callers
+ * may unconditionally pop entries and examine their fields themselves.
+ *
+ * Logging from the code under test is cheap: each message is copied into a
+ * #GtLogQueueEntry and pushed onto a lock-free ring buffer, and entries are
+ * only sorted into the queue when the test pops or counts them. For very
+ * frequent messages, such as debug output in a hot loop, the queue can be told
+ * to only count messages at certain levels, using
+ * gt_log_queue_set_count_only_levels(), in which case logging them costs a
+ * single atomic increment.
+ *
+ * #GtLogQueue works by installing a #GLogWriterFunc the first time a queue is
+ * created, so it cannot be used in a program which sets its own writer
+ * function with g_log_set_writer_func(). Messages which are not captured or
+ * counted, or which are logged while no #GtLogQueue exists, are passed on to
+ * g_log_writer_default(). Only one #GtLogQueue may exist at a time.
+ *
+ * Capturing a message does not stop it being fatal: messages at levels which
+ * are fatal (for example, warnings in a test program, due to
+ * g_log_set_always_fatal()) will still abort the program after being captured.
+ *
+ * By default, a #GtLogQueue will not assert that its queue is empty on
+ * destruction: that is up to the caller, and it is highly recommended that
+ * gt_log_queue_assert_no_entries() is called before a log queue is destroyed.
+ *
+ * Since: 0.2.0
+ */
+
+/* Number of slots in the ring buffer. Must be a power of two. When the ring is
+ * full, writers drain it into the queue under the lock. */
+#define RING_SIZE 4096
+
+/* Number of standard log levels, from %G_LOG_LEVEL_ERROR to
+ * %G_LOG_LEVEL_DEBUG. */
+#define N_LEVELS 6
+
+typedef struct _DomainIndex DomainIndex;
+
+typedef struct
+{
+  gchar *key;  /* (owned) */
+  gchar *value;  /* (owned); always nul-terminated */
+  gssize length;  /* as passed to the writer; -1 for nul-terminated */
+} EntryField;
+
+/**
+ * GtLogQueueEntry:
+ *
+ * The details of a single logged message, including all its structured
+ * fields.
+ *
+ * Since: 0.2.0
+ */
+struct _GtLogQueueEntry
+{
+  GLogLevelFlags level;
+  guint level_index;
+  const gchar *domain;  /* (nullable) (unowned); points into @fields */
+  const gchar *message;  /* (unowned); points into @fields or a static string */
+  gint64 time;
+  gpointer thread;  /* (unowned); only used as an identifier */
+
+  EntryField *fields;  /* (array length=n_fields) (owned) */
+  gsize n_fields;
+
+  /* Position in the #GtLogQueue, only set while the entry is queued. */
+  guint64 serial;
+  GList *link;  /* (nullable) (unowned) */
+  DomainIndex *index;  /* (nullable) (unowned) */
+  GList *index_link;  /* (nullable) (unowned) */
+};
+
+/* Queued entries for a single log domain, split by level. Entries are owned by
+ * #GtLogQueue.entries. */
+struct _DomainIndex
+{
+  gchar *domain;  /* (owned); empty for messages with no domain */
+  GQueue levels[N_LEVELS];  /* (element-type GtLogQueueEntry) (unowned) */
+};
+
+typedef struct
+{
+  gint sequence;  /* (atomic) */
+  GtLogQueueEntry *entry;  /* (owned) (nullable) */
+} RingCell;
+
+/**
+ * GtLogQueue:
+ *
+ * A queue of log messages captured from any thread, which can be popped and
+ * asserted on by the test.
+ *
+ * Since: 0.2.0
+ */
+struct _GtLogQueue
+{
+  /* Entries pushed by log writers in any thread, without locking. This is a
+   * bounded multiple-producer queue as described by Dmitry Vyukov, with a
+   * single consumer (whoever holds @lock). */
+  RingCell *ring;  /* (array fixed-size=RING_SIZE) (owned) */
+  gint enqueue_pos;  /* (atomic) */
+  guint dequeue_pos;  /* (locked-by lock) */
+
+  GMutex lock;
+  /* Head entry was logged first. */
+  GQueue entries;  /* (element-type GtLogQueueEntry) (owned) (locked-by lock) */
+  GHashTable *domains;  /* (element-type utf8 DomainIndex) (owned) (locked-by lock) */
+  guint64 next_serial;  /* (locked-by lock) */
+
+  gint capture_levels;  /* (atomic); GLogLevelFlags */
+  gint count_only_levels;  /* (atomic); GLogLevelFlags */
+  gint counts[N_LEVELS];  /* (atomic) */
+};
+
+/* The queue which the writer function passes messages to, if any. The writer
+ * function is installed once and never removed, since GLib does not allow
+ * that. @n_writers counts the threads currently inside the writer function,
+ * so that gt_log_queue_free() can wait for them to stop using the queue. */
+static GtLogQueue *active_queue = NULL;  /* (atomic) (nullable) */
+static gint n_writers = 0;  /* (atomic) */
+
+static const gchar * const level_names[N_LEVELS] =
+{
+  "ERROR", "CRITICAL", "WARNING", "Message", "INFO", "DEBUG",
+};
+
+/* Get the index of the most severe standard level in @log_level, between 0
+ * (for %G_LOG_LEVEL_ERROR) and N_LEVELS - 1 (for %G_LOG_LEVEL_DEBUG).
+ * User-defined log levels are treated as debug messages. */
+static guint
+level_to_index (GLogLevelFlags log_level)
+{
+  for (guint i = 0; i < N_LEVELS; i++)
+    {
+      if (log_level & (G_LOG_LEVEL_ERROR << i))
+        return i;
+    }
+
+  return N_LEVELS - 1;
+}
+
+static GLogLevelFlags
+index_to_level (guint i)
+{
+  return (GLogLevelFlags) (G_LOG_LEVEL_ERROR << i);
+}
+
+static GtLogQueueEntry *
+gt_log_queue_entry_new (GLogLevelFlags   log_level,
+                        const GLogField *fields,
+                        gsize            n_fields)
+{
+  g_autoptr(GtLogQueueEntry) entry = g_new0 (GtLogQueueEntry, 1);
+
+  entry->level = log_level & ~G_LOG_FLAG_FATAL & ~G_LOG_FLAG_RECURSION;
+  entry->level_index = level_to_index (log_level);
+  entry->message = "";
+  entry->time = g_get_monotonic_time ();
+  entry->thread = g_thread_self ();
+
+  entry->fields = g_new0 (EntryField, n_fields);
+  entry->n_fields = n_fields;
+
+  for (gsize i = 0; i < n_fields; i++)
+    {
+      EntryField *field = &entry->fields[i];
+      gsize length;
+
+      length = (fields[i].length < 0) ? strlen (fields[i].value) : (gsize) fields[i].length;
+
+      field->key = g_strdup (fields[i].key);
+      field->value = g_malloc (length + 1);
+      memcpy (field->value, fields[i].value, length);
+      field->value[length] = '\0';
+      field->length = fields[i].length;
+
+      if (g_str_equal (field->key, "GLIB_DOMAIN"))
+        entry->domain = field->value;
+      else if (g_str_equal (field->key, "MESSAGE"))
+        entry->message = field->value;
+    }
+
+  return g_steal_pointer (&entry);
+}
+
+/**
+ * gt_log_queue_entry_free:
+ * @entry: (transfer full): a #GtLogQueueEntry
+ *
+ * Free a #GtLogQueueEntry.
+ *
+ * Since: 0.2.0
+ */
+void
+gt_log_queue_entry_free (GtLogQueueEntry *entry)
+{
+  g_return_if_fail (entry != NULL);
+  g_return_if_fail (entry->link == NULL);
+
+  for (gsize i = 0; i < entry->n_fields; i++)
+    {
+      g_free (entry->fields[i].key);
+      g_free (entry->fields[i].value);
+    }
+  g_free (entry->fields);
+
+  g_free (entry);
+}
+
+/**
+ * gt_log_queue_entry_get_level:
+ * @entry: a #GtLogQueueEntry
+ *
+ * Get the level the message was logged at. This will not include
+ * %G_LOG_FLAG_FATAL or %G_LOG_FLAG_RECURSION.
+ *
+ * Returns: level of the message
+ * Since: 0.2.0
+ */
+GLogLevelFlags
+gt_log_queue_entry_get_level (const GtLogQueueEntry *entry)
+{
+  g_return_val_if_fail (entry != NULL, 0);
+
+  return entry->level;
+}
+
+/**
+ * gt_log_queue_entry_get_domain:
+ * @entry: a #GtLogQueueEntry
+ *
+ * Get the log domain the message was logged in, from its `GLIB_DOMAIN` field.
+ *
+ * Returns: (nullable): log domain of the message, or %NULL if it had none
+ * Since: 0.2.0
+ */
+const gchar *
+gt_log_queue_entry_get_domain (const GtLogQueueEntry *entry)
+{
+  g_return_val_if_fail (entry != NULL, NULL);
+
+  return entry->domain;
+}
+
+/**
+ * gt_log_queue_entry_get_message:
+ * @entry: a #GtLogQueueEntry
+ *
+ * Get the message which was logged, from its `MESSAGE` field.
+ *
+ * Returns: the message, or an empty string if it had none
+ * Since: 0.2.0
+ */
+const gchar *
+gt_log_queue_entry_get_message (const GtLogQueueEntry *entry)
+{
+  g_return_val_if_fail (entry != NULL, NULL);
+
+  return entry->message;
+}
+
+/**
+ * gt_log_queue_entry_get_time:
+ * @entry: a #GtLogQueueEntry
+ *
+ * Get the monotonic time (as from g_get_monotonic_time()) at which the message
+ * was logged.
+ *
+ * Returns: time the message was logged, in microseconds
+ * Since: 0.2.0
+ */
+gint64
+gt_log_queue_entry_get_time (const GtLogQueueEntry *entry)
+{
+  g_return_val_if_fail (entry != NULL, 0);
+
+  return entry->time;
+}
+
+/**
+ * gt_log_queue_entry_get_thread:
+ * @entry: a #GtLogQueueEntry
+ *
+ * Get the #GThread which logged the message. This should only be compared
+ * against other #GThread pointers, such as the return value from
+ * g_thread_self(); the thread may have exited since the message was logged.
+ *
+ * Returns: (transfer none): the thread which logged the message
+ * Since: 0.2.0
+ */
+gpointer
+gt_log_queue_entry_get_thread (const GtLogQueueEntry *entry)
+{
+  g_return_val_if_fail (entry != NULL, NULL);
+
+  return entry->thread;
+}
+
+/**
+ * gt_log_queue_entry_get_field:
+ * @entry: a #GtLogQueueEntry
+ * @key: key of the structured field to get, such as `CODE_FILE`
+ * @out_length: (out) (optional): return location for the length of the field
+ *    value, or -1 if it was logged as a nul-terminated string
+ *
+ * Get the value of one of the structured fields the message was logged with.
+ * If there are several fields with the same @key, the first is returned.
+ *
+ * The returned value is always nul-terminated, even if it was logged with an
+ * explicit length.
+ *
+ * Returns: (nullable): value of the field, or %NULL if it was not present
+ * Since: 0.2.0
+ */
+gconstpointer
+gt_log_queue_entry_get_field (const GtLogQueueEntry *entry,
+                              const gchar           *key,
+                              gssize                *out_length)
+{
+  g_return_val_if_fail (entry != NULL, NULL);
+  g_return_val_if_fail (key != NULL, NULL);
+
+  for (gsize i = 0; i < entry->n_fields; i++)
+    {
+      if (g_str_equal (entry->fields[i].key, key))
+        {
+          if (out_length != NULL)
+            *out_length = entry->fields[i].length;
+          return entry->fields[i].value;
+        }
+    }
+
+  if (out_length != NULL)
+    *out_length = 0;
+
+  return NULL;
+}
+
+static void
+domain_index_free (DomainIndex *index)
+{
+  for (gsize i = 0; i < N_LEVELS; i++)
+    g_queue_clear (&index->levels[i]);
+  g_free (index->domain);
+  g_free (index);
+}
+
+/* Push @entry onto the ring buffer. This is safe to call from any thread
+ * without holding the lock. Returns %FALSE if the ring is full. */
+static gboolean
+gt_log_queue_ring_push (GtLogQueue      *self,
+                        GtLogQueueEntry *entry)
+{
+  guint pos = (guint) g_atomic_int_get (&self->enqueue_pos);
+
+  while (TRUE)
+    {
+      RingCell *cell = &self->ring[pos & (RING_SIZE - 1)];
+      guint sequence = (guint) g_atomic_int_get (&cell->sequence);
+      gint diff = (gint) (sequence - pos);
+
+      if (diff == 0)
+        {
+          /* The cell is free; try to claim it. */
+          if (g_atomic_int_compare_and_exchange (&self->enqueue_pos,
+                                                 (gint) pos, (gint) (pos + 1)))
+            {
+              cell->entry = entry;
+              g_atomic_int_set (&cell->sequence, (gint) (pos + 1));
+              return TRUE;
+            }
+        }
+      else if (diff < 0)
+        {
+          /* The cell still holds an entry from the previous lap. */
+          return FALSE;
+        }
+
+      pos = (guint) g_atomic_int_get (&self->enqueue_pos);
+    }
+}
+
+/* Pop the next entry off the ring buffer, or return %NULL if it is empty (or
+ * if the next entry is still being pushed). */
+static GtLogQueueEntry *
+gt_log_queue_ring_pop_locked (GtLogQueue *self)
+{
+  guint pos = self->dequeue_pos;
+  RingCell *cell = &self->ring[pos & (RING_SIZE - 1)];
+  guint sequence = (guint) g_atomic_int_get (&cell->sequence);
+  GtLogQueueEntry *entry;
+
+  if ((gint) (sequence - (pos + 1)) < 0)
+    return NULL;
+
+  entry = g_steal_pointer (&cell->entry);
+  self->dequeue_pos = pos + 1;
+  g_atomic_int_set (&cell->sequence, (gint) (pos + RING_SIZE));
+
+  return entry;
+}
+
+/* Move all the entries from the ring buffer into @entries and the domain
+ * index. */
+static void
+gt_log_queue_drain_locked (GtLogQueue *self)
+{
+  GtLogQueueEntry *entry;
+
+  while ((entry = gt_log_queue_ring_pop_locked (self)) != NULL)
+    {
+      const gchar *domain = (entry->domain != NULL) ? entry->domain : "";
+      DomainIndex *index = g_hash_table_lookup (self->domains, domain);
+
+      if (index == NULL)
+        {
+          index = g_new0 (DomainIndex, 1);
+          index->domain = g_strdup (domain);
+          g_hash_table_insert (self->domains, index->domain, index);
+        }
+
+      entry->serial = self->next_serial++;
+
+      g_queue_push_tail (&self->entries, entry);
+      entry->link = self->entries.tail;
+
+      g_queue_push_tail (&index->levels[entry->level_index], entry);
+      entry->index = index;
+      entry->index_link = index->levels[entry->level_index].tail;
+    }
+}
+
+/* Remove @entry from @entries and the domain index, and return ownership of it
+ * to the caller. */
+static GtLogQueueEntry *
+gt_log_queue_remove_entry_locked (GtLogQueue      *self,
+                                  GtLogQueueEntry *entry)
+{
+  g_queue_delete_link (&self->entries, g_steal_pointer (&entry->link));
+  g_queue_delete_link (&entry->index->levels[entry->level_index],
+                       g_steal_pointer (&entry->index_link));
+  entry->index = NULL;
+
+  return entry;
+}
+
+/* Find the oldest entry in @index at any of the given @levels. */
+static GtLogQueueEntry *
+domain_index_find (DomainIndex    *index,
+                   GLogLevelFlags  levels)
+{
+  GtLogQueueEntry *oldest = NULL;
+
+  for (guint i = 0; i < N_LEVELS; i++)
+    {
+      GtLogQueueEntry *head;
+
+      if (!(levels & index_to_level (i)))
+        continue;
+
+      head = g_queue_peek_head (&index->levels[i]);
+      if (head != NULL && (oldest == NULL || head->serial < oldest->serial))
+        oldest = head;
+    }
+
+  return oldest;
+}
+
+/* Find the oldest entry for @domain (or any domain, if %NULL) at any of the
+ * given @levels. */
+static GtLogQueueEntry *
+gt_log_queue_find_entry_locked (GtLogQueue     *self,
+                                const gchar    *domain,
+                                GLogLevelFlags  levels)
+{
+  GtLogQueueEntry *oldest = NULL;
+  GHashTableIter iter;
+  gpointer value;
+
+  if (domain != NULL)
+    {
+      DomainIndex *index = g_hash_table_lookup (self->domains, domain);
+      return (index != NULL) ? domain_index_find (index, levels) : NULL;
+    }
+
+  g_hash_table_iter_init (&iter, self->domains);
+
+  while (g_hash_table_iter_next (&iter, NULL, &value))
+    {
+      GtLogQueueEntry *entry = domain_index_find (value, levels);
+
+      if (entry != NULL && (oldest == NULL || entry->serial < oldest->serial))
+        oldest = entry;
+    }
+
+  return oldest;
+}
+
+/* Handle a message logged while @self is the active queue. This may be called
+ * from any thread. */
+static GLogWriterOutput
+gt_log_queue_write (GtLogQueue      *self,
+                    GLogLevelFlags   log_level,
+                    const GLogField *fields,
+                    gsize            n_fields)
+{
+  GLogLevelFlags capture_levels = (GLogLevelFlags) g_atomic_int_get (&self->capture_levels);
+  GLogLevelFlags count_only_levels = (GLogLevelFlags) g_atomic_int_get (&self->count_only_levels);
+  GtLogQueueEntry *entry;
+
+  if (!(log_level & (capture_levels | count_only_levels)))
+    return G_LOG_WRITER_UNHANDLED;
+
+  g_atomic_int_inc (&self->counts[level_to_index (log_level)]);
+
+  if (log_level & count_only_levels)
+    return G_LOG_WRITER_HANDLED;
+
+  entry = gt_log_queue_entry_new (log_level, fields, n_fields);
+
+  while (!gt_log_queue_ring_push (self, entry))
+    {
+      /* The ring is full, so drain it into the queue to make space. If the
+       * oldest cell is still being written by another thread, this won’t free
+       * anything, so give that thread a chance to finish. */
+      g_mutex_lock (&self->lock);
+      gt_log_queue_drain_locked (self);
+      g_mutex_unlock (&self->lock);
+
+      g_thread_yield ();
+    }
+
+  return G_LOG_WRITER_HANDLED;
+}
+
+static GLogWriterOutput
+gt_log_queue_writer_cb (GLogLevelFlags   log_level,
+                        const GLogField *fields,
+                        gsize            n_fields,
+                        gpointer         user_data)
+{
+  GtLogQueue *self;
+  GLogWriterOutput retval = G_LOG_WRITER_UNHANDLED;
+
+  g_atomic_int_inc (&n_writers);
+
+  self = g_atomic_pointer_get (&active_queue);
+  if (self != NULL)
+    retval = gt_log_queue_write (self, log_level, fields, n_fields);
+
+  (void) g_atomic_int_dec_and_test (&n_writers);
+
+  if (retval == G_LOG_WRITER_UNHANDLED)
+    retval = g_log_writer_default (log_level, fields, n_fields, user_data);
+
+  return retval;
+}
+
+/**
+ * gt_log_queue_new:
+ *
+ * Create a new #GtLogQueue and start capturing log messages into it. By
+ * default, messages at all levels are captured. Only one #GtLogQueue may exist
+ * at a time.
+ *
+ * Returns: (transfer full): a new #GtLogQueue
+ * Since: 0.2.0
+ */
+GtLogQueue *
+gt_log_queue_new (void)
+{
+  static gsize writer_installed = 0;
+  g_autoptr(GtLogQueue) queue = NULL;
+
+  g_return_val_if_fail (g_atomic_pointer_get (&active_queue) == NULL, NULL);
+
+  if (g_once_init_enter (&writer_installed))
+    {
+      g_log_set_writer_func (gt_log_queue_writer_cb, NULL, NULL);
+      g_once_init_leave (&writer_installed, 1);
+    }
+
+  queue = g_new0 (GtLogQueue, 1);
+  queue->ring = g_new0 (RingCell, RING_SIZE);
+  for (guint i = 0; i < RING_SIZE; i++)
+    queue->ring[i].sequence = (gint) i;
+
+  g_mutex_init (&queue->lock);
+  g_queue_init (&queue->entries);
+  queue->domains = g_hash_table_new_full (g_str_hash, g_str_equal, NULL,
+                                          (GDestroyNotify) domain_index_free);
+
+  queue->capture_levels = G_LOG_LEVEL_MASK;
+
+  g_atomic_pointer_set (&active_queue, queue);
+
+  return g_steal_pointer (&queue);
+}
+
+/**
+ * gt_log_queue_free:
+ * @self: (transfer full): a #GtLogQueue
+ *
+ * Stop capturing log messages and free a #GtLogQueue. Log messages after this
+ * point will be passed to g_log_writer_default().
+ *
+ * This function may be called when there are entries left in the queue, but
+ * typically you will want to call gt_log_queue_assert_no_entries() first.
+ *
+ * Since: 0.2.0
+ */
+void
+gt_log_queue_free (GtLogQueue *self)
+{
+  GtLogQueueEntry *entry;
+
+  g_return_if_fail (self != NULL);
+
+  /* Stop new messages being captured, and wait for threads which are in the
+   * middle of capturing one. */
+  if (g_atomic_pointer_compare_and_exchange (&active_queue, self, NULL))
+    {
+      while (g_atomic_int_get (&n_writers) > 0)
+        g_thread_yield ();
+    }
+
+  g_mutex_lock (&self->lock);
+  gt_log_queue_drain_locked (self);
+  g_mutex_unlock (&self->lock);
+
+  /* FIXME: Use g_queue_clear_full() once we depend on GLib 2.60. */
+  while ((entry = g_queue_peek_head (&self->entries)) != NULL)
+    gt_log_queue_entry_free (gt_log_queue_remove_entry_locked (self, entry));
+
+  g_clear_pointer (&self->domains, g_hash_table_unref);
+  g_mutex_clear (&self->lock);
+  g_free (self->ring);
+
+  g_free (self);
+}
+
+/**
+ * gt_log_queue_set_capture_levels:
+ * @self: a #GtLogQueue
+ * @levels: log levels to capture messages at
+ *
+ * Set which levels of log message are captured into the queue. Messages at
+ * other levels (which are not being counted, see
+ * gt_log_queue_set_count_only_levels()) will be passed to
+ * g_log_writer_default(). By default, messages at all levels are captured.
+ *
+ * This may be called from any thread.
+ *
+ * Since: 0.2.0
+ */
+void
+gt_log_queue_set_capture_levels (GtLogQueue     *self,
+                                 GLogLevelFlags  levels)
+{
+  g_return_if_fail (self != NULL);
+
+  g_atomic_int_set (&self->capture_levels, (gint) (levels & G_LOG_LEVEL_MASK));
+}
+
+/**
+ * gt_log_queue_set_count_only_levels:
+ * @self: a #GtLogQueue
+ * @levels: log levels to count messages at, without capturing them
+ *
+ * Set which levels of log message are only counted, rather than being captured
+ * into the queue. This is much cheaper than capturing them, so is useful for
+ * keeping frequent debug messages enabled in tests which are under load or
+ * are being profiled. Use gt_log_queue_get_n_counted() to check the counts.
+ *
+ * Levels set here take precedence over those set with
+ * gt_log_queue_set_capture_levels(). By default, no levels are count-only.
+ *
+ * This may be called from any thread.
+ *
+ * Since: 0.2.0
+ */
+void
+gt_log_queue_set_count_only_levels (GtLogQueue     *self,
+                                    GLogLevelFlags  levels)
+{
+  g_return_if_fail (self != NULL);
+
+  g_atomic_int_set (&self->count_only_levels, (gint) (levels & G_LOG_LEVEL_MASK));
+}
+
+/**
+ * gt_log_queue_get_n_counted:
+ * @self: a #GtLogQueue
+ * @levels: log levels to count messages at
+ *
+ * Get the number of messages at any of @levels which have been handled by the
+ * queue since it was created, whether they were captured or only counted.
+ * Popping entries does not affect this count.
+ *
+ * This may be called from any thread.
+ *
+ * Returns: number of messages logged at @levels
+ * Since: 0.2.0
+ */
+gsize
+gt_log_queue_get_n_counted (GtLogQueue     *self,
+                            GLogLevelFlags  levels)
+{
+  gsize n_counted = 0;
+
+  g_return_val_if_fail (self != NULL, 0);
+
+  for (guint i = 0; i < N_LEVELS; i++)
+    {
+      if (levels & index_to_level (i))
+        n_counted += (guint) g_atomic_int_get (&self->counts[i]);
+    }
+
+  return n_counted;
+}
+
+/**
+ * gt_log_queue_get_n_entries:
+ * @self: a #GtLogQueue
+ *
+ * Get the number of entries which have been captured (and not popped) since
+ * the queue was created.
+ *
+ * This may be called from any thread.
+ *
+ * Returns: number of entries in the queue
+ * Since: 0.2.0
+ */
+gsize
+gt_log_queue_get_n_entries (GtLogQueue *self)
+{
+  gsize n_entries;
+
+  g_return_val_if_fail (self != NULL, 0);
+
+  g_mutex_lock (&self->lock);
+  gt_log_queue_drain_locked (self);
+  n_entries = self->entries.length;
+  g_mutex_unlock (&self->lock);
+
+  return n_entries;
+}
+
+/**
+ * gt_log_queue_get_n_entries_for:
+ * @self: a #GtLogQueue
+ * @domain: (nullable): log domain to count entries for, %NULL to count entries
+ *    for all domains, or an empty string to count entries which have no domain
+ * @levels: log levels to count entries for
+ *
+ * Get the number of entries in the queue for @domain at any of @levels.
+ *
+ * This may be called from any thread.
+ *
+ * Returns: number of matching entries in the queue
+ * Since: 0.2.0
+ */
+gsize
+gt_log_queue_get_n_entries_for (GtLogQueue     *self,
+                                const gchar    *domain,
+                                GLogLevelFlags  levels)
+{
+  gsize n_entries = 0;
+  GHashTableIter iter;
+  gpointer value;
+
+  g_return_val_if_fail (self != NULL, 0);
+
+  g_mutex_lock (&self->lock);
+  gt_log_queue_drain_locked (self);
+
+  g_hash_table_iter_init (&iter, self->domains);
+
+  while (g_hash_table_iter_next (&iter, NULL, &value))
+    {
+      const DomainIndex *index = value;
+
+      if (domain != NULL && !g_str_equal (index->domain, domain))
+        continue;
+
+      for (guint i = 0; i < N_LEVELS; i++)
+        {
+          if (levels & index_to_level (i))
+            n_entries += index->levels[i].length;
+        }
+    }
+
+  g_mutex_unlock (&self->lock);
+
+  return n_entries;
+}
+
+/**
+ * gt_log_queue_pop_entry:
+ * @self: a #GtLogQueue
+ *
+ * Pop the oldest entry off the queue, if there is one.
+ *
+ * This may be called from any thread.
+ *
+ * Returns: (transfer full) (nullable): the oldest entry, or %NULL if the queue
+ *    is empty
+ * Since: 0.2.0
+ */
+GtLogQueueEntry *
+gt_log_queue_pop_entry (GtLogQueue *self)
+{
+  GtLogQueueEntry *entry;
+
+  g_return_val_if_fail (self != NULL, NULL);
+
+  g_mutex_lock (&self->lock);
+  gt_log_queue_drain_locked (self);
+  entry = g_queue_peek_head (&self->entries);
+  if (entry != NULL)
+    gt_log_queue_remove_entry_locked (self, entry);
+  g_mutex_unlock (&self->lock);
+
+  return entry;
+}
+
+/**
+ * gt_log_queue_pop_entry_for:
+ * @self: a #GtLogQueue
+ * @domain: (nullable): log domain to pop an entry for, %NULL to pop an entry
+ *    for any domain, or an empty string to pop an entry which has no domain
+ * @levels: log levels to pop an entry for
+ *
+ * Pop the oldest entry for @domain at any of @levels off the queue, if there
+ * is one. Entries for other domains and levels are left in the queue, in
+ * order.
+ *
+ * This may be called from any thread.
+ *
+ * Returns: (transfer full) (nullable): the oldest matching entry, or %NULL if
+ *    there are none
+ * Since: 0.2.0
+ */
+GtLogQueueEntry *
+gt_log_queue_pop_entry_for (GtLogQueue     *self,
+                            const gchar    *domain,
+                            GLogLevelFlags  levels)
+{
+  GtLogQueueEntry *entry;
+
+  g_return_val_if_fail (self != NULL, NULL);
+
+  g_mutex_lock (&self->lock);
+  gt_log_queue_drain_locked (self);
+  entry = gt_log_queue_find_entry_locked (self, domain, levels);
+  if (entry != NULL)
+    gt_log_queue_remove_entry_locked (self, entry);
+  g_mutex_unlock (&self->lock);
+
+  return entry;
+}
+
+/**
+ * gt_log_queue_format_entry:
+ * @entry: a #GtLogQueueEntry
+ *
+ * Format a log entry in a human readable form, typically for logging it to
+ * some debug output.
+ *
+ * The returned string does not have a trailing newline character (`\n`).
+ *
+ * Returns: (transfer full): human readable string detailing the log entry
+ * Since: 0.2.0
+ */
+gchar *
+gt_log_queue_format_entry (const GtLogQueueEntry *entry)
+{
+  g_return_val_if_fail (entry != NULL, NULL);
+
+  return g_strdup_printf ("%s%s%s: %s (thread %p, time %" G_GINT64_FORMAT ")",
+                          (entry->domain != NULL) ? entry->domain : "",
+                          (entry->domain != NULL) ? "-" : "",
+                          level_names[entry->level_index],
+                          entry->message, entry->thread, entry->time);
+}
+
+/**
+ * gt_log_queue_format_entries:
+ * @self: a #GtLogQueue
+ *
+ * Format all the entries in the #GtLogQueue, in a human readable format, one
+ * per line. The returned string does not end in a newline character (`\n`).
+ * Each entry is formatted using gt_log_queue_format_entry().
+ *
+ * This may be called from any thread.
+ *
+ * Returns: (transfer full): human readable list of all the entries currently in
+ *    the queue, or an empty string if the queue is empty
+ * Since: 0.2.0
+ */
+gchar *
+gt_log_queue_format_entries (GtLogQueue *self)
+{
+  g_autoptr(GString) str = g_string_new ("");
+  guint width = 1;
+  gsize n_entries, i = 0;
+
+  g_return_val_if_fail (self != NULL, NULL);
+
+  g_mutex_lock (&self->lock);
+  gt_log_queue_drain_locked (self);
+
+  /* Work out the width of the counter we need to number the entries. */
+  n_entries = self->entries.length;
+  while (n_entries >= 10)
+    {
+      n_entries /= 10;
+      width++;
+    }
+
+  for (const GList *l = self->entries.head; l != NULL; l = l->next, i++)
+    {
+      g_autofree gchar *entry_str = gt_log_queue_format_entry (l->data);
+
+      if (i > 0)
+        g_string_append (str, "\n");
+
+      g_string_append_printf (str, " %*" G_GSIZE_FORMAT ". %s", (int) width, i + 1, entry_str);
+    }
+
+  g_mutex_unlock (&self->lock);
+
+  return g_string_free (g_steal_pointer (&str), FALSE);
+}
@@ -0,0 +1,164 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ *
+ * Copyright © 2018 Endless Mobile, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#pragma once
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+typedef struct _GtLogQueueEntry GtLogQueueEntry;
+
+void            gt_log_queue_entry_free        (GtLogQueueEntry       *entry);
+GLogLevelFlags  gt_log_queue_entry_get_level   (const GtLogQueueEntry *entry);
+const gchar    *gt_log_queue_entry_get_domain  (const GtLogQueueEntry *entry);
+const gchar    *gt_log_queue_entry_get_message (const GtLogQueueEntry *entry);
+gint64          gt_log_queue_entry_get_time    (const GtLogQueueEntry *entry);
+gpointer        gt_log_queue_entry_get_thread  (const GtLogQueueEntry *entry);
+gconstpointer   gt_log_queue_entry_get_field   (const GtLogQueueEntry *entry,
+                                                const gchar           *key,
+                                                gssize                *out_length);
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC (GtLogQueueEntry, gt_log_queue_entry_free)
+
+typedef struct _GtLogQueue GtLogQueue;
+
+GtLogQueue *gt_log_queue_new  (void);
+void        gt_log_queue_free (GtLogQueue *self);
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC (GtLogQueue, gt_log_queue_free)
+
+void     gt_log_queue_set_capture_levels    (GtLogQueue     *self,
+                                             GLogLevelFlags  levels);
+void     gt_log_queue_set_count_only_levels (GtLogQueue     *self,
+                                             GLogLevelFlags  levels);
+gsize    gt_log_queue_get_n_counted         (GtLogQueue     *self,
+                                             GLogLevelFlags  levels);
+
+gsize            gt_log_queue_get_n_entries     (GtLogQueue     *self);
+gsize            gt_log_queue_get_n_entries_for (GtLogQueue     *self,
+                                                 const gchar    *domain,
+                                                 GLogLevelFlags  levels);
+GtLogQueueEntry *gt_log_queue_pop_entry         (GtLogQueue     *self);
+GtLogQueueEntry *gt_log_queue_pop_entry_for     (GtLogQueue     *self,
+                                                 const gchar    *domain,
+                                                 GLogLevelFlags  levels);
+
+gchar *gt_log_queue_format_entry   (const GtLogQueueEntry *entry);
+gchar *gt_log_queue_format_entries (GtLogQueue            *self);
+
+/**
+ * gt_log_queue_assert_no_entries:
+ * @self: a #GtLogQueue
+ *
+ * Assert that there are no log entries currently in the queue. Messages which
+ * were only counted (see gt_log_queue_set_count_only_levels()) are not
+ * included.
+ *
+ * If there are, an assertion fails and some debug output is printed.
+ *
+ * Since: 0.2.0
+ */
+#define gt_log_queue_assert_no_entries(self) \
+  G_STMT_START { \
+    if (gt_log_queue_get_n_entries (self) > 0) \
+      { \
+        g_autofree gchar *ane_list = gt_log_queue_format_entries (self); \
+        g_autofree gchar *ane_message = \
+            g_strdup_printf ("Expected no log entries, but saw %" G_GSIZE_FORMAT ":\n%s", \
+                             gt_log_queue_get_n_entries (self), \
+                             ane_list); \
+        g_assertion_message (G_LOG_DOMAIN, __FILE__, __LINE__, G_STRFUNC, \
+                             ane_message); \
+      } \
+  } G_STMT_END
+
+/**
+ * gt_log_queue_assert_entry_pop:
+ * @self: a #GtLogQueue
+ * @domain: (nullable): log domain to pop an entry for, or %NULL to match any
+ *    domain
+ * @level: log level to pop an entry for; only one level should be set
+ * @message_pattern: a glob-style pattern (see g_pattern_match_simple()) which
+ *    the entry’s message is expected to match
+ *
+ * Assert that a log entry for @domain and @level can be popped off the queue
+ * (using gt_log_queue_pop_entry_for()) and that its message matches
+ * @message_pattern. Entries for other domains and levels are left in the
+ * queue.
+ *
+ * If no such entry can be popped, or if its message doesn’t match, an
+ * assertion fails, and some debug output is printed.
+ *
+ * Since: 0.2.0
+ */
+#define gt_log_queue_assert_entry_pop(self, domain, level, message_pattern) \
+  G_STMT_START { \
+    g_autoptr(GtLogQueueEntry) aep_entry = \
+        gt_log_queue_pop_entry_for (self, domain, level); \
+    if (aep_entry == NULL) \
+      { \
+        g_autofree gchar *aep_list = gt_log_queue_format_entries (self); \
+        g_autofree gchar *aep_message = \
+            g_strdup_printf ("Expected log entry matching ‘%s’, but saw no entries " \
+                             "for that domain and level in:\n%s", \
+                             message_pattern, aep_list); \
+        g_assertion_message (G_LOG_DOMAIN, __FILE__, __LINE__, G_STRFUNC, \
+                             aep_message); \
+      } \
+    else if (!g_pattern_match_simple (message_pattern, \
+                                      gt_log_queue_entry_get_message (aep_entry))) \
+      { \
+        g_autofree gchar *aep_args = gt_log_queue_format_entry (aep_entry); \
+        g_autofree gchar *aep_message = \
+            g_strdup_printf ("Expected log entry matching ‘%s’, but saw: %s", \
+                             message_pattern, aep_args); \
+        g_assertion_message (G_LOG_DOMAIN, __FILE__, __LINE__, G_STRFUNC, \
+                             aep_message); \
+      } \
+  } G_STMT_END
+
+/**
+ * gt_log_queue_assert_n_counted:
+ * @self: a #GtLogQueue
+ * @levels: log levels to count messages for
+ * @expected_n: expected number of messages
+ *
+ * Assert that exactly @expected_n messages at @levels have been counted (see
+ * gt_log_queue_get_n_counted()).
+ *
+ * If not, an assertion fails, and some debug output is printed.
+ *
+ * Since: 0.2.0
+ */
+#define gt_log_queue_assert_n_counted(self, levels, expected_n) \
+  G_STMT_START { \
+    gsize anc_n = gt_log_queue_get_n_counted (self, levels); \
+    if (anc_n != (gsize) (expected_n)) \
+      { \
+        g_autofree gchar *anc_message = \
+            g_strdup_printf ("Expected %" G_GSIZE_FORMAT " counted log messages, but saw %" G_GSIZE_FORMAT, \
+                             (gsize) (expected_n), anc_n); \
+        g_assertion_message (G_LOG_DOMAIN, __FILE__, __LINE__, G_STRFUNC, \
+                             anc_message); \
+      } \
+  } G_STMT_END
+
+G_END_DECLS
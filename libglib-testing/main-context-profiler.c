@@ -0,0 +1,817 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ *
+ * Copyright © 2018 Endless Mobile, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#include "config.h"
+
+#include <glib.h>
+#include <libglib-testing/latencies-private.h>
+#include <libglib-testing/main-context-profiler.h>
+#include <libglib-testing/main-context-profiler-private.h>
+#include <libglib-testing/source-tracker-private.h>
+#include <libglib-testing/symbols-private.h>
+#include <libglib-testing/time-private.h>
+
+
+/**
+ * SECTION:main-context-profiler
+ * @short_description: Per-source dispatch timing for a main context
+ * @stability: Unstable
+ * @include: libglib-testing/main-context-profiler.h
+ *
+ * #GtMainContextProfiler times every source dispatch in a #GMainContext, and
+ * attributes the time to the source which was dispatched, identified by its
+ * name (see g_source_set_name()) and callback. Latency in a service is often
+ * caused by a single slow source blocking the main loop, and this allows that
+ * source to be found from a test.
+ *
+ * For each source, the profiler records how many times it was dispatched, the
+ * total time spent dispatching it, and its longest dispatch. It also records
+ * the total time spent dispatching sources in each iteration of the context
+ * (the iteration latency), which is how long any other source which became
+ * ready during that iteration had to wait; percentiles of this are available
+ * from gt_main_context_profiler_get_iteration_latency_ns(). A summary of all
+ * the statistics can be printed using gt_main_context_profiler_format().
+ *
+ * Sources are profiled from the first time they are dispatched after the
+ * profiler is installed. As GLib provides no hook for observing dispatches, the
+ * profiler replaces the #GSourceFuncs of each source in the context with a
+ * copy whose dispatch function is timed. This is not undone when the profiler
+ * is freed, though the sources are no longer timed. A side effect is that
+ * functions which look sources up by their #GSourceFuncs, such as
+ * g_idle_remove_by_data(), will not find profiled sources.
+ *
+ * If a source dispatch iterates the context recursively, the time for any
+ * sources dispatched by the recursive iteration is included in the time for
+ * the outer source as well as being recorded for the inner sources.
+ *
+ * To profile the contexts used by a #GtDBusQueue, and separate the time spent
+ * in the test harness from the time spent in the code under test, use
+ * gt_dbus_queue_set_profiling().
+ *
+ * Only one #GtMainContextProfiler may be installed on a given #GMainContext at
+ * once.
+ *
+ * Since: 0.2.0
+ */
+
+/**
+ * GtMainContextProfiler:
+ *
+ * A profiler which times the source dispatches in a #GMainContext.
+ *
+ * Since: 0.2.0
+ */
+struct _GtMainContextProfiler
+{
+  GMainContext *context;  /* (owned) */
+  GSource *profiler_source;  /* (owned) */
+};
+
+/* Statistics for the dispatches of one source, keyed by its name and
+ * callback. */
+typedef struct
+{
+  gchar *name;  /* (owned) (nullable) */
+  GSourceFunc callback;  /* (nullable) */
+  guint n_dispatches;
+  guint64 total_time_ns;
+  guint64 max_time_ns;
+} SourceStats;
+
+static void
+source_stats_free (SourceStats *stats)
+{
+  g_free (stats->name);
+  g_free (stats);
+}
+
+static guint
+source_stats_hash (gconstpointer key)
+{
+  const SourceStats *stats = key;
+
+  return ((stats->name != NULL) ? g_str_hash (stats->name) : 0) ^
+         g_direct_hash ((gpointer) stats->callback);
+}
+
+static gboolean
+source_stats_equal (gconstpointer a,
+                    gconstpointer b)
+{
+  const SourceStats *stats_a = a, *stats_b = b;
+
+  return (stats_a->callback == stats_b->callback &&
+          g_strcmp0 (stats_a->name, stats_b->name) == 0);
+}
+
+/* Describe the source and callback which @stats are for, in a form suitable
+ * for showing to the user. */
+static gchar *
+source_stats_dup_label (const SourceStats *stats)
+{
+  const gchar *name = (stats->name != NULL) ? stats->name : "(unnamed)";
+  g_autofree gchar *callback_name = NULL;
+
+  if (stats->callback == NULL)
+    return g_strdup (name);
+
+  callback_name = gt_symbol_dup_name ((gconstpointer) stats->callback);
+
+  return g_strdup_printf ("%s (%s)", name, callback_name);
+}
+
+/* Highest priority source which is prepared at the start of every iteration
+ * of the context, and checked before any sources are dispatched. It finishes
+ * recording the previous iteration, and wraps the #GSourceFuncs of any sources
+ * which have been attached since it last ran.
+ *
+ * The profiler’s state is stored here, rather than in #GtMainContextProfiler,
+ * so that it remains valid while a source is being dispatched in another
+ * thread (which holds a reference to this source) as
+ * gt_main_context_profiler_free() is called. */
+typedef struct
+{
+  GSource source;
+
+  GMutex lock;
+  GHashTable *stats;  /* (owned) (element-type SourceStats) (locked-by lock) */
+  GArray *iteration_latencies_ns;  /* (owned) (element-type guint64) (locked-by lock) */
+  guint64 pending_iteration_ns;  /* (locked-by lock) */
+  gboolean have_pending_iteration;  /* (locked-by lock) */
+  guint n_dispatches;  /* (locked-by lock) */
+  guint64 total_time_ns;  /* (locked-by lock) */
+
+  /* Only accessed from the thread iterating the context: */
+  GtSourceTracker *new_sources;  /* (owned) (nullable) */
+  guint dispatch_depth;
+} ProfilerSource;
+
+/* A copy of some #GSourceFuncs, with a timed dispatch function. */
+typedef struct
+{
+  GSourceFuncs funcs;
+  const GSourceFuncs *original;  /* (unowned) */
+} WrappedFuncs;
+
+/* Global state, shared by all profilers. #WrappedFuncs are never freed, since
+ * sources may continue to use them after their profiler has been freed. */
+static GMutex global_lock;
+static GHashTable *profilers = NULL;  /* (owned) (element-type GMainContext ProfilerSource) (locked-by global_lock) */
+static GHashTable *wrapped_funcs_by_original = NULL;  /* (owned) (element-type GSourceFuncs WrappedFuncs) (locked-by global_lock) */
+static GHashTable *wrapped_funcs_set = NULL;  /* (owned) (element-type WrappedFuncs) (locked-by global_lock) */
+
+/* Get a new reference to the profiler installed on @context, if there is
+ * one. */
+static ProfilerSource *
+profiler_source_ref_for_context (GMainContext *context)
+{
+  ProfilerSource *profiler_source = NULL;
+
+  g_mutex_lock (&global_lock);
+  if (profilers != NULL)
+    profiler_source = g_hash_table_lookup (profilers, context);
+  if (profiler_source != NULL)
+    g_source_ref ((GSource *) profiler_source);
+  g_mutex_unlock (&global_lock);
+
+  return profiler_source;
+}
+
+/* Add a dispatch of @name and @callback taking @time_ns to the statistics. */
+static void
+profiler_source_record_dispatch (ProfilerSource *self,
+                                 const gchar    *name,
+                                 GSourceFunc     callback,
+                                 guint64         time_ns)
+{
+  SourceStats key = { (gchar *) name, callback, 0, 0, 0 };
+  SourceStats *stats;
+
+  g_mutex_lock (&self->lock);
+
+  stats = g_hash_table_lookup (self->stats, &key);
+  if (stats == NULL)
+    {
+      stats = g_new0 (SourceStats, 1);
+      stats->name = g_strdup (name);
+      stats->callback = callback;
+      g_hash_table_add (self->stats, stats);
+    }
+
+  stats->n_dispatches++;
+  stats->total_time_ns += time_ns;
+  stats->max_time_ns = MAX (stats->max_time_ns, time_ns);
+  self->n_dispatches++;
+
+  /* Recursive dispatches are already included in the time for the outermost
+   * one. */
+  if (self->dispatch_depth == 0)
+    {
+      self->pending_iteration_ns += time_ns;
+      self->have_pending_iteration = TRUE;
+      self->total_time_ns += time_ns;
+    }
+
+  g_mutex_unlock (&self->lock);
+}
+
+static gboolean
+wrapped_dispatch (GSource     *source,
+                  GSourceFunc  callback,
+                  gpointer     user_data)
+{
+  const WrappedFuncs *wrapped = (const WrappedFuncs *) source->source_funcs;
+  ProfilerSource *profiler_source;
+  gint64 start_time_ns, time_ns;
+  gboolean retval;
+
+  profiler_source = profiler_source_ref_for_context (g_source_get_context (source));
+  if (profiler_source == NULL)
+    return wrapped->original->dispatch (source, callback, user_data);
+
+  profiler_source->dispatch_depth++;
+  start_time_ns = gt_get_time_ns ();
+  retval = wrapped->original->dispatch (source, callback, user_data);
+  time_ns = gt_get_time_ns () - start_time_ns;
+  profiler_source->dispatch_depth--;
+
+  profiler_source_record_dispatch (profiler_source, g_source_get_name (source),
+                                   callback, (guint64) time_ns);
+  g_source_unref ((GSource *) profiler_source);
+
+  return retval;
+}
+
+/* Replace the #GSourceFuncs of @source with a wrapped copy, unless that has
+ * already been done. */
+static void
+wrap_source (GSource *source)
+{
+  const GSourceFuncs *original = source->source_funcs;
+  WrappedFuncs *wrapped;
+
+  g_mutex_lock (&global_lock);
+
+  if (wrapped_funcs_by_original == NULL)
+    {
+      wrapped_funcs_by_original = g_hash_table_new (NULL, NULL);
+      wrapped_funcs_set = g_hash_table_new (NULL, NULL);
+    }
+
+  if (!g_hash_table_contains (wrapped_funcs_set, original))
+    {
+      wrapped = g_hash_table_lookup (wrapped_funcs_by_original, original);
+
+      if (wrapped == NULL)
+        {
+          wrapped = g_new0 (WrappedFuncs, 1);
+          wrapped->funcs = *original;
+          wrapped->funcs.dispatch = wrapped_dispatch;
+          wrapped->original = original;
+
+          g_hash_table_insert (wrapped_funcs_by_original, (gpointer) original, wrapped);
+          g_hash_table_add (wrapped_funcs_set, wrapped);
+        }
+
+      source->source_funcs = &wrapped->funcs;
+    }
+
+  g_mutex_unlock (&global_lock);
+}
+
+/*
+ * gt_main_context_profiler_get_source_funcs:
+ * @source: a #GSource
+ *
+ * Get the #GSourceFuncs which @source was created with. If it has been
+ * profiled by a #GtMainContextProfiler, its `source_funcs` will have been
+ * replaced with a wrapped copy, so should not be compared against (for
+ * example) `g_timeout_funcs` directly.
+ *
+ * Returns: (transfer none): the original source functions for @source
+ * Since: 0.2.0
+ */
+const GSourceFuncs *
+gt_main_context_profiler_get_source_funcs (GSource *source)
+{
+  const GSourceFuncs *funcs;
+
+  g_return_val_if_fail (source != NULL, NULL);
+
+  funcs = source->source_funcs;
+
+  g_mutex_lock (&global_lock);
+  if (wrapped_funcs_set != NULL &&
+      g_hash_table_contains (wrapped_funcs_set, funcs))
+    funcs = ((const WrappedFuncs *) funcs)->original;
+  g_mutex_unlock (&global_lock);
+
+  return funcs;
+}
+
+/* Move the dispatch time for the current iteration into the list of iteration
+ * latencies, if any sources were dispatched in it. */
+static void
+profiler_source_finish_iteration_locked (ProfilerSource *self)
+{
+  if (!self->have_pending_iteration)
+    return;
+
+  g_array_append_val (self->iteration_latencies_ns, self->pending_iteration_ns);
+  self->pending_iteration_ns = 0;
+  self->have_pending_iteration = FALSE;
+}
+
+/* Wrap each source found in the context, other than the profiler itself.
+ * Sources don’t need tracking once they have been wrapped. */
+static gboolean
+wrap_source_cb (GSource  *source,
+                gpointer  user_data)
+{
+  if (source != user_data)
+    wrap_source (source);
+
+  return FALSE;
+}
+
+/* Wrap the #GSourceFuncs of any sources which have been attached to the
+ * context since this was last called. The first call wraps all the sources
+ * which were already attached. That is done here, rather than when the
+ * profiler is created, so that sources are only wrapped in the thread which
+ * is iterating the context. */
+static void
+profiler_source_wrap_new_sources (ProfilerSource *self)
+{
+  if (self->new_sources == NULL)
+    self->new_sources = gt_source_tracker_new (g_source_get_context ((GSource *) self),
+                                               wrap_source_cb, self);
+  else
+    gt_source_tracker_update (self->new_sources);
+}
+
+static gboolean
+profiler_source_prepare (GSource *source,
+                         gint    *timeout)
+{
+  ProfilerSource *self = (ProfilerSource *) source;
+
+  *timeout = -1;
+
+  /* A recursive iteration is part of the outer iteration. */
+  if (self->dispatch_depth == 0)
+    {
+      g_mutex_lock (&self->lock);
+      profiler_source_finish_iteration_locked (self);
+      g_mutex_unlock (&self->lock);
+    }
+
+  profiler_source_wrap_new_sources (self);
+
+  return FALSE;
+}
+
+static gboolean
+profiler_source_check (GSource *source)
+{
+  ProfilerSource *self = (ProfilerSource *) source;
+
+  /* Sources attached from another thread while the context was polling (such
+   * as GDBus’ idle sources for delivering replies) are checked and dispatched
+   * without being prepared, so need wrapping here too. */
+  profiler_source_wrap_new_sources (self);
+
+  return FALSE;
+}
+
+static gboolean
+profiler_source_dispatch (GSource     *source,
+                          GSourceFunc  callback,
+                          gpointer     user_data)
+{
+  /* Never ready, so never dispatched. */
+  return G_SOURCE_CONTINUE;
+}
+
+static void
+profiler_source_finalize (GSource *source)
+{
+  ProfilerSource *self = (ProfilerSource *) source;
+
+  g_clear_pointer (&self->new_sources, gt_source_tracker_free);
+  g_clear_pointer (&self->iteration_latencies_ns, g_array_unref);
+  g_clear_pointer (&self->stats, g_hash_table_unref);
+  g_mutex_clear (&self->lock);
+}
+
+static GSourceFuncs profiler_source_funcs =
+{
+  profiler_source_prepare,
+  profiler_source_check,
+  profiler_source_dispatch,
+  profiler_source_finalize,
+  NULL,
+  NULL,
+};
+
+/**
+ * gt_main_context_profiler_new:
+ * @context: (nullable): a #GMainContext to profile, or %NULL to use the global
+ *    default main context
+ *
+ * Create a new #GtMainContextProfiler and install it on @context. Profiling
+ * starts from the next iteration of @context.
+ *
+ * Only one #GtMainContextProfiler may be installed on a given #GMainContext at
+ * once.
+ *
+ * Returns: (transfer full): a new #GtMainContextProfiler
+ * Since: 0.2.0
+ */
+GtMainContextProfiler *
+gt_main_context_profiler_new (GMainContext *context)
+{
+  g_autoptr(GtMainContextProfiler) profiler = NULL;
+  ProfilerSource *profiler_source;
+  gboolean already_profiled;
+
+  if (context == NULL)
+    context = g_main_context_default ();
+
+  g_mutex_lock (&global_lock);
+  already_profiled = (profilers != NULL && g_hash_table_contains (profilers, context));
+  g_mutex_unlock (&global_lock);
+
+  g_return_val_if_fail (!already_profiled, NULL);
+
+  profiler = g_new0 (GtMainContextProfiler, 1);
+  profiler->context = g_main_context_ref (context);
+
+  profiler->profiler_source = g_source_new (&profiler_source_funcs, sizeof (ProfilerSource));
+  profiler_source = (ProfilerSource *) profiler->profiler_source;
+  g_mutex_init (&profiler_source->lock);
+  profiler_source->stats = g_hash_table_new_full (source_stats_hash,
+                                                  source_stats_equal,
+                                                  (GDestroyNotify) source_stats_free,
+                                                  NULL);
+  profiler_source->iteration_latencies_ns = g_array_new (FALSE, FALSE, sizeof (guint64));
+
+  g_mutex_lock (&global_lock);
+  if (profilers == NULL)
+    profilers = g_hash_table_new_full (NULL, NULL, NULL, (GDestroyNotify) g_source_unref);
+  g_hash_table_insert (profilers, profiler->context,
+                       g_source_ref (profiler->profiler_source));
+  g_mutex_unlock (&global_lock);
+
+  g_source_set_priority (profiler->profiler_source, G_MININT);
+  g_source_set_name (profiler->profiler_source, "GtMainContextProfiler");
+  g_source_attach (profiler->profiler_source, profiler->context);
+
+  /* Make sure the sources which are already attached get wrapped before they
+   * are next dispatched. */
+  g_main_context_wakeup (profiler->context);
+
+  return g_steal_pointer (&profiler);
+}
+
+/**
+ * gt_main_context_profiler_free:
+ * @self: (transfer full): a #GtMainContextProfiler
+ *
+ * Uninstall a #GtMainContextProfiler from its #GMainContext and free it,
+ * along with its statistics.
+ *
+ * Since: 0.2.0
+ */
+void
+gt_main_context_profiler_free (GtMainContextProfiler *self)
+{
+  g_return_if_fail (self != NULL);
+
+  if (self->profiler_source != NULL)
+    {
+      g_mutex_lock (&global_lock);
+      if (g_hash_table_lookup (profilers, self->context) == (gpointer) self->profiler_source)
+        g_hash_table_remove (profilers, self->context);
+      g_mutex_unlock (&global_lock);
+
+      g_source_destroy (self->profiler_source);
+    }
+
+  g_clear_pointer (&self->profiler_source, g_source_unref);
+  g_clear_pointer (&self->context, g_main_context_unref);
+
+  g_free (self);
+}
+
+/**
+ * gt_main_context_profiler_reset:
+ * @self: a #GtMainContextProfiler
+ *
+ * Clear all the statistics recorded so far. This is useful for excluding the
+ * set up phase of a test from the profile.
+ *
+ * This may be called from any thread.
+ *
+ * Since: 0.2.0
+ */
+void
+gt_main_context_profiler_reset (GtMainContextProfiler *self)
+{
+  ProfilerSource *profiler_source;
+
+  g_return_if_fail (self != NULL);
+
+  profiler_source = (ProfilerSource *) self->profiler_source;
+
+  g_mutex_lock (&profiler_source->lock);
+  g_hash_table_remove_all (profiler_source->stats);
+  g_array_set_size (profiler_source->iteration_latencies_ns, 0);
+  profiler_source->pending_iteration_ns = 0;
+  profiler_source->have_pending_iteration = FALSE;
+  profiler_source->n_dispatches = 0;
+  profiler_source->total_time_ns = 0;
+  g_mutex_unlock (&profiler_source->lock);
+}
+
+/**
+ * gt_main_context_profiler_get_n_dispatches:
+ * @self: a #GtMainContextProfiler
+ *
+ * Get the number of source dispatches recorded, across all sources.
+ *
+ * This may be called from any thread.
+ *
+ * Returns: number of source dispatches
+ * Since: 0.2.0
+ */
+guint
+gt_main_context_profiler_get_n_dispatches (GtMainContextProfiler *self)
+{
+  ProfilerSource *profiler_source;
+  guint n_dispatches;
+
+  g_return_val_if_fail (self != NULL, 0);
+
+  profiler_source = (ProfilerSource *) self->profiler_source;
+
+  g_mutex_lock (&profiler_source->lock);
+  n_dispatches = profiler_source->n_dispatches;
+  g_mutex_unlock (&profiler_source->lock);
+
+  return n_dispatches;
+}
+
+/**
+ * gt_main_context_profiler_get_total_time_ns:
+ * @self: a #GtMainContextProfiler
+ *
+ * Get the total time spent dispatching sources. Time spent in recursive
+ * iterations of the context is only counted once.
+ *
+ * This may be called from any thread.
+ *
+ * Returns: total dispatch time, in nanoseconds
+ * Since: 0.2.0
+ */
+guint64
+gt_main_context_profiler_get_total_time_ns (GtMainContextProfiler *self)
+{
+  ProfilerSource *profiler_source;
+  guint64 total_time_ns;
+
+  g_return_val_if_fail (self != NULL, 0);
+
+  profiler_source = (ProfilerSource *) self->profiler_source;
+
+  g_mutex_lock (&profiler_source->lock);
+  total_time_ns = profiler_source->total_time_ns;
+  g_mutex_unlock (&profiler_source->lock);
+
+  return total_time_ns;
+}
+
+/* Get a sorted copy of the iteration latencies, including the current
+ * iteration if any sources have been dispatched in it. */
+static GArray *
+profiler_source_dup_sorted_latencies_locked (ProfilerSource *self)
+{
+  GArray *latencies;
+
+  latencies = g_array_sized_new (FALSE, FALSE, sizeof (guint64),
+                                 self->iteration_latencies_ns->len + 1);
+  g_array_append_vals (latencies, self->iteration_latencies_ns->data,
+                       self->iteration_latencies_ns->len);
+  if (self->have_pending_iteration)
+    g_array_append_val (latencies, self->pending_iteration_ns);
+
+  gt_latencies_sort (latencies);
+
+  return latencies;
+}
+
+/**
+ * gt_main_context_profiler_get_n_iterations:
+ * @self: a #GtMainContextProfiler
+ *
+ * Get the number of iterations of the context in which at least one source was
+ * dispatched. Iterations where nothing was dispatched are not counted, and do
+ * not contribute to the iteration latency percentiles.
+ *
+ * This may be called from any thread.
+ *
+ * Returns: number of iterations which dispatched sources
+ * Since: 0.2.0
+ */
+guint
+gt_main_context_profiler_get_n_iterations (GtMainContextProfiler *self)
+{
+  ProfilerSource *profiler_source;
+  guint n_iterations;
+
+  g_return_val_if_fail (self != NULL, 0);
+
+  profiler_source = (ProfilerSource *) self->profiler_source;
+
+  g_mutex_lock (&profiler_source->lock);
+  n_iterations = profiler_source->iteration_latencies_ns->len;
+  if (profiler_source->have_pending_iteration)
+    n_iterations++;
+  g_mutex_unlock (&profiler_source->lock);
+
+  return n_iterations;
+}
+
+/**
+ * gt_main_context_profiler_get_iteration_latency_ns:
+ * @self: a #GtMainContextProfiler
+ * @percentile: percentile to get, between 0 and 100 inclusive
+ *
+ * Get a percentile of the iteration latency: the total time spent dispatching
+ * sources in a single iteration of the context. For example, a @percentile of
+ * 99 gives the latency which 99% of iterations were at or below, and a
+ * @percentile of 100 gives the slowest iteration.
+ *
+ * This may be called from any thread.
+ *
+ * Returns: iteration latency at @percentile, in nanoseconds, or 0 if no
+ *    iterations have been recorded
+ * Since: 0.2.0
+ */
+guint64
+gt_main_context_profiler_get_iteration_latency_ns (GtMainContextProfiler *self,
+                                                   gdouble                percentile)
+{
+  ProfilerSource *profiler_source;
+  g_autoptr(GArray) latencies = NULL;
+
+  g_return_val_if_fail (self != NULL, 0);
+  g_return_val_if_fail (percentile >= 0.0 && percentile <= 100.0, 0);
+
+  profiler_source = (ProfilerSource *) self->profiler_source;
+
+  g_mutex_lock (&profiler_source->lock);
+  latencies = profiler_source_dup_sorted_latencies_locked (profiler_source);
+  g_mutex_unlock (&profiler_source->lock);
+
+  return gt_latencies_get_percentile (latencies, percentile);
+}
+
+/**
+ * gt_main_context_profiler_dup_slowest_source:
+ * @self: a #GtMainContextProfiler
+ * @out_max_time_ns: (out caller-allocates) (optional): return location for the
+ *    duration of the source’s longest dispatch, in nanoseconds
+ *
+ * Get a description of the source which had the longest single dispatch. This
+ * contains the source’s name and callback, in the same form as used by
+ * gt_main_context_profiler_format().
+ *
+ * This may be called from any thread.
+ *
+ * Returns: (transfer full) (nullable): description of the slowest source, or
+ *    %NULL if no sources have been dispatched
+ * Since: 0.2.0
+ */
+gchar *
+gt_main_context_profiler_dup_slowest_source (GtMainContextProfiler *self,
+                                             guint64               *out_max_time_ns)
+{
+  ProfilerSource *profiler_source;
+  GHashTableIter iter;
+  SourceStats *stats, *slowest_stats = NULL;
+  gchar *label = NULL;
+
+  g_return_val_if_fail (self != NULL, NULL);
+
+  profiler_source = (ProfilerSource *) self->profiler_source;
+
+  g_mutex_lock (&profiler_source->lock);
+
+  g_hash_table_iter_init (&iter, profiler_source->stats);
+  while (g_hash_table_iter_next (&iter, (gpointer *) &stats, NULL))
+    {
+      if (slowest_stats == NULL || stats->max_time_ns > slowest_stats->max_time_ns)
+        slowest_stats = stats;
+    }
+
+  if (slowest_stats != NULL)
+    label = source_stats_dup_label (slowest_stats);
+  if (out_max_time_ns != NULL)
+    *out_max_time_ns = (slowest_stats != NULL) ? slowest_stats->max_time_ns : 0;
+
+  g_mutex_unlock (&profiler_source->lock);
+
+  return label;
+}
+
+/* Sort #SourceStats by decreasing total time. */
+static gint
+compare_source_stats (gconstpointer a,
+                      gconstpointer b)
+{
+  const SourceStats *stats_a = *((const SourceStats **) a);
+  const SourceStats *stats_b = *((const SourceStats **) b);
+
+  return (stats_a->total_time_ns < stats_b->total_time_ns) -
+         (stats_a->total_time_ns > stats_b->total_time_ns);
+}
+
+/**
+ * gt_main_context_profiler_format:
+ * @self: a #GtMainContextProfiler
+ *
+ * Format the recorded statistics as a human-readable table, listing each
+ * source’s number of dispatches, total dispatch time and longest dispatch, in
+ * order of decreasing total time, followed by the iteration latency
+ * percentiles.
+ *
+ * This may be called from any thread.
+ *
+ * Returns: (transfer full): human-readable statistics
+ * Since: 0.2.0
+ */
+gchar *
+gt_main_context_profiler_format (GtMainContextProfiler *self)
+{
+  ProfilerSource *profiler_source;
+  g_autoptr(GString) str = g_string_new ("");
+  g_autoptr(GPtrArray) sorted_stats = g_ptr_array_new ();
+  g_autoptr(GArray) latencies = NULL;
+  GHashTableIter iter;
+  SourceStats *stats;
+
+  g_return_val_if_fail (self != NULL, NULL);
+
+  profiler_source = (ProfilerSource *) self->profiler_source;
+
+  g_mutex_lock (&profiler_source->lock);
+
+  g_hash_table_iter_init (&iter, profiler_source->stats);
+  while (g_hash_table_iter_next (&iter, (gpointer *) &stats, NULL))
+    g_ptr_array_add (sorted_stats, stats);
+  g_ptr_array_sort (sorted_stats, compare_source_stats);
+
+  for (gsize i = 0; i < sorted_stats->len; i++)
+    {
+      g_autofree gchar *label = NULL;
+
+      stats = g_ptr_array_index (sorted_stats, i);
+      label = source_stats_dup_label (stats);
+
+      g_string_append_printf (str, "  %s: %u dispatches, %.3fms total, %.3fms max\n",
+                              label, stats->n_dispatches,
+                              (gdouble) stats->total_time_ns / 1000000.0,
+                              (gdouble) stats->max_time_ns / 1000000.0);
+    }
+
+  latencies = profiler_source_dup_sorted_latencies_locked (profiler_source);
+
+  g_mutex_unlock (&profiler_source->lock);
+
+  g_string_append_printf (str, "  Iteration latency over %u iterations: "
+                          "p50 %.3fms, p90 %.3fms, p99 %.3fms, max %.3fms\n",
+                          latencies->len,
+                          (gdouble) gt_latencies_get_percentile (latencies, 50.0) / 1000000.0,
+                          (gdouble) gt_latencies_get_percentile (latencies, 90.0) / 1000000.0,
+                          (gdouble) gt_latencies_get_percentile (latencies, 99.0) / 1000000.0,
+                          (gdouble) gt_latencies_get_percentile (latencies, 100.0) / 1000000.0);
+
+  return g_string_free (g_steal_pointer (&str), FALSE);
+}
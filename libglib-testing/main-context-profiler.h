@@ -0,0 +1,46 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ *
+ * Copyright © 2018 Endless Mobile, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#pragma once
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+typedef struct _GtMainContextProfiler GtMainContextProfiler;
+
+GtMainContextProfiler *gt_main_context_profiler_new  (GMainContext          *context);
+void                   gt_main_context_profiler_free (GtMainContextProfiler *self);
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC (GtMainContextProfiler, gt_main_context_profiler_free)
+
+void    gt_main_context_profiler_reset                    (GtMainContextProfiler *self);
+
+guint   gt_main_context_profiler_get_n_dispatches         (GtMainContextProfiler *self);
+guint64 gt_main_context_profiler_get_total_time_ns        (GtMainContextProfiler *self);
+guint   gt_main_context_profiler_get_n_iterations         (GtMainContextProfiler *self);
+guint64 gt_main_context_profiler_get_iteration_latency_ns (GtMainContextProfiler *self,
+                                                           gdouble                percentile);
+gchar  *gt_main_context_profiler_dup_slowest_source       (GtMainContextProfiler *self,
+                                                           guint64               *out_max_time_ns);
+
+gchar  *gt_main_context_profiler_format                   (GtMainContextProfiler *self);
+
+G_END_DECLS
@@ -0,0 +1,1666 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ *
+ * Copyright © 2018 Endless Mobile, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+#include "config.h"
+
+#include <gio/gio.h>
+#include <glib.h>
+#include <glib-object.h>
+#include <libglib-testing/memory-vfs.h>
+#include <string.h>
+
+
+/**
+ * SECTION:memory-vfs
+ * @short_description: In-memory file tree with I/O operation counting
+ * @stability: Unstable
+ * @include: libglib-testing/memory-vfs.h
+ *
+ * #GtMemoryVfs is an in-memory tree of files and directories, which can be
+ * accessed through #GFile using a custom URI scheme, so that code which does
+ * file I/O can be tested without touching the disk.
+ *
+ * The tree is populated using gt_memory_vfs_add_file() and
+ * gt_memory_vfs_add_directory(), and files in it can be got using
+ * gt_memory_vfs_get_file(), or by passing URIs like `scheme:///path/to/file`
+ * to g_file_new_for_uri(). The files are read-only through #GFile: opening,
+ * reading, querying information and enumerating directories are supported.
+ *
+ * Every one of those operations is counted per path (whether it succeeds or
+ * not), so that tests can catch I/O regressions, such as a change which causes
+ * many more files to be queried at startup. Use
+ * gt_memory_vfs_get_n_operations() to query the counts, and
+ * gt_memory_vfs_assert_n_operations_at_most() or
+ * gt_memory_vfs_assert_no_operations() to check them.
+ *
+ * Latency can be injected into each type of operation using
+ * gt_memory_vfs_set_latency(). Asynchronous operations are completed by a
+ * timeout source on the thread-default main context of the caller once the
+ * latency has passed (so a #GtVirtualClock can be used to skip the wait);
+ * synchronous operations block the calling thread for the latency.
+ *
+ * The URI scheme is registered with the default #GVfs for the lifetime of the
+ * #GtMemoryVfs, so each #GtMemoryVfs which exists at the same time must use a
+ * different scheme. #GFiles from a #GtMemoryVfs may outlive it, but can no
+ * longer be looked up by URI once it has been freed.
+ *
+ * Since: 0.2.0
+ */
+
+#define N_OPERATIONS (GT_MEMORY_VFS_OPERATION_LAST + 1)
+
+/**
+ * GtMemoryVfs:
+ *
+ * An in-memory file tree, accessed through #GFile using a custom URI scheme,
+ * which counts the I/O operations performed on it.
+ *
+ * Since: 0.2.0
+ */
+struct _GtMemoryVfs
+{
+  /* Reference counted internally, as #GFiles keep the tree alive. */
+  gint ref_count;  /* (atomic) */
+  gchar *scheme;  /* (owned) */
+  gboolean registered;
+
+  GMutex lock;
+  GHashTable *nodes;  /* (owned) (element-type utf8 Node) (locked-by lock) */
+  GHashTable *counts;  /* (owned) (element-type utf8 OperationCounts) (locked-by lock) */
+  guint latency_ms[N_OPERATIONS];  /* (locked-by lock) */
+};
+
+/* A file or directory in the tree, keyed by its canonical path. */
+typedef struct
+{
+  gboolean is_directory;
+  GBytes *contents;  /* (owned) (nullable); %NULL for directories */
+} Node;
+
+/* Operation counts for a path. */
+typedef struct
+{
+  guint n_operations[N_OPERATIONS];
+} OperationCounts;
+
+static void
+node_free (Node *node)
+{
+  g_clear_pointer (&node->contents, g_bytes_unref);
+  g_free (node);
+}
+
+static GtMemoryVfs *
+memory_vfs_ref (GtMemoryVfs *self)
+{
+  g_atomic_int_inc (&self->ref_count);
+  return self;
+}
+
+static void
+memory_vfs_unref (GtMemoryVfs *self)
+{
+  if (!g_atomic_int_dec_and_test (&self->ref_count))
+    return;
+
+  g_clear_pointer (&self->counts, g_hash_table_unref);
+  g_clear_pointer (&self->nodes, g_hash_table_unref);
+  g_mutex_clear (&self->lock);
+  g_free (self->scheme);
+  g_free (self);
+}
+
+/* Canonicalise @path into an absolute path with no empty, `.` or `..`
+ * components and no trailing slash, such as `/a/b`. */
+static gchar *
+canonicalize_path (const gchar *path)
+{
+  g_auto(GStrv) components = g_strsplit (path, "/", -1);
+  g_autoptr(GPtrArray) canonical = g_ptr_array_new ();
+  g_autofree gchar *joined = NULL;
+
+  for (gsize i = 0; components[i] != NULL; i++)
+    {
+      const gchar *component = components[i];
+
+      if (*component == '\0' || g_str_equal (component, "."))
+        continue;
+      else if (g_str_equal (component, ".."))
+        {
+          if (canonical->len > 0)
+            g_ptr_array_remove_index (canonical, canonical->len - 1);
+        }
+      else
+        g_ptr_array_add (canonical, (gpointer) component);
+    }
+
+  g_ptr_array_add (canonical, NULL);
+  joined = g_strjoinv ("/", (gchar **) canonical->pdata);
+
+  return g_strconcat ("/", joined, NULL);
+}
+
+/* Get the parent of canonical @path, or %NULL if it is the root. */
+static gchar *
+path_dup_parent (const gchar *path)
+{
+  const gchar *last_slash;
+
+  if (g_str_equal (path, "/"))
+    return NULL;
+
+  last_slash = strrchr (path, '/');
+  if (last_slash == path)
+    return g_strdup ("/");
+
+  return g_strndup (path, last_slash - path);
+}
+
+/* Get the last component of canonical @path, or `/` if it is the root. */
+static const gchar *
+path_get_basename (const gchar *path)
+{
+  if (g_str_equal (path, "/"))
+    return path;
+
+  return strrchr (path, '/') + 1;
+}
+
+/* Count @operation on @path. */
+static void
+record_operation (GtMemoryVfs          *self,
+                  GtMemoryVfsOperation  operation,
+                  const gchar          *path)
+{
+  OperationCounts *counts;
+
+  g_mutex_lock (&self->lock);
+
+  counts = g_hash_table_lookup (self->counts, path);
+  if (counts == NULL)
+    {
+      counts = g_new0 (OperationCounts, 1);
+      g_hash_table_insert (self->counts, g_strdup (path), counts);
+    }
+
+  counts->n_operations[operation]++;
+
+  g_mutex_unlock (&self->lock);
+}
+
+static guint
+get_latency (GtMemoryVfs          *self,
+             GtMemoryVfsOperation  operation)
+{
+  guint latency_ms;
+
+  g_mutex_lock (&self->lock);
+  latency_ms = self->latency_ms[operation];
+  g_mutex_unlock (&self->lock);
+
+  return latency_ms;
+}
+
+/* Count a synchronous @operation on @path and block for its latency. */
+static void
+start_sync_operation (GtMemoryVfs          *self,
+                      GtMemoryVfsOperation  operation,
+                      const gchar          *path)
+{
+  guint latency_ms;
+
+  record_operation (self, operation, path);
+
+  latency_ms = get_latency (self, operation);
+  if (latency_ms > 0)
+    g_usleep (latency_ms * 1000);
+}
+
+/* Count an asynchronous @operation on @path, and call @complete_func with
+ * @task to complete it after the operation’s latency, from a timeout source on
+ * the task’s main context. */
+static void
+start_async_operation (GtMemoryVfs          *self,
+                       GtMemoryVfsOperation  operation,
+                       const gchar          *path,
+                       GTask                *task,
+                       GSourceFunc           complete_func)
+{
+  guint latency_ms;
+  g_autoptr(GSource) source = NULL;
+
+  record_operation (self, operation, path);
+
+  latency_ms = get_latency (self, operation);
+  if (latency_ms == 0)
+    {
+      complete_func (task);
+      return;
+    }
+
+  /* The source holds a reference to the task until it is dispatched. */
+  source = g_timeout_source_new (latency_ms);
+  g_source_set_priority (source, g_task_get_priority (task));
+  g_source_set_callback (source, complete_func, g_object_ref (task),
+                         g_object_unref);
+  g_source_attach (source, g_task_get_context (task));
+}
+
+static gint
+compare_strings (gconstpointer a,
+                 gconstpointer b)
+{
+  return g_strcmp0 (*((const gchar * const *) a), *((const gchar * const *) b));
+}
+
+/* Build a #GFileInfo for @node, at @path, with the attributes matched by
+ * @matcher. Must be called with the lock held. */
+static GFileInfo *
+node_dup_file_info (const Node            *node,
+                    const gchar           *path,
+                    GFileAttributeMatcher *matcher)
+{
+  g_autoptr(GFileInfo) info = g_file_info_new ();
+  const gchar *basename = path_get_basename (path);
+
+  g_file_info_set_attribute_mask (info, matcher);
+
+  g_file_info_set_name (info, basename);
+  g_file_info_set_display_name (info, basename);
+  g_file_info_set_is_hidden (info, basename[0] == '.');
+  g_file_info_set_attribute_boolean (info, G_FILE_ATTRIBUTE_ACCESS_CAN_READ,
+                                     TRUE);
+  g_file_info_set_attribute_boolean (info, G_FILE_ATTRIBUTE_ACCESS_CAN_WRITE,
+                                     FALSE);
+
+  if (node->is_directory)
+    {
+      g_file_info_set_file_type (info, G_FILE_TYPE_DIRECTORY);
+      g_file_info_set_content_type (info, "inode/directory");
+    }
+  else
+    {
+      gsize size;
+      gconstpointer data = g_bytes_get_data (node->contents, &size);
+
+      g_file_info_set_file_type (info, G_FILE_TYPE_REGULAR);
+      g_file_info_set_size (info, (goffset) size);
+
+      /* Guessing the content type looks at the data, so only do it if
+       * needed. */
+      if (g_file_attribute_matcher_matches (matcher,
+                                            G_FILE_ATTRIBUTE_STANDARD_CONTENT_TYPE))
+        {
+          g_autofree gchar *content_type = NULL;
+
+          content_type = g_content_type_guess (basename, data, size, NULL);
+          g_file_info_set_content_type (info, content_type);
+        }
+    }
+
+  g_file_info_unset_attribute_mask (info);
+
+  return g_steal_pointer (&info);
+}
+
+static void
+set_not_found_error (GError      **error,
+                     const gchar  *path)
+{
+  g_set_error (error, G_IO_ERROR, G_IO_ERROR_NOT_FOUND,
+               "No such file or directory: %s", path);
+}
+
+/* GtMemoryFileInputStream: the input stream for a file in the tree, which
+ * counts reads. */
+#define GT_TYPE_MEMORY_FILE_INPUT_STREAM gt_memory_file_input_stream_get_type ()
+G_DECLARE_FINAL_TYPE (GtMemoryFileInputStream, gt_memory_file_input_stream, GT,
+                      MEMORY_FILE_INPUT_STREAM, GFileInputStream)
+
+struct _GtMemoryFileInputStream
+{
+  GFileInputStream parent;
+
+  GtMemoryVfs *vfs;  /* (owned) */
+  gchar *path;  /* (owned) */
+  GBytes *contents;  /* (owned) */
+  gsize position;
+};
+
+G_DEFINE_TYPE (GtMemoryFileInputStream, gt_memory_file_input_stream,
+               G_TYPE_FILE_INPUT_STREAM)
+
+static gssize
+memory_file_input_stream_read_internal (GtMemoryFileInputStream *self,
+                                        void                    *buffer,
+                                        gsize                    count)
+{
+  gsize size;
+  const guint8 *data = g_bytes_get_data (self->contents, &size);
+  gsize n_read = MIN (count, size - self->position);
+
+  memcpy (buffer, data + self->position, n_read);
+  self->position += n_read;
+
+  return (gssize) n_read;
+}
+
+static gssize
+gt_memory_file_input_stream_read (GInputStream  *stream,
+                                  void          *buffer,
+                                  gsize          count,
+                                  GCancellable  *cancellable,
+                                  GError       **error)
+{
+  GtMemoryFileInputStream *self = GT_MEMORY_FILE_INPUT_STREAM (stream);
+
+  start_sync_operation (self->vfs, GT_MEMORY_VFS_OPERATION_READ, self->path);
+
+  if (g_cancellable_set_error_if_cancelled (cancellable, error))
+    return -1;
+
+  return memory_file_input_stream_read_internal (self, buffer, count);
+}
+
+typedef struct
+{
+  void *buffer;  /* (unowned) */
+  gsize count;
+} ReadData;
+
+static gboolean
+read_complete_cb (gpointer user_data)
+{
+  GTask *task = G_TASK (user_data);
+  GtMemoryFileInputStream *self = g_task_get_source_object (task);
+  ReadData *data = g_task_get_task_data (task);
+
+  if (!g_task_return_error_if_cancelled (task))
+    g_task_return_int (task, memory_file_input_stream_read_internal (self,
+                                                                     data->buffer,
+                                                                     data->count));
+
+  return G_SOURCE_REMOVE;
+}
+
+static void
+gt_memory_file_input_stream_read_async (GInputStream        *stream,
+                                        void                *buffer,
+                                        gsize                count,
+                                        int                  io_priority,
+                                        GCancellable        *cancellable,
+                                        GAsyncReadyCallback  callback,
+                                        gpointer             user_data)
+{
+  GtMemoryFileInputStream *self = GT_MEMORY_FILE_INPUT_STREAM (stream);
+  g_autoptr(GTask) task = NULL;
+  ReadData *data;
+
+  task = g_task_new (stream, cancellable, callback, user_data);
+  g_task_set_source_tag (task, gt_memory_file_input_stream_read_async);
+  g_task_set_priority (task, io_priority);
+
+  data = g_new0 (ReadData, 1);
+  data->buffer = buffer;
+  data->count = count;
+  g_task_set_task_data (task, data, g_free);
+
+  start_async_operation (self->vfs, GT_MEMORY_VFS_OPERATION_READ, self->path,
+                         task, read_complete_cb);
+}
+
+static gssize
+gt_memory_file_input_stream_read_finish (GInputStream  *stream,
+                                         GAsyncResult  *result,
+                                         GError       **error)
+{
+  g_return_val_if_fail (g_task_is_valid (result, stream), -1);
+
+  return g_task_propagate_int (G_TASK (result), error);
+}
+
+static gboolean
+gt_memory_file_input_stream_close (GInputStream  *stream,
+                                   GCancellable  *cancellable,
+                                   GError       **error)
+{
+  return TRUE;
+}
+
+static goffset
+gt_memory_file_input_stream_tell (GFileInputStream *stream)
+{
+  GtMemoryFileInputStream *self = GT_MEMORY_FILE_INPUT_STREAM (stream);
+
+  return (goffset) self->position;
+}
+
+static gboolean
+gt_memory_file_input_stream_can_seek (GFileInputStream *stream)
+{
+  return TRUE;
+}
+
+static gboolean
+gt_memory_file_input_stream_seek (GFileInputStream  *stream,
+                                  goffset            offset,
+                                  GSeekType          type,
+                                  GCancellable      *cancellable,
+                                  GError           **error)
+{
+  GtMemoryFileInputStream *self = GT_MEMORY_FILE_INPUT_STREAM (stream);
+  goffset size = (goffset) g_bytes_get_size (self->contents);
+  goffset new_position;
+
+  switch (type)
+    {
+    case G_SEEK_CUR:
+      new_position = (goffset) self->position + offset;
+      break;
+    case G_SEEK_SET:
+      new_position = offset;
+      break;
+    case G_SEEK_END:
+      new_position = size + offset;
+      break;
+    default:
+      g_assert_not_reached ();
+    }
+
+  if (new_position < 0 || new_position > size)
+    {
+      g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_INVALID_ARGUMENT,
+                           "Invalid seek request");
+      return FALSE;
+    }
+
+  self->position = (gsize) new_position;
+
+  return TRUE;
+}
+
+static void
+gt_memory_file_input_stream_finalize (GObject *object)
+{
+  GtMemoryFileInputStream *self = GT_MEMORY_FILE_INPUT_STREAM (object);
+
+  g_clear_pointer (&self->contents, g_bytes_unref);
+  g_clear_pointer (&self->path, g_free);
+  g_clear_pointer (&self->vfs, memory_vfs_unref);
+
+  G_OBJECT_CLASS (gt_memory_file_input_stream_parent_class)->finalize (object);
+}
+
+static void
+gt_memory_file_input_stream_class_init (GtMemoryFileInputStreamClass *klass)
+{
+  GObjectClass *object_class = G_OBJECT_CLASS (klass);
+  GInputStreamClass *input_stream_class = G_INPUT_STREAM_CLASS (klass);
+  GFileInputStreamClass *file_input_stream_class = G_FILE_INPUT_STREAM_CLASS (klass);
+
+  object_class->finalize = gt_memory_file_input_stream_finalize;
+
+  input_stream_class->read_fn = gt_memory_file_input_stream_read;
+  input_stream_class->read_async = gt_memory_file_input_stream_read_async;
+  input_stream_class->read_finish = gt_memory_file_input_stream_read_finish;
+  input_stream_class->close_fn = gt_memory_file_input_stream_close;
+
+  file_input_stream_class->tell = gt_memory_file_input_stream_tell;
+  file_input_stream_class->can_seek = gt_memory_file_input_stream_can_seek;
+  file_input_stream_class->seek = gt_memory_file_input_stream_seek;
+}
+
+static void
+gt_memory_file_input_stream_init (GtMemoryFileInputStream *self)
+{
+}
+
+/* GtMemoryFileEnumerator: an enumerator over a snapshot of the children of a
+ * directory in the tree. */
+#define GT_TYPE_MEMORY_FILE_ENUMERATOR gt_memory_file_enumerator_get_type ()
+G_DECLARE_FINAL_TYPE (GtMemoryFileEnumerator, gt_memory_file_enumerator, GT,
+                      MEMORY_FILE_ENUMERATOR, GFileEnumerator)
+
+struct _GtMemoryFileEnumerator
+{
+  GFileEnumerator parent;
+
+  GPtrArray *infos;  /* (owned) (element-type GFileInfo) */
+  guint next_index;
+};
+
+G_DEFINE_TYPE (GtMemoryFileEnumerator, gt_memory_file_enumerator,
+               G_TYPE_FILE_ENUMERATOR)
+
+static GFileInfo *
+gt_memory_file_enumerator_next_file (GFileEnumerator  *enumerator,
+                                     GCancellable     *cancellable,
+                                     GError          **error)
+{
+  GtMemoryFileEnumerator *self = GT_MEMORY_FILE_ENUMERATOR (enumerator);
+
+  if (g_cancellable_set_error_if_cancelled (cancellable, error))
+    return NULL;
+
+  if (self->next_index >= self->infos->len)
+    return NULL;
+
+  return g_object_ref (g_ptr_array_index (self->infos, self->next_index++));
+}
+
+static gboolean
+gt_memory_file_enumerator_close (GFileEnumerator  *enumerator,
+                                 GCancellable     *cancellable,
+                                 GError          **error)
+{
+  return TRUE;
+}
+
+static void
+gt_memory_file_enumerator_finalize (GObject *object)
+{
+  GtMemoryFileEnumerator *self = GT_MEMORY_FILE_ENUMERATOR (object);
+
+  g_clear_pointer (&self->infos, g_ptr_array_unref);
+
+  G_OBJECT_CLASS (gt_memory_file_enumerator_parent_class)->finalize (object);
+}
+
+static void
+gt_memory_file_enumerator_class_init (GtMemoryFileEnumeratorClass *klass)
+{
+  GObjectClass *object_class = G_OBJECT_CLASS (klass);
+  GFileEnumeratorClass *enumerator_class = G_FILE_ENUMERATOR_CLASS (klass);
+
+  object_class->finalize = gt_memory_file_enumerator_finalize;
+
+  enumerator_class->next_file = gt_memory_file_enumerator_next_file;
+  enumerator_class->close_fn = gt_memory_file_enumerator_close;
+}
+
+static void
+gt_memory_file_enumerator_init (GtMemoryFileEnumerator *self)
+{
+}
+
+/* GtMemoryFile: a #GFile for a path in the tree, which need not exist. */
+#define GT_TYPE_MEMORY_FILE gt_memory_file_get_type ()
+G_DECLARE_FINAL_TYPE (GtMemoryFile, gt_memory_file, GT, MEMORY_FILE, GObject)
+
+struct _GtMemoryFile
+{
+  GObject parent;
+
+  GtMemoryVfs *vfs;  /* (owned) */
+  gchar *path;  /* (owned); canonical */
+};
+
+static void gt_memory_file_file_iface_init (GFileIface *iface);
+
+G_DEFINE_TYPE_WITH_CODE (GtMemoryFile, gt_memory_file, G_TYPE_OBJECT,
+                         G_IMPLEMENT_INTERFACE (G_TYPE_FILE,
+                                                gt_memory_file_file_iface_init))
+
+/* @path must be canonical. */
+static GFile *
+memory_file_new (GtMemoryVfs *vfs,
+                 const gchar *path)
+{
+  GtMemoryFile *file = g_object_new (GT_TYPE_MEMORY_FILE, NULL);
+
+  file->vfs = memory_vfs_ref (vfs);
+  file->path = g_strdup (path);
+
+  return G_FILE (file);
+}
+
+static GFileInfo *
+memory_file_query_info_internal (GtMemoryFile  *self,
+                                 const gchar   *attributes,
+                                 GError       **error)
+{
+  g_autoptr(GFileAttributeMatcher) matcher = NULL;
+  const Node *node;
+  GFileInfo *info = NULL;
+
+  matcher = g_file_attribute_matcher_new (attributes);
+
+  g_mutex_lock (&self->vfs->lock);
+  node = g_hash_table_lookup (self->vfs->nodes, self->path);
+  if (node != NULL)
+    info = node_dup_file_info (node, self->path, matcher);
+  g_mutex_unlock (&self->vfs->lock);
+
+  if (info == NULL)
+    set_not_found_error (error, self->path);
+
+  return info;
+}
+
+static GFileEnumerator *
+memory_file_enumerate_children_internal (GtMemoryFile  *self,
+                                         const gchar   *attributes,
+                                         GError       **error)
+{
+  g_autoptr(GFileAttributeMatcher) matcher = NULL;
+  g_autoptr(GPtrArray) child_paths = g_ptr_array_new ();
+  g_autoptr(GPtrArray) infos = NULL;
+  const Node *node;
+  GtMemoryFileEnumerator *enumerator;
+  GHashTableIter iter;
+  gpointer key;
+
+  matcher = g_file_attribute_matcher_new (attributes);
+
+  g_mutex_lock (&self->vfs->lock);
+
+  node = g_hash_table_lookup (self->vfs->nodes, self->path);
+  if (node == NULL || !node->is_directory)
+    {
+      g_mutex_unlock (&self->vfs->lock);
+
+      if (node == NULL)
+        set_not_found_error (error, self->path);
+      else
+        g_set_error (error, G_IO_ERROR, G_IO_ERROR_NOT_DIRECTORY,
+                     "Not a directory: %s", self->path);
+
+      return NULL;
+    }
+
+  g_hash_table_iter_init (&iter, self->vfs->nodes);
+  while (g_hash_table_iter_next (&iter, &key, NULL))
+    {
+      g_autofree gchar *parent = path_dup_parent (key);
+
+      if (parent != NULL && g_str_equal (parent, self->path))
+        g_ptr_array_add (child_paths, key);
+    }
+
+  /* Enumerate children in a stable order. */
+  g_ptr_array_sort (child_paths, compare_strings);
+
+  infos = g_ptr_array_new_with_free_func (g_object_unref);
+  for (gsize i = 0; i < child_paths->len; i++)
+    {
+      const gchar *child_path = g_ptr_array_index (child_paths, i);
+      const Node *child = g_hash_table_lookup (self->vfs->nodes, child_path);
+
+      g_ptr_array_add (infos, node_dup_file_info (child, child_path, matcher));
+    }
+
+  g_mutex_unlock (&self->vfs->lock);
+
+  enumerator = g_object_new (GT_TYPE_MEMORY_FILE_ENUMERATOR,
+                             "container", self,
+                             NULL);
+  enumerator->infos = g_steal_pointer (&infos);
+
+  return G_FILE_ENUMERATOR (enumerator);
+}
+
+static GFileInputStream *
+memory_file_read_internal (GtMemoryFile  *self,
+                           GError       **error)
+{
+  const Node *node;
+  g_autoptr(GBytes) contents = NULL;
+  gboolean is_directory = FALSE;
+  GtMemoryFileInputStream *stream;
+
+  g_mutex_lock (&self->vfs->lock);
+  node = g_hash_table_lookup (self->vfs->nodes, self->path);
+  if (node != NULL && !node->is_directory)
+    contents = g_bytes_ref (node->contents);
+  else if (node != NULL)
+    is_directory = TRUE;
+  g_mutex_unlock (&self->vfs->lock);
+
+  if (is_directory)
+    {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_IS_DIRECTORY,
+                   "Is a directory: %s", self->path);
+      return NULL;
+    }
+  else if (contents == NULL)
+    {
+      set_not_found_error (error, self->path);
+      return NULL;
+    }
+
+  stream = g_object_new (GT_TYPE_MEMORY_FILE_INPUT_STREAM, NULL);
+  stream->vfs = memory_vfs_ref (self->vfs);
+  stream->path = g_strdup (self->path);
+  stream->contents = g_steal_pointer (&contents);
+
+  return G_FILE_INPUT_STREAM (stream);
+}
+
+static GFile *
+gt_memory_file_dup (GFile *file)
+{
+  GtMemoryFile *self = GT_MEMORY_FILE (file);
+
+  return memory_file_new (self->vfs, self->path);
+}
+
+static guint
+gt_memory_file_hash (GFile *file)
+{
+  GtMemoryFile *self = GT_MEMORY_FILE (file);
+
+  return g_str_hash (self->path);
+}
+
+static gboolean
+gt_memory_file_equal (GFile *file1,
+                      GFile *file2)
+{
+  GtMemoryFile *self1 = GT_MEMORY_FILE (file1);
+  GtMemoryFile *self2 = GT_MEMORY_FILE (file2);
+
+  return (self1->vfs == self2->vfs && g_str_equal (self1->path, self2->path));
+}
+
+static gboolean
+gt_memory_file_is_native (GFile *file)
+{
+  return FALSE;
+}
+
+static gboolean
+gt_memory_file_has_uri_scheme (GFile      *file,
+                               const char *uri_scheme)
+{
+  GtMemoryFile *self = GT_MEMORY_FILE (file);
+
+  return (g_ascii_strcasecmp (uri_scheme, self->vfs->scheme) == 0);
+}
+
+static char *
+gt_memory_file_get_uri_scheme (GFile *file)
+{
+  GtMemoryFile *self = GT_MEMORY_FILE (file);
+
+  return g_strdup (self->vfs->scheme);
+}
+
+static char *
+gt_memory_file_get_basename (GFile *file)
+{
+  GtMemoryFile *self = GT_MEMORY_FILE (file);
+
+  return g_strdup (path_get_basename (self->path));
+}
+
+static char *
+gt_memory_file_get_path (GFile *file)
+{
+  /* The files don’t exist on disk. */
+  return NULL;
+}
+
+static char *
+gt_memory_file_get_uri (GFile *file)
+{
+  GtMemoryFile *self = GT_MEMORY_FILE (file);
+  g_autofree gchar *escaped_path = NULL;
+
+  escaped_path = g_uri_escape_string (self->path,
+                                      G_URI_RESERVED_CHARS_ALLOWED_IN_PATH,
+                                      FALSE);
+
+  return g_strconcat (self->vfs->scheme, "://", escaped_path, NULL);
+}
+
+static GFile *
+gt_memory_file_get_parent (GFile *file)
+{
+  GtMemoryFile *self = GT_MEMORY_FILE (file);
+  g_autofree gchar *parent = path_dup_parent (self->path);
+
+  if (parent == NULL)
+    return NULL;
+
+  return memory_file_new (self->vfs, parent);
+}
+
+static gboolean
+gt_memory_file_prefix_matches (GFile *prefix,
+                               GFile *file)
+{
+  GtMemoryFile *prefix_self = GT_MEMORY_FILE (prefix);
+  GtMemoryFile *self = GT_MEMORY_FILE (file);
+  gsize prefix_len = strlen (prefix_self->path);
+
+  if (prefix_self->vfs != self->vfs ||
+      g_str_equal (prefix_self->path, self->path))
+    return FALSE;
+
+  if (g_str_equal (prefix_self->path, "/"))
+    return TRUE;
+
+  return (strncmp (self->path, prefix_self->path, prefix_len) == 0 &&
+          self->path[prefix_len] == '/');
+}
+
+static char *
+gt_memory_file_get_relative_path (GFile *parent,
+                                  GFile *descendant)
+{
+  GtMemoryFile *parent_self = GT_MEMORY_FILE (parent);
+  GtMemoryFile *self = GT_MEMORY_FILE (descendant);
+
+  if (!gt_memory_file_prefix_matches (parent, descendant))
+    return NULL;
+
+  if (g_str_equal (parent_self->path, "/"))
+    return g_strdup (self->path + 1);
+
+  return g_strdup (self->path + strlen (parent_self->path) + 1);
+}
+
+static GFile *
+gt_memory_file_resolve_relative_path (GFile      *file,
+                                      const char *relative_path)
+{
+  GtMemoryFile *self = GT_MEMORY_FILE (file);
+  g_autofree gchar *joined = NULL;
+  g_autofree gchar *path = NULL;
+
+  if (g_path_is_absolute (relative_path))
+    joined = g_strdup (relative_path);
+  else
+    joined = g_strconcat (self->path, "/", relative_path, NULL);
+
+  path = canonicalize_path (joined);
+
+  return memory_file_new (self->vfs, path);
+}
+
+static GFile *
+gt_memory_file_get_child_for_display_name (GFile       *file,
+                                           const char  *display_name,
+                                           GError     **error)
+{
+  if (strchr (display_name, '/') != NULL)
+    {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_FILENAME,
+                   "Invalid filename: %s", display_name);
+      return NULL;
+    }
+
+  return gt_memory_file_resolve_relative_path (file, display_name);
+}
+
+static GFileEnumerator *
+gt_memory_file_enumerate_children (GFile                *file,
+                                   const char           *attributes,
+                                   GFileQueryInfoFlags   flags,
+                                   GCancellable         *cancellable,
+                                   GError              **error)
+{
+  GtMemoryFile *self = GT_MEMORY_FILE (file);
+
+  start_sync_operation (self->vfs, GT_MEMORY_VFS_OPERATION_ENUMERATE,
+                        self->path);
+
+  if (g_cancellable_set_error_if_cancelled (cancellable, error))
+    return NULL;
+
+  return memory_file_enumerate_children_internal (self, attributes, error);
+}
+
+static gboolean
+enumerate_children_complete_cb (gpointer user_data)
+{
+  GTask *task = G_TASK (user_data);
+  GtMemoryFile *self = g_task_get_source_object (task);
+  const gchar *attributes = g_task_get_task_data (task);
+  GFileEnumerator *enumerator;
+  GError *local_error = NULL;
+
+  if (g_task_return_error_if_cancelled (task))
+    return G_SOURCE_REMOVE;
+
+  enumerator = memory_file_enumerate_children_internal (self, attributes,
+                                                        &local_error);
+  if (enumerator != NULL)
+    g_task_return_pointer (task, enumerator, g_object_unref);
+  else
+    g_task_return_error (task, local_error);
+
+  return G_SOURCE_REMOVE;
+}
+
+static void
+gt_memory_file_enumerate_children_async (GFile               *file,
+                                         const char          *attributes,
+                                         GFileQueryInfoFlags  flags,
+                                         int                  io_priority,
+                                         GCancellable        *cancellable,
+                                         GAsyncReadyCallback  callback,
+                                         gpointer             user_data)
+{
+  GtMemoryFile *self = GT_MEMORY_FILE (file);
+  g_autoptr(GTask) task = NULL;
+
+  task = g_task_new (file, cancellable, callback, user_data);
+  g_task_set_source_tag (task, gt_memory_file_enumerate_children_async);
+  g_task_set_priority (task, io_priority);
+  g_task_set_task_data (task, g_strdup (attributes), g_free);
+
+  start_async_operation (self->vfs, GT_MEMORY_VFS_OPERATION_ENUMERATE,
+                         self->path, task, enumerate_children_complete_cb);
+}
+
+static GFileEnumerator *
+gt_memory_file_enumerate_children_finish (GFile         *file,
+                                          GAsyncResult  *result,
+                                          GError       **error)
+{
+  g_return_val_if_fail (g_task_is_valid (result, file), NULL);
+
+  return g_task_propagate_pointer (G_TASK (result), error);
+}
+
+static GFileInfo *
+gt_memory_file_query_info (GFile                *file,
+                           const char           *attributes,
+                           GFileQueryInfoFlags   flags,
+                           GCancellable         *cancellable,
+                           GError              **error)
+{
+  GtMemoryFile *self = GT_MEMORY_FILE (file);
+
+  start_sync_operation (self->vfs, GT_MEMORY_VFS_OPERATION_QUERY_INFO,
+                        self->path);
+
+  if (g_cancellable_set_error_if_cancelled (cancellable, error))
+    return NULL;
+
+  return memory_file_query_info_internal (self, attributes, error);
+}
+
+static gboolean
+query_info_complete_cb (gpointer user_data)
+{
+  GTask *task = G_TASK (user_data);
+  GtMemoryFile *self = g_task_get_source_object (task);
+  const gchar *attributes = g_task_get_task_data (task);
+  GFileInfo *info;
+  GError *local_error = NULL;
+
+  if (g_task_return_error_if_cancelled (task))
+    return G_SOURCE_REMOVE;
+
+  info = memory_file_query_info_internal (self, attributes, &local_error);
+  if (info != NULL)
+    g_task_return_pointer (task, info, g_object_unref);
+  else
+    g_task_return_error (task, local_error);
+
+  return G_SOURCE_REMOVE;
+}
+
+static void
+gt_memory_file_query_info_async (GFile               *file,
+                                 const char          *attributes,
+                                 GFileQueryInfoFlags  flags,
+                                 int                  io_priority,
+                                 GCancellable        *cancellable,
+                                 GAsyncReadyCallback  callback,
+                                 gpointer             user_data)
+{
+  GtMemoryFile *self = GT_MEMORY_FILE (file);
+  g_autoptr(GTask) task = NULL;
+
+  task = g_task_new (file, cancellable, callback, user_data);
+  g_task_set_source_tag (task, gt_memory_file_query_info_async);
+  g_task_set_priority (task, io_priority);
+  g_task_set_task_data (task, g_strdup (attributes), g_free);
+
+  start_async_operation (self->vfs, GT_MEMORY_VFS_OPERATION_QUERY_INFO,
+                         self->path, task, query_info_complete_cb);
+}
+
+static GFileInfo *
+gt_memory_file_query_info_finish (GFile         *file,
+                                  GAsyncResult  *result,
+                                  GError       **error)
+{
+  g_return_val_if_fail (g_task_is_valid (result, file), NULL);
+
+  return g_task_propagate_pointer (G_TASK (result), error);
+}
+
+static GFileInputStream *
+gt_memory_file_read (GFile         *file,
+                     GCancellable  *cancellable,
+                     GError       **error)
+{
+  GtMemoryFile *self = GT_MEMORY_FILE (file);
+
+  start_sync_operation (self->vfs, GT_MEMORY_VFS_OPERATION_OPEN, self->path);
+
+  if (g_cancellable_set_error_if_cancelled (cancellable, error))
+    return NULL;
+
+  return memory_file_read_internal (self, error);
+}
+
+static gboolean
+read_file_complete_cb (gpointer user_data)
+{
+  GTask *task = G_TASK (user_data);
+  GtMemoryFile *self = g_task_get_source_object (task);
+  GFileInputStream *stream;
+  GError *local_error = NULL;
+
+  if (g_task_return_error_if_cancelled (task))
+    return G_SOURCE_REMOVE;
+
+  stream = memory_file_read_internal (self, &local_error);
+  if (stream != NULL)
+    g_task_return_pointer (task, stream, g_object_unref);
+  else
+    g_task_return_error (task, local_error);
+
+  return G_SOURCE_REMOVE;
+}
+
+static void
+gt_memory_file_read_async (GFile               *file,
+                           int                  io_priority,
+                           GCancellable        *cancellable,
+                           GAsyncReadyCallback  callback,
+                           gpointer             user_data)
+{
+  GtMemoryFile *self = GT_MEMORY_FILE (file);
+  g_autoptr(GTask) task = NULL;
+
+  task = g_task_new (file, cancellable, callback, user_data);
+  g_task_set_source_tag (task, gt_memory_file_read_async);
+  g_task_set_priority (task, io_priority);
+
+  start_async_operation (self->vfs, GT_MEMORY_VFS_OPERATION_OPEN, self->path,
+                         task, read_file_complete_cb);
+}
+
+static GFileInputStream *
+gt_memory_file_read_finish (GFile         *file,
+                            GAsyncResult  *result,
+                            GError       **error)
+{
+  g_return_val_if_fail (g_task_is_valid (result, file), NULL);
+
+  return g_task_propagate_pointer (G_TASK (result), error);
+}
+
+static void
+gt_memory_file_finalize (GObject *object)
+{
+  GtMemoryFile *self = GT_MEMORY_FILE (object);
+
+  g_clear_pointer (&self->path, g_free);
+  g_clear_pointer (&self->vfs, memory_vfs_unref);
+
+  G_OBJECT_CLASS (gt_memory_file_parent_class)->finalize (object);
+}
+
+static void
+gt_memory_file_class_init (GtMemoryFileClass *klass)
+{
+  GObjectClass *object_class = G_OBJECT_CLASS (klass);
+
+  object_class->finalize = gt_memory_file_finalize;
+}
+
+static void
+gt_memory_file_file_iface_init (GFileIface *iface)
+{
+  iface->dup = gt_memory_file_dup;
+  iface->hash = gt_memory_file_hash;
+  iface->equal = gt_memory_file_equal;
+  iface->is_native = gt_memory_file_is_native;
+  iface->has_uri_scheme = gt_memory_file_has_uri_scheme;
+  iface->get_uri_scheme = gt_memory_file_get_uri_scheme;
+  iface->get_basename = gt_memory_file_get_basename;
+  iface->get_path = gt_memory_file_get_path;
+  iface->get_uri = gt_memory_file_get_uri;
+  iface->get_parse_name = gt_memory_file_get_uri;
+  iface->get_parent = gt_memory_file_get_parent;
+  iface->prefix_matches = gt_memory_file_prefix_matches;
+  iface->get_relative_path = gt_memory_file_get_relative_path;
+  iface->resolve_relative_path = gt_memory_file_resolve_relative_path;
+  iface->get_child_for_display_name = gt_memory_file_get_child_for_display_name;
+  iface->enumerate_children = gt_memory_file_enumerate_children;
+  iface->enumerate_children_async = gt_memory_file_enumerate_children_async;
+  iface->enumerate_children_finish = gt_memory_file_enumerate_children_finish;
+  iface->query_info = gt_memory_file_query_info;
+  iface->query_info_async = gt_memory_file_query_info_async;
+  iface->query_info_finish = gt_memory_file_query_info_finish;
+  iface->read_fn = gt_memory_file_read;
+  iface->read_async = gt_memory_file_read_async;
+  iface->read_finish = gt_memory_file_read_finish;
+}
+
+static void
+gt_memory_file_init (GtMemoryFile *self)
+{
+}
+
+/* #GVfsFileLookupFunc for URIs and parse names using the scheme. */
+static GFile *
+lookup_uri_cb (GVfs       *vfs,
+               const char *identifier,
+               gpointer    user_data)
+{
+  GtMemoryVfs *self = user_data;
+  const gchar *rest;
+  g_autofree gchar *unescaped = NULL;
+  g_autofree gchar *path = NULL;
+
+  /* Skip the scheme and authority, if present. */
+  rest = strchr (identifier, ':');
+  rest = (rest != NULL) ? rest + 1 : identifier;
+
+  if (g_str_has_prefix (rest, "//"))
+    {
+      rest = strchr (rest + 2, '/');
+      if (rest == NULL)
+        rest = "/";
+    }
+
+  unescaped = g_uri_unescape_string (rest, NULL);
+  path = canonicalize_path ((unescaped != NULL) ? unescaped : rest);
+
+  return memory_file_new (self, path);
+}
+
+/**
+ * gt_memory_vfs_operation_get_name:
+ * @operation: a #GtMemoryVfsOperation
+ *
+ * Get a short name for @operation, such as `query-info`, for use in debug
+ * output.
+ *
+ * Returns: name of the operation
+ * Since: 0.2.0
+ */
+const gchar *
+gt_memory_vfs_operation_get_name (GtMemoryVfsOperation operation)
+{
+  switch (operation)
+    {
+    case GT_MEMORY_VFS_OPERATION_OPEN:
+      return "open";
+    case GT_MEMORY_VFS_OPERATION_READ:
+      return "read";
+    case GT_MEMORY_VFS_OPERATION_QUERY_INFO:
+      return "query-info";
+    case GT_MEMORY_VFS_OPERATION_ENUMERATE:
+      return "enumerate";
+    default:
+      g_return_val_if_reached (NULL);
+    }
+}
+
+/**
+ * gt_memory_vfs_new:
+ * @scheme: URI scheme to register, such as `test`
+ *
+ * Create a new, empty #GtMemoryVfs, and register @scheme with the default
+ * #GVfs so that URIs using it refer to files in the #GtMemoryVfs. The tree
+ * contains only the root directory, `/`.
+ *
+ * @scheme must not already be registered, including by another #GtMemoryVfs.
+ *
+ * Returns: (transfer full): a new #GtMemoryVfs
+ * Since: 0.2.0
+ */
+GtMemoryVfs *
+gt_memory_vfs_new (const gchar *scheme)
+{
+  GtMemoryVfs *self = NULL;
+  Node *root;
+
+  g_return_val_if_fail (scheme != NULL && *scheme != '\0', NULL);
+
+  self = g_new0 (GtMemoryVfs, 1);
+  self->ref_count = 1;
+  self->scheme = g_strdup (scheme);
+  g_mutex_init (&self->lock);
+  self->nodes = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                       g_free, (GDestroyNotify) node_free);
+  self->counts = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+
+  root = g_new0 (Node, 1);
+  root->is_directory = TRUE;
+  g_hash_table_insert (self->nodes, g_strdup ("/"), root);
+
+  self->registered = g_vfs_register_uri_scheme (g_vfs_get_default (), scheme,
+                                                lookup_uri_cb, self, NULL,
+                                                lookup_uri_cb, self, NULL);
+  if (!self->registered)
+    g_critical ("%s: Failed to register URI scheme ‘%s’; it may already be "
+                "registered", G_STRFUNC, scheme);
+
+  return self;
+}
+
+/**
+ * gt_memory_vfs_free:
+ * @self: (transfer full): a #GtMemoryVfs
+ *
+ * Free a #GtMemoryVfs, unregistering its URI scheme. Any #GFiles from it which
+ * are still alive keep the tree alive, and can still be used.
+ *
+ * Since: 0.2.0
+ */
+void
+gt_memory_vfs_free (GtMemoryVfs *self)
+{
+  g_return_if_fail (self != NULL);
+
+  if (self->registered)
+    g_vfs_unregister_uri_scheme (g_vfs_get_default (), self->scheme);
+  self->registered = FALSE;
+
+  memory_vfs_unref (self);
+}
+
+/**
+ * gt_memory_vfs_get_scheme:
+ * @self: a #GtMemoryVfs
+ *
+ * Get the URI scheme registered for @self.
+ *
+ * Returns: the URI scheme
+ * Since: 0.2.0
+ */
+const gchar *
+gt_memory_vfs_get_scheme (GtMemoryVfs *self)
+{
+  g_return_val_if_fail (self != NULL, NULL);
+
+  return self->scheme;
+}
+
+/**
+ * gt_memory_vfs_get_file:
+ * @self: a #GtMemoryVfs
+ * @path: absolute path of the file in the tree, such as `/dir/file`
+ *
+ * Get a #GFile for @path in @self. The file need not exist. This is
+ * equivalent to calling g_file_new_for_uri() with the URI for @path.
+ *
+ * Returns: (transfer full): a #GFile for @path
+ * Since: 0.2.0
+ */
+GFile *
+gt_memory_vfs_get_file (GtMemoryVfs *self,
+                        const gchar *path)
+{
+  g_autofree gchar *canonical_path = NULL;
+
+  g_return_val_if_fail (self != NULL, NULL);
+  g_return_val_if_fail (path != NULL, NULL);
+
+  canonical_path = canonicalize_path (path);
+
+  return memory_file_new (self, canonical_path);
+}
+
+/* Add a node at canonical @path, creating its parent directories if needed.
+ * Takes ownership of @node. Must be called with the lock held. */
+static void
+add_node_locked (GtMemoryVfs *self,
+                 const gchar *path,
+                 Node        *node)
+{
+  g_autofree gchar *parent = path_dup_parent (path);
+
+  /* The root always exists. */
+  if (parent == NULL)
+    {
+      node_free (node);
+      return;
+    }
+
+  while (parent != NULL)
+    {
+      const Node *parent_node = g_hash_table_lookup (self->nodes, parent);
+      gchar *grandparent;
+
+      if (parent_node != NULL && parent_node->is_directory)
+        break;
+      else if (parent_node != NULL)
+        g_critical ("%s: Replacing file ‘%s’ with a directory", G_STRFUNC,
+                    parent);
+
+      Node *parent_dir = g_new0 (Node, 1);
+      parent_dir->is_directory = TRUE;
+      g_hash_table_insert (self->nodes, g_strdup (parent), parent_dir);
+
+      grandparent = path_dup_parent (parent);
+      g_free (parent);
+      parent = grandparent;
+    }
+
+  g_hash_table_insert (self->nodes, g_strdup (path), node);
+}
+
+/**
+ * gt_memory_vfs_add_file:
+ * @self: a #GtMemoryVfs
+ * @path: absolute path of the file in the tree
+ * @contents: contents of the file
+ *
+ * Add a file at @path in @self, with the given @contents, replacing any
+ * existing file there. Parent directories are created as needed.
+ *
+ * This does not count as an operation.
+ *
+ * Since: 0.2.0
+ */
+void
+gt_memory_vfs_add_file (GtMemoryVfs *self,
+                        const gchar *path,
+                        GBytes      *contents)
+{
+  g_autofree gchar *canonical_path = NULL;
+  Node *node;
+
+  g_return_if_fail (self != NULL);
+  g_return_if_fail (path != NULL);
+  g_return_if_fail (contents != NULL);
+
+  canonical_path = canonicalize_path (path);
+
+  node = g_new0 (Node, 1);
+  node->is_directory = FALSE;
+  node->contents = g_bytes_ref (contents);
+
+  g_mutex_lock (&self->lock);
+  add_node_locked (self, canonical_path, node);
+  g_mutex_unlock (&self->lock);
+}
+
+/**
+ * gt_memory_vfs_add_directory:
+ * @self: a #GtMemoryVfs
+ * @path: absolute path of the directory in the tree
+ *
+ * Add an empty directory at @path in @self, if one doesn’t already exist.
+ * Parent directories are created as needed.
+ *
+ * This does not count as an operation.
+ *
+ * Since: 0.2.0
+ */
+void
+gt_memory_vfs_add_directory (GtMemoryVfs *self,
+                             const gchar *path)
+{
+  g_autofree gchar *canonical_path = NULL;
+  const Node *existing;
+
+  g_return_if_fail (self != NULL);
+  g_return_if_fail (path != NULL);
+
+  canonical_path = canonicalize_path (path);
+
+  g_mutex_lock (&self->lock);
+
+  existing = g_hash_table_lookup (self->nodes, canonical_path);
+  if (existing == NULL || !existing->is_directory)
+    {
+      Node *node = g_new0 (Node, 1);
+      node->is_directory = TRUE;
+      add_node_locked (self, canonical_path, node);
+    }
+
+  g_mutex_unlock (&self->lock);
+}
+
+/**
+ * gt_memory_vfs_remove:
+ * @self: a #GtMemoryVfs
+ * @path: absolute path of the file or directory to remove
+ *
+ * Remove the file or directory at @path in @self, including all the contents
+ * of the directory. The root directory can’t be removed.
+ *
+ * This does not count as an operation.
+ *
+ * Returns: %TRUE if @path existed, %FALSE otherwise
+ * Since: 0.2.0
+ */
+gboolean
+gt_memory_vfs_remove (GtMemoryVfs *self,
+                      const gchar *path)
+{
+  g_autofree gchar *canonical_path = NULL;
+  g_autofree gchar *prefix = NULL;
+  GHashTableIter iter;
+  gpointer key;
+  gboolean removed;
+
+  g_return_val_if_fail (self != NULL, FALSE);
+  g_return_val_if_fail (path != NULL, FALSE);
+
+  canonical_path = canonicalize_path (path);
+  g_return_val_if_fail (!g_str_equal (canonical_path, "/"), FALSE);
+
+  prefix = g_strconcat (canonical_path, "/", NULL);
+
+  g_mutex_lock (&self->lock);
+
+  removed = g_hash_table_remove (self->nodes, canonical_path);
+
+  g_hash_table_iter_init (&iter, self->nodes);
+  while (g_hash_table_iter_next (&iter, &key, NULL))
+    {
+      if (g_str_has_prefix (key, prefix))
+        g_hash_table_iter_remove (&iter);
+    }
+
+  g_mutex_unlock (&self->lock);
+
+  return removed;
+}
+
+/**
+ * gt_memory_vfs_set_latency:
+ * @self: a #GtMemoryVfs
+ * @operation: operation to set the latency for
+ * @latency_ms: latency to inject, in milliseconds, or 0 for none
+ *
+ * Set the latency to inject into each future @operation on @self. Asynchronous
+ * operations complete from a timeout source on the caller’s thread-default
+ * main context once the latency has passed; synchronous operations block the
+ * calling thread for the latency. The default is no latency.
+ *
+ * Since: 0.2.0
+ */
+void
+gt_memory_vfs_set_latency (GtMemoryVfs          *self,
+                           GtMemoryVfsOperation  operation,
+                           guint                 latency_ms)
+{
+  g_return_if_fail (self != NULL);
+  g_return_if_fail ((guint) operation <= GT_MEMORY_VFS_OPERATION_LAST);
+
+  g_mutex_lock (&self->lock);
+  self->latency_ms[operation] = latency_ms;
+  g_mutex_unlock (&self->lock);
+}
+
+/**
+ * gt_memory_vfs_get_n_operations:
+ * @self: a #GtMemoryVfs
+ * @operation: operation to get the count for
+ * @path: (nullable): absolute path to get the count for, or %NULL to get the
+ *    total for all paths
+ *
+ * Get the number of times @operation has been performed on @path (whether or
+ * not it succeeded) since @self was created, or since
+ * gt_memory_vfs_reset_counts() was last called.
+ *
+ * Returns: number of operations
+ * Since: 0.2.0
+ */
+guint
+gt_memory_vfs_get_n_operations (GtMemoryVfs          *self,
+                                GtMemoryVfsOperation  operation,
+                                const gchar          *path)
+{
+  guint n_operations = 0;
+
+  g_return_val_if_fail (self != NULL, 0);
+  g_return_val_if_fail ((guint) operation <= GT_MEMORY_VFS_OPERATION_LAST, 0);
+
+  if (path != NULL)
+    {
+      g_autofree gchar *canonical_path = canonicalize_path (path);
+      const OperationCounts *counts;
+
+      g_mutex_lock (&self->lock);
+      counts = g_hash_table_lookup (self->counts, canonical_path);
+      if (counts != NULL)
+        n_operations = counts->n_operations[operation];
+      g_mutex_unlock (&self->lock);
+    }
+  else
+    {
+      GHashTableIter iter;
+      gpointer value;
+
+      g_mutex_lock (&self->lock);
+      g_hash_table_iter_init (&iter, self->counts);
+      while (g_hash_table_iter_next (&iter, NULL, &value))
+        {
+          const OperationCounts *counts = value;
+          n_operations += counts->n_operations[operation];
+        }
+      g_mutex_unlock (&self->lock);
+    }
+
+  return n_operations;
+}
+
+/**
+ * gt_memory_vfs_get_n_operations_total:
+ * @self: a #GtMemoryVfs
+ *
+ * Get the total number of operations of all types performed on all paths in
+ * @self since it was created, or since gt_memory_vfs_reset_counts() was last
+ * called.
+ *
+ * Returns: number of operations
+ * Since: 0.2.0
+ */
+guint
+gt_memory_vfs_get_n_operations_total (GtMemoryVfs *self)
+{
+  guint n_operations = 0;
+
+  g_return_val_if_fail (self != NULL, 0);
+
+  for (gsize i = 0; i < N_OPERATIONS; i++)
+    n_operations += gt_memory_vfs_get_n_operations (self,
+                                                    (GtMemoryVfsOperation) i,
+                                                    NULL);
+
+  return n_operations;
+}
+
+/**
+ * gt_memory_vfs_reset_counts:
+ * @self: a #GtMemoryVfs
+ *
+ * Reset the operation counts for all paths to zero, so that the operations
+ * performed by a particular piece of code can be checked.
+ *
+ * Since: 0.2.0
+ */
+void
+gt_memory_vfs_reset_counts (GtMemoryVfs *self)
+{
+  g_return_if_fail (self != NULL);
+
+  g_mutex_lock (&self->lock);
+  g_hash_table_remove_all (self->counts);
+  g_mutex_unlock (&self->lock);
+}
+
+/**
+ * gt_memory_vfs_format_operations:
+ * @self: a #GtMemoryVfs
+ *
+ * Format the operation counts for every path which has had operations
+ * performed on it, in alphabetical order, for use in debug output.
+ *
+ * Returns: (transfer full): human readable list of operation counts
+ * Since: 0.2.0
+ */
+gchar *
+gt_memory_vfs_format_operations (GtMemoryVfs *self)
+{
+  g_autoptr(GString) str = g_string_new ("");
+  g_autoptr(GPtrArray) sorted_paths = g_ptr_array_new ();
+  GHashTableIter iter;
+  gpointer key;
+
+  g_return_val_if_fail (self != NULL, NULL);
+
+  g_mutex_lock (&self->lock);
+
+  g_hash_table_iter_init (&iter, self->counts);
+  while (g_hash_table_iter_next (&iter, &key, NULL))
+    g_ptr_array_add (sorted_paths, key);
+  g_ptr_array_sort (sorted_paths, compare_strings);
+
+  for (gsize i = 0; i < sorted_paths->len; i++)
+    {
+      const gchar *path = g_ptr_array_index (sorted_paths, i);
+      const OperationCounts *counts = g_hash_table_lookup (self->counts, path);
+      const gchar *separator = "";
+
+      g_string_append_printf (str, " • %s:", path);
+
+      for (gsize j = 0; j < N_OPERATIONS; j++)
+        {
+          if (counts->n_operations[j] == 0)
+            continue;
+
+          g_string_append_printf (str, "%s %s ×%u", separator,
+                                  gt_memory_vfs_operation_get_name ((GtMemoryVfsOperation) j),
+                                  counts->n_operations[j]);
+          separator = ",";
+        }
+
+      g_string_append_c (str, '\n');
+    }
+
+  g_mutex_unlock (&self->lock);
+
+  return g_string_free (g_steal_pointer (&str), FALSE);
+}
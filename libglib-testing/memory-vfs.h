@@ -0,0 +1,157 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ *
+ * Copyright © 2018 Endless Mobile, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#pragma once
+
+#include <gio/gio.h>
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/**
+ * GtMemoryVfsOperation:
+ * @GT_MEMORY_VFS_OPERATION_OPEN: opening a file for reading, using
+ *    g_file_read() or g_file_read_async()
+ * @GT_MEMORY_VFS_OPERATION_READ: reading from a file’s input stream, using
+ *    g_input_stream_read() or g_input_stream_read_async() (or functions built
+ *    on them)
+ * @GT_MEMORY_VFS_OPERATION_QUERY_INFO: querying information about a file,
+ *    using g_file_query_info() or g_file_query_info_async() (or functions built
+ *    on them, such as g_file_query_exists())
+ * @GT_MEMORY_VFS_OPERATION_ENUMERATE: enumerating the children of a directory,
+ *    using g_file_enumerate_children() or g_file_enumerate_children_async()
+ *
+ * An I/O operation which is counted, and can be delayed, by #GtMemoryVfs.
+ *
+ * Since: 0.2.0
+ */
+typedef enum
+{
+  GT_MEMORY_VFS_OPERATION_OPEN,
+  GT_MEMORY_VFS_OPERATION_READ,
+  GT_MEMORY_VFS_OPERATION_QUERY_INFO,
+  GT_MEMORY_VFS_OPERATION_ENUMERATE,
+} GtMemoryVfsOperation;
+
+/**
+ * GT_MEMORY_VFS_OPERATION_LAST:
+ *
+ * The last valid #GtMemoryVfsOperation, for iterating over all of them.
+ *
+ * Since: 0.2.0
+ */
+#define GT_MEMORY_VFS_OPERATION_LAST GT_MEMORY_VFS_OPERATION_ENUMERATE
+
+const gchar *gt_memory_vfs_operation_get_name (GtMemoryVfsOperation operation);
+
+typedef struct _GtMemoryVfs GtMemoryVfs;
+
+GtMemoryVfs *gt_memory_vfs_new  (const gchar *scheme);
+void         gt_memory_vfs_free (GtMemoryVfs *self);
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC (GtMemoryVfs, gt_memory_vfs_free)
+
+const gchar *gt_memory_vfs_get_scheme             (GtMemoryVfs          *self);
+GFile       *gt_memory_vfs_get_file               (GtMemoryVfs          *self,
+                                                   const gchar          *path);
+
+void         gt_memory_vfs_add_file               (GtMemoryVfs          *self,
+                                                   const gchar          *path,
+                                                   GBytes               *contents);
+void         gt_memory_vfs_add_directory          (GtMemoryVfs          *self,
+                                                   const gchar          *path);
+gboolean     gt_memory_vfs_remove                 (GtMemoryVfs          *self,
+                                                   const gchar          *path);
+
+void         gt_memory_vfs_set_latency            (GtMemoryVfs          *self,
+                                                   GtMemoryVfsOperation  operation,
+                                                   guint                 latency_ms);
+
+guint        gt_memory_vfs_get_n_operations       (GtMemoryVfs          *self,
+                                                   GtMemoryVfsOperation  operation,
+                                                   const gchar          *path);
+guint        gt_memory_vfs_get_n_operations_total (GtMemoryVfs          *self);
+void         gt_memory_vfs_reset_counts           (GtMemoryVfs          *self);
+gchar       *gt_memory_vfs_format_operations      (GtMemoryVfs          *self);
+
+/**
+ * gt_memory_vfs_assert_no_operations:
+ * @self: a #GtMemoryVfs
+ *
+ * Assert that no operations have been performed on any of the files in @self
+ * since it was created, or since gt_memory_vfs_reset_counts() was last called.
+ *
+ * If any have, an assertion fails and the operation counts for each path are
+ * printed, using gt_memory_vfs_format_operations().
+ *
+ * Since: 0.2.0
+ */
+#define gt_memory_vfs_assert_no_operations(self) \
+  G_STMT_START { \
+    guint ano_n_operations = gt_memory_vfs_get_n_operations_total (self); \
+    if (ano_n_operations > 0) \
+      { \
+        g_autofree gchar *ano_list = gt_memory_vfs_format_operations (self); \
+        g_autofree gchar *ano_message = \
+            g_strdup_printf ("Expected no I/O operations, but saw %u:\n%s", \
+                             ano_n_operations, ano_list); \
+        g_assertion_message (G_LOG_DOMAIN, __FILE__, __LINE__, G_STRFUNC, \
+                             ano_message); \
+      } \
+  } G_STMT_END
+
+/**
+ * gt_memory_vfs_assert_n_operations_at_most:
+ * @self: a #GtMemoryVfs
+ * @operation: a #GtMemoryVfsOperation
+ * @path: (nullable): path to check the count for, or %NULL to check the total
+ *    for all paths
+ * @max_operations: maximum number of operations allowed
+ *
+ * Assert that @operation has been performed on @path (or on all paths, if
+ * @path is %NULL) at most @max_operations times since @self was created, or
+ * since gt_memory_vfs_reset_counts() was last called.
+ *
+ * If it has been performed more often, an assertion fails and the operation
+ * counts for each path are printed, using gt_memory_vfs_format_operations().
+ *
+ * Since: 0.2.0
+ */
+#define gt_memory_vfs_assert_n_operations_at_most(self, operation, path, max_operations) \
+  G_STMT_START { \
+    guint anoam_n_operations = \
+        gt_memory_vfs_get_n_operations (self, operation, path); \
+    if (anoam_n_operations > (guint) (max_operations)) \
+      { \
+        const gchar *anoam_path = (path); \
+        g_autofree gchar *anoam_list = gt_memory_vfs_format_operations (self); \
+        g_autofree gchar *anoam_message = \
+            g_strdup_printf ("Expected at most %u %s operations on %s, but " \
+                             "saw %u:\n%s", \
+                             (guint) (max_operations), \
+                             gt_memory_vfs_operation_get_name (operation), \
+                             (anoam_path != NULL) ? anoam_path : "all paths", \
+                             anoam_n_operations, anoam_list); \
+        g_assertion_message (G_LOG_DOMAIN, __FILE__, __LINE__, G_STRFUNC, \
+                             anoam_message); \
+      } \
+  } G_STMT_END
+
+G_END_DECLS
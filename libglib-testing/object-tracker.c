@@ -0,0 +1,736 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ *
+ * Copyright © 2018 Endless Mobile, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#include "config.h"
+
+#include <glib.h>
+#include <glib-object.h>
+#include <libglib-testing/object-tracker.h>
+#include <libglib-testing/object-tracker-private.h>
+
+
+/**
+ * SECTION:object-tracker
+ * @short_description: GObject leak and lifetime tracker
+ * @stability: Unstable
+ * @include: libglib-testing/object-tracker.h
+ *
+ * #GtObjectTracker records the creation and finalization of instances of
+ * selected #GObject types (and their subtypes), or of all #GObjects, during a
+ * test. It can report how many instances of each type are still alive, the
+ * peak number which were alive at once, and which instances have been alive
+ * for longest. This is useful for finding #GObject leaks, which are a common
+ * cause of memory growth in long-running processes.
+ *
+ * Select the types to track using gt_object_tracker_track_type() or
+ * gt_object_tracker_track_all(). Only instances created after that are
+ * tracked. At the end of the test, use gt_object_tracker_assert_no_leaks() to
+ * check they have all been finalized, or gt_object_tracker_format() to print a
+ * report.
+ *
+ * Instance creation is detected by hooking the #GObjectClass.constructed
+ * virtual method of the tracked types and any of their subtypes whose classes
+ * already exist (subtypes created later inherit the hook). The hook is left
+ * installed once the tracker is freed, but does very little when no tracker
+ * is active. Finalization is detected using weak references.
+ *
+ * Objects may be created and finalized in any thread while they are being
+ * tracked, but must not be finalized concurrently with a call to
+ * gt_object_tracker_free().
+ *
+ * Since: 0.2.0
+ */
+
+/* Maximum number of live instances to list per type in
+ * gt_object_tracker_format(). */
+#define MAX_FORMATTED_INSTANCES 5
+
+typedef struct _TypeStats TypeStats;
+
+/* A live instance which is being tracked. */
+typedef struct
+{
+  TypeStats *stats;  /* (unowned) */
+  GObject *obj;  /* (unowned) */
+  gint64 creation_time;  /* monotonic, in microseconds */
+} TrackedInstance;
+
+/* Statistics for instances of exactly @type. */
+struct _TypeStats
+{
+  GType type;
+  guint n_created;
+  guint n_finalized;
+  guint peak_n_live;
+  GHashTable *live;  /* (element-type GObject TrackedInstance) (owned) */
+};
+
+/**
+ * GtObjectTracker:
+ *
+ * A tracker for the lifetimes of #GObject instances.
+ *
+ * Since: 0.2.0
+ */
+struct _GtObjectTracker
+{
+  /* All members are protected by @trackers_lock. */
+  GArray *types;  /* (element-type GType) (owned) */
+  GHashTable *stats;  /* (element-type GType TypeStats) (owned) */
+  GtObjectTrackerCreatedFunc created_func;  /* (nullable) */
+  gpointer created_data;  /* (unowned) (nullable) */
+};
+
+/* A pending call to a tracker’s #GtObjectTrackerCreatedFunc. */
+typedef struct
+{
+  GtObjectTrackerCreatedFunc func;
+  gpointer user_data;  /* (unowned) (nullable) */
+} CreatedNotify;
+
+/* Global state for the #GObjectClass.constructed hook. @trackers_lock protects
+ * all #GtObjectTrackers, as weak notify callbacks can be called from any
+ * thread. */
+static GMutex trackers_lock;
+static GPtrArray *trackers = NULL;  /* (element-type GtObjectTracker) (unowned) (nullable) */
+/* Original #GObjectClass.constructed implementations of each hooked class. */
+static GHashTable *original_constructed = NULL;  /* (element-type GType funcptr) (owned) (nullable) */
+
+typedef void (*ConstructedFunc) (GObject *obj);
+
+/* Quark for the type whose #GObjectClass.constructed implementation is
+ * currently being run for an object, while its hooked constructed chain is in
+ * progress. */
+static GQuark
+constructed_level_quark (void)
+{
+  static GQuark quark = 0;
+
+  if (G_UNLIKELY (quark == 0))
+    quark = g_quark_from_static_string ("gt-object-tracker-constructed-level");
+
+  return quark;
+}
+
+static void
+type_stats_free (TypeStats *stats)
+{
+  g_hash_table_unref (stats->live);
+  g_free (stats);
+}
+
+static void instance_finalized_cb (gpointer  user_data,
+                                   GObject  *where_the_object_was);
+
+/* Start tracking @obj in @self if it’s of a tracked type, and return the new
+ * #TrackedInstance. The caller must add a weak ref to @obj for it, once
+ * @trackers_lock is no longer held (as weak notify callbacks take it).
+ *
+ * Must be called with @trackers_lock held. */
+static TrackedInstance *
+gt_object_tracker_add_instance_locked (GtObjectTracker *self,
+                                       GObject         *obj)
+{
+  GType type = G_OBJECT_TYPE (obj);
+  gboolean tracked = FALSE;
+  TypeStats *stats;
+  TrackedInstance *instance;
+
+  for (gsize i = 0; i < self->types->len && !tracked; i++)
+    tracked = g_type_is_a (type, g_array_index (self->types, GType, i));
+
+  if (!tracked)
+    return NULL;
+
+  stats = g_hash_table_lookup (self->stats, GSIZE_TO_POINTER (type));
+  if (stats == NULL)
+    {
+      stats = g_new0 (TypeStats, 1);
+      stats->type = type;
+      stats->live = g_hash_table_new_full (NULL, NULL, NULL, g_free);
+      g_hash_table_insert (self->stats, GSIZE_TO_POINTER (type), stats);
+    }
+
+  instance = g_new0 (TrackedInstance, 1);
+  instance->stats = stats;
+  instance->obj = obj;
+  instance->creation_time = g_get_monotonic_time ();
+
+  g_hash_table_insert (stats->live, obj, instance);
+
+  stats->n_created++;
+  stats->peak_n_live = MAX (stats->peak_n_live, g_hash_table_size (stats->live));
+
+  return instance;
+}
+
+static void
+instance_finalized_cb (gpointer  user_data,
+                       GObject  *where_the_object_was)
+{
+  TrackedInstance *instance = user_data;
+  TypeStats *stats;
+
+  g_mutex_lock (&trackers_lock);
+  stats = instance->stats;
+  stats->n_finalized++;
+  g_hash_table_remove (stats->live, where_the_object_was);
+  g_mutex_unlock (&trackers_lock);
+}
+
+/* The hooked #GObjectClass.constructed implementation. Objects chain up
+ * through their class hierarchy’s constructed implementations; each time this
+ * is called for an object, it finds the next hooked class up the hierarchy
+ * from the last one it ran, and calls that class’ original implementation.
+ * Classes which inherited the hook (rather than having it installed) are
+ * skipped. Once the outermost call has returned, the object is fully
+ * constructed, so is recorded by the active trackers. */
+static void
+hooked_constructed (GObject *obj)
+{
+  GQuark quark = constructed_level_quark ();
+  GType level = GPOINTER_TO_SIZE (g_object_get_qdata (obj, quark));
+  gboolean outermost = (level == 0);
+  GType type;
+  ConstructedFunc original = NULL;
+
+  g_mutex_lock (&trackers_lock);
+
+  for (type = outermost ? G_OBJECT_TYPE (obj) : g_type_parent (level);
+       type != 0;
+       type = g_type_parent (type))
+    {
+      const GObjectClass *klass = g_type_class_peek (type);
+
+      if (klass->constructed == hooked_constructed &&
+          (original = g_hash_table_lookup (original_constructed,
+                                           GSIZE_TO_POINTER (type))) != NULL)
+        break;
+    }
+
+  g_mutex_unlock (&trackers_lock);
+
+  /* #GObject itself is always hooked before any of its subtypes. */
+  g_assert (original != NULL);
+
+  g_object_set_qdata (obj, quark, GSIZE_TO_POINTER (type));
+  original (obj);
+
+  if (outermost)
+    {
+      g_autoptr(GPtrArray) instances = NULL;
+      g_autoptr(GArray) notifies = NULL;
+
+      g_object_set_qdata (obj, quark, NULL);
+
+      g_mutex_lock (&trackers_lock);
+      for (gsize i = 0; trackers != NULL && i < trackers->len; i++)
+        {
+          GtObjectTracker *tracker = g_ptr_array_index (trackers, i);
+          TrackedInstance *instance =
+              gt_object_tracker_add_instance_locked (tracker, obj);
+
+          if (instance == NULL)
+            continue;
+          if (instances == NULL)
+            instances = g_ptr_array_new ();
+          g_ptr_array_add (instances, instance);
+
+          if (tracker->created_func != NULL)
+            {
+              CreatedNotify notify = { tracker->created_func, tracker->created_data };
+
+              if (notifies == NULL)
+                notifies = g_array_new (FALSE, FALSE, sizeof (CreatedNotify));
+              g_array_append_val (notifies, notify);
+            }
+        }
+      g_mutex_unlock (&trackers_lock);
+
+      for (gsize i = 0; instances != NULL && i < instances->len; i++)
+        g_object_weak_ref (obj, instance_finalized_cb, g_ptr_array_index (instances, i));
+
+      for (gsize i = 0; notifies != NULL && i < notifies->len; i++)
+        {
+          const CreatedNotify *notify = &g_array_index (notifies, CreatedNotify, i);
+          notify->func (obj, notify->user_data);
+        }
+    }
+}
+
+/* Install the constructed hook on @type, and recursively on any of its
+ * subtypes whose classes have already been initialised.
+ *
+ * Must be called with @trackers_lock held. */
+static void
+install_hook_locked (GType type)
+{
+  GObjectClass *klass = g_type_class_peek (type);
+  g_autofree GType *children = NULL;
+  guint n_children = 0;
+
+  /* Classes which are initialised later will inherit the hook. */
+  if (klass == NULL)
+    return;
+
+  if (klass->constructed != hooked_constructed)
+    {
+      g_hash_table_insert (original_constructed, GSIZE_TO_POINTER (type),
+                           (gpointer) klass->constructed);
+      klass->constructed = hooked_constructed;
+    }
+
+  children = g_type_children (type, &n_children);
+  for (guint i = 0; i < n_children; i++)
+    install_hook_locked (children[i]);
+}
+
+/**
+ * gt_object_tracker_new:
+ *
+ * Create a new #GtObjectTracker. It does not track any types until
+ * gt_object_tracker_track_type() or gt_object_tracker_track_all() is called.
+ *
+ * Returns: (transfer full): a new #GtObjectTracker
+ * Since: 0.2.0
+ */
+GtObjectTracker *
+gt_object_tracker_new (void)
+{
+  g_autoptr(GtObjectTracker) self = g_new0 (GtObjectTracker, 1);
+
+  self->types = g_array_new (FALSE, FALSE, sizeof (GType));
+  self->stats = g_hash_table_new_full (NULL, NULL, NULL,
+                                       (GDestroyNotify) type_stats_free);
+
+  g_mutex_lock (&trackers_lock);
+  if (trackers == NULL)
+    trackers = g_ptr_array_new ();
+  g_ptr_array_add (trackers, self);
+  g_mutex_unlock (&trackers_lock);
+
+  return g_steal_pointer (&self);
+}
+
+/**
+ * gt_object_tracker_free:
+ * @self: (transfer full): a #GtObjectTracker
+ *
+ * Free a #GtObjectTracker. Any objects which are still alive stop being
+ * tracked.
+ *
+ * Since: 0.2.0
+ */
+void
+gt_object_tracker_free (GtObjectTracker *self)
+{
+  GHashTableIter iter;
+  TypeStats *stats;
+
+  g_return_if_fail (self != NULL);
+
+  g_mutex_lock (&trackers_lock);
+  g_ptr_array_remove_fast (trackers, self);
+  if (trackers->len == 0)
+    g_clear_pointer (&trackers, g_ptr_array_unref);
+  g_mutex_unlock (&trackers_lock);
+
+  /* No new instances can be added now. Remove the weak refs without holding
+   * the lock, as weak notify callbacks take it. */
+  g_hash_table_iter_init (&iter, self->stats);
+  while (g_hash_table_iter_next (&iter, NULL, (gpointer *) &stats))
+    {
+      GHashTableIter live_iter;
+      TrackedInstance *instance;
+
+      g_hash_table_iter_init (&live_iter, stats->live);
+      while (g_hash_table_iter_next (&live_iter, NULL, (gpointer *) &instance))
+        g_object_weak_unref (instance->obj, instance_finalized_cb, instance);
+    }
+
+  g_hash_table_unref (self->stats);
+  g_array_unref (self->types);
+  g_free (self);
+}
+
+/**
+ * gt_object_tracker_track_type:
+ * @self: a #GtObjectTracker
+ * @type: a #GObject type
+ *
+ * Start tracking instances of @type, and of any of its subtypes, which are
+ * created from now on.
+ *
+ * The class of @type is referenced (and never unreferenced), so that the hook
+ * used to detect instance creation stays installed.
+ *
+ * Since: 0.2.0
+ */
+void
+gt_object_tracker_track_type (GtObjectTracker *self,
+                              GType            type)
+{
+  g_return_if_fail (self != NULL);
+  g_return_if_fail (g_type_is_a (type, G_TYPE_OBJECT));
+
+  /* Make sure the class exists, so the hook can be installed on it.
+   * Deliberately leak the reference. */
+  g_type_class_ref (type);
+
+  g_mutex_lock (&trackers_lock);
+
+  if (original_constructed == NULL)
+    {
+      original_constructed = g_hash_table_new (NULL, NULL);
+
+      /* Always hook #GObject itself, so that the end of every hooked
+       * constructed chain can be found. */
+      install_hook_locked (G_TYPE_OBJECT);
+    }
+  else
+    {
+      install_hook_locked (type);
+    }
+
+  g_array_append_val (self->types, type);
+
+  g_mutex_unlock (&trackers_lock);
+}
+
+/**
+ * gt_object_tracker_track_all:
+ * @self: a #GtObjectTracker
+ *
+ * Start tracking instances of all #GObject types which are created from now
+ * on. This is equivalent to calling gt_object_tracker_track_type() with
+ * %G_TYPE_OBJECT.
+ *
+ * Since: 0.2.0
+ */
+void
+gt_object_tracker_track_all (GtObjectTracker *self)
+{
+  g_return_if_fail (self != NULL);
+
+  gt_object_tracker_track_type (self, G_TYPE_OBJECT);
+}
+
+/*
+ * gt_object_tracker_set_created_func:
+ * @self: a #GtObjectTracker
+ * @func: (nullable): function to call for each tracked instance once it has
+ *    been constructed, or %NULL to unset it
+ * @user_data: user data to pass to @func
+ *
+ * Set a function to be called whenever an instance of a tracked type is
+ * created. It is called in the thread which created the instance, once the
+ * instance has been fully constructed, without any locks held.
+ *
+ * @user_data must remain valid until @self is freed, and @self must not be
+ * freed while instances of its tracked types could be being created in other
+ * threads.
+ *
+ * Since: 0.2.0
+ */
+void
+gt_object_tracker_set_created_func (GtObjectTracker            *self,
+                                    GtObjectTrackerCreatedFunc  func,
+                                    gpointer                    user_data)
+{
+  g_return_if_fail (self != NULL);
+
+  g_mutex_lock (&trackers_lock);
+  self->created_func = func;
+  self->created_data = user_data;
+  g_mutex_unlock (&trackers_lock);
+}
+
+typedef enum
+{
+  COUNT_CREATED,
+  COUNT_FINALIZED,
+  COUNT_LIVE,
+} CountKind;
+
+/* Sum a count over all the tracked types which are @type or its subtypes. */
+static guint
+gt_object_tracker_sum (GtObjectTracker *self,
+                       GType            type,
+                       CountKind        kind)
+{
+  GHashTableIter iter;
+  const TypeStats *stats;
+  guint total = 0;
+
+  g_mutex_lock (&trackers_lock);
+
+  g_hash_table_iter_init (&iter, self->stats);
+  while (g_hash_table_iter_next (&iter, NULL, (gpointer *) &stats))
+    {
+      if (!g_type_is_a (stats->type, type))
+        continue;
+
+      switch (kind)
+        {
+        case COUNT_CREATED:
+          total += stats->n_created;
+          break;
+        case COUNT_FINALIZED:
+          total += stats->n_finalized;
+          break;
+        case COUNT_LIVE:
+          total += g_hash_table_size (stats->live);
+          break;
+        default:
+          g_assert_not_reached ();
+        }
+    }
+
+  g_mutex_unlock (&trackers_lock);
+
+  return total;
+}
+
+/**
+ * gt_object_tracker_get_n_created:
+ * @self: a #GtObjectTracker
+ * @type: a #GObject type
+ *
+ * Get the number of tracked instances of @type, or of any of its subtypes,
+ * which have been created.
+ *
+ * Returns: number of instances created
+ * Since: 0.2.0
+ */
+guint
+gt_object_tracker_get_n_created (GtObjectTracker *self,
+                                 GType            type)
+{
+  g_return_val_if_fail (self != NULL, 0);
+
+  return gt_object_tracker_sum (self, type, COUNT_CREATED);
+}
+
+/**
+ * gt_object_tracker_get_n_finalized:
+ * @self: a #GtObjectTracker
+ * @type: a #GObject type
+ *
+ * Get the number of tracked instances of @type, or of any of its subtypes,
+ * which have been finalized.
+ *
+ * Returns: number of instances finalized
+ * Since: 0.2.0
+ */
+guint
+gt_object_tracker_get_n_finalized (GtObjectTracker *self,
+                                   GType            type)
+{
+  g_return_val_if_fail (self != NULL, 0);
+
+  return gt_object_tracker_sum (self, type, COUNT_FINALIZED);
+}
+
+/**
+ * gt_object_tracker_get_n_live:
+ * @self: a #GtObjectTracker
+ * @type: a #GObject type
+ *
+ * Get the number of tracked instances of @type, or of any of its subtypes,
+ * which are still alive. Pass %G_TYPE_OBJECT to count all live instances.
+ *
+ * Returns: number of live instances
+ * Since: 0.2.0
+ */
+guint
+gt_object_tracker_get_n_live (GtObjectTracker *self,
+                              GType            type)
+{
+  g_return_val_if_fail (self != NULL, 0);
+
+  return gt_object_tracker_sum (self, type, COUNT_LIVE);
+}
+
+/**
+ * gt_object_tracker_get_peak_n_live:
+ * @self: a #GtObjectTracker
+ * @type: a #GObject type
+ *
+ * Get the largest number of tracked instances of exactly @type (not including
+ * its subtypes) which have been alive at the same time.
+ *
+ * Returns: peak number of live instances
+ * Since: 0.2.0
+ */
+guint
+gt_object_tracker_get_peak_n_live (GtObjectTracker *self,
+                                   GType            type)
+{
+  const TypeStats *stats;
+  guint peak_n_live;
+
+  g_return_val_if_fail (self != NULL, 0);
+
+  g_mutex_lock (&trackers_lock);
+  stats = g_hash_table_lookup (self->stats, GSIZE_TO_POINTER (type));
+  peak_n_live = (stats != NULL) ? stats->peak_n_live : 0;
+  g_mutex_unlock (&trackers_lock);
+
+  return peak_n_live;
+}
+
+/**
+ * gt_object_tracker_dup_live_objects:
+ * @self: a #GtObjectTracker
+ * @type: a #GObject type
+ *
+ * Get the tracked instances of @type, or of any of its subtypes, which are
+ * still alive. A reference is added to each of them.
+ *
+ * Returns: (transfer full) (element-type GObject): live instances, in no
+ *    particular order
+ * Since: 0.2.0
+ */
+GPtrArray *
+gt_object_tracker_dup_live_objects (GtObjectTracker *self,
+                                    GType            type)
+{
+  g_autoptr(GPtrArray) objects = g_ptr_array_new_with_free_func (g_object_unref);
+  GHashTableIter iter;
+  const TypeStats *stats;
+
+  g_return_val_if_fail (self != NULL, NULL);
+
+  g_mutex_lock (&trackers_lock);
+
+  g_hash_table_iter_init (&iter, self->stats);
+  while (g_hash_table_iter_next (&iter, NULL, (gpointer *) &stats))
+    {
+      GHashTableIter live_iter;
+      GObject *obj;
+
+      if (!g_type_is_a (stats->type, type))
+        continue;
+
+      g_hash_table_iter_init (&live_iter, stats->live);
+      while (g_hash_table_iter_next (&live_iter, (gpointer *) &obj, NULL))
+        g_ptr_array_add (objects, g_object_ref (obj));
+    }
+
+  g_mutex_unlock (&trackers_lock);
+
+  return g_steal_pointer (&objects);
+}
+
+static gint
+compare_type_stats (gconstpointer a,
+                    gconstpointer b)
+{
+  const TypeStats *stats_a = *((const TypeStats **) a);
+  const TypeStats *stats_b = *((const TypeStats **) b);
+
+  return g_strcmp0 (g_type_name (stats_a->type), g_type_name (stats_b->type));
+}
+
+static gint
+compare_instances_by_age (gconstpointer a,
+                          gconstpointer b)
+{
+  const TrackedInstance *instance_a = *((const TrackedInstance **) a);
+  const TrackedInstance *instance_b = *((const TrackedInstance **) b);
+
+  if (instance_a->creation_time < instance_b->creation_time)
+    return -1;
+  else if (instance_a->creation_time > instance_b->creation_time)
+    return 1;
+  else
+    return 0;
+}
+
+/**
+ * gt_object_tracker_format:
+ * @self: a #GtObjectTracker
+ *
+ * Format a report of the tracked types in a human readable form, typically
+ * for logging it to some debug output. For each type which has had instances
+ * created, it lists the number of live instances, the peak number of live
+ * instances, and the numbers created and finalized. It then lists the
+ * longest-lived of the instances which are still alive, with their ages. Each
+ * line is indented by two spaces.
+ *
+ * Returns: (transfer full): human readable report, or an empty string if no
+ *    instances have been tracked
+ * Since: 0.2.0
+ */
+gchar *
+gt_object_tracker_format (GtObjectTracker *self)
+{
+  g_autoptr(GString) str = g_string_new ("");
+  g_autoptr(GPtrArray) sorted_stats = g_ptr_array_new ();
+  GHashTableIter iter;
+  TypeStats *stats;
+  gint64 now = g_get_monotonic_time ();
+
+  g_return_val_if_fail (self != NULL, NULL);
+
+  g_mutex_lock (&trackers_lock);
+
+  g_hash_table_iter_init (&iter, self->stats);
+  while (g_hash_table_iter_next (&iter, NULL, (gpointer *) &stats))
+    g_ptr_array_add (sorted_stats, stats);
+  g_ptr_array_sort (sorted_stats, compare_type_stats);
+
+  for (gsize i = 0; i < sorted_stats->len; i++)
+    {
+      g_autoptr(GPtrArray) instances = NULL;
+      GHashTableIter live_iter;
+      TrackedInstance *instance;
+
+      stats = g_ptr_array_index (sorted_stats, i);
+
+      instances = g_ptr_array_sized_new (g_hash_table_size (stats->live));
+      g_hash_table_iter_init (&live_iter, stats->live);
+      while (g_hash_table_iter_next (&live_iter, NULL, (gpointer *) &instance))
+        g_ptr_array_add (instances, instance);
+      g_ptr_array_sort (instances, compare_instances_by_age);
+
+      g_string_append_printf (str, "  %s: %u live (peak %u, %u created, %u finalized)\n",
+                              g_type_name (stats->type),
+                              instances->len, stats->peak_n_live,
+                              stats->n_created, stats->n_finalized);
+
+      for (gsize j = 0; j < instances->len && j < MAX_FORMATTED_INSTANCES; j++)
+        {
+          instance = g_ptr_array_index (instances, j);
+
+          g_string_append_printf (str, "    %s %p, alive for %.3fs\n",
+                                  g_type_name (stats->type), instance->obj,
+                                  (gdouble) (now - instance->creation_time) / G_USEC_PER_SEC);
+        }
+
+      if (instances->len > MAX_FORMATTED_INSTANCES)
+        g_string_append_printf (str, "    …and %u more\n",
+                                instances->len - MAX_FORMATTED_INSTANCES);
+    }
+
+  g_mutex_unlock (&trackers_lock);
+
+  return g_string_free (g_steal_pointer (&str), FALSE);
+}
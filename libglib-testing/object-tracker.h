@@ -0,0 +1,107 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ *
+ * Copyright © 2018 Endless Mobile, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#pragma once
+
+#include <glib.h>
+#include <glib-object.h>
+
+G_BEGIN_DECLS
+
+typedef struct _GtObjectTracker GtObjectTracker;
+
+GtObjectTracker *gt_object_tracker_new  (void);
+void             gt_object_tracker_free (GtObjectTracker *self);
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC (GtObjectTracker, gt_object_tracker_free)
+
+void gt_object_tracker_track_type (GtObjectTracker *self,
+                                   GType            type);
+void gt_object_tracker_track_all  (GtObjectTracker *self);
+
+guint      gt_object_tracker_get_n_created    (GtObjectTracker *self,
+                                               GType            type);
+guint      gt_object_tracker_get_n_finalized  (GtObjectTracker *self,
+                                               GType            type);
+guint      gt_object_tracker_get_n_live       (GtObjectTracker *self,
+                                               GType            type);
+guint      gt_object_tracker_get_peak_n_live  (GtObjectTracker *self,
+                                               GType            type);
+GPtrArray *gt_object_tracker_dup_live_objects (GtObjectTracker *self,
+                                               GType            type);
+
+gchar *gt_object_tracker_format (GtObjectTracker *self);
+
+/**
+ * gt_object_tracker_assert_no_leaks:
+ * @self: a #GtObjectTracker
+ *
+ * Assert that all the objects created since @self started tracking them have
+ * been finalized. This is typically called at the end of a test.
+ *
+ * If they have not, an assertion fails and the live objects are printed, using
+ * gt_object_tracker_format().
+ *
+ * Since: 0.2.0
+ */
+#define gt_object_tracker_assert_no_leaks(self) \
+  G_STMT_START { \
+    guint anl_n_live = gt_object_tracker_get_n_live (self, G_TYPE_OBJECT); \
+    if (anl_n_live > 0) \
+      { \
+        g_autofree gchar *anl_list = gt_object_tracker_format (self); \
+        g_autofree gchar *anl_message = \
+            g_strdup_printf ("Expected no live objects, but saw %u:\n%s", \
+                             anl_n_live, anl_list); \
+        g_assertion_message (G_LOG_DOMAIN, __FILE__, __LINE__, G_STRFUNC, \
+                             anl_message); \
+      } \
+  } G_STMT_END
+
+/**
+ * gt_object_tracker_assert_n_live:
+ * @self: a #GtObjectTracker
+ * @type: a #GObject type
+ * @n: expected number of live instances of @type or its subtypes
+ *
+ * Assert that exactly @n instances of @type (or its subtypes) which were
+ * created since @self started tracking them are still alive.
+ *
+ * If not, an assertion fails and the live objects are printed, using
+ * gt_object_tracker_format().
+ *
+ * Since: 0.2.0
+ */
+#define gt_object_tracker_assert_n_live(self, type, n) \
+  G_STMT_START { \
+    guint anl_n_live = gt_object_tracker_get_n_live (self, type); \
+    if (anl_n_live != (n)) \
+      { \
+        g_autofree gchar *anl_list = gt_object_tracker_format (self); \
+        g_autofree gchar *anl_message = \
+            g_strdup_printf ("Expected %u live %s objects, but saw %u:\n%s", \
+                             (guint) (n), g_type_name (type), anl_n_live, \
+                             anl_list); \
+        g_assertion_message (G_LOG_DOMAIN, __FILE__, __LINE__, G_STRFUNC, \
+                             anl_message); \
+      } \
+  } G_STMT_END
+
+G_END_DECLS
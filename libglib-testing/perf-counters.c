@@ -0,0 +1,405 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ *
+ * Copyright © 2018 Endless Mobile, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#include "config.h"
+
+#include <glib.h>
+#include <libglib-testing/perf-counters.h>
+#include <libglib-testing/perf-counters-private.h>
+
+#ifdef HAVE_LINUX_PERF_EVENT_H
+#include <errno.h>
+#include <linux/perf_event.h>
+#include <string.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+
+/**
+ * SECTION:perf-counters
+ * @short_description: Per-thread performance counters for a scope
+ * @stability: Unstable
+ * @include: libglib-testing/perf-counters.h
+ *
+ * #GtPerfCounters measures performance counters, such as the number of
+ * instructions executed, for a single thread over a scope delimited by
+ * gt_perf_counters_start() and gt_perf_counters_stop(). Unlike wall clock
+ * times, instruction counts are largely unaffected by other load on the
+ * machine, so they are stable enough to detect performance regressions on
+ * shared CI machines.
+ *
+ * Hardware counters (instructions and cycles) are used where they are
+ * available. On machines where they are not (for example, many virtual
+ * machines), or where access to them is restricted by
+ * `/proc/sys/kernel/perf_event_paranoid`, only the software counters (task
+ * clock, context switches and page faults) will be available. Use
+ * gt_perf_counters_is_available() to check. Counters which are not available
+ * always read as zero.
+ *
+ * If `perf_event_paranoid` is 2 or higher (the default on many distributions),
+ * unprivileged processes may only measure user space. The task clock and page
+ * faults are then measured in user space only, and the context switch counter
+ * is not available, as context switches only happen in the kernel.
+ *
+ * Counters are opened using `perf_event_open()`, so are only available on
+ * Linux. On other platforms, no counters are available.
+ *
+ * To measure the #GtDBusQueue server thread, use
+ * gt_dbus_queue_new_perf_counters(). #GtBench reports also include the
+ * counters for each benchmark, where available.
+ *
+ * Since: 0.2.0
+ */
+
+#define N_COUNTERS (GT_PERF_COUNTER_LAST + 1)
+
+/**
+ * GtPerfCounters:
+ *
+ * A set of performance counters for a single thread.
+ *
+ * Since: 0.2.0
+ */
+struct _GtPerfCounters
+{
+  /* File descriptors from perf_event_open(), or -1 if a counter is not
+   * available. */
+  int fds[N_COUNTERS];
+};
+
+/**
+ * gt_perf_counter_get_name:
+ * @counter: a #GtPerfCounter
+ *
+ * Get a short name for @counter, suitable for use as a key in a report, such
+ * as `instructions`.
+ *
+ * Returns: name of the counter
+ * Since: 0.2.0
+ */
+const gchar *
+gt_perf_counter_get_name (GtPerfCounter counter)
+{
+  switch (counter)
+    {
+    case GT_PERF_COUNTER_INSTRUCTIONS:
+      return "instructions";
+    case GT_PERF_COUNTER_CYCLES:
+      return "cycles";
+    case GT_PERF_COUNTER_TASK_CLOCK:
+      return "task-clock";
+    case GT_PERF_COUNTER_CONTEXT_SWITCHES:
+      return "context-switches";
+    case GT_PERF_COUNTER_PAGE_FAULTS:
+      return "page-faults";
+    default:
+      g_return_val_if_reached (NULL);
+    }
+}
+
+#ifdef HAVE_LINUX_PERF_EVENT_H
+/* Open a perf event for @counter on @thread_id (or the calling thread, if
+ * zero), initially disabled. Returns -1 if it is not available. */
+static int
+open_counter (GtPerfCounter counter,
+              gint          thread_id)
+{
+  struct perf_event_attr attr;
+  int fd;
+
+  memset (&attr, 0, sizeof (attr));
+  attr.size = sizeof (attr);
+  attr.disabled = 1;
+  attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+
+  switch (counter)
+    {
+    case GT_PERF_COUNTER_INSTRUCTIONS:
+      attr.type = PERF_TYPE_HARDWARE;
+      attr.config = PERF_COUNT_HW_INSTRUCTIONS;
+      break;
+    case GT_PERF_COUNTER_CYCLES:
+      attr.type = PERF_TYPE_HARDWARE;
+      attr.config = PERF_COUNT_HW_CPU_CYCLES;
+      break;
+    case GT_PERF_COUNTER_TASK_CLOCK:
+      attr.type = PERF_TYPE_SOFTWARE;
+      attr.config = PERF_COUNT_SW_TASK_CLOCK;
+      break;
+    case GT_PERF_COUNTER_CONTEXT_SWITCHES:
+      attr.type = PERF_TYPE_SOFTWARE;
+      attr.config = PERF_COUNT_SW_CONTEXT_SWITCHES;
+      break;
+    case GT_PERF_COUNTER_PAGE_FAULTS:
+      attr.type = PERF_TYPE_SOFTWARE;
+      attr.config = PERF_COUNT_SW_PAGE_FAULTS;
+      break;
+    default:
+      g_assert_not_reached ();
+    }
+
+  /* Hardware counters are only measured in user space, so they can be opened
+   * by unprivileged users with the default perf_event_paranoid setting.
+   * Software events like page faults can happen in the kernel, so include it
+   * where that’s allowed. */
+  if (attr.type == PERF_TYPE_HARDWARE)
+    {
+      attr.exclude_kernel = 1;
+      attr.exclude_hv = 1;
+    }
+
+  fd = (int) syscall (SYS_perf_event_open, &attr, (pid_t) thread_id,
+                      -1  /* any CPU */, -1  /* no group */, 0UL);
+
+  /* If perf_event_paranoid ≥ 2, unprivileged users may only measure user
+   * space. Context switches only ever happen in the kernel, so would always
+   * read as zero there; leave them unavailable instead. */
+  if (fd < 0 && errno == EACCES && !attr.exclude_kernel &&
+      counter != GT_PERF_COUNTER_CONTEXT_SWITCHES)
+    {
+      attr.exclude_kernel = 1;
+      attr.exclude_hv = 1;
+
+      fd = (int) syscall (SYS_perf_event_open, &attr, (pid_t) thread_id,
+                          -1  /* any CPU */, -1  /* no group */, 0UL);
+    }
+
+  return fd;
+}
+#endif  /* HAVE_LINUX_PERF_EVENT_H */
+
+/*< private >
+ * gt_perf_counters_new_for_thread_id:
+ * @thread_id: Linux thread ID (as from `gettid()`) to measure, 0 for the
+ *    calling thread, or a negative value to create counters which are all
+ *    unavailable
+ *
+ * Create a new #GtPerfCounters for the given thread. This is private, as
+ * thread IDs are not portable.
+ *
+ * Returns: (transfer full): a new #GtPerfCounters
+ * Since: 0.2.0
+ */
+GtPerfCounters *
+gt_perf_counters_new_for_thread_id (gint thread_id)
+{
+  g_autoptr(GtPerfCounters) counters = g_new0 (GtPerfCounters, 1);
+
+  for (guint i = 0; i < N_COUNTERS; i++)
+    {
+#ifdef HAVE_LINUX_PERF_EVENT_H
+      counters->fds[i] = (thread_id >= 0) ? open_counter ((GtPerfCounter) i, thread_id) : -1;
+#else
+      counters->fds[i] = -1;
+#endif
+    }
+
+  return g_steal_pointer (&counters);
+}
+
+/**
+ * gt_perf_counters_new:
+ *
+ * Create a new #GtPerfCounters for the calling thread. The counters are not
+ * running until gt_perf_counters_start() is called.
+ *
+ * Returns: (transfer full): a new #GtPerfCounters
+ * Since: 0.2.0
+ */
+GtPerfCounters *
+gt_perf_counters_new (void)
+{
+  return gt_perf_counters_new_for_thread_id (0);
+}
+
+/**
+ * gt_perf_counters_free:
+ * @self: (transfer full): a #GtPerfCounters
+ *
+ * Free a #GtPerfCounters.
+ *
+ * Since: 0.2.0
+ */
+void
+gt_perf_counters_free (GtPerfCounters *self)
+{
+  g_return_if_fail (self != NULL);
+
+#ifdef HAVE_LINUX_PERF_EVENT_H
+  for (guint i = 0; i < N_COUNTERS; i++)
+    {
+      if (self->fds[i] >= 0)
+        close (self->fds[i]);
+    }
+#endif
+
+  g_free (self);
+}
+
+/**
+ * gt_perf_counters_start:
+ * @self: a #GtPerfCounters
+ *
+ * Reset all the counters to zero and start them running. This may be called
+ * from any thread, not just the one being measured.
+ *
+ * Since: 0.2.0
+ */
+void
+gt_perf_counters_start (GtPerfCounters *self)
+{
+  g_return_if_fail (self != NULL);
+
+#ifdef HAVE_LINUX_PERF_EVENT_H
+  for (guint i = 0; i < N_COUNTERS; i++)
+    {
+      if (self->fds[i] >= 0)
+        {
+          ioctl (self->fds[i], PERF_EVENT_IOC_RESET, 0);
+          ioctl (self->fds[i], PERF_EVENT_IOC_ENABLE, 0);
+        }
+    }
+#endif
+}
+
+/**
+ * gt_perf_counters_stop:
+ * @self: a #GtPerfCounters
+ *
+ * Stop all the counters running. Their values can then be read using
+ * gt_perf_counters_get(). This may be called from any thread, not just the
+ * one being measured.
+ *
+ * Since: 0.2.0
+ */
+void
+gt_perf_counters_stop (GtPerfCounters *self)
+{
+  g_return_if_fail (self != NULL);
+
+#ifdef HAVE_LINUX_PERF_EVENT_H
+  /* Stop in the reverse order to starting, so the counters cover as similar
+   * a region as possible. */
+  for (guint i = N_COUNTERS; i > 0; i--)
+    {
+      if (self->fds[i - 1] >= 0)
+        ioctl (self->fds[i - 1], PERF_EVENT_IOC_DISABLE, 0);
+    }
+#endif
+}
+
+/**
+ * gt_perf_counters_is_available:
+ * @self: a #GtPerfCounters
+ * @counter: a #GtPerfCounter
+ *
+ * Check whether @counter could be opened on this machine.
+ *
+ * Returns: %TRUE if @counter is available, %FALSE otherwise
+ * Since: 0.2.0
+ */
+gboolean
+gt_perf_counters_is_available (GtPerfCounters *self,
+                               GtPerfCounter   counter)
+{
+  g_return_val_if_fail (self != NULL, FALSE);
+  g_return_val_if_fail ((guint) counter < N_COUNTERS, FALSE);
+
+  return (self->fds[counter] >= 0);
+}
+
+/**
+ * gt_perf_counters_get:
+ * @self: a #GtPerfCounters
+ * @counter: a #GtPerfCounter
+ *
+ * Get the value of @counter since gt_perf_counters_start() was last called.
+ * If the kernel had to multiplex the counter with others, the value is scaled
+ * to estimate the value over the whole time it was running.
+ *
+ * Returns: value of the counter, or zero if it is not available
+ * Since: 0.2.0
+ */
+guint64
+gt_perf_counters_get (GtPerfCounters *self,
+                      GtPerfCounter   counter)
+{
+  g_return_val_if_fail (self != NULL, 0);
+  g_return_val_if_fail ((guint) counter < N_COUNTERS, 0);
+
+#ifdef HAVE_LINUX_PERF_EVENT_H
+  /* Layout given by PERF_FORMAT_TOTAL_TIME_ENABLED and
+   * PERF_FORMAT_TOTAL_TIME_RUNNING. */
+  struct
+    {
+      guint64 value;
+      guint64 time_enabled;
+      guint64 time_running;
+    } data;
+
+  if (self->fds[counter] < 0 ||
+      read (self->fds[counter], &data, sizeof (data)) != sizeof (data))
+    return 0;
+
+  if (data.time_running > 0 && data.time_running < data.time_enabled)
+    return (guint64) ((gdouble) data.value * (gdouble) data.time_enabled / (gdouble) data.time_running);
+
+  return data.value;
+#else
+  return 0;
+#endif
+}
+
+/**
+ * gt_perf_counters_format:
+ * @self: a #GtPerfCounters
+ *
+ * Format the values of all the available counters in a human readable form,
+ * typically for logging them to some debug output. The returned string does
+ * not end in a newline character (`\n`).
+ *
+ * Returns: (transfer full): human readable list of the counters, or an empty
+ *    string if none are available
+ * Since: 0.2.0
+ */
+gchar *
+gt_perf_counters_format (GtPerfCounters *self)
+{
+  g_autoptr(GString) str = g_string_new ("");
+
+  g_return_val_if_fail (self != NULL, NULL);
+
+  for (guint i = 0; i < N_COUNTERS; i++)
+    {
+      if (!gt_perf_counters_is_available (self, (GtPerfCounter) i))
+        continue;
+
+      if (str->len > 0)
+        g_string_append (str, ", ");
+
+      g_string_append_printf (str, "%s: %" G_GUINT64_FORMAT,
+                              gt_perf_counter_get_name ((GtPerfCounter) i),
+                              gt_perf_counters_get (self, (GtPerfCounter) i));
+    }
+
+  return g_string_free (g_steal_pointer (&str), FALSE);
+}
@@ -0,0 +1,80 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ *
+ * Copyright © 2018 Endless Mobile, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#pragma once
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/**
+ * GtPerfCounter:
+ * @GT_PERF_COUNTER_INSTRUCTIONS: instructions retired, in user space (hardware)
+ * @GT_PERF_COUNTER_CYCLES: CPU cycles, in user space (hardware)
+ * @GT_PERF_COUNTER_TASK_CLOCK: time the thread was running on a CPU, in
+ *    nanoseconds (software)
+ * @GT_PERF_COUNTER_CONTEXT_SWITCHES: number of context switches (software;
+ *    not available to unprivileged processes if `perf_event_paranoid` is 2 or
+ *    higher)
+ * @GT_PERF_COUNTER_PAGE_FAULTS: number of page faults (software; only those in
+ *    user space if `perf_event_paranoid` is 2 or higher)
+ *
+ * A performance counter which can be measured by #GtPerfCounters. Hardware
+ * counters are not available on all machines (for example, in many virtual
+ * machines), in which case the software counters are still usually available.
+ *
+ * Since: 0.2.0
+ */
+typedef enum
+{
+  GT_PERF_COUNTER_INSTRUCTIONS,
+  GT_PERF_COUNTER_CYCLES,
+  GT_PERF_COUNTER_TASK_CLOCK,
+  GT_PERF_COUNTER_CONTEXT_SWITCHES,
+  GT_PERF_COUNTER_PAGE_FAULTS,
+} GtPerfCounter;
+
+/**
+ * GT_PERF_COUNTER_LAST:
+ *
+ * The last valid #GtPerfCounter, for iterating over all of them.
+ *
+ * Since: 0.2.0
+ */
+#define GT_PERF_COUNTER_LAST GT_PERF_COUNTER_PAGE_FAULTS
+
+const gchar *gt_perf_counter_get_name (GtPerfCounter counter);
+
+typedef struct _GtPerfCounters GtPerfCounters;
+
+GtPerfCounters *gt_perf_counters_new  (void);
+void            gt_perf_counters_free (GtPerfCounters *self);
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC (GtPerfCounters, gt_perf_counters_free)
+
+void     gt_perf_counters_start        (GtPerfCounters *self);
+void     gt_perf_counters_stop         (GtPerfCounters *self);
+gboolean gt_perf_counters_is_available (GtPerfCounters *self,
+                                        GtPerfCounter   counter);
+guint64  gt_perf_counters_get          (GtPerfCounters *self,
+                                        GtPerfCounter   counter);
+gchar   *gt_perf_counters_format       (GtPerfCounters *self);
+
+G_END_DECLS
@@ -0,0 +1,1057 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ *
+ * Copyright © 2018 Endless Mobile, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#include "config.h"
+
+#include <glib.h>
+#include <glib-object.h>
+#include <libglib-testing/property-recorder.h>
+#include <libglib-testing/virtual-clock.h>
+#include <string.h>
+
+
+/**
+ * SECTION:property-recorder
+ * @short_description: Records the history of #GObject property values
+ * @stability: Unstable
+ * @include: libglib-testing/property-recorder.h
+ *
+ * #GtPropertyRecorder watches #GObject::notify for chosen properties of zero
+ * or more #GObjects, and records the new value of each property, with a
+ * timestamp, every time it is emitted. The history of each property can then
+ * be queried: its value at a given time, how many times it changed, how long
+ * it spent with a given value, and how often it oscillated.
+ *
+ * This complements #GtSignalLogger: gt_signal_logger_assert_notify_emission_pop()
+ * checks that a property was notified, but not what its value was, so it
+ * can’t tell whether the property was flapping between two values, or being
+ * notified without changing. Both cause redundant work for anything bound to
+ * the property.
+ *
+ * A transition is a notification where the property’s value differs from its
+ * previous value. An oscillation is a transition back to the value the
+ * property had before its previous transition, such as `A → B → A`.
+ *
+ * Histories are stored compactly, so a property can be recorded for a long
+ * time: each sample is delta encoded against the previous one as a pair of
+ * variable length integers, and strings are interned, so a property flapping
+ * between two values typically needs two or three bytes per notification.
+ * Properties with boolean, integer, enum, flags, floating point and string
+ * types can be recorded.
+ *
+ * Timestamps are taken from a #GtVirtualClock if one is passed to
+ * gt_property_recorder_new(), so that histories can be recorded in virtual
+ * time; otherwise from g_get_monotonic_time(). All times are in microseconds.
+ *
+ * Watched properties are identified by their object and name in queries. The
+ * history of a property can still be queried after its object is finalised,
+ * and stops growing at that point.
+ *
+ * A #GtPropertyRecorder must be used from a single thread, and the properties
+ * it watches must be notified in that thread.
+ *
+ * Since: 0.2.0
+ */
+
+/* How the values of a property are encoded in its history. */
+typedef enum
+{
+  VALUE_KIND_SIGNED,
+  VALUE_KIND_UNSIGNED,
+  VALUE_KIND_DOUBLE,
+  VALUE_KIND_STRING,
+} ValueKind;
+
+/* The recorded history of a single property on a single object.
+ *
+ * Each sample in @history is two varints: the time since the previous sample
+ * (zigzag encoded), and the value relative to the previous value. The first
+ * sample is relative to a time and value of zero. Values are stored as raw
+ * 64-bit integers: integers are delta encoded (zigzag), doubles are XORed with
+ * the previous value and byte swapped, and strings are stored as their #GQuark,
+ * with 0 for %NULL. XORing makes unchanged bits zero. Byte swapping moves the
+ * trailing mantissa bytes to the high-order end, where the varint encoding
+ * omits them if they are zero, as they are when both values have short
+ * mantissas (such as small integers). The sign and exponent bytes move to the
+ * low-order end, so they still take space even when they are unchanged. */
+typedef struct
+{
+  GtPropertyRecorder *recorder;  /* (not owned) */
+
+  /* Pointer to the object instance this series is for; no ref is held, and
+   * once the object is finalised (@alive is %FALSE) this is only used as an
+   * opaque key. */
+  gpointer obj;  /* (not owned) */
+  /* A copy of `G_OBJECT_TYPE_NAME (obj)` for use when @obj may be invalid. */
+  gchar *obj_type_name;  /* (owned) */
+  gboolean alive;
+  gulong notify_id;  /* 0 when disconnected */
+
+  GParamSpec *pspec;  /* (owned) */
+  ValueKind kind;
+
+  GByteArray *history;  /* (owned) */
+  guint n_samples;
+  guint n_notifies;
+  guint n_transitions;
+  guint n_oscillations;
+
+  /* The first and last samples, for encoding the next sample and computing
+   * durations. @before_last_raw is the value before the last transition, if
+   * there has been one. */
+  gint64 first_time;
+  gint64 last_time;
+  guint64 last_raw;
+  guint64 before_last_raw;
+  gboolean have_before_last;
+
+  /* Time @obj was finalised, if it has been. */
+  gint64 end_time;
+} Series;
+
+/**
+ * GtPropertyRecorder:
+ *
+ * An object which records the history of the values of #GObject properties.
+ *
+ * Since: 0.2.0
+ */
+struct _GtPropertyRecorder
+{
+  GtVirtualClock *clock;  /* (nullable) (not owned) */
+
+  /* Watched properties, in the order they were first watched. */
+  GPtrArray *series;  /* (owned) (element-type Series) */
+};
+
+/* Doubles are stored as their bit patterns. */
+G_STATIC_ASSERT (sizeof (gdouble) == sizeof (guint64));
+
+static void weak_notify_cb (gpointer  user_data,
+                            GObject  *where_the_object_was);
+
+static gint64
+get_time (GtPropertyRecorder *self)
+{
+  if (self->clock != NULL)
+    return gt_virtual_clock_get_time (self->clock);
+  else
+    return g_get_monotonic_time ();
+}
+
+static void
+append_varint (GByteArray *buffer,
+               guint64     value)
+{
+  guint8 bytes[10];
+  guint n_bytes = 0;
+
+  do
+    {
+      bytes[n_bytes] = value & 0x7f;
+      value >>= 7;
+      if (value != 0)
+        bytes[n_bytes] |= 0x80;
+      n_bytes++;
+    }
+  while (value != 0);
+
+  g_byte_array_append (buffer, bytes, n_bytes);
+}
+
+static guint64
+read_varint (const GByteArray *buffer,
+             gsize            *offset)
+{
+  guint64 value = 0;
+  guint shift = 0;
+
+  while (*offset < buffer->len && shift < 64)
+    {
+      guint8 byte = buffer->data[(*offset)++];
+
+      value |= (guint64) (byte & 0x7f) << shift;
+      shift += 7;
+
+      if (!(byte & 0x80))
+        break;
+    }
+
+  return value;
+}
+
+static guint64
+zigzag_encode (gint64 value)
+{
+  return ((guint64) value << 1) ^ (guint64) (value >> 63);
+}
+
+static gint64
+zigzag_decode (guint64 value)
+{
+  return (gint64) ((value >> 1) ^ (0 - (value & 1)));
+}
+
+/* Work out how to encode values of @type. Returns %FALSE if they can’t be. */
+static gboolean
+value_kind_for_type (GType      type,
+                     ValueKind *kind_out)
+{
+  switch (G_TYPE_FUNDAMENTAL (type))
+    {
+    case G_TYPE_CHAR:
+    case G_TYPE_INT:
+    case G_TYPE_LONG:
+    case G_TYPE_INT64:
+    case G_TYPE_ENUM:
+      *kind_out = VALUE_KIND_SIGNED;
+      return TRUE;
+    case G_TYPE_BOOLEAN:
+    case G_TYPE_UCHAR:
+    case G_TYPE_UINT:
+    case G_TYPE_ULONG:
+    case G_TYPE_UINT64:
+    case G_TYPE_FLAGS:
+      *kind_out = VALUE_KIND_UNSIGNED;
+      return TRUE;
+    case G_TYPE_FLOAT:
+    case G_TYPE_DOUBLE:
+      *kind_out = VALUE_KIND_DOUBLE;
+      return TRUE;
+    case G_TYPE_STRING:
+      *kind_out = VALUE_KIND_STRING;
+      return TRUE;
+    default:
+      return FALSE;
+    }
+}
+
+/* Convert @value, which must be of a type accepted by value_kind_for_type(),
+ * to its raw representation. */
+static guint64
+value_to_raw (const GValue *value)
+{
+  switch (G_TYPE_FUNDAMENTAL (G_VALUE_TYPE (value)))
+    {
+    case G_TYPE_CHAR:
+      return (guint64) (gint64) g_value_get_schar (value);
+    case G_TYPE_INT:
+      return (guint64) (gint64) g_value_get_int (value);
+    case G_TYPE_LONG:
+      return (guint64) (gint64) g_value_get_long (value);
+    case G_TYPE_INT64:
+      return (guint64) g_value_get_int64 (value);
+    case G_TYPE_ENUM:
+      return (guint64) (gint64) g_value_get_enum (value);
+    case G_TYPE_BOOLEAN:
+      return g_value_get_boolean (value) ? 1 : 0;
+    case G_TYPE_UCHAR:
+      return g_value_get_uchar (value);
+    case G_TYPE_UINT:
+      return g_value_get_uint (value);
+    case G_TYPE_ULONG:
+      return g_value_get_ulong (value);
+    case G_TYPE_UINT64:
+      return g_value_get_uint64 (value);
+    case G_TYPE_FLAGS:
+      return g_value_get_flags (value);
+    case G_TYPE_FLOAT:
+    case G_TYPE_DOUBLE:
+      {
+        gdouble d;
+        guint64 raw;
+
+        if (G_VALUE_HOLDS_FLOAT (value))
+          d = g_value_get_float (value);
+        else
+          d = g_value_get_double (value);
+
+        memcpy (&raw, &d, sizeof (raw));
+
+        return raw;
+      }
+    case G_TYPE_STRING:
+      return g_quark_from_string (g_value_get_string (value));
+    default:
+      g_assert_not_reached ();
+    }
+
+  return 0;
+}
+
+/* Set @value, which must be uninitialised, to @raw as a value of @type. */
+static void
+value_from_raw (GValue  *value,
+                GType    type,
+                guint64  raw)
+{
+  g_value_init (value, type);
+
+  switch (G_TYPE_FUNDAMENTAL (type))
+    {
+    case G_TYPE_CHAR:
+      g_value_set_schar (value, (gint8) (gint64) raw);
+      break;
+    case G_TYPE_INT:
+      g_value_set_int (value, (gint) (gint64) raw);
+      break;
+    case G_TYPE_LONG:
+      g_value_set_long (value, (glong) (gint64) raw);
+      break;
+    case G_TYPE_INT64:
+      g_value_set_int64 (value, (gint64) raw);
+      break;
+    case G_TYPE_ENUM:
+      g_value_set_enum (value, (gint) (gint64) raw);
+      break;
+    case G_TYPE_BOOLEAN:
+      g_value_set_boolean (value, raw != 0);
+      break;
+    case G_TYPE_UCHAR:
+      g_value_set_uchar (value, (guchar) raw);
+      break;
+    case G_TYPE_UINT:
+      g_value_set_uint (value, (guint) raw);
+      break;
+    case G_TYPE_ULONG:
+      g_value_set_ulong (value, (gulong) raw);
+      break;
+    case G_TYPE_UINT64:
+      g_value_set_uint64 (value, raw);
+      break;
+    case G_TYPE_FLAGS:
+      g_value_set_flags (value, (guint) raw);
+      break;
+    case G_TYPE_FLOAT:
+    case G_TYPE_DOUBLE:
+      {
+        gdouble d;
+
+        memcpy (&d, &raw, sizeof (d));
+
+        if (G_VALUE_HOLDS_FLOAT (value))
+          g_value_set_float (value, (gfloat) d);
+        else
+          g_value_set_double (value, d);
+        break;
+      }
+    case G_TYPE_STRING:
+      g_value_set_string (value, g_quark_to_string ((GQuark) raw));
+      break;
+    default:
+      g_assert_not_reached ();
+    }
+}
+
+static guint64
+encode_value (ValueKind kind,
+              guint64   previous_raw,
+              guint64   raw)
+{
+  switch (kind)
+    {
+    case VALUE_KIND_SIGNED:
+    case VALUE_KIND_UNSIGNED:
+      return zigzag_encode ((gint64) (raw - previous_raw));
+    case VALUE_KIND_DOUBLE:
+      return GUINT64_SWAP_LE_BE (raw ^ previous_raw);
+    case VALUE_KIND_STRING:
+      return raw;
+    default:
+      g_assert_not_reached ();
+    }
+
+  return 0;
+}
+
+static guint64
+decode_value (ValueKind kind,
+              guint64   previous_raw,
+              guint64   encoded)
+{
+  switch (kind)
+    {
+    case VALUE_KIND_SIGNED:
+    case VALUE_KIND_UNSIGNED:
+      return previous_raw + (guint64) zigzag_decode (encoded);
+    case VALUE_KIND_DOUBLE:
+      return GUINT64_SWAP_LE_BE (encoded) ^ previous_raw;
+    case VALUE_KIND_STRING:
+      return encoded;
+    default:
+      g_assert_not_reached ();
+    }
+
+  return 0;
+}
+
+/* Iterator over the samples in a Series. */
+typedef struct
+{
+  const Series *series;  /* (not owned) */
+  gsize offset;
+  guint index;
+  gint64 time;
+  guint64 raw;
+} SeriesIter;
+
+static void
+series_iter_init (SeriesIter   *iter,
+                  const Series *series)
+{
+  iter->series = series;
+  iter->offset = 0;
+  iter->index = 0;
+  iter->time = 0;
+  iter->raw = 0;
+}
+
+/* Decode the next sample into @iter->time and @iter->raw. Returns %FALSE if
+ * there are no more samples. */
+static gboolean
+series_iter_next (SeriesIter *iter)
+{
+  if (iter->index >= iter->series->n_samples)
+    return FALSE;
+
+  iter->time += zigzag_decode (read_varint (iter->series->history, &iter->offset));
+  iter->raw = decode_value (iter->series->kind, iter->raw,
+                            read_varint (iter->series->history, &iter->offset));
+  iter->index++;
+
+  return TRUE;
+}
+
+/* Append a sample to @series. */
+static void
+series_add_sample (Series  *series,
+                   gint64   time,
+                   guint64  raw)
+{
+  gint64 previous_time = (series->n_samples > 0) ? series->last_time : 0;
+  guint64 previous_raw = (series->n_samples > 0) ? series->last_raw : 0;
+
+  append_varint (series->history, zigzag_encode (time - previous_time));
+  append_varint (series->history,
+                 encode_value (series->kind, previous_raw, raw));
+
+  if (series->n_samples == 0)
+    {
+      series->first_time = time;
+    }
+  else if (raw != previous_raw)
+    {
+      series->n_transitions++;
+
+      if (series->have_before_last && raw == series->before_last_raw)
+        series->n_oscillations++;
+
+      series->before_last_raw = previous_raw;
+      series->have_before_last = TRUE;
+    }
+
+  series->n_samples++;
+  series->last_time = time;
+  series->last_raw = raw;
+}
+
+/* Sample the current value of the property on the object. */
+static void
+series_sample (Series *series)
+{
+  g_auto(GValue) value = G_VALUE_INIT;
+
+  g_value_init (&value, series->pspec->value_type);
+  g_object_get_property (series->obj, series->pspec->name, &value);
+
+  series_add_sample (series, get_time (series->recorder), value_to_raw (&value));
+}
+
+/* Clear the history of @series, and start it again from the current value of
+ * the property. */
+static void
+series_restart (Series *series)
+{
+  g_byte_array_set_size (series->history, 0);
+  series->n_samples = 0;
+  series->n_notifies = 0;
+  series->n_transitions = 0;
+  series->n_oscillations = 0;
+  series->have_before_last = FALSE;
+
+  series_sample (series);
+}
+
+static void
+series_disconnect (Series *series)
+{
+  if (series->notify_id != 0)
+    g_signal_handler_disconnect (series->obj, series->notify_id);
+  series->notify_id = 0;
+
+  if (series->alive)
+    g_object_weak_unref (series->obj, weak_notify_cb, series);
+  series->alive = FALSE;
+}
+
+static void
+series_free (Series *series)
+{
+  series_disconnect (series);
+
+  g_byte_array_unref (series->history);
+  g_param_spec_unref (series->pspec);
+  g_free (series->obj_type_name);
+  g_free (series);
+}
+
+static void
+notify_cb (GObject    *obj,
+           GParamSpec *pspec,
+           gpointer    user_data)
+{
+  Series *series = user_data;
+
+  series->n_notifies++;
+  series_sample (series);
+}
+
+static void
+weak_notify_cb (gpointer  user_data,
+                GObject  *where_the_object_was)
+{
+  Series *series = user_data;
+
+  /* The signal handler has already been disconnected by the object. */
+  series->notify_id = 0;
+  series->alive = FALSE;
+  series->end_time = get_time (series->recorder);
+}
+
+/* Find the series for @property_name on @obj. Later series take precedence,
+ * in case @obj is a new object which reuses the address of a finalised one. */
+static Series *
+find_series (GtPropertyRecorder *self,
+             gpointer            obj,
+             const gchar        *property_name)
+{
+  g_autofree gchar *canonical_name = g_strdelimit (g_strdup (property_name), "_", '-');
+
+  for (guint i = self->series->len; i > 0; i--)
+    {
+      Series *series = g_ptr_array_index (self->series, i - 1);
+
+      if (series->obj == obj &&
+          g_str_equal (series->pspec->name, canonical_name))
+        return series;
+    }
+
+  return NULL;
+}
+
+/* Get the time the history of @series ends: now, or when its object was
+ * finalised. */
+static gint64
+series_get_end_time (const Series *series)
+{
+  return series->alive ? get_time (series->recorder) : series->end_time;
+}
+
+/**
+ * gt_property_recorder_new:
+ * @clock: (nullable) (transfer none): a #GtVirtualClock to take timestamps
+ *    from, or %NULL to use g_get_monotonic_time(); it must outlive the
+ *    recorder
+ *
+ * Create a new #GtPropertyRecorder. Use gt_property_recorder_watch() to start
+ * recording properties.
+ *
+ * Returns: (transfer full): a new #GtPropertyRecorder
+ * Since: 0.2.0
+ */
+GtPropertyRecorder *
+gt_property_recorder_new (GtVirtualClock *clock)
+{
+  g_autoptr(GtPropertyRecorder) recorder = NULL;
+
+  recorder = g_new0 (GtPropertyRecorder, 1);
+  recorder->clock = clock;
+  recorder->series = g_ptr_array_new_with_free_func ((GDestroyNotify) series_free);
+
+  return g_steal_pointer (&recorder);
+}
+
+/**
+ * gt_property_recorder_free:
+ * @self: (transfer full): a #GtPropertyRecorder
+ *
+ * Free a #GtPropertyRecorder, and stop recording all the properties it is
+ * watching.
+ *
+ * Since: 0.2.0
+ */
+void
+gt_property_recorder_free (GtPropertyRecorder *self)
+{
+  g_return_if_fail (self != NULL);
+
+  g_clear_pointer (&self->series, g_ptr_array_unref);
+
+  g_free (self);
+}
+
+/**
+ * gt_property_recorder_watch:
+ * @self: a #GtPropertyRecorder
+ * @obj: (type GObject): a #GObject to watch
+ * @property_name: name of a readable property on @obj
+ *
+ * Start recording the value of @property_name on @obj. Its current value is
+ * recorded as the first sample in its history, and a new sample is recorded
+ * whenever #GObject::notify is emitted for it.
+ *
+ * The property must have a boolean, integer, enum, flags, floating point or
+ * string type. No reference is held on @obj.
+ *
+ * Since: 0.2.0
+ */
+void
+gt_property_recorder_watch (GtPropertyRecorder *self,
+                            gpointer            obj,
+                            const gchar        *property_name)
+{
+  GParamSpec *pspec;
+  ValueKind kind;
+  g_autofree gchar *detailed_signal = NULL;
+  Series *series;
+
+  g_return_if_fail (self != NULL);
+  g_return_if_fail (G_IS_OBJECT (obj));
+  g_return_if_fail (property_name != NULL);
+
+  pspec = g_object_class_find_property (G_OBJECT_GET_CLASS (obj), property_name);
+  g_return_if_fail (pspec != NULL);
+  g_return_if_fail (pspec->flags & G_PARAM_READABLE);
+
+  if (!value_kind_for_type (pspec->value_type, &kind))
+    {
+      g_critical ("%s: Property %s:%s has type %s, which can’t be recorded",
+                  G_STRFUNC, G_OBJECT_TYPE_NAME (obj), pspec->name,
+                  g_type_name (pspec->value_type));
+      return;
+    }
+
+  series = find_series (self, obj, pspec->name);
+  g_return_if_fail (series == NULL || !series->alive);
+
+  series = g_new0 (Series, 1);
+  series->recorder = self;
+  series->obj = obj;
+  series->obj_type_name = g_strdup (G_OBJECT_TYPE_NAME (obj));
+  series->alive = TRUE;
+  series->pspec = g_param_spec_ref (pspec);
+  series->kind = kind;
+  series->history = g_byte_array_new ();
+
+  g_ptr_array_add (self->series, series);
+
+  series_sample (series);
+
+  detailed_signal = g_strdup_printf ("notify::%s", pspec->name);
+  series->notify_id = g_signal_connect (obj, detailed_signal,
+                                        G_CALLBACK (notify_cb), series);
+  g_object_weak_ref (obj, weak_notify_cb, series);
+}
+
+/**
+ * gt_property_recorder_reset:
+ * @self: a #GtPropertyRecorder
+ *
+ * Clear the histories of all the properties being watched, and start them
+ * again from the current values of the properties. Properties on objects which
+ * have been finalised are forgotten.
+ *
+ * This can be used to check a single operation on an object after setting it
+ * up.
+ *
+ * Since: 0.2.0
+ */
+void
+gt_property_recorder_reset (GtPropertyRecorder *self)
+{
+  g_return_if_fail (self != NULL);
+
+  for (guint i = self->series->len; i > 0; i--)
+    {
+      Series *series = g_ptr_array_index (self->series, i - 1);
+
+      if (series->alive)
+        series_restart (series);
+      else
+        g_ptr_array_remove_index (self->series, i - 1);
+    }
+}
+
+/**
+ * gt_property_recorder_get_n_notifies:
+ * @self: a #GtPropertyRecorder
+ * @obj: (type GObject): object being watched
+ * @property_name: name of the watched property on @obj
+ *
+ * Get the number of times #GObject::notify has been emitted for
+ * @property_name on @obj since it started being watched, or since
+ * gt_property_recorder_reset() was last called. This includes notifications
+ * where the value didn’t change, so comparing it with
+ * gt_property_recorder_get_n_transitions() shows how many were redundant.
+ *
+ * Returns: number of notifications
+ * Since: 0.2.0
+ */
+guint
+gt_property_recorder_get_n_notifies (GtPropertyRecorder *self,
+                                     gpointer            obj,
+                                     const gchar        *property_name)
+{
+  Series *series;
+
+  g_return_val_if_fail (self != NULL, 0);
+  g_return_val_if_fail (property_name != NULL, 0);
+
+  series = find_series (self, obj, property_name);
+  g_return_val_if_fail (series != NULL, 0);
+
+  return series->n_notifies;
+}
+
+/**
+ * gt_property_recorder_get_n_transitions:
+ * @self: a #GtPropertyRecorder
+ * @obj: (type GObject): object being watched
+ * @property_name: name of the watched property on @obj
+ *
+ * Get the number of times the value of @property_name on @obj has changed
+ * since it started being watched, or since gt_property_recorder_reset() was
+ * last called. Changes are only seen when the property is notified.
+ *
+ * Returns: number of transitions
+ * Since: 0.2.0
+ */
+guint
+gt_property_recorder_get_n_transitions (GtPropertyRecorder *self,
+                                        gpointer            obj,
+                                        const gchar        *property_name)
+{
+  Series *series;
+
+  g_return_val_if_fail (self != NULL, 0);
+  g_return_val_if_fail (property_name != NULL, 0);
+
+  series = find_series (self, obj, property_name);
+  g_return_val_if_fail (series != NULL, 0);
+
+  return series->n_transitions;
+}
+
+/**
+ * gt_property_recorder_get_n_oscillations:
+ * @self: a #GtPropertyRecorder
+ * @obj: (type GObject): object being watched
+ * @property_name: name of the watched property on @obj
+ *
+ * Get the number of transitions of @property_name on @obj which changed it
+ * back to the value it had before the previous transition. For example, a
+ * property which changes `A → B → A → B` has three transitions and two
+ * oscillations.
+ *
+ * Returns: number of oscillations
+ * Since: 0.2.0
+ */
+guint
+gt_property_recorder_get_n_oscillations (GtPropertyRecorder *self,
+                                         gpointer            obj,
+                                         const gchar        *property_name)
+{
+  Series *series;
+
+  g_return_val_if_fail (self != NULL, 0);
+  g_return_val_if_fail (property_name != NULL, 0);
+
+  series = find_series (self, obj, property_name);
+  g_return_val_if_fail (series != NULL, 0);
+
+  return series->n_oscillations;
+}
+
+/**
+ * gt_property_recorder_get_oscillations_per_second:
+ * @self: a #GtPropertyRecorder
+ * @obj: (type GObject): object being watched
+ * @property_name: name of the watched property on @obj
+ *
+ * Get the rate at which @property_name on @obj has oscillated, as the number
+ * of oscillations (see gt_property_recorder_get_n_oscillations()) divided by
+ * the length of its history. The history ends now, or when @obj was
+ * finalised.
+ *
+ * Returns: oscillations per second, or 0.0 if the history is empty
+ * Since: 0.2.0
+ */
+gdouble
+gt_property_recorder_get_oscillations_per_second (GtPropertyRecorder *self,
+                                                  gpointer            obj,
+                                                  const gchar        *property_name)
+{
+  Series *series;
+  gint64 duration_us;
+
+  g_return_val_if_fail (self != NULL, 0.0);
+  g_return_val_if_fail (property_name != NULL, 0.0);
+
+  series = find_series (self, obj, property_name);
+  g_return_val_if_fail (series != NULL, 0.0);
+
+  duration_us = series_get_end_time (series) - series->first_time;
+  if (duration_us <= 0)
+    return 0.0;
+
+  return (gdouble) series->n_oscillations * G_USEC_PER_SEC / (gdouble) duration_us;
+}
+
+/**
+ * gt_property_recorder_get_value_at:
+ * @self: a #GtPropertyRecorder
+ * @obj: (type GObject): object being watched
+ * @property_name: name of the watched property on @obj
+ * @time_us: time to get the value at, in microseconds, in the same time base
+ *    as the recorder’s clock
+ * @value: (out caller-allocates): an uninitialised #GValue to return the
+ *    value in
+ *
+ * Get the value @property_name on @obj had at @time_us, according to its
+ * history. If @time_us is after the last sample, the last value recorded is
+ * returned.
+ *
+ * Returns: %TRUE if @value was set, %FALSE if @time_us is before the start of
+ *    the property’s history
+ * Since: 0.2.0
+ */
+gboolean
+gt_property_recorder_get_value_at (GtPropertyRecorder *self,
+                                   gpointer            obj,
+                                   const gchar        *property_name,
+                                   gint64              time_us,
+                                   GValue             *value)
+{
+  Series *series;
+  SeriesIter iter;
+  gboolean found = FALSE;
+  guint64 raw = 0;
+
+  g_return_val_if_fail (self != NULL, FALSE);
+  g_return_val_if_fail (property_name != NULL, FALSE);
+  g_return_val_if_fail (value != NULL && !G_IS_VALUE (value), FALSE);
+
+  series = find_series (self, obj, property_name);
+  g_return_val_if_fail (series != NULL, FALSE);
+
+  series_iter_init (&iter, series);
+
+  while (series_iter_next (&iter) && iter.time <= time_us)
+    {
+      raw = iter.raw;
+      found = TRUE;
+    }
+
+  if (found)
+    value_from_raw (value, series->pspec->value_type, raw);
+
+  return found;
+}
+
+/**
+ * gt_property_recorder_get_time_in_state:
+ * @self: a #GtPropertyRecorder
+ * @obj: (type GObject): object being watched
+ * @property_name: name of the watched property on @obj
+ * @value: a value of the property’s type
+ *
+ * Get the total time @property_name on @obj has had the given @value, over its
+ * whole history. The history ends now, or when @obj was finalised.
+ *
+ * Returns: time spent with @value, in microseconds
+ * Since: 0.2.0
+ */
+gint64
+gt_property_recorder_get_time_in_state (GtPropertyRecorder *self,
+                                        gpointer            obj,
+                                        const gchar        *property_name,
+                                        const GValue       *value)
+{
+  Series *series;
+  SeriesIter iter;
+  guint64 wanted_raw;
+  gint64 total_us = 0;
+  gint64 state_start_us = 0;
+  gboolean in_state = FALSE;
+
+  g_return_val_if_fail (self != NULL, 0);
+  g_return_val_if_fail (property_name != NULL, 0);
+  g_return_val_if_fail (G_IS_VALUE (value), 0);
+
+  series = find_series (self, obj, property_name);
+  g_return_val_if_fail (series != NULL, 0);
+  g_return_val_if_fail (G_TYPE_FUNDAMENTAL (G_VALUE_TYPE (value)) ==
+                        G_TYPE_FUNDAMENTAL (series->pspec->value_type), 0);
+
+  wanted_raw = value_to_raw (value);
+
+  series_iter_init (&iter, series);
+
+  while (series_iter_next (&iter))
+    {
+      if (in_state && iter.raw != wanted_raw)
+        {
+          total_us += iter.time - state_start_us;
+          in_state = FALSE;
+        }
+      else if (!in_state && iter.raw == wanted_raw)
+        {
+          state_start_us = iter.time;
+          in_state = TRUE;
+        }
+    }
+
+  if (in_state)
+    total_us += series_get_end_time (series) - state_start_us;
+
+  return total_us;
+}
+
+/**
+ * gt_property_recorder_get_history_size:
+ * @self: a #GtPropertyRecorder
+ * @obj: (type GObject): object being watched
+ * @property_name: name of the watched property on @obj
+ *
+ * Get the number of bytes used to store the history of @property_name on
+ * @obj, not including fixed overheads.
+ *
+ * Returns: size of the encoded history, in bytes
+ * Since: 0.2.0
+ */
+gsize
+gt_property_recorder_get_history_size (GtPropertyRecorder *self,
+                                       gpointer            obj,
+                                       const gchar        *property_name)
+{
+  Series *series;
+
+  g_return_val_if_fail (self != NULL, 0);
+  g_return_val_if_fail (property_name != NULL, 0);
+
+  series = find_series (self, obj, property_name);
+  g_return_val_if_fail (series != NULL, 0);
+
+  return series->history->len;
+}
+
+/**
+ * gt_property_recorder_format_history:
+ * @self: a #GtPropertyRecorder
+ * @obj: (type GObject): object being watched
+ * @property_name: name of the watched property on @obj
+ *
+ * Format the history of @property_name on @obj as a human-readable string for
+ * debug output, with one sample per line. Times are relative to the first
+ * sample.
+ *
+ * Returns: (transfer full): human-readable history
+ * Since: 0.2.0
+ */
+gchar *
+gt_property_recorder_format_history (GtPropertyRecorder *self,
+                                     gpointer            obj,
+                                     const gchar        *property_name)
+{
+  g_autoptr(GString) str = g_string_new ("");
+  Series *series;
+  SeriesIter iter;
+
+  g_return_val_if_fail (self != NULL, NULL);
+  g_return_val_if_fail (property_name != NULL, NULL);
+
+  series = find_series (self, obj, property_name);
+  g_return_val_if_fail (series != NULL, NULL);
+
+  series_iter_init (&iter, series);
+
+  while (series_iter_next (&iter))
+    {
+      g_auto(GValue) value = G_VALUE_INIT;
+      g_autofree gchar *value_str = NULL;
+
+      value_from_raw (&value, series->pspec->value_type, iter.raw);
+      value_str = g_strdup_value_contents (&value);
+
+      g_string_append_printf (str, " • +%" G_GINT64_FORMAT " µs: %s\n",
+                              iter.time - series->first_time, value_str);
+    }
+
+  if (!series->alive)
+    g_string_append_printf (str, " • +%" G_GINT64_FORMAT " µs: finalised\n",
+                            series->end_time - series->first_time);
+
+  return g_string_free (g_steal_pointer (&str), FALSE);
+}
+
+/**
+ * gt_property_recorder_format:
+ * @self: a #GtPropertyRecorder
+ *
+ * Format a summary of all the properties being watched by @self, one per line,
+ * as a human-readable string for debug output.
+ *
+ * Returns: (transfer full): human-readable summary
+ * Since: 0.2.0
+ */
+gchar *
+gt_property_recorder_format (GtPropertyRecorder *self)
+{
+  g_autoptr(GString) str = g_string_new ("");
+
+  g_return_val_if_fail (self != NULL, NULL);
+
+  for (guint i = 0; i < self->series->len; i++)
+    {
+      const Series *series = g_ptr_array_index (self->series, i);
+      gint64 duration_us = series_get_end_time (series) - series->first_time;
+
+      g_string_append_printf (str, " • %s %p:%s: %u notifies, %u transitions, "
+                              "%u oscillations over %" G_GINT64_FORMAT " µs "
+                              "(%u bytes)%s\n",
+                              series->obj_type_name, series->obj,
+                              series->pspec->name, series->n_notifies,
+                              series->n_transitions, series->n_oscillations,
+                              duration_us, series->history->len,
+                              series->alive ? "" : " (finalised)");
+    }
+
+  return g_string_free (g_steal_pointer (&str), FALSE);
+}
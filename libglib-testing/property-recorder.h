@@ -0,0 +1,137 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ *
+ * Copyright © 2018 Endless Mobile, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#pragma once
+
+#include <glib.h>
+#include <glib-object.h>
+#include <libglib-testing/virtual-clock.h>
+
+G_BEGIN_DECLS
+
+typedef struct _GtPropertyRecorder GtPropertyRecorder;
+
+GtPropertyRecorder *gt_property_recorder_new  (GtVirtualClock     *clock);
+void                gt_property_recorder_free (GtPropertyRecorder *self);
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC (GtPropertyRecorder, gt_property_recorder_free)
+
+void     gt_property_recorder_watch                       (GtPropertyRecorder *self,
+                                                           gpointer            obj,
+                                                           const gchar        *property_name);
+void     gt_property_recorder_reset                       (GtPropertyRecorder *self);
+
+guint    gt_property_recorder_get_n_notifies              (GtPropertyRecorder *self,
+                                                           gpointer            obj,
+                                                           const gchar        *property_name);
+guint    gt_property_recorder_get_n_transitions           (GtPropertyRecorder *self,
+                                                           gpointer            obj,
+                                                           const gchar        *property_name);
+guint    gt_property_recorder_get_n_oscillations          (GtPropertyRecorder *self,
+                                                           gpointer            obj,
+                                                           const gchar        *property_name);
+gdouble  gt_property_recorder_get_oscillations_per_second (GtPropertyRecorder *self,
+                                                           gpointer            obj,
+                                                           const gchar        *property_name);
+gboolean gt_property_recorder_get_value_at                (GtPropertyRecorder *self,
+                                                           gpointer            obj,
+                                                           const gchar        *property_name,
+                                                           gint64              time_us,
+                                                           GValue             *value);
+gint64   gt_property_recorder_get_time_in_state           (GtPropertyRecorder *self,
+                                                           gpointer            obj,
+                                                           const gchar        *property_name,
+                                                           const GValue       *value);
+gsize    gt_property_recorder_get_history_size            (GtPropertyRecorder *self,
+                                                           gpointer            obj,
+                                                           const gchar        *property_name);
+
+gchar   *gt_property_recorder_format_history              (GtPropertyRecorder *self,
+                                                           gpointer            obj,
+                                                           const gchar        *property_name);
+gchar   *gt_property_recorder_format                      (GtPropertyRecorder *self);
+
+/**
+ * gt_property_recorder_assert_transitions_at_most:
+ * @self: a #GtPropertyRecorder
+ * @obj: object being watched
+ * @property_name: name of the watched property on @obj
+ * @max: maximum number of transitions expected
+ *
+ * Assert that the value of @property_name on @obj has changed at most @max
+ * times since it started being watched, or since
+ * gt_property_recorder_reset() was last called.
+ *
+ * If it has changed more often, an assertion fails and the property’s history
+ * is printed.
+ *
+ * Since: 0.2.0
+ */
+#define gt_property_recorder_assert_transitions_at_most(self, obj, property_name, max) \
+  G_STMT_START { \
+    guint at_n_transitions = \
+        gt_property_recorder_get_n_transitions (self, obj, property_name); \
+    guint at_max = (max); \
+    if (at_n_transitions > at_max) \
+      { \
+        g_autofree gchar *at_history = \
+            gt_property_recorder_format_history (self, obj, property_name); \
+        g_autofree gchar *at_message = \
+            g_strdup_printf ("Expected at most %u transitions of %s, but " \
+                             "saw %u:\n%s", at_max, (property_name), \
+                             at_n_transitions, at_history); \
+        g_assertion_message (G_LOG_DOMAIN, __FILE__, __LINE__, G_STRFUNC, \
+                             at_message); \
+      } \
+  } G_STMT_END
+
+/**
+ * gt_property_recorder_assert_no_oscillations:
+ * @self: a #GtPropertyRecorder
+ * @obj: object being watched
+ * @property_name: name of the watched property on @obj
+ *
+ * Assert that the value of @property_name on @obj has never changed back to
+ * the value it had before its previous change, since it started being watched
+ * or since gt_property_recorder_reset() was last called. See
+ * gt_property_recorder_get_n_oscillations().
+ *
+ * If it has, an assertion fails and the property’s history is printed.
+ *
+ * Since: 0.2.0
+ */
+#define gt_property_recorder_assert_no_oscillations(self, obj, property_name) \
+  G_STMT_START { \
+    guint ao_n_oscillations = \
+        gt_property_recorder_get_n_oscillations (self, obj, property_name); \
+    if (ao_n_oscillations > 0) \
+      { \
+        g_autofree gchar *ao_history = \
+            gt_property_recorder_format_history (self, obj, property_name); \
+        g_autofree gchar *ao_message = \
+            g_strdup_printf ("Expected %s not to oscillate, but it changed " \
+                             "back %u times:\n%s", (property_name), \
+                             ao_n_oscillations, ao_history); \
+        g_assertion_message (G_LOG_DOMAIN, __FILE__, __LINE__, G_STRFUNC, \
+                             ao_message); \
+      } \
+  } G_STMT_END
+
+G_END_DECLS
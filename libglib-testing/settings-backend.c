@@ -0,0 +1,967 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ *
+ * Copyright © 2018 Endless Mobile, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+#include "config.h"
+
+/* #GSettingsBackend is only available if the caller acknowledges that its API
+ * is not stable. */
+#define G_SETTINGS_ENABLE_BACKEND
+
+#include <gio/gio.h>
+#include <gio/gsettingsbackend.h>
+#include <glib.h>
+#include <glib-object.h>
+#include <libglib-testing/settings-backend.h>
+
+
+/**
+ * SECTION:settings-backend
+ * @short_description: In-memory GSettings backend with write accounting
+ * @stability: Unstable
+ * @include: libglib-testing/settings-backend.h
+ *
+ * #GtSettingsBackend is an in-memory #GSettingsBackend for use in tests, so
+ * that code which uses #GSettings can be tested without touching the disk or
+ * the user’s real settings, and so that the writes it makes can be checked.
+ *
+ * Pass the backend returned by gt_settings_backend_get_backend() to
+ * g_settings_new_with_backend() (or g_settings_new_full()) to create a
+ * #GSettings object which uses it. All keys start out unset, so reads return
+ * the schema defaults.
+ *
+ * Every write which reaches the backend’s storage is counted, per key. A write
+ * which sets a key to the value it already had is additionally counted as
+ * redundant, as it causes work (and, with a real backend, disk I/O) for no
+ * effect. The counts can be queried with gt_settings_backend_get_n_writes()
+ * and gt_settings_backend_get_n_redundant_writes(), and checked using
+ * gt_settings_backend_assert_writes_at_most() and
+ * gt_settings_backend_assert_no_redundant_writes().
+ *
+ * Each write is also added to a queue of change notifications, which can be
+ * checked by popping changes off it, in the same way as #GtSignalLogger: see
+ * gt_settings_backend_assert_change_pop() and
+ * gt_settings_backend_assert_no_changes().
+ *
+ * Writes can be batched by calling gt_settings_backend_delay(). Until
+ * gt_settings_backend_apply() is called, writes are held as pending changes:
+ * they are visible to reads and #GSettings::changed is emitted for them, but
+ * they are not written to storage, counted, or added to the change queue.
+ * When the changes are applied, each pending key is written once, no matter
+ * how many times it was changed while delayed. This simulates the coalescing
+ * done by real backends, such as dconf, and by g_settings_delay().
+ *
+ * By default, a #GtSettingsBackend will not assert that its change queue is
+ * empty on destruction: that is up to the caller, and it is highly recommended
+ * that gt_settings_backend_assert_no_changes() is called before it is
+ * destroyed, or after a particular unit test is completed.
+ *
+ * Since: 0.2.0
+ */
+
+#define GT_TYPE_SETTINGS_BACKEND_OBJECT gt_settings_backend_object_get_type ()
+G_DECLARE_FINAL_TYPE (GtSettingsBackendObject, gt_settings_backend_object, GT,
+                      SETTINGS_BACKEND_OBJECT, GSettingsBackend)
+
+/* A change notification, or a pending change while delayed. */
+typedef struct
+{
+  gchar *key;  /* (owned) */
+  GVariant *value;  /* (owned) (nullable); %NULL if the key was reset */
+} Change;
+
+/* Write counts for a key. */
+typedef struct
+{
+  guint n_writes;
+  guint n_redundant_writes;
+} KeyStats;
+
+/* The #GSettingsBackend implementation. All the state is kept here, rather
+ * than in #GtSettingsBackend, as #GSettings objects may keep the backend alive
+ * after the #GtSettingsBackend is freed, and its methods may be called from
+ * any thread. */
+struct _GtSettingsBackendObject
+{
+  GSettingsBackend parent;
+
+  GMutex lock;
+  GHashTable *values;  /* (owned) (element-type utf8 GVariant) (locked-by lock) */
+  GHashTable *stats;  /* (owned) (element-type utf8 KeyStats) (locked-by lock) */
+  GPtrArray *changes;  /* (owned) (element-type Change) (locked-by lock) */
+  gboolean delayed;  /* (locked-by lock) */
+  GHashTable *pending;  /* (owned) (element-type utf8 GVariant) (nullable) (locked-by lock) */
+};
+
+G_DEFINE_TYPE (GtSettingsBackendObject, gt_settings_backend_object,
+               G_TYPE_SETTINGS_BACKEND)
+
+/**
+ * GtSettingsBackend:
+ *
+ * An in-memory #GSettingsBackend which counts the writes made to it and
+ * queues change notifications for them.
+ *
+ * Since: 0.2.0
+ */
+struct _GtSettingsBackend
+{
+  GtSettingsBackendObject *backend;  /* (owned) */
+};
+
+static void
+change_free (Change *change)
+{
+  g_free (change->key);
+  g_clear_pointer (&change->value, g_variant_unref);
+  g_free (change);
+}
+
+static Change *
+change_new (const gchar *key,
+            GVariant    *value)
+{
+  Change *change = g_new0 (Change, 1);
+
+  change->key = g_strdup (key);
+  change->value = (value != NULL) ? g_variant_ref_sink (value) : NULL;
+
+  return change;
+}
+
+static void
+variant_unref0 (gpointer data)
+{
+  if (data != NULL)
+    g_variant_unref (data);
+}
+
+/* Write @value (or reset, if @value is %NULL) to storage for @key, counting the
+ * write and queueing a change notification for it. */
+static void
+commit_locked (GtSettingsBackendObject *self,
+               const gchar             *key,
+               GVariant                *value)
+{
+  GVariant *old_value = g_hash_table_lookup (self->values, key);
+  KeyStats *stats = g_hash_table_lookup (self->stats, key);
+
+  if (stats == NULL)
+    {
+      stats = g_new0 (KeyStats, 1);
+      g_hash_table_insert (self->stats, g_strdup (key), stats);
+    }
+
+  stats->n_writes++;
+
+  if ((old_value == NULL && value == NULL) ||
+      (old_value != NULL && value != NULL && g_variant_equal (old_value, value)))
+    stats->n_redundant_writes++;
+
+  if (value != NULL)
+    g_hash_table_insert (self->values, g_strdup (key), g_variant_ref_sink (value));
+  else
+    g_hash_table_remove (self->values, key);
+
+  g_ptr_array_add (self->changes, change_new (key, value));
+}
+
+/* Write @value (or reset, if @value is %NULL) for @key, either to storage or
+ * to the pending changes if delayed. */
+static void
+write_locked (GtSettingsBackendObject *self,
+              const gchar             *key,
+              GVariant                *value)
+{
+  if (self->delayed)
+    g_hash_table_insert (self->pending, g_strdup (key),
+                         (value != NULL) ? g_variant_ref_sink (value) : NULL);
+  else
+    commit_locked (self, key, value);
+}
+
+static GVariant *
+gt_settings_backend_object_read (GSettingsBackend   *backend,
+                                 const gchar        *key,
+                                 const GVariantType *expected_type,
+                                 gboolean            default_value)
+{
+  GtSettingsBackendObject *self = GT_SETTINGS_BACKEND_OBJECT (backend);
+  GVariant *value;
+
+  /* There are no defaults other than those in the schema. */
+  if (default_value)
+    return NULL;
+
+  g_mutex_lock (&self->lock);
+
+  if (self->pending != NULL && g_hash_table_contains (self->pending, key))
+    value = g_hash_table_lookup (self->pending, key);
+  else
+    value = g_hash_table_lookup (self->values, key);
+
+  if (value != NULL && g_variant_is_of_type (value, expected_type))
+    g_variant_ref (value);
+  else
+    value = NULL;
+
+  g_mutex_unlock (&self->lock);
+
+  return value;
+}
+
+static gboolean
+gt_settings_backend_object_get_writable (GSettingsBackend *backend,
+                                         const gchar      *key)
+{
+  return TRUE;
+}
+
+static gboolean
+gt_settings_backend_object_write (GSettingsBackend *backend,
+                                  const gchar      *key,
+                                  GVariant         *value,
+                                  gpointer          origin_tag)
+{
+  GtSettingsBackendObject *self = GT_SETTINGS_BACKEND_OBJECT (backend);
+
+  g_mutex_lock (&self->lock);
+  write_locked (self, key, value);
+  g_mutex_unlock (&self->lock);
+
+  g_settings_backend_changed (backend, key, origin_tag);
+
+  return TRUE;
+}
+
+static gboolean
+write_tree_cb (gpointer key,
+               gpointer value,
+               gpointer user_data)
+{
+  GtSettingsBackendObject *self = GT_SETTINGS_BACKEND_OBJECT (user_data);
+
+  write_locked (self, key, value);
+
+  return FALSE;
+}
+
+static gboolean
+gt_settings_backend_object_write_tree (GSettingsBackend *backend,
+                                       GTree            *tree,
+                                       gpointer          origin_tag)
+{
+  GtSettingsBackendObject *self = GT_SETTINGS_BACKEND_OBJECT (backend);
+
+  /* The tree is sorted by key, so the changes are queued in key order. */
+  g_mutex_lock (&self->lock);
+  g_tree_foreach (tree, write_tree_cb, self);
+  g_mutex_unlock (&self->lock);
+
+  g_settings_backend_changed_tree (backend, tree, origin_tag);
+
+  return TRUE;
+}
+
+static void
+gt_settings_backend_object_reset (GSettingsBackend *backend,
+                                  const gchar      *key,
+                                  gpointer          origin_tag)
+{
+  GtSettingsBackendObject *self = GT_SETTINGS_BACKEND_OBJECT (backend);
+
+  g_mutex_lock (&self->lock);
+  write_locked (self, key, NULL);
+  g_mutex_unlock (&self->lock);
+
+  g_settings_backend_changed (backend, key, origin_tag);
+}
+
+static GPermission *
+gt_settings_backend_object_get_permission (GSettingsBackend *backend,
+                                           const gchar      *path)
+{
+  return g_simple_permission_new (TRUE);
+}
+
+static void
+gt_settings_backend_object_finalize (GObject *object)
+{
+  GtSettingsBackendObject *self = GT_SETTINGS_BACKEND_OBJECT (object);
+
+  g_clear_pointer (&self->pending, g_hash_table_unref);
+  g_clear_pointer (&self->changes, g_ptr_array_unref);
+  g_clear_pointer (&self->stats, g_hash_table_unref);
+  g_clear_pointer (&self->values, g_hash_table_unref);
+  g_mutex_clear (&self->lock);
+
+  G_OBJECT_CLASS (gt_settings_backend_object_parent_class)->finalize (object);
+}
+
+static void
+gt_settings_backend_object_class_init (GtSettingsBackendObjectClass *klass)
+{
+  GObjectClass *object_class = G_OBJECT_CLASS (klass);
+  GSettingsBackendClass *backend_class = G_SETTINGS_BACKEND_CLASS (klass);
+
+  object_class->finalize = gt_settings_backend_object_finalize;
+
+  backend_class->read = gt_settings_backend_object_read;
+  backend_class->get_writable = gt_settings_backend_object_get_writable;
+  backend_class->write = gt_settings_backend_object_write;
+  backend_class->write_tree = gt_settings_backend_object_write_tree;
+  backend_class->reset = gt_settings_backend_object_reset;
+  backend_class->get_permission = gt_settings_backend_object_get_permission;
+}
+
+static void
+gt_settings_backend_object_init (GtSettingsBackendObject *self)
+{
+  g_mutex_init (&self->lock);
+  self->values = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                        g_free, (GDestroyNotify) g_variant_unref);
+  self->stats = g_hash_table_new_full (g_str_hash, g_str_equal, g_free, g_free);
+  self->changes = g_ptr_array_new_with_free_func ((GDestroyNotify) change_free);
+}
+
+/**
+ * gt_settings_backend_new:
+ *
+ * Create a new #GtSettingsBackend, with all its keys unset.
+ *
+ * Returns: (transfer full): a new #GtSettingsBackend
+ * Since: 0.2.0
+ */
+GtSettingsBackend *
+gt_settings_backend_new (void)
+{
+  g_autoptr(GtSettingsBackend) self = g_new0 (GtSettingsBackend, 1);
+
+  self->backend = g_object_new (GT_TYPE_SETTINGS_BACKEND_OBJECT, NULL);
+
+  return g_steal_pointer (&self);
+}
+
+/**
+ * gt_settings_backend_free:
+ * @self: (transfer full): a #GtSettingsBackend
+ *
+ * Free a #GtSettingsBackend. The #GSettingsBackend returned by
+ * gt_settings_backend_get_backend() stays valid for as long as any #GSettings
+ * objects using it exist, but can no longer be inspected.
+ *
+ * Since: 0.2.0
+ */
+void
+gt_settings_backend_free (GtSettingsBackend *self)
+{
+  g_return_if_fail (self != NULL);
+
+  g_clear_object (&self->backend);
+  g_free (self);
+}
+
+/**
+ * gt_settings_backend_get_backend:
+ * @self: a #GtSettingsBackend
+ *
+ * Get the #GSettingsBackend implemented by @self, to pass to
+ * g_settings_new_with_backend().
+ *
+ * Returns: (transfer none): the #GSettingsBackend
+ * Since: 0.2.0
+ */
+GSettingsBackend *
+gt_settings_backend_get_backend (GtSettingsBackend *self)
+{
+  g_return_val_if_fail (self != NULL, NULL);
+
+  return G_SETTINGS_BACKEND (self->backend);
+}
+
+/**
+ * gt_settings_backend_dup_value:
+ * @self: a #GtSettingsBackend
+ * @key: full path of the key to look up, such as `/org/example/app/key`
+ *
+ * Get the value of @key, including any pending changes made while delayed
+ * (see gt_settings_backend_delay()). This does not count as a read or write.
+ *
+ * Returns: (transfer full) (nullable): the value of @key, or %NULL if it is
+ *    unset
+ * Since: 0.2.0
+ */
+GVariant *
+gt_settings_backend_dup_value (GtSettingsBackend *self,
+                               const gchar       *key)
+{
+  GtSettingsBackendObject *backend;
+  GVariant *value;
+
+  g_return_val_if_fail (self != NULL, NULL);
+  g_return_val_if_fail (key != NULL, NULL);
+
+  backend = self->backend;
+
+  g_mutex_lock (&backend->lock);
+
+  if (backend->pending != NULL && g_hash_table_contains (backend->pending, key))
+    value = g_hash_table_lookup (backend->pending, key);
+  else
+    value = g_hash_table_lookup (backend->values, key);
+
+  if (value != NULL)
+    g_variant_ref (value);
+
+  g_mutex_unlock (&backend->lock);
+
+  return value;
+}
+
+/**
+ * gt_settings_backend_delay:
+ * @self: a #GtSettingsBackend
+ *
+ * Start batching writes to @self. Until gt_settings_backend_apply() or
+ * gt_settings_backend_revert() is called, writes are held as pending changes,
+ * rather than being written to storage. See the section documentation for
+ * details.
+ *
+ * Calling this while already delayed does nothing.
+ *
+ * Since: 0.2.0
+ */
+void
+gt_settings_backend_delay (GtSettingsBackend *self)
+{
+  GtSettingsBackendObject *backend;
+
+  g_return_if_fail (self != NULL);
+
+  backend = self->backend;
+
+  g_mutex_lock (&backend->lock);
+
+  if (!backend->delayed)
+    {
+      backend->delayed = TRUE;
+      backend->pending = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                                g_free, variant_unref0);
+    }
+
+  g_mutex_unlock (&backend->lock);
+}
+
+static gint
+compare_strings (gconstpointer a,
+                 gconstpointer b)
+{
+  return g_strcmp0 (*((const gchar * const *) a), *((const gchar * const *) b));
+}
+
+static gint
+compare_changes_by_key (gconstpointer a,
+                        gconstpointer b)
+{
+  const Change *change_a = *((const Change * const *) a);
+  const Change *change_b = *((const Change * const *) b);
+
+  return g_strcmp0 (change_a->key, change_b->key);
+}
+
+/* Stop being delayed, and return the pending changes, sorted by key. */
+static GPtrArray *
+steal_pending_locked (GtSettingsBackendObject *self)
+{
+  g_autoptr(GPtrArray) pending = g_ptr_array_new_with_free_func ((GDestroyNotify) change_free);
+  GHashTableIter iter;
+  gpointer key, value;
+
+  g_hash_table_iter_init (&iter, self->pending);
+  while (g_hash_table_iter_next (&iter, &key, &value))
+    g_ptr_array_add (pending, change_new (key, value));
+
+  g_ptr_array_sort (pending, compare_changes_by_key);
+
+  g_clear_pointer (&self->pending, g_hash_table_unref);
+  self->delayed = FALSE;
+
+  return g_steal_pointer (&pending);
+}
+
+/**
+ * gt_settings_backend_apply:
+ * @self: a #GtSettingsBackend
+ *
+ * Stop batching writes to @self, and write all the pending changes to storage.
+ * Each key which was changed while delayed is written (and counted) once, with
+ * its most recent value, and a change notification is queued for it. Change
+ * notifications are queued in key order.
+ *
+ * It is an error to call this if gt_settings_backend_delay() has not been
+ * called.
+ *
+ * Since: 0.2.0
+ */
+void
+gt_settings_backend_apply (GtSettingsBackend *self)
+{
+  GtSettingsBackendObject *backend;
+  g_autoptr(GPtrArray) pending = NULL;
+  gsize i;
+
+  g_return_if_fail (self != NULL);
+
+  backend = self->backend;
+
+  g_mutex_lock (&backend->lock);
+
+  if (!backend->delayed)
+    {
+      g_mutex_unlock (&backend->lock);
+      g_critical ("%s: Settings backend is not delayed", G_STRFUNC);
+      return;
+    }
+
+  pending = steal_pending_locked (backend);
+
+  for (i = 0; i < pending->len; i++)
+    {
+      const Change *change = g_ptr_array_index (pending, i);
+      commit_locked (backend, change->key, change->value);
+    }
+
+  g_mutex_unlock (&backend->lock);
+
+  /* #GSettings::changed was already emitted for each pending change when it
+   * was made, so there is nothing to notify about here. */
+}
+
+/**
+ * gt_settings_backend_revert:
+ * @self: a #GtSettingsBackend
+ *
+ * Stop batching writes to @self, and discard all the pending changes. Nothing
+ * is written to storage or counted, and #GSettings::changed is emitted for
+ * each key which was changed while delayed, as it has changed back.
+ *
+ * It is an error to call this if gt_settings_backend_delay() has not been
+ * called.
+ *
+ * Since: 0.2.0
+ */
+void
+gt_settings_backend_revert (GtSettingsBackend *self)
+{
+  GtSettingsBackendObject *backend;
+  g_autoptr(GPtrArray) pending = NULL;
+  gsize i;
+
+  g_return_if_fail (self != NULL);
+
+  backend = self->backend;
+
+  g_mutex_lock (&backend->lock);
+
+  if (!backend->delayed)
+    {
+      g_mutex_unlock (&backend->lock);
+      g_critical ("%s: Settings backend is not delayed", G_STRFUNC);
+      return;
+    }
+
+  pending = steal_pending_locked (backend);
+
+  g_mutex_unlock (&backend->lock);
+
+  for (i = 0; i < pending->len; i++)
+    {
+      const Change *change = g_ptr_array_index (pending, i);
+      g_settings_backend_changed (G_SETTINGS_BACKEND (backend), change->key, NULL);
+    }
+}
+
+/**
+ * gt_settings_backend_get_has_unapplied:
+ * @self: a #GtSettingsBackend
+ *
+ * Get whether @self is delayed (see gt_settings_backend_delay()) and has
+ * pending changes which have not yet been applied.
+ *
+ * Returns: %TRUE if there are unapplied changes, %FALSE otherwise
+ * Since: 0.2.0
+ */
+gboolean
+gt_settings_backend_get_has_unapplied (GtSettingsBackend *self)
+{
+  gboolean has_unapplied;
+
+  g_return_val_if_fail (self != NULL, FALSE);
+
+  g_mutex_lock (&self->backend->lock);
+  has_unapplied = (self->backend->pending != NULL &&
+                   g_hash_table_size (self->backend->pending) > 0);
+  g_mutex_unlock (&self->backend->lock);
+
+  return has_unapplied;
+}
+
+/* Sum the counts for @key, or for all keys if @key is %NULL. */
+static void
+sum_stats (GtSettingsBackend *self,
+           const gchar       *key,
+           KeyStats          *out_sum)
+{
+  GtSettingsBackendObject *backend = self->backend;
+
+  out_sum->n_writes = 0;
+  out_sum->n_redundant_writes = 0;
+
+  g_mutex_lock (&backend->lock);
+
+  if (key != NULL)
+    {
+      const KeyStats *stats = g_hash_table_lookup (backend->stats, key);
+
+      if (stats != NULL)
+        *out_sum = *stats;
+    }
+  else
+    {
+      GHashTableIter iter;
+      gpointer value;
+
+      g_hash_table_iter_init (&iter, backend->stats);
+      while (g_hash_table_iter_next (&iter, NULL, &value))
+        {
+          const KeyStats *stats = value;
+
+          out_sum->n_writes += stats->n_writes;
+          out_sum->n_redundant_writes += stats->n_redundant_writes;
+        }
+    }
+
+  g_mutex_unlock (&backend->lock);
+}
+
+/**
+ * gt_settings_backend_get_n_writes:
+ * @self: a #GtSettingsBackend
+ * @key: (nullable): full path of the key to get the count for, or %NULL to
+ *    get the total for all keys
+ *
+ * Get the number of times @key has been written to storage (including resets)
+ * since @self was created, or since gt_settings_backend_reset_counts() was
+ * last called. Writes made while delayed are not counted until they are
+ * applied, and then count once per key.
+ *
+ * Returns: number of writes
+ * Since: 0.2.0
+ */
+guint
+gt_settings_backend_get_n_writes (GtSettingsBackend *self,
+                                  const gchar       *key)
+{
+  KeyStats sum;
+
+  g_return_val_if_fail (self != NULL, 0);
+
+  sum_stats (self, key, &sum);
+
+  return sum.n_writes;
+}
+
+/**
+ * gt_settings_backend_get_n_redundant_writes:
+ * @self: a #GtSettingsBackend
+ * @key: (nullable): full path of the key to get the count for, or %NULL to
+ *    get the total for all keys
+ *
+ * Get the number of times @key has been written to storage with the value it
+ * already had (or reset when it was already unset). This is a subset of the
+ * writes counted by gt_settings_backend_get_n_writes().
+ *
+ * Returns: number of redundant writes
+ * Since: 0.2.0
+ */
+guint
+gt_settings_backend_get_n_redundant_writes (GtSettingsBackend *self,
+                                            const gchar       *key)
+{
+  KeyStats sum;
+
+  g_return_val_if_fail (self != NULL, 0);
+
+  sum_stats (self, key, &sum);
+
+  return sum.n_redundant_writes;
+}
+
+/**
+ * gt_settings_backend_dup_most_written_key:
+ * @self: a #GtSettingsBackend
+ * @out_n_writes: (out) (optional): return location for the number of times
+ *    the key was written
+ *
+ * Get the key which has been written to storage the most times, as counted by
+ * gt_settings_backend_get_n_writes(). If several keys have been written the
+ * same number of times, the first of them in alphabetical order is returned.
+ *
+ * Returns: (transfer full) (nullable): full path of the most written key, or
+ *    %NULL if nothing has been written
+ * Since: 0.2.0
+ */
+gchar *
+gt_settings_backend_dup_most_written_key (GtSettingsBackend *self,
+                                          guint             *out_n_writes)
+{
+  GtSettingsBackendObject *backend;
+  GHashTableIter iter;
+  gpointer key, value;
+  const gchar *max_key = NULL;
+  guint max_n_writes = 0;
+  gchar *result;
+
+  g_return_val_if_fail (self != NULL, NULL);
+
+  backend = self->backend;
+
+  g_mutex_lock (&backend->lock);
+
+  g_hash_table_iter_init (&iter, backend->stats);
+  while (g_hash_table_iter_next (&iter, &key, &value))
+    {
+      const KeyStats *stats = value;
+
+      if (stats->n_writes > max_n_writes ||
+          (stats->n_writes == max_n_writes && g_strcmp0 (key, max_key) < 0))
+        {
+          max_key = key;
+          max_n_writes = stats->n_writes;
+        }
+    }
+
+  result = g_strdup (max_key);
+
+  g_mutex_unlock (&backend->lock);
+
+  if (out_n_writes != NULL)
+    *out_n_writes = max_n_writes;
+
+  return result;
+}
+
+/**
+ * gt_settings_backend_reset_counts:
+ * @self: a #GtSettingsBackend
+ *
+ * Reset the write counts for all keys to zero, so that the writes made by a
+ * particular operation can be checked. Values and the change queue are not
+ * affected.
+ *
+ * Since: 0.2.0
+ */
+void
+gt_settings_backend_reset_counts (GtSettingsBackend *self)
+{
+  g_return_if_fail (self != NULL);
+
+  g_mutex_lock (&self->backend->lock);
+  g_hash_table_remove_all (self->backend->stats);
+  g_mutex_unlock (&self->backend->lock);
+}
+
+/**
+ * gt_settings_backend_format_writes:
+ * @self: a #GtSettingsBackend
+ *
+ * Format the write counts for all the keys which have been written, in
+ * alphabetical order, for use in debug output.
+ *
+ * Returns: (transfer full): human readable list of write counts
+ * Since: 0.2.0
+ */
+gchar *
+gt_settings_backend_format_writes (GtSettingsBackend *self)
+{
+  GtSettingsBackendObject *backend;
+  g_autoptr(GString) str = g_string_new ("");
+  g_autoptr(GPtrArray) sorted_keys = g_ptr_array_new ();
+  GHashTableIter iter;
+  gpointer key;
+
+  g_return_val_if_fail (self != NULL, NULL);
+
+  backend = self->backend;
+
+  g_mutex_lock (&backend->lock);
+
+  g_hash_table_iter_init (&iter, backend->stats);
+  while (g_hash_table_iter_next (&iter, &key, NULL))
+    g_ptr_array_add (sorted_keys, key);
+  g_ptr_array_sort (sorted_keys, compare_strings);
+
+  for (gsize i = 0; i < sorted_keys->len; i++)
+    {
+      const gchar *sorted_key = g_ptr_array_index (sorted_keys, i);
+      const KeyStats *stats = g_hash_table_lookup (backend->stats, sorted_key);
+
+      g_string_append_printf (str, " • %s: %u writes (%u redundant)\n",
+                              sorted_key, stats->n_writes,
+                              stats->n_redundant_writes);
+    }
+
+  g_mutex_unlock (&backend->lock);
+
+  return g_string_free (g_steal_pointer (&str), FALSE);
+}
+
+/**
+ * gt_settings_backend_get_n_changes:
+ * @self: a #GtSettingsBackend
+ *
+ * Get the number of change notifications currently in the queue.
+ *
+ * Returns: number of queued changes
+ * Since: 0.2.0
+ */
+gsize
+gt_settings_backend_get_n_changes (GtSettingsBackend *self)
+{
+  gsize n_changes;
+
+  g_return_val_if_fail (self != NULL, 0);
+
+  g_mutex_lock (&self->backend->lock);
+  n_changes = self->backend->changes->len;
+  g_mutex_unlock (&self->backend->lock);
+
+  return n_changes;
+}
+
+/**
+ * gt_settings_backend_pop_change:
+ * @self: a #GtSettingsBackend
+ * @out_key: (out) (optional) (transfer full): return location for the full
+ *    path of the changed key
+ * @out_value: (out) (optional) (nullable) (transfer full): return location for
+ *    the new value of the key, which is %NULL if the key was reset
+ *
+ * Pop the oldest change notification off the queue. If the queue is empty,
+ * %FALSE is returned and the return locations are set to %NULL.
+ *
+ * Returns: %TRUE if a change was popped, %FALSE if the queue was empty
+ * Since: 0.2.0
+ */
+gboolean
+gt_settings_backend_pop_change (GtSettingsBackend  *self,
+                                gchar             **out_key,
+                                GVariant          **out_value)
+{
+  Change *change = NULL;
+
+  g_return_val_if_fail (self != NULL, FALSE);
+
+  g_mutex_lock (&self->backend->lock);
+  if (self->backend->changes->len > 0)
+    {
+      /* Steal the change so it isn’t freed on removal. */
+      change = g_ptr_array_index (self->backend->changes, 0);
+      g_ptr_array_index (self->backend->changes, 0) = NULL;
+      g_ptr_array_remove_index (self->backend->changes, 0);
+    }
+  g_mutex_unlock (&self->backend->lock);
+
+  if (change == NULL)
+    {
+      if (out_key != NULL)
+        *out_key = NULL;
+      if (out_value != NULL)
+        *out_value = NULL;
+      return FALSE;
+    }
+
+  if (out_key != NULL)
+    *out_key = g_steal_pointer (&change->key);
+  if (out_value != NULL)
+    *out_value = g_steal_pointer (&change->value);
+
+  change_free (change);
+
+  return TRUE;
+}
+
+/**
+ * gt_settings_backend_format_change:
+ * @key: full path of the changed key
+ * @value: (nullable): new value of the key, or %NULL if it was reset
+ *
+ * Format a change notification, as returned by
+ * gt_settings_backend_pop_change(), for use in debug output.
+ *
+ * Returns: (transfer full): human readable description of the change
+ * Since: 0.2.0
+ */
+gchar *
+gt_settings_backend_format_change (const gchar *key,
+                                   GVariant    *value)
+{
+  g_autofree gchar *value_str = NULL;
+
+  g_return_val_if_fail (key != NULL, NULL);
+
+  if (value == NULL)
+    return g_strdup_printf ("%s reset", key);
+
+  value_str = g_variant_print (value, TRUE);
+
+  return g_strdup_printf ("%s = %s", key, value_str);
+}
+
+/**
+ * gt_settings_backend_format_changes:
+ * @self: a #GtSettingsBackend
+ *
+ * Format all the change notifications in the queue, in order, for use in debug
+ * output.
+ *
+ * Returns: (transfer full): human readable list of changes
+ * Since: 0.2.0
+ */
+gchar *
+gt_settings_backend_format_changes (GtSettingsBackend *self)
+{
+  g_autoptr(GString) str = g_string_new ("");
+
+  g_return_val_if_fail (self != NULL, NULL);
+
+  g_mutex_lock (&self->backend->lock);
+
+  for (gsize i = 0; i < self->backend->changes->len; i++)
+    {
+      const Change *change = g_ptr_array_index (self->backend->changes, i);
+      g_autofree gchar *change_str =
+          gt_settings_backend_format_change (change->key, change->value);
+
+      g_string_append_printf (str, " • %s\n", change_str);
+    }
+
+  g_mutex_unlock (&self->backend->lock);
+
+  return g_string_free (g_steal_pointer (&str), FALSE);
+}
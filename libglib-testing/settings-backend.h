@@ -0,0 +1,192 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ *
+ * Copyright © 2018 Endless Mobile, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#pragma once
+
+#include <gio/gio.h>
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+typedef struct _GtSettingsBackend GtSettingsBackend;
+
+GtSettingsBackend *gt_settings_backend_new         (void);
+void               gt_settings_backend_free        (GtSettingsBackend *self);
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC (GtSettingsBackend, gt_settings_backend_free)
+
+GSettingsBackend  *gt_settings_backend_get_backend (GtSettingsBackend *self);
+GVariant          *gt_settings_backend_dup_value   (GtSettingsBackend *self,
+                                                    const gchar       *key);
+
+void               gt_settings_backend_delay       (GtSettingsBackend *self);
+void               gt_settings_backend_apply       (GtSettingsBackend *self);
+void               gt_settings_backend_revert      (GtSettingsBackend *self);
+gboolean           gt_settings_backend_get_has_unapplied (GtSettingsBackend *self);
+
+guint              gt_settings_backend_get_n_writes           (GtSettingsBackend *self,
+                                                               const gchar       *key);
+guint              gt_settings_backend_get_n_redundant_writes (GtSettingsBackend *self,
+                                                               const gchar       *key);
+gchar             *gt_settings_backend_dup_most_written_key   (GtSettingsBackend *self,
+                                                               guint             *out_n_writes);
+void               gt_settings_backend_reset_counts           (GtSettingsBackend *self);
+gchar             *gt_settings_backend_format_writes          (GtSettingsBackend *self);
+
+gsize              gt_settings_backend_get_n_changes    (GtSettingsBackend  *self);
+gboolean           gt_settings_backend_pop_change       (GtSettingsBackend  *self,
+                                                         gchar             **out_key,
+                                                         GVariant          **out_value);
+gchar             *gt_settings_backend_format_change    (const gchar        *key,
+                                                         GVariant           *value);
+gchar             *gt_settings_backend_format_changes   (GtSettingsBackend  *self);
+
+/**
+ * gt_settings_backend_assert_no_changes:
+ * @self: a #GtSettingsBackend
+ *
+ * Assert that there are no change notifications currently in the queue.
+ *
+ * Since: 0.2.0
+ */
+#define gt_settings_backend_assert_no_changes(self) \
+  G_STMT_START { \
+    if (gt_settings_backend_get_n_changes (self) > 0) \
+      { \
+        g_autofree gchar *anc_list = gt_settings_backend_format_changes (self); \
+        g_autofree gchar *anc_message = \
+            g_strdup_printf ("Expected no settings changes, but saw %" G_GSIZE_FORMAT ":\n%s", \
+                             gt_settings_backend_get_n_changes (self), \
+                             anc_list); \
+        g_assertion_message (G_LOG_DOMAIN, __FILE__, __LINE__, G_STRFUNC, \
+                             anc_message); \
+      } \
+  } G_STMT_END
+
+/**
+ * gt_settings_backend_assert_change_pop:
+ * @self: a #GtSettingsBackend
+ * @key: full path of the key to assert the change matches
+ * @value: (nullable): value to assert the change matches, or %NULL to assert
+ *    that the key was reset; if this is floating, it is consumed
+ *
+ * Assert that a change notification can be popped off the queue (using
+ * gt_settings_backend_pop_change()) and that it is a change of @key to @value.
+ *
+ * If a change can’t be popped, or if it doesn’t match @key and @value, an
+ * assertion fails, and some debug output is printed.
+ *
+ * Since: 0.2.0
+ */
+#define gt_settings_backend_assert_change_pop(self, key, value) \
+  G_STMT_START { \
+    g_autofree gchar *acp_key = NULL; \
+    g_autoptr(GVariant) acp_value = NULL; \
+    GVariant *acp_expected_value_ = (value); \
+    g_autoptr(GVariant) acp_expected_value = \
+        (acp_expected_value_ != NULL) ? g_variant_ref_sink (acp_expected_value_) : NULL; \
+    g_autofree gchar *acp_expected = \
+        gt_settings_backend_format_change (key, acp_expected_value); \
+    if (gt_settings_backend_pop_change (self, &acp_key, &acp_value)) \
+      { \
+        if (!g_str_equal (acp_key, key) || \
+            (acp_value == NULL) != (acp_expected_value == NULL) || \
+            (acp_value != NULL && !g_variant_equal (acp_value, acp_expected_value))) \
+          { \
+            g_autofree gchar *acp_actual = \
+                gt_settings_backend_format_change (acp_key, acp_value); \
+            g_autofree gchar *acp_message = \
+                g_strdup_printf ("Expected settings change %s, but saw: %s", \
+                                 acp_expected, acp_actual); \
+            g_assertion_message (G_LOG_DOMAIN, __FILE__, __LINE__, G_STRFUNC, \
+                                 acp_message); \
+          } \
+      } \
+    else \
+      { \
+        g_autofree gchar *acp_message = \
+            g_strdup_printf ("Expected settings change %s, but saw no changes", \
+                             acp_expected); \
+        g_assertion_message (G_LOG_DOMAIN, __FILE__, __LINE__, G_STRFUNC, \
+                             acp_message); \
+      } \
+  } G_STMT_END
+
+/**
+ * gt_settings_backend_assert_writes_at_most:
+ * @self: a #GtSettingsBackend
+ * @max_writes: maximum number of writes allowed to each key
+ *
+ * Assert that no key has been written to @self more than @max_writes times
+ * since it was created, or since gt_settings_backend_reset_counts() was last
+ * called. Pass 1 to check that an operation writes each key at most once.
+ *
+ * If any key has been written more often, an assertion fails and the write
+ * counts for all keys are printed, using gt_settings_backend_format_writes().
+ *
+ * Since: 0.2.0
+ */
+#define gt_settings_backend_assert_writes_at_most(self, max_writes) \
+  G_STMT_START { \
+    guint awam_n_writes = 0; \
+    g_autofree gchar *awam_key = \
+        gt_settings_backend_dup_most_written_key (self, &awam_n_writes); \
+    if (awam_key != NULL && awam_n_writes > (guint) (max_writes)) \
+      { \
+        g_autofree gchar *awam_list = gt_settings_backend_format_writes (self); \
+        g_autofree gchar *awam_message = \
+            g_strdup_printf ("Expected each settings key to be written at " \
+                             "most %u times, but %s was written %u times:\n%s", \
+                             (guint) (max_writes), awam_key, awam_n_writes, \
+                             awam_list); \
+        g_assertion_message (G_LOG_DOMAIN, __FILE__, __LINE__, G_STRFUNC, \
+                             awam_message); \
+      } \
+  } G_STMT_END
+
+/**
+ * gt_settings_backend_assert_no_redundant_writes:
+ * @self: a #GtSettingsBackend
+ *
+ * Assert that no key has been written to @self with the value it already had,
+ * since it was created, or since gt_settings_backend_reset_counts() was last
+ * called.
+ *
+ * If any redundant writes have happened, an assertion fails and the write
+ * counts for all keys are printed, using gt_settings_backend_format_writes().
+ *
+ * Since: 0.2.0
+ */
+#define gt_settings_backend_assert_no_redundant_writes(self) \
+  G_STMT_START { \
+    guint anrw_n_redundant = \
+        gt_settings_backend_get_n_redundant_writes (self, NULL); \
+    if (anrw_n_redundant > 0) \
+      { \
+        g_autofree gchar *anrw_list = gt_settings_backend_format_writes (self); \
+        g_autofree gchar *anrw_message = \
+            g_strdup_printf ("Expected no redundant settings writes, but " \
+                             "saw %u:\n%s", anrw_n_redundant, anrw_list); \
+        g_assertion_message (G_LOG_DOMAIN, __FILE__, __LINE__, G_STRFUNC, \
+                             anrw_message); \
+      } \
+  } G_STMT_END
+
+G_END_DECLS
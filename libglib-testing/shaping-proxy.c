@@ -0,0 +1,833 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ *
+ * Copyright © 2018 Endless Mobile, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#include "config.h"
+
+#include <gio/gio.h>
+#include <gio/gunixsocketaddress.h>
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <libglib-testing/shaping-proxy.h>
+
+
+/**
+ * SECTION:shaping-proxy
+ * @short_description: Latency and bandwidth shaping socket proxy
+ * @stability: Unstable
+ * @include: libglib-testing/shaping-proxy.h
+ *
+ * #GtShapingProxy is an in-process, byte-level proxy which sits between a
+ * client and a listening socket (typically a D-Bus bus), and delays and
+ * throttles the traffic between them. It can be used to reproduce the
+ * behaviour of slow transports, such as a sandboxed client talking to the bus
+ * through a filtering proxy, and to measure how the throughput of the code
+ * under test degrades when the transport is constrained.
+ *
+ * Each direction of traffic is shaped independently, and can be given:
+ *
+ *  - a latency, using gt_shaping_proxy_set_latency(), which delays each block
+ *    of data by a fixed amount after it is received;
+ *  - a bandwidth cap, using gt_shaping_proxy_set_bandwidth();
+ *  - a maximum chunk size, using gt_shaping_proxy_set_max_chunk_size(), which
+ *    splits the data into several partial writes, with a main loop iteration
+ *    between each.
+ *
+ * The proxy runs in its own thread, using non-blocking sockets. It listens on
+ * a new Unix socket, whose D-Bus address is returned by
+ * gt_shaping_proxy_get_address(). Each connection to it results in a new
+ * connection to the upstream address passed to gt_shaping_proxy_new().
+ *
+ * As the proxy only forwards bytes, ancillary data (such as Unix file
+ * descriptors or credentials) is not passed through it.
+ *
+ * To put a #GtShapingProxy between the client connection of a #GtDBusQueue and
+ * its bus, call gt_dbus_queue_set_use_shaping_proxy() before
+ * gt_dbus_queue_connect(), and then configure the proxy returned by
+ * gt_dbus_queue_get_shaping_proxy().
+ *
+ * Since: 0.2.0
+ */
+
+/* Maximum number of bytes to read from a socket at once. */
+#define READ_BUFFER_SIZE 65536
+
+/* Maximum number of bytes to queue in each direction before applying
+ * back-pressure, by not reading any more from the input socket until some of
+ * the queue has been sent. */
+#define MAX_QUEUED_BYTES (4 * READ_BUFFER_SIZE)
+
+/* FIXME: Use G_SOURCE_FUNC() once we can depend on a new enough GLib
+ * version. */
+#define SOCKET_SOURCE_FUNC(f) ((GSourceFunc) (void (*) (void)) (f))
+
+/* Shaping parameters and statistics for one direction of traffic. */
+typedef struct
+{
+  guint latency_ms;
+  gsize bandwidth;  /* bytes per second, or 0 for unlimited */
+  gsize max_chunk_size;  /* 0 for unlimited */
+  guint64 n_bytes;
+} DirectionParams;
+
+/**
+ * GtShapingProxy:
+ *
+ * An in-process proxy which applies latency, bandwidth and chunking constraints
+ * to the traffic passing through it.
+ *
+ * Since: 0.2.0
+ */
+struct _GtShapingProxy
+{
+  gchar *upstream_address;  /* (owned) */
+  gchar *address;  /* (owned) (nullable) */
+  gchar *socket_dir;  /* (owned) (nullable) */
+  gchar *socket_path;  /* (owned) (nullable) */
+
+  GThread *thread;  /* (owned) (nullable) */
+  GMainContext *context;  /* (owned) */
+  gboolean quitting;  /* (atomic) */
+
+  /* These are only accessed in the proxy thread while it is running. */
+  GSocket *listen_socket;  /* (owned) (nullable) */
+  GSource *listen_source;  /* (owned) (nullable) */
+  GPtrArray *connections;  /* (owned) (element-type Connection) */
+
+  GMutex lock;
+  DirectionParams params[2];  /* (locked-by lock); indexed by #GtShapingProxyDirection */
+};
+
+/* A block of data waiting to be sent, which may have been partially sent. */
+typedef struct
+{
+  GBytes *data;  /* (owned) */
+  gsize offset;  /* number of bytes already sent */
+  gint64 release_time_us;  /* monotonic time when it may be sent */
+} Chunk;
+
+static void
+chunk_free (Chunk *chunk)
+{
+  g_bytes_unref (chunk->data);
+  g_free (chunk);
+}
+
+typedef struct _Connection Connection;
+
+/* One direction of a #Connection, reading from @input and writing the shaped
+ * data to @output. All of this is accessed only in the proxy thread. */
+typedef struct
+{
+  Connection *connection;  /* (unowned) */
+  GtShapingProxyDirection direction;
+
+  GSocket *input;  /* (unowned) */
+  GSocket *output;  /* (unowned) */
+
+  GQueue chunks;  /* (element-type Chunk) (owned) */
+  gsize n_queued_bytes;
+  gint64 next_send_time_us;  /* earliest time to send, for bandwidth limiting */
+
+  gboolean input_closed;
+  gboolean output_closed;
+
+  GSource *input_source;  /* (owned) (nullable) */
+  GSource *output_source;  /* (owned) (nullable) */
+  GSource *timeout_source;  /* (owned) (nullable) */
+} Pipe;
+
+/* A connection from a client to the proxy, and the corresponding connection
+ * from the proxy to the upstream server. */
+struct _Connection
+{
+  GtShapingProxy *proxy;  /* (unowned) */
+
+  GSocket *client_socket;  /* (owned) */
+  GIOStream *upstream_stream;  /* (owned) */
+  GSocket *upstream_socket;  /* (unowned); owned by @upstream_stream */
+
+  Pipe pipes[2];  /* indexed by #GtShapingProxyDirection */
+};
+
+static void
+clear_source (GSource **source_pointer)
+{
+  GSource *source = g_steal_pointer (source_pointer);
+
+  if (source != NULL)
+    {
+      g_source_destroy (source);
+      g_source_unref (source);
+    }
+}
+
+static void
+pipe_clear (Pipe *pipe)
+{
+  Chunk *chunk;
+
+  clear_source (&pipe->input_source);
+  clear_source (&pipe->output_source);
+  clear_source (&pipe->timeout_source);
+
+  /* FIXME: Use g_queue_clear_full() once we can depend on a new enough GLib
+   * version. */
+  while ((chunk = g_queue_pop_head (&pipe->chunks)) != NULL)
+    chunk_free (chunk);
+}
+
+static void
+connection_free (Connection *connection)
+{
+  pipe_clear (&connection->pipes[GT_SHAPING_PROXY_DIRECTION_TO_SERVER]);
+  pipe_clear (&connection->pipes[GT_SHAPING_PROXY_DIRECTION_TO_CLIENT]);
+
+  g_socket_close (connection->client_socket, NULL);
+  g_clear_object (&connection->client_socket);
+  g_io_stream_close (connection->upstream_stream, NULL, NULL);
+  g_clear_object (&connection->upstream_stream);
+
+  g_free (connection);
+}
+
+/* Close and free @connection. Neither it nor its pipes may be used after this
+ * returns. */
+static void
+connection_close (Connection *connection)
+{
+  g_debug ("%s: Closing connection %p", G_STRFUNC, connection);
+  g_ptr_array_remove_fast (connection->proxy->connections, connection);
+}
+
+static void pipe_pump (Pipe *pipe);
+static void pipe_watch_input (Pipe *pipe);
+
+static gboolean
+pipe_timeout_cb (gpointer user_data)
+{
+  Pipe *pipe = user_data;
+
+  g_clear_pointer (&pipe->timeout_source, g_source_unref);
+  pipe_pump (pipe);
+
+  return G_SOURCE_REMOVE;
+}
+
+/* Pump @pipe again after @delay_us have elapsed. */
+static void
+pipe_schedule_timeout (Pipe   *pipe,
+                       gint64  delay_us)
+{
+  g_assert (pipe->timeout_source == NULL);
+
+  /* Round up, so the pump doesn’t happen early. */
+  pipe->timeout_source = g_timeout_source_new ((guint) ((delay_us + 999) / 1000));
+  g_source_set_name (pipe->timeout_source, "GtShapingProxy timeout");
+  g_source_set_callback (pipe->timeout_source, pipe_timeout_cb, pipe, NULL);
+  g_source_attach (pipe->timeout_source, pipe->connection->proxy->context);
+}
+
+static gboolean
+pipe_output_cb (GSocket      *socket,
+                GIOCondition  condition,
+                gpointer      user_data)
+{
+  Pipe *pipe = user_data;
+
+  g_clear_pointer (&pipe->output_source, g_source_unref);
+  pipe_pump (pipe);
+
+  return G_SOURCE_REMOVE;
+}
+
+/* Pump @pipe again once its output socket is writable. */
+static void
+pipe_watch_output (Pipe *pipe)
+{
+  if (pipe->output_source != NULL)
+    return;
+
+  pipe->output_source = g_socket_create_source (pipe->output, G_IO_OUT, NULL);
+  g_source_set_name (pipe->output_source, "GtShapingProxy output");
+  g_source_set_callback (pipe->output_source, SOCKET_SOURCE_FUNC (pipe_output_cb),
+                         pipe, NULL);
+  g_source_attach (pipe->output_source, pipe->connection->proxy->context);
+}
+
+/* Close the connection if both its pipes have finished. Returns %TRUE if it was
+ * closed (and hence freed). */
+static gboolean
+connection_maybe_close (Connection *connection)
+{
+  if (connection->pipes[GT_SHAPING_PROXY_DIRECTION_TO_SERVER].output_closed &&
+      connection->pipes[GT_SHAPING_PROXY_DIRECTION_TO_CLIENT].output_closed)
+    {
+      connection_close (connection);
+      return TRUE;
+    }
+
+  return FALSE;
+}
+
+/* Send as much of the queued data in @pipe as the shaping parameters allow, and
+ * arrange to be called again when more can be sent. This may close (and hence
+ * free) the connection which @pipe is part of. */
+static void
+pipe_pump (Pipe *pipe)
+{
+  GtShapingProxy *proxy = pipe->connection->proxy;
+  gsize bandwidth, max_chunk_size;
+
+  clear_source (&pipe->timeout_source);
+
+  g_mutex_lock (&proxy->lock);
+  bandwidth = proxy->params[pipe->direction].bandwidth;
+  max_chunk_size = proxy->params[pipe->direction].max_chunk_size;
+  g_mutex_unlock (&proxy->lock);
+
+  while (!g_queue_is_empty (&pipe->chunks))
+    {
+      Chunk *chunk = g_queue_peek_head (&pipe->chunks);
+      gint64 now = g_get_monotonic_time ();
+      gint64 send_time = MAX (chunk->release_time_us, pipe->next_send_time_us);
+      const guint8 *data;
+      gsize data_size, n_to_send;
+      gssize n_sent;
+      g_autoptr(GError) local_error = NULL;
+
+      if (send_time > now)
+        {
+          pipe_schedule_timeout (pipe, send_time - now);
+          return;
+        }
+
+      data = g_bytes_get_data (chunk->data, &data_size);
+      n_to_send = data_size - chunk->offset;
+      if (max_chunk_size > 0)
+        n_to_send = MIN (n_to_send, max_chunk_size);
+
+      n_sent = g_socket_send (pipe->output, (const gchar *) data + chunk->offset,
+                              n_to_send, NULL, &local_error);
+
+      if (n_sent < 0 &&
+          g_error_matches (local_error, G_IO_ERROR, G_IO_ERROR_WOULD_BLOCK))
+        {
+          pipe_watch_output (pipe);
+          return;
+        }
+      else if (n_sent < 0)
+        {
+          g_debug ("%s: Error sending: %s", G_STRFUNC, local_error->message);
+          connection_close (pipe->connection);
+          return;
+        }
+
+      chunk->offset += (gsize) n_sent;
+      pipe->n_queued_bytes -= (gsize) n_sent;
+
+      g_mutex_lock (&proxy->lock);
+      proxy->params[pipe->direction].n_bytes += (guint64) n_sent;
+      g_mutex_unlock (&proxy->lock);
+
+      if (bandwidth > 0)
+        pipe->next_send_time_us = MAX (now, pipe->next_send_time_us) +
+                                  (gint64) ((guint64) n_sent * G_USEC_PER_SEC / bandwidth);
+
+      if (chunk->offset == data_size)
+        chunk_free (g_queue_pop_head (&pipe->chunks));
+
+      /* Resume reading if back-pressure was being applied. */
+      if (!pipe->input_closed && pipe->input_source == NULL &&
+          pipe->n_queued_bytes < MAX_QUEUED_BYTES)
+        pipe_watch_input (pipe);
+
+      /* Let the receiver see this partial write on its own before sending the
+       * rest. */
+      if (max_chunk_size > 0 && !g_queue_is_empty (&pipe->chunks))
+        {
+          pipe_schedule_timeout (pipe, 0);
+          return;
+        }
+    }
+
+  /* Propagate end-of-stream once all the queued data has been sent. */
+  if (pipe->input_closed && !pipe->output_closed)
+    {
+      g_socket_shutdown (pipe->output, FALSE, TRUE, NULL);
+      pipe->output_closed = TRUE;
+      connection_maybe_close (pipe->connection);
+    }
+}
+
+static gboolean
+pipe_input_cb (GSocket      *socket,
+               GIOCondition  condition,
+               gpointer      user_data)
+{
+  Pipe *pipe = user_data;
+  GtShapingProxy *proxy = pipe->connection->proxy;
+  g_autofree guint8 *buffer = NULL;
+  gssize n_received;
+  g_autoptr(GError) local_error = NULL;
+  Chunk *chunk;
+  guint latency_ms;
+
+  buffer = g_malloc (READ_BUFFER_SIZE);
+  n_received = g_socket_receive (socket, (gchar *) buffer, READ_BUFFER_SIZE,
+                                 NULL, &local_error);
+
+  if (n_received < 0 &&
+      g_error_matches (local_error, G_IO_ERROR, G_IO_ERROR_WOULD_BLOCK))
+    {
+      return G_SOURCE_CONTINUE;
+    }
+  else if (n_received < 0)
+    {
+      g_debug ("%s: Error receiving: %s", G_STRFUNC, local_error->message);
+      connection_close (pipe->connection);
+      return G_SOURCE_REMOVE;
+    }
+  else if (n_received == 0)
+    {
+      pipe->input_closed = TRUE;
+      clear_source (&pipe->input_source);
+      pipe_pump (pipe);
+      return G_SOURCE_REMOVE;
+    }
+
+  g_mutex_lock (&proxy->lock);
+  latency_ms = proxy->params[pipe->direction].latency_ms;
+  g_mutex_unlock (&proxy->lock);
+
+  chunk = g_new0 (Chunk, 1);
+  chunk->data = g_bytes_new_take (g_realloc (g_steal_pointer (&buffer), (gsize) n_received),
+                                  (gsize) n_received);
+  chunk->release_time_us = g_get_monotonic_time () + (gint64) latency_ms * 1000;
+  g_queue_push_tail (&pipe->chunks, chunk);
+  pipe->n_queued_bytes += (gsize) n_received;
+
+  /* Apply back-pressure if too much data is queued. */
+  if (pipe->n_queued_bytes >= MAX_QUEUED_BYTES)
+    clear_source (&pipe->input_source);
+
+  /* Only pump if nothing is already scheduled; otherwise the new chunk will be
+   * sent after the ones before it. */
+  if (pipe->timeout_source == NULL && pipe->output_source == NULL)
+    pipe_pump (pipe);
+
+  return G_SOURCE_CONTINUE;
+}
+
+static void
+pipe_watch_input (Pipe *pipe)
+{
+  g_assert (pipe->input_source == NULL);
+
+  pipe->input_source = g_socket_create_source (pipe->input,
+                                               G_IO_IN | G_IO_HUP | G_IO_ERR,
+                                               NULL);
+  g_source_set_name (pipe->input_source, "GtShapingProxy input");
+  g_source_set_callback (pipe->input_source, SOCKET_SOURCE_FUNC (pipe_input_cb),
+                         pipe, NULL);
+  g_source_attach (pipe->input_source, pipe->connection->proxy->context);
+}
+
+static void
+pipe_init (Pipe                    *pipe,
+           Connection              *connection,
+           GtShapingProxyDirection  direction,
+           GSocket                 *input,
+           GSocket                 *output)
+{
+  pipe->connection = connection;
+  pipe->direction = direction;
+  pipe->input = input;
+  pipe->output = output;
+  g_queue_init (&pipe->chunks);
+
+  pipe_watch_input (pipe);
+}
+
+static gboolean
+listen_cb (GSocket      *socket,
+           GIOCondition  condition,
+           gpointer      user_data)
+{
+  GtShapingProxy *self = user_data;
+  g_autoptr(GSocket) client_socket = NULL;
+  g_autoptr(GIOStream) upstream_stream = NULL;
+  g_autoptr(GError) local_error = NULL;
+  Connection *connection;
+
+  client_socket = g_socket_accept (socket, NULL, &local_error);
+
+  if (client_socket == NULL)
+    {
+      if (!g_error_matches (local_error, G_IO_ERROR, G_IO_ERROR_WOULD_BLOCK))
+        g_debug ("%s: Error accepting connection: %s",
+                 G_STRFUNC, local_error->message);
+      return G_SOURCE_CONTINUE;
+    }
+
+  /* This blocks, but the upstream server is typically listening on a local
+   * socket, so it’s quick. */
+  upstream_stream = g_dbus_address_get_stream_sync (self->upstream_address,
+                                                    NULL, NULL, &local_error);
+
+  if (upstream_stream != NULL && !G_IS_SOCKET_CONNECTION (upstream_stream))
+    g_set_error (&local_error, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED,
+                 "Upstream address ‘%s’ is not a socket", self->upstream_address);
+
+  if (local_error != NULL)
+    {
+      g_debug ("%s: Error connecting to upstream: %s",
+               G_STRFUNC, local_error->message);
+      g_socket_close (client_socket, NULL);
+      return G_SOURCE_CONTINUE;
+    }
+
+  connection = g_new0 (Connection, 1);
+  connection->proxy = self;
+  connection->client_socket = g_steal_pointer (&client_socket);
+  connection->upstream_stream = g_steal_pointer (&upstream_stream);
+  connection->upstream_socket =
+      g_socket_connection_get_socket (G_SOCKET_CONNECTION (connection->upstream_stream));
+
+  g_socket_set_blocking (connection->client_socket, FALSE);
+  g_socket_set_blocking (connection->upstream_socket, FALSE);
+
+  pipe_init (&connection->pipes[GT_SHAPING_PROXY_DIRECTION_TO_SERVER], connection,
+             GT_SHAPING_PROXY_DIRECTION_TO_SERVER,
+             connection->client_socket, connection->upstream_socket);
+  pipe_init (&connection->pipes[GT_SHAPING_PROXY_DIRECTION_TO_CLIENT], connection,
+             GT_SHAPING_PROXY_DIRECTION_TO_CLIENT,
+             connection->upstream_socket, connection->client_socket);
+
+  g_ptr_array_add (self->connections, connection);
+  g_debug ("%s: Accepted connection %p", G_STRFUNC, connection);
+
+  return G_SOURCE_CONTINUE;
+}
+
+/* The main function for the proxy thread. This runs #GtShapingProxy.context
+ * until #GtShapingProxy.quitting is set, then closes all the connections. */
+static gpointer
+proxy_thread_cb (gpointer user_data)
+{
+  GtShapingProxy *self = user_data;
+
+  g_main_context_push_thread_default (self->context);
+
+  while (!g_atomic_int_get (&self->quitting))
+    g_main_context_iteration (self->context, TRUE);
+
+  g_ptr_array_set_size (self->connections, 0);
+  clear_source (&self->listen_source);
+
+  /* Process any remaining sources while quitting, without blocking. */
+  while (g_main_context_iteration (self->context, FALSE));
+
+  g_main_context_pop_thread_default (self->context);
+
+  return NULL;
+}
+
+/**
+ * gt_shaping_proxy_new:
+ * @upstream_address: D-Bus address to forward connections to, such as the one
+ *    returned by g_test_dbus_get_bus_address()
+ *
+ * Create a new #GtShapingProxy which will forward connections to
+ * @upstream_address. Start it using gt_shaping_proxy_start(). Initially, no
+ * shaping is applied to the traffic.
+ *
+ * Returns: (transfer full): a new #GtShapingProxy
+ * Since: 0.2.0
+ */
+GtShapingProxy *
+gt_shaping_proxy_new (const gchar *upstream_address)
+{
+  g_autoptr(GtShapingProxy) proxy = NULL;
+
+  g_return_val_if_fail (g_dbus_is_address (upstream_address), NULL);
+
+  proxy = g_new0 (GtShapingProxy, 1);
+  proxy->upstream_address = g_strdup (upstream_address);
+  proxy->context = g_main_context_new ();
+  proxy->connections = g_ptr_array_new_with_free_func ((GDestroyNotify) connection_free);
+  g_mutex_init (&proxy->lock);
+
+  return g_steal_pointer (&proxy);
+}
+
+/**
+ * gt_shaping_proxy_free:
+ * @self: (transfer full): a #GtShapingProxy
+ *
+ * Free a #GtShapingProxy. This will call gt_shaping_proxy_stop() if it hasn’t
+ * been called already.
+ *
+ * Since: 0.2.0
+ */
+void
+gt_shaping_proxy_free (GtShapingProxy *self)
+{
+  g_return_if_fail (self != NULL);
+
+  if (self->thread != NULL)
+    gt_shaping_proxy_stop (self);
+
+  g_clear_pointer (&self->connections, g_ptr_array_unref);
+  g_clear_pointer (&self->context, g_main_context_unref);
+  g_mutex_clear (&self->lock);
+
+  g_free (self->socket_path);
+  g_free (self->socket_dir);
+  g_free (self->address);
+  g_free (self->upstream_address);
+
+  g_free (self);
+}
+
+/**
+ * gt_shaping_proxy_start:
+ * @self: a #GtShapingProxy
+ * @error: return location for a #GError, or %NULL
+ *
+ * Start listening for connections, and start the proxy thread. The address to
+ * connect to is available from gt_shaping_proxy_get_address() once this
+ * returns successfully.
+ *
+ * Returns: %TRUE on success, %FALSE otherwise
+ * Since: 0.2.0
+ */
+gboolean
+gt_shaping_proxy_start (GtShapingProxy  *self,
+                        GError         **error)
+{
+  g_autofree gchar *socket_dir = NULL;
+  g_autofree gchar *socket_path = NULL;
+  g_autofree gchar *escaped_path = NULL;
+  g_autoptr(GSocket) listen_socket = NULL;
+  g_autoptr(GSocketAddress) listen_address = NULL;
+
+  g_return_val_if_fail (self != NULL, FALSE);
+  g_return_val_if_fail (self->thread == NULL, FALSE);
+  g_return_val_if_fail (error == NULL || *error == NULL, FALSE);
+
+  socket_dir = g_dir_make_tmp ("gt-shaping-proxy-XXXXXX", error);
+  if (socket_dir == NULL)
+    return FALSE;
+
+  socket_path = g_build_filename (socket_dir, "socket", NULL);
+  listen_address = g_unix_socket_address_new (socket_path);
+  listen_socket = g_socket_new (G_SOCKET_FAMILY_UNIX, G_SOCKET_TYPE_STREAM,
+                                G_SOCKET_PROTOCOL_DEFAULT, error);
+
+  if (listen_socket == NULL ||
+      !g_socket_bind (listen_socket, listen_address, TRUE, error) ||
+      !g_socket_listen (listen_socket, error))
+    {
+      g_unlink (socket_path);
+      g_rmdir (socket_dir);
+      return FALSE;
+    }
+
+  g_socket_set_blocking (listen_socket, FALSE);
+
+  escaped_path = g_dbus_address_escape_value (socket_path);
+  g_free (self->address);
+  self->address = g_strdup_printf ("unix:path=%s", escaped_path);
+  g_free (self->socket_dir);
+  self->socket_dir = g_steal_pointer (&socket_dir);
+  g_free (self->socket_path);
+  self->socket_path = g_steal_pointer (&socket_path);
+  self->listen_socket = g_steal_pointer (&listen_socket);
+
+  self->listen_source = g_socket_create_source (self->listen_socket, G_IO_IN, NULL);
+  g_source_set_name (self->listen_source, "GtShapingProxy listen");
+  g_source_set_callback (self->listen_source, SOCKET_SOURCE_FUNC (listen_cb),
+                         self, NULL);
+  g_source_attach (self->listen_source, self->context);
+
+  g_atomic_int_set (&self->quitting, FALSE);
+  self->thread = g_thread_new ("GtShapingProxy", proxy_thread_cb, self);
+
+  return TRUE;
+}
+
+/**
+ * gt_shaping_proxy_stop:
+ * @self: a #GtShapingProxy
+ *
+ * Stop the proxy thread, close all the connections through the proxy, and stop
+ * listening for new ones. Any data which is still queued in the proxy is
+ * dropped.
+ *
+ * This must be called from the thread which called gt_shaping_proxy_start().
+ *
+ * Since: 0.2.0
+ */
+void
+gt_shaping_proxy_stop (GtShapingProxy *self)
+{
+  g_return_if_fail (self != NULL);
+  g_return_if_fail (self->thread != NULL);
+
+  g_atomic_int_set (&self->quitting, TRUE);
+  g_main_context_wakeup (self->context);
+  g_thread_join (g_steal_pointer (&self->thread));
+
+  g_socket_close (self->listen_socket, NULL);
+  g_clear_object (&self->listen_socket);
+
+  g_unlink (self->socket_path);
+  g_rmdir (self->socket_dir);
+}
+
+/**
+ * gt_shaping_proxy_get_address:
+ * @self: a #GtShapingProxy
+ *
+ * Get the D-Bus address which clients should connect to in order to have their
+ * traffic go through the proxy. This will be %NULL if gt_shaping_proxy_start()
+ * has not been called yet.
+ *
+ * Returns: (nullable): D-Bus address of the proxy
+ * Since: 0.2.0
+ */
+const gchar *
+gt_shaping_proxy_get_address (GtShapingProxy *self)
+{
+  g_return_val_if_fail (self != NULL, NULL);
+
+  return self->address;
+}
+
+/**
+ * gt_shaping_proxy_set_latency:
+ * @self: a #GtShapingProxy
+ * @direction: direction of traffic to shape
+ * @latency_ms: latency to add, in milliseconds
+ *
+ * Set the latency added to traffic in @direction. Each block of data received
+ * by the proxy is held for @latency_ms before it is forwarded. The default is
+ * no added latency.
+ *
+ * This may be called from any thread, and takes effect for data received after
+ * it is called.
+ *
+ * Since: 0.2.0
+ */
+void
+gt_shaping_proxy_set_latency (GtShapingProxy          *self,
+                              GtShapingProxyDirection  direction,
+                              guint                    latency_ms)
+{
+  g_return_if_fail (self != NULL);
+  g_return_if_fail ((guint) direction < G_N_ELEMENTS (self->params));
+
+  g_mutex_lock (&self->lock);
+  self->params[direction].latency_ms = latency_ms;
+  g_mutex_unlock (&self->lock);
+}
+
+/**
+ * gt_shaping_proxy_set_bandwidth:
+ * @self: a #GtShapingProxy
+ * @direction: direction of traffic to shape
+ * @bytes_per_second: maximum bandwidth, in bytes per second, or 0 for unlimited
+ *
+ * Set the maximum bandwidth for traffic in @direction. The default is
+ * unlimited.
+ *
+ * This may be called from any thread.
+ *
+ * Since: 0.2.0
+ */
+void
+gt_shaping_proxy_set_bandwidth (GtShapingProxy          *self,
+                                GtShapingProxyDirection  direction,
+                                gsize                    bytes_per_second)
+{
+  g_return_if_fail (self != NULL);
+  g_return_if_fail ((guint) direction < G_N_ELEMENTS (self->params));
+
+  g_mutex_lock (&self->lock);
+  self->params[direction].bandwidth = bytes_per_second;
+  g_mutex_unlock (&self->lock);
+}
+
+/**
+ * gt_shaping_proxy_set_max_chunk_size:
+ * @self: a #GtShapingProxy
+ * @direction: direction of traffic to shape
+ * @max_chunk_size: maximum number of bytes to write at once, or 0 for unlimited
+ *
+ * Set the maximum number of bytes which are forwarded in a single write in
+ * @direction. Larger blocks of data are split into several partial writes,
+ * with an iteration of the proxy’s main loop between each, so the receiver
+ * sees them as separate partial reads. The default is unlimited.
+ *
+ * This may be called from any thread.
+ *
+ * Since: 0.2.0
+ */
+void
+gt_shaping_proxy_set_max_chunk_size (GtShapingProxy          *self,
+                                     GtShapingProxyDirection  direction,
+                                     gsize                    max_chunk_size)
+{
+  g_return_if_fail (self != NULL);
+  g_return_if_fail ((guint) direction < G_N_ELEMENTS (self->params));
+
+  g_mutex_lock (&self->lock);
+  self->params[direction].max_chunk_size = max_chunk_size;
+  g_mutex_unlock (&self->lock);
+}
+
+/**
+ * gt_shaping_proxy_get_n_bytes:
+ * @self: a #GtShapingProxy
+ * @direction: direction of traffic
+ *
+ * Get the total number of bytes which have been forwarded in @direction, over
+ * all connections.
+ *
+ * This may be called from any thread.
+ *
+ * Returns: number of bytes forwarded
+ * Since: 0.2.0
+ */
+guint64
+gt_shaping_proxy_get_n_bytes (GtShapingProxy          *self,
+                              GtShapingProxyDirection  direction)
+{
+  guint64 n_bytes;
+
+  g_return_val_if_fail (self != NULL, 0);
+  g_return_val_if_fail ((guint) direction < G_N_ELEMENTS (self->params), 0);
+
+  g_mutex_lock (&self->lock);
+  n_bytes = self->params[direction].n_bytes;
+  g_mutex_unlock (&self->lock);
+
+  return n_bytes;
+}
@@ -0,0 +1,71 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ *
+ * Copyright © 2018 Endless Mobile, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#pragma once
+
+#include <gio/gio.h>
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/**
+ * GtShapingProxyDirection:
+ * @GT_SHAPING_PROXY_DIRECTION_TO_SERVER: data sent by the client, towards the
+ *    upstream server
+ * @GT_SHAPING_PROXY_DIRECTION_TO_CLIENT: data sent by the upstream server,
+ *    towards the client
+ *
+ * A direction of traffic through a #GtShapingProxy. Each direction is shaped
+ * independently.
+ *
+ * Since: 0.2.0
+ */
+typedef enum
+{
+  GT_SHAPING_PROXY_DIRECTION_TO_SERVER,
+  GT_SHAPING_PROXY_DIRECTION_TO_CLIENT,
+} GtShapingProxyDirection;
+
+typedef struct _GtShapingProxy GtShapingProxy;
+
+GtShapingProxy *gt_shaping_proxy_new  (const gchar    *upstream_address);
+void            gt_shaping_proxy_free (GtShapingProxy *self);
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC (GtShapingProxy, gt_shaping_proxy_free)
+
+gboolean     gt_shaping_proxy_start       (GtShapingProxy  *self,
+                                           GError         **error);
+void         gt_shaping_proxy_stop        (GtShapingProxy  *self);
+const gchar *gt_shaping_proxy_get_address (GtShapingProxy  *self);
+
+void    gt_shaping_proxy_set_latency        (GtShapingProxy          *self,
+                                             GtShapingProxyDirection  direction,
+                                             guint                    latency_ms);
+void    gt_shaping_proxy_set_bandwidth      (GtShapingProxy          *self,
+                                             GtShapingProxyDirection  direction,
+                                             gsize                    bytes_per_second);
+void    gt_shaping_proxy_set_max_chunk_size (GtShapingProxy          *self,
+                                             GtShapingProxyDirection  direction,
+                                             gsize                    max_chunk_size);
+
+guint64 gt_shaping_proxy_get_n_bytes        (GtShapingProxy          *self,
+                                             GtShapingProxyDirection  direction);
+
+G_END_DECLS
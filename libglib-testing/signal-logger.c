@@ -118,9 +118,11 @@ struct _GtSignalLoggerEmission
 {
   /* The closure this emission was captured by. */
   GtLoggedClosure *closure;  /* (owned) */
-  /* Array of parameter values, not including the object instance. */
-  GValue *param_values;  /* (array length=n_param_values) */
   gsize n_param_values;
+  /* Array of parameter values, not including the object instance. This is
+   * allocated in the same block as the emission, so capturing an emission
+   * only needs a single allocation. */
+  GValue param_values[];  /* (array length=n_param_values) */
 };
 
 /**
@@ -136,7 +138,6 @@ gt_signal_logger_emission_free (GtSignalLoggerEmission *emission)
 {
   for (gsize i = 0; i < emission->n_param_values; i++)
     g_value_unset (&emission->param_values[i]);
-  g_free (emission->param_values);
 
   g_closure_unref ((GClosure *) emission->closure);
   g_free (emission);
@@ -181,6 +182,47 @@ gt_signal_logger_emission_get_params (GtSignalLoggerEmission *self,
   va_end (ap);
 }
 
+/**
+ * gt_signal_logger_emission_get_n_params:
+ * @self: a #GtSignalLoggerEmission
+ *
+ * Get the number of parameters in this signal emission, not including the
+ * object instance.
+ *
+ * Returns: number of parameters
+ * Since: 0.2.0
+ */
+gsize
+gt_signal_logger_emission_get_n_params (const GtSignalLoggerEmission *self)
+{
+  g_return_val_if_fail (self != NULL, 0);
+
+  return self->n_param_values;
+}
+
+/**
+ * gt_signal_logger_emission_get_param:
+ * @self: a #GtSignalLoggerEmission
+ * @index: index of the parameter, not counting the object instance
+ *
+ * Get a single parameter from this signal emission. Unlike
+ * gt_signal_logger_emission_get_params(), this allows the type of the
+ * parameter to be checked before it is extracted, which is useful for language
+ * bindings.
+ *
+ * Returns: (transfer none): the parameter value, valid as long as @self is
+ * Since: 0.2.0
+ */
+const GValue *
+gt_signal_logger_emission_get_param (const GtSignalLoggerEmission *self,
+                                     gsize                         index)
+{
+  g_return_val_if_fail (self != NULL, NULL);
+  g_return_val_if_fail (index < self->n_param_values, NULL);
+
+  return &self->param_values[index];
+}
+
 static void
 gt_logged_closure_marshal (GClosure     *closure,
                            GValue       *return_value,
@@ -195,10 +237,11 @@ gt_logged_closure_marshal (GClosure     *closure,
    * @param_values (which is the object instance). */
   g_assert (n_param_values >= 1);
 
-  g_autoptr(GtSignalLoggerEmission) emission = g_new0 (GtSignalLoggerEmission, 1);
+  g_autoptr(GtSignalLoggerEmission) emission =
+      g_malloc0 (sizeof (GtSignalLoggerEmission) +
+                 (n_param_values - 1) * sizeof (GValue));
   emission->closure = (GtLoggedClosure *) g_closure_ref ((GClosure *) self);
   emission->n_param_values = n_param_values - 1;
-  emission->param_values = g_new0 (GValue, emission->n_param_values);
 
   for (gsize i = 0; i < emission->n_param_values; i++)
     {
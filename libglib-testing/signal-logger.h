@@ -29,9 +29,12 @@ G_BEGIN_DECLS
 
 typedef struct _GtSignalLoggerEmission GtSignalLoggerEmission;
 
-void            gt_signal_logger_emission_free       (GtSignalLoggerEmission *emission);
-void            gt_signal_logger_emission_get_params (GtSignalLoggerEmission *self,
-                                                      ...);
+void            gt_signal_logger_emission_free         (GtSignalLoggerEmission       *emission);
+void            gt_signal_logger_emission_get_params   (GtSignalLoggerEmission       *self,
+                                                        ...);
+gsize           gt_signal_logger_emission_get_n_params (const GtSignalLoggerEmission *self);
+const GValue   *gt_signal_logger_emission_get_param    (const GtSignalLoggerEmission *self,
+                                                        gsize                         index);
 
 G_DEFINE_AUTOPTR_CLEANUP_FUNC (GtSignalLoggerEmission, gt_signal_logger_emission_free)
 
@@ -0,0 +1,1623 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ *
+ * Copyright © 2018 Endless Mobile, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#include "config.h"
+
+#include <gio/gio.h>
+#include <gio/gunixsocketaddress.h>
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <libglib-testing/latencies-private.h>
+#include <libglib-testing/socket-queue.h>
+#include <libglib-testing/time-private.h>
+#include <string.h>
+
+
+/**
+ * SECTION:socket-queue
+ * @short_description: Queue of frames received by a mock socket service
+ * @stability: Unstable
+ * @include: libglib-testing/socket-queue.h
+ *
+ * #GtSocketQueue is a mock service for components which speak a simple framed
+ * protocol (such as a line-based or length-prefixed protocol) over a Unix
+ * socket, rather than D-Bus. It listens on a new Unix socket, and splits the
+ * data received on each connection to it into frames, which are put in a
+ * queue. The test can then pop frames off the queue, assert that they are as
+ * expected, and reply to them, in the same way as with a #GtDBusQueue.
+ *
+ * The socket is served by a dedicated thread, running its own #GMainContext
+ * (available from gt_socket_queue_get_server_context()), so the code under
+ * test can block on the socket without deadlocking the test. Frames may be
+ * popped and replied to from any thread.
+ *
+ * Frames are split using a #GtSocketQueueFramerFunc, set using
+ * gt_socket_queue_set_framer(). Two are provided:
+ * gt_socket_queue_framer_lines() (the default) and
+ * gt_socket_queue_framer_length_prefixed().
+ *
+ * Data is received into large buffers which are recycled once all the frames
+ * referencing them have been freed, and the payload of each frame is a
+ * #GBytes slice of one of those buffers, so frames are not copied between
+ * being received and being popped.
+ *
+ * The number of frames and bytes received and sent, the throughput, and the
+ * latency between each frame being received and being replied to, are
+ * recorded, and are available using gt_socket_queue_format_stats() and
+ * related functions.
+ *
+ * Since: 0.2.0
+ */
+
+/* Size of each receive buffer. Buffers are only reused once all the frames
+ * referencing them have been freed, so this trades memory usage against the
+ * number of allocations. */
+#define BLOCK_SIZE 65536
+
+/* Maximum number of free buffers to keep for reuse. */
+#define MAX_FREE_BLOCKS 8
+
+/* FIXME: Use G_SOURCE_FUNC() once we can depend on a new enough GLib
+ * version. */
+#define SOCKET_SOURCE_FUNC(f) ((GSourceFunc) (void (*) (void)) (f))
+
+/* A pool of free receive buffers of %BLOCK_SIZE bytes. It is reference counted
+ * because frame payloads (and hence the buffers they slice) may outlive the
+ * #GtSocketQueue. */
+typedef struct
+{
+  gint ref_count;  /* (atomic) */
+  GMutex lock;
+  GPtrArray *free_blocks;  /* (owned) (element-type guint8) (locked-by lock) */
+} BlockPool;
+
+static BlockPool *
+block_pool_new (void)
+{
+  BlockPool *pool = g_new0 (BlockPool, 1);
+
+  pool->ref_count = 1;
+  g_mutex_init (&pool->lock);
+  pool->free_blocks = g_ptr_array_new_with_free_func (g_free);
+
+  return pool;
+}
+
+static BlockPool *
+block_pool_ref (BlockPool *pool)
+{
+  g_atomic_int_inc (&pool->ref_count);
+  return pool;
+}
+
+static void
+block_pool_unref (BlockPool *pool)
+{
+  if (!g_atomic_int_dec_and_test (&pool->ref_count))
+    return;
+
+  g_clear_pointer (&pool->free_blocks, g_ptr_array_unref);
+  g_mutex_clear (&pool->lock);
+  g_free (pool);
+}
+
+/* A receive buffer, owned by the #GBytes which wraps it. */
+typedef struct
+{
+  BlockPool *pool;  /* (owned) */
+  guint8 *data;  /* (owned) */
+  gsize size;
+} Block;
+
+/* Called once the last reference to a block’s #GBytes (held by the connection
+ * or by a frame payload) is dropped. */
+static void
+block_release_cb (gpointer user_data)
+{
+  Block *block = user_data;
+  BlockPool *pool = block->pool;
+
+  g_mutex_lock (&pool->lock);
+  if (block->size == BLOCK_SIZE && pool->free_blocks->len < MAX_FREE_BLOCKS)
+    g_ptr_array_add (pool->free_blocks, g_steal_pointer (&block->data));
+  g_mutex_unlock (&pool->lock);
+
+  g_free (block->data);
+  block_pool_unref (pool);
+  g_free (block);
+}
+
+/* Get a buffer of at least @min_size bytes, reusing a free one from @pool if
+ * possible. Its data is returned in @out_data, and may be written to until the
+ * returned #GBytes is sliced. */
+static GBytes *
+block_pool_new_block (BlockPool  *pool,
+                      gsize       min_size,
+                      guint8    **out_data,
+                      gsize      *out_size)
+{
+  Block *block = g_new0 (Block, 1);
+
+  block->pool = block_pool_ref (pool);
+  block->size = MAX (min_size, BLOCK_SIZE);
+
+  if (block->size == BLOCK_SIZE)
+    {
+      g_mutex_lock (&pool->lock);
+      if (pool->free_blocks->len > 0)
+        block->data = g_ptr_array_remove_index_fast (pool->free_blocks,
+                                                     pool->free_blocks->len - 1);
+      g_mutex_unlock (&pool->lock);
+    }
+
+  if (block->data == NULL)
+    block->data = g_malloc (block->size);
+
+  *out_data = block->data;
+  *out_size = block->size;
+
+  return g_bytes_new_with_free_func (block->data, block->size,
+                                     block_release_cb, block);
+}
+
+/**
+ * GtSocketQueue:
+ *
+ * A mock service which listens on a Unix socket and queues the frames received
+ * on it, so they can be asserted on and replied to.
+ *
+ * Since: 0.2.0
+ */
+struct _GtSocketQueue
+{
+  GtSocketQueueFramerFunc framer;
+  gpointer framer_user_data;
+
+  GSocketAddress *address;  /* (owned) (nullable) */
+  gchar *socket_dir;  /* (owned) (nullable) */
+  gchar *socket_path;  /* (owned) (nullable) */
+
+  GThread *thread;  /* (owned) (nullable) */
+  GMainContext *server_context;  /* (owned) */
+  gboolean quitting;  /* (atomic) */
+  BlockPool *pool;  /* (owned) */
+
+  /* These are only accessed in the server thread while it is running. */
+  GSocket *listen_socket;  /* (owned) (nullable) */
+  GSource *listen_source;  /* (owned) (nullable) */
+  GHashTable *connections;  /* (owned) (element-type guint Connection) */
+  guint next_connection_id;
+
+  GMutex lock;
+  GQueue frames;  /* (element-type GtSocketQueueFrame) (owned) (locked-by lock) */
+  GPtrArray *waiting_contexts;  /* (owned) (element-type GMainContext) (locked-by lock) */
+
+  /* Statistics. */
+  guint64 n_frames_received;  /* (locked-by lock) */
+  guint64 n_bytes_received;  /* (locked-by lock) */
+  guint64 n_bytes_sent;  /* (locked-by lock) */
+  gint64 first_receive_time_ns;  /* (locked-by lock); 0 if nothing received */
+  gint64 last_frame_time_ns;  /* (locked-by lock) */
+  GArray *reply_latencies;  /* (owned) (element-type guint64) (locked-by lock) */
+};
+
+/**
+ * GtSocketQueueFrame:
+ *
+ * A frame received by a #GtSocketQueue.
+ *
+ * Since: 0.2.0
+ */
+struct _GtSocketQueueFrame
+{
+  GtSocketQueue *queue;  /* (unowned) */
+  guint connection_id;
+  GBytes *payload;  /* (owned) */
+  gint64 receive_time_ns;
+  gboolean replied;
+};
+
+/* A reply waiting to be sent, which may have been partially sent. */
+typedef struct
+{
+  GBytes *data;  /* (owned) */
+  gsize offset;  /* number of bytes already sent */
+} Chunk;
+
+static void
+chunk_free (Chunk *chunk)
+{
+  g_bytes_unref (chunk->data);
+  g_free (chunk);
+}
+
+/* A connection to the socket. All of this is accessed only in the server
+ * thread. Received data is appended to @block_bytes at @end; the bytes
+ * between @start and @end are an incomplete frame. Bytes before @start may
+ * be referenced by frame payloads, so are never overwritten. */
+typedef struct
+{
+  GtSocketQueue *queue;  /* (unowned) */
+  guint id;
+  GSocket *socket;  /* (owned) */
+
+  GBytes *block_bytes;  /* (owned) */
+  guint8 *block_data;  /* (unowned); owned by @block_bytes */
+  gsize block_size;
+  gsize start;
+  gsize end;
+
+  GQueue output;  /* (element-type Chunk) (owned) */
+
+  GSource *input_source;  /* (owned) (nullable) */
+  GSource *output_source;  /* (owned) (nullable) */
+} Connection;
+
+static void
+clear_source (GSource **source_pointer)
+{
+  GSource *source = g_steal_pointer (source_pointer);
+
+  if (source != NULL)
+    {
+      g_source_destroy (source);
+      g_source_unref (source);
+    }
+}
+
+static void
+connection_free (Connection *connection)
+{
+  Chunk *chunk;
+
+  clear_source (&connection->input_source);
+  clear_source (&connection->output_source);
+
+  /* FIXME: Use g_queue_clear_full() once we can depend on a new enough GLib
+   * version. */
+  while ((chunk = g_queue_pop_head (&connection->output)) != NULL)
+    chunk_free (chunk);
+
+  g_clear_pointer (&connection->block_bytes, g_bytes_unref);
+  g_socket_close (connection->socket, NULL);
+  g_clear_object (&connection->socket);
+
+  g_free (connection);
+}
+
+/* Close and free @connection. It may not be used after this returns. */
+static void
+connection_close (Connection *connection)
+{
+  g_debug ("%s: Closing connection %u", G_STRFUNC, connection->id);
+  g_hash_table_remove (connection->queue->connections,
+                       GUINT_TO_POINTER (connection->id));
+}
+
+/* Move the incomplete frame at the end of the current block into a new block
+ * which has space for at least as many bytes again. The old block stays alive
+ * for as long as any frame payloads reference it. */
+static void
+connection_new_block (Connection *connection)
+{
+  gsize n_pending = connection->end - connection->start;
+  guint8 *new_data;
+  gsize new_size;
+  GBytes *new_bytes;
+
+  new_bytes = block_pool_new_block (connection->queue->pool, n_pending * 2,
+                                    &new_data, &new_size);
+
+  if (n_pending > 0)
+    memcpy (new_data, connection->block_data + connection->start, n_pending);
+
+  g_clear_pointer (&connection->block_bytes, g_bytes_unref);
+  connection->block_bytes = new_bytes;
+  connection->block_data = new_data;
+  connection->block_size = new_size;
+  connection->start = 0;
+  connection->end = n_pending;
+}
+
+/* Split as many complete frames as possible off the pending data in
+ * @connection, and push them onto the queue. */
+static void
+connection_parse_frames (Connection *connection)
+{
+  GtSocketQueue *self = connection->queue;
+  GPtrArray *frames = g_ptr_array_new ();
+  gint64 now_ns = gt_get_time_ns ();
+
+  while (connection->start < connection->end)
+    {
+      gsize n_pending = connection->end - connection->start;
+      gsize payload_offset = 0, payload_length = 0;
+      gsize frame_length;
+      GtSocketQueueFrame *frame;
+
+      frame_length = self->framer (connection->block_data + connection->start,
+                                   n_pending, &payload_offset, &payload_length,
+                                   self->framer_user_data);
+
+      if (frame_length == 0)
+        break;
+
+      g_assert (frame_length <= n_pending);
+      g_assert (payload_offset <= frame_length &&
+                payload_length <= frame_length - payload_offset);
+
+      frame = g_new0 (GtSocketQueueFrame, 1);
+      frame->queue = self;
+      frame->connection_id = connection->id;
+      frame->payload = g_bytes_new_from_bytes (connection->block_bytes,
+                                               connection->start + payload_offset,
+                                               payload_length);
+      frame->receive_time_ns = now_ns;
+      g_ptr_array_add (frames, frame);
+
+      connection->start += frame_length;
+    }
+
+  if (frames->len > 0)
+    {
+      g_mutex_lock (&self->lock);
+
+      for (gsize i = 0; i < frames->len; i++)
+        g_queue_push_tail (&self->frames, g_ptr_array_index (frames, i));
+
+      self->n_frames_received += frames->len;
+      self->last_frame_time_ns = now_ns;
+
+      for (gsize i = 0; i < self->waiting_contexts->len; i++)
+        g_main_context_wakeup (g_ptr_array_index (self->waiting_contexts, i));
+
+      g_mutex_unlock (&self->lock);
+
+      g_debug ("%s: Queued %u frames from connection %u",
+               G_STRFUNC, frames->len, connection->id);
+    }
+
+  g_ptr_array_unref (frames);
+}
+
+static void connection_pump_output (Connection *connection);
+
+static gboolean
+connection_output_cb (GSocket      *socket,
+                      GIOCondition  condition,
+                      gpointer      user_data)
+{
+  Connection *connection = user_data;
+
+  g_clear_pointer (&connection->output_source, g_source_unref);
+  connection_pump_output (connection);
+
+  return G_SOURCE_REMOVE;
+}
+
+/* Send as much of the queued output on @connection as possible, and arrange to
+ * be called again when more can be sent. This may close (and hence free)
+ * @connection. */
+static void
+connection_pump_output (Connection *connection)
+{
+  GtSocketQueue *self = connection->queue;
+
+  while (!g_queue_is_empty (&connection->output))
+    {
+      Chunk *chunk = g_queue_peek_head (&connection->output);
+      const guint8 *data;
+      gsize data_size;
+      gssize n_sent;
+      g_autoptr(GError) local_error = NULL;
+
+      data = g_bytes_get_data (chunk->data, &data_size);
+      n_sent = g_socket_send (connection->socket,
+                              (const gchar *) data + chunk->offset,
+                              data_size - chunk->offset, NULL, &local_error);
+
+      if (n_sent < 0 &&
+          g_error_matches (local_error, G_IO_ERROR, G_IO_ERROR_WOULD_BLOCK))
+        {
+          if (connection->output_source == NULL)
+            {
+              connection->output_source = g_socket_create_source (connection->socket,
+                                                                  G_IO_OUT, NULL);
+              g_source_set_name (connection->output_source, "GtSocketQueue output");
+              g_source_set_callback (connection->output_source,
+                                     SOCKET_SOURCE_FUNC (connection_output_cb),
+                                     connection, NULL);
+              g_source_attach (connection->output_source, self->server_context);
+            }
+          return;
+        }
+      else if (n_sent < 0)
+        {
+          g_debug ("%s: Error sending: %s", G_STRFUNC, local_error->message);
+          connection_close (connection);
+          return;
+        }
+
+      chunk->offset += (gsize) n_sent;
+
+      g_mutex_lock (&self->lock);
+      self->n_bytes_sent += (guint64) n_sent;
+      g_mutex_unlock (&self->lock);
+
+      if (chunk->offset == data_size)
+        chunk_free (g_queue_pop_head (&connection->output));
+    }
+}
+
+static gboolean
+connection_input_cb (GSocket      *socket,
+                     GIOCondition  condition,
+                     gpointer      user_data)
+{
+  Connection *connection = user_data;
+  GtSocketQueue *self = connection->queue;
+  gssize n_received;
+  g_autoptr(GError) local_error = NULL;
+
+  if (connection->end == connection->block_size)
+    connection_new_block (connection);
+
+  n_received = g_socket_receive (socket,
+                                 (gchar *) connection->block_data + connection->end,
+                                 connection->block_size - connection->end,
+                                 NULL, &local_error);
+
+  if (n_received < 0 &&
+      g_error_matches (local_error, G_IO_ERROR, G_IO_ERROR_WOULD_BLOCK))
+    {
+      return G_SOURCE_CONTINUE;
+    }
+  else if (n_received < 0)
+    {
+      g_debug ("%s: Error receiving: %s", G_STRFUNC, local_error->message);
+      connection_close (connection);
+      return G_SOURCE_REMOVE;
+    }
+  else if (n_received == 0)
+    {
+      if (connection->end > connection->start)
+        g_debug ("%s: Dropping %" G_GSIZE_FORMAT " bytes of incomplete frame",
+                 G_STRFUNC, connection->end - connection->start);
+      connection_close (connection);
+      return G_SOURCE_REMOVE;
+    }
+
+  connection->end += (gsize) n_received;
+
+  g_mutex_lock (&self->lock);
+  if (self->first_receive_time_ns == 0)
+    self->first_receive_time_ns = gt_get_time_ns ();
+  self->n_bytes_received += (guint64) n_received;
+  g_mutex_unlock (&self->lock);
+
+  connection_parse_frames (connection);
+
+  return G_SOURCE_CONTINUE;
+}
+
+static gboolean
+listen_cb (GSocket      *socket,
+           GIOCondition  condition,
+           gpointer      user_data)
+{
+  GtSocketQueue *self = user_data;
+  g_autoptr(GSocket) client_socket = NULL;
+  g_autoptr(GError) local_error = NULL;
+  Connection *connection;
+
+  client_socket = g_socket_accept (socket, NULL, &local_error);
+
+  if (client_socket == NULL)
+    {
+      if (!g_error_matches (local_error, G_IO_ERROR, G_IO_ERROR_WOULD_BLOCK))
+        g_debug ("%s: Error accepting connection: %s",
+                 G_STRFUNC, local_error->message);
+      return G_SOURCE_CONTINUE;
+    }
+
+  g_socket_set_blocking (client_socket, FALSE);
+
+  connection = g_new0 (Connection, 1);
+  connection->queue = self;
+  connection->id = ++self->next_connection_id;
+  connection->socket = g_steal_pointer (&client_socket);
+  g_queue_init (&connection->output);
+  connection_new_block (connection);
+
+  connection->input_source = g_socket_create_source (connection->socket,
+                                                     G_IO_IN | G_IO_HUP | G_IO_ERR,
+                                                     NULL);
+  g_source_set_name (connection->input_source, "GtSocketQueue input");
+  g_source_set_callback (connection->input_source,
+                         SOCKET_SOURCE_FUNC (connection_input_cb),
+                         connection, NULL);
+  g_source_attach (connection->input_source, self->server_context);
+
+  g_hash_table_insert (self->connections, GUINT_TO_POINTER (connection->id),
+                       connection);
+  g_debug ("%s: Accepted connection %u", G_STRFUNC, connection->id);
+
+  return G_SOURCE_CONTINUE;
+}
+
+/* The main function for the server thread. This runs
+ * #GtSocketQueue.server_context until #GtSocketQueue.quitting is set, then
+ * closes all the connections. */
+static gpointer
+server_thread_cb (gpointer user_data)
+{
+  GtSocketQueue *self = user_data;
+
+  g_main_context_push_thread_default (self->server_context);
+
+  while (!g_atomic_int_get (&self->quitting))
+    g_main_context_iteration (self->server_context, TRUE);
+
+  g_hash_table_remove_all (self->connections);
+  clear_source (&self->listen_source);
+
+  /* Process any remaining sources while quitting, without blocking. */
+  while (g_main_context_iteration (self->server_context, FALSE));
+
+  g_main_context_pop_thread_default (self->server_context);
+
+  return NULL;
+}
+
+/**
+ * gt_socket_queue_framer_lines:
+ * @data: (array length=length): received bytes
+ * @length: number of bytes in @data
+ * @out_payload_offset: (out): return location for the payload offset
+ * @out_payload_length: (out): return location for the payload length
+ * @user_data: unused
+ *
+ * A #GtSocketQueueFramerFunc which splits data into lines terminated by `\n`.
+ * The payload of each frame is the line without its terminator (or its
+ * `\r\n` terminator, if it has one).
+ *
+ * This is the default framer.
+ *
+ * Returns: length of the first line in @data, including its terminator, or 0
+ *    if it is incomplete
+ * Since: 0.2.0
+ */
+gsize
+gt_socket_queue_framer_lines (const guint8 *data,
+                              gsize         length,
+                              gsize        *out_payload_offset,
+                              gsize        *out_payload_length,
+                              gpointer      user_data)
+{
+  const guint8 *newline = memchr (data, '\n', length);
+  gsize line_length;
+
+  if (newline == NULL)
+    return 0;
+
+  line_length = (gsize) (newline - data);
+
+  *out_payload_offset = 0;
+  *out_payload_length = line_length;
+  if (line_length > 0 && data[line_length - 1] == '\r')
+    *out_payload_length = line_length - 1;
+
+  return line_length + 1;
+}
+
+/**
+ * gt_socket_queue_framer_length_prefixed:
+ * @data: (array length=length): received bytes
+ * @length: number of bytes in @data
+ * @out_payload_offset: (out): return location for the payload offset
+ * @out_payload_length: (out): return location for the payload length
+ * @user_data: unused
+ *
+ * A #GtSocketQueueFramerFunc which splits data into frames which each start
+ * with their payload length, as a big-endian 32-bit unsigned integer. The
+ * payload of each frame excludes the length prefix.
+ *
+ * Returns: length of the first frame in @data, including its prefix, or 0 if
+ *    it is incomplete
+ * Since: 0.2.0
+ */
+gsize
+gt_socket_queue_framer_length_prefixed (const guint8 *data,
+                                        gsize         length,
+                                        gsize        *out_payload_offset,
+                                        gsize        *out_payload_length,
+                                        gpointer      user_data)
+{
+  guint32 payload_length;
+
+  if (length < sizeof (payload_length))
+    return 0;
+
+  memcpy (&payload_length, data, sizeof (payload_length));
+  payload_length = GUINT32_FROM_BE (payload_length);
+
+  if (length - sizeof (payload_length) < payload_length)
+    return 0;
+
+  *out_payload_offset = sizeof (payload_length);
+  *out_payload_length = payload_length;
+
+  return sizeof (payload_length) + payload_length;
+}
+
+/**
+ * gt_socket_queue_new:
+ *
+ * Create a new #GtSocketQueue. Set its framer using
+ * gt_socket_queue_set_framer() if needed, and then start it using
+ * gt_socket_queue_start().
+ *
+ * Returns: (transfer full): a new #GtSocketQueue
+ * Since: 0.2.0
+ */
+GtSocketQueue *
+gt_socket_queue_new (void)
+{
+  g_autoptr(GtSocketQueue) queue = NULL;
+
+  queue = g_new0 (GtSocketQueue, 1);
+  queue->framer = gt_socket_queue_framer_lines;
+  queue->server_context = g_main_context_new ();
+  queue->pool = block_pool_new ();
+  queue->connections = g_hash_table_new_full (NULL, NULL, NULL,
+                                              (GDestroyNotify) connection_free);
+  g_mutex_init (&queue->lock);
+  g_queue_init (&queue->frames);
+  queue->waiting_contexts = g_ptr_array_new_with_free_func ((GDestroyNotify) g_main_context_unref);
+  queue->reply_latencies = g_array_new (FALSE, FALSE, sizeof (guint64));
+
+  return g_steal_pointer (&queue);
+}
+
+/**
+ * gt_socket_queue_free:
+ * @self: (transfer full): a #GtSocketQueue
+ *
+ * Free a #GtSocketQueue. This will call gt_socket_queue_stop() if it hasn’t
+ * been called already. Any frames still in the queue are freed.
+ *
+ * Frames which have been popped may outlive the queue, but must not be replied
+ * to after it has been freed.
+ *
+ * Since: 0.2.0
+ */
+void
+gt_socket_queue_free (GtSocketQueue *self)
+{
+  GtSocketQueueFrame *frame;
+
+  g_return_if_fail (self != NULL);
+
+  if (self->thread != NULL)
+    gt_socket_queue_stop (self);
+
+  /* FIXME: Use g_queue_clear_full() once we can depend on a new enough GLib
+   * version. */
+  while ((frame = g_queue_pop_head (&self->frames)) != NULL)
+    gt_socket_queue_frame_free (frame);
+
+  g_assert (self->waiting_contexts->len == 0);
+  g_clear_pointer (&self->waiting_contexts, g_ptr_array_unref);
+  g_clear_pointer (&self->reply_latencies, g_array_unref);
+  g_clear_pointer (&self->connections, g_hash_table_unref);
+  g_clear_pointer (&self->pool, block_pool_unref);
+  g_clear_pointer (&self->server_context, g_main_context_unref);
+  g_mutex_clear (&self->lock);
+
+  g_clear_object (&self->address);
+  g_free (self->socket_path);
+  g_free (self->socket_dir);
+
+  g_free (self);
+}
+
+/**
+ * gt_socket_queue_set_framer:
+ * @self: a #GtSocketQueue
+ * @func: (nullable): function to split received data into frames, or %NULL
+ *    to use gt_socket_queue_framer_lines()
+ * @user_data: user data to pass to @func
+ *
+ * Set the function used to split the data received on each connection into
+ * frames. It is called in the server thread.
+ *
+ * This must be called before gt_socket_queue_start().
+ *
+ * Since: 0.2.0
+ */
+void
+gt_socket_queue_set_framer (GtSocketQueue           *self,
+                            GtSocketQueueFramerFunc  func,
+                            gpointer                 user_data)
+{
+  g_return_if_fail (self != NULL);
+  g_return_if_fail (self->thread == NULL);
+
+  self->framer = (func != NULL) ? func : gt_socket_queue_framer_lines;
+  self->framer_user_data = user_data;
+}
+
+/**
+ * gt_socket_queue_start:
+ * @self: a #GtSocketQueue
+ * @error: return location for a #GError, or %NULL
+ *
+ * Start listening for connections, and start the server thread. The address to
+ * connect to is available from gt_socket_queue_get_address() once this returns
+ * successfully.
+ *
+ * An abstract Unix socket is used if the platform supports them; otherwise, a
+ * socket in a new temporary directory is used.
+ *
+ * Returns: %TRUE on success, %FALSE otherwise
+ * Since: 0.2.0
+ */
+gboolean
+gt_socket_queue_start (GtSocketQueue  *self,
+                       GError        **error)
+{
+  g_autofree gchar *socket_dir = NULL;
+  g_autofree gchar *socket_path = NULL;
+  g_autoptr(GSocket) listen_socket = NULL;
+  g_autoptr(GSocketAddress) listen_address = NULL;
+
+  g_return_val_if_fail (self != NULL, FALSE);
+  g_return_val_if_fail (self->thread == NULL, FALSE);
+  g_return_val_if_fail (error == NULL || *error == NULL, FALSE);
+
+  if (g_unix_socket_address_abstract_names_supported ())
+    {
+      g_autofree gchar *name = g_strdup_printf ("libglib-testing/socket-queue/%08x%08x",
+                                                g_random_int (), g_random_int ());
+      listen_address = g_unix_socket_address_new_with_type (name, -1,
+                                                            G_UNIX_SOCKET_ADDRESS_ABSTRACT);
+    }
+  else
+    {
+      socket_dir = g_dir_make_tmp ("gt-socket-queue-XXXXXX", error);
+      if (socket_dir == NULL)
+        return FALSE;
+
+      socket_path = g_build_filename (socket_dir, "socket", NULL);
+      listen_address = g_unix_socket_address_new (socket_path);
+    }
+
+  listen_socket = g_socket_new (G_SOCKET_FAMILY_UNIX, G_SOCKET_TYPE_STREAM,
+                                G_SOCKET_PROTOCOL_DEFAULT, error);
+
+  if (listen_socket == NULL ||
+      !g_socket_bind (listen_socket, listen_address, TRUE, error) ||
+      !g_socket_listen (listen_socket, error))
+    {
+      if (socket_dir != NULL)
+        {
+          g_unlink (socket_path);
+          g_rmdir (socket_dir);
+        }
+      return FALSE;
+    }
+
+  g_socket_set_blocking (listen_socket, FALSE);
+
+  g_clear_object (&self->address);
+  self->address = g_steal_pointer (&listen_address);
+  g_free (self->socket_dir);
+  self->socket_dir = g_steal_pointer (&socket_dir);
+  g_free (self->socket_path);
+  self->socket_path = g_steal_pointer (&socket_path);
+  self->listen_socket = g_steal_pointer (&listen_socket);
+
+  self->listen_source = g_socket_create_source (self->listen_socket, G_IO_IN, NULL);
+  g_source_set_name (self->listen_source, "GtSocketQueue listen");
+  g_source_set_callback (self->listen_source, SOCKET_SOURCE_FUNC (listen_cb),
+                         self, NULL);
+  g_source_attach (self->listen_source, self->server_context);
+
+  g_atomic_int_set (&self->quitting, FALSE);
+  self->thread = g_thread_new ("GtSocketQueue", server_thread_cb, self);
+
+  return TRUE;
+}
+
+/**
+ * gt_socket_queue_stop:
+ * @self: a #GtSocketQueue
+ *
+ * Stop the server thread, close all the connections to the socket, and stop
+ * listening for new ones. Any replies which have not been sent yet are
+ * dropped. Frames which have already been received stay in the queue.
+ *
+ * This must be called from the thread which called gt_socket_queue_start().
+ *
+ * Since: 0.2.0
+ */
+void
+gt_socket_queue_stop (GtSocketQueue *self)
+{
+  g_return_if_fail (self != NULL);
+  g_return_if_fail (self->thread != NULL);
+
+  g_atomic_int_set (&self->quitting, TRUE);
+  g_main_context_wakeup (self->server_context);
+  g_thread_join (g_steal_pointer (&self->thread));
+
+  g_socket_close (self->listen_socket, NULL);
+  g_clear_object (&self->listen_socket);
+
+  if (self->socket_dir != NULL)
+    {
+      g_unlink (self->socket_path);
+      g_rmdir (self->socket_dir);
+    }
+}
+
+/**
+ * gt_socket_queue_get_address:
+ * @self: a #GtSocketQueue
+ *
+ * Get the address of the socket which the code under test should connect to.
+ * This will be %NULL if gt_socket_queue_start() has not been called yet.
+ *
+ * Returns: (transfer none) (nullable): address of the socket
+ * Since: 0.2.0
+ */
+GSocketAddress *
+gt_socket_queue_get_address (GtSocketQueue *self)
+{
+  g_return_val_if_fail (self != NULL, NULL);
+
+  return self->address;
+}
+
+/**
+ * gt_socket_queue_get_server_context:
+ * @self: a #GtSocketQueue
+ *
+ * Get the #GMainContext which the server thread runs.
+ *
+ * Returns: (transfer none): the server’s #GMainContext
+ * Since: 0.2.0
+ */
+GMainContext *
+gt_socket_queue_get_server_context (GtSocketQueue *self)
+{
+  g_return_val_if_fail (self != NULL, NULL);
+
+  return self->server_context;
+}
+
+/**
+ * gt_socket_queue_get_n_frames:
+ * @self: a #GtSocketQueue
+ *
+ * Get the number of frames waiting in the queue to be popped.
+ *
+ * This may be called from any thread.
+ *
+ * Returns: number of queued frames
+ * Since: 0.2.0
+ */
+gsize
+gt_socket_queue_get_n_frames (GtSocketQueue *self)
+{
+  gsize n_frames;
+
+  g_return_val_if_fail (self != NULL, 0);
+
+  g_mutex_lock (&self->lock);
+  n_frames = self->frames.length;
+  g_mutex_unlock (&self->lock);
+
+  return n_frames;
+}
+
+static gboolean
+gt_socket_queue_pop_frame_internal (GtSocketQueue       *self,
+                                    gboolean             wait,
+                                    GtSocketQueueFrame **out_frame)
+{
+  g_autoptr(GtSocketQueueFrame) frame = NULL;
+  g_autoptr(GMainContext) context = NULL;
+  gboolean frame_popped;
+
+  context = g_main_context_ref_thread_default ();
+
+  g_mutex_lock (&self->lock);
+
+  while (TRUE)
+    {
+      frame = g_queue_pop_head (&self->frames);
+
+      if (frame != NULL || !wait)
+        break;
+
+      /* Register @context to be woken up when a frame is pushed, and block
+       * until then. */
+      g_ptr_array_add (self->waiting_contexts, g_main_context_ref (context));
+      g_mutex_unlock (&self->lock);
+
+      g_main_context_iteration (context, TRUE);
+
+      g_mutex_lock (&self->lock);
+      g_ptr_array_remove (self->waiting_contexts, context);
+    }
+
+  g_mutex_unlock (&self->lock);
+
+  frame_popped = (frame != NULL);
+
+  if (out_frame != NULL)
+    *out_frame = g_steal_pointer (&frame);
+
+  return frame_popped;
+}
+
+/**
+ * gt_socket_queue_try_pop_frame:
+ * @self: a #GtSocketQueue
+ * @out_frame: (out) (transfer full) (optional) (nullable): return location for
+ *    the popped frame, which may be %NULL; pass %NULL to free the frame
+ *
+ * Pop a frame off the queue, if one is ready to be popped. Otherwise,
+ * immediately return %FALSE.
+ *
+ * This may be called from any thread.
+ *
+ * Returns: %TRUE if a frame was popped, %FALSE otherwise
+ * Since: 0.2.0
+ */
+gboolean
+gt_socket_queue_try_pop_frame (GtSocketQueue       *self,
+                               GtSocketQueueFrame **out_frame)
+{
+  g_return_val_if_fail (self != NULL, FALSE);
+
+  return gt_socket_queue_pop_frame_internal (self, FALSE, out_frame);
+}
+
+/**
+ * gt_socket_queue_pop_frame:
+ * @self: a #GtSocketQueue
+ * @out_frame: (out) (transfer full) (optional) (nullable): return location for
+ *    the popped frame, which may be %NULL; pass %NULL to free the frame
+ *
+ * Pop a frame off the queue, if one is ready to be popped. Otherwise, block
+ * until one is, iterating the thread-default #GMainContext.
+ *
+ * This may be called from any thread after gt_socket_queue_start() has been
+ * called.
+ *
+ * Returns: %TRUE if a frame was popped, %FALSE otherwise
+ * Since: 0.2.0
+ */
+gboolean
+gt_socket_queue_pop_frame (GtSocketQueue       *self,
+                           GtSocketQueueFrame **out_frame)
+{
+  g_return_val_if_fail (self != NULL, FALSE);
+  g_return_val_if_fail (self->thread != NULL, FALSE);
+
+  return gt_socket_queue_pop_frame_internal (self, TRUE, out_frame);
+}
+
+/* Append a printable representation of @data to @str, escaping non-printable
+ * bytes and truncating it if it’s long. */
+static void
+append_escaped_data (GString      *str,
+                     const guint8 *data,
+                     gsize         length)
+{
+  const gsize max_length = 64;
+
+  g_string_append_c (str, '"');
+
+  for (gsize i = 0; i < MIN (length, max_length); i++)
+    {
+      if (data[i] == '\\' || data[i] == '"')
+        g_string_append_printf (str, "\\%c", data[i]);
+      else if (g_ascii_isprint (data[i]))
+        g_string_append_c (str, (gchar) data[i]);
+      else
+        g_string_append_printf (str, "\\x%02x", (guint) data[i]);
+    }
+
+  g_string_append_c (str, '"');
+
+  if (length > max_length)
+    g_string_append_printf (str, "… (%" G_GSIZE_FORMAT " bytes)", length);
+}
+
+/**
+ * gt_socket_queue_format_frames:
+ * @self: a #GtSocketQueue
+ *
+ * Format the frames in the queue as a human-readable string, one per line,
+ * for debug output.
+ *
+ * This may be called from any thread.
+ *
+ * Returns: (transfer full): human-readable list of queued frames
+ * Since: 0.2.0
+ */
+gchar *
+gt_socket_queue_format_frames (GtSocketQueue *self)
+{
+  g_autoptr(GString) str = NULL;
+
+  g_return_val_if_fail (self != NULL, NULL);
+
+  str = g_string_new ("");
+
+  g_mutex_lock (&self->lock);
+
+  for (const GList *l = self->frames.head; l != NULL; l = l->next)
+    {
+      g_autofree gchar *frame_str = gt_socket_queue_frame_format (l->data);
+      g_string_append_printf (str, " • %s\n", frame_str);
+    }
+
+  g_mutex_unlock (&self->lock);
+
+  return g_string_free (g_steal_pointer (&str), FALSE);
+}
+
+/**
+ * gt_socket_queue_get_n_frames_received:
+ * @self: a #GtSocketQueue
+ *
+ * Get the total number of frames received since the queue was created, or
+ * since gt_socket_queue_reset_stats() was last called, including ones which
+ * have since been popped.
+ *
+ * This may be called from any thread.
+ *
+ * Returns: number of frames received
+ * Since: 0.2.0
+ */
+guint64
+gt_socket_queue_get_n_frames_received (GtSocketQueue *self)
+{
+  guint64 n_frames;
+
+  g_return_val_if_fail (self != NULL, 0);
+
+  g_mutex_lock (&self->lock);
+  n_frames = self->n_frames_received;
+  g_mutex_unlock (&self->lock);
+
+  return n_frames;
+}
+
+/**
+ * gt_socket_queue_get_n_bytes_received:
+ * @self: a #GtSocketQueue
+ *
+ * Get the total number of bytes received on all connections, including frame
+ * headers and any incomplete frames.
+ *
+ * This may be called from any thread.
+ *
+ * Returns: number of bytes received
+ * Since: 0.2.0
+ */
+guint64
+gt_socket_queue_get_n_bytes_received (GtSocketQueue *self)
+{
+  guint64 n_bytes;
+
+  g_return_val_if_fail (self != NULL, 0);
+
+  g_mutex_lock (&self->lock);
+  n_bytes = self->n_bytes_received;
+  g_mutex_unlock (&self->lock);
+
+  return n_bytes;
+}
+
+/**
+ * gt_socket_queue_get_n_bytes_sent:
+ * @self: a #GtSocketQueue
+ *
+ * Get the total number of bytes of replies sent on all connections.
+ *
+ * This may be called from any thread.
+ *
+ * Returns: number of bytes sent
+ * Since: 0.2.0
+ */
+guint64
+gt_socket_queue_get_n_bytes_sent (GtSocketQueue *self)
+{
+  guint64 n_bytes;
+
+  g_return_val_if_fail (self != NULL, 0);
+
+  g_mutex_lock (&self->lock);
+  n_bytes = self->n_bytes_sent;
+  g_mutex_unlock (&self->lock);
+
+  return n_bytes;
+}
+
+static gboolean
+gt_socket_queue_get_throughput_locked (GtSocketQueue *self,
+                                       gdouble       *out_frames_per_second,
+                                       gdouble       *out_bytes_per_second)
+{
+  gdouble seconds;
+
+  if (self->n_frames_received < 2 ||
+      self->last_frame_time_ns <= self->first_receive_time_ns)
+    return FALSE;
+
+  seconds = (gdouble) (self->last_frame_time_ns - self->first_receive_time_ns) / 1e9;
+
+  if (out_frames_per_second != NULL)
+    *out_frames_per_second = (gdouble) self->n_frames_received / seconds;
+  if (out_bytes_per_second != NULL)
+    *out_bytes_per_second = (gdouble) self->n_bytes_received / seconds;
+
+  return TRUE;
+}
+
+/**
+ * gt_socket_queue_get_throughput:
+ * @self: a #GtSocketQueue
+ * @out_frames_per_second: (out) (optional): return location for the number of
+ *    frames received per second
+ * @out_bytes_per_second: (out) (optional): return location for the number of
+ *    bytes received per second
+ *
+ * Get the rate at which frames and bytes have been received, measured from
+ * when the first data was received to when the most recent frame was.
+ *
+ * This may be called from any thread.
+ *
+ * Returns: %TRUE if the throughput could be calculated, %FALSE if fewer than
+ *    two frames have been received
+ * Since: 0.2.0
+ */
+gboolean
+gt_socket_queue_get_throughput (GtSocketQueue *self,
+                                gdouble       *out_frames_per_second,
+                                gdouble       *out_bytes_per_second)
+{
+  gboolean retval;
+
+  g_return_val_if_fail (self != NULL, FALSE);
+
+  g_mutex_lock (&self->lock);
+  retval = gt_socket_queue_get_throughput_locked (self, out_frames_per_second,
+                                                  out_bytes_per_second);
+  g_mutex_unlock (&self->lock);
+
+  return retval;
+}
+
+/* Get a sorted copy of the reply latencies. */
+static GArray *
+gt_socket_queue_dup_sorted_latencies_locked (GtSocketQueue *self)
+{
+  GArray *latencies;
+
+  latencies = g_array_sized_new (FALSE, FALSE, sizeof (guint64),
+                                 self->reply_latencies->len);
+  g_array_append_vals (latencies, self->reply_latencies->data,
+                       self->reply_latencies->len);
+  gt_latencies_sort (latencies);
+
+  return latencies;
+}
+
+/**
+ * gt_socket_queue_get_reply_latency_ns:
+ * @self: a #GtSocketQueue
+ * @percentile: percentile to get, between 0 and 100
+ *
+ * Get the given @percentile of the latency between a frame being received and
+ * the first reply to it being sent, over all the frames which have been
+ * replied to. For example, pass 50 to get the median latency, or 100 to get the
+ * maximum.
+ *
+ * This includes the time the frame spent in the queue before being popped,
+ * so it measures how quickly the test (or a #GtSocketQueue user) responds.
+ *
+ * This may be called from any thread.
+ *
+ * Returns: latency percentile in nanoseconds, or 0 if no frames have been
+ *    replied to
+ * Since: 0.2.0
+ */
+guint64
+gt_socket_queue_get_reply_latency_ns (GtSocketQueue *self,
+                                      gdouble        percentile)
+{
+  g_autoptr(GArray) latencies = NULL;
+
+  g_return_val_if_fail (self != NULL, 0);
+  g_return_val_if_fail (percentile >= 0.0 && percentile <= 100.0, 0);
+
+  g_mutex_lock (&self->lock);
+  latencies = gt_socket_queue_dup_sorted_latencies_locked (self);
+  g_mutex_unlock (&self->lock);
+
+  return gt_latencies_get_percentile (latencies, percentile);
+}
+
+/**
+ * gt_socket_queue_reset_stats:
+ * @self: a #GtSocketQueue
+ *
+ * Reset all the statistics recorded by @self to zero. This does not affect the
+ * frames in the queue.
+ *
+ * This may be called from any thread.
+ *
+ * Since: 0.2.0
+ */
+void
+gt_socket_queue_reset_stats (GtSocketQueue *self)
+{
+  g_return_if_fail (self != NULL);
+
+  g_mutex_lock (&self->lock);
+  self->n_frames_received = 0;
+  self->n_bytes_received = 0;
+  self->n_bytes_sent = 0;
+  self->first_receive_time_ns = 0;
+  self->last_frame_time_ns = 0;
+  g_array_set_size (self->reply_latencies, 0);
+  g_mutex_unlock (&self->lock);
+}
+
+/**
+ * gt_socket_queue_format_stats:
+ * @self: a #GtSocketQueue
+ *
+ * Format the statistics recorded by @self as a human-readable string, for
+ * debug output.
+ *
+ * This may be called from any thread.
+ *
+ * Returns: (transfer full): human-readable statistics
+ * Since: 0.2.0
+ */
+gchar *
+gt_socket_queue_format_stats (GtSocketQueue *self)
+{
+  g_autoptr(GString) str = NULL;
+  g_autoptr(GArray) latencies = NULL;
+  gdouble frames_per_second, bytes_per_second;
+
+  g_return_val_if_fail (self != NULL, NULL);
+
+  str = g_string_new ("");
+
+  g_mutex_lock (&self->lock);
+
+  g_string_append_printf (str, " • Frames received: %" G_GUINT64_FORMAT "\n",
+                          self->n_frames_received);
+  g_string_append_printf (str, " • Bytes received: %" G_GUINT64_FORMAT "\n",
+                          self->n_bytes_received);
+  g_string_append_printf (str, " • Bytes sent: %" G_GUINT64_FORMAT "\n",
+                          self->n_bytes_sent);
+
+  if (gt_socket_queue_get_throughput_locked (self, &frames_per_second,
+                                             &bytes_per_second))
+    g_string_append_printf (str, " • Throughput: %.1f frames/s, %.1f bytes/s\n",
+                            frames_per_second, bytes_per_second);
+
+  latencies = gt_socket_queue_dup_sorted_latencies_locked (self);
+
+  g_mutex_unlock (&self->lock);
+
+  if (latencies->len > 0)
+    g_string_append_printf (str, " • Reply latency: %u replies, "
+                            "median %.3f ms, 99th percentile %.3f ms, "
+                            "max %.3f ms\n",
+                            latencies->len,
+                            (gdouble) gt_latencies_get_percentile (latencies, 50.0) / 1e6,
+                            (gdouble) gt_latencies_get_percentile (latencies, 99.0) / 1e6,
+                            (gdouble) gt_latencies_get_percentile (latencies, 100.0) / 1e6);
+
+  return g_string_free (g_steal_pointer (&str), FALSE);
+}
+
+/**
+ * gt_socket_queue_frame_free:
+ * @frame: (transfer full): a #GtSocketQueueFrame
+ *
+ * Free a #GtSocketQueueFrame. Its payload remains valid for as long as other
+ * references to it are held.
+ *
+ * Since: 0.2.0
+ */
+void
+gt_socket_queue_frame_free (GtSocketQueueFrame *frame)
+{
+  g_return_if_fail (frame != NULL);
+
+  g_clear_pointer (&frame->payload, g_bytes_unref);
+  g_free (frame);
+}
+
+/**
+ * gt_socket_queue_frame_get_payload:
+ * @frame: a #GtSocketQueueFrame
+ *
+ * Get the payload of @frame, as split out by the #GtSocketQueueFramerFunc.
+ * This is a slice of the buffer the frame was received into; hold a reference
+ * to it to keep it alive after @frame is freed.
+ *
+ * Returns: (transfer none): payload of the frame
+ * Since: 0.2.0
+ */
+GBytes *
+gt_socket_queue_frame_get_payload (GtSocketQueueFrame *frame)
+{
+  g_return_val_if_fail (frame != NULL, NULL);
+
+  return frame->payload;
+}
+
+/**
+ * gt_socket_queue_frame_get_connection_id:
+ * @frame: a #GtSocketQueueFrame
+ *
+ * Get the ID of the connection which @frame was received on. Connections are
+ * numbered from 1 in the order they were accepted, so this can be used to
+ * check which client sent a frame.
+ *
+ * Returns: ID of the connection
+ * Since: 0.2.0
+ */
+guint
+gt_socket_queue_frame_get_connection_id (GtSocketQueueFrame *frame)
+{
+  g_return_val_if_fail (frame != NULL, 0);
+
+  return frame->connection_id;
+}
+
+/* A reply to be sent by the server thread. */
+typedef struct
+{
+  GtSocketQueue *queue;  /* (unowned) */
+  guint connection_id;
+  GBytes *data;  /* (owned) */
+} Reply;
+
+static void
+reply_free (Reply *reply)
+{
+  g_bytes_unref (reply->data);
+  g_free (reply);
+}
+
+/* Queue a reply on its connection. This is called in the server thread. */
+static gboolean
+reply_cb (gpointer user_data)
+{
+  Reply *reply = user_data;
+  Connection *connection;
+
+  connection = g_hash_table_lookup (reply->queue->connections,
+                                    GUINT_TO_POINTER (reply->connection_id));
+
+  if (connection == NULL)
+    {
+      g_debug ("%s: Dropping reply to closed connection %u",
+               G_STRFUNC, reply->connection_id);
+      return G_SOURCE_REMOVE;
+    }
+
+  Chunk *chunk = g_new0 (Chunk, 1);
+  chunk->data = g_bytes_ref (reply->data);
+  g_queue_push_tail (&connection->output, chunk);
+
+  if (connection->output_source == NULL)
+    connection_pump_output (connection);
+
+  return G_SOURCE_REMOVE;
+}
+
+/**
+ * gt_socket_queue_frame_reply_bytes:
+ * @frame: a #GtSocketQueueFrame
+ * @data: bytes to send
+ *
+ * Send @data on the connection which @frame was received on. @data is sent
+ * as-is, so must include any framing which the protocol needs. Replies are
+ * sent in the order this is called. If the connection has since been closed,
+ * the reply is dropped.
+ *
+ * The first reply to each frame is counted in the reply latency statistics.
+ *
+ * This may be called from any thread, but must not be called after the
+ * #GtSocketQueue has been freed.
+ *
+ * Since: 0.2.0
+ */
+void
+gt_socket_queue_frame_reply_bytes (GtSocketQueueFrame *frame,
+                                   GBytes             *data)
+{
+  GtSocketQueue *self;
+  Reply *reply;
+
+  g_return_if_fail (frame != NULL);
+  g_return_if_fail (data != NULL);
+
+  self = frame->queue;
+
+  if (!frame->replied)
+    {
+      guint64 latency_ns = (guint64) (gt_get_time_ns () - frame->receive_time_ns);
+
+      g_mutex_lock (&self->lock);
+      g_array_append_val (self->reply_latencies, latency_ns);
+      g_mutex_unlock (&self->lock);
+
+      frame->replied = TRUE;
+    }
+
+  reply = g_new0 (Reply, 1);
+  reply->queue = self;
+  reply->connection_id = frame->connection_id;
+  reply->data = g_bytes_ref (data);
+
+  g_main_context_invoke_full (self->server_context, G_PRIORITY_DEFAULT,
+                              reply_cb, reply, (GDestroyNotify) reply_free);
+}
+
+/**
+ * gt_socket_queue_frame_reply:
+ * @frame: a #GtSocketQueueFrame
+ * @data: (array length=length): bytes to send
+ * @length: length of @data, or -1 if it is nul-terminated
+ *
+ * Send a copy of @data on the connection which @frame was received on. See
+ * gt_socket_queue_frame_reply_bytes().
+ *
+ * Since: 0.2.0
+ */
+void
+gt_socket_queue_frame_reply (GtSocketQueueFrame *frame,
+                             const void         *data,
+                             gssize              length)
+{
+  g_autoptr(GBytes) bytes = NULL;
+
+  g_return_if_fail (frame != NULL);
+  g_return_if_fail (data != NULL || length == 0);
+
+  if (length < 0)
+    length = (gssize) strlen (data);
+
+  bytes = g_bytes_new (data, (gsize) length);
+  gt_socket_queue_frame_reply_bytes (frame, bytes);
+}
+
+/**
+ * gt_socket_queue_frame_format:
+ * @frame: a #GtSocketQueueFrame
+ *
+ * Format @frame as a human-readable string, for debug output. Non-printable
+ * bytes in the payload are escaped, and long payloads are truncated.
+ *
+ * Returns: (transfer full): human-readable representation of @frame
+ * Since: 0.2.0
+ */
+gchar *
+gt_socket_queue_frame_format (GtSocketQueueFrame *frame)
+{
+  g_autoptr(GString) str = NULL;
+  const guint8 *data;
+  gsize length;
+
+  g_return_val_if_fail (frame != NULL, NULL);
+
+  str = g_string_new ("");
+  data = g_bytes_get_data (frame->payload, &length);
+
+  g_string_append_printf (str, "connection %u: ", frame->connection_id);
+  append_escaped_data (str, data, length);
+
+  return g_string_free (g_steal_pointer (&str), FALSE);
+}
+
+/**
+ * gt_socket_queue_assert_pop_frame_impl:
+ * @self: a #GtSocketQueue
+ * @macro_log_domain: #G_LOG_DOMAIN from the call site
+ * @macro_file: C file containing the call site
+ * @macro_line: line number of the call site
+ * @macro_function: function containing the call site
+ * @expected_payload: (array length=expected_length): expected payload
+ * @expected_length: length of @expected_payload, or -1 if it is nul-terminated
+ *
+ * Implementation of gt_socket_queue_assert_pop_frame(). See the documentation
+ * for that.
+ *
+ * Returns: (transfer full): the popped frame
+ * Since: 0.2.0
+ */
+GtSocketQueueFrame *
+gt_socket_queue_assert_pop_frame_impl (GtSocketQueue *self,
+                                       const gchar   *macro_log_domain,
+                                       const gchar   *macro_file,
+                                       gint           macro_line,
+                                       const gchar   *macro_function,
+                                       const void    *expected_payload,
+                                       gssize         expected_length)
+{
+  g_autoptr(GtSocketQueueFrame) frame = NULL;
+  g_autoptr(GString) expected_str = NULL;
+  const guint8 *data;
+  gsize length;
+
+  g_return_val_if_fail (self != NULL, NULL);
+  g_return_val_if_fail (macro_file != NULL, NULL);
+  g_return_val_if_fail (macro_line >= 0, NULL);
+  g_return_val_if_fail (macro_function != NULL, NULL);
+  g_return_val_if_fail (expected_payload != NULL || expected_length == 0, NULL);
+
+  if (expected_length < 0)
+    expected_length = (gssize) strlen (expected_payload);
+
+  expected_str = g_string_new ("");
+  append_escaped_data (expected_str, expected_payload, (gsize) expected_length);
+
+  if (!gt_socket_queue_pop_frame (self, &frame))
+    {
+      g_autofree gchar *message =
+          g_strdup_printf ("Expected frame %s, but saw no frames",
+                           expected_str->str);
+      g_assertion_message (macro_log_domain, macro_file, macro_line,
+                           macro_function, message);
+      return NULL;
+    }
+
+  data = g_bytes_get_data (frame->payload, &length);
+
+  if (length != (gsize) expected_length ||
+      (length > 0 && memcmp (data, expected_payload, length) != 0))
+    {
+      g_autofree gchar *frame_formatted = gt_socket_queue_frame_format (frame);
+      g_autofree gchar *message =
+          g_strdup_printf ("Expected frame %s, but saw: %s",
+                           expected_str->str, frame_formatted);
+      g_assertion_message (macro_log_domain, macro_file, macro_line,
+                           macro_function, message);
+      return NULL;
+    }
+
+  return g_steal_pointer (&frame);
+}
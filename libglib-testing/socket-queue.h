@@ -0,0 +1,175 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ *
+ * Copyright © 2018 Endless Mobile, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#pragma once
+
+#include <gio/gio.h>
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+/**
+ * GtSocketQueueFramerFunc:
+ * @data: (array length=length): bytes received on a connection which have not
+ *    yet been split into frames
+ * @length: number of bytes in @data
+ * @out_payload_offset: (out): return location for the offset of the frame’s
+ *    payload from the start of @data
+ * @out_payload_length: (out): return location for the length of the frame’s
+ *    payload
+ * @user_data: user data passed to gt_socket_queue_set_framer()
+ *
+ * Function called in the #GtSocketQueue server thread to split the bytes
+ * received on a connection into frames. If @data starts with a complete frame,
+ * return its length (including any headers or delimiters), and set
+ * @out_payload_offset and @out_payload_length to the part of it which should
+ * be queued as the frame’s payload. If more data is needed to complete the
+ * frame, return 0.
+ *
+ * The function is called repeatedly until it returns 0, so it only needs to
+ * look at the start of @data.
+ *
+ * Returns: length of the first frame in @data, or 0 if it is incomplete
+ * Since: 0.2.0
+ */
+typedef gsize (*GtSocketQueueFramerFunc) (const guint8 *data,
+                                          gsize         length,
+                                          gsize        *out_payload_offset,
+                                          gsize        *out_payload_length,
+                                          gpointer      user_data);
+
+gsize gt_socket_queue_framer_lines            (const guint8 *data,
+                                               gsize         length,
+                                               gsize        *out_payload_offset,
+                                               gsize        *out_payload_length,
+                                               gpointer      user_data);
+gsize gt_socket_queue_framer_length_prefixed  (const guint8 *data,
+                                               gsize         length,
+                                               gsize        *out_payload_offset,
+                                               gsize        *out_payload_length,
+                                               gpointer      user_data);
+
+typedef struct _GtSocketQueueFrame GtSocketQueueFrame;
+
+void    gt_socket_queue_frame_free              (GtSocketQueueFrame *frame);
+GBytes *gt_socket_queue_frame_get_payload       (GtSocketQueueFrame *frame);
+guint   gt_socket_queue_frame_get_connection_id (GtSocketQueueFrame *frame);
+void    gt_socket_queue_frame_reply             (GtSocketQueueFrame *frame,
+                                                 const void         *data,
+                                                 gssize              length);
+void    gt_socket_queue_frame_reply_bytes       (GtSocketQueueFrame *frame,
+                                                 GBytes             *data);
+gchar  *gt_socket_queue_frame_format            (GtSocketQueueFrame *frame);
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC (GtSocketQueueFrame, gt_socket_queue_frame_free)
+
+typedef struct _GtSocketQueue GtSocketQueue;
+
+GtSocketQueue *gt_socket_queue_new  (void);
+void           gt_socket_queue_free (GtSocketQueue *self);
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC (GtSocketQueue, gt_socket_queue_free)
+
+void            gt_socket_queue_set_framer         (GtSocketQueue            *self,
+                                                    GtSocketQueueFramerFunc   func,
+                                                    gpointer                  user_data);
+
+gboolean        gt_socket_queue_start              (GtSocketQueue            *self,
+                                                    GError                  **error);
+void            gt_socket_queue_stop               (GtSocketQueue            *self);
+GSocketAddress *gt_socket_queue_get_address        (GtSocketQueue            *self);
+GMainContext   *gt_socket_queue_get_server_context (GtSocketQueue            *self);
+
+gsize           gt_socket_queue_get_n_frames       (GtSocketQueue            *self);
+gboolean        gt_socket_queue_try_pop_frame      (GtSocketQueue            *self,
+                                                    GtSocketQueueFrame      **out_frame);
+gboolean        gt_socket_queue_pop_frame          (GtSocketQueue            *self,
+                                                    GtSocketQueueFrame      **out_frame);
+gchar          *gt_socket_queue_format_frames      (GtSocketQueue            *self);
+
+guint64         gt_socket_queue_get_n_frames_received (GtSocketQueue *self);
+guint64         gt_socket_queue_get_n_bytes_received  (GtSocketQueue *self);
+guint64         gt_socket_queue_get_n_bytes_sent      (GtSocketQueue *self);
+gboolean        gt_socket_queue_get_throughput        (GtSocketQueue *self,
+                                                       gdouble       *out_frames_per_second,
+                                                       gdouble       *out_bytes_per_second);
+guint64         gt_socket_queue_get_reply_latency_ns  (GtSocketQueue *self,
+                                                       gdouble        percentile);
+void            gt_socket_queue_reset_stats           (GtSocketQueue *self);
+gchar          *gt_socket_queue_format_stats          (GtSocketQueue *self);
+
+/**
+ * gt_socket_queue_assert_no_frames:
+ * @self: a #GtSocketQueue
+ *
+ * Assert that there are no frames currently in the queue.
+ *
+ * If there are, an assertion fails and some debug output is printed.
+ *
+ * Since: 0.2.0
+ */
+#define gt_socket_queue_assert_no_frames(self) \
+  G_STMT_START { \
+    if (gt_socket_queue_get_n_frames (self) > 0) \
+      { \
+        g_autofree gchar *anf_list = gt_socket_queue_format_frames (self); \
+        g_autofree gchar *anf_message = \
+            g_strdup_printf ("Expected no frames, but saw %" G_GSIZE_FORMAT ":\n%s", \
+                             gt_socket_queue_get_n_frames (self), \
+                             anf_list); \
+        g_assertion_message (G_LOG_DOMAIN, __FILE__, __LINE__, G_STRFUNC, \
+                             anf_message); \
+      } \
+  } G_STMT_END
+
+/**
+ * gt_socket_queue_assert_pop_frame:
+ * @self: a #GtSocketQueue
+ * @expected_payload: (array length=expected_length): payload which the frame
+ *    is expected to have
+ * @expected_length: length of @expected_payload, or -1 if it is nul-terminated
+ *
+ * Pop a frame off the queue using gt_socket_queue_pop_frame(), blocking until
+ * one is available, and assert that its payload is @expected_payload. If it
+ * isn’t, an assertion fails and some debug output is printed.
+ *
+ * The popped frame is returned, so that it can be replied to using
+ * gt_socket_queue_frame_reply().
+ *
+ * Returns: (transfer full): the popped frame
+ * Since: 0.2.0
+ */
+#define gt_socket_queue_assert_pop_frame(self, expected_payload, expected_length) \
+  gt_socket_queue_assert_pop_frame_impl (self, G_LOG_DOMAIN, __FILE__, __LINE__, \
+                                         G_STRFUNC, expected_payload, \
+                                         expected_length)
+
+/* Private implementations of the assertion functions above. */
+
+/*< private >*/
+GtSocketQueueFrame *gt_socket_queue_assert_pop_frame_impl (GtSocketQueue *self,
+                                                           const gchar   *macro_log_domain,
+                                                           const gchar   *macro_file,
+                                                           gint           macro_line,
+                                                           const gchar   *macro_function,
+                                                           const void    *expected_payload,
+                                                           gssize         expected_length);
+
+G_END_DECLS
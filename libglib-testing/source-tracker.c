@@ -0,0 +1,221 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ *
+ * Copyright © 2018 Endless Mobile, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#include "config.h"
+
+#include <glib.h>
+#include <libglib-testing/source-tracker-private.h>
+
+
+/* A source tracker finds the sources attached to a #GMainContext, so that
+ * #GtVirtualClock can adjust its timeout sources and #GtMainContextProfiler can
+ * wrap new sources. GLib provides no way to enumerate or observe the sources in
+ * a context, so they are found by looking up their IDs, which are allocated in
+ * increasing order.
+ *
+ * Each update looks up the IDs after the highest one found so far, until
+ * %MAX_ID_GAP consecutive IDs are missing. IDs can be missing because their
+ * sources were attached and destroyed again between two updates, so a run of
+ * more than %MAX_ID_GAP such sources will hide any sources attached after it
+ * until another source is found. For #GtVirtualClock, that only means a timeout
+ * fires in real time rather than virtual time.
+ *
+ * Each source which passes the filter is referenced as soon as it is found,
+ * and is then used through that reference, so it stays valid if another thread
+ * destroys it. Destroyed sources are dropped on the next update.
+ */
+
+#define MAX_ID_GAP 32
+
+struct _GtSourceTracker
+{
+  GMainContext *context;  /* (owned) */
+  GtSourceTrackerFilterFunc filter;
+  gpointer user_data;
+
+  GMutex lock;
+  GPtrArray *sources;  /* (owned) (element-type GSource) (locked-by lock) */
+  guint next_id;  /* (locked-by lock) */
+};
+
+/* Look up the source with @id, and track it if it passes the filter. Returns
+ * %TRUE if there is a source with @id. */
+static gboolean
+gt_source_tracker_add_id_locked (GtSourceTracker *self,
+                                 guint            id)
+{
+  GSource *source = g_main_context_find_source_by_id (self->context, id);
+
+  if (source == NULL)
+    return FALSE;
+
+  g_source_ref (source);
+
+  if (self->filter (source, self->user_data))
+    g_ptr_array_add (self->sources, source);
+  else
+    g_source_unref (source);
+
+  return TRUE;
+}
+
+/*
+ * gt_source_tracker_new:
+ * @context: a #GMainContext
+ * @filter: function to decide which sources to track
+ * @user_data: user data to pass to @filter
+ *
+ * Create a new #GtSourceTracker for @context, and find the sources which are
+ * already attached to it. @filter is called once for each source as it is
+ * found (with the tracker’s lock held, so it must not call the tracker), and
+ * the source is tracked if it returns %TRUE.
+ *
+ * To find the existing sources despite any gaps in their IDs, this attaches a
+ * temporary source to @context to find the highest ID allocated so far, and
+ * looks up every ID up to it. That is only done once.
+ *
+ * Returns: (transfer full): a new #GtSourceTracker
+ * Since: 0.2.0
+ */
+GtSourceTracker *
+gt_source_tracker_new (GMainContext              *context,
+                       GtSourceTrackerFilterFunc  filter,
+                       gpointer                   user_data)
+{
+  g_autoptr(GtSourceTracker) self = NULL;
+  g_autoptr(GSource) probe = NULL;
+  guint max_id;
+
+  g_return_val_if_fail (context != NULL, NULL);
+  g_return_val_if_fail (filter != NULL, NULL);
+
+  self = g_new0 (GtSourceTracker, 1);
+  self->context = g_main_context_ref (context);
+  self->filter = filter;
+  self->user_data = user_data;
+  g_mutex_init (&self->lock);
+  self->sources = g_ptr_array_new_with_free_func ((GDestroyNotify) g_source_unref);
+
+  probe = g_idle_source_new ();
+  max_id = g_source_attach (probe, context);
+  g_source_destroy (probe);
+
+  g_mutex_lock (&self->lock);
+  for (guint id = 1; id < max_id; id++)
+    gt_source_tracker_add_id_locked (self, id);
+  self->next_id = max_id + 1;
+  g_mutex_unlock (&self->lock);
+
+  return g_steal_pointer (&self);
+}
+
+/*
+ * gt_source_tracker_free:
+ * @self: (transfer full): a #GtSourceTracker
+ *
+ * Free a #GtSourceTracker, dropping its references to the tracked sources.
+ *
+ * Since: 0.2.0
+ */
+void
+gt_source_tracker_free (GtSourceTracker *self)
+{
+  g_return_if_fail (self != NULL);
+
+  g_clear_pointer (&self->sources, g_ptr_array_unref);
+  g_mutex_clear (&self->lock);
+  g_clear_pointer (&self->context, g_main_context_unref);
+
+  g_free (self);
+}
+
+/*
+ * gt_source_tracker_update:
+ * @self: a #GtSourceTracker
+ *
+ * Find any sources which have been attached to the context since the last
+ * update, passing each to the filter, and stop tracking any sources which have
+ * been destroyed.
+ *
+ * This may be called from any thread.
+ *
+ * Since: 0.2.0
+ */
+void
+gt_source_tracker_update (GtSourceTracker *self)
+{
+  guint n_missing = 0;
+
+  g_return_if_fail (self != NULL);
+
+  g_mutex_lock (&self->lock);
+
+  for (guint i = self->sources->len; i > 0; i--)
+    {
+      if (g_source_is_destroyed (g_ptr_array_index (self->sources, i - 1)))
+        g_ptr_array_remove_index_fast (self->sources, i - 1);
+    }
+
+  for (guint id = self->next_id; n_missing < MAX_ID_GAP; id++)
+    {
+      /* Source IDs wrap around, skipping zero. */
+      if (id == 0)
+        continue;
+
+      if (gt_source_tracker_add_id_locked (self, id))
+        {
+          self->next_id = id + 1;
+          n_missing = 0;
+        }
+      else
+        {
+          n_missing++;
+        }
+    }
+
+  g_mutex_unlock (&self->lock);
+}
+
+/*
+ * gt_source_tracker_foreach:
+ * @self: a #GtSourceTracker
+ * @func: (scope call): function to call for each tracked source
+ * @user_data: user data to pass to @func
+ *
+ * Call @func for each tracked source, as of the last update. @func is called
+ * with the tracker’s lock held, so it must not call the tracker. The sources
+ * may have been destroyed since the last update.
+ *
+ * This may be called from any thread.
+ *
+ * Since: 0.2.0
+ */
+void
+gt_source_tracker_foreach (GtSourceTracker *self,
+                           GFunc            func,
+                           gpointer         user_data)
+{
+  g_return_if_fail (self != NULL);
+  g_return_if_fail (func != NULL);
+
+  g_mutex_lock (&self->lock);
+  g_ptr_array_foreach (self->sources, func, user_data);
+  g_mutex_unlock (&self->lock);
+}
@@ -0,0 +1,1108 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ *
+ * Copyright © 2018 Endless Mobile, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#include "config.h"
+
+#include <gio/gio.h>
+#include <gio/gunixsocketaddress.h>
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <libglib-testing/latencies-private.h>
+#include <libglib-testing/socket-queue.h>
+#include <libglib-testing/subprocess-queue.h>
+#include <libglib-testing/subprocess-shim.h>
+#include <string.h>
+
+
+/**
+ * SECTION:subprocess-queue
+ * @short_description: Queue of intercepted subprocess spawns
+ * @stability: Unstable
+ * @include: libglib-testing/subprocess-queue.h
+ *
+ * #GtSubprocessQueue intercepts the helper programs spawned by the code under
+ * test, so that tests can check how they are called, and give canned output
+ * for them, without running the real programs.
+ *
+ * Programs are intercepted by name: each one passed to
+ * gt_subprocess_queue_add_program() is linked to a small shim executable in a
+ * temporary directory, which is put at the start of `PATH` for spawned
+ * processes. Use gt_subprocess_queue_new_launcher() to get a
+ * #GSubprocessLauncher with that environment, or
+ * gt_subprocess_queue_get_environ() for use with g_spawn_async() and friends.
+ * If the code under test uses g_subprocess_new() directly, call
+ * gt_subprocess_queue_install() to modify the environment of the test process
+ * itself. Programs spawned using an absolute path are not intercepted.
+ *
+ * When an intercepted program is spawned, the shim connects back to the queue
+ * over a socket (see #GtSocketQueue) and sends its arguments, environment and
+ * working directory. These are queued as a #GtSubprocessQueueSpawn, which the
+ * test pops using gt_subprocess_queue_pop_spawn() or
+ * gt_subprocess_queue_assert_pop_spawn(), and answers using
+ * gt_subprocess_queue_spawn_reply(). The shim then writes the given stdout and
+ * stderr, and exits with the given status. Its stdin is ignored.
+ *
+ * Each spawn is counted as soon as it arrives, whether or not it has been
+ * popped yet, so gt_subprocess_queue_assert_spawns_at_most() can be used to
+ * check that an operation doesn’t spawn more helpers than expected. The time
+ * from each shim starting to it being replied to is also recorded, and is
+ * available using gt_subprocess_queue_get_spawn_latency_ns().
+ *
+ * The shim is installed to the libexec directory. When running uninstalled,
+ * set the `GT_SUBPROCESS_SHIM` environment variable to the path of the built
+ * shim.
+ *
+ * Since: 0.2.0
+ */
+
+/**
+ * GtSubprocessQueue:
+ *
+ * A queue of the spawns of the programs it intercepts.
+ *
+ * Since: 0.2.0
+ */
+struct _GtSubprocessQueue
+{
+  GtSocketQueue *socket_queue;  /* (owned) */
+
+  gchar *shim_path;  /* (owned) (nullable) */
+  gchar *shim_dir;  /* (owned) (nullable) */
+  gchar *address;  /* (owned) (nullable); value of %GT_SUBPROCESS_SHIM_ADDRESS_ENV */
+  GPtrArray *links;  /* (owned) (element-type filename) */
+
+  gboolean installed;
+  gchar *saved_path;  /* (owned) (nullable) */
+  gchar *saved_address;  /* (owned) (nullable) */
+
+  GMutex lock;
+  guint n_spawns;  /* (locked-by lock) */
+  GHashTable *program_counts;  /* (owned) (element-type utf8 guint) (locked-by lock) */
+  GArray *spawn_latencies;  /* (owned) (element-type guint64) (locked-by lock) */
+};
+
+/**
+ * GtSubprocessQueueSpawn:
+ *
+ * A spawn of a program intercepted by a #GtSubprocessQueue, which is waiting
+ * for a reply.
+ *
+ * Since: 0.2.0
+ */
+struct _GtSubprocessQueueSpawn
+{
+  GtSubprocessQueue *queue;  /* (unowned) */
+  GtSocketQueueFrame *frame;  /* (owned) */
+
+  gchar *program;  /* (owned) */
+  gchar **argv;  /* (owned) (array zero-terminated=1) */
+  gchar **envp;  /* (owned) (array zero-terminated=1) */
+  gchar *cwd;  /* (owned) */
+  gint64 start_time_us;
+  gboolean replied;
+};
+
+/* Parse a request from the shim. @data need not be aligned. Any of the out
+ * arguments may be %NULL. */
+static void
+parse_request (const guint8   *data,
+               gsize           length,
+               gchar        ***out_argv,
+               gchar        ***out_envp,
+               gchar         **out_cwd,
+               gint64         *out_start_time_us)
+{
+  g_autoptr(GBytes) aligned_bytes = g_bytes_new (data, length);
+  g_autoptr(GVariant) request = NULL;
+  g_auto(GStrv) argv = NULL;
+  g_auto(GStrv) envp = NULL;
+  g_autofree gchar *cwd = NULL;
+  gint64 start_time_us;
+
+  request = g_variant_ref_sink (g_variant_new_from_bytes (G_VARIANT_TYPE (GT_SUBPROCESS_SHIM_REQUEST_TYPE),
+                                                          aligned_bytes, FALSE));
+  g_variant_get (request, "(^aay^aay^ayx)", &argv, &envp, &cwd, &start_time_us);
+
+  if (out_argv != NULL)
+    *out_argv = g_steal_pointer (&argv);
+  if (out_envp != NULL)
+    *out_envp = g_steal_pointer (&envp);
+  if (out_cwd != NULL)
+    *out_cwd = g_steal_pointer (&cwd);
+  if (out_start_time_us != NULL)
+    *out_start_time_us = start_time_us;
+}
+
+/* Get the name of the program from its @argv, as the basename of `argv[0]`. */
+static gchar *
+program_from_argv (const gchar * const *argv)
+{
+  return (argv[0] != NULL) ? g_path_get_basename (argv[0]) : g_strdup ("");
+}
+
+/* Wraps gt_socket_queue_framer_length_prefixed() to count each spawn as it
+ * arrives. This is called in the #GtSocketQueue server thread. */
+static gsize
+spawn_framer_cb (const guint8 *data,
+                 gsize         length,
+                 gsize        *out_payload_offset,
+                 gsize        *out_payload_length,
+                 gpointer      user_data)
+{
+  GtSubprocessQueue *self = user_data;
+  g_auto(GStrv) argv = NULL;
+  g_autofree gchar *program = NULL;
+  gsize frame_length;
+  guint n_program_spawns;
+
+  frame_length = gt_socket_queue_framer_length_prefixed (data, length,
+                                                         out_payload_offset,
+                                                         out_payload_length,
+                                                         NULL);
+  if (frame_length == 0)
+    return 0;
+
+  parse_request (data + *out_payload_offset, *out_payload_length,
+                 &argv, NULL, NULL, NULL);
+  program = program_from_argv ((const gchar * const *) argv);
+
+  g_mutex_lock (&self->lock);
+  self->n_spawns++;
+  n_program_spawns = GPOINTER_TO_UINT (g_hash_table_lookup (self->program_counts, program));
+  g_hash_table_replace (self->program_counts, g_steal_pointer (&program),
+                        GUINT_TO_POINTER (n_program_spawns + 1));
+  g_mutex_unlock (&self->lock);
+
+  return frame_length;
+}
+
+/**
+ * gt_subprocess_queue_new:
+ *
+ * Create a new #GtSubprocessQueue. Start it using gt_subprocess_queue_start(),
+ * and then add the programs to intercept using
+ * gt_subprocess_queue_add_program().
+ *
+ * Returns: (transfer full): a new #GtSubprocessQueue
+ * Since: 0.2.0
+ */
+GtSubprocessQueue *
+gt_subprocess_queue_new (void)
+{
+  g_autoptr(GtSubprocessQueue) queue = NULL;
+
+  queue = g_new0 (GtSubprocessQueue, 1);
+  queue->socket_queue = gt_socket_queue_new ();
+  gt_socket_queue_set_framer (queue->socket_queue, spawn_framer_cb, queue);
+  queue->links = g_ptr_array_new_with_free_func (g_free);
+  g_mutex_init (&queue->lock);
+  queue->program_counts = g_hash_table_new_full (g_str_hash, g_str_equal,
+                                                 g_free, NULL);
+  queue->spawn_latencies = g_array_new (FALSE, FALSE, sizeof (guint64));
+
+  return g_steal_pointer (&queue);
+}
+
+/**
+ * gt_subprocess_queue_free:
+ * @self: (transfer full): a #GtSubprocessQueue
+ *
+ * Free a #GtSubprocessQueue. This will call gt_subprocess_queue_stop() if it
+ * hasn’t been called already.
+ *
+ * Since: 0.2.0
+ */
+void
+gt_subprocess_queue_free (GtSubprocessQueue *self)
+{
+  g_return_if_fail (self != NULL);
+
+  if (self->shim_dir != NULL)
+    gt_subprocess_queue_stop (self);
+
+  g_clear_pointer (&self->socket_queue, gt_socket_queue_free);
+  g_clear_pointer (&self->links, g_ptr_array_unref);
+  g_clear_pointer (&self->program_counts, g_hash_table_unref);
+  g_clear_pointer (&self->spawn_latencies, g_array_unref);
+  g_mutex_clear (&self->lock);
+
+  g_free (self->shim_path);
+  g_free (self->address);
+
+  g_free (self);
+}
+
+/* Format the address of @socket_address in the form the shim expects. */
+static gchar *
+format_shim_address (GSocketAddress *socket_address)
+{
+  GUnixSocketAddress *address = G_UNIX_SOCKET_ADDRESS (socket_address);
+  GUnixSocketAddressType address_type = g_unix_socket_address_get_address_type (address);
+
+  switch (address_type)
+    {
+    case G_UNIX_SOCKET_ADDRESS_ABSTRACT:
+      return g_strdup_printf ("abstract:%s", g_unix_socket_address_get_path (address));
+    case G_UNIX_SOCKET_ADDRESS_PATH:
+      return g_strdup_printf ("path:%s", g_unix_socket_address_get_path (address));
+    case G_UNIX_SOCKET_ADDRESS_INVALID:
+    case G_UNIX_SOCKET_ADDRESS_ANONYMOUS:
+    case G_UNIX_SOCKET_ADDRESS_ABSTRACT_PADDED:
+    default:
+      g_assert_not_reached ();
+    }
+
+  return NULL;
+}
+
+/**
+ * gt_subprocess_queue_start:
+ * @self: a #GtSubprocessQueue
+ * @error: return location for a #GError, or %NULL
+ *
+ * Start listening for spawns of intercepted programs, and create the directory
+ * which will contain the links to the shim.
+ *
+ * If the shim executable cannot be found, %G_IO_ERROR_NOT_FOUND is returned;
+ * tests will typically want to skip themselves in that case.
+ *
+ * Returns: %TRUE on success, %FALSE otherwise
+ * Since: 0.2.0
+ */
+gboolean
+gt_subprocess_queue_start (GtSubprocessQueue  *self,
+                           GError            **error)
+{
+  const gchar *shim_path;
+  g_autofree gchar *shim_dir = NULL;
+
+  g_return_val_if_fail (self != NULL, FALSE);
+  g_return_val_if_fail (self->shim_dir == NULL, FALSE);
+  g_return_val_if_fail (error == NULL || *error == NULL, FALSE);
+
+  shim_path = g_getenv (GT_SUBPROCESS_SHIM_PATH_ENV);
+  if (shim_path == NULL)
+    shim_path = LIBEXECDIR "/libglib-testing-subprocess-shim";
+
+  if (!g_file_test (shim_path, G_FILE_TEST_IS_EXECUTABLE))
+    {
+      g_set_error (error, G_IO_ERROR, G_IO_ERROR_NOT_FOUND,
+                   "Subprocess shim ‘%s’ not found; set %s to its path",
+                   shim_path, GT_SUBPROCESS_SHIM_PATH_ENV);
+      return FALSE;
+    }
+
+  shim_dir = g_dir_make_tmp ("gt-subprocess-queue-XXXXXX", error);
+  if (shim_dir == NULL)
+    return FALSE;
+
+  if (!gt_socket_queue_start (self->socket_queue, error))
+    {
+      g_rmdir (shim_dir);
+      return FALSE;
+    }
+
+  g_free (self->shim_path);
+  self->shim_path = g_strdup (shim_path);
+  self->shim_dir = g_steal_pointer (&shim_dir);
+  g_free (self->address);
+  self->address = format_shim_address (gt_socket_queue_get_address (self->socket_queue));
+
+  return TRUE;
+}
+
+/**
+ * gt_subprocess_queue_stop:
+ * @self: a #GtSubprocessQueue
+ *
+ * Stop intercepting programs, and remove the links to the shim. Any shims which
+ * are still waiting for a reply exit with status 127. If
+ * gt_subprocess_queue_install() was called, the environment of the test
+ * process is restored.
+ *
+ * Since: 0.2.0
+ */
+void
+gt_subprocess_queue_stop (GtSubprocessQueue *self)
+{
+  g_return_if_fail (self != NULL);
+  g_return_if_fail (self->shim_dir != NULL);
+
+  if (self->installed)
+    {
+      if (self->saved_path != NULL)
+        g_setenv ("PATH", self->saved_path, TRUE);
+      else
+        g_unsetenv ("PATH");
+
+      if (self->saved_address != NULL)
+        g_setenv (GT_SUBPROCESS_SHIM_ADDRESS_ENV, self->saved_address, TRUE);
+      else
+        g_unsetenv (GT_SUBPROCESS_SHIM_ADDRESS_ENV);
+
+      g_clear_pointer (&self->saved_path, g_free);
+      g_clear_pointer (&self->saved_address, g_free);
+      self->installed = FALSE;
+    }
+
+  gt_socket_queue_stop (self->socket_queue);
+
+  for (gsize i = 0; i < self->links->len; i++)
+    g_unlink (g_ptr_array_index (self->links, i));
+  g_ptr_array_set_size (self->links, 0);
+
+  g_rmdir (self->shim_dir);
+  g_clear_pointer (&self->shim_dir, g_free);
+}
+
+/**
+ * gt_subprocess_queue_add_program:
+ * @self: a #GtSubprocessQueue
+ * @program: name of the program to intercept, such as `git`; this must not
+ *    contain a directory separator
+ * @error: return location for a #GError, or %NULL
+ *
+ * Intercept spawns of @program, by adding a link to the shim called @program
+ * to the shim directory.
+ *
+ * This must be called after gt_subprocess_queue_start().
+ *
+ * Returns: %TRUE on success, %FALSE otherwise
+ * Since: 0.2.0
+ */
+gboolean
+gt_subprocess_queue_add_program (GtSubprocessQueue  *self,
+                                 const gchar        *program,
+                                 GError            **error)
+{
+  g_autofree gchar *link_path = NULL;
+  g_autoptr(GFile) link_file = NULL;
+
+  g_return_val_if_fail (self != NULL, FALSE);
+  g_return_val_if_fail (self->shim_dir != NULL, FALSE);
+  g_return_val_if_fail (program != NULL && *program != '\0', FALSE);
+  g_return_val_if_fail (strchr (program, G_DIR_SEPARATOR) == NULL, FALSE);
+  g_return_val_if_fail (error == NULL || *error == NULL, FALSE);
+
+  link_path = g_build_filename (self->shim_dir, program, NULL);
+  link_file = g_file_new_for_path (link_path);
+
+  if (!g_file_make_symbolic_link (link_file, self->shim_path, NULL, error))
+    return FALSE;
+
+  g_ptr_array_add (self->links, g_steal_pointer (&link_path));
+
+  return TRUE;
+}
+
+/**
+ * gt_subprocess_queue_get_shim_dir:
+ * @self: a #GtSubprocessQueue
+ *
+ * Get the directory containing the links to the shim, which must be at the
+ * start of `PATH` for programs to be intercepted. This will be %NULL if
+ * gt_subprocess_queue_start() has not been called yet.
+ *
+ * Returns: (nullable): path of the shim directory
+ * Since: 0.2.0
+ */
+const gchar *
+gt_subprocess_queue_get_shim_dir (GtSubprocessQueue *self)
+{
+  g_return_val_if_fail (self != NULL, NULL);
+
+  return self->shim_dir;
+}
+
+/**
+ * gt_subprocess_queue_get_environ:
+ * @self: a #GtSubprocessQueue
+ * @envp: (array zero-terminated=1) (transfer full) (nullable): an environment
+ *    list, such as one from g_get_environ(), or %NULL for an empty one
+ *
+ * Modify @envp so that programs spawned with it are intercepted by @self: the
+ * shim directory is put at the start of its `PATH`, and the address of the
+ * queue is added. This is like g_environ_setenv().
+ *
+ * This must be called after gt_subprocess_queue_start().
+ *
+ * Returns: (array zero-terminated=1) (transfer full): the modified environment
+ * Since: 0.2.0
+ */
+gchar **
+gt_subprocess_queue_get_environ (GtSubprocessQueue  *self,
+                                 gchar             **envp)
+{
+  const gchar *old_path;
+  g_autofree gchar *new_path = NULL;
+
+  g_return_val_if_fail (self != NULL, NULL);
+  g_return_val_if_fail (self->shim_dir != NULL, NULL);
+
+  old_path = g_environ_getenv (envp, "PATH");
+  if (old_path != NULL && *old_path != '\0')
+    new_path = g_strjoin (G_SEARCHPATH_SEPARATOR_S, self->shim_dir, old_path, NULL);
+  else
+    new_path = g_strdup (self->shim_dir);
+
+  envp = g_environ_setenv (envp, "PATH", new_path, TRUE);
+  envp = g_environ_setenv (envp, GT_SUBPROCESS_SHIM_ADDRESS_ENV, self->address, TRUE);
+
+  return envp;
+}
+
+/**
+ * gt_subprocess_queue_new_launcher:
+ * @self: a #GtSubprocessQueue
+ * @flags: flags for the launcher
+ *
+ * Create a new #GSubprocessLauncher whose environment is the environment of
+ * the test process, modified by gt_subprocess_queue_get_environ(), so that the
+ * programs it spawns are intercepted by @self.
+ *
+ * This must be called after gt_subprocess_queue_start().
+ *
+ * Returns: (transfer full): a new #GSubprocessLauncher
+ * Since: 0.2.0
+ */
+GSubprocessLauncher *
+gt_subprocess_queue_new_launcher (GtSubprocessQueue *self,
+                                  GSubprocessFlags   flags)
+{
+  g_autoptr(GSubprocessLauncher) launcher = NULL;
+  g_auto(GStrv) envp = NULL;
+
+  g_return_val_if_fail (self != NULL, NULL);
+  g_return_val_if_fail (self->shim_dir != NULL, NULL);
+
+  envp = gt_subprocess_queue_get_environ (self, g_get_environ ());
+
+  launcher = g_subprocess_launcher_new (flags);
+  g_subprocess_launcher_set_environ (launcher, envp);
+
+  return g_steal_pointer (&launcher);
+}
+
+/**
+ * gt_subprocess_queue_install:
+ * @self: a #GtSubprocessQueue
+ *
+ * Modify the environment of the test process, as with
+ * gt_subprocess_queue_get_environ(), so that programs spawned with the default
+ * environment (for example, using g_subprocess_new()) are intercepted. The
+ * environment is restored by gt_subprocess_queue_stop().
+ *
+ * As this calls g_setenv(), it is not thread safe, and must be called before
+ * any other threads which use the environment are started.
+ *
+ * Since: 0.2.0
+ */
+void
+gt_subprocess_queue_install (GtSubprocessQueue *self)
+{
+  g_auto(GStrv) envp = NULL;
+
+  g_return_if_fail (self != NULL);
+  g_return_if_fail (self->shim_dir != NULL);
+  g_return_if_fail (!self->installed);
+
+  self->saved_path = g_strdup (g_getenv ("PATH"));
+  self->saved_address = g_strdup (g_getenv (GT_SUBPROCESS_SHIM_ADDRESS_ENV));
+  self->installed = TRUE;
+
+  envp = gt_subprocess_queue_get_environ (self, g_get_environ ());
+  g_setenv ("PATH", g_environ_getenv (envp, "PATH"), TRUE);
+  g_setenv (GT_SUBPROCESS_SHIM_ADDRESS_ENV, self->address, TRUE);
+}
+
+/**
+ * gt_subprocess_queue_get_n_queued:
+ * @self: a #GtSubprocessQueue
+ *
+ * Get the number of spawns waiting in the queue to be popped.
+ *
+ * This may be called from any thread.
+ *
+ * Returns: number of queued spawns
+ * Since: 0.2.0
+ */
+gsize
+gt_subprocess_queue_get_n_queued (GtSubprocessQueue *self)
+{
+  g_return_val_if_fail (self != NULL, 0);
+
+  return gt_socket_queue_get_n_frames (self->socket_queue);
+}
+
+static GtSubprocessQueueSpawn *
+spawn_new_from_frame (GtSubprocessQueue  *self,
+                      GtSocketQueueFrame *frame)
+{
+  GtSubprocessQueueSpawn *spawn;
+  GBytes *payload = gt_socket_queue_frame_get_payload (frame);
+  const guint8 *data;
+  gsize length;
+
+  data = g_bytes_get_data (payload, &length);
+
+  spawn = g_new0 (GtSubprocessQueueSpawn, 1);
+  spawn->queue = self;
+  spawn->frame = frame;
+  parse_request (data, length, &spawn->argv, &spawn->envp, &spawn->cwd,
+                 &spawn->start_time_us);
+  spawn->program = program_from_argv ((const gchar * const *) spawn->argv);
+
+  return spawn;
+}
+
+static gboolean
+gt_subprocess_queue_pop_spawn_internal (GtSubprocessQueue       *self,
+                                        gboolean                 wait,
+                                        GtSubprocessQueueSpawn **out_spawn)
+{
+  GtSocketQueueFrame *frame = NULL;
+  gboolean popped;
+
+  if (wait)
+    popped = gt_socket_queue_pop_frame (self->socket_queue, &frame);
+  else
+    popped = gt_socket_queue_try_pop_frame (self->socket_queue, &frame);
+
+  if (!popped)
+    return FALSE;
+
+  if (out_spawn != NULL)
+    *out_spawn = spawn_new_from_frame (self, frame);
+  else
+    gt_socket_queue_frame_free (frame);
+
+  return TRUE;
+}
+
+/**
+ * gt_subprocess_queue_try_pop_spawn:
+ * @self: a #GtSubprocessQueue
+ * @out_spawn: (out) (transfer full) (optional) (nullable): return location for
+ *    the popped spawn, which may be %NULL; pass %NULL to free the spawn
+ *
+ * Pop a spawn off the queue, if one is ready to be popped. Otherwise,
+ * immediately return %FALSE.
+ *
+ * If a spawn is freed without being replied to, its shim exits with status 127
+ * once the queue is stopped.
+ *
+ * This may be called from any thread.
+ *
+ * Returns: %TRUE if a spawn was popped, %FALSE otherwise
+ * Since: 0.2.0
+ */
+gboolean
+gt_subprocess_queue_try_pop_spawn (GtSubprocessQueue       *self,
+                                   GtSubprocessQueueSpawn **out_spawn)
+{
+  g_return_val_if_fail (self != NULL, FALSE);
+
+  return gt_subprocess_queue_pop_spawn_internal (self, FALSE, out_spawn);
+}
+
+/**
+ * gt_subprocess_queue_pop_spawn:
+ * @self: a #GtSubprocessQueue
+ * @out_spawn: (out) (transfer full) (optional) (nullable): return location for
+ *    the popped spawn, which may be %NULL; pass %NULL to free the spawn
+ *
+ * Pop a spawn off the queue, if one is ready to be popped. Otherwise, block
+ * until one is, iterating the thread-default #GMainContext.
+ *
+ * This may be called from any thread after gt_subprocess_queue_start() has
+ * been called.
+ *
+ * Returns: %TRUE if a spawn was popped, %FALSE otherwise
+ * Since: 0.2.0
+ */
+gboolean
+gt_subprocess_queue_pop_spawn (GtSubprocessQueue       *self,
+                               GtSubprocessQueueSpawn **out_spawn)
+{
+  g_return_val_if_fail (self != NULL, FALSE);
+  g_return_val_if_fail (self->shim_dir != NULL, FALSE);
+
+  return gt_subprocess_queue_pop_spawn_internal (self, TRUE, out_spawn);
+}
+
+/**
+ * gt_subprocess_queue_get_n_spawns:
+ * @self: a #GtSubprocessQueue
+ * @program: (nullable): name of the program to count spawns of, or %NULL to
+ *    count spawns of all programs
+ *
+ * Get the number of times @program has been spawned since @self was created,
+ * or since gt_subprocess_queue_reset_counts() was last called. This includes
+ * spawns which have not been popped yet.
+ *
+ * This may be called from any thread.
+ *
+ * Returns: number of spawns
+ * Since: 0.2.0
+ */
+guint
+gt_subprocess_queue_get_n_spawns (GtSubprocessQueue *self,
+                                  const gchar       *program)
+{
+  guint n_spawns;
+
+  g_return_val_if_fail (self != NULL, 0);
+
+  g_mutex_lock (&self->lock);
+  if (program != NULL)
+    n_spawns = GPOINTER_TO_UINT (g_hash_table_lookup (self->program_counts, program));
+  else
+    n_spawns = self->n_spawns;
+  g_mutex_unlock (&self->lock);
+
+  return n_spawns;
+}
+
+/* Get a sorted copy of the spawn latencies. */
+static GArray *
+gt_subprocess_queue_dup_sorted_latencies (GtSubprocessQueue *self)
+{
+  GArray *latencies;
+
+  g_mutex_lock (&self->lock);
+  latencies = g_array_sized_new (FALSE, FALSE, sizeof (guint64),
+                                 self->spawn_latencies->len);
+  g_array_append_vals (latencies, self->spawn_latencies->data,
+                       self->spawn_latencies->len);
+  g_mutex_unlock (&self->lock);
+
+  gt_latencies_sort (latencies);
+
+  return latencies;
+}
+
+/**
+ * gt_subprocess_queue_get_spawn_latency_ns:
+ * @self: a #GtSubprocessQueue
+ * @percentile: percentile to get, between 0 and 100
+ *
+ * Get the given @percentile of the time between each shim starting and it
+ * being replied to, over all the spawns which have been replied to. This is
+ * how long the code under test waited for each intercepted program, excluding
+ * the time taken to fork.
+ *
+ * This may be called from any thread.
+ *
+ * Returns: latency percentile in nanoseconds, or 0 if no spawns have been
+ *    replied to
+ * Since: 0.2.0
+ */
+guint64
+gt_subprocess_queue_get_spawn_latency_ns (GtSubprocessQueue *self,
+                                          gdouble            percentile)
+{
+  g_autoptr(GArray) latencies = NULL;
+
+  g_return_val_if_fail (self != NULL, 0);
+  g_return_val_if_fail (percentile >= 0.0 && percentile <= 100.0, 0);
+
+  latencies = gt_subprocess_queue_dup_sorted_latencies (self);
+
+  return gt_latencies_get_percentile (latencies, percentile);
+}
+
+/**
+ * gt_subprocess_queue_reset_counts:
+ * @self: a #GtSubprocessQueue
+ *
+ * Reset the spawn counts and latencies recorded by @self. This does not affect
+ * the spawns in the queue.
+ *
+ * This may be called from any thread.
+ *
+ * Since: 0.2.0
+ */
+void
+gt_subprocess_queue_reset_counts (GtSubprocessQueue *self)
+{
+  g_return_if_fail (self != NULL);
+
+  g_mutex_lock (&self->lock);
+  self->n_spawns = 0;
+  g_hash_table_remove_all (self->program_counts);
+  g_array_set_size (self->spawn_latencies, 0);
+  g_mutex_unlock (&self->lock);
+}
+
+static gint
+compare_strings (gconstpointer a,
+                 gconstpointer b)
+{
+  return g_strcmp0 (*((const gchar * const *) a), *((const gchar * const *) b));
+}
+
+/**
+ * gt_subprocess_queue_format_counts:
+ * @self: a #GtSubprocessQueue
+ *
+ * Format the spawn counts and latencies recorded by @self as a human-readable
+ * string, with one line per program, for debug output.
+ *
+ * This may be called from any thread.
+ *
+ * Returns: (transfer full): human-readable spawn counts
+ * Since: 0.2.0
+ */
+gchar *
+gt_subprocess_queue_format_counts (GtSubprocessQueue *self)
+{
+  g_autoptr(GString) str = g_string_new ("");
+  g_autoptr(GPtrArray) sorted_programs = g_ptr_array_new ();
+  g_autoptr(GArray) latencies = NULL;
+  GHashTableIter iter;
+  gpointer program, n_spawns;
+
+  g_return_val_if_fail (self != NULL, NULL);
+
+  g_mutex_lock (&self->lock);
+
+  g_hash_table_iter_init (&iter, self->program_counts);
+  while (g_hash_table_iter_next (&iter, &program, NULL))
+    g_ptr_array_add (sorted_programs, program);
+  g_ptr_array_sort (sorted_programs, compare_strings);
+
+  for (gsize i = 0; i < sorted_programs->len; i++)
+    {
+      program = g_ptr_array_index (sorted_programs, i);
+      n_spawns = g_hash_table_lookup (self->program_counts, program);
+
+      g_string_append_printf (str, " • %s: %u spawns\n",
+                              (const gchar *) program,
+                              GPOINTER_TO_UINT (n_spawns));
+    }
+
+  g_mutex_unlock (&self->lock);
+
+  latencies = gt_subprocess_queue_dup_sorted_latencies (self);
+
+  if (latencies->len > 0)
+    g_string_append_printf (str, " • Spawn latency: %u replies, "
+                            "median %.3f ms, max %.3f ms\n",
+                            latencies->len,
+                            (gdouble) gt_latencies_get_percentile (latencies, 50.0) / 1e6,
+                            (gdouble) gt_latencies_get_percentile (latencies, 100.0) / 1e6);
+
+  return g_string_free (g_steal_pointer (&str), FALSE);
+}
+
+/**
+ * gt_subprocess_queue_spawn_free:
+ * @spawn: (transfer full): a #GtSubprocessQueueSpawn
+ *
+ * Free a #GtSubprocessQueueSpawn.
+ *
+ * Since: 0.2.0
+ */
+void
+gt_subprocess_queue_spawn_free (GtSubprocessQueueSpawn *spawn)
+{
+  g_return_if_fail (spawn != NULL);
+
+  g_clear_pointer (&spawn->frame, gt_socket_queue_frame_free);
+  g_free (spawn->program);
+  g_strfreev (spawn->argv);
+  g_strfreev (spawn->envp);
+  g_free (spawn->cwd);
+  g_free (spawn);
+}
+
+/**
+ * gt_subprocess_queue_spawn_get_program:
+ * @spawn: a #GtSubprocessQueueSpawn
+ *
+ * Get the name of the program which was spawned. This is the basename of
+ * `argv[0]`.
+ *
+ * Returns: name of the program
+ * Since: 0.2.0
+ */
+const gchar *
+gt_subprocess_queue_spawn_get_program (GtSubprocessQueueSpawn *spawn)
+{
+  g_return_val_if_fail (spawn != NULL, NULL);
+
+  return spawn->program;
+}
+
+/**
+ * gt_subprocess_queue_spawn_get_argv:
+ * @spawn: a #GtSubprocessQueueSpawn
+ *
+ * Get the arguments the program was spawned with, including `argv[0]`.
+ *
+ * Returns: (array zero-terminated=1) (transfer none): arguments of the spawn
+ * Since: 0.2.0
+ */
+const gchar * const *
+gt_subprocess_queue_spawn_get_argv (GtSubprocessQueueSpawn *spawn)
+{
+  g_return_val_if_fail (spawn != NULL, NULL);
+
+  return (const gchar * const *) spawn->argv;
+}
+
+/**
+ * gt_subprocess_queue_spawn_get_environ:
+ * @spawn: a #GtSubprocessQueueSpawn
+ *
+ * Get the environment the program was spawned with. Use g_environ_getenv() to
+ * look up variables in it.
+ *
+ * Returns: (array zero-terminated=1) (transfer none): environment of the spawn
+ * Since: 0.2.0
+ */
+const gchar * const *
+gt_subprocess_queue_spawn_get_environ (GtSubprocessQueueSpawn *spawn)
+{
+  g_return_val_if_fail (spawn != NULL, NULL);
+
+  return (const gchar * const *) spawn->envp;
+}
+
+/**
+ * gt_subprocess_queue_spawn_get_cwd:
+ * @spawn: a #GtSubprocessQueueSpawn
+ *
+ * Get the working directory the program was spawned in.
+ *
+ * Returns: working directory of the spawn
+ * Since: 0.2.0
+ */
+const gchar *
+gt_subprocess_queue_spawn_get_cwd (GtSubprocessQueueSpawn *spawn)
+{
+  g_return_val_if_fail (spawn != NULL, NULL);
+
+  return spawn->cwd;
+}
+
+/**
+ * gt_subprocess_queue_spawn_reply_bytes:
+ * @spawn: a #GtSubprocessQueueSpawn
+ * @stdout_data: (nullable): data for the program to write to its stdout, or
+ *    %NULL for none
+ * @stderr_data: (nullable): data for the program to write to its stderr, or
+ *    %NULL for none
+ * @exit_status: status for the program to exit with, between 0 and 255
+ *
+ * Reply to @spawn, causing the shim to write @stdout_data and @stderr_data,
+ * and then exit with @exit_status. Each spawn should be replied to once.
+ *
+ * This may be called from any thread, but must not be called after the
+ * #GtSubprocessQueue has been freed.
+ *
+ * Since: 0.2.0
+ */
+void
+gt_subprocess_queue_spawn_reply_bytes (GtSubprocessQueueSpawn *spawn,
+                                       GBytes                 *stdout_data,
+                                       GBytes                 *stderr_data,
+                                       gint                    exit_status)
+{
+  GtSubprocessQueue *self;
+  g_autoptr(GBytes) empty_bytes = NULL;
+  g_autoptr(GVariant) response = NULL;
+  g_autoptr(GByteArray) message = NULL;
+  g_autoptr(GBytes) message_bytes = NULL;
+  guint32 length_be;
+  guint64 latency_ns;
+
+  g_return_if_fail (spawn != NULL);
+  g_return_if_fail (!spawn->replied);
+  g_return_if_fail (exit_status >= 0 && exit_status <= 255);
+
+  self = spawn->queue;
+  empty_bytes = g_bytes_new (NULL, 0);
+
+  response = g_variant_ref_sink (g_variant_new ("(@ay@ayi)",
+                                                g_variant_new_from_bytes (G_VARIANT_TYPE_BYTESTRING,
+                                                                          (stdout_data != NULL) ? stdout_data : empty_bytes,
+                                                                          TRUE),
+                                                g_variant_new_from_bytes (G_VARIANT_TYPE_BYTESTRING,
+                                                                          (stderr_data != NULL) ? stderr_data : empty_bytes,
+                                                                          TRUE),
+                                                exit_status));
+
+  message = g_byte_array_sized_new ((guint) (sizeof (length_be) + g_variant_get_size (response)));
+  length_be = GUINT32_TO_BE ((guint32) g_variant_get_size (response));
+  g_byte_array_append (message, (const guint8 *) &length_be, sizeof (length_be));
+  g_byte_array_append (message, g_variant_get_data (response),
+                       (guint) g_variant_get_size (response));
+
+  latency_ns = (guint64) (g_get_monotonic_time () - spawn->start_time_us) * 1000;
+  g_mutex_lock (&self->lock);
+  g_array_append_val (self->spawn_latencies, latency_ns);
+  g_mutex_unlock (&self->lock);
+
+  spawn->replied = TRUE;
+
+  message_bytes = g_byte_array_free_to_bytes (g_steal_pointer (&message));
+  gt_socket_queue_frame_reply_bytes (spawn->frame, message_bytes);
+}
+
+/**
+ * gt_subprocess_queue_spawn_reply:
+ * @spawn: a #GtSubprocessQueueSpawn
+ * @stdout_text: (nullable): text for the program to write to its stdout, or
+ *    %NULL for none
+ * @stderr_text: (nullable): text for the program to write to its stderr, or
+ *    %NULL for none
+ * @exit_status: status for the program to exit with, between 0 and 255
+ *
+ * Reply to @spawn with nul-terminated output. See
+ * gt_subprocess_queue_spawn_reply_bytes().
+ *
+ * Since: 0.2.0
+ */
+void
+gt_subprocess_queue_spawn_reply (GtSubprocessQueueSpawn *spawn,
+                                 const gchar            *stdout_text,
+                                 const gchar            *stderr_text,
+                                 gint                    exit_status)
+{
+  g_autoptr(GBytes) stdout_data = NULL;
+  g_autoptr(GBytes) stderr_data = NULL;
+
+  g_return_if_fail (spawn != NULL);
+
+  if (stdout_text != NULL)
+    stdout_data = g_bytes_new (stdout_text, strlen (stdout_text));
+  if (stderr_text != NULL)
+    stderr_data = g_bytes_new (stderr_text, strlen (stderr_text));
+
+  gt_subprocess_queue_spawn_reply_bytes (spawn, stdout_data, stderr_data,
+                                         exit_status);
+}
+
+/**
+ * gt_subprocess_queue_spawn_format:
+ * @spawn: a #GtSubprocessQueueSpawn
+ *
+ * Format @spawn as a human-readable string, as a shell command line followed
+ * by its working directory, for debug output.
+ *
+ * Returns: (transfer full): human-readable representation of @spawn
+ * Since: 0.2.0
+ */
+gchar *
+gt_subprocess_queue_spawn_format (GtSubprocessQueueSpawn *spawn)
+{
+  g_autoptr(GString) str = g_string_new ("");
+
+  g_return_val_if_fail (spawn != NULL, NULL);
+
+  for (gsize i = 0; spawn->argv[i] != NULL; i++)
+    {
+      g_autofree gchar *quoted = g_shell_quote (spawn->argv[i]);
+
+      if (i > 0)
+        g_string_append_c (str, ' ');
+      g_string_append (str, quoted);
+    }
+
+  g_string_append_printf (str, " (in %s)", spawn->cwd);
+
+  return g_string_free (g_steal_pointer (&str), FALSE);
+}
+
+/**
+ * gt_subprocess_queue_assert_pop_spawn_impl:
+ * @self: a #GtSubprocessQueue
+ * @macro_log_domain: #G_LOG_DOMAIN from the call site
+ * @macro_file: C file containing the call site
+ * @macro_line: line number of the call site
+ * @macro_function: function containing the call site
+ * @...: expected program name and arguments, terminated by %NULL
+ *
+ * Implementation of gt_subprocess_queue_assert_pop_spawn(). See the
+ * documentation for that.
+ *
+ * Returns: (transfer full): the popped spawn
+ * Since: 0.2.0
+ */
+GtSubprocessQueueSpawn *
+gt_subprocess_queue_assert_pop_spawn_impl (GtSubprocessQueue *self,
+                                           const gchar       *macro_log_domain,
+                                           const gchar       *macro_file,
+                                           gint               macro_line,
+                                           const gchar       *macro_function,
+                                           ...)
+{
+  g_autoptr(GtSubprocessQueueSpawn) spawn = NULL;
+  g_autoptr(GPtrArray) expected = g_ptr_array_new ();
+  g_autofree gchar *expected_str = NULL;
+  gboolean matches;
+  const gchar *arg;
+  va_list args;
+
+  g_return_val_if_fail (self != NULL, NULL);
+  g_return_val_if_fail (macro_file != NULL, NULL);
+  g_return_val_if_fail (macro_line >= 0, NULL);
+  g_return_val_if_fail (macro_function != NULL, NULL);
+
+  va_start (args, macro_function);
+  while ((arg = va_arg (args, const gchar *)) != NULL)
+    g_ptr_array_add (expected, (gpointer) arg);
+  va_end (args);
+  g_ptr_array_add (expected, NULL);
+
+  g_return_val_if_fail (expected->len > 1, NULL);
+
+  expected_str = g_strjoinv (" ", (gchar **) expected->pdata);
+
+  if (!gt_subprocess_queue_pop_spawn (self, &spawn))
+    {
+      g_autofree gchar *message =
+          g_strdup_printf ("Expected spawn of ‘%s’, but saw no spawns",
+                           expected_str);
+      g_assertion_message (macro_log_domain, macro_file, macro_line,
+                           macro_function, message);
+      return NULL;
+    }
+
+  matches = (g_strcmp0 (spawn->program, g_ptr_array_index (expected, 0)) == 0 &&
+             g_strv_length (spawn->argv) == expected->len - 1);
+
+  for (gsize i = 1; matches && spawn->argv[i] != NULL; i++)
+    matches = (g_strcmp0 (spawn->argv[i], g_ptr_array_index (expected, i)) == 0);
+
+  if (!matches)
+    {
+      g_autofree gchar *spawn_formatted = gt_subprocess_queue_spawn_format (spawn);
+      g_autofree gchar *message =
+          g_strdup_printf ("Expected spawn of ‘%s’, but saw: %s",
+                           expected_str, spawn_formatted);
+      g_assertion_message (macro_log_domain, macro_file, macro_line,
+                           macro_function, message);
+      return NULL;
+    }
+
+  return g_steal_pointer (&spawn);
+}
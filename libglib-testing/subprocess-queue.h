@@ -0,0 +1,171 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ *
+ * Copyright © 2018 Endless Mobile, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#pragma once
+
+#include <gio/gio.h>
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+typedef struct _GtSubprocessQueueSpawn GtSubprocessQueueSpawn;
+
+void                 gt_subprocess_queue_spawn_free        (GtSubprocessQueueSpawn *spawn);
+const gchar         *gt_subprocess_queue_spawn_get_program (GtSubprocessQueueSpawn *spawn);
+const gchar * const *gt_subprocess_queue_spawn_get_argv    (GtSubprocessQueueSpawn *spawn);
+const gchar * const *gt_subprocess_queue_spawn_get_environ (GtSubprocessQueueSpawn *spawn);
+const gchar         *gt_subprocess_queue_spawn_get_cwd     (GtSubprocessQueueSpawn *spawn);
+void                 gt_subprocess_queue_spawn_reply       (GtSubprocessQueueSpawn *spawn,
+                                                            const gchar            *stdout_text,
+                                                            const gchar            *stderr_text,
+                                                            gint                    exit_status);
+void                 gt_subprocess_queue_spawn_reply_bytes (GtSubprocessQueueSpawn *spawn,
+                                                            GBytes                 *stdout_data,
+                                                            GBytes                 *stderr_data,
+                                                            gint                    exit_status);
+gchar               *gt_subprocess_queue_spawn_format      (GtSubprocessQueueSpawn *spawn);
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC (GtSubprocessQueueSpawn, gt_subprocess_queue_spawn_free)
+
+typedef struct _GtSubprocessQueue GtSubprocessQueue;
+
+GtSubprocessQueue *gt_subprocess_queue_new  (void);
+void               gt_subprocess_queue_free (GtSubprocessQueue *self);
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC (GtSubprocessQueue, gt_subprocess_queue_free)
+
+gboolean             gt_subprocess_queue_start             (GtSubprocessQueue  *self,
+                                                            GError            **error);
+void                 gt_subprocess_queue_stop              (GtSubprocessQueue  *self);
+gboolean             gt_subprocess_queue_add_program       (GtSubprocessQueue  *self,
+                                                            const gchar        *program,
+                                                            GError            **error);
+const gchar         *gt_subprocess_queue_get_shim_dir      (GtSubprocessQueue  *self);
+gchar              **gt_subprocess_queue_get_environ       (GtSubprocessQueue  *self,
+                                                            gchar             **envp);
+GSubprocessLauncher *gt_subprocess_queue_new_launcher      (GtSubprocessQueue  *self,
+                                                            GSubprocessFlags    flags);
+void                 gt_subprocess_queue_install           (GtSubprocessQueue  *self);
+
+gsize                gt_subprocess_queue_get_n_queued      (GtSubprocessQueue       *self);
+gboolean             gt_subprocess_queue_try_pop_spawn     (GtSubprocessQueue       *self,
+                                                            GtSubprocessQueueSpawn **out_spawn);
+gboolean             gt_subprocess_queue_pop_spawn         (GtSubprocessQueue       *self,
+                                                            GtSubprocessQueueSpawn **out_spawn);
+
+guint                gt_subprocess_queue_get_n_spawns      (GtSubprocessQueue *self,
+                                                            const gchar       *program);
+guint64              gt_subprocess_queue_get_spawn_latency_ns (GtSubprocessQueue *self,
+                                                               gdouble            percentile);
+void                 gt_subprocess_queue_reset_counts      (GtSubprocessQueue *self);
+gchar               *gt_subprocess_queue_format_counts     (GtSubprocessQueue *self);
+
+/**
+ * gt_subprocess_queue_assert_no_spawns:
+ * @self: a #GtSubprocessQueue
+ *
+ * Assert that there are no spawns currently in the queue waiting to be
+ * replied to.
+ *
+ * If there are, an assertion fails and some debug output is printed.
+ *
+ * Since: 0.2.0
+ */
+#define gt_subprocess_queue_assert_no_spawns(self) \
+  G_STMT_START { \
+    if (gt_subprocess_queue_get_n_queued (self) > 0) \
+      { \
+        g_autofree gchar *ans_counts = gt_subprocess_queue_format_counts (self); \
+        g_autofree gchar *ans_message = \
+            g_strdup_printf ("Expected no spawns, but saw %" G_GSIZE_FORMAT \
+                             " queued. Spawns so far:\n%s", \
+                             gt_subprocess_queue_get_n_queued (self), \
+                             ans_counts); \
+        g_assertion_message (G_LOG_DOMAIN, __FILE__, __LINE__, G_STRFUNC, \
+                             ans_message); \
+      } \
+  } G_STMT_END
+
+/**
+ * gt_subprocess_queue_assert_spawns_at_most:
+ * @self: a #GtSubprocessQueue
+ * @program: (nullable): name of the program to check, or %NULL to check all
+ *    spawns
+ * @max_spawns: maximum number of spawns expected
+ *
+ * Assert that @program has been spawned at most @max_spawns times since the
+ * counts were last reset using gt_subprocess_queue_reset_counts().
+ *
+ * If it has been spawned more often, an assertion fails and some debug output
+ * is printed.
+ *
+ * Since: 0.2.0
+ */
+#define gt_subprocess_queue_assert_spawns_at_most(self, program, max_spawns) \
+  G_STMT_START { \
+    const gchar *asam_program = (program); \
+    guint asam_n_spawns = gt_subprocess_queue_get_n_spawns (self, asam_program); \
+    guint asam_max_spawns = (max_spawns); \
+    if (asam_n_spawns > asam_max_spawns) \
+      { \
+        g_autofree gchar *asam_counts = gt_subprocess_queue_format_counts (self); \
+        g_autofree gchar *asam_message = \
+            g_strdup_printf ("Expected at most %u spawns of %s, but saw %u:\n%s", \
+                             asam_max_spawns, \
+                             (asam_program != NULL) ? asam_program : "any program", \
+                             asam_n_spawns, asam_counts); \
+        g_assertion_message (G_LOG_DOMAIN, __FILE__, __LINE__, G_STRFUNC, \
+                             asam_message); \
+      } \
+  } G_STMT_END
+
+/**
+ * gt_subprocess_queue_assert_pop_spawn:
+ * @self: a #GtSubprocessQueue
+ * @...: expected program name, followed by its expected arguments, terminated
+ *    by %NULL
+ *
+ * Pop a spawn off the queue using gt_subprocess_queue_pop_spawn(), blocking
+ * until one is available, and assert that it was of the given program with the
+ * given arguments. The program name is compared against the basename of
+ * `argv[0]`; the arguments must match exactly. If they don’t match, an
+ * assertion fails and some debug output is printed.
+ *
+ * The popped spawn is returned, so that it can be replied to using
+ * gt_subprocess_queue_spawn_reply().
+ *
+ * Returns: (transfer full): the popped spawn
+ * Since: 0.2.0
+ */
+#define gt_subprocess_queue_assert_pop_spawn(self, ...) \
+  gt_subprocess_queue_assert_pop_spawn_impl (self, G_LOG_DOMAIN, __FILE__, __LINE__, \
+                                             G_STRFUNC, __VA_ARGS__)
+
+/* Private implementations of the assertion functions above. */
+
+/*< private >*/
+GtSubprocessQueueSpawn *gt_subprocess_queue_assert_pop_spawn_impl (GtSubprocessQueue *self,
+                                                                   const gchar       *macro_log_domain,
+                                                                   const gchar       *macro_file,
+                                                                   gint               macro_line,
+                                                                   const gchar       *macro_function,
+                                                                   ...) G_GNUC_NULL_TERMINATED;
+
+G_END_DECLS
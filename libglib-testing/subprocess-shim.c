@@ -0,0 +1,180 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ *
+ * Copyright © 2018 Endless Mobile, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#include "config.h"
+
+#include <gio/gio.h>
+#include <gio/gunixsocketaddress.h>
+#include <glib.h>
+#include <libglib-testing/subprocess-shim.h>
+#include <locale.h>
+#include <stdio.h>
+#include <string.h>
+
+
+/* This program is run in place of the programs intercepted by a
+ * #GtSubprocessQueue, through symlinks to it in a directory which is put at
+ * the start of `PATH`. It forwards its arguments, environment and working
+ * directory to the queue, and then writes whatever output the test replies
+ * with, and exits with the given status. Its stdin is ignored.
+ *
+ * It exits with status 127 if it cannot reach the queue, matching the shell’s
+ * status for a command which cannot be found. */
+
+#define EXIT_STATUS_UNAVAILABLE 127
+
+static GSocketAddress *
+parse_address (const gchar  *address,
+               GError      **error)
+{
+  if (g_str_has_prefix (address, "abstract:"))
+    return g_unix_socket_address_new_with_type (address + strlen ("abstract:"), -1,
+                                                G_UNIX_SOCKET_ADDRESS_ABSTRACT);
+  else if (g_str_has_prefix (address, "path:"))
+    return g_unix_socket_address_new (address + strlen ("path:"));
+
+  g_set_error (error, G_IO_ERROR, G_IO_ERROR_INVALID_ARGUMENT,
+               "Invalid address ‘%s’", address);
+  return NULL;
+}
+
+static gboolean
+write_message (GOutputStream  *output,
+               GVariant       *message,
+               GError        **error)
+{
+  guint32 length_be = GUINT32_TO_BE ((guint32) g_variant_get_size (message));
+
+  return (g_output_stream_write_all (output, &length_be, sizeof (length_be),
+                                     NULL, NULL, error) &&
+          g_output_stream_write_all (output, g_variant_get_data (message),
+                                     g_variant_get_size (message),
+                                     NULL, NULL, error));
+}
+
+static GVariant *
+read_message (GInputStream        *input,
+              const GVariantType  *type,
+              GError             **error)
+{
+  guint32 length_be;
+  gsize n_read;
+  g_autofree guint8 *data = NULL;
+  gsize length;
+  guint8 *owned_data;
+
+  if (!g_input_stream_read_all (input, &length_be, sizeof (length_be),
+                                &n_read, NULL, error))
+    return NULL;
+  if (n_read < sizeof (length_be))
+    {
+      g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_CONNECTION_CLOSED,
+                           "Connection closed before response");
+      return NULL;
+    }
+
+  length = GUINT32_FROM_BE (length_be);
+  data = g_malloc (length);
+
+  if (!g_input_stream_read_all (input, data, length, &n_read, NULL, error))
+    return NULL;
+  if (n_read < length)
+    {
+      g_set_error_literal (error, G_IO_ERROR, G_IO_ERROR_CONNECTION_CLOSED,
+                           "Connection closed during response");
+      return NULL;
+    }
+
+  owned_data = g_steal_pointer (&data);
+  return g_variant_ref_sink (g_variant_new_from_data (type, owned_data, length,
+                                                      FALSE, g_free, owned_data));
+}
+
+int
+main (int   argc,
+      char *argv[])
+{
+  gint64 start_time_us = g_get_monotonic_time ();
+  const gchar *address_str;
+  g_autoptr(GSocketAddress) address = NULL;
+  g_autoptr(GSocketClient) client = NULL;
+  g_autoptr(GSocketConnection) connection = NULL;
+  g_auto(GStrv) envp = NULL;
+  g_autofree gchar *cwd = NULL;
+  g_autoptr(GVariant) request = NULL;
+  g_autoptr(GVariant) response = NULL;
+  g_autoptr(GVariant) stdout_variant = NULL;
+  g_autoptr(GVariant) stderr_variant = NULL;
+  gint exit_status;
+  g_autoptr(GError) local_error = NULL;
+
+  setlocale (LC_ALL, "");
+
+  address_str = g_getenv (GT_SUBPROCESS_SHIM_ADDRESS_ENV);
+  if (address_str == NULL)
+    {
+      g_printerr ("%s: %s is not set\n", argv[0], GT_SUBPROCESS_SHIM_ADDRESS_ENV);
+      return EXIT_STATUS_UNAVAILABLE;
+    }
+
+  address = parse_address (address_str, &local_error);
+  if (address != NULL)
+    {
+      client = g_socket_client_new ();
+      connection = g_socket_client_connect (client, G_SOCKET_CONNECTABLE (address),
+                                            NULL, &local_error);
+    }
+
+  if (connection == NULL)
+    {
+      g_printerr ("%s: Error connecting to subprocess queue: %s\n",
+                  argv[0], local_error->message);
+      return EXIT_STATUS_UNAVAILABLE;
+    }
+
+  envp = g_get_environ ();
+  cwd = g_get_current_dir ();
+  request = g_variant_ref_sink (g_variant_new ("(^aay^aay^ayx)",
+                                               argv, envp, cwd,
+                                               start_time_us));
+
+  if (!write_message (g_io_stream_get_output_stream (G_IO_STREAM (connection)),
+                      request, &local_error) ||
+      (response = read_message (g_io_stream_get_input_stream (G_IO_STREAM (connection)),
+                                G_VARIANT_TYPE (GT_SUBPROCESS_SHIM_RESPONSE_TYPE),
+                                &local_error)) == NULL)
+    {
+      g_printerr ("%s: Error communicating with subprocess queue: %s\n",
+                  argv[0], local_error->message);
+      return EXIT_STATUS_UNAVAILABLE;
+    }
+
+  g_variant_get (response, "(@ay@ayi)",
+                 &stdout_variant, &stderr_variant, &exit_status);
+
+  fwrite (g_variant_get_data (stdout_variant), 1,
+          g_variant_get_size (stdout_variant), stdout);
+  fwrite (g_variant_get_data (stderr_variant), 1,
+          g_variant_get_size (stderr_variant), stderr);
+  fflush (stdout);
+  fflush (stderr);
+
+  return exit_status;
+}
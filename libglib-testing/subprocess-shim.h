@@ -0,0 +1,45 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ *
+ * Copyright © 2018 Endless Mobile, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#pragma once
+
+/* Interface between the subprocess shim, which is run in place of the programs
+ * intercepted by a #GtSubprocessQueue, and the queue itself.
+ *
+ * The shim finds the queue’s socket from %GT_SUBPROCESS_SHIM_ADDRESS_ENV,
+ * which is `abstract:` followed by an abstract socket name, or `path:`
+ * followed by a socket path. It sends a single request, and waits for a single
+ * response. Each is a serialised #GVariant, preceded by its length as a
+ * big-endian 32-bit unsigned integer. */
+
+/* Environment variable giving the address of the queue’s socket. */
+#define GT_SUBPROCESS_SHIM_ADDRESS_ENV "GT_SUBPROCESS_QUEUE_ADDRESS"
+
+/* Environment variable which overrides the path of the shim executable, for
+ * running uninstalled. */
+#define GT_SUBPROCESS_SHIM_PATH_ENV "GT_SUBPROCESS_SHIM"
+
+/* Request from the shim: its argv, environment and working directory, and
+ * the monotonic time (in microseconds) when it started. */
+#define GT_SUBPROCESS_SHIM_REQUEST_TYPE "(aayaayayx)"
+
+/* Response to the shim: the data to write to its stdout and stderr, and its
+ * exit status. */
+#define GT_SUBPROCESS_SHIM_RESPONSE_TYPE "(ayayi)"
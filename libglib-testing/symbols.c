@@ -0,0 +1,54 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ *
+ * Copyright © 2018 Endless Mobile, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#include "config.h"
+
+#ifdef HAVE_DLADDR
+#include <dlfcn.h>
+#endif
+#include <glib.h>
+#include <libglib-testing/symbols-private.h>
+
+
+/*
+ * gt_symbol_dup_name:
+ * @address: address of a function
+ *
+ * Get a human-readable name for the function at @address, for use in
+ * diagnostic output. This is the name of its dynamic symbol if it can be
+ * found, which requires the function to be exported (or the program to be
+ * linked with `-rdynamic`); otherwise it is the address formatted as a
+ * pointer.
+ *
+ * Returns: (transfer full): name of the function
+ * Since: 0.2.0
+ */
+gchar *
+gt_symbol_dup_name (gconstpointer address)
+{
+#ifdef HAVE_DLADDR
+  Dl_info info;
+
+  if (dladdr (address, &info) != 0 && info.dli_sname != NULL)
+    return g_strdup (info.dli_sname);
+#endif
+
+  return g_strdup_printf ("%p", address);
+}
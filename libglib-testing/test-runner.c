@@ -0,0 +1,875 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ *
+ * Copyright © 2018 Endless Mobile, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#include "config.h"
+
+#include <gio/gio.h>
+#include <gio/gunixinputstream.h>
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <glib-unix.h>
+#include <libglib-testing/test-runner.h>
+#include <string.h>
+
+
+/**
+ * SECTION:test-runner
+ * @short_description: Parallel runner for GTest programs
+ * @stability: Unstable
+ * @include: libglib-testing/test-runner.h
+ *
+ * g_test_run() runs a test program’s test cases one after another, in a single
+ * process. For test cases which mostly wait on I/O, such as those using a
+ * #GtDBusQueue (each of which starts its own D-Bus daemon), this leaves most
+ * of the machine idle. gt_test_run_parallel() can be called instead of
+ * g_test_run() to run the test cases in a pool of worker processes, each of
+ * which re-executes the test program to run a subset of the test cases (using
+ * `-p`).
+ *
+ * The test cases are balanced between the workers using the duration of each
+ * test case from the previous run, which are stored in a file in the build
+ * directory (see g_test_build_filename()) named after the test program, with a
+ * `.test-durations` suffix; or in the file named by the `GT_TEST_DURATIONS`
+ * environment variable. Test cases with no recorded duration are assumed to
+ * take the mean duration of the others.
+ *
+ * The results from all the workers are merged and printed in
+ * [TAP](https://testanything.org/) format, in the order the test cases were
+ * registered in, including any g_test_message() output. If a worker crashes
+ * (for example, because an assertion failed), the test case it was running
+ * is reported as failed, and the test cases it had not yet run are given to a
+ * new worker.
+ *
+ * The number of workers defaults to the number of processors, and can be set
+ * using the `GT_TEST_JOBS` environment variable. gt_test_run_parallel() falls
+ * back to calling g_test_run() if there would only be one worker, if the
+ * program was run with options which select specific test cases (`-p`, `-s`
+ * or `-l`), if it is running as a worker or as a test subprocess (see
+ * g_test_trap_subprocess()), or on platforms other than Linux. Other command
+ * line options, such as `-m` or `--verbose`, are passed through to the
+ * workers.
+ *
+ * |[<!-- language="C" -->
+ * int
+ * main (int argc, char *argv[])
+ * {
+ *   g_test_init (&argc, &argv, NULL);
+ *
+ *   g_test_add ("/dbus/some-test", BusFixture, NULL,
+ *               bus_set_up, test_some_test, bus_tear_down);
+ *
+ *   return gt_test_run_parallel ();
+ * }
+ * ]|
+ *
+ * Since: 0.2.0
+ */
+
+/* Environment variable set in worker processes, so they run their test cases
+ * normally rather than spawning more workers. */
+#define WORKER_ENV_VAR "GT_TEST_PARALLEL_WORKER"
+
+/* File descriptor number which the workers write their GTest log to. */
+#define WORKER_LOG_FD 3
+
+/* Mirrors the private GTestResult enum in gtestutils.c, which is the first
+ * number in %G_TEST_LOG_STOP_CASE messages. */
+typedef enum
+{
+  TEST_RESULT_SUCCESS = 0,
+  TEST_RESULT_SKIPPED = 1,
+  TEST_RESULT_FAILURE = 2,
+  TEST_RESULT_INCOMPLETE = 3,
+} TestResult;
+
+/* A test case, and its result once a worker has run it. */
+typedef struct
+{
+  gchar *path;  /* (owned) */
+  gboolean done;
+  TestResult result;
+  gchar *reason;  /* (owned) (nullable) */
+  GString *diagnostics;  /* (owned); TAP comment lines */
+  gdouble expected_duration;  /* seconds */
+  gdouble duration;  /* seconds; only valid if @done */
+  gint64 start_time;  /* monotonic, in microseconds */
+} TestCase;
+
+typedef struct _Runner Runner;
+
+/* A worker process, and the state of its GTest log. */
+typedef struct
+{
+  Runner *runner;  /* (unowned) */
+  GSubprocess *subprocess;  /* (owned) */
+  GInputStream *log_stream;  /* (owned) */
+  GTestLogBuffer *log_buffer;  /* (owned) */
+  GPtrArray *test_cases;  /* (owned) (element-type TestCase) (unowned elements) */
+  TestCase *current;  /* (unowned) (nullable) */
+  gboolean log_done;
+  gboolean exited;
+} Worker;
+
+struct _Runner
+{
+  gchar *program;  /* (owned) */
+  GPtrArray *extra_args;  /* (owned) (element-type utf8) */
+  GPtrArray *test_cases;  /* (owned) (element-type TestCase) */
+  GHashTable *test_cases_by_path;  /* (owned) (element-type utf8 TestCase) (unowned keys) (unowned values) */
+  GPtrArray *workers;  /* (owned) (element-type Worker) */
+  guint n_running_workers;
+  guint n_printed;
+  gboolean failed;
+};
+
+static void
+test_case_free (TestCase *test_case)
+{
+  g_free (test_case->path);
+  g_free (test_case->reason);
+  g_string_free (test_case->diagnostics, TRUE);
+  g_free (test_case);
+}
+
+static void
+worker_free (Worker *worker)
+{
+  g_clear_object (&worker->subprocess);
+  g_clear_object (&worker->log_stream);
+  g_clear_pointer (&worker->log_buffer, g_test_log_buffer_free);
+  g_clear_pointer (&worker->test_cases, g_ptr_array_unref);
+  g_free (worker);
+}
+
+/* Get the arguments the program was originally run with, before
+ * g_test_init() removed the ones it handles, excluding `argv[0]`. */
+static GPtrArray *
+get_original_args (void)
+{
+  g_autofree gchar *cmdline = NULL;
+  gsize cmdline_len = 0;
+  g_autoptr(GPtrArray) args = NULL;
+  gsize i;
+
+  /* This is Linux-specific. On other platforms, the tests are run serially. */
+  if (!g_file_get_contents ("/proc/self/cmdline", &cmdline, &cmdline_len, NULL))
+    return NULL;
+
+  args = g_ptr_array_new_with_free_func (g_free);
+
+  /* Skip `argv[0]`. */
+  for (i = 0; i < cmdline_len && cmdline[i] != '\0'; i++);
+  i++;
+
+  while (i < cmdline_len)
+    {
+      const gchar *arg = cmdline + i;
+
+      g_ptr_array_add (args, g_strdup (arg));
+      i += strlen (arg) + 1;
+    }
+
+  return g_steal_pointer (&args);
+}
+
+/* Whether @arg is the GTest option @option, either on its own or with an
+ * `=value` suffix. */
+static gboolean
+arg_is_option (const gchar *arg,
+               const gchar *option)
+{
+  gsize len = strlen (option);
+
+  return (strncmp (arg, option, len) == 0 &&
+          (arg[len] == '\0' || arg[len] == '='));
+}
+
+/* Whether the test program can be run in parallel with the given @args. Options
+ * which select test cases can’t be passed through to the workers. */
+static gboolean
+args_allow_parallel (GPtrArray *args)
+{
+  for (gsize i = 0; i < args->len; i++)
+    {
+      const gchar *arg = g_ptr_array_index (args, i);
+
+      if (arg_is_option (arg, "-p") ||
+          arg_is_option (arg, "-s") ||
+          arg_is_option (arg, "-l") ||
+          arg_is_option (arg, "--GTestLogFD") ||
+          arg_is_option (arg, "--GTestSubprocess"))
+        return FALSE;
+    }
+
+  return TRUE;
+}
+
+/* Get the number of workers to use. */
+static guint
+get_n_jobs (void)
+{
+  const gchar *jobs_str = g_getenv ("GT_TEST_JOBS");
+  gchar *end = NULL;
+  guint64 jobs;
+
+  if (jobs_str != NULL && *jobs_str != '\0')
+    {
+      jobs = g_ascii_strtoull (jobs_str, &end, 10);
+      if (*end == '\0' && jobs >= 1 && jobs <= G_MAXUINT)
+        return (guint) jobs;
+    }
+
+  return g_get_num_processors ();
+}
+
+static GSubprocessLauncher *
+runner_new_launcher (GSubprocessFlags flags)
+{
+  g_autoptr(GSubprocessLauncher) launcher = g_subprocess_launcher_new (flags);
+
+  g_subprocess_launcher_setenv (launcher, WORKER_ENV_VAR, "1", TRUE);
+
+  return g_steal_pointer (&launcher);
+}
+
+/* Start building the argument vector to run the test program with the
+ * pass-through arguments. The elements are not owned by the array. */
+static GPtrArray *
+runner_new_argv (Runner *self)
+{
+  GPtrArray *argv = g_ptr_array_new ();
+
+  g_ptr_array_add (argv, self->program);
+  for (gsize i = 0; i < self->extra_args->len; i++)
+    g_ptr_array_add (argv, g_ptr_array_index (self->extra_args, i));
+
+  return argv;
+}
+
+/* List the test cases in the program, in the order they were registered, by
+ * running it with `-l`. */
+static gboolean
+runner_list_test_cases (Runner  *self,
+                        GError **error)
+{
+  g_autoptr(GSubprocessLauncher) launcher = NULL;
+  g_autoptr(GSubprocess) subprocess = NULL;
+  g_autoptr(GPtrArray) argv = NULL;
+  g_autofree gchar *stdout_buf = NULL;
+  g_auto(GStrv) lines = NULL;
+
+  launcher = runner_new_launcher (G_SUBPROCESS_FLAGS_STDOUT_PIPE);
+  argv = runner_new_argv (self);
+  g_ptr_array_add (argv, (gpointer) "-l");
+  g_ptr_array_add (argv, NULL);
+
+  subprocess = g_subprocess_launcher_spawnv (launcher,
+                                             (const gchar * const *) argv->pdata,
+                                             error);
+  if (subprocess == NULL ||
+      !g_subprocess_communicate_utf8 (subprocess, NULL, NULL, &stdout_buf, NULL, error) ||
+      !g_subprocess_wait_check (subprocess, NULL, error))
+    return FALSE;
+
+  lines = g_strsplit (stdout_buf, "\n", -1);
+
+  for (gsize i = 0; lines[i] != NULL; i++)
+    {
+      g_auto(GStrv) tokens = NULL;
+      const gchar *path = NULL;
+      TestCase *test_case;
+
+      /* Depending on the GLib version and whether TAP output is enabled, each
+       * test case is listed either as a bare path or in a TAP result line. */
+      tokens = g_strsplit (lines[i], " ", -1);
+      for (gsize j = 0; tokens[j] != NULL && path == NULL; j++)
+        {
+          if (tokens[j][0] == '/')
+            path = tokens[j];
+        }
+
+      if (path == NULL ||
+          g_hash_table_contains (self->test_cases_by_path, path))
+        continue;
+
+      test_case = g_new0 (TestCase, 1);
+      test_case->path = g_strdup (path);
+      test_case->diagnostics = g_string_new ("");
+      g_ptr_array_add (self->test_cases, test_case);
+      g_hash_table_insert (self->test_cases_by_path, test_case->path, test_case);
+    }
+
+  return TRUE;
+}
+
+static gchar *
+runner_get_durations_path (Runner *self)
+{
+  const gchar *path = g_getenv ("GT_TEST_DURATIONS");
+  g_autofree gchar *basename = NULL;
+  g_autofree gchar *filename = NULL;
+
+  if (path != NULL)
+    return g_strdup (path);
+
+  basename = g_path_get_basename (self->program);
+  filename = g_strconcat (basename, ".test-durations", NULL);
+
+  return g_test_build_filename (G_TEST_BUILT, filename, NULL);
+}
+
+/* Set the expected duration of each test case from the durations recorded on
+ * the last run. */
+static void
+runner_load_durations (Runner *self)
+{
+  g_autoptr(GKeyFile) key_file = g_key_file_new ();
+  g_autofree gchar *durations_path = runner_get_durations_path (self);
+  gdouble total = 0.0;
+  guint n_known = 0;
+  gdouble mean;
+
+  if (g_key_file_load_from_file (key_file, durations_path, G_KEY_FILE_NONE, NULL))
+    {
+      for (gsize i = 0; i < self->test_cases->len; i++)
+        {
+          TestCase *test_case = g_ptr_array_index (self->test_cases, i);
+          g_autoptr(GError) local_error = NULL;
+          gdouble duration;
+
+          duration = g_key_file_get_double (key_file, "Durations", test_case->path,
+                                            &local_error);
+          if (local_error != NULL || duration < 0.0)
+            continue;
+
+          test_case->expected_duration = duration;
+          total += duration;
+          n_known++;
+        }
+    }
+
+  mean = (n_known > 0) ? total / n_known : 1.0;
+
+  for (gsize i = 0; i < self->test_cases->len; i++)
+    {
+      TestCase *test_case = g_ptr_array_index (self->test_cases, i);
+
+      if (test_case->expected_duration <= 0.0)
+        test_case->expected_duration = mean;
+    }
+}
+
+/* Record the duration of each test case which was run, for balancing the next
+ * run. Failure to save them is not fatal. */
+static void
+runner_save_durations (Runner *self)
+{
+  g_autoptr(GKeyFile) key_file = g_key_file_new ();
+  g_autofree gchar *durations_path = runner_get_durations_path (self);
+  g_autoptr(GError) local_error = NULL;
+
+  g_key_file_load_from_file (key_file, durations_path, G_KEY_FILE_KEEP_COMMENTS, NULL);
+
+  for (gsize i = 0; i < self->test_cases->len; i++)
+    {
+      const TestCase *test_case = g_ptr_array_index (self->test_cases, i);
+
+      if (test_case->done && test_case->result != TEST_RESULT_FAILURE)
+        g_key_file_set_double (key_file, "Durations", test_case->path,
+                               test_case->duration);
+    }
+
+  if (!g_key_file_save_to_file (key_file, durations_path, &local_error))
+    g_debug ("%s: Error saving test durations to ‘%s’: %s",
+             G_STRFUNC, durations_path, local_error->message);
+}
+
+/* Print the results of the test cases which have finished, in registration
+ * order, stopping at the first which has not. */
+static void
+runner_print_results (Runner *self)
+{
+  while (self->n_printed < self->test_cases->len)
+    {
+      const TestCase *test_case = g_ptr_array_index (self->test_cases, self->n_printed);
+      const gchar *status, *directive;
+
+      if (!test_case->done)
+        break;
+
+      self->n_printed++;
+
+      switch (test_case->result)
+        {
+        case TEST_RESULT_SUCCESS:
+          status = "ok";
+          directive = NULL;
+          break;
+        case TEST_RESULT_SKIPPED:
+          status = "ok";
+          directive = "SKIP";
+          break;
+        case TEST_RESULT_INCOMPLETE:
+          status = "not ok";
+          directive = "TODO";
+          break;
+        case TEST_RESULT_FAILURE:
+        default:
+          status = "not ok";
+          directive = NULL;
+          self->failed = TRUE;
+          break;
+        }
+
+      g_print ("%s", test_case->diagnostics->str);
+
+      if (directive != NULL)
+        g_print ("%s %u %s # %s%s%s\n", status, self->n_printed, test_case->path,
+                 directive, (test_case->reason != NULL) ? " " : "",
+                 (test_case->reason != NULL) ? test_case->reason : "");
+      else
+        g_print ("%s %u %s\n", status, self->n_printed, test_case->path);
+    }
+}
+
+static void
+test_case_add_diagnostic (TestCase    *test_case,
+                          const gchar *message)
+{
+  g_auto(GStrv) lines = g_strsplit (message, "\n", -1);
+
+  for (gsize i = 0; lines[i] != NULL; i++)
+    g_string_append_printf (test_case->diagnostics, "# %s\n", lines[i]);
+}
+
+static void
+test_case_finish (TestCase    *test_case,
+                  TestResult   result,
+                  const gchar *reason,
+                  gdouble      duration)
+{
+  test_case->done = TRUE;
+  test_case->result = result;
+  g_free (test_case->reason);
+  test_case->reason = g_strdup (reason);
+  test_case->duration = duration;
+}
+
+/* Look up a test case which was assigned to @self by path, returning %NULL if
+ * it isn’t one (for example, because `-p` also matched test cases below
+ * it) or has already finished. */
+static TestCase *
+worker_lookup_test_case (Worker      *self,
+                         const gchar *path)
+{
+  TestCase *test_case = g_hash_table_lookup (self->runner->test_cases_by_path, path);
+
+  if (test_case == NULL || test_case->done)
+    return NULL;
+
+  for (gsize i = 0; i < self->test_cases->len; i++)
+    {
+      if (g_ptr_array_index (self->test_cases, i) == test_case)
+        return test_case;
+    }
+
+  return NULL;
+}
+
+static void
+worker_handle_log_msg (Worker     *self,
+                       GTestLogMsg *msg)
+{
+  switch (msg->log_type)
+    {
+    case G_TEST_LOG_START_CASE:
+      self->current = (msg->n_strings >= 1) ? worker_lookup_test_case (self, msg->strings[0]) : NULL;
+      if (self->current != NULL)
+        self->current->start_time = g_get_monotonic_time ();
+      break;
+
+    case G_TEST_LOG_STOP_CASE:
+      if (self->current != NULL)
+        {
+          TestResult result = (msg->n_nums >= 1) ? (TestResult) msg->nums[0] : TEST_RESULT_FAILURE;
+          const gchar *reason = (msg->n_strings >= 2) ? msg->strings[1] : NULL;
+          gdouble duration;
+
+          if (msg->n_nums >= 3)
+            duration = (gdouble) msg->nums[2];
+          else
+            duration = (gdouble) (g_get_monotonic_time () - self->current->start_time) / G_USEC_PER_SEC;
+
+          test_case_finish (self->current, result,
+                            (reason != NULL && *reason != '\0') ? reason : NULL,
+                            duration);
+          self->current = NULL;
+          runner_print_results (self->runner);
+        }
+      break;
+
+    case G_TEST_LOG_SKIP_CASE:
+      {
+        TestCase *test_case = (msg->n_strings >= 1) ? worker_lookup_test_case (self, msg->strings[0]) : NULL;
+
+        if (test_case != NULL)
+          {
+            test_case_finish (test_case, TEST_RESULT_SKIPPED, NULL, 0.0);
+            runner_print_results (self->runner);
+          }
+      }
+      break;
+
+    case G_TEST_LOG_MESSAGE:
+    case G_TEST_LOG_ERROR:
+      if (self->current != NULL && msg->n_strings >= 1)
+        test_case_add_diagnostic (self->current, msg->strings[0]);
+      break;
+
+    case G_TEST_LOG_NONE:
+    case G_TEST_LOG_START_BINARY:
+    case G_TEST_LOG_LIST_CASE:
+    case G_TEST_LOG_MIN_RESULT:
+    case G_TEST_LOG_MAX_RESULT:
+    case G_TEST_LOG_START_SUITE:
+    case G_TEST_LOG_STOP_SUITE:
+    default:
+      break;
+    }
+}
+
+static void runner_spawn_worker (Runner    *self,
+                                 GPtrArray *test_cases);
+
+/* Once a worker has exited and its log has been read to the end, report the
+ * test case it was running (if any) as failed, and hand any test cases it did
+ * not start to a new worker. */
+static void
+worker_maybe_finish (Worker *self)
+{
+  g_autoptr(GPtrArray) remaining = NULL;
+  g_autofree gchar *status_message = NULL;
+  gboolean crashed, retry;
+
+  if (!self->log_done || !self->exited)
+    return;
+
+  self->runner->n_running_workers--;
+
+  if (g_subprocess_get_if_signaled (self->subprocess))
+    status_message = g_strdup_printf ("Worker was killed by signal %d",
+                                      g_subprocess_get_term_sig (self->subprocess));
+  else
+    status_message = g_strdup_printf ("Worker exited with status %d",
+                                      g_subprocess_get_exit_status (self->subprocess));
+
+  crashed = !g_subprocess_get_successful (self->subprocess);
+
+  /* Only retry the remaining test cases if the crash can be blamed on one test
+   * case, otherwise a worker which always crashes would be respawned
+   * forever. */
+  retry = (crashed && self->current != NULL);
+
+  if (self->current != NULL)
+    {
+      test_case_add_diagnostic (self->current, status_message);
+      test_case_finish (self->current, TEST_RESULT_FAILURE, NULL,
+                        (gdouble) (g_get_monotonic_time () - self->current->start_time) / G_USEC_PER_SEC);
+      self->current = NULL;
+    }
+
+  remaining = g_ptr_array_new ();
+
+  for (gsize i = 0; i < self->test_cases->len; i++)
+    {
+      TestCase *test_case = g_ptr_array_index (self->test_cases, i);
+
+      if (test_case->done)
+        continue;
+
+      /* If the worker exited normally without running a test case, running it
+       * again won’t help. */
+      if (retry)
+        {
+          g_ptr_array_add (remaining, test_case);
+        }
+      else if (crashed)
+        {
+          test_case_add_diagnostic (test_case, status_message);
+          test_case_finish (test_case, TEST_RESULT_FAILURE, NULL, 0.0);
+        }
+      else
+        {
+          test_case_finish (test_case, TEST_RESULT_SKIPPED, "not run by worker", 0.0);
+        }
+    }
+
+  if (remaining->len > 0)
+    runner_spawn_worker (self->runner, remaining);
+
+  runner_print_results (self->runner);
+}
+
+static void
+worker_wait_cb (GObject      *object,
+                GAsyncResult *result,
+                gpointer      user_data)
+{
+  Worker *self = user_data;
+  g_autoptr(GError) local_error = NULL;
+
+  if (!g_subprocess_wait_finish (G_SUBPROCESS (object), result, &local_error))
+    g_warning ("Error waiting for test worker: %s", local_error->message);
+
+  self->exited = TRUE;
+  worker_maybe_finish (self);
+}
+
+static void
+worker_read_cb (GObject      *object,
+                GAsyncResult *result,
+                gpointer      user_data)
+{
+  Worker *self = user_data;
+  g_autoptr(GBytes) bytes = NULL;
+  g_autoptr(GError) local_error = NULL;
+  GTestLogMsg *msg;
+
+  bytes = g_input_stream_read_bytes_finish (G_INPUT_STREAM (object), result, &local_error);
+
+  if (bytes == NULL || g_bytes_get_size (bytes) == 0)
+    {
+      if (local_error != NULL)
+        g_warning ("Error reading test worker log: %s", local_error->message);
+
+      self->log_done = TRUE;
+      worker_maybe_finish (self);
+      return;
+    }
+
+  g_test_log_buffer_push (self->log_buffer, g_bytes_get_size (bytes),
+                          g_bytes_get_data (bytes, NULL));
+
+  while ((msg = g_test_log_buffer_pop (self->log_buffer)) != NULL)
+    {
+      worker_handle_log_msg (self, msg);
+      g_test_log_msg_free (msg);
+    }
+
+  g_input_stream_read_bytes_async (self->log_stream, 4096, G_PRIORITY_DEFAULT,
+                                   NULL, worker_read_cb, self);
+}
+
+/* Spawn a worker to run @test_cases. If it can’t be spawned, they are all
+ * reported as failed. */
+static void
+runner_spawn_worker (Runner    *self,
+                     GPtrArray *test_cases)
+{
+  g_autoptr(GSubprocessLauncher) launcher = NULL;
+  g_autoptr(GPtrArray) argv = NULL;
+  g_autofree gchar *log_fd_arg = NULL;
+  g_autoptr(GError) local_error = NULL;
+  Worker *worker;
+  gint log_fds[2];
+
+  worker = g_new0 (Worker, 1);
+  worker->runner = self;
+  worker->test_cases = g_ptr_array_ref (test_cases);
+  worker->log_buffer = g_test_log_buffer_new ();
+  g_ptr_array_add (self->workers, worker);
+
+  /* The workers’ TAP output is replaced by the merged output, but their stderr
+   * is passed through so that failure messages are seen. */
+  launcher = runner_new_launcher (G_SUBPROCESS_FLAGS_STDOUT_SILENCE);
+
+  if (g_unix_open_pipe (log_fds, FD_CLOEXEC, &local_error))
+    {
+      worker->log_stream = g_unix_input_stream_new (log_fds[0], TRUE);
+      g_subprocess_launcher_take_fd (launcher, log_fds[1], WORKER_LOG_FD);
+
+      log_fd_arg = g_strdup_printf ("--GTestLogFD=%d", WORKER_LOG_FD);
+      argv = runner_new_argv (self);
+      g_ptr_array_add (argv, log_fd_arg);
+      for (gsize i = 0; i < test_cases->len; i++)
+        {
+          TestCase *test_case = g_ptr_array_index (test_cases, i);
+
+          g_ptr_array_add (argv, (gpointer) "-p");
+          g_ptr_array_add (argv, test_case->path);
+        }
+      g_ptr_array_add (argv, NULL);
+
+      worker->subprocess = g_subprocess_launcher_spawnv (launcher,
+                                                         (const gchar * const *) argv->pdata,
+                                                         &local_error);
+    }
+
+  if (worker->subprocess == NULL)
+    {
+      for (gsize i = 0; i < test_cases->len; i++)
+        {
+          TestCase *test_case = g_ptr_array_index (test_cases, i);
+
+          test_case_add_diagnostic (test_case, local_error->message);
+          test_case_finish (test_case, TEST_RESULT_FAILURE, NULL, 0.0);
+        }
+
+      return;
+    }
+
+  self->n_running_workers++;
+
+  g_input_stream_read_bytes_async (worker->log_stream, 4096, G_PRIORITY_DEFAULT,
+                                   NULL, worker_read_cb, worker);
+  g_subprocess_wait_async (worker->subprocess, NULL, worker_wait_cb, worker);
+}
+
+/* Sort #TestCases by decreasing expected duration. */
+static gint
+compare_test_cases_by_duration (gconstpointer a,
+                                gconstpointer b)
+{
+  const TestCase *test_case_a = *((const TestCase **) a);
+  const TestCase *test_case_b = *((const TestCase **) b);
+
+  return (test_case_a->expected_duration < test_case_b->expected_duration) -
+         (test_case_a->expected_duration > test_case_b->expected_duration);
+}
+
+/* Split the test cases between @n_jobs workers, so that each worker’s total
+ * expected duration is about the same, by assigning them longest first to
+ * the worker with the least work so far. */
+static GPtrArray *
+runner_partition_test_cases (Runner *self,
+                             guint   n_jobs)
+{
+  g_autoptr(GPtrArray) sorted = g_ptr_array_sized_new (self->test_cases->len);
+  g_autoptr(GPtrArray) partitions = NULL;
+  g_autofree gdouble *totals = g_new0 (gdouble, n_jobs);
+
+  for (gsize i = 0; i < self->test_cases->len; i++)
+    g_ptr_array_add (sorted, g_ptr_array_index (self->test_cases, i));
+  g_ptr_array_sort (sorted, compare_test_cases_by_duration);
+
+  partitions = g_ptr_array_new_with_free_func ((GDestroyNotify) g_ptr_array_unref);
+  for (guint i = 0; i < n_jobs; i++)
+    g_ptr_array_add (partitions, g_ptr_array_new ());
+
+  for (gsize i = 0; i < sorted->len; i++)
+    {
+      TestCase *test_case = g_ptr_array_index (sorted, i);
+      guint least_loaded = 0;
+
+      for (guint j = 1; j < n_jobs; j++)
+        {
+          if (totals[j] < totals[least_loaded])
+            least_loaded = j;
+        }
+
+      g_ptr_array_add (g_ptr_array_index (partitions, least_loaded), test_case);
+      totals[least_loaded] += test_case->expected_duration;
+    }
+
+  return g_steal_pointer (&partitions);
+}
+
+static void
+runner_free (Runner *self)
+{
+  g_clear_pointer (&self->workers, g_ptr_array_unref);
+  g_clear_pointer (&self->test_cases_by_path, g_hash_table_unref);
+  g_clear_pointer (&self->test_cases, g_ptr_array_unref);
+  g_clear_pointer (&self->extra_args, g_ptr_array_unref);
+  g_free (self->program);
+  g_free (self);
+}
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC (Runner, runner_free)
+
+/**
+ * gt_test_run_parallel:
+ *
+ * Run the test cases registered with g_test_add() and friends, in parallel in
+ * a pool of worker processes. This should be called instead of g_test_run(),
+ * after g_test_init() and the test cases have been registered. See the
+ * section documentation for details.
+ *
+ * Returns: 0 on success, 1 on failure; suitable for returning from `main()`
+ * Since: 0.2.0
+ */
+int
+gt_test_run_parallel (void)
+{
+  g_autoptr(Runner) runner = NULL;
+  g_autoptr(GMainContext) context = NULL;
+  g_autoptr(GPtrArray) partitions = NULL;
+  g_autoptr(GError) local_error = NULL;
+  guint n_jobs;
+
+  if (g_getenv (WORKER_ENV_VAR) != NULL || g_test_subprocess ())
+    return g_test_run ();
+
+  runner = g_new0 (Runner, 1);
+  runner->extra_args = get_original_args ();
+  runner->program = g_file_read_link ("/proc/self/exe", NULL);
+
+  if (runner->extra_args == NULL || runner->program == NULL ||
+      !args_allow_parallel (runner->extra_args))
+    return g_test_run ();
+
+  runner->test_cases = g_ptr_array_new_with_free_func ((GDestroyNotify) test_case_free);
+  runner->test_cases_by_path = g_hash_table_new (g_str_hash, g_str_equal);
+  runner->workers = g_ptr_array_new_with_free_func ((GDestroyNotify) worker_free);
+
+  if (!runner_list_test_cases (runner, &local_error))
+    {
+      g_printerr ("Error listing test cases: %s\n", local_error->message);
+      return 1;
+    }
+
+  n_jobs = MIN (get_n_jobs (), runner->test_cases->len);
+  if (n_jobs <= 1)
+    return g_test_run ();
+
+  runner_load_durations (runner);
+
+  g_print ("# Running %u test cases in %u workers\n", runner->test_cases->len, n_jobs);
+  g_print ("1..%u\n", runner->test_cases->len);
+
+  context = g_main_context_new ();
+  g_main_context_push_thread_default (context);
+
+  partitions = runner_partition_test_cases (runner, n_jobs);
+  for (gsize i = 0; i < partitions->len; i++)
+    runner_spawn_worker (runner, g_ptr_array_index (partitions, i));
+
+  while (runner->n_running_workers > 0)
+    g_main_context_iteration (context, TRUE);
+
+  g_main_context_pop_thread_default (context);
+
+  runner_print_results (runner);
+  g_assert (runner->n_printed == runner->test_cases->len);
+
+  runner_save_durations (runner);
+
+  return runner->failed ? 1 : 0;
+}
@@ -0,0 +1,164 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ *
+ * Copyright © 2018 Endless Mobile, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#include <glib.h>
+#include <libglib-testing/alloc-tracker.h>
+#include <locale.h>
+#include <string.h>
+
+
+/* Test that creating and destroying a tracker works, and that nothing is
+ * counted before it’s started. A basic smoketest. */
+static void
+test_alloc_tracker_construction (void)
+{
+  g_autoptr(GtAllocTracker) tracker = NULL;
+  g_autofree gchar *formatted = NULL;
+
+  tracker = gt_alloc_tracker_new (GT_ALLOC_TRACKER_SCOPE_THREAD);
+
+  g_test_message ("Using backend %d", (gint) gt_alloc_tracker_get_backend (tracker));
+
+  g_assert_cmpuint (gt_alloc_tracker_get_n_allocs (tracker), ==, 0);
+  g_assert_cmpuint (gt_alloc_tracker_get_n_frees (tracker), ==, 0);
+  g_assert_cmpuint (gt_alloc_tracker_get_n_bytes (tracker), ==, 0);
+
+  formatted = gt_alloc_tracker_format (tracker);
+  g_assert_nonnull (formatted);
+}
+
+/* Test that allocations are counted, and that an allocation-free scope passes
+ * the budget assertions. */
+static void
+test_alloc_tracker_count (void)
+{
+  g_autoptr(GtAllocTracker) tracker = NULL;
+  gpointer blocks[10];
+  guint sum = 0;
+
+  tracker = gt_alloc_tracker_new (GT_ALLOC_TRACKER_SCOPE_THREAD);
+
+  /* An empty scope. */
+  gt_alloc_tracker_start (tracker);
+  for (guint i = 0; i < 1000; i++)
+    sum += i;
+  gt_alloc_tracker_stop (tracker);
+
+  g_assert_cmpuint (sum, ==, 499500);
+  gt_assert_allocs_at_most (tracker, 0);
+  gt_assert_alloc_bytes_at_most (tracker, 0);
+
+  /* A scope with some allocations, which are kept alive so the mallinfo
+   * backend sees them too. */
+  gt_alloc_tracker_start (tracker);
+  for (gsize i = 0; i < G_N_ELEMENTS (blocks); i++)
+    blocks[i] = g_malloc (1024);
+  gt_alloc_tracker_stop (tracker);
+
+  for (gsize i = 0; i < G_N_ELEMENTS (blocks); i++)
+    g_free (blocks[i]);
+
+  switch (gt_alloc_tracker_get_backend (tracker))
+    {
+    case GT_ALLOC_TRACKER_BACKEND_SHIM:
+      g_assert_cmpuint (gt_alloc_tracker_get_n_allocs (tracker), ==, G_N_ELEMENTS (blocks));
+      g_assert_cmpuint (gt_alloc_tracker_get_n_frees (tracker), ==, 0);
+      g_assert_cmpuint (gt_alloc_tracker_get_n_bytes (tracker), ==, G_N_ELEMENTS (blocks) * 1024);
+      break;
+    case GT_ALLOC_TRACKER_BACKEND_MALLINFO:
+      g_assert_cmpuint (gt_alloc_tracker_get_n_allocs (tracker), ==, 0);
+      g_assert_cmpuint (gt_alloc_tracker_get_n_bytes (tracker), >=, G_N_ELEMENTS (blocks) * 1024);
+      break;
+    case GT_ALLOC_TRACKER_BACKEND_NONE:
+      g_test_skip ("Allocation tracking not available");
+      return;
+    default:
+      g_assert_not_reached ();
+    }
+
+  gt_assert_allocs_at_most (tracker, G_N_ELEMENTS (blocks));
+  gt_assert_alloc_bytes_at_most (tracker, G_MAXUINT64);
+}
+
+static gpointer
+allocate_thread_cb (gpointer user_data)
+{
+  gint *go = user_data;
+
+  /* Wait until the trackers have been started. */
+  while (!g_atomic_int_get (go))
+    g_thread_yield ();
+
+  g_free (g_malloc (64));
+
+  return NULL;
+}
+
+/* Test that a thread-scoped tracker doesn’t count allocations made by other
+ * threads, and a process-scoped one does. This needs the shim. */
+static void
+test_alloc_tracker_scope (void)
+{
+  g_autoptr(GtAllocTracker) thread_tracker = NULL;
+  g_autoptr(GtAllocTracker) process_tracker = NULL;
+  g_autoptr(GThread) thread = NULL;
+  gint go = FALSE;
+
+  thread_tracker = gt_alloc_tracker_new (GT_ALLOC_TRACKER_SCOPE_THREAD);
+  process_tracker = gt_alloc_tracker_new (GT_ALLOC_TRACKER_SCOPE_PROCESS);
+
+  if (gt_alloc_tracker_get_backend (thread_tracker) != GT_ALLOC_TRACKER_BACKEND_SHIM)
+    {
+      g_test_skip ("Allocation shim not loaded");
+      return;
+    }
+
+  /* Create the thread before starting, so the allocations needed to create it
+   * aren’t counted in this thread. */
+  thread = g_thread_new ("alloc-tracker-test", allocate_thread_cb, &go);
+
+  gt_alloc_tracker_start (thread_tracker);
+  gt_alloc_tracker_start (process_tracker);
+  g_atomic_int_set (&go, TRUE);
+  g_thread_join (g_steal_pointer (&thread));
+  gt_alloc_tracker_stop (process_tracker);
+  gt_alloc_tracker_stop (thread_tracker);
+
+  gt_assert_allocs_at_most (thread_tracker, 0);
+  g_assert_cmpuint (gt_alloc_tracker_get_n_allocs (process_tracker), >=, 1);
+}
+
+int
+main (int   argc,
+      char *argv[])
+{
+  setlocale (LC_ALL, "");
+
+  g_test_init (&argc, &argv, NULL);
+
+  g_test_add_func ("/alloc-tracker/construction",
+                   test_alloc_tracker_construction);
+  g_test_add_func ("/alloc-tracker/count",
+                   test_alloc_tracker_count);
+  g_test_add_func ("/alloc-tracker/scope",
+                   test_alloc_tracker_scope);
+
+  return g_test_run ();
+}
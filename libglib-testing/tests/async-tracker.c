@@ -0,0 +1,184 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ *
+ * Copyright © 2018 Endless Mobile, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#include <gio/gio.h>
+#include <glib.h>
+#include <libglib-testing/async-tracker.h>
+#include <locale.h>
+#include <string.h>
+
+
+/* Test that creating and destroying an async tracker works. A basic
+ * smoketest. */
+static void
+test_async_tracker_construction (void)
+{
+  g_autoptr(GtAsyncTracker) tracker = NULL;
+  tracker = gt_async_tracker_new ();
+
+  g_assert_cmpuint (gt_async_tracker_get_n_in_flight (tracker), ==, 0);
+  g_assert_cmpuint (gt_async_tracker_get_n_completed (tracker), ==, 0);
+  g_assert_true (gt_async_tracker_wait_idle (tracker, NULL, 0));
+}
+
+static void
+sleep_thread_cb (GTask        *task,
+                 gpointer      source_object,
+                 gpointer      task_data,
+                 GCancellable *cancellable)
+{
+  g_usleep (GPOINTER_TO_UINT (task_data) * 1000);
+  g_task_return_boolean (task, TRUE);
+}
+
+static void
+sleep_done_cb (GObject      *source_object,
+               GAsyncResult *result,
+               gpointer      user_data)
+{
+  guint *n_done = user_data;
+
+  g_assert_true (g_task_propagate_boolean (G_TASK (result), NULL));
+  *n_done = *n_done + 1;
+}
+
+static void
+test_sleep_async (guint               sleep_ms,
+                  GAsyncReadyCallback callback,
+                  gpointer            user_data)
+{
+  g_autoptr(GTask) task = NULL;
+
+  task = g_task_new (NULL, NULL, callback, user_data);
+  g_task_set_source_tag (task, test_sleep_async);
+  g_task_set_task_data (task, GUINT_TO_POINTER (sleep_ms), NULL);
+  g_task_run_in_thread (task, sleep_thread_cb);
+}
+
+/* Test that tasks which complete in another thread are waited for, and that
+ * slow ones are recorded. The slow task can’t take less than the threshold,
+ * and the threshold leaves a wide margin for the fast tasks to be delayed on a
+ * loaded machine. */
+static void
+test_async_tracker_tasks (void)
+{
+  g_autoptr(GtAsyncTracker) tracker = NULL;
+  g_autofree gchar *formatted = NULL;
+  guint n_done = 0;
+
+  tracker = gt_async_tracker_new ();
+  gt_async_tracker_set_slow_threshold (tracker, 1000);
+
+  test_sleep_async (1, sleep_done_cb, &n_done);
+  test_sleep_async (1, sleep_done_cb, &n_done);
+  test_sleep_async (1500, sleep_done_cb, &n_done);
+
+  g_assert_cmpuint (gt_async_tracker_get_n_in_flight (tracker), ==, 3);
+
+  gt_async_tracker_assert_wait_idle (tracker, NULL, 10000);
+
+  g_assert_cmpuint (n_done, ==, 3);
+  g_assert_cmpuint (gt_async_tracker_get_n_in_flight (tracker), ==, 0);
+  g_assert_cmpuint (gt_async_tracker_get_n_completed (tracker), ==, 3);
+  g_assert_cmpuint (gt_async_tracker_get_n_slow (tracker), ==, 1);
+
+  formatted = gt_async_tracker_format (tracker);
+  g_test_message ("%s", formatted);
+  g_assert_nonnull (strstr (formatted, "Slow"));
+  g_assert_nonnull (strstr (formatted, "GTask"));
+}
+
+/* Test that waiting for a task which hasn’t completed times out, and that the
+ * task is listed as in flight. */
+static void
+test_async_tracker_timeout (void)
+{
+  g_autoptr(GtAsyncTracker) tracker = NULL;
+  g_autoptr(GTask) task = NULL;
+  g_autofree gchar *formatted = NULL;
+  guint n_done = 0;
+
+  tracker = gt_async_tracker_new ();
+
+  task = g_task_new (NULL, NULL, sleep_done_cb, &n_done);
+  g_task_set_source_tag (task, test_async_tracker_timeout);
+
+  g_assert_false (gt_async_tracker_wait_idle (tracker, NULL, 10));
+  g_assert_cmpuint (gt_async_tracker_get_n_in_flight (tracker), ==, 1);
+
+  formatted = gt_async_tracker_format (tracker);
+  g_test_message ("%s", formatted);
+  g_assert_nonnull (strstr (formatted, "In flight"));
+
+  g_task_return_boolean (task, TRUE);
+  g_clear_object (&task);
+
+  gt_async_tracker_assert_wait_idle (tracker, NULL, 10000);
+  g_assert_cmpuint (n_done, ==, 1);
+}
+
+/* Test that operations scoped to a #GCancellable are tracked until it is
+ * cancelled or finalized. */
+static void
+test_async_tracker_cancellable (void)
+{
+  g_autoptr(GtAsyncTracker) tracker = NULL;
+  g_autoptr(GCancellable) cancellable1 = g_cancellable_new ();
+  g_autoptr(GCancellable) cancellable2 = g_cancellable_new ();
+  g_autoptr(GCancellable) cancelled = g_cancellable_new ();
+
+  tracker = gt_async_tracker_new ();
+
+  g_cancellable_cancel (cancelled);
+  gt_async_tracker_track_cancellable (tracker, cancelled, "already cancelled");
+  g_assert_cmpuint (gt_async_tracker_get_n_in_flight (tracker), ==, 0);
+
+  gt_async_tracker_track_cancellable (tracker, cancellable1, "operation 1");
+  gt_async_tracker_track_cancellable (tracker, cancellable2, "operation 2");
+  gt_async_tracker_track_cancellable (tracker, cancellable2, "operation 2");
+  g_assert_cmpuint (gt_async_tracker_get_n_in_flight (tracker), ==, 2);
+
+  g_cancellable_cancel (cancellable1);
+  g_assert_cmpuint (gt_async_tracker_get_n_in_flight (tracker), ==, 1);
+
+  g_clear_object (&cancellable2);
+  g_assert_cmpuint (gt_async_tracker_get_n_in_flight (tracker), ==, 0);
+  g_assert_cmpuint (gt_async_tracker_get_n_completed (tracker), ==, 3);
+}
+
+int
+main (int   argc,
+      char *argv[])
+{
+  setlocale (LC_ALL, "");
+
+  g_test_init (&argc, &argv, NULL);
+
+  g_test_add_func ("/async-tracker/construction",
+                   test_async_tracker_construction);
+  g_test_add_func ("/async-tracker/tasks",
+                   test_async_tracker_tasks);
+  g_test_add_func ("/async-tracker/timeout",
+                   test_async_tracker_timeout);
+  g_test_add_func ("/async-tracker/cancellable",
+                   test_async_tracker_cancellable);
+
+  return g_test_run ();
+}
@@ -0,0 +1,201 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ *
+ * Copyright © 2018 Endless Mobile, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#include <gio/gio.h>
+#include <glib.h>
+#include <libglib-testing/bench.h>
+#include <libglib-testing/dbus-queue.h>
+#include <locale.h>
+#include "test-service-iface.h"
+
+
+/* Fixture for benchmarks which make calls to the com.example.Test service over
+ * D-Bus. It exports one object (with ID 123) and a manager object. */
+typedef struct
+{
+  GtDBusQueue *queue;  /* (owned) */
+  guint handler_id;
+} BusFixture;
+
+static void
+bus_set_up (BusFixture    *fixture,
+            gconstpointer  user_data)
+{
+  g_autoptr(GError) local_error = NULL;
+
+  fixture->queue = gt_dbus_queue_new ();
+
+  gt_dbus_queue_connect (fixture->queue, &local_error);
+  g_assert_no_error (local_error);
+
+  gt_dbus_queue_own_name (fixture->queue, "com.example.Test");
+
+  gt_dbus_queue_export_object (fixture->queue,
+                               "/com/example/Test/Object123",
+                               (GDBusInterfaceInfo *) &gt_mock_object_interface_info,
+                               &local_error);
+  g_assert_no_error (local_error);
+
+  gt_dbus_queue_export_object (fixture->queue,
+                               "/com/example/Test",
+                               (GDBusInterfaceInfo *) &gt_mock_manager_interface_info,
+                               &local_error);
+  g_assert_no_error (local_error);
+}
+
+static void
+bus_tear_down (BusFixture    *fixture,
+               gconstpointer  user_data)
+{
+  if (fixture->handler_id != 0)
+    gt_dbus_queue_remove_handler (fixture->queue, fixture->handler_id);
+
+  gt_dbus_queue_disconnect (fixture->queue, TRUE);
+  g_clear_pointer (&fixture->queue, gt_dbus_queue_free);
+}
+
+/* Handler for GetObjectPath() calls which replies immediately. This is run in
+ * the server thread. */
+static void
+get_object_path_cb (GtDBusQueue           *queue,
+                    GDBusMethodInvocation *invocation,
+                    gpointer               user_data)
+{
+  gt_mock_manager_return_get_object_path (invocation,
+                                          "/com/example/Test/Object123");
+}
+
+static void
+bus_set_up_handler (BusFixture    *fixture,
+                    gconstpointer  user_data)
+{
+  bus_set_up (fixture, user_data);
+
+  fixture->handler_id = gt_dbus_queue_add_handler (fixture->queue,
+                                                   "/com/example/Test",
+                                                   "com.example.Test.Manager",
+                                                   "GetObjectPath",
+                                                   get_object_path_cb,
+                                                   NULL, NULL);
+}
+
+/* Make a GetObjectPath() call and return its reply. */
+static GVariant *
+call_get_object_path_sync (BusFixture *fixture)
+{
+  g_autoptr(GError) local_error = NULL;
+  g_autoptr(GVariant) reply = NULL;
+
+  reply = g_dbus_connection_call_sync (gt_dbus_queue_get_client_connection (fixture->queue),
+                                       "com.example.Test",
+                                       "/com/example/Test",
+                                       "com.example.Test.Manager",
+                                       "GetObjectPath",
+                                       g_variant_new ("(u)", 123),
+                                       G_VARIANT_TYPE ("(o)"),
+                                       G_DBUS_CALL_FLAGS_NONE,
+                                       -1,  /* timeout (ms) */
+                                       NULL,  /* cancellable */
+                                       &local_error);
+  g_assert_no_error (local_error);
+
+  return g_steal_pointer (&reply);
+}
+
+/* Benchmark a round trip to a handler registered with
+ * gt_dbus_queue_add_handler(), which replies in the server thread. */
+static void
+bench_dbus_queue_handler_round_trip (BusFixture    *fixture,
+                                     gconstpointer  user_data)
+{
+  g_autoptr(GVariant) reply = call_get_object_path_sync (fixture);
+  g_assert_nonnull (reply);
+}
+
+/* Helper #GAsyncReadyCallback which returns the #GAsyncResult in its @user_data. */
+static void
+async_result_cb (GObject      *obj,
+                 GAsyncResult *result,
+                 gpointer      user_data)
+{
+  GAsyncResult **result_out = (GAsyncResult **) user_data;
+
+  g_assert_null (*result_out);
+  *result_out = g_object_ref (result);
+}
+
+/* Benchmark a round trip where the test thread pops the message off the queue
+ * and replies to it. */
+static void
+bench_dbus_queue_pop_round_trip (BusFixture    *fixture,
+                                 gconstpointer  user_data)
+{
+  GDBusConnection *client_connection = gt_dbus_queue_get_client_connection (fixture->queue);
+  g_autoptr(GAsyncResult) result = NULL;
+  g_autoptr(GDBusMethodInvocation) invocation = NULL;
+  g_autoptr(GVariant) reply = NULL;
+  g_autoptr(GError) local_error = NULL;
+  guint32 object_id;
+
+  g_dbus_connection_call (client_connection,
+                          "com.example.Test",
+                          "/com/example/Test",
+                          "com.example.Test.Manager",
+                          "GetObjectPath",
+                          g_variant_new ("(u)", 123),
+                          G_VARIANT_TYPE ("(o)"),
+                          G_DBUS_CALL_FLAGS_NONE,
+                          -1,  /* timeout (ms) */
+                          NULL,  /* cancellable */
+                          async_result_cb,
+                          &result);
+
+  invocation =
+      gt_mock_manager_assert_pop_get_object_path (fixture->queue,
+                                                  "/com/example/Test",
+                                                  &object_id);
+  gt_mock_manager_return_get_object_path (invocation,
+                                          "/com/example/Test/Object123");
+
+  while (result == NULL)
+    g_main_context_iteration (NULL, TRUE);
+
+  reply = g_dbus_connection_call_finish (client_connection, result, &local_error);
+  g_assert_no_error (local_error);
+  g_assert_nonnull (reply);
+}
+
+int
+main (int   argc,
+      char *argv[])
+{
+  setlocale (LC_ALL, "");
+
+  gt_bench_init (&argc, &argv);
+  g_test_init (&argc, &argv, NULL);
+
+  gt_bench_add ("/dbus-queue/handler-round-trip", BusFixture, NULL,
+                bus_set_up_handler, bench_dbus_queue_handler_round_trip,
+                bus_tear_down);
+  gt_bench_add ("/dbus-queue/pop-round-trip", BusFixture, NULL,
+                bus_set_up, bench_dbus_queue_pop_round_trip, bus_tear_down);
+
+  return gt_bench_run ();
+}
@@ -0,0 +1,120 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ *
+ * Copyright © 2018 Endless Mobile, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#include <gio/gio.h>
+#include <glib.h>
+#include <libglib-testing/bench.h>
+#include <libglib-testing/signal-logger.h>
+#include <locale.h>
+
+
+/* Fixture for benchmarks which log #GObject::notify emissions from a
+ * #GSimpleAction. */
+typedef struct
+{
+  GtSignalLogger *logger;  /* (owned) */
+  GSimpleAction *action;  /* (owned) */
+  gboolean enabled;
+} LoggerFixture;
+
+static void
+logger_set_up (LoggerFixture *fixture,
+               gconstpointer  user_data)
+{
+  fixture->logger = gt_signal_logger_new ();
+  fixture->action = g_simple_action_new ("action", NULL);
+  fixture->enabled = TRUE;
+
+  gt_signal_logger_connect (fixture->logger, fixture->action, "notify::enabled");
+}
+
+static void
+logger_tear_down (LoggerFixture *fixture,
+                  gconstpointer  user_data)
+{
+  gt_signal_logger_assert_no_emissions (fixture->logger);
+
+  g_clear_object (&fixture->action);
+  g_clear_pointer (&fixture->logger, gt_signal_logger_free);
+}
+
+/* Benchmark logging a signal emission and popping it again. */
+static void
+bench_signal_logger_emission_pop (LoggerFixture *fixture,
+                                  gconstpointer  user_data)
+{
+  fixture->enabled = !fixture->enabled;
+  g_simple_action_set_enabled (fixture->action, fixture->enabled);
+
+  gt_signal_logger_assert_notify_emission_pop (fixture->logger, fixture->action, "enabled");
+}
+
+/* Benchmark formatting a signal emission for debug output. */
+static void
+bench_signal_logger_format (LoggerFixture *fixture,
+                            gconstpointer  user_data)
+{
+  g_autofree gchar *formatted = NULL;
+
+  formatted = gt_signal_logger_format_emissions (fixture->logger);
+  g_assert_nonnull (formatted);
+}
+
+static void
+logger_set_up_with_emissions (LoggerFixture *fixture,
+                              gconstpointer  user_data)
+{
+  logger_set_up (fixture, user_data);
+
+  for (gsize i = 0; i < 10; i++)
+    {
+      fixture->enabled = !fixture->enabled;
+      g_simple_action_set_enabled (fixture->action, fixture->enabled);
+    }
+}
+
+static void
+logger_tear_down_with_emissions (LoggerFixture *fixture,
+                                 gconstpointer  user_data)
+{
+  for (gsize i = 0; i < 10; i++)
+    gt_signal_logger_assert_notify_emission_pop (fixture->logger, fixture->action, "enabled");
+
+  logger_tear_down (fixture, user_data);
+}
+
+int
+main (int   argc,
+      char *argv[])
+{
+  setlocale (LC_ALL, "");
+
+  gt_bench_init (&argc, &argv);
+  g_test_init (&argc, &argv, NULL);
+
+  gt_bench_add ("/signal-logger/emission-pop", LoggerFixture, NULL,
+                logger_set_up, bench_signal_logger_emission_pop,
+                logger_tear_down);
+  gt_bench_add ("/signal-logger/format", LoggerFixture, NULL,
+                logger_set_up_with_emissions, bench_signal_logger_format,
+                logger_tear_down_with_emissions);
+
+  return gt_bench_run ();
+}
@@ -0,0 +1,101 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ *
+ * Copyright © 2018 Endless Mobile, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#include <glib.h>
+#include <libglib-testing/bench.h>
+#include <locale.h>
+
+
+/* Test the statistics for a simple set of samples with no outliers. */
+static void
+test_bench_stats_simple (void)
+{
+  const gdouble samples[] = { 5.0, 1.0, 4.0, 2.0, 3.0 };
+  GtBenchStats stats;
+
+  gt_bench_stats_compute (samples, G_N_ELEMENTS (samples), &stats);
+
+  g_assert_cmpuint (stats.n_samples, ==, 5);
+  g_assert_cmpuint (stats.n_outliers, ==, 0);
+  g_assert_cmpfloat (stats.median, ==, 3.0);
+  g_assert_cmpfloat (stats.mad, ==, 1.0);
+  g_assert_cmpfloat (stats.mean, ==, 3.0);
+  g_assert_cmpfloat (stats.min, ==, 1.0);
+  g_assert_cmpfloat (stats.max, ==, 5.0);
+}
+
+/* Test that outliers are rejected from the mean, minimum and maximum, but not
+ * from the median. */
+static void
+test_bench_stats_outliers (void)
+{
+  const gdouble samples[] = { 10.0, 11.0, 9.0, 10.0, 1000.0, 10.0 };
+  GtBenchStats stats;
+
+  gt_bench_stats_compute (samples, G_N_ELEMENTS (samples), &stats);
+
+  g_assert_cmpuint (stats.n_samples, ==, 6);
+  g_assert_cmpuint (stats.n_outliers, ==, 1);
+  g_assert_cmpfloat (stats.median, ==, 10.0);
+  g_assert_cmpfloat (stats.mad, ==, 0.5);
+  g_assert_cmpfloat (stats.mean, ==, 10.0);
+  g_assert_cmpfloat (stats.min, ==, 9.0);
+  g_assert_cmpfloat (stats.max, ==, 11.0);
+}
+
+/* Test that identical samples (zero MAD) are not all rejected as outliers. */
+static void
+test_bench_stats_constant (void)
+{
+  const gdouble samples[] = { 7.0, 7.0, 7.0, 7.0 };
+  GtBenchStats stats;
+
+  gt_bench_stats_compute (samples, G_N_ELEMENTS (samples), &stats);
+
+  g_assert_cmpuint (stats.n_outliers, ==, 0);
+  g_assert_cmpfloat (stats.median, ==, 7.0);
+  g_assert_cmpfloat (stats.mad, ==, 0.0);
+  g_assert_cmpfloat (stats.mean, ==, 7.0);
+}
+
+static void
+bench_strdup_printf (void)
+{
+  g_autofree gchar *str = g_strdup_printf ("%u", 123u);
+  g_assert_nonnull (str);
+}
+
+int
+main (int   argc,
+      char *argv[])
+{
+  setlocale (LC_ALL, "");
+
+  gt_bench_init (&argc, &argv);
+  g_test_init (&argc, &argv, NULL);
+
+  g_test_add_func ("/bench/stats/simple", test_bench_stats_simple);
+  g_test_add_func ("/bench/stats/outliers", test_bench_stats_outliers);
+  g_test_add_func ("/bench/stats/constant", test_bench_stats_constant);
+
+  gt_bench_add_func ("/bench/strdup-printf", bench_strdup_printf);
+
+  return gt_bench_run ();
+}
@@ -22,8 +22,13 @@
 
 #include <gio/gio.h>
 #include <glib.h>
+#include <glib/gstdio.h>
+#include <libglib-testing/alloc-tracker.h>
 #include <libglib-testing/dbus-queue.h>
+#include <libglib-testing/test-runner.h>
+#include <libglib-testing/virtual-clock.h>
 #include <locale.h>
+#include <string.h>
 #include "test-service-iface.h"
 
 /* Test that creating and destroying a D-Bus queue works. A basic smoketest. */
@@ -50,8 +55,8 @@ typedef struct
 } BusFixture;
 
 static void
-bus_set_up (BusFixture    *fixture,
-            gconstpointer  test_data)
+bus_set_up_full (BusFixture                *fixture,
+                 GtDBusQueueClassifierFunc  classifier_func)
 {
   g_autoptr(GError) local_error = NULL;
   g_autofree gchar *object_path = NULL;
@@ -59,6 +64,9 @@ bus_set_up (BusFixture    *fixture,
   fixture->valid_id = 123;  /* arbitrarily chosen */
   fixture->queue = gt_dbus_queue_new ();
 
+  if (classifier_func != NULL)
+    gt_dbus_queue_set_classifier_func (fixture->queue, classifier_func, NULL, NULL);
+
   gt_dbus_queue_connect (fixture->queue, &local_error);
   g_assert_no_error (local_error);
 
@@ -67,17 +75,46 @@ bus_set_up (BusFixture    *fixture,
   object_path = g_strdup_printf ("/com/example/Test/Object%u", fixture->valid_id);
   gt_dbus_queue_export_object (fixture->queue,
                                object_path,
-                               (GDBusInterfaceInfo *) &object_interface_info,
+                               (GDBusInterfaceInfo *) &gt_mock_object_interface_info,
                                &local_error);
   g_assert_no_error (local_error);
 
   gt_dbus_queue_export_object (fixture->queue,
                                "/com/example/Test",
-                               (GDBusInterfaceInfo *) &manager_interface_info,
+                               (GDBusInterfaceInfo *) &gt_mock_manager_interface_info,
                                &local_error);
   g_assert_no_error (local_error);
 }
 
+static void
+bus_set_up (BusFixture    *fixture,
+            gconstpointer  test_data)
+{
+  bus_set_up_full (fixture, NULL);
+}
+
+/* Classifier which puts all messages in one partition, and gives
+ * org.freedesktop.DBus.Properties calls a higher priority than other calls. */
+static gchar *
+prioritise_properties_classifier_cb (GtDBusQueue           *queue,
+                                     GDBusMethodInvocation *invocation,
+                                     gint                  *out_priority,
+                                     gpointer               user_data)
+{
+  if (g_str_equal (g_dbus_method_invocation_get_interface_name (invocation),
+                   "org.freedesktop.DBus.Properties"))
+    *out_priority = G_PRIORITY_HIGH;
+
+  return g_strdup ("all");
+}
+
+static void
+bus_set_up_prioritised (BusFixture    *fixture,
+                        gconstpointer  test_data)
+{
+  bus_set_up_full (fixture, prioritise_properties_classifier_cb);
+}
+
 static void
 bus_tear_down (BusFixture    *fixture,
                gconstpointer  test_data)
@@ -221,20 +258,16 @@ series_server_cb (GtDBusQueue *queue,
   g_autoptr(GDBusMethodInvocation) invocation1 = NULL;
   g_autoptr(GDBusMethodInvocation) invocation2 = NULL;
   g_autofree gchar *object_path = NULL;
-  g_autofree gchar *reply1 = NULL;
 
-  /* Handle the GetObjectPath() call. */
-  guint object_id;
+  /* Handle the GetObjectPath() call, using the generated helpers. */
+  guint32 object_id;
   invocation1 =
-      gt_dbus_queue_assert_pop_message (queue,
-                                        "/com/example/Test",
-                                        "com.example.Test.Manager",
-                                        "GetObjectPath", "(u)", &object_id);
+      gt_mock_manager_assert_pop_get_object_path (queue, "/com/example/Test",
+                                                  &object_id);
   g_assert_cmpint (object_id, ==, fixture->valid_id);
 
   object_path = g_strdup_printf ("/com/example/Test/Object%u", object_id);
-  reply1 = g_strdup_printf ("(@o '%s',)", object_path);
-  g_dbus_method_invocation_return_value (invocation1, g_variant_new_parsed (reply1));
+  gt_mock_manager_return_get_object_path (invocation1, object_path);
 
   /* Handle the Properties.GetAll() call and return some arbitrary values for
    * the given object. */
@@ -254,6 +287,1242 @@ series_server_cb (GtDBusQueue *queue,
   g_dbus_method_invocation_return_value (invocation2, g_variant_new_parsed (reply2));
 }
 
+/* Handler for GetObjectPath() calls which replies slowly for object ID 1, and
+ * immediately for all other object IDs. This is run in the server thread. */
+static void
+concurrent_get_object_path_cb (GtDBusQueue           *queue,
+                               GDBusMethodInvocation *invocation,
+                               gpointer               user_data)
+{
+  guint object_id;
+  g_autofree gchar *object_path = NULL;
+
+  g_variant_get (g_dbus_method_invocation_get_parameters (invocation), "(u)", &object_id);
+  object_path = g_strdup_printf ("/com/example/Test/Object%u", object_id);
+
+  if (object_id == 1)
+    gt_dbus_queue_return_value_delayed (queue, invocation,
+                                        g_variant_new ("(o)", object_path),
+                                        500);
+  else
+    g_dbus_method_invocation_return_value (invocation,
+                                           g_variant_new ("(o)", object_path));
+}
+
+/* Test that a handler registered with gt_dbus_queue_add_handler() can have
+ * several method calls in flight at once, and reply to them out of order. */
+static void
+test_dbus_queue_handler_concurrent (BusFixture    *fixture,
+                                    gconstpointer  test_data)
+{
+  GDBusConnection *client_connection = gt_dbus_queue_get_client_connection (fixture->queue);
+  g_autoptr(GAsyncResult) slow_result = NULL;
+  g_autoptr(GAsyncResult) fast_result = NULL;
+  g_autoptr(GVariant) reply = NULL;
+  g_autoptr(GError) local_error = NULL;
+  const gchar *object_path;
+  guint handler_id;
+
+  handler_id = gt_dbus_queue_add_handler (fixture->queue,
+                                          "/com/example/Test",
+                                          "com.example.Test.Manager",
+                                          "GetObjectPath",
+                                          concurrent_get_object_path_cb,
+                                          NULL, NULL);
+
+  g_dbus_connection_call (client_connection,
+                          "com.example.Test",
+                          "/com/example/Test",
+                          "com.example.Test.Manager",
+                          "GetObjectPath",
+                          g_variant_new ("(u)", 1),
+                          G_VARIANT_TYPE ("(o)"),
+                          G_DBUS_CALL_FLAGS_NONE,
+                          -1,  /* timeout (ms) */
+                          NULL,  /* cancellable */
+                          async_result_cb,
+                          &slow_result);
+  g_dbus_connection_call (client_connection,
+                          "com.example.Test",
+                          "/com/example/Test",
+                          "com.example.Test.Manager",
+                          "GetObjectPath",
+                          g_variant_new ("(u)", 2),
+                          G_VARIANT_TYPE ("(o)"),
+                          G_DBUS_CALL_FLAGS_NONE,
+                          -1,  /* timeout (ms) */
+                          NULL,  /* cancellable */
+                          async_result_cb,
+                          &fast_result);
+
+  /* The fast call should complete while the slow one is still pending. */
+  while (fast_result == NULL)
+    g_main_context_iteration (NULL, TRUE);
+  g_assert_null (slow_result);
+
+  reply = g_dbus_connection_call_finish (client_connection, fast_result, &local_error);
+  g_assert_no_error (local_error);
+  g_variant_get (reply, "(&o)", &object_path);
+  g_assert_cmpstr (object_path, ==, "/com/example/Test/Object2");
+  g_clear_pointer (&reply, g_variant_unref);
+
+  while (slow_result == NULL)
+    g_main_context_iteration (NULL, TRUE);
+
+  reply = g_dbus_connection_call_finish (client_connection, slow_result, &local_error);
+  g_assert_no_error (local_error);
+  g_variant_get (reply, "(&o)", &object_path);
+  g_assert_cmpstr (object_path, ==, "/com/example/Test/Object1");
+
+  gt_dbus_queue_remove_handler (fixture->queue, handler_id);
+}
+
+/* Handler for GetObjectPath() calls which replies after a delay of as many
+ * seconds as the object ID. This is run in the server thread. */
+static void
+delayed_get_object_path_cb (GtDBusQueue           *queue,
+                            GDBusMethodInvocation *invocation,
+                            gpointer               user_data)
+{
+  guint object_id;
+  g_autofree gchar *object_path = NULL;
+
+  g_variant_get (g_dbus_method_invocation_get_parameters (invocation), "(u)", &object_id);
+  object_path = g_strdup_printf ("/com/example/Test/Object%u", object_id);
+
+  gt_dbus_queue_return_value_delayed (queue, invocation,
+                                      g_variant_new ("(o)", object_path),
+                                      object_id * 1000);
+}
+
+/* Test that delayed replies respect a #GtVirtualClock installed on the server
+ * context, so that long delays are not waited for in real time, but replies
+ * are still sent in the order of their delays. */
+static void
+test_dbus_queue_virtual_clock (BusFixture    *fixture,
+                               gconstpointer  test_data)
+{
+  GDBusConnection *client_connection = gt_dbus_queue_get_client_connection (fixture->queue);
+  g_autoptr(GtVirtualClock) vclock = NULL;
+  g_autoptr(GAsyncResult) slow_result = NULL;
+  g_autoptr(GAsyncResult) fast_result = NULL;
+  g_autoptr(GVariant) reply = NULL;
+  g_autoptr(GError) local_error = NULL;
+  const gchar *object_path;
+  guint handler_id;
+  gint64 start_time;
+
+  vclock = gt_virtual_clock_new (gt_dbus_queue_get_server_context (fixture->queue));
+  handler_id = gt_dbus_queue_add_handler (fixture->queue,
+                                          "/com/example/Test",
+                                          "com.example.Test.Manager",
+                                          "GetObjectPath",
+                                          delayed_get_object_path_cb,
+                                          NULL, NULL);
+
+  start_time = g_get_monotonic_time ();
+
+  g_dbus_connection_call (client_connection,
+                          "com.example.Test",
+                          "/com/example/Test",
+                          "com.example.Test.Manager",
+                          "GetObjectPath",
+                          g_variant_new ("(u)", 120),
+                          G_VARIANT_TYPE ("(o)"),
+                          G_DBUS_CALL_FLAGS_NONE,
+                          G_MAXINT,  /* timeout (ms) */
+                          NULL,  /* cancellable */
+                          async_result_cb,
+                          &slow_result);
+  g_dbus_connection_call (client_connection,
+                          "com.example.Test",
+                          "/com/example/Test",
+                          "com.example.Test.Manager",
+                          "GetObjectPath",
+                          g_variant_new ("(u)", 60),
+                          G_VARIANT_TYPE ("(o)"),
+                          G_DBUS_CALL_FLAGS_NONE,
+                          G_MAXINT,  /* timeout (ms) */
+                          NULL,  /* cancellable */
+                          async_result_cb,
+                          &fast_result);
+
+  while (fast_result == NULL)
+    g_main_context_iteration (NULL, TRUE);
+
+  reply = g_dbus_connection_call_finish (client_connection, fast_result, &local_error);
+  g_assert_no_error (local_error);
+  g_variant_get (reply, "(&o)", &object_path);
+  g_assert_cmpstr (object_path, ==, "/com/example/Test/Object60");
+  g_clear_pointer (&reply, g_variant_unref);
+
+  while (slow_result == NULL)
+    g_main_context_iteration (NULL, TRUE);
+
+  reply = g_dbus_connection_call_finish (client_connection, slow_result, &local_error);
+  g_assert_no_error (local_error);
+  g_variant_get (reply, "(&o)", &object_path);
+  g_assert_cmpstr (object_path, ==, "/com/example/Test/Object120");
+
+  /* Two minutes of virtual time should have passed in much less real time. */
+  g_assert_cmpint (gt_virtual_clock_get_offset (vclock), >=, 110 * G_USEC_PER_SEC);
+  g_assert_cmpint (g_get_monotonic_time () - start_time, <, 30 * G_USEC_PER_SEC);
+
+  gt_dbus_queue_remove_handler (fixture->queue, handler_id);
+}
+
+/* Test that gt_dbus_queue_pop_message_async() returns matching messages, and
+ * can be cancelled. */
+static void
+test_dbus_queue_pop_async (BusFixture    *fixture,
+                           gconstpointer  test_data)
+{
+  GDBusConnection *client_connection = gt_dbus_queue_get_client_connection (fixture->queue);
+  g_autoptr(GCancellable) cancellable = NULL;
+  g_autoptr(GAsyncResult) cancelled_pop_result = NULL;
+  g_autoptr(GAsyncResult) pop_result = NULL;
+  g_autoptr(GAsyncResult) call_result = NULL;
+  g_autoptr(GDBusMethodInvocation) invocation = NULL;
+  g_autoptr(GVariant) reply = NULL;
+  g_autoptr(GError) local_error = NULL;
+
+  /* Start and then cancel a pop. */
+  cancellable = g_cancellable_new ();
+  gt_dbus_queue_pop_message_async (fixture->queue, NULL, NULL, "NonexistentMethod",
+                                   cancellable, async_result_cb,
+                                   &cancelled_pop_result);
+  g_cancellable_cancel (cancellable);
+
+  while (cancelled_pop_result == NULL)
+    g_main_context_iteration (NULL, TRUE);
+
+  invocation = gt_dbus_queue_pop_message_finish (fixture->queue,
+                                                 cancelled_pop_result,
+                                                 &local_error);
+  g_assert_error (local_error, G_IO_ERROR, G_IO_ERROR_CANCELLED);
+  g_assert_null (invocation);
+  g_clear_error (&local_error);
+
+  /* Now pop a message which is received after the pop is started. */
+  gt_dbus_queue_pop_message_async (fixture->queue,
+                                   "/com/example/Test",
+                                   "com.example.Test.Manager",
+                                   "GetObjectPath",
+                                   NULL, async_result_cb, &pop_result);
+
+  g_dbus_connection_call (client_connection,
+                          "com.example.Test",
+                          "/com/example/Test",
+                          "com.example.Test.Manager",
+                          "GetObjectPath",
+                          g_variant_new ("(u)", fixture->valid_id),
+                          G_VARIANT_TYPE ("(o)"),
+                          G_DBUS_CALL_FLAGS_NONE,
+                          -1,  /* timeout (ms) */
+                          NULL,  /* cancellable */
+                          async_result_cb,
+                          &call_result);
+
+  while (pop_result == NULL)
+    g_main_context_iteration (NULL, TRUE);
+
+  invocation = gt_dbus_queue_pop_message_finish (fixture->queue, pop_result,
+                                                 &local_error);
+  g_assert_no_error (local_error);
+  g_assert_true (gt_dbus_queue_match_client_message (fixture->queue, invocation,
+                                                     "/com/example/Test",
+                                                     "com.example.Test.Manager",
+                                                     "GetObjectPath",
+                                                     "(@u 123,)"));
+  g_dbus_method_invocation_return_value (invocation,
+                                         g_variant_new ("(o)", "/com/example/Test/Object123"));
+
+  while (call_result == NULL)
+    g_main_context_iteration (NULL, TRUE);
+
+  reply = g_dbus_connection_call_finish (client_connection, call_result, &local_error);
+  g_assert_no_error (local_error);
+  g_assert_nonnull (reply);
+
+  /* The message should not have been queued. */
+  gt_dbus_queue_assert_no_messages (fixture->queue);
+}
+
+/* Test that the helpers generated by gt-dbus-codegen pop and unpack matching
+ * method calls, and return non-matching ones without unpacking them. */
+static void
+test_dbus_queue_generated_pop (BusFixture    *fixture,
+                               gconstpointer  test_data)
+{
+  GDBusConnection *client_connection = gt_dbus_queue_get_client_connection (fixture->queue);
+  gsize i;
+
+  for (i = 0; i < 2; i++)
+    {
+      g_autoptr(GAsyncResult) call_result = NULL;
+      g_autoptr(GDBusMethodInvocation) invocation = NULL;
+      g_autoptr(GVariant) reply = NULL;
+      g_autoptr(GError) local_error = NULL;
+      guint32 object_id = 0;
+      const gchar *object_path;
+
+      g_dbus_connection_call (client_connection,
+                              "com.example.Test",
+                              "/com/example/Test",
+                              "com.example.Test.Manager",
+                              "GetObjectPath",
+                              g_variant_new ("(u)", fixture->valid_id),
+                              G_VARIANT_TYPE ("(o)"),
+                              G_DBUS_CALL_FLAGS_NONE,
+                              -1,  /* timeout (ms) */
+                              NULL,  /* cancellable */
+                              async_result_cb,
+                              &call_result);
+
+      if (i == 0)
+        {
+          /* The first call is expected on a different object, so it is popped
+           * but not unpacked. */
+          g_assert_false (gt_mock_manager_pop_get_object_path (fixture->queue,
+                                                               "/com/example/Test/Other",
+                                                               &invocation,
+                                                               &object_id));
+          g_assert_nonnull (invocation);
+          g_assert_cmpuint (object_id, ==, 0);
+        }
+      else
+        {
+          /* The second is expected on any object, so it is unpacked. */
+          g_assert_true (gt_mock_manager_pop_get_object_path (fixture->queue,
+                                                              NULL,
+                                                              &invocation,
+                                                              &object_id));
+          g_assert_nonnull (invocation);
+          g_assert_cmpuint (object_id, ==, fixture->valid_id);
+        }
+
+      gt_mock_manager_return_get_object_path (invocation,
+                                              "/com/example/Test/Object123");
+
+      while (call_result == NULL)
+        g_main_context_iteration (NULL, TRUE);
+
+      reply = g_dbus_connection_call_finish (client_connection, call_result, &local_error);
+      g_assert_no_error (local_error);
+      g_variant_get (reply, "(&o)", &object_path);
+      g_assert_cmpstr (object_path, ==, "/com/example/Test/Object123");
+    }
+
+  gt_dbus_queue_assert_no_messages (fixture->queue);
+}
+
+/* Test that gt-dbus-codegen handles methods whose argument names clash once
+ * converted to C, including an in and an out argument sharing a name. */
+static void
+test_dbus_queue_generated_clashing_args (BusFixture    *fixture,
+                                         gconstpointer  test_data)
+{
+  GDBusConnection *client_connection = gt_dbus_queue_get_client_connection (fixture->queue);
+  g_autoptr(GAsyncResult) call_result = NULL;
+  g_autoptr(GDBusMethodInvocation) invocation = NULL;
+  g_autoptr(GVariant) reply = NULL;
+  g_autoptr(GError) local_error = NULL;
+  g_autofree gchar *value = NULL;
+  guint32 foo = 0, foo_ = 0;
+  gboolean invocation1 = FALSE, invocation2 = TRUE;
+  const gchar *reply_value;
+
+  g_dbus_connection_call (client_connection,
+                          "com.example.Test",
+                          "/com/example/Test",
+                          "com.example.Test.Manager",
+                          "Echo",
+                          g_variant_new ("(suubb)", "hello", 1, 2, TRUE, FALSE),
+                          G_VARIANT_TYPE ("(s)"),
+                          G_DBUS_CALL_FLAGS_NONE,
+                          -1,  /* timeout (ms) */
+                          NULL,  /* cancellable */
+                          async_result_cb,
+                          &call_result);
+
+  invocation =
+      gt_mock_manager_assert_pop_echo (fixture->queue, "/com/example/Test",
+                                       &value, &foo, &foo_,
+                                       &invocation1, &invocation2);
+  g_assert_cmpstr (value, ==, "hello");
+  g_assert_cmpuint (foo, ==, 1);
+  g_assert_cmpuint (foo_, ==, 2);
+  g_assert_true (invocation1);
+  g_assert_false (invocation2);
+
+  gt_mock_manager_return_echo (invocation, value);
+
+  while (call_result == NULL)
+    g_main_context_iteration (NULL, TRUE);
+
+  reply = g_dbus_connection_call_finish (client_connection, call_result, &local_error);
+  g_assert_no_error (local_error);
+  g_variant_get (reply, "(&s)", &reply_value);
+  g_assert_cmpstr (reply_value, ==, "hello");
+
+  gt_dbus_queue_assert_no_messages (fixture->queue);
+}
+
+/* A minimal implementation of com.example.Test.Manager, like one generated by
+ * gdbus-codegen. It counts the method calls it handles. */
+#define GT_TYPE_TEST_MANAGER_SKELETON gt_test_manager_skeleton_get_type ()
+G_DECLARE_FINAL_TYPE (GtTestManagerSkeleton, gt_test_manager_skeleton, GT,
+                      TEST_MANAGER_SKELETON, GDBusInterfaceSkeleton)
+
+struct _GtTestManagerSkeleton
+{
+  GDBusInterfaceSkeleton parent;
+
+  gint n_method_calls;  /* (atomic) */
+};
+
+G_DEFINE_TYPE (GtTestManagerSkeleton, gt_test_manager_skeleton,
+               G_TYPE_DBUS_INTERFACE_SKELETON)
+
+/* This is run in the server thread. */
+static void
+gt_test_manager_skeleton_method_call (GDBusConnection       *connection,
+                                      const gchar           *sender,
+                                      const gchar           *object_path,
+                                      const gchar           *interface_name,
+                                      const gchar           *method_name,
+                                      GVariant              *parameters,
+                                      GDBusMethodInvocation *invocation,
+                                      gpointer               user_data)
+{
+  GtTestManagerSkeleton *self = GT_TEST_MANAGER_SKELETON (user_data);
+
+  g_atomic_int_inc (&self->n_method_calls);
+
+  if (g_str_equal (method_name, "Ping"))
+    gt_mock_manager_return_ping (invocation);
+  else if (g_str_equal (method_name, "GetObjectPath"))
+    gt_mock_manager_return_get_object_path (invocation,
+                                            "/com/example/Test/Skeleton");
+  else
+    g_assert_not_reached ();
+}
+
+static const GDBusInterfaceVTable gt_test_manager_skeleton_vtable =
+{
+  .method_call = gt_test_manager_skeleton_method_call,
+  .get_property = NULL,
+  .set_property = NULL,
+};
+
+static GDBusInterfaceInfo *
+gt_test_manager_skeleton_get_info (GDBusInterfaceSkeleton *skeleton)
+{
+  return (GDBusInterfaceInfo *) &gt_mock_manager_interface_info;
+}
+
+static GDBusInterfaceVTable *
+gt_test_manager_skeleton_get_vtable (GDBusInterfaceSkeleton *skeleton)
+{
+  return (GDBusInterfaceVTable *) &gt_test_manager_skeleton_vtable;
+}
+
+static GVariant *
+gt_test_manager_skeleton_get_properties (GDBusInterfaceSkeleton *skeleton)
+{
+  return g_variant_new_array (G_VARIANT_TYPE ("{sv}"), NULL, 0);
+}
+
+static void
+gt_test_manager_skeleton_flush (GDBusInterfaceSkeleton *skeleton)
+{
+  /* No properties, so nothing to do. */
+}
+
+static void
+gt_test_manager_skeleton_class_init (GtTestManagerSkeletonClass *klass)
+{
+  GDBusInterfaceSkeletonClass *skeleton_class = (GDBusInterfaceSkeletonClass *) klass;
+
+  skeleton_class->get_info = gt_test_manager_skeleton_get_info;
+  skeleton_class->get_vtable = gt_test_manager_skeleton_get_vtable;
+  skeleton_class->get_properties = gt_test_manager_skeleton_get_properties;
+  skeleton_class->flush = gt_test_manager_skeleton_flush;
+}
+
+static void
+gt_test_manager_skeleton_init (GtTestManagerSkeleton *self)
+{
+  /* Nothing to do here. */
+}
+
+/* Test that gt_dbus_queue_export_skeleton() routes method calls to the queue
+ * only if they’re in its routing table, and to the skeleton otherwise. */
+static void
+test_dbus_queue_skeleton (BusFixture    *fixture,
+                          gconstpointer  test_data)
+{
+  GDBusConnection *client_connection = gt_dbus_queue_get_client_connection (fixture->queue);
+  g_autoptr(GtTestManagerSkeleton) skeleton = NULL;
+  const gchar *queued_methods[] = { "GetObjectPath", NULL };
+  g_autoptr(GAsyncResult) call_result = NULL;
+  g_autoptr(GDBusMethodInvocation) invocation = NULL;
+  g_autoptr(GVariant) reply = NULL;
+  g_autoptr(GError) local_error = NULL;
+  guint32 object_id = 0;
+  const gchar *object_path;
+  guint id;
+
+  skeleton = g_object_new (GT_TYPE_TEST_MANAGER_SKELETON, NULL);
+  id = gt_dbus_queue_export_skeleton (fixture->queue,
+                                      "/com/example/Test/Skeleton",
+                                      G_DBUS_INTERFACE_SKELETON (skeleton),
+                                      queued_methods,
+                                      &local_error);
+  g_assert_no_error (local_error);
+  g_assert_cmpuint (id, !=, 0);
+
+  /* Ping() isn’t in the routing table, so is handled by the skeleton in the
+   * server thread, without being queued. */
+  reply = g_dbus_connection_call_sync (client_connection,
+                                       "com.example.Test",
+                                       "/com/example/Test/Skeleton",
+                                       "com.example.Test.Manager",
+                                       "Ping",
+                                       NULL,
+                                       G_VARIANT_TYPE_UNIT,
+                                       G_DBUS_CALL_FLAGS_NONE,
+                                       -1,  /* timeout (ms) */
+                                       NULL,  /* cancellable */
+                                       &local_error);
+  g_assert_no_error (local_error);
+  g_assert_nonnull (reply);
+  g_assert_cmpint (g_atomic_int_get (&skeleton->n_method_calls), ==, 1);
+  gt_dbus_queue_assert_no_messages (fixture->queue);
+  g_clear_pointer (&reply, g_variant_unref);
+
+  /* GetObjectPath() is in the routing table, so is queued. */
+  g_dbus_connection_call (client_connection,
+                          "com.example.Test",
+                          "/com/example/Test/Skeleton",
+                          "com.example.Test.Manager",
+                          "GetObjectPath",
+                          g_variant_new ("(u)", fixture->valid_id),
+                          G_VARIANT_TYPE ("(o)"),
+                          G_DBUS_CALL_FLAGS_NONE,
+                          -1,  /* timeout (ms) */
+                          NULL,  /* cancellable */
+                          async_result_cb,
+                          &call_result);
+
+  invocation =
+      gt_mock_manager_assert_pop_get_object_path (fixture->queue,
+                                                  "/com/example/Test/Skeleton",
+                                                  &object_id);
+  g_assert_cmpuint (object_id, ==, fixture->valid_id);
+  gt_mock_manager_return_get_object_path (invocation,
+                                          "/com/example/Test/Object123");
+
+  while (call_result == NULL)
+    g_main_context_iteration (NULL, TRUE);
+
+  reply = g_dbus_connection_call_finish (client_connection, call_result, &local_error);
+  g_assert_no_error (local_error);
+  g_variant_get (reply, "(&o)", &object_path);
+  g_assert_cmpstr (object_path, ==, "/com/example/Test/Object123");
+  g_assert_cmpint (g_atomic_int_get (&skeleton->n_method_calls), ==, 1);
+
+  gt_dbus_queue_unexport_object (fixture->queue, id);
+}
+
+/* Call GetObjectPath() on the mock service synchronously, returning the reply
+ * or error. */
+static GVariant *
+call_get_object_path (BusFixture  *fixture,
+                      guint        object_id,
+                      GError     **error)
+{
+  return g_dbus_connection_call_sync (gt_dbus_queue_get_client_connection (fixture->queue),
+                                      "com.example.Test",
+                                      "/com/example/Test",
+                                      "com.example.Test.Manager",
+                                      "GetObjectPath",
+                                      g_variant_new ("(u)", object_id),
+                                      G_VARIANT_TYPE ("(o)"),
+                                      G_DBUS_CALL_FLAGS_NONE,
+                                      -1,  /* timeout (ms) */
+                                      NULL,  /* cancellable */
+                                      error);
+}
+
+/* Call GetObjectPath() on the mock service asynchronously, iterating the
+ * thread-default main context until it returns, so that a real service
+ * running in this thread can handle the call if it’s forwarded to it. */
+static GVariant *
+call_get_object_path_iterate (BusFixture  *fixture,
+                              guint        object_id,
+                              GError     **error)
+{
+  GDBusConnection *client_connection = gt_dbus_queue_get_client_connection (fixture->queue);
+  g_autoptr(GAsyncResult) result = NULL;
+
+  g_dbus_connection_call (client_connection,
+                          "com.example.Test",
+                          "/com/example/Test",
+                          "com.example.Test.Manager",
+                          "GetObjectPath",
+                          g_variant_new ("(u)", object_id),
+                          G_VARIANT_TYPE ("(o)"),
+                          G_DBUS_CALL_FLAGS_NONE,
+                          -1,  /* timeout (ms) */
+                          NULL,  /* cancellable */
+                          async_result_cb,
+                          &result);
+
+  while (result == NULL)
+    g_main_context_iteration (NULL, TRUE);
+
+  return g_dbus_connection_call_finish (client_connection, result, error);
+}
+
+/* A real implementation of com.example.Test.Manager, for learning replies
+ * from. Object ID 0 doesn’t exist. This is run in the test thread. */
+static void
+real_manager_method_call (GDBusConnection       *connection,
+                          const gchar           *sender,
+                          const gchar           *object_path,
+                          const gchar           *interface_name,
+                          const gchar           *method_name,
+                          GVariant              *parameters,
+                          GDBusMethodInvocation *invocation,
+                          gpointer               user_data)
+{
+  guint *n_calls = user_data;
+  guint object_id;
+  g_autofree gchar *reply_path = NULL;
+
+  (*n_calls)++;
+
+  g_assert_cmpstr (method_name, ==, "GetObjectPath");
+  g_variant_get (parameters, "(u)", &object_id);
+
+  if (object_id == 0)
+    {
+      g_dbus_method_invocation_return_dbus_error (invocation,
+                                                  "com.example.Test.Error.NotFound",
+                                                  "No such object");
+      return;
+    }
+
+  reply_path = g_strdup_printf ("/com/example/Test/Object%u", object_id);
+  gt_mock_manager_return_get_object_path (invocation, reply_path);
+}
+
+static const GDBusInterfaceVTable real_manager_vtable =
+{
+  .method_call = real_manager_method_call,
+  .get_property = NULL,
+  .set_property = NULL,
+};
+
+/* Check the replies to GetObjectPath() calls, which are the same whether they
+ * come from the real service or from a reply table. */
+static void
+assert_get_object_path_replies (BusFixture *fixture)
+{
+  const guint object_ids[] = { 1, 2, 1, 0 };
+
+  for (gsize i = 0; i < G_N_ELEMENTS (object_ids); i++)
+    {
+      g_autoptr(GVariant) reply = NULL;
+      g_autoptr(GError) local_error = NULL;
+      g_autofree gchar *expected_path = NULL;
+      const gchar *object_path;
+
+      reply = call_get_object_path_iterate (fixture, object_ids[i], &local_error);
+
+      if (object_ids[i] == 0)
+        {
+          g_autofree gchar *remote_error = NULL;
+
+          g_assert_null (reply);
+          g_assert_true (g_dbus_error_is_remote_error (local_error));
+          remote_error = g_dbus_error_get_remote_error (local_error);
+          g_assert_cmpstr (remote_error, ==, "com.example.Test.Error.NotFound");
+          continue;
+        }
+
+      g_assert_no_error (local_error);
+      expected_path = g_strdup_printf ("/com/example/Test/Object%u", object_ids[i]);
+      g_variant_get (reply, "(&o)", &object_path);
+      g_assert_cmpstr (object_path, ==, expected_path);
+    }
+}
+
+/* Test that replies can be learnt from a real service in learn mode, saved
+ * to a reply table, and then replayed from it without the real service. */
+static void
+test_dbus_queue_learn (BusFixture    *fixture,
+                       gconstpointer  test_data)
+{
+  g_autoptr(GDBusConnection) real_connection = NULL;
+  g_autofree gchar *table_path = NULL;
+  g_autoptr(GError) local_error = NULL;
+  g_autoptr(GAsyncResult) call_result = NULL;
+  g_autoptr(GDBusMethodInvocation) invocation = NULL;
+  g_autoptr(GVariant) reply = NULL;
+  guint32 object_id;
+  guint n_real_calls = 0;
+  guint registration_id;
+  int fd;
+
+  /* Start a real service on the test bus. */
+  real_connection =
+      g_dbus_connection_new_for_address_sync (g_getenv ("DBUS_SESSION_BUS_ADDRESS"),
+                                              G_DBUS_CONNECTION_FLAGS_AUTHENTICATION_CLIENT |
+                                              G_DBUS_CONNECTION_FLAGS_MESSAGE_BUS_CONNECTION,
+                                              NULL, NULL, &local_error);
+  g_assert_no_error (local_error);
+
+  registration_id =
+      g_dbus_connection_register_object (real_connection,
+                                         "/com/example/Test",
+                                         (GDBusInterfaceInfo *) &gt_mock_manager_interface_info,
+                                         &real_manager_vtable,
+                                         &n_real_calls,
+                                         NULL,
+                                         &local_error);
+  g_assert_no_error (local_error);
+
+  /* Learn its replies. The repeated call is recorded once. */
+  gt_dbus_queue_set_learn_target (fixture->queue,
+                                  g_dbus_connection_get_unique_name (real_connection));
+  assert_get_object_path_replies (fixture);
+
+  g_assert_cmpuint (n_real_calls, ==, 4);
+  g_assert_cmpuint (gt_dbus_queue_get_n_learnt_replies (fixture->queue), ==, 3);
+  gt_dbus_queue_assert_no_messages (fixture->queue);
+
+  fd = g_file_open_tmp ("dbus-queue-XXXXXX.replies", &table_path, &local_error);
+  g_assert_no_error (local_error);
+  g_close (fd, NULL);
+
+  gt_dbus_queue_save_reply_table (fixture->queue, table_path, &local_error);
+  g_assert_no_error (local_error);
+
+  /* Stop the real service. */
+  gt_dbus_queue_set_learn_target (fixture->queue, NULL);
+  g_dbus_connection_unregister_object (real_connection, registration_id);
+  g_dbus_connection_close_sync (real_connection, NULL, &local_error);
+  g_assert_no_error (local_error);
+
+  /* Replay the replies from the reply table. */
+  gt_dbus_queue_load_reply_table (fixture->queue, table_path, &local_error);
+  g_assert_no_error (local_error);
+
+  assert_get_object_path_replies (fixture);
+
+  g_assert_cmpuint (n_real_calls, ==, 4);
+  gt_dbus_queue_assert_no_messages (fixture->queue);
+
+  /* Calls which aren’t in the table are queued as normal. */
+  g_dbus_connection_call (gt_dbus_queue_get_client_connection (fixture->queue),
+                          "com.example.Test",
+                          "/com/example/Test",
+                          "com.example.Test.Manager",
+                          "GetObjectPath",
+                          g_variant_new ("(u)", 3),
+                          G_VARIANT_TYPE ("(o)"),
+                          G_DBUS_CALL_FLAGS_NONE,
+                          -1,  /* timeout (ms) */
+                          NULL,  /* cancellable */
+                          async_result_cb,
+                          &call_result);
+
+  invocation = gt_mock_manager_assert_pop_get_object_path (fixture->queue,
+                                                           "/com/example/Test",
+                                                           &object_id);
+  g_assert_cmpuint (object_id, ==, 3);
+  gt_mock_manager_return_get_object_path (invocation, "/com/example/Test/Object3");
+
+  while (call_result == NULL)
+    g_main_context_iteration (NULL, TRUE);
+
+  reply = g_dbus_connection_call_finish (gt_dbus_queue_get_client_connection (fixture->queue),
+                                         call_result, &local_error);
+  g_assert_no_error (local_error);
+
+  /* Invalid reply tables are rejected. */
+  g_file_set_contents (table_path, "not a reply table", -1, &local_error);
+  g_assert_no_error (local_error);
+
+  g_assert_false (gt_dbus_queue_load_reply_table (fixture->queue, table_path,
+                                                  &local_error));
+  g_assert_error (local_error, G_IO_ERROR, G_IO_ERROR_INVALID_DATA);
+  g_clear_error (&local_error);
+
+  gt_dbus_queue_load_reply_table (fixture->queue, NULL, &local_error);
+  g_assert_no_error (local_error);
+
+  g_unlink (table_path);
+}
+
+/* Test that a script of expected method calls is replied to in the server
+ * thread, in order, without any messages being queued. */
+static void
+test_dbus_queue_expectations_ordered (BusFixture    *fixture,
+                                      gconstpointer  test_data)
+{
+  g_autoptr(GVariant) reply = NULL;
+  g_autoptr(GError) local_error = NULL;
+  const gchar *object_path;
+
+  gt_dbus_queue_expect_call (fixture->queue,
+                             "/com/example/Test",
+                             "com.example.Test.Manager",
+                             "GetObjectPath",
+                             "(@u 123,)",
+                             "(@o '/com/example/Test/Object123',)");
+  gt_dbus_queue_expect_call_error (fixture->queue,
+                                   "/com/example/Test",
+                                   "com.example.Test.Manager",
+                                   "GetObjectPath",
+                                   NULL,
+                                   "com.example.Test.Error.InvalidId",
+                                   "Invalid ID");
+  g_assert_cmpuint (gt_dbus_queue_get_n_expectations (fixture->queue), ==, 2);
+
+  reply = call_get_object_path (fixture, 123, &local_error);
+  g_assert_no_error (local_error);
+  g_variant_get (reply, "(&o)", &object_path);
+  g_assert_cmpstr (object_path, ==, "/com/example/Test/Object123");
+  g_clear_pointer (&reply, g_variant_unref);
+
+  reply = call_get_object_path (fixture, 5, &local_error);
+  g_assert_true (g_dbus_error_is_remote_error (local_error));
+  g_assert_null (reply);
+  g_clear_error (&local_error);
+
+  gt_dbus_queue_assert_expectations_met (fixture->queue);
+  gt_dbus_queue_assert_no_messages (fixture->queue);
+}
+
+/* Test that unordered expectations can be met in any order, and that a method
+ * call which matches none of them is recorded as a failure. */
+static void
+test_dbus_queue_expectations_unordered (BusFixture    *fixture,
+                                        gconstpointer  test_data)
+{
+  g_autoptr(GVariant) reply = NULL;
+  g_autoptr(GError) local_error = NULL;
+  g_autofree gchar *formatted = NULL;
+
+  gt_dbus_queue_set_expectations_ordered (fixture->queue, FALSE);
+  gt_dbus_queue_expect_call (fixture->queue,
+                             "/com/example/Test",
+                             "com.example.Test.Manager",
+                             "GetObjectPath",
+                             "(@u 1,)",
+                             "(@o '/com/example/Test/Object1',)");
+  gt_dbus_queue_expect_call (fixture->queue,
+                             "/com/example/Test",
+                             "com.example.Test.Manager",
+                             "GetObjectPath",
+                             "(@u 2,)",
+                             "(@o '/com/example/Test/Object2',)");
+
+  reply = call_get_object_path (fixture, 2, &local_error);
+  g_assert_no_error (local_error);
+  g_clear_pointer (&reply, g_variant_unref);
+
+  /* This matches neither expectation. */
+  reply = call_get_object_path (fixture, 3, &local_error);
+  g_assert_error (local_error, G_DBUS_ERROR, G_DBUS_ERROR_FAILED);
+  g_assert_null (reply);
+  g_clear_error (&local_error);
+
+  g_assert_cmpuint (gt_dbus_queue_get_n_expectations (fixture->queue), ==, 1);
+  g_assert_cmpuint (gt_dbus_queue_get_n_expectation_failures (fixture->queue), ==, 1);
+
+  formatted = gt_dbus_queue_format_expectations (fixture->queue);
+  g_assert_nonnull (strstr (formatted, "Unmet expectation"));
+  g_assert_nonnull (strstr (formatted, "Unexpected method call"));
+
+  reply = call_get_object_path (fixture, 1, &local_error);
+  g_assert_no_error (local_error);
+
+  g_assert_cmpuint (gt_dbus_queue_get_n_expectations (fixture->queue), ==, 0);
+  gt_dbus_queue_assert_no_messages (fixture->queue);
+}
+
+/* Start an asynchronous GetObjectPath() call on the manager object, and an
+ * asynchronous Properties.Get() call on object 123, in that order, and wait
+ * until both have been queued. */
+static void
+start_partitioned_calls (BusFixture    *fixture,
+                         GAsyncResult **manager_result_out,
+                         GAsyncResult **object_result_out)
+{
+  GDBusConnection *client_connection = gt_dbus_queue_get_client_connection (fixture->queue);
+  g_autofree gchar *object_path = NULL;
+
+  object_path = g_strdup_printf ("/com/example/Test/Object%u", fixture->valid_id);
+
+  g_dbus_connection_call (client_connection,
+                          "com.example.Test",
+                          "/com/example/Test",
+                          "com.example.Test.Manager",
+                          "GetObjectPath",
+                          g_variant_new ("(u)", fixture->valid_id),
+                          G_VARIANT_TYPE ("(o)"),
+                          G_DBUS_CALL_FLAGS_NONE,
+                          -1,  /* timeout (ms) */
+                          NULL,  /* cancellable */
+                          async_result_cb,
+                          manager_result_out);
+
+  /* Wait for the first call to be queued so the order is deterministic. */
+  while (gt_dbus_queue_get_n_messages (fixture->queue) < 1)
+    g_main_context_iteration (NULL, TRUE);
+
+  g_dbus_connection_call (client_connection,
+                          "com.example.Test",
+                          object_path,
+                          "org.freedesktop.DBus.Properties",
+                          "Get",
+                          g_variant_new ("(ss)", "com.example.Test.Object", "ObjectId"),
+                          G_VARIANT_TYPE ("(v)"),
+                          G_DBUS_CALL_FLAGS_NONE,
+                          -1,  /* timeout (ms) */
+                          NULL,  /* cancellable */
+                          async_result_cb,
+                          object_result_out);
+
+  while (gt_dbus_queue_get_n_messages (fixture->queue) < 2)
+    g_main_context_iteration (NULL, TRUE);
+}
+
+/* Reply to both calls started by start_partitioned_calls(), and wait for the
+ * replies. */
+static void
+finish_partitioned_calls (BusFixture            *fixture,
+                          GDBusMethodInvocation *manager_invocation,
+                          GDBusMethodInvocation *object_invocation,
+                          GAsyncResult         **manager_result,
+                          GAsyncResult         **object_result)
+{
+  GDBusConnection *client_connection = gt_dbus_queue_get_client_connection (fixture->queue);
+  g_autoptr(GVariant) manager_reply = NULL;
+  g_autoptr(GVariant) object_reply = NULL;
+  g_autoptr(GError) local_error = NULL;
+
+  g_dbus_method_invocation_return_value (manager_invocation,
+                                         g_variant_new ("(o)", "/com/example/Test/Object123"));
+  g_dbus_method_invocation_return_value (object_invocation,
+                                         g_variant_new ("(v)", g_variant_new_uint32 (123)));
+
+  while (*manager_result == NULL || *object_result == NULL)
+    g_main_context_iteration (NULL, TRUE);
+
+  manager_reply = g_dbus_connection_call_finish (client_connection, *manager_result, &local_error);
+  g_assert_no_error (local_error);
+  object_reply = g_dbus_connection_call_finish (client_connection, *object_result, &local_error);
+  g_assert_no_error (local_error);
+}
+
+/* Test that messages can be popped from the sub-queue for one object path,
+ * leaving messages for other object paths in the queue. */
+static void
+test_dbus_queue_partitions (BusFixture    *fixture,
+                            gconstpointer  test_data)
+{
+  g_autoptr(GAsyncResult) manager_result = NULL;
+  g_autoptr(GAsyncResult) object_result = NULL;
+  g_autoptr(GDBusMethodInvocation) manager_invocation = NULL;
+  g_autoptr(GDBusMethodInvocation) object_invocation = NULL;
+  g_autofree gchar *object_path = NULL;
+
+  object_path = g_strdup_printf ("/com/example/Test/Object%u", fixture->valid_id);
+
+  start_partitioned_calls (fixture, &manager_result, &object_result);
+
+  g_assert_cmpuint (gt_dbus_queue_get_n_messages_for (fixture->queue, "/com/example/Test"), ==, 1);
+  g_assert_cmpuint (gt_dbus_queue_get_n_messages_for (fixture->queue, object_path), ==, 1);
+  g_assert_cmpuint (gt_dbus_queue_get_n_messages_for (fixture->queue, "/nonexistent"), ==, 0);
+  g_assert_false (gt_dbus_queue_try_pop_message_for (fixture->queue, "/nonexistent", NULL));
+
+  /* Pop the second message first, using its partition. */
+  g_assert_true (gt_dbus_queue_pop_message_for (fixture->queue, object_path,
+                                                &object_invocation));
+  g_assert_cmpstr (g_dbus_method_invocation_get_method_name (object_invocation), ==, "Get");
+  g_assert_cmpuint (gt_dbus_queue_get_n_messages (fixture->queue), ==, 1);
+
+  /* The global view still contains the first message. */
+  g_assert_true (gt_dbus_queue_try_pop_message (fixture->queue, &manager_invocation));
+  g_assert_cmpstr (g_dbus_method_invocation_get_method_name (manager_invocation), ==, "GetObjectPath");
+  g_assert_cmpuint (gt_dbus_queue_get_n_messages_for (fixture->queue, "/com/example/Test"), ==, 0);
+
+  finish_partitioned_calls (fixture, manager_invocation, object_invocation,
+                            &manager_result, &object_result);
+}
+
+/* Test that messages with a higher priority are popped first, regardless of
+ * the order they arrived in. */
+static void
+test_dbus_queue_priorities (BusFixture    *fixture,
+                            gconstpointer  test_data)
+{
+  g_autoptr(GAsyncResult) manager_result = NULL;
+  g_autoptr(GAsyncResult) object_result = NULL;
+  g_autoptr(GDBusMethodInvocation) manager_invocation = NULL;
+  g_autoptr(GDBusMethodInvocation) object_invocation = NULL;
+
+  start_partitioned_calls (fixture, &manager_result, &object_result);
+
+  g_assert_cmpuint (gt_dbus_queue_get_n_messages_for (fixture->queue, "all"), ==, 2);
+
+  g_assert_true (gt_dbus_queue_pop_message (fixture->queue, &object_invocation));
+  g_assert_cmpstr (g_dbus_method_invocation_get_method_name (object_invocation), ==, "Get");
+  g_assert_true (gt_dbus_queue_pop_message_for (fixture->queue, "all", &manager_invocation));
+  g_assert_cmpstr (g_dbus_method_invocation_get_method_name (manager_invocation), ==, "GetObjectPath");
+
+  finish_partitioned_calls (fixture, manager_invocation, object_invocation,
+                            &manager_result, &object_result);
+}
+
+/* Test that the server thread can be pinned to a CPU and have its nice level
+ * changed, and that the CPU each message is received on is recorded. These
+ * operations may not be supported or permitted, in which case they are
+ * skipped. */
+static void
+test_dbus_queue_thread_scheduling (BusFixture    *fixture,
+                                   gconstpointer  test_data)
+{
+  GDBusConnection *client_connection = gt_dbus_queue_get_client_connection (fixture->queue);
+  g_autoptr(GAsyncResult) result = NULL;
+  g_autoptr(GDBusMethodInvocation) invocation = NULL;
+  g_autoptr(GVariant) reply = NULL;
+  g_autoptr(GError) local_error = NULL;
+  gboolean pinned;
+  gint cpu;
+
+  pinned = gt_dbus_queue_set_thread_affinity (fixture->queue,
+                                              GT_DBUS_QUEUE_THREAD_SERVER,
+                                              0, &local_error);
+  if (!pinned)
+    {
+      g_test_message ("Could not pin server thread: %s", local_error->message);
+      g_clear_error (&local_error);
+    }
+
+  /* Increasing the nice level should always be permitted. */
+  if (!gt_dbus_queue_set_thread_nice (fixture->queue,
+                                      GT_DBUS_QUEUE_THREAD_SERVER,
+                                      1, &local_error))
+    {
+      g_assert_error (local_error, G_IO_ERROR, G_IO_ERROR_NOT_SUPPORTED);
+      g_clear_error (&local_error);
+    }
+
+  g_dbus_connection_call (client_connection,
+                          "com.example.Test",
+                          "/com/example/Test",
+                          "com.example.Test.Manager",
+                          "GetObjectPath",
+                          g_variant_new ("(u)", fixture->valid_id),
+                          G_VARIANT_TYPE ("(o)"),
+                          G_DBUS_CALL_FLAGS_NONE,
+                          -1,  /* timeout (ms) */
+                          NULL,  /* cancellable */
+                          async_result_cb,
+                          &result);
+
+  g_assert_true (gt_dbus_queue_pop_message (fixture->queue, &invocation));
+
+  cpu = gt_dbus_queue_get_message_cpu (invocation);
+  g_assert_cmpint (cpu, >=, -1);
+  if (pinned && cpu >= 0)
+    g_assert_cmpint (cpu, ==, 0);
+
+  if (cpu >= 0)
+    {
+      g_autofree gchar *formatted = gt_dbus_queue_format_message (invocation);
+      g_assert_nonnull (strstr (formatted, "Received on CPU"));
+    }
+
+  g_dbus_method_invocation_return_value (invocation,
+                                         g_variant_new ("(o)", "/com/example/Test/Object123"));
+
+  while (result == NULL)
+    g_main_context_iteration (NULL, TRUE);
+
+  reply = g_dbus_connection_call_finish (client_connection, result, &local_error);
+  g_assert_no_error (local_error);
+}
+
+/* Test that the server thread and the caller thread can be measured separately
+ * using performance counters. Counters may not be available, in which case the
+ * test is skipped. */
+static void
+test_dbus_queue_perf_counters (BusFixture    *fixture,
+                               gconstpointer  test_data)
+{
+  GDBusConnection *client_connection = gt_dbus_queue_get_client_connection (fixture->queue);
+  g_autoptr(GtPerfCounters) server_counters = NULL;
+  g_autoptr(GtPerfCounters) caller_counters = NULL;
+  g_autoptr(GAsyncResult) result = NULL;
+  g_autoptr(GDBusMethodInvocation) invocation = NULL;
+  g_autoptr(GVariant) reply = NULL;
+  g_autoptr(GError) local_error = NULL;
+  g_autofree gchar *server_formatted = NULL;
+
+  server_counters = gt_dbus_queue_new_perf_counters (fixture->queue,
+                                                     GT_DBUS_QUEUE_THREAD_SERVER);
+  caller_counters = gt_dbus_queue_new_perf_counters (fixture->queue,
+                                                     GT_DBUS_QUEUE_THREAD_CALLER);
+
+  if (!gt_perf_counters_is_available (server_counters, GT_PERF_COUNTER_TASK_CLOCK) ||
+      !gt_perf_counters_is_available (caller_counters, GT_PERF_COUNTER_TASK_CLOCK))
+    {
+      g_test_skip ("Performance counters are not available");
+      return;
+    }
+
+  gt_perf_counters_start (server_counters);
+  gt_perf_counters_start (caller_counters);
+
+  g_dbus_connection_call (client_connection,
+                          "com.example.Test",
+                          "/com/example/Test",
+                          "com.example.Test.Manager",
+                          "GetObjectPath",
+                          g_variant_new ("(u)", fixture->valid_id),
+                          G_VARIANT_TYPE ("(o)"),
+                          G_DBUS_CALL_FLAGS_NONE,
+                          -1,  /* timeout (ms) */
+                          NULL,  /* cancellable */
+                          async_result_cb,
+                          &result);
+
+  g_assert_true (gt_dbus_queue_pop_message (fixture->queue, &invocation));
+  g_dbus_method_invocation_return_value (invocation,
+                                         g_variant_new ("(o)", "/com/example/Test/Object123"));
+
+  while (result == NULL)
+    g_main_context_iteration (NULL, TRUE);
+
+  reply = g_dbus_connection_call_finish (client_connection, result, &local_error);
+  g_assert_no_error (local_error);
+
+  gt_perf_counters_stop (caller_counters);
+  gt_perf_counters_stop (server_counters);
+
+  /* Both threads must have done some work to receive and reply to the call. */
+  g_assert_cmpuint (gt_perf_counters_get (server_counters, GT_PERF_COUNTER_TASK_CLOCK), >, 0);
+  g_assert_cmpuint (gt_perf_counters_get (caller_counters, GT_PERF_COUNTER_TASK_CLOCK), >, 0);
+
+  server_formatted = gt_perf_counters_format (server_counters);
+  g_test_message ("Server thread: %s", server_formatted);
+}
+
+/* Test that the server and client contexts can be profiled separately, and
+ * that both see dispatches when handling a call. */
+static void
+test_dbus_queue_profiling (BusFixture    *fixture,
+                           gconstpointer  test_data)
+{
+  GDBusConnection *client_connection = gt_dbus_queue_get_client_connection (fixture->queue);
+  GtMainContextProfiler *server_profiler, *client_profiler;
+  g_autoptr(GAsyncResult) result = NULL;
+  g_autoptr(GDBusMethodInvocation) invocation = NULL;
+  g_autoptr(GVariant) reply = NULL;
+  g_autoptr(GError) local_error = NULL;
+  g_autofree gchar *server_formatted = NULL;
+  g_autofree gchar *client_formatted = NULL;
+
+  g_assert_null (gt_dbus_queue_get_server_profiler (fixture->queue));
+  g_assert_null (gt_dbus_queue_get_client_profiler (fixture->queue));
+
+  gt_dbus_queue_set_profiling (fixture->queue, TRUE);
+
+  server_profiler = gt_dbus_queue_get_server_profiler (fixture->queue);
+  client_profiler = gt_dbus_queue_get_client_profiler (fixture->queue);
+  g_assert_nonnull (server_profiler);
+  g_assert_nonnull (client_profiler);
+
+  g_dbus_connection_call (client_connection,
+                          "com.example.Test",
+                          "/com/example/Test",
+                          "com.example.Test.Manager",
+                          "GetObjectPath",
+                          g_variant_new ("(u)", fixture->valid_id),
+                          G_VARIANT_TYPE ("(o)"),
+                          G_DBUS_CALL_FLAGS_NONE,
+                          -1,  /* timeout (ms) */
+                          NULL,  /* cancellable */
+                          async_result_cb,
+                          &result);
+
+  g_assert_true (gt_dbus_queue_pop_message (fixture->queue, &invocation));
+  g_dbus_method_invocation_return_value (invocation,
+                                         g_variant_new ("(o)", "/com/example/Test/Object123"));
+
+  while (result == NULL)
+    g_main_context_iteration (NULL, TRUE);
+
+  reply = g_dbus_connection_call_finish (client_connection, result, &local_error);
+  g_assert_no_error (local_error);
+
+  /* The server context dispatched the method call to the queue, and the client
+   * context dispatched the reply. */
+  g_assert_cmpuint (gt_main_context_profiler_get_n_dispatches (server_profiler), >, 0);
+  g_assert_cmpuint (gt_main_context_profiler_get_n_dispatches (client_profiler), >, 0);
+
+  server_formatted = gt_main_context_profiler_format (server_profiler);
+  client_formatted = gt_main_context_profiler_format (client_profiler);
+  g_test_message ("Server context:\n%s", server_formatted);
+  g_test_message ("Client context:\n%s", client_formatted);
+
+  gt_dbus_queue_set_profiling (fixture->queue, FALSE);
+  g_assert_null (gt_dbus_queue_get_server_profiler (fixture->queue));
+  g_assert_null (gt_dbus_queue_get_client_profiler (fixture->queue));
+}
+
+/* Test that polling an empty queue, as tests commonly do in a loop, doesn’t
+ * allocate. */
+static void
+test_dbus_queue_poll_allocations (BusFixture    *fixture,
+                                  gconstpointer  test_data)
+{
+  g_autoptr(GtAllocTracker) tracker = NULL;
+
+  tracker = gt_alloc_tracker_new (GT_ALLOC_TRACKER_SCOPE_THREAD);
+
+  /* Without the shim, allocations can only be tracked for the whole process,
+   * and the server and GDBus worker threads could be allocating. */
+  if (gt_alloc_tracker_get_backend (tracker) != GT_ALLOC_TRACKER_BACKEND_SHIM)
+    {
+      g_test_skip ("Allocation shim not loaded");
+      return;
+    }
+
+  /* Warm up any lazily initialised state, such as the default main context. */
+  g_assert_false (gt_dbus_queue_try_pop_message (fixture->queue, NULL));
+
+  gt_alloc_tracker_start (tracker);
+
+  for (guint i = 0; i < 100; i++)
+    {
+      g_assert_cmpuint (gt_dbus_queue_get_n_messages (fixture->queue), ==, 0);
+      g_assert_cmpuint (gt_dbus_queue_get_n_messages_for (fixture->queue, "/com/example/Test"), ==, 0);
+      g_assert_false (gt_dbus_queue_try_pop_message (fixture->queue, NULL));
+    }
+
+  gt_alloc_tracker_stop (tracker);
+
+  gt_assert_allocs_at_most (tracker, 0);
+}
+
 int
 main (int   argc,
       char *argv[])
@@ -269,6 +1538,37 @@ main (int   argc,
               bus_set_up, test_dbus_queue_series, bus_tear_down);
   g_test_add ("/dbus-queue/series-sync", BusFixture, GUINT_TO_POINTER (FALSE),
               bus_set_up, test_dbus_queue_series, bus_tear_down);
+  g_test_add ("/dbus-queue/handler-concurrent", BusFixture, NULL,
+              bus_set_up, test_dbus_queue_handler_concurrent, bus_tear_down);
+  g_test_add ("/dbus-queue/virtual-clock", BusFixture, NULL,
+              bus_set_up, test_dbus_queue_virtual_clock, bus_tear_down);
+  g_test_add ("/dbus-queue/pop-async", BusFixture, NULL,
+              bus_set_up, test_dbus_queue_pop_async, bus_tear_down);
+  g_test_add ("/dbus-queue/generated-pop", BusFixture, NULL,
+              bus_set_up, test_dbus_queue_generated_pop, bus_tear_down);
+  g_test_add ("/dbus-queue/generated-clashing-args", BusFixture, NULL,
+              bus_set_up, test_dbus_queue_generated_clashing_args,
+              bus_tear_down);
+  g_test_add ("/dbus-queue/skeleton", BusFixture, NULL,
+              bus_set_up, test_dbus_queue_skeleton, bus_tear_down);
+  g_test_add ("/dbus-queue/learn", BusFixture, NULL,
+              bus_set_up, test_dbus_queue_learn, bus_tear_down);
+  g_test_add ("/dbus-queue/expectations/ordered", BusFixture, NULL,
+              bus_set_up, test_dbus_queue_expectations_ordered, bus_tear_down);
+  g_test_add ("/dbus-queue/expectations/unordered", BusFixture, NULL,
+              bus_set_up, test_dbus_queue_expectations_unordered, bus_tear_down);
+  g_test_add ("/dbus-queue/partitions", BusFixture, NULL,
+              bus_set_up, test_dbus_queue_partitions, bus_tear_down);
+  g_test_add ("/dbus-queue/priorities", BusFixture, NULL,
+              bus_set_up_prioritised, test_dbus_queue_priorities, bus_tear_down);
+  g_test_add ("/dbus-queue/thread-scheduling", BusFixture, NULL,
+              bus_set_up, test_dbus_queue_thread_scheduling, bus_tear_down);
+  g_test_add ("/dbus-queue/perf-counters", BusFixture, NULL,
+              bus_set_up, test_dbus_queue_perf_counters, bus_tear_down);
+  g_test_add ("/dbus-queue/profiling", BusFixture, NULL,
+              bus_set_up, test_dbus_queue_profiling, bus_tear_down);
+  g_test_add ("/dbus-queue/poll-allocations", BusFixture, NULL,
+              bus_set_up, test_dbus_queue_poll_allocations, bus_tear_down);
 
-  return g_test_run ();
+  return gt_test_run_parallel ();
 }
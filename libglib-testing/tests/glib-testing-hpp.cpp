@@ -0,0 +1,208 @@
+/* -*- mode: C++; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ *
+ * Copyright © 2018 Endless Mobile, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#include <gio/gio.h>
+#include <glib.h>
+#include <libglib-testing/glib-testing.hpp>
+#include <locale.h>
+#include <string>
+#include <string_view>
+#include <vector>
+
+
+/* The parameter type strings are built at compile time. */
+static_assert (std::string_view (Gt::detail::tuple_type_string<> ().c_str ()) == "()");
+static_assert (std::string_view (Gt::detail::tuple_type_string<std::string, std::vector<guint32>, bool> ().c_str ()) == "(saub)");
+static_assert (std::string_view (Gt::detail::tuple_type_string<Gt::ObjectPath, std::vector<std::vector<gint64>>> ().c_str ()) == "(oaax)");
+
+/* Test that the RAII wrappers can be created, moved and destroyed. A basic
+ * smoketest. */
+static void
+test_glib_testing_hpp_construction (void)
+{
+  Gt::SignalLogger logger;
+  Gt::DBusQueue queue;
+
+  g_assert_cmpuint (logger.n_emissions (), ==, 0);
+  g_assert_cmpuint (queue.n_messages (), ==, 0);
+
+  Gt::SignalLogger moved_logger = std::move (logger);
+  g_assert_null (logger.get ());
+  g_assert_nonnull (moved_logger.get ());
+  moved_logger.assert_no_emissions ();
+}
+
+/* Test that signal emission parameters are extracted with the types of the
+ * destination variables. */
+static void
+test_glib_testing_hpp_signal_logger (void)
+{
+  Gt::SignalLogger logger;
+  GSimpleAction *action = g_simple_action_new ("action", G_VARIANT_TYPE_INT32);
+  GVariant *parameter = nullptr;
+
+  logger.connect (action, "notify::enabled");
+  logger.connect (action, "activate");
+
+  g_simple_action_set_enabled (action, FALSE);
+  g_simple_action_set_enabled (action, TRUE);
+  g_action_activate (G_ACTION (action), g_variant_new_int32 (5));
+
+  g_assert_cmpuint (logger.n_emissions (), ==, 3);
+  logger.assert_notify_emission_pop (action, "enabled");
+
+  {
+    Gt::SignalLoggerEmission emission = logger.pop_emission ();
+    GParamSpec *pspec = nullptr;
+
+    g_assert_true (emission);
+    g_assert_cmpstr (emission.signal_name (), ==, "notify::enabled");
+    g_assert_cmpuint (emission.n_params (), ==, 1);
+    emission.get_params (pspec);
+    g_assert_cmpstr (g_param_spec_get_name (pspec), ==, "enabled");
+  }
+
+  /* The parameter is borrowed from the emission, so it must be checked before
+   * the emission is freed. */
+  {
+    Gt::SignalLoggerEmission emission = logger.assert_emission_pop (action, "activate");
+    emission.get_params (parameter);
+    g_assert_cmpint (g_variant_get_int32 (parameter), ==, 5);
+  }
+
+  logger.assert_no_emissions ();
+
+  g_object_unref (action);
+}
+
+static const char test_interface_xml[] =
+  "<node>"
+    "<interface name='com.example.Cxx'>"
+      "<method name='Frobnicate'>"
+        "<arg type='s' name='name' direction='in'/>"
+        "<arg type='au' name='ids' direction='in'/>"
+        "<arg type='b' name='found' direction='out'/>"
+        "<arg type='o' name='path' direction='out'/>"
+      "</method>"
+    "</interface>"
+  "</node>";
+
+/* Helper #GAsyncReadyCallback which returns the #GAsyncResult in its @user_data. */
+static void
+async_result_cb (GObject      *obj,
+                 GAsyncResult *result,
+                 gpointer      user_data)
+{
+  GAsyncResult **result_out = static_cast<GAsyncResult **> (user_data);
+
+  g_assert_null (*result_out);
+  *result_out = static_cast<GAsyncResult *> (g_object_ref (result));
+}
+
+/* Test that method call parameters are extracted with the types of the
+ * destination variables, and that replies are built from the types of the
+ * values. */
+static void
+test_glib_testing_hpp_dbus_queue (void)
+{
+  Gt::DBusQueue queue;
+  GError *local_error = nullptr;
+  GDBusNodeInfo *node_info = nullptr;
+  GAsyncResult *result = nullptr;
+  GVariant *reply = nullptr;
+  const guint32 sent_ids[] = { 1, 2, 3 };
+  std::string name;
+  std::vector<guint32> ids;
+  gboolean found = FALSE;
+  const gchar *path = nullptr;
+
+  node_info = g_dbus_node_info_new_for_xml (test_interface_xml, &local_error);
+  g_assert_no_error (local_error);
+
+  queue.connect (&local_error);
+  g_assert_no_error (local_error);
+
+  queue.own_name ("com.example.Test");
+  queue.export_object ("/com/example/Cxx", node_info->interfaces[0], &local_error);
+  g_assert_no_error (local_error);
+
+  g_dbus_connection_call (queue.client_connection (),
+                          "com.example.Test",
+                          "/com/example/Cxx",
+                          "com.example.Cxx",
+                          "Frobnicate",
+                          g_variant_new ("(s@au)", "hello",
+                                         g_variant_new_fixed_array (G_VARIANT_TYPE_UINT32,
+                                                                    sent_ids,
+                                                                    G_N_ELEMENTS (sent_ids),
+                                                                    sizeof (sent_ids[0]))),
+                          G_VARIANT_TYPE ("(bo)"),
+                          G_DBUS_CALL_FLAGS_NONE,
+                          -1,
+                          nullptr,
+                          async_result_cb,
+                          &result);
+
+  {
+    Gt::MethodInvocation invocation =
+        queue.assert_pop_message ("/com/example/Cxx", "com.example.Cxx", "Frobnicate");
+    invocation.get_parameters (name, ids);
+    invocation.return_values (true, Gt::ObjectPath { "/com/example/Cxx/Found" });
+  }
+
+  g_assert_cmpstr (name.c_str (), ==, "hello");
+  g_assert_cmpuint (ids.size (), ==, G_N_ELEMENTS (sent_ids));
+  for (std::size_t i = 0; i < ids.size (); i++)
+    g_assert_cmpuint (ids[i], ==, sent_ids[i]);
+
+  while (result == nullptr)
+    g_main_context_iteration (nullptr, TRUE);
+
+  reply = g_dbus_connection_call_finish (queue.client_connection (), result, &local_error);
+  g_assert_no_error (local_error);
+  g_variant_get (reply, "(b&o)", &found, &path);
+  g_assert_true (found);
+  g_assert_cmpstr (path, ==, "/com/example/Cxx/Found");
+
+  queue.assert_no_messages ();
+
+  g_variant_unref (reply);
+  g_object_unref (result);
+  queue.disconnect (true);
+  g_dbus_node_info_unref (node_info);
+}
+
+int
+main (int   argc,
+      char *argv[])
+{
+  setlocale (LC_ALL, "");
+
+  g_test_init (&argc, &argv, NULL);
+
+  g_test_add_func ("/glib-testing-hpp/construction",
+                   test_glib_testing_hpp_construction);
+  g_test_add_func ("/glib-testing-hpp/signal-logger",
+                   test_glib_testing_hpp_signal_logger);
+  g_test_add_func ("/glib-testing-hpp/dbus-queue",
+                   test_glib_testing_hpp_dbus_queue);
+
+  return g_test_run ();
+}
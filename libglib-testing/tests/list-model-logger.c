@@ -0,0 +1,217 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ *
+ * Copyright © 2018 Endless Mobile, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#include <gio/gio.h>
+#include <glib.h>
+#include <libglib-testing/list-model-logger.h>
+#include <locale.h>
+
+
+/* Create a #GListStore containing @n_items new objects. */
+static GListStore *
+store_new (guint n_items)
+{
+  g_autoptr(GListStore) store = g_list_store_new (G_TYPE_OBJECT);
+
+  for (guint i = 0; i < n_items; i++)
+    {
+      g_autoptr(GObject) item = g_object_new (G_TYPE_OBJECT, NULL);
+      g_list_store_append (store, item);
+    }
+
+  return g_steal_pointer (&store);
+}
+
+/* Iterate the default main context until it has nothing to do, ending the
+ * current batch of emissions. */
+static void
+end_batch (void)
+{
+  while (g_main_context_iteration (NULL, FALSE));
+}
+
+/* Test that creating and destroying a list model logger works. A basic
+ * smoketest. */
+static void
+test_list_model_logger_construction (void)
+{
+  g_autoptr(GListStore) store = store_new (3);
+  g_autoptr(GtListModelLogger) logger = NULL;
+  g_autofree gchar *issues = NULL;
+
+  logger = gt_list_model_logger_new (G_LIST_MODEL (store));
+  g_assert_true (gt_list_model_logger_get_model (logger) == G_LIST_MODEL (store));
+  g_assert_cmpuint (gt_list_model_logger_get_n_emissions (logger), ==, 0);
+  g_assert_cmpuint (gt_list_model_logger_get_n_issues_total (logger), ==, 0);
+
+  issues = gt_list_model_logger_format_issues (logger);
+  g_assert_cmpstr (issues, ==, " • 0 emissions of 0 items, of which 0 changed\n");
+
+  gt_list_model_logger_assert_efficient (logger);
+}
+
+/* Test that minimal emissions are not flagged, and are counted correctly. */
+static void
+test_list_model_logger_efficient (void)
+{
+  g_autoptr(GListStore) store = store_new (5);
+  g_autoptr(GtListModelLogger) logger = NULL;
+  g_autoptr(GObject) item = g_object_new (G_TYPE_OBJECT, NULL);
+
+  logger = gt_list_model_logger_new (G_LIST_MODEL (store));
+
+  g_list_store_insert (store, 2, item);
+  end_batch ();
+  g_list_store_remove (store, 0);
+  end_batch ();
+  g_list_store_remove_all (store);
+  end_batch ();
+
+  g_assert_cmpuint (gt_list_model_logger_get_n_emissions (logger), ==, 3);
+  g_assert_cmpuint (gt_list_model_logger_get_n_items_emitted (logger), ==, 7);
+  g_assert_cmpuint (gt_list_model_logger_get_n_items_minimal (logger), ==, 7);
+  gt_list_model_logger_assert_consistent (logger);
+  gt_list_model_logger_assert_efficient (logger);
+}
+
+/* Test that each kind of wasteful emission is detected. */
+static void
+test_list_model_logger_wasteful (void)
+{
+  g_autoptr(GListStore) store = store_new (5);
+  g_autoptr(GtListModelLogger) logger = NULL;
+  g_autoptr(GObject) new_item = g_object_new (G_TYPE_OBJECT, NULL);
+  gpointer items[5];
+
+  for (guint i = 0; i < G_N_ELEMENTS (items); i++)
+    items[i] = g_list_model_get_item (G_LIST_MODEL (store), i);
+
+  logger = gt_list_model_logger_new (G_LIST_MODEL (store));
+
+  /* No-op emissions. */
+  g_list_model_items_changed (G_LIST_MODEL (store), 1, 0, 0);
+  end_batch ();
+  g_list_store_splice (store, 1, 2, items + 1, 2);
+  end_batch ();
+  g_assert_cmpuint (gt_list_model_logger_get_n_issues (logger, GT_LIST_MODEL_LOGGER_ISSUE_NO_OP), ==, 2);
+
+  /* Replacing three items to change the middle one. */
+  {
+    gpointer replacement[] = { items[1], new_item, items[3] };
+    g_list_store_splice (store, 1, 3, replacement, G_N_ELEMENTS (replacement));
+    end_batch ();
+  }
+  g_assert_cmpuint (gt_list_model_logger_get_n_issues (logger, GT_LIST_MODEL_LOGGER_ISSUE_OVERSIZED), ==, 1);
+
+  /* Resetting the whole model to change one item back. */
+  g_list_store_splice (store, 0, 5, items, G_N_ELEMENTS (items));
+  end_batch ();
+  g_assert_cmpuint (gt_list_model_logger_get_n_issues (logger, GT_LIST_MODEL_LOGGER_ISSUE_RESET), ==, 1);
+
+  /* Appending items one at a time in a single operation. */
+  for (guint i = 0; i < 3; i++)
+    {
+      g_autoptr(GObject) item = g_object_new (G_TYPE_OBJECT, NULL);
+      g_list_store_append (store, item);
+    }
+  end_batch ();
+  g_assert_cmpuint (gt_list_model_logger_get_n_issues (logger, GT_LIST_MODEL_LOGGER_ISSUE_SPLIT_RANGE), ==, 2);
+
+  /* The same, in separate operations, is fine. */
+  for (guint i = 0; i < 3; i++)
+    {
+      g_autoptr(GObject) item = g_object_new (G_TYPE_OBJECT, NULL);
+      g_list_store_append (store, item);
+      end_batch ();
+    }
+  g_assert_cmpuint (gt_list_model_logger_get_n_issues (logger, GT_LIST_MODEL_LOGGER_ISSUE_SPLIT_RANGE), ==, 2);
+
+  gt_list_model_logger_assert_consistent (logger);
+  g_assert_cmpuint (gt_list_model_logger_get_n_issues_total (logger), ==, 6);
+  g_assert_cmpuint (gt_list_model_logger_get_n_items_emitted (logger), ==,
+                    0 + 4 + 6 + 10 + 3 + 3);
+  g_assert_cmpuint (gt_list_model_logger_get_n_items_minimal (logger), ==,
+                    0 + 0 + 2 + 2 + 3 + 3);
+
+  gt_list_model_logger_reset (logger);
+  g_assert_cmpuint (gt_list_model_logger_get_n_issues_total (logger), ==, 0);
+  g_assert_cmpuint (gt_list_model_logger_get_n_items_emitted (logger), ==, 0);
+
+  for (guint i = 0; i < G_N_ELEMENTS (items); i++)
+    g_object_unref (items[i]);
+}
+
+/* Test that emissions which don’t match the change to the model are
+ * detected. */
+static void
+test_list_model_logger_inconsistent (void)
+{
+  g_autoptr(GListStore) store = store_new (3);
+  g_autoptr(GtListModelLogger) logger = NULL;
+
+  logger = gt_list_model_logger_new (G_LIST_MODEL (store));
+
+  /* Wrong number of items. */
+  g_list_model_items_changed (G_LIST_MODEL (store), 0, 0, 1);
+  g_assert_cmpuint (gt_list_model_logger_get_n_issues (logger, GT_LIST_MODEL_LOGGER_ISSUE_INCONSISTENT), ==, 1);
+
+  /* Out of range. */
+  g_list_model_items_changed (G_LIST_MODEL (store), 3, 1, 1);
+  g_assert_cmpuint (gt_list_model_logger_get_n_issues (logger, GT_LIST_MODEL_LOGGER_ISSUE_INCONSISTENT), ==, 2);
+
+  /* Wrong position: swap the first item, but say the last one changed. */
+  {
+    g_autoptr(GObject) item = g_object_new (G_TYPE_OBJECT, NULL);
+    gpointer replacement[] = { item };
+
+    g_signal_handlers_block_matched (store, G_SIGNAL_MATCH_ID,
+                                     g_signal_lookup ("items-changed", G_TYPE_LIST_MODEL),
+                                     0, NULL, NULL, NULL);
+    g_list_store_splice (store, 0, 1, replacement, 1);
+    g_signal_handlers_unblock_matched (store, G_SIGNAL_MATCH_ID,
+                                       g_signal_lookup ("items-changed", G_TYPE_LIST_MODEL),
+                                       0, NULL, NULL, NULL);
+    g_list_model_items_changed (G_LIST_MODEL (store), 2, 1, 1);
+  }
+  g_assert_cmpuint (gt_list_model_logger_get_n_issues (logger, GT_LIST_MODEL_LOGGER_ISSUE_INCONSISTENT), ==, 3);
+
+  /* The shadow copy is resynchronised after each inconsistency, so later
+   * correct emissions aren’t flagged. */
+  g_list_store_remove (store, 1);
+  g_assert_cmpuint (gt_list_model_logger_get_n_issues (logger, GT_LIST_MODEL_LOGGER_ISSUE_INCONSISTENT), ==, 3);
+
+  end_batch ();
+}
+
+int
+main (int   argc,
+      char *argv[])
+{
+  setlocale (LC_ALL, "");
+
+  g_test_init (&argc, &argv, NULL);
+
+  g_test_add_func ("/list-model-logger/construction", test_list_model_logger_construction);
+  g_test_add_func ("/list-model-logger/efficient", test_list_model_logger_efficient);
+  g_test_add_func ("/list-model-logger/wasteful", test_list_model_logger_wasteful);
+  g_test_add_func ("/list-model-logger/inconsistent", test_list_model_logger_inconsistent);
+
+  return g_test_run ();
+}
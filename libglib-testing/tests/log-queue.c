@@ -0,0 +1,218 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ *
+ * Copyright © 2018 Endless Mobile, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#include <glib.h>
+#include <libglib-testing/log-queue.h>
+#include <locale.h>
+#include <stdio.h>
+
+
+/* Test that creating and destroying a log queue works. A basic smoketest. */
+static void
+test_log_queue_construction (void)
+{
+  g_autoptr(GtLogQueue) queue = NULL;
+  queue = gt_log_queue_new ();
+
+  /* Call a method to avoid warnings about unused variables. */
+  g_assert_cmpuint (gt_log_queue_get_n_entries (queue), ==, 0);
+}
+
+/* Test that entries can be popped by domain and level, out of order, and that
+ * entries for other domains and levels are left in order. */
+static void
+test_log_queue_pop_for (void)
+{
+  g_autoptr(GtLogQueue) queue = gt_log_queue_new ();
+  g_autoptr(GtLogQueueEntry) entry = NULL;
+
+  g_log ("test-a", G_LOG_LEVEL_DEBUG, "a debug %u", 1u);
+  g_log ("test-b", G_LOG_LEVEL_MESSAGE, "b message %u", 2u);
+  g_log ("test-a", G_LOG_LEVEL_INFO, "a info %u", 3u);
+  g_log ("test-b", G_LOG_LEVEL_DEBUG, "b debug %u", 4u);
+  g_log (NULL, G_LOG_LEVEL_MESSAGE, "no domain %u", 5u);
+
+  g_assert_cmpuint (gt_log_queue_get_n_entries (queue), ==, 5);
+  g_assert_cmpuint (gt_log_queue_get_n_entries_for (queue, "test-a", G_LOG_LEVEL_MASK), ==, 2);
+  g_assert_cmpuint (gt_log_queue_get_n_entries_for (queue, NULL, G_LOG_LEVEL_DEBUG), ==, 2);
+  g_assert_cmpuint (gt_log_queue_get_n_entries_for (queue, "", G_LOG_LEVEL_MASK), ==, 1);
+
+  gt_log_queue_assert_entry_pop (queue, "test-b", G_LOG_LEVEL_DEBUG, "b debug 4");
+  gt_log_queue_assert_entry_pop (queue, NULL, G_LOG_LEVEL_INFO | G_LOG_LEVEL_MESSAGE, "b message *");
+  gt_log_queue_assert_entry_pop (queue, "", G_LOG_LEVEL_MESSAGE, "no domain 5");
+
+  /* The remaining entries should come out in the order they were logged. */
+  entry = gt_log_queue_pop_entry (queue);
+  g_assert_nonnull (entry);
+  g_assert_cmpstr (gt_log_queue_entry_get_domain (entry), ==, "test-a");
+  g_assert_cmpstr (gt_log_queue_entry_get_message (entry), ==, "a debug 1");
+  g_assert_cmpint (gt_log_queue_entry_get_level (entry), ==, G_LOG_LEVEL_DEBUG);
+  g_assert_true (gt_log_queue_entry_get_thread (entry) == g_thread_self ());
+  g_clear_pointer (&entry, gt_log_queue_entry_free);
+
+  gt_log_queue_assert_entry_pop (queue, "test-a", G_LOG_LEVEL_MASK, "a info 3");
+
+  g_assert_null (gt_log_queue_pop_entry_for (queue, "test-a", G_LOG_LEVEL_MASK));
+  gt_log_queue_assert_no_entries (queue);
+}
+
+/* Test that structured fields are captured. */
+static void
+test_log_queue_fields (void)
+{
+  g_autoptr(GtLogQueue) queue = gt_log_queue_new ();
+  g_autoptr(GtLogQueueEntry) entry = NULL;
+  const guint8 binary[] = { 'a', 'b', 0, 'c' };
+  const GLogField fields[] =
+    {
+      { "GLIB_DOMAIN", "test", -1 },
+      { "MESSAGE", "structured", -1 },
+      { "BINARY", binary, sizeof (binary) },
+    };
+  gssize length;
+
+  g_log_structured ("test", G_LOG_LEVEL_MESSAGE,
+                    "CUSTOM", "value",
+                    "MESSAGE", "hello %d", 5);
+  g_log_structured_array (G_LOG_LEVEL_INFO, fields, G_N_ELEMENTS (fields));
+
+  entry = gt_log_queue_pop_entry (queue);
+  g_assert_nonnull (entry);
+  g_assert_cmpstr (gt_log_queue_entry_get_message (entry), ==, "hello 5");
+  g_assert_cmpstr (gt_log_queue_entry_get_field (entry, "CUSTOM", &length), ==, "value");
+  g_assert_cmpint (length, ==, -1);
+  g_assert_null (gt_log_queue_entry_get_field (entry, "MISSING", NULL));
+  g_clear_pointer (&entry, gt_log_queue_entry_free);
+
+  entry = gt_log_queue_pop_entry (queue);
+  g_assert_nonnull (entry);
+  g_assert_cmpstr (gt_log_queue_entry_get_domain (entry), ==, "test");
+  g_assert_cmpint (gt_log_queue_entry_get_level (entry), ==, G_LOG_LEVEL_INFO);
+  g_assert_cmpmem (gt_log_queue_entry_get_field (entry, "BINARY", &length),
+                   sizeof (binary), binary, sizeof (binary));
+  g_assert_cmpint (length, ==, (gssize) sizeof (binary));
+
+  gt_log_queue_assert_no_entries (queue);
+}
+
+#define N_THREADS 4
+#define N_MESSAGES_PER_THREAD 10000
+
+static gpointer
+log_thread_cb (gpointer user_data)
+{
+  for (guint i = 0; i < N_MESSAGES_PER_THREAD; i++)
+    g_log ("test-threads", G_LOG_LEVEL_DEBUG, "message %u", i);
+
+  return NULL;
+}
+
+static void
+log_from_threads (void)
+{
+  GThread *threads[N_THREADS];
+
+  for (gsize i = 0; i < G_N_ELEMENTS (threads); i++)
+    threads[i] = g_thread_new ("log", log_thread_cb, NULL);
+  for (gsize i = 0; i < G_N_ELEMENTS (threads); i++)
+    g_thread_join (threads[i]);
+}
+
+/* Test that messages logged concurrently from several threads are all
+ * captured, even when there are more of them than fit in the ring buffer. */
+static void
+test_log_queue_threads (void)
+{
+  g_autoptr(GtLogQueue) queue = gt_log_queue_new ();
+  guint last_message[N_THREADS] = { 0, };
+  gpointer thread_ids[N_THREADS] = { NULL, };
+
+  log_from_threads ();
+
+  g_assert_cmpuint (gt_log_queue_get_n_entries (queue), ==,
+                    N_THREADS * N_MESSAGES_PER_THREAD);
+  g_assert_cmpuint (gt_log_queue_get_n_counted (queue, G_LOG_LEVEL_DEBUG), ==,
+                    N_THREADS * N_MESSAGES_PER_THREAD);
+
+  /* Messages from each thread should be in the order that thread logged
+   * them. */
+  for (gsize i = 0; i < N_THREADS * N_MESSAGES_PER_THREAD; i++)
+    {
+      g_autoptr(GtLogQueueEntry) entry = gt_log_queue_pop_entry (queue);
+      gpointer thread = gt_log_queue_entry_get_thread (entry);
+      guint message_number;
+      gsize j = 0;
+
+      while (j < N_THREADS && thread_ids[j] != NULL && thread_ids[j] != thread)
+        j++;
+      g_assert_cmpuint (j, <, N_THREADS);
+
+      g_assert_cmpint (sscanf (gt_log_queue_entry_get_message (entry), "message %u", &message_number), ==, 1);
+
+      if (thread_ids[j] == NULL)
+        g_assert_cmpuint (message_number, ==, 0);
+      else
+        g_assert_cmpuint (message_number, ==, last_message[j] + 1);
+
+      thread_ids[j] = thread;
+      last_message[j] = message_number;
+    }
+
+  gt_log_queue_assert_no_entries (queue);
+}
+
+/* Test that count-only levels are counted but not captured. */
+static void
+test_log_queue_count_only (void)
+{
+  g_autoptr(GtLogQueue) queue = gt_log_queue_new ();
+
+  gt_log_queue_set_count_only_levels (queue, G_LOG_LEVEL_DEBUG);
+
+  log_from_threads ();
+  g_log ("test", G_LOG_LEVEL_INFO, "captured");
+
+  gt_log_queue_assert_n_counted (queue, G_LOG_LEVEL_DEBUG, N_THREADS * N_MESSAGES_PER_THREAD);
+  gt_log_queue_assert_n_counted (queue, G_LOG_LEVEL_INFO, 1);
+  gt_log_queue_assert_entry_pop (queue, "test", G_LOG_LEVEL_INFO, "captured");
+  gt_log_queue_assert_no_entries (queue);
+}
+
+int
+main (int   argc,
+      char *argv[])
+{
+  setlocale (LC_ALL, "");
+
+  g_test_init (&argc, &argv, NULL);
+
+  g_test_add_func ("/log-queue/construction",
+                   test_log_queue_construction);
+  g_test_add_func ("/log-queue/pop-for",
+                   test_log_queue_pop_for);
+  g_test_add_func ("/log-queue/fields",
+                   test_log_queue_fields);
+  g_test_add_func ("/log-queue/threads",
+                   test_log_queue_threads);
+  g_test_add_func ("/log-queue/count-only",
+                   test_log_queue_count_only);
+
+  return g_test_run ();
+}
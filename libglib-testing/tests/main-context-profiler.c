@@ -0,0 +1,209 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ *
+ * Copyright © 2018 Endless Mobile, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#include <glib.h>
+#include <libglib-testing/main-context-profiler.h>
+#include <libglib-testing/virtual-clock.h>
+#include <locale.h>
+#include <string.h>
+
+
+/* Test that creating and destroying a profiler works. A basic smoketest. */
+static void
+test_main_context_profiler_construction (void)
+{
+  g_autoptr(GtMainContextProfiler) profiler = NULL;
+  profiler = gt_main_context_profiler_new (NULL);
+
+  g_assert_cmpuint (gt_main_context_profiler_get_n_dispatches (profiler), ==, 0);
+  g_assert_cmpuint (gt_main_context_profiler_get_n_iterations (profiler), ==, 0);
+  g_assert_null (gt_main_context_profiler_dup_slowest_source (profiler, NULL));
+}
+
+static gboolean
+count_cb (gpointer user_data)
+{
+  guint *counter = user_data;
+
+  *counter = *counter + 1;
+
+  return G_SOURCE_REMOVE;
+}
+
+static gboolean
+slow_cb (gpointer user_data)
+{
+  guint *counter = user_data;
+
+  g_usleep (20 * 1000);
+  *counter = *counter + 1;
+
+  return G_SOURCE_REMOVE;
+}
+
+static void
+add_named_idle (GMainContext *context,
+                const gchar  *name,
+                GSourceFunc   callback,
+                guint        *counter)
+{
+  g_autoptr(GSource) source = g_idle_source_new ();
+
+  g_source_set_name (source, name);
+  g_source_set_callback (source, callback, counter, NULL);
+  g_source_attach (source, context);
+}
+
+/* Test that a slow source is identified as the slowest, and that its dispatch
+ * time is reflected in the totals and iteration latencies. */
+static void
+test_main_context_profiler_slow_source (void)
+{
+  g_autoptr(GMainContext) context = g_main_context_new ();
+  g_autoptr(GtMainContextProfiler) profiler = NULL;
+  g_autofree gchar *slowest = NULL;
+  g_autofree gchar *formatted = NULL;
+  guint64 max_time_ns = 0;
+  guint counter = 0;
+
+  profiler = gt_main_context_profiler_new (context);
+
+  for (gsize i = 0; i < 5; i++)
+    add_named_idle (context, "fast", count_cb, &counter);
+  add_named_idle (context, "slow", slow_cb, &counter);
+
+  while (counter < 6)
+    g_main_context_iteration (context, TRUE);
+
+  g_assert_cmpuint (gt_main_context_profiler_get_n_dispatches (profiler), ==, 6);
+  g_assert_cmpuint (gt_main_context_profiler_get_n_iterations (profiler), >=, 1);
+
+  slowest = gt_main_context_profiler_dup_slowest_source (profiler, &max_time_ns);
+  g_assert_nonnull (slowest);
+  g_assert_true (g_str_has_prefix (slowest, "slow "));
+  g_assert_cmpuint (max_time_ns, >=, 20 * 1000 * 1000);
+
+  g_assert_cmpuint (gt_main_context_profiler_get_total_time_ns (profiler), >=, max_time_ns);
+  g_assert_cmpuint (gt_main_context_profiler_get_iteration_latency_ns (profiler, 100.0), >=, max_time_ns);
+  g_assert_cmpuint (gt_main_context_profiler_get_iteration_latency_ns (profiler, 0.0), <=,
+                    gt_main_context_profiler_get_iteration_latency_ns (profiler, 100.0));
+
+  formatted = gt_main_context_profiler_format (profiler);
+  g_test_message ("%s", formatted);
+  g_assert_nonnull (strstr (formatted, "slow "));
+  g_assert_nonnull (strstr (formatted, "fast "));
+
+  gt_main_context_profiler_reset (profiler);
+  g_assert_cmpuint (gt_main_context_profiler_get_n_dispatches (profiler), ==, 0);
+  g_assert_cmpuint (gt_main_context_profiler_get_total_time_ns (profiler), ==, 0);
+  g_assert_cmpuint (gt_main_context_profiler_get_n_iterations (profiler), ==, 0);
+}
+
+typedef struct
+{
+  GMainContext *context;  /* (unowned) */
+  guint *counter;  /* (unowned) */
+} AttachData;
+
+static gpointer
+attach_thread_cb (gpointer user_data)
+{
+  AttachData *data = user_data;
+
+  /* Give the main thread a chance to start polling. */
+  g_usleep (10 * 1000);
+  add_named_idle (data->context, "from-thread", count_cb, data->counter);
+
+  return NULL;
+}
+
+/* Test that a source attached from another thread while the context is
+ * polling is profiled, even though it is dispatched without being prepared. */
+static void
+test_main_context_profiler_other_thread (void)
+{
+  g_autoptr(GMainContext) context = g_main_context_new ();
+  g_autoptr(GtMainContextProfiler) profiler = NULL;
+  g_autoptr(GThread) thread = NULL;
+  g_autofree gchar *slowest = NULL;
+  guint counter = 0;
+  AttachData data = { context, &counter };
+
+  profiler = gt_main_context_profiler_new (context);
+
+  thread = g_thread_new ("attach", attach_thread_cb, &data);
+
+  while (counter < 1)
+    g_main_context_iteration (context, TRUE);
+
+  g_thread_join (g_steal_pointer (&thread));
+
+  g_assert_cmpuint (gt_main_context_profiler_get_n_dispatches (profiler), ==, 1);
+  slowest = gt_main_context_profiler_dup_slowest_source (profiler, NULL);
+  g_assert_true (g_str_has_prefix (slowest, "from-thread "));
+}
+
+/* Test that a #GtVirtualClock still recognises timeout sources after they have
+ * been wrapped by a profiler. */
+static void
+test_main_context_profiler_virtual_clock (void)
+{
+  g_autoptr(GMainContext) context = g_main_context_new ();
+  g_autoptr(GtMainContextProfiler) profiler = NULL;
+  g_autoptr(GtVirtualClock) vclock = NULL;
+  g_autoptr(GSource) source = NULL;
+  guint counter = 0;
+  gint64 start_time;
+
+  profiler = gt_main_context_profiler_new (context);
+  vclock = gt_virtual_clock_new (context);
+
+  source = g_timeout_source_new_seconds (30);
+  g_source_set_callback (source, count_cb, &counter, NULL);
+  g_source_attach (source, context);
+
+  start_time = g_get_monotonic_time ();
+
+  while (counter < 1)
+    g_main_context_iteration (context, TRUE);
+
+  g_assert_cmpint (g_get_monotonic_time () - start_time, <, 10 * G_USEC_PER_SEC);
+  g_assert_cmpuint (gt_main_context_profiler_get_n_dispatches (profiler), >=, 1);
+}
+
+int
+main (int   argc,
+      char *argv[])
+{
+  setlocale (LC_ALL, "");
+
+  g_test_init (&argc, &argv, NULL);
+
+  g_test_add_func ("/main-context-profiler/construction",
+                   test_main_context_profiler_construction);
+  g_test_add_func ("/main-context-profiler/slow-source",
+                   test_main_context_profiler_slow_source);
+  g_test_add_func ("/main-context-profiler/other-thread",
+                   test_main_context_profiler_other_thread);
+  g_test_add_func ("/main-context-profiler/virtual-clock",
+                   test_main_context_profiler_virtual_clock);
+
+  return g_test_run ();
+}
@@ -0,0 +1,319 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ *
+ * Copyright © 2018 Endless Mobile, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#include <gio/gio.h>
+#include <glib.h>
+#include <libglib-testing/memory-vfs.h>
+#include <locale.h>
+#include <string.h>
+
+
+#define TEST_SCHEME "gt-test"
+
+static void
+add_file_from_string (GtMemoryVfs *vfs,
+                      const gchar *path,
+                      const gchar *contents)
+{
+  g_autoptr(GBytes) bytes = g_bytes_new (contents, strlen (contents));
+  gt_memory_vfs_add_file (vfs, path, bytes);
+}
+
+/* Test that creating and destroying a memory VFS works. A basic smoketest. */
+static void
+test_memory_vfs_construction (void)
+{
+  g_autoptr(GtMemoryVfs) vfs = NULL;
+  g_autoptr(GFile) root = NULL;
+
+  vfs = gt_memory_vfs_new (TEST_SCHEME);
+
+  g_assert_cmpstr (gt_memory_vfs_get_scheme (vfs), ==, TEST_SCHEME);
+  gt_memory_vfs_assert_no_operations (vfs);
+
+  root = gt_memory_vfs_get_file (vfs, "/");
+  g_assert_true (g_file_query_exists (root, NULL));
+  g_assert_cmpuint (gt_memory_vfs_get_n_operations (vfs, GT_MEMORY_VFS_OPERATION_QUERY_INFO, "/"), ==, 1);
+
+  gt_memory_vfs_reset_counts (vfs);
+  gt_memory_vfs_assert_no_operations (vfs);
+}
+
+/* Test that files in the tree can be looked up by URI, and that the #GFile
+ * path manipulation functions work on them. */
+static void
+test_memory_vfs_uris (void)
+{
+  g_autoptr(GtMemoryVfs) vfs = NULL;
+  g_autoptr(GFile) file = NULL;
+  g_autoptr(GFile) file_from_uri = NULL;
+  g_autoptr(GFile) parent = NULL;
+  g_autoptr(GFile) child = NULL;
+  g_autoptr(GFile) resolved = NULL;
+  g_autofree gchar *uri = NULL;
+  g_autofree gchar *basename = NULL;
+  g_autofree gchar *relative_path = NULL;
+  g_autofree gchar *path = NULL;
+
+  vfs = gt_memory_vfs_new (TEST_SCHEME);
+
+  file = gt_memory_vfs_get_file (vfs, "/dir//sub/./file.txt");
+  uri = g_file_get_uri (file);
+  g_assert_cmpstr (uri, ==, TEST_SCHEME ":///dir/sub/file.txt");
+  g_assert_true (g_file_has_uri_scheme (file, TEST_SCHEME));
+  g_assert_false (g_file_is_native (file));
+  path = g_file_get_path (file);
+  g_assert_null (path);
+
+  file_from_uri = g_file_new_for_uri (TEST_SCHEME ":///dir/sub/file.txt");
+  g_assert_true (g_file_equal (file, file_from_uri));
+
+  basename = g_file_get_basename (file);
+  g_assert_cmpstr (basename, ==, "file.txt");
+
+  parent = g_file_get_parent (file);
+  child = g_file_get_child (parent, "file.txt");
+  g_assert_true (g_file_equal (file, child));
+  g_assert_true (g_file_has_prefix (file, parent));
+  g_assert_false (g_file_has_prefix (parent, file));
+
+  relative_path = g_file_get_relative_path (parent, file);
+  g_assert_cmpstr (relative_path, ==, "file.txt");
+
+  resolved = g_file_resolve_relative_path (file, "../other");
+  g_clear_pointer (&uri, g_free);
+  uri = g_file_get_uri (resolved);
+  g_assert_cmpstr (uri, ==, TEST_SCHEME ":///dir/sub/other");
+
+  /* None of that is I/O. */
+  gt_memory_vfs_assert_no_operations (vfs);
+}
+
+/* Test that files can be read, and that opens and reads are counted. */
+static void
+test_memory_vfs_read (void)
+{
+  g_autoptr(GtMemoryVfs) vfs = NULL;
+  g_autoptr(GFile) file = NULL;
+  g_autoptr(GFile) dir = NULL;
+  g_autoptr(GFile) missing = NULL;
+  g_autoptr(GFileInputStream) stream = NULL;
+  g_autoptr(GError) local_error = NULL;
+  g_autofree gchar *contents = NULL;
+  gsize length = 0;
+
+  vfs = gt_memory_vfs_new (TEST_SCHEME);
+  add_file_from_string (vfs, "/dir/file.txt", "hello world");
+
+  file = g_file_new_for_uri (TEST_SCHEME ":///dir/file.txt");
+  g_file_load_contents (file, NULL, &contents, &length, NULL, &local_error);
+  g_assert_no_error (local_error);
+  g_assert_cmpstr (contents, ==, "hello world");
+  g_assert_cmpuint (length, ==, strlen ("hello world"));
+
+  gt_memory_vfs_assert_n_operations_at_most (vfs, GT_MEMORY_VFS_OPERATION_OPEN,
+                                             "/dir/file.txt", 1);
+  g_assert_cmpuint (gt_memory_vfs_get_n_operations (vfs, GT_MEMORY_VFS_OPERATION_OPEN, "/dir/file.txt"), ==, 1);
+  g_assert_cmpuint (gt_memory_vfs_get_n_operations (vfs, GT_MEMORY_VFS_OPERATION_READ, "/dir/file.txt"), >=, 1);
+  g_assert_cmpuint (gt_memory_vfs_get_n_operations (vfs, GT_MEMORY_VFS_OPERATION_QUERY_INFO, NULL), ==, 0);
+
+  /* Directories and missing files can’t be read, but the attempts are
+   * counted. */
+  dir = g_file_get_parent (file);
+  stream = g_file_read (dir, NULL, &local_error);
+  g_assert_error (local_error, G_IO_ERROR, G_IO_ERROR_IS_DIRECTORY);
+  g_assert_null (stream);
+  g_clear_error (&local_error);
+
+  missing = gt_memory_vfs_get_file (vfs, "/missing");
+  stream = g_file_read (missing, NULL, &local_error);
+  g_assert_error (local_error, G_IO_ERROR, G_IO_ERROR_NOT_FOUND);
+  g_assert_null (stream);
+  g_clear_error (&local_error);
+
+  g_assert_cmpuint (gt_memory_vfs_get_n_operations (vfs, GT_MEMORY_VFS_OPERATION_OPEN, NULL), ==, 3);
+  g_assert_cmpuint (gt_memory_vfs_get_n_operations (vfs, GT_MEMORY_VFS_OPERATION_OPEN, "/missing"), ==, 1);
+
+  /* Removing the file makes it missing. */
+  g_assert_true (gt_memory_vfs_remove (vfs, "/dir"));
+  g_assert_false (gt_memory_vfs_remove (vfs, "/dir"));
+  g_assert_false (g_file_query_exists (file, NULL));
+}
+
+/* Test that querying information and enumerating directories work, and are
+ * counted. */
+static void
+test_memory_vfs_query_info (void)
+{
+  g_autoptr(GtMemoryVfs) vfs = NULL;
+  g_autoptr(GFile) dir = NULL;
+  g_autoptr(GFile) file = NULL;
+  g_autoptr(GFileInfo) info = NULL;
+  g_autoptr(GFileEnumerator) enumerator = NULL;
+  g_autoptr(GError) local_error = NULL;
+  g_autofree gchar *operations = NULL;
+  const gchar *expected_names[] = { "a.txt", "b.txt", "sub" };
+  gsize n_children = 0;
+
+  vfs = gt_memory_vfs_new (TEST_SCHEME);
+  add_file_from_string (vfs, "/dir/b.txt", "bee");
+  add_file_from_string (vfs, "/dir/a.txt", "a");
+  gt_memory_vfs_add_directory (vfs, "/dir/sub");
+  add_file_from_string (vfs, "/dir/sub/nested.txt", "not enumerated");
+
+  file = gt_memory_vfs_get_file (vfs, "/dir/b.txt");
+  info = g_file_query_info (file, G_FILE_ATTRIBUTE_STANDARD_SIZE ","
+                            G_FILE_ATTRIBUTE_STANDARD_TYPE,
+                            G_FILE_QUERY_INFO_NONE, NULL, &local_error);
+  g_assert_no_error (local_error);
+  g_assert_cmpint (g_file_info_get_file_type (info), ==, G_FILE_TYPE_REGULAR);
+  g_assert_cmpint (g_file_info_get_size (info), ==, 3);
+  g_clear_object (&info);
+
+  dir = gt_memory_vfs_get_file (vfs, "/dir");
+  g_assert_cmpint (g_file_query_file_type (dir, G_FILE_QUERY_INFO_NONE, NULL), ==,
+                   G_FILE_TYPE_DIRECTORY);
+
+  enumerator = g_file_enumerate_children (dir, G_FILE_ATTRIBUTE_STANDARD_NAME,
+                                          G_FILE_QUERY_INFO_NONE, NULL,
+                                          &local_error);
+  g_assert_no_error (local_error);
+
+  while ((info = g_file_enumerator_next_file (enumerator, NULL, &local_error)) != NULL)
+    {
+      g_assert_cmpuint (n_children, <, G_N_ELEMENTS (expected_names));
+      g_assert_cmpstr (g_file_info_get_name (info), ==, expected_names[n_children]);
+      n_children++;
+      g_clear_object (&info);
+    }
+  g_assert_no_error (local_error);
+  g_assert_cmpuint (n_children, ==, G_N_ELEMENTS (expected_names));
+
+  /* Enumerating a file fails. */
+  g_clear_object (&enumerator);
+  enumerator = g_file_enumerate_children (file, G_FILE_ATTRIBUTE_STANDARD_NAME,
+                                          G_FILE_QUERY_INFO_NONE, NULL,
+                                          &local_error);
+  g_assert_error (local_error, G_IO_ERROR, G_IO_ERROR_NOT_DIRECTORY);
+  g_assert_null (enumerator);
+  g_clear_error (&local_error);
+
+  g_assert_cmpuint (gt_memory_vfs_get_n_operations (vfs, GT_MEMORY_VFS_OPERATION_QUERY_INFO, "/dir/b.txt"), ==, 1);
+  g_assert_cmpuint (gt_memory_vfs_get_n_operations (vfs, GT_MEMORY_VFS_OPERATION_QUERY_INFO, "/dir"), ==, 1);
+  g_assert_cmpuint (gt_memory_vfs_get_n_operations (vfs, GT_MEMORY_VFS_OPERATION_ENUMERATE, NULL), ==, 2);
+  g_assert_cmpuint (gt_memory_vfs_get_n_operations_total (vfs), ==, 4);
+  gt_memory_vfs_assert_n_operations_at_most (vfs, GT_MEMORY_VFS_OPERATION_QUERY_INFO,
+                                             NULL, 2);
+
+  operations = gt_memory_vfs_format_operations (vfs);
+  g_assert_nonnull (strstr (operations, "/dir/b.txt: query-info ×1, enumerate ×1"));
+}
+
+static void
+async_result_cb (GObject      *source_object,
+                 GAsyncResult *result,
+                 gpointer      user_data)
+{
+  GAsyncResult **result_out = user_data;
+
+  g_assert_null (*result_out);
+  *result_out = g_object_ref (result);
+}
+
+/* Test that asynchronous operations are counted, and complete after the
+ * injected latency. */
+static void
+test_memory_vfs_latency (void)
+{
+  g_autoptr(GtMemoryVfs) vfs = NULL;
+  g_autoptr(GFile) file = NULL;
+  g_autoptr(GAsyncResult) result = NULL;
+  g_autoptr(GFileInfo) info = NULL;
+  g_autoptr(GFileInputStream) stream = NULL;
+  g_autoptr(GError) local_error = NULL;
+  gint64 start_time, end_time;
+  guint8 buffer[16];
+  gssize n_read;
+  const guint latency_ms = 50;
+
+  vfs = gt_memory_vfs_new (TEST_SCHEME);
+  add_file_from_string (vfs, "/file", "contents");
+  gt_memory_vfs_set_latency (vfs, GT_MEMORY_VFS_OPERATION_QUERY_INFO,
+                             latency_ms);
+
+  file = gt_memory_vfs_get_file (vfs, "/file");
+
+  /* A delayed query. */
+  start_time = g_get_monotonic_time ();
+  g_file_query_info_async (file, G_FILE_ATTRIBUTE_STANDARD_TYPE,
+                           G_FILE_QUERY_INFO_NONE, G_PRIORITY_DEFAULT, NULL,
+                           async_result_cb, &result);
+  g_assert_cmpuint (gt_memory_vfs_get_n_operations (vfs, GT_MEMORY_VFS_OPERATION_QUERY_INFO, "/file"), ==, 1);
+
+  while (result == NULL)
+    g_main_context_iteration (NULL, TRUE);
+  end_time = g_get_monotonic_time ();
+
+  info = g_file_query_info_finish (file, result, &local_error);
+  g_assert_no_error (local_error);
+  g_assert_cmpint (g_file_info_get_file_type (info), ==, G_FILE_TYPE_REGULAR);
+  g_assert_cmpint (end_time - start_time, >=, latency_ms * 1000);
+  g_clear_object (&result);
+
+  /* An undelayed open and read. */
+  g_file_read_async (file, G_PRIORITY_DEFAULT, NULL, async_result_cb, &result);
+  while (result == NULL)
+    g_main_context_iteration (NULL, TRUE);
+
+  stream = g_file_read_finish (file, result, &local_error);
+  g_assert_no_error (local_error);
+  g_clear_object (&result);
+
+  g_input_stream_read_async (G_INPUT_STREAM (stream), buffer, sizeof (buffer),
+                             G_PRIORITY_DEFAULT, NULL, async_result_cb, &result);
+  while (result == NULL)
+    g_main_context_iteration (NULL, TRUE);
+
+  n_read = g_input_stream_read_finish (G_INPUT_STREAM (stream), result,
+                                       &local_error);
+  g_assert_no_error (local_error);
+  g_assert_cmpint (n_read, ==, strlen ("contents"));
+  g_assert_cmpmem (buffer, n_read, "contents", strlen ("contents"));
+
+  g_assert_cmpuint (gt_memory_vfs_get_n_operations (vfs, GT_MEMORY_VFS_OPERATION_OPEN, "/file"), ==, 1);
+  g_assert_cmpuint (gt_memory_vfs_get_n_operations (vfs, GT_MEMORY_VFS_OPERATION_READ, "/file"), ==, 1);
+}
+
+int
+main (int   argc,
+      char *argv[])
+{
+  setlocale (LC_ALL, "");
+
+  g_test_init (&argc, &argv, NULL);
+
+  g_test_add_func ("/memory-vfs/construction", test_memory_vfs_construction);
+  g_test_add_func ("/memory-vfs/uris", test_memory_vfs_uris);
+  g_test_add_func ("/memory-vfs/read", test_memory_vfs_read);
+  g_test_add_func ("/memory-vfs/query-info", test_memory_vfs_query_info);
+  g_test_add_func ("/memory-vfs/latency", test_memory_vfs_latency);
+
+  return g_test_run ();
+}
@@ -0,0 +1,174 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ *
+ * Copyright © 2018 Endless Mobile, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#include <gio/gio.h>
+#include <glib.h>
+#include <glib-object.h>
+#include <libglib-testing/object-tracker.h>
+#include <locale.h>
+#include <string.h>
+
+
+/* A test type which overrides #GObjectClass.constructed, to check that the
+ * tracker’s hook calls each class’ constructed implementation exactly once. */
+#define GT_TYPE_TEST_OBJECT gt_test_object_get_type ()
+G_DECLARE_FINAL_TYPE (GtTestObject, gt_test_object, GT, TEST_OBJECT, GObject)
+
+struct _GtTestObject
+{
+  GObject parent;
+
+  guint n_constructed_calls;
+};
+
+G_DEFINE_TYPE (GtTestObject, gt_test_object, G_TYPE_OBJECT)
+
+static void
+gt_test_object_constructed (GObject *obj)
+{
+  GtTestObject *self = GT_TEST_OBJECT (obj);
+
+  G_OBJECT_CLASS (gt_test_object_parent_class)->constructed (obj);
+
+  self->n_constructed_calls++;
+}
+
+static void
+gt_test_object_class_init (GtTestObjectClass *klass)
+{
+  GObjectClass *object_class = G_OBJECT_CLASS (klass);
+
+  object_class->constructed = gt_test_object_constructed;
+}
+
+static void
+gt_test_object_init (GtTestObject *self)
+{
+}
+
+/* Test that creating and destroying an object tracker works. A basic
+ * smoketest. */
+static void
+test_object_tracker_construction (void)
+{
+  g_autoptr(GtObjectTracker) tracker = NULL;
+  g_autofree gchar *formatted = NULL;
+
+  tracker = gt_object_tracker_new ();
+
+  g_assert_cmpuint (gt_object_tracker_get_n_live (tracker, G_TYPE_OBJECT), ==, 0);
+  formatted = gt_object_tracker_format (tracker);
+  g_assert_cmpstr (formatted, ==, "");
+  gt_object_tracker_assert_no_leaks (tracker);
+}
+
+/* Test that creations and finalizations of selected types are counted, and
+ * other types are ignored. */
+static void
+test_object_tracker_counts (void)
+{
+  g_autoptr(GtObjectTracker) tracker = NULL;
+  g_autoptr(GSimpleAction) action1 = NULL;
+  g_autoptr(GSimpleAction) action2 = NULL;
+  g_autoptr(GSimpleAction) action3 = NULL;
+  g_autoptr(GtTestObject) test_object = NULL;
+  g_autoptr(GCancellable) cancellable = NULL;
+  g_autoptr(GPtrArray) live = NULL;
+  g_autofree gchar *formatted = NULL;
+
+  /* Created before tracking starts, so never counted. */
+  action1 = g_simple_action_new ("action1", NULL);
+
+  tracker = gt_object_tracker_new ();
+  gt_object_tracker_track_type (tracker, G_TYPE_SIMPLE_ACTION);
+  gt_object_tracker_track_type (tracker, GT_TYPE_TEST_OBJECT);
+
+  action2 = g_simple_action_new ("action2", NULL);
+  action3 = g_simple_action_new ("action3", NULL);
+  test_object = g_object_new (GT_TYPE_TEST_OBJECT, NULL);
+  cancellable = g_cancellable_new ();
+
+  g_assert_cmpuint (test_object->n_constructed_calls, ==, 1);
+
+  g_assert_cmpuint (gt_object_tracker_get_n_created (tracker, G_TYPE_SIMPLE_ACTION), ==, 2);
+  g_assert_cmpuint (gt_object_tracker_get_n_created (tracker, GT_TYPE_TEST_OBJECT), ==, 1);
+  g_assert_cmpuint (gt_object_tracker_get_n_created (tracker, G_TYPE_CANCELLABLE), ==, 0);
+  gt_object_tracker_assert_n_live (tracker, G_TYPE_SIMPLE_ACTION, 2);
+  gt_object_tracker_assert_n_live (tracker, G_TYPE_OBJECT, 3);
+  g_assert_cmpuint (gt_object_tracker_get_peak_n_live (tracker, G_TYPE_SIMPLE_ACTION), ==, 2);
+
+  live = gt_object_tracker_dup_live_objects (tracker, GT_TYPE_TEST_OBJECT);
+  g_assert_cmpuint (live->len, ==, 1);
+  g_assert_true (g_ptr_array_index (live, 0) == test_object);
+  g_clear_pointer (&live, g_ptr_array_unref);
+
+  formatted = gt_object_tracker_format (tracker);
+  g_test_message ("%s", formatted);
+  g_assert_nonnull (strstr (formatted, "GSimpleAction: 2 live (peak 2, 2 created, 0 finalized)"));
+
+  g_clear_object (&action2);
+  g_clear_object (&action3);
+  g_clear_object (&test_object);
+
+  g_assert_cmpuint (gt_object_tracker_get_n_finalized (tracker, G_TYPE_SIMPLE_ACTION), ==, 2);
+  g_assert_cmpuint (gt_object_tracker_get_n_finalized (tracker, G_TYPE_OBJECT), ==, 3);
+  g_assert_cmpuint (gt_object_tracker_get_peak_n_live (tracker, G_TYPE_SIMPLE_ACTION), ==, 2);
+  gt_object_tracker_assert_no_leaks (tracker);
+}
+
+/* Test that all #GObjects can be tracked, and that freeing the tracker while
+ * objects are still alive is safe. */
+static void
+test_object_tracker_all (void)
+{
+  g_autoptr(GtObjectTracker) tracker = NULL;
+  g_autoptr(GObject) obj = NULL;
+  g_autoptr(GCancellable) cancellable = NULL;
+
+  tracker = gt_object_tracker_new ();
+  gt_object_tracker_track_all (tracker);
+
+  obj = g_object_new (G_TYPE_OBJECT, NULL);
+  cancellable = g_cancellable_new ();
+
+  gt_object_tracker_assert_n_live (tracker, G_TYPE_OBJECT, 2);
+  gt_object_tracker_assert_n_live (tracker, G_TYPE_CANCELLABLE, 1);
+
+  g_clear_pointer (&tracker, gt_object_tracker_free);
+  g_clear_object (&cancellable);
+}
+
+int
+main (int   argc,
+      char *argv[])
+{
+  setlocale (LC_ALL, "");
+
+  g_test_init (&argc, &argv, NULL);
+
+  g_test_add_func ("/object-tracker/construction",
+                   test_object_tracker_construction);
+  g_test_add_func ("/object-tracker/counts",
+                   test_object_tracker_counts);
+  g_test_add_func ("/object-tracker/all",
+                   test_object_tracker_all);
+
+  return g_test_run ();
+}
@@ -0,0 +1,176 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ *
+ * Copyright © 2018 Endless Mobile, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#include <glib.h>
+#include <libglib-testing/perf-counters.h>
+#include <locale.h>
+#include <string.h>
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+
+/* Test that creating and destroying a set of counters works, and that all the
+ * counters have names. A basic smoketest. */
+static void
+test_perf_counters_construction (void)
+{
+  g_autoptr(GtPerfCounters) counters = NULL;
+  counters = gt_perf_counters_new ();
+
+  for (guint i = 0; i <= GT_PERF_COUNTER_LAST; i++)
+    {
+      g_assert_nonnull (gt_perf_counter_get_name ((GtPerfCounter) i));
+
+      /* Unavailable counters must read as zero. */
+      if (!gt_perf_counters_is_available (counters, (GtPerfCounter) i))
+        g_assert_cmpuint (gt_perf_counters_get (counters, (GtPerfCounter) i), ==, 0);
+    }
+}
+
+/* Do some work which can’t be optimised away. */
+static guint
+busy_work (guint n_iterations)
+{
+  volatile guint total = 0;
+
+  for (guint i = 0; i < n_iterations; i++)
+    total += i;
+
+  return total;
+}
+
+/* Test that counters only count while they are running, and that more work
+ * gives a higher instruction count. Hardware counters are often not available
+ * (for example, in virtual machines), in which case the test is skipped. */
+static void
+test_perf_counters_scope (void)
+{
+  g_autoptr(GtPerfCounters) counters = NULL;
+  g_autofree gchar *formatted = NULL;
+  guint64 short_instructions, long_instructions, stopped_instructions;
+
+  counters = gt_perf_counters_new ();
+
+  if (!gt_perf_counters_is_available (counters, GT_PERF_COUNTER_INSTRUCTIONS))
+    {
+      g_test_skip ("Instruction counter is not available");
+      return;
+    }
+
+  gt_perf_counters_start (counters);
+  busy_work (1000);
+  gt_perf_counters_stop (counters);
+  short_instructions = gt_perf_counters_get (counters, GT_PERF_COUNTER_INSTRUCTIONS);
+
+  gt_perf_counters_start (counters);
+  busy_work (100000);
+  gt_perf_counters_stop (counters);
+  long_instructions = gt_perf_counters_get (counters, GT_PERF_COUNTER_INSTRUCTIONS);
+
+  g_assert_cmpuint (short_instructions, >, 0);
+  g_assert_cmpuint (long_instructions, >, short_instructions);
+
+  /* Work done while stopped should not be counted. */
+  busy_work (100000);
+  stopped_instructions = gt_perf_counters_get (counters, GT_PERF_COUNTER_INSTRUCTIONS);
+  g_assert_cmpuint (stopped_instructions, ==, long_instructions);
+
+  formatted = gt_perf_counters_format (counters);
+  g_assert_nonnull (strstr (formatted, "instructions: "));
+}
+
+/* Check whether the kernel allows this process to measure its own task clock
+ * in user space, which is the least an unprivileged process can be allowed.
+ * It may not if perf_event_paranoid is 3 or higher, or if perf_event_open() is
+ * blocked by a seccomp filter (as in many containers). */
+static gboolean
+task_clock_is_permitted (void)
+{
+#ifdef __linux__
+  struct perf_event_attr attr;
+  int fd;
+
+  memset (&attr, 0, sizeof (attr));
+  attr.size = sizeof (attr);
+  attr.disabled = 1;
+  attr.type = PERF_TYPE_SOFTWARE;
+  attr.config = PERF_COUNT_SW_TASK_CLOCK;
+  attr.exclude_kernel = 1;
+  attr.exclude_hv = 1;
+
+  fd = (int) syscall (SYS_perf_event_open, &attr, (pid_t) 0, -1, -1, 0UL);
+  if (fd < 0)
+    return FALSE;
+
+  close (fd);
+  return TRUE;
+#else
+  return FALSE;
+#endif
+}
+
+/* Test that the software counters are available to unprivileged processes
+ * with the default perf_event_paranoid setting of 2, where they have to be
+ * limited to user space. That is where they are needed most, as hardware
+ * counters are often not available either. */
+static void
+test_perf_counters_software (void)
+{
+  g_autoptr(GtPerfCounters) counters = NULL;
+
+  if (!task_clock_is_permitted ())
+    {
+      g_test_skip ("perf_event_open() is not permitted");
+      return;
+    }
+
+  counters = gt_perf_counters_new ();
+
+  g_assert_true (gt_perf_counters_is_available (counters, GT_PERF_COUNTER_TASK_CLOCK));
+  g_assert_true (gt_perf_counters_is_available (counters, GT_PERF_COUNTER_PAGE_FAULTS));
+
+  gt_perf_counters_start (counters);
+  busy_work (100000);
+  gt_perf_counters_stop (counters);
+
+  g_assert_cmpuint (gt_perf_counters_get (counters, GT_PERF_COUNTER_TASK_CLOCK), >, 0);
+}
+
+int
+main (int   argc,
+      char *argv[])
+{
+  setlocale (LC_ALL, "");
+
+  g_test_init (&argc, &argv, NULL);
+
+  g_test_add_func ("/perf-counters/construction",
+                   test_perf_counters_construction);
+  g_test_add_func ("/perf-counters/scope",
+                   test_perf_counters_scope);
+  g_test_add_func ("/perf-counters/software",
+                   test_perf_counters_software);
+
+  return g_test_run ();
+}
@@ -0,0 +1,311 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ *
+ * Copyright © 2018 Endless Mobile, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#include <glib.h>
+#include <glib-object.h>
+#include <libglib-testing/property-recorder.h>
+#include <libglib-testing/virtual-clock.h>
+#include <locale.h>
+
+
+/* A simple object with a few properties of different types, which notifies
+ * them every time they are set, even if they don’t change. */
+#define GT_TYPE_TEST_OBJECT gt_test_object_get_type ()
+G_DECLARE_FINAL_TYPE (GtTestObject, gt_test_object, GT, TEST_OBJECT, GObject)
+
+struct _GtTestObject
+{
+  GObject parent;
+
+  gint int_value;
+  gdouble double_value;
+  gchar *string_value;  /* (owned) (nullable) */
+};
+
+G_DEFINE_TYPE (GtTestObject, gt_test_object, G_TYPE_OBJECT)
+
+typedef enum
+{
+  PROP_INT = 1,
+  PROP_DOUBLE,
+  PROP_STRING,
+} GtTestObjectProperty;
+
+static GParamSpec *props[PROP_STRING + 1] = { NULL, };
+
+static void
+gt_test_object_init (GtTestObject *self)
+{
+  /* Nothing to do here. */
+}
+
+static void
+gt_test_object_finalize (GObject *object)
+{
+  GtTestObject *self = GT_TEST_OBJECT (object);
+
+  g_free (self->string_value);
+
+  G_OBJECT_CLASS (gt_test_object_parent_class)->finalize (object);
+}
+
+static void
+gt_test_object_get_property (GObject    *object,
+                             guint       property_id,
+                             GValue     *value,
+                             GParamSpec *pspec)
+{
+  GtTestObject *self = GT_TEST_OBJECT (object);
+
+  switch ((GtTestObjectProperty) property_id)
+    {
+    case PROP_INT:
+      g_value_set_int (value, self->int_value);
+      break;
+    case PROP_DOUBLE:
+      g_value_set_double (value, self->double_value);
+      break;
+    case PROP_STRING:
+      g_value_set_string (value, self->string_value);
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
+    }
+}
+
+static void
+gt_test_object_set_property (GObject      *object,
+                             guint         property_id,
+                             const GValue *value,
+                             GParamSpec   *pspec)
+{
+  GtTestObject *self = GT_TEST_OBJECT (object);
+
+  switch ((GtTestObjectProperty) property_id)
+    {
+    case PROP_INT:
+      self->int_value = g_value_get_int (value);
+      break;
+    case PROP_DOUBLE:
+      self->double_value = g_value_get_double (value);
+      break;
+    case PROP_STRING:
+      g_free (self->string_value);
+      self->string_value = g_value_dup_string (value);
+      break;
+    default:
+      G_OBJECT_WARN_INVALID_PROPERTY_ID (object, property_id, pspec);
+    }
+}
+
+static void
+gt_test_object_class_init (GtTestObjectClass *klass)
+{
+  GObjectClass *object_class = G_OBJECT_CLASS (klass);
+
+  object_class->finalize = gt_test_object_finalize;
+  object_class->get_property = gt_test_object_get_property;
+  object_class->set_property = gt_test_object_set_property;
+
+  props[PROP_INT] =
+      g_param_spec_int ("int", "Int", "An integer.",
+                        G_MININT, G_MAXINT, 0,
+                        G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS);
+  props[PROP_DOUBLE] =
+      g_param_spec_double ("double", "Double", "A double.",
+                           -G_MAXDOUBLE, G_MAXDOUBLE, 0.0,
+                           G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS);
+  props[PROP_STRING] =
+      g_param_spec_string ("string", "String", "A string.",
+                           NULL,
+                           G_PARAM_READWRITE | G_PARAM_STATIC_STRINGS);
+
+  g_object_class_install_properties (object_class, G_N_ELEMENTS (props), props);
+}
+
+/* Test that creating and destroying a property recorder works. A basic
+ * smoketest. */
+static void
+test_property_recorder_construction (void)
+{
+  g_autoptr(GtPropertyRecorder) recorder = NULL;
+  g_autofree gchar *summary = NULL;
+
+  recorder = gt_property_recorder_new (NULL);
+
+  summary = gt_property_recorder_format (recorder);
+  g_assert_cmpstr (summary, ==, "");
+}
+
+/* Test that notifications, transitions and oscillations are counted
+ * correctly, including redundant notifications which don’t change the value. */
+static void
+test_property_recorder_counts (void)
+{
+  g_autoptr(GtPropertyRecorder) recorder = NULL;
+  g_autoptr(GtTestObject) obj = NULL;
+  const gint values[] = { 0, 1, 1, 2, 1, 2, 3 };
+
+  recorder = gt_property_recorder_new (NULL);
+  obj = g_object_new (GT_TYPE_TEST_OBJECT, NULL);
+
+  gt_property_recorder_watch (recorder, obj, "int");
+  g_assert_cmpuint (gt_property_recorder_get_n_notifies (recorder, obj, "int"), ==, 0);
+
+  for (gsize i = 0; i < G_N_ELEMENTS (values); i++)
+    g_object_set (obj, "int", values[i], NULL);
+
+  /* 0 → 0 and 1 → 1 are redundant; 1 → 2 → 1 and 2 → 1 → 2 oscillate. */
+  g_assert_cmpuint (gt_property_recorder_get_n_notifies (recorder, obj, "int"), ==, 7);
+  g_assert_cmpuint (gt_property_recorder_get_n_transitions (recorder, obj, "int"), ==, 5);
+  g_assert_cmpuint (gt_property_recorder_get_n_oscillations (recorder, obj, "int"), ==, 2);
+  gt_property_recorder_assert_transitions_at_most (recorder, obj, "int", 5);
+
+  /* The history is delta encoded, so small changes shouldn’t need more than
+   * a few bytes each. The first sample has an absolute timestamp. */
+  g_assert_cmpuint (gt_property_recorder_get_history_size (recorder, obj, "int"), <=,
+                    16 + 4 * G_N_ELEMENTS (values));
+
+  gt_property_recorder_reset (recorder);
+  g_assert_cmpuint (gt_property_recorder_get_n_notifies (recorder, obj, "int"), ==, 0);
+  g_assert_cmpuint (gt_property_recorder_get_n_transitions (recorder, obj, "int"), ==, 0);
+  gt_property_recorder_assert_no_oscillations (recorder, obj, "int");
+}
+
+/* Test that the value of a property at a given time, and the time it spends
+ * with a given value, are calculated from its history, using virtual time. */
+static void
+test_property_recorder_timeline (void)
+{
+  g_autoptr(GtVirtualClock) vclock = NULL;
+  g_autoptr(GtPropertyRecorder) recorder = NULL;
+  g_autoptr(GtTestObject) obj = NULL;
+  g_auto(GValue) value = G_VALUE_INIT;
+  g_auto(GValue) query = G_VALUE_INIT;
+  gint64 start_time, mid_time;
+  gint64 time_in_state;
+
+  vclock = gt_virtual_clock_new (NULL);
+  recorder = gt_property_recorder_new (vclock);
+  obj = g_object_new (GT_TYPE_TEST_OBJECT, "string", "idle", NULL);
+
+  start_time = gt_virtual_clock_get_time (vclock);
+  gt_property_recorder_watch (recorder, obj, "string");
+  gt_property_recorder_watch (recorder, obj, "double");
+
+  /* Spend 10 s as “idle”, then 1 s as “busy”, then 10 s as “idle”. */
+  gt_virtual_clock_advance (vclock, 10 * G_USEC_PER_SEC);
+  g_object_set (obj, "string", "busy", "double", 0.5, NULL);
+  gt_virtual_clock_advance (vclock, G_USEC_PER_SEC);
+  mid_time = gt_virtual_clock_get_time (vclock);
+  g_object_set (obj, "string", "idle", "double", 1.0, NULL);
+  gt_virtual_clock_advance (vclock, 10 * G_USEC_PER_SEC);
+
+  g_assert_false (gt_property_recorder_get_value_at (recorder, obj, "string",
+                                                     start_time - 1, &value));
+
+  g_assert_true (gt_property_recorder_get_value_at (recorder, obj, "string",
+                                                    start_time + 5 * G_USEC_PER_SEC,
+                                                    &value));
+  g_assert_cmpstr (g_value_get_string (&value), ==, "idle");
+  g_value_unset (&value);
+
+  g_assert_true (gt_property_recorder_get_value_at (recorder, obj, "string",
+                                                    mid_time - 1, &value));
+  g_assert_cmpstr (g_value_get_string (&value), ==, "busy");
+  g_value_unset (&value);
+
+  g_assert_true (gt_property_recorder_get_value_at (recorder, obj, "double",
+                                                    mid_time - 1, &value));
+  g_assert_cmpfloat (g_value_get_double (&value), ==, 0.5);
+  g_value_unset (&value);
+
+  g_assert_true (gt_property_recorder_get_value_at (recorder, obj, "double",
+                                                    G_MAXINT64, &value));
+  g_assert_cmpfloat (g_value_get_double (&value), ==, 1.0);
+
+  /* Real time passes too, so allow some slack. */
+  g_value_init (&query, G_TYPE_STRING);
+  g_value_set_static_string (&query, "busy");
+  time_in_state = gt_property_recorder_get_time_in_state (recorder, obj, "string", &query);
+  g_assert_cmpint (time_in_state, >=, G_USEC_PER_SEC);
+  g_assert_cmpint (time_in_state, <, 2 * G_USEC_PER_SEC);
+
+  g_value_set_static_string (&query, "idle");
+  time_in_state = gt_property_recorder_get_time_in_state (recorder, obj, "string", &query);
+  g_assert_cmpint (time_in_state, >=, 20 * G_USEC_PER_SEC);
+  g_assert_cmpint (time_in_state, <, 21 * G_USEC_PER_SEC);
+
+  g_assert_cmpuint (gt_property_recorder_get_n_oscillations (recorder, obj, "string"), ==, 1);
+  g_assert_cmpfloat (gt_property_recorder_get_oscillations_per_second (recorder, obj, "string"),
+                     <=, 1.0 / 21.0);
+  g_assert_cmpfloat (gt_property_recorder_get_oscillations_per_second (recorder, obj, "string"),
+                     >, 1.0 / 22.0);
+}
+
+/* Test that a property’s history can still be queried after its object is
+ * finalised, and that it stops at that point. */
+static void
+test_property_recorder_finalised (void)
+{
+  g_autoptr(GtPropertyRecorder) recorder = NULL;
+  g_autoptr(GtTestObject) obj = NULL;
+  gpointer obj_pointer;
+  g_autofree gchar *history = NULL;
+
+  recorder = gt_property_recorder_new (NULL);
+  obj = g_object_new (GT_TYPE_TEST_OBJECT, NULL);
+  obj_pointer = obj;
+
+  gt_property_recorder_watch (recorder, obj, "int");
+  g_object_set (obj, "int", 5, NULL);
+  g_clear_object (&obj);
+
+  g_assert_cmpuint (gt_property_recorder_get_n_transitions (recorder, obj_pointer, "int"), ==, 1);
+
+  history = gt_property_recorder_format_history (recorder, obj_pointer, "int");
+  g_assert_true (g_str_has_suffix (history, " µs: finalised\n"));
+
+  /* Forgotten on reset. */
+  gt_property_recorder_reset (recorder);
+  g_clear_pointer (&history, g_free);
+  history = gt_property_recorder_format (recorder);
+  g_assert_cmpstr (history, ==, "");
+}
+
+int
+main (int   argc,
+      char *argv[])
+{
+  setlocale (LC_ALL, "");
+
+  g_test_init (&argc, &argv, NULL);
+
+  g_test_add_func ("/property-recorder/construction",
+                   test_property_recorder_construction);
+  g_test_add_func ("/property-recorder/counts",
+                   test_property_recorder_counts);
+  g_test_add_func ("/property-recorder/timeline",
+                   test_property_recorder_timeline);
+  g_test_add_func ("/property-recorder/finalised",
+                   test_property_recorder_finalised);
+
+  return g_test_run ();
+}
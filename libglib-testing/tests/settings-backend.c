@@ -0,0 +1,270 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ *
+ * Copyright © 2018 Endless Mobile, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#include <gio/gio.h>
+#include <glib.h>
+#include <libglib-testing/settings-backend.h>
+#include <locale.h>
+
+
+#define TEST_SCHEMA_ID "com.endlessm.libglibtesting.test"
+#define TEST_PATH "/com/endlessm/libglibtesting/test/"
+
+/* Create a #GSettings for the test schema, using the backend from @backend.
+ * The schema is compiled into the build directory when the tests are built;
+ * if it can’t be found (for example, when running as installed tests), the
+ * test is skipped and %NULL is returned. */
+static GSettings *
+new_test_settings (GtSettingsBackend *backend)
+{
+  g_autoptr(GSettingsSchemaSource) source = NULL;
+  g_autoptr(GSettingsSchema) schema = NULL;
+  g_autoptr(GError) local_error = NULL;
+
+  source = g_settings_schema_source_new_from_directory (g_test_get_dir (G_TEST_BUILT),
+                                                        NULL, FALSE,
+                                                        &local_error);
+  if (source != NULL)
+    schema = g_settings_schema_source_lookup (source, TEST_SCHEMA_ID, FALSE);
+
+  if (schema == NULL)
+    {
+      g_test_skip ("Test schema " TEST_SCHEMA_ID " not found");
+      return NULL;
+    }
+
+  return g_settings_new_full (schema, gt_settings_backend_get_backend (backend),
+                              NULL);
+}
+
+/* Test that creating and destroying a settings backend works. A basic
+ * smoketest. */
+static void
+test_settings_backend_construction (void)
+{
+  g_autoptr(GtSettingsBackend) backend = NULL;
+  g_autofree gchar *key = NULL;
+  guint n_writes = 1;
+
+  backend = gt_settings_backend_new ();
+
+  g_assert_nonnull (gt_settings_backend_get_backend (backend));
+  g_assert_null (gt_settings_backend_dup_value (backend, TEST_PATH "count"));
+  g_assert_cmpuint (gt_settings_backend_get_n_writes (backend, NULL), ==, 0);
+  g_assert_false (gt_settings_backend_get_has_unapplied (backend));
+
+  key = gt_settings_backend_dup_most_written_key (backend, &n_writes);
+  g_assert_null (key);
+  g_assert_cmpuint (n_writes, ==, 0);
+
+  gt_settings_backend_assert_no_changes (backend);
+  gt_settings_backend_assert_writes_at_most (backend, 0);
+}
+
+/* Test that writes through #GSettings are stored, counted and queued as
+ * changes, and that redundant writes are detected. */
+static void
+test_settings_backend_writes (void)
+{
+  g_autoptr(GtSettingsBackend) backend = NULL;
+  g_autoptr(GSettings) settings = NULL;
+  g_autoptr(GVariant) value = NULL;
+  g_autofree gchar *key = NULL;
+  g_autofree gchar *name = NULL;
+  guint n_writes = 0;
+
+  backend = gt_settings_backend_new ();
+  settings = new_test_settings (backend);
+  if (settings == NULL)
+    return;
+
+  /* Unset keys read as their defaults. */
+  g_assert_cmpuint (g_settings_get_uint (settings, "count"), ==, 0);
+
+  g_settings_set_uint (settings, "count", 5);
+  g_assert_cmpuint (g_settings_get_uint (settings, "count"), ==, 5);
+  value = gt_settings_backend_dup_value (backend, TEST_PATH "count");
+  g_assert_nonnull (value);
+  g_assert_cmpuint (g_variant_get_uint32 (value), ==, 5);
+
+  gt_settings_backend_assert_change_pop (backend, TEST_PATH "count",
+                                         g_variant_new_uint32 (5));
+  gt_settings_backend_assert_no_changes (backend);
+  gt_settings_backend_assert_writes_at_most (backend, 1);
+  gt_settings_backend_assert_no_redundant_writes (backend);
+
+  /* Write the same value again. */
+  g_settings_set_uint (settings, "count", 5);
+  g_settings_set_string (settings, "name", "hello");
+
+  gt_settings_backend_assert_change_pop (backend, TEST_PATH "count",
+                                         g_variant_new_uint32 (5));
+  gt_settings_backend_assert_change_pop (backend, TEST_PATH "name",
+                                         g_variant_new_string ("hello"));
+  gt_settings_backend_assert_no_changes (backend);
+
+  g_assert_cmpuint (gt_settings_backend_get_n_writes (backend, TEST_PATH "count"), ==, 2);
+  g_assert_cmpuint (gt_settings_backend_get_n_writes (backend, TEST_PATH "name"), ==, 1);
+  g_assert_cmpuint (gt_settings_backend_get_n_writes (backend, NULL), ==, 3);
+  g_assert_cmpuint (gt_settings_backend_get_n_redundant_writes (backend, TEST_PATH "count"), ==, 1);
+  g_assert_cmpuint (gt_settings_backend_get_n_redundant_writes (backend, NULL), ==, 1);
+  gt_settings_backend_assert_writes_at_most (backend, 2);
+
+  key = gt_settings_backend_dup_most_written_key (backend, &n_writes);
+  g_assert_cmpstr (key, ==, TEST_PATH "count");
+  g_assert_cmpuint (n_writes, ==, 2);
+
+  /* Reset the key back to its default. */
+  g_settings_reset (settings, "count");
+  g_assert_cmpuint (g_settings_get_uint (settings, "count"), ==, 0);
+  gt_settings_backend_assert_change_pop (backend, TEST_PATH "count", NULL);
+  gt_settings_backend_assert_no_changes (backend);
+
+  /* Resetting the counts doesn’t affect the values. */
+  gt_settings_backend_reset_counts (backend);
+  g_assert_cmpuint (gt_settings_backend_get_n_writes (backend, NULL), ==, 0);
+  gt_settings_backend_assert_no_redundant_writes (backend);
+  name = g_settings_get_string (settings, "name");
+  g_assert_cmpstr (name, ==, "hello");
+}
+
+/* Test that writes made while the backend is delayed are visible, but are only
+ * written to storage (and counted) once per key when applied. */
+static void
+test_settings_backend_delay_apply (void)
+{
+  g_autoptr(GtSettingsBackend) backend = NULL;
+  g_autoptr(GSettings) settings = NULL;
+
+  backend = gt_settings_backend_new ();
+  settings = new_test_settings (backend);
+  if (settings == NULL)
+    return;
+
+  gt_settings_backend_delay (backend);
+
+  g_settings_set_uint (settings, "count", 1);
+  g_settings_set_uint (settings, "count", 2);
+  g_settings_set_uint (settings, "count", 3);
+  g_settings_set_string (settings, "name", "batched");
+
+  g_assert_cmpuint (g_settings_get_uint (settings, "count"), ==, 3);
+  g_assert_true (gt_settings_backend_get_has_unapplied (backend));
+  g_assert_cmpuint (gt_settings_backend_get_n_writes (backend, NULL), ==, 0);
+  gt_settings_backend_assert_no_changes (backend);
+
+  gt_settings_backend_apply (backend);
+
+  g_assert_false (gt_settings_backend_get_has_unapplied (backend));
+  g_assert_cmpuint (g_settings_get_uint (settings, "count"), ==, 3);
+  gt_settings_backend_assert_change_pop (backend, TEST_PATH "count",
+                                         g_variant_new_uint32 (3));
+  gt_settings_backend_assert_change_pop (backend, TEST_PATH "name",
+                                         g_variant_new_string ("batched"));
+  gt_settings_backend_assert_no_changes (backend);
+  gt_settings_backend_assert_writes_at_most (backend, 1);
+  gt_settings_backend_assert_no_redundant_writes (backend);
+
+  /* Writing a value and then writing it back while delayed results in one
+   * redundant write. */
+  gt_settings_backend_delay (backend);
+  g_settings_set_uint (settings, "count", 4);
+  g_settings_set_uint (settings, "count", 3);
+  gt_settings_backend_apply (backend);
+
+  gt_settings_backend_assert_change_pop (backend, TEST_PATH "count",
+                                         g_variant_new_uint32 (3));
+  gt_settings_backend_assert_no_changes (backend);
+  g_assert_cmpuint (gt_settings_backend_get_n_redundant_writes (backend, NULL), ==, 1);
+}
+
+/* Test that reverting pending changes discards them without writing. */
+static void
+test_settings_backend_delay_revert (void)
+{
+  g_autoptr(GtSettingsBackend) backend = NULL;
+  g_autoptr(GSettings) settings = NULL;
+
+  backend = gt_settings_backend_new ();
+  settings = new_test_settings (backend);
+  if (settings == NULL)
+    return;
+
+  gt_settings_backend_delay (backend);
+  g_settings_set_uint (settings, "count", 10);
+  g_assert_cmpuint (g_settings_get_uint (settings, "count"), ==, 10);
+
+  gt_settings_backend_revert (backend);
+
+  g_assert_false (gt_settings_backend_get_has_unapplied (backend));
+  g_assert_cmpuint (g_settings_get_uint (settings, "count"), ==, 0);
+  g_assert_cmpuint (gt_settings_backend_get_n_writes (backend, NULL), ==, 0);
+  gt_settings_backend_assert_no_changes (backend);
+}
+
+/* Test that changes applied using g_settings_delay() are written in one batch,
+ * through the backend’s write_tree() method. */
+static void
+test_settings_backend_settings_delay (void)
+{
+  g_autoptr(GtSettingsBackend) backend = NULL;
+  g_autoptr(GSettings) settings = NULL;
+
+  backend = gt_settings_backend_new ();
+  settings = new_test_settings (backend);
+  if (settings == NULL)
+    return;
+
+  g_settings_delay (settings);
+  g_settings_set_string (settings, "name", "first");
+  g_settings_set_string (settings, "name", "second");
+  g_settings_set_uint (settings, "count", 7);
+
+  gt_settings_backend_assert_no_changes (backend);
+
+  g_settings_apply (settings);
+
+  gt_settings_backend_assert_change_pop (backend, TEST_PATH "count",
+                                         g_variant_new_uint32 (7));
+  gt_settings_backend_assert_change_pop (backend, TEST_PATH "name",
+                                         g_variant_new_string ("second"));
+  gt_settings_backend_assert_no_changes (backend);
+  gt_settings_backend_assert_writes_at_most (backend, 1);
+}
+
+int
+main (int   argc,
+      char *argv[])
+{
+  setlocale (LC_ALL, "");
+  g_test_init (&argc, &argv, NULL);
+
+  g_test_add_func ("/settings-backend/construction",
+                   test_settings_backend_construction);
+  g_test_add_func ("/settings-backend/writes", test_settings_backend_writes);
+  g_test_add_func ("/settings-backend/delay-apply",
+                   test_settings_backend_delay_apply);
+  g_test_add_func ("/settings-backend/delay-revert",
+                   test_settings_backend_delay_revert);
+  g_test_add_func ("/settings-backend/settings-delay",
+                   test_settings_backend_settings_delay);
+
+  return g_test_run ();
+}
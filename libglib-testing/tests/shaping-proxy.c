@@ -0,0 +1,192 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ *
+ * Copyright © 2018 Endless Mobile, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#include <gio/gio.h>
+#include <glib.h>
+#include <libglib-testing/dbus-queue.h>
+#include <libglib-testing/shaping-proxy.h>
+#include <locale.h>
+#include <string.h>
+#include "test-service-iface.h"
+
+
+/* Fixture for tests which interact with the com.example.Test service over
+ * D-Bus, with the client connection going through a #GtShapingProxy. It
+ * exports one object (with ID 123) and a manager object. */
+typedef struct
+{
+  GtDBusQueue *queue;  /* (owned) */
+  GtShapingProxy *proxy;  /* (unowned) */
+} ProxyFixture;
+
+static void
+proxy_set_up (ProxyFixture  *fixture,
+              gconstpointer  test_data)
+{
+  g_autoptr(GError) local_error = NULL;
+
+  fixture->queue = gt_dbus_queue_new ();
+  gt_dbus_queue_set_use_shaping_proxy (fixture->queue, TRUE);
+
+  gt_dbus_queue_connect (fixture->queue, &local_error);
+  g_assert_no_error (local_error);
+
+  fixture->proxy = gt_dbus_queue_get_shaping_proxy (fixture->queue);
+  g_assert_nonnull (fixture->proxy);
+
+  gt_dbus_queue_own_name (fixture->queue, "com.example.Test");
+
+  gt_dbus_queue_export_object (fixture->queue,
+                               "/com/example/Test/Object123",
+                               (GDBusInterfaceInfo *) &gt_mock_object_interface_info,
+                               &local_error);
+  g_assert_no_error (local_error);
+
+  gt_dbus_queue_export_object (fixture->queue,
+                               "/com/example/Test",
+                               (GDBusInterfaceInfo *) &gt_mock_manager_interface_info,
+                               &local_error);
+  g_assert_no_error (local_error);
+}
+
+static void
+proxy_tear_down (ProxyFixture  *fixture,
+                 gconstpointer  test_data)
+{
+  gt_dbus_queue_disconnect (fixture->queue, TRUE);
+  g_clear_pointer (&fixture->queue, gt_dbus_queue_free);
+}
+
+/* Call GetObjectPath() on the mock service synchronously, asserting that it
+ * succeeds, and return how long it took in microseconds. */
+static gint64
+timed_get_object_path (ProxyFixture *fixture)
+{
+  g_autoptr(GVariant) reply = NULL;
+  g_autoptr(GError) local_error = NULL;
+  gint64 start_time;
+
+  start_time = g_get_monotonic_time ();
+  reply = g_dbus_connection_call_sync (gt_dbus_queue_get_client_connection (fixture->queue),
+                                       "com.example.Test",
+                                       "/com/example/Test",
+                                       "com.example.Test.Manager",
+                                       "GetObjectPath",
+                                       g_variant_new ("(u)", 123),
+                                       G_VARIANT_TYPE ("(o)"),
+                                       G_DBUS_CALL_FLAGS_NONE,
+                                       -1,  /* timeout (ms) */
+                                       NULL,  /* cancellable */
+                                       &local_error);
+  g_assert_no_error (local_error);
+  g_assert_nonnull (reply);
+
+  return g_get_monotonic_time () - start_time;
+}
+
+/* Test that traffic passes through the proxy, and that latency is added to it
+ * in each direction. */
+static void
+test_shaping_proxy_latency (ProxyFixture  *fixture,
+                            gconstpointer  test_data)
+{
+  guint64 n_bytes_to_server, n_bytes_to_client;
+  gint64 duration;
+
+  /* Authentication and the Hello() call have already gone through the proxy. */
+  n_bytes_to_server = gt_shaping_proxy_get_n_bytes (fixture->proxy,
+                                                    GT_SHAPING_PROXY_DIRECTION_TO_SERVER);
+  n_bytes_to_client = gt_shaping_proxy_get_n_bytes (fixture->proxy,
+                                                    GT_SHAPING_PROXY_DIRECTION_TO_CLIENT);
+  g_assert_cmpuint (n_bytes_to_server, >, 0);
+  g_assert_cmpuint (n_bytes_to_client, >, 0);
+
+  gt_shaping_proxy_set_latency (fixture->proxy,
+                                GT_SHAPING_PROXY_DIRECTION_TO_SERVER, 100);
+  gt_shaping_proxy_set_latency (fixture->proxy,
+                                GT_SHAPING_PROXY_DIRECTION_TO_CLIENT, 50);
+
+  gt_dbus_queue_expect_call (fixture->queue,
+                             "/com/example/Test",
+                             "com.example.Test.Manager",
+                             "GetObjectPath",
+                             "(@u 123,)",
+                             "(@o '/com/example/Test/Object123',)");
+
+  duration = timed_get_object_path (fixture);
+  g_assert_cmpint (duration, >=, 150 * 1000);
+
+  gt_dbus_queue_assert_expectations_met (fixture->queue);
+  g_assert_cmpuint (gt_shaping_proxy_get_n_bytes (fixture->proxy,
+                                                  GT_SHAPING_PROXY_DIRECTION_TO_SERVER),
+                    >, n_bytes_to_server);
+  g_assert_cmpuint (gt_shaping_proxy_get_n_bytes (fixture->proxy,
+                                                  GT_SHAPING_PROXY_DIRECTION_TO_CLIENT),
+                    >, n_bytes_to_client);
+}
+
+/* Test that a large reply is throttled by the bandwidth cap, and still arrives
+ * intact when it’s split into small chunks. */
+static void
+test_shaping_proxy_bandwidth (ProxyFixture  *fixture,
+                              gconstpointer  test_data)
+{
+  g_autofree gchar *long_name = NULL;
+  g_autofree gchar *reply = NULL;
+  gint64 duration;
+
+  /* Reply with an object path of about 4000 bytes, which should take about
+   * 200ms at 20000 bytes per second. */
+  long_name = g_strnfill (4000, 'a');
+  reply = g_strdup_printf ("(@o '/com/example/Test/%s',)", long_name);
+
+  gt_shaping_proxy_set_bandwidth (fixture->proxy,
+                                  GT_SHAPING_PROXY_DIRECTION_TO_CLIENT, 20000);
+  gt_shaping_proxy_set_max_chunk_size (fixture->proxy,
+                                       GT_SHAPING_PROXY_DIRECTION_TO_CLIENT, 100);
+
+  gt_dbus_queue_expect_call (fixture->queue,
+                             "/com/example/Test",
+                             "com.example.Test.Manager",
+                             "GetObjectPath",
+                             NULL,
+                             reply);
+
+  duration = timed_get_object_path (fixture);
+  g_assert_cmpint (duration, >=, 150 * 1000);
+
+  gt_dbus_queue_assert_expectations_met (fixture->queue);
+}
+
+int
+main (int   argc,
+      char *argv[])
+{
+  setlocale (LC_ALL, "");
+
+  g_test_init (&argc, &argv, NULL);
+
+  g_test_add ("/shaping-proxy/latency", ProxyFixture, NULL,
+              proxy_set_up, test_shaping_proxy_latency, proxy_tear_down);
+  g_test_add ("/shaping-proxy/bandwidth", ProxyFixture, NULL,
+              proxy_set_up, test_shaping_proxy_bandwidth, proxy_tear_down);
+
+  return g_test_run ();
+}
@@ -20,7 +20,9 @@
  *  - Philip Withnall <withnall@endlessm.com>
  */
 
+#include <gio/gio.h>
 #include <glib.h>
+#include <libglib-testing/alloc-tracker.h>
 #include <libglib-testing/signal-logger.h>
 #include <locale.h>
 
@@ -36,6 +38,67 @@ test_signal_logger_construction (void)
   g_assert_cmpuint (gt_signal_logger_get_n_emissions (logger), ==, 0);
 }
 
+static void
+notify_cb (GObject    *obj,
+           GParamSpec *pspec,
+           gpointer    user_data)
+{
+  /* Do nothing. */
+}
+
+/* Emit #GObject::notify::enabled on @action @n_emissions times. */
+static void
+toggle_enabled (GSimpleAction *action,
+                guint          n_emissions)
+{
+  for (guint i = 0; i < n_emissions; i++)
+    g_simple_action_set_enabled (action, !g_action_get_enabled (G_ACTION (action)));
+}
+
+/* Test that capturing a signal emission needs only a single allocation, on
+ * top of whatever GLib needs to emit the signal. */
+static void
+test_signal_logger_allocations (void)
+{
+  const guint n_emissions = 100;
+  g_autoptr(GtSignalLogger) logger = NULL;
+  g_autoptr(GSimpleAction) action = NULL;
+  g_autoptr(GtAllocTracker) baseline_tracker = NULL;
+  g_autoptr(GtAllocTracker) tracker = NULL;
+  gulong notify_id;
+
+  logger = gt_signal_logger_new ();
+  action = g_simple_action_new ("action", NULL);
+  baseline_tracker = gt_alloc_tracker_new (GT_ALLOC_TRACKER_SCOPE_THREAD);
+  tracker = gt_alloc_tracker_new (GT_ALLOC_TRACKER_SCOPE_THREAD);
+
+  /* Measure emitting the signal with a no-op handler connected, so GLib goes
+   * through the same emission path as with the logger connected. */
+  notify_id = g_signal_connect (action, "notify::enabled",
+                                G_CALLBACK (notify_cb), NULL);
+  toggle_enabled (action, 1);
+  gt_alloc_tracker_start (baseline_tracker);
+  toggle_enabled (action, n_emissions);
+  gt_alloc_tracker_stop (baseline_tracker);
+  g_signal_handler_disconnect (action, notify_id);
+
+  gt_signal_logger_connect (logger, action, "notify::enabled");
+
+  gt_alloc_tracker_start (tracker);
+  toggle_enabled (action, n_emissions);
+  gt_alloc_tracker_stop (tracker);
+
+  /* One allocation per emission, plus a few to grow the log. */
+  gt_assert_allocs_at_most (tracker,
+                            gt_alloc_tracker_get_n_allocs (baseline_tracker) +
+                            n_emissions + 16);
+
+  g_assert_cmpuint (gt_signal_logger_get_n_emissions (logger), ==, n_emissions);
+  for (guint i = 0; i < n_emissions; i++)
+    gt_signal_logger_assert_notify_emission_pop (logger, action, "enabled");
+  gt_signal_logger_assert_no_emissions (logger);
+}
+
 int
 main (int   argc,
       char *argv[])
@@ -46,6 +109,8 @@ main (int   argc,
 
   g_test_add_func ("/signal-logger/construction",
                    test_signal_logger_construction);
+  g_test_add_func ("/signal-logger/allocations",
+                   test_signal_logger_allocations);
 
   return g_test_run ();
 }
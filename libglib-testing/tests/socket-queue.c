@@ -0,0 +1,295 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ *
+ * Copyright © 2018 Endless Mobile, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#include <gio/gio.h>
+#include <glib.h>
+#include <libglib-testing/socket-queue.h>
+#include <locale.h>
+#include <string.h>
+
+
+/* Connect a new client to @queue, asserting that it succeeds. */
+static GSocketConnection *
+connect_client (GtSocketQueue *queue)
+{
+  g_autoptr(GSocketClient) client = g_socket_client_new ();
+  g_autoptr(GSocketConnection) connection = NULL;
+  g_autoptr(GError) local_error = NULL;
+
+  connection = g_socket_client_connect (client,
+                                        G_SOCKET_CONNECTABLE (gt_socket_queue_get_address (queue)),
+                                        NULL, &local_error);
+  g_assert_no_error (local_error);
+  g_assert_nonnull (connection);
+
+  return g_steal_pointer (&connection);
+}
+
+/* Write all of @data to @connection, asserting that it succeeds. */
+static void
+client_write (GSocketConnection *connection,
+              const void        *data,
+              gsize              length)
+{
+  GOutputStream *output = g_io_stream_get_output_stream (G_IO_STREAM (connection));
+  g_autoptr(GError) local_error = NULL;
+
+  g_output_stream_write_all (output, data, length, NULL, NULL, &local_error);
+  g_assert_no_error (local_error);
+}
+
+/* Read exactly @length bytes from @connection and assert they match
+ * @expected. */
+static void
+client_assert_read (GSocketConnection *connection,
+                    const gchar       *expected)
+{
+  GInputStream *input = g_io_stream_get_input_stream (G_IO_STREAM (connection));
+  gsize length = strlen (expected);
+  g_autofree gchar *buffer = g_malloc0 (length + 1);
+  gsize n_read = 0;
+  g_autoptr(GError) local_error = NULL;
+
+  g_input_stream_read_all (input, buffer, length, &n_read, NULL, &local_error);
+  g_assert_no_error (local_error);
+  g_assert_cmpuint (n_read, ==, length);
+  g_assert_cmpstr (buffer, ==, expected);
+}
+
+/* Test that creating and destroying a socket queue works. A basic smoketest. */
+static void
+test_socket_queue_construction (void)
+{
+  g_autoptr(GtSocketQueue) queue = NULL;
+  g_autoptr(GError) local_error = NULL;
+
+  queue = gt_socket_queue_new ();
+  g_assert_null (gt_socket_queue_get_address (queue));
+  g_assert_nonnull (gt_socket_queue_get_server_context (queue));
+
+  gt_socket_queue_start (queue, &local_error);
+  g_assert_no_error (local_error);
+  g_assert_true (G_IS_SOCKET_ADDRESS (gt_socket_queue_get_address (queue)));
+
+  gt_socket_queue_assert_no_frames (queue);
+  g_assert_false (gt_socket_queue_try_pop_frame (queue, NULL));
+
+  gt_socket_queue_stop (queue);
+}
+
+/* Test that the default line framer splits frames correctly, including across
+ * writes, and that replies are sent to the right connection. */
+static void
+test_socket_queue_lines (void)
+{
+  g_autoptr(GtSocketQueue) queue = NULL;
+  g_autoptr(GSocketConnection) client1 = NULL;
+  g_autoptr(GSocketConnection) client2 = NULL;
+  g_autoptr(GtSocketQueueFrame) frame1 = NULL;
+  g_autoptr(GtSocketQueueFrame) frame2 = NULL;
+  g_autoptr(GtSocketQueueFrame) frame3 = NULL;
+  g_autoptr(GError) local_error = NULL;
+
+  queue = gt_socket_queue_new ();
+  gt_socket_queue_start (queue, &local_error);
+  g_assert_no_error (local_error);
+
+  client1 = connect_client (queue);
+  client2 = connect_client (queue);
+
+  client_write (client1, "PING\nHEL", strlen ("PING\nHEL"));
+  frame1 = gt_socket_queue_assert_pop_frame (queue, "PING", -1);
+
+  client_write (client1, "LO\r\n", strlen ("LO\r\n"));
+  frame2 = gt_socket_queue_assert_pop_frame (queue, "HELLO", -1);
+  g_assert_cmpuint (gt_socket_queue_frame_get_connection_id (frame1), ==,
+                    gt_socket_queue_frame_get_connection_id (frame2));
+
+  client_write (client2, "\n", 1);
+  frame3 = gt_socket_queue_assert_pop_frame (queue, "", 0);
+  g_assert_cmpuint (gt_socket_queue_frame_get_connection_id (frame3), !=,
+                    gt_socket_queue_frame_get_connection_id (frame1));
+
+  gt_socket_queue_assert_no_frames (queue);
+
+  /* Reply out of order across the two connections. */
+  gt_socket_queue_frame_reply (frame3, "EMPTY\n", -1);
+  gt_socket_queue_frame_reply (frame1, "PONG\n", -1);
+  gt_socket_queue_frame_reply (frame2, "WORLD\n", -1);
+
+  client_assert_read (client1, "PONG\nWORLD\n");
+  client_assert_read (client2, "EMPTY\n");
+
+  g_assert_cmpuint (gt_socket_queue_get_n_frames_received (queue), ==, 3);
+  g_assert_cmpuint (gt_socket_queue_get_n_bytes_received (queue), ==, 13);
+
+  /* The sent byte count is updated just after the server thread sends each
+   * reply, so it may lag slightly behind what the clients have read. */
+  while (gt_socket_queue_get_n_bytes_sent (queue) < 17)
+    g_usleep (1000);
+  g_assert_cmpuint (gt_socket_queue_get_n_bytes_sent (queue), ==, 17);
+}
+
+/* Test that the length-prefixed framer handles several frames in one write,
+ * empty frames, and frames larger than the receive buffer. */
+static void
+test_socket_queue_length_prefixed (void)
+{
+  g_autoptr(GtSocketQueue) queue = NULL;
+  g_autoptr(GSocketConnection) client = NULL;
+  g_autoptr(GtSocketQueueFrame) frame = NULL;
+  g_autoptr(GByteArray) data = NULL;
+  g_autofree guint8 *large_payload = NULL;
+  const gsize large_length = 200000;
+  guint32 length_be;
+  g_autoptr(GError) local_error = NULL;
+
+  queue = gt_socket_queue_new ();
+  gt_socket_queue_set_framer (queue, gt_socket_queue_framer_length_prefixed, NULL);
+  gt_socket_queue_start (queue, &local_error);
+  g_assert_no_error (local_error);
+
+  client = connect_client (queue);
+
+  /* Two frames, one of them empty, in a single write. */
+  data = g_byte_array_new ();
+  length_be = GUINT32_TO_BE (3);
+  g_byte_array_append (data, (const guint8 *) &length_be, sizeof (length_be));
+  g_byte_array_append (data, (const guint8 *) "a\0b", 3);
+  length_be = GUINT32_TO_BE (0);
+  g_byte_array_append (data, (const guint8 *) &length_be, sizeof (length_be));
+  client_write (client, data->data, data->len);
+
+  frame = gt_socket_queue_assert_pop_frame (queue, "a\0b", 3);
+  g_clear_pointer (&frame, gt_socket_queue_frame_free);
+  frame = gt_socket_queue_assert_pop_frame (queue, "", 0);
+  g_clear_pointer (&frame, gt_socket_queue_frame_free);
+
+  /* A frame which has to be moved to a larger buffer. */
+  large_payload = g_malloc (large_length);
+  for (gsize i = 0; i < large_length; i++)
+    large_payload[i] = (guint8) (i % 251);
+
+  length_be = GUINT32_TO_BE ((guint32) large_length);
+  client_write (client, &length_be, sizeof (length_be));
+  client_write (client, large_payload, large_length);
+
+  frame = gt_socket_queue_assert_pop_frame (queue, large_payload, (gssize) large_length);
+  gt_socket_queue_assert_no_frames (queue);
+}
+
+/* Test that frame payloads stay valid after the queue which received them has
+ * been freed. */
+static void
+test_socket_queue_payload_lifetime (void)
+{
+  g_autoptr(GtSocketQueue) queue = NULL;
+  g_autoptr(GSocketConnection) client = NULL;
+  g_autoptr(GtSocketQueueFrame) frame = NULL;
+  g_autoptr(GBytes) payload = NULL;
+  g_autoptr(GError) local_error = NULL;
+
+  queue = gt_socket_queue_new ();
+  gt_socket_queue_start (queue, &local_error);
+  g_assert_no_error (local_error);
+
+  client = connect_client (queue);
+  client_write (client, "one\ntwo\n", strlen ("one\ntwo\n"));
+
+  frame = gt_socket_queue_assert_pop_frame (queue, "one", -1);
+  payload = g_bytes_ref (gt_socket_queue_frame_get_payload (frame));
+  g_clear_pointer (&frame, gt_socket_queue_frame_free);
+
+  /* Wait for the second frame so the queue is freed with it still queued. */
+  while (gt_socket_queue_get_n_frames (queue) == 0)
+    g_usleep (1000);
+
+  g_clear_object (&client);
+  g_clear_pointer (&queue, gt_socket_queue_free);
+
+  g_assert_cmpuint (g_bytes_get_size (payload), ==, 3);
+  g_assert_cmpint (memcmp (g_bytes_get_data (payload, NULL), "one", 3), ==, 0);
+}
+
+/* Test that statistics are recorded and can be reset. */
+static void
+test_socket_queue_stats (void)
+{
+  g_autoptr(GtSocketQueue) queue = NULL;
+  g_autoptr(GSocketConnection) client = NULL;
+  g_autofree gchar *stats = NULL;
+  gdouble frames_per_second = 0.0, bytes_per_second = 0.0;
+  g_autoptr(GError) local_error = NULL;
+
+  queue = gt_socket_queue_new ();
+  gt_socket_queue_start (queue, &local_error);
+  g_assert_no_error (local_error);
+
+  g_assert_false (gt_socket_queue_get_throughput (queue, NULL, NULL));
+  g_assert_cmpuint (gt_socket_queue_get_reply_latency_ns (queue, 50.0), ==, 0);
+
+  client = connect_client (queue);
+
+  for (gsize i = 0; i < 3; i++)
+    {
+      g_autoptr(GtSocketQueueFrame) frame = NULL;
+
+      client_write (client, "request\n", strlen ("request\n"));
+      frame = gt_socket_queue_assert_pop_frame (queue, "request", -1);
+      g_usleep (1000);
+      gt_socket_queue_frame_reply (frame, "reply\n", -1);
+      client_assert_read (client, "reply\n");
+    }
+
+  g_assert_cmpuint (gt_socket_queue_get_n_frames_received (queue), ==, 3);
+  g_assert_true (gt_socket_queue_get_throughput (queue, &frames_per_second,
+                                                 &bytes_per_second));
+  g_assert_cmpfloat (frames_per_second, >, 0.0);
+  g_assert_cmpfloat (bytes_per_second, >, frames_per_second);
+  g_assert_cmpuint (gt_socket_queue_get_reply_latency_ns (queue, 50.0), >=, 1000000);
+  g_assert_cmpuint (gt_socket_queue_get_reply_latency_ns (queue, 100.0), >=,
+                    gt_socket_queue_get_reply_latency_ns (queue, 50.0));
+
+  stats = gt_socket_queue_format_stats (queue);
+  g_assert_nonnull (strstr (stats, "Frames received: 3"));
+  g_assert_nonnull (strstr (stats, "Reply latency: 3 replies"));
+
+  gt_socket_queue_reset_stats (queue);
+  g_assert_cmpuint (gt_socket_queue_get_n_frames_received (queue), ==, 0);
+  g_assert_cmpuint (gt_socket_queue_get_n_bytes_sent (queue), ==, 0);
+  g_assert_cmpuint (gt_socket_queue_get_reply_latency_ns (queue, 100.0), ==, 0);
+}
+
+int
+main (int   argc,
+      char *argv[])
+{
+  setlocale (LC_ALL, "");
+
+  g_test_init (&argc, &argv, NULL);
+
+  g_test_add_func ("/socket-queue/construction", test_socket_queue_construction);
+  g_test_add_func ("/socket-queue/lines", test_socket_queue_lines);
+  g_test_add_func ("/socket-queue/length-prefixed", test_socket_queue_length_prefixed);
+  g_test_add_func ("/socket-queue/payload-lifetime", test_socket_queue_payload_lifetime);
+  g_test_add_func ("/socket-queue/stats", test_socket_queue_stats);
+
+  return g_test_run ();
+}
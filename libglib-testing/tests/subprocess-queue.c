@@ -0,0 +1,260 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ *
+ * Copyright © 2018 Endless Mobile, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#include <gio/gio.h>
+#include <glib.h>
+#include <libglib-testing/subprocess-queue.h>
+#include <locale.h>
+#include <string.h>
+
+
+/* Start @queue and intercept `fake-tool` and `other-tool` with it, skipping
+ * the test if the shim isn’t available. Returns %FALSE if the test was
+ * skipped. */
+static gboolean
+start_queue (GtSubprocessQueue *queue)
+{
+  g_autoptr(GError) local_error = NULL;
+
+  if (!gt_subprocess_queue_start (queue, &local_error) &&
+      g_error_matches (local_error, G_IO_ERROR, G_IO_ERROR_NOT_FOUND))
+    {
+      g_test_skip (local_error->message);
+      return FALSE;
+    }
+  g_assert_no_error (local_error);
+
+  gt_subprocess_queue_add_program (queue, "fake-tool", &local_error);
+  g_assert_no_error (local_error);
+  gt_subprocess_queue_add_program (queue, "other-tool", &local_error);
+  g_assert_no_error (local_error);
+
+  return TRUE;
+}
+
+static void
+async_result_cb (GObject      *obj,
+                 GAsyncResult *result,
+                 gpointer      user_data)
+{
+  GAsyncResult **result_out = user_data;
+
+  g_assert_null (*result_out);
+  *result_out = g_object_ref (result);
+}
+
+/* Spawn @argv using @launcher and start communicating with it. Its result is
+ * returned in @out_result once it has exited. */
+static GSubprocess *
+spawn_async (GSubprocessLauncher  *launcher,
+             const gchar * const  *argv,
+             GAsyncResult        **out_result)
+{
+  g_autoptr(GSubprocess) subprocess = NULL;
+  g_autoptr(GError) local_error = NULL;
+
+  subprocess = g_subprocess_launcher_spawnv (launcher, argv, &local_error);
+  g_assert_no_error (local_error);
+
+  g_subprocess_communicate_utf8_async (subprocess, NULL, NULL,
+                                       async_result_cb, out_result);
+
+  return g_steal_pointer (&subprocess);
+}
+
+/* Test that creating and destroying a subprocess queue works. A basic
+ * smoketest. */
+static void
+test_subprocess_queue_construction (void)
+{
+  g_autoptr(GtSubprocessQueue) queue = NULL;
+  g_auto(GStrv) envp = NULL;
+  g_autofree gchar *link_path = NULL;
+
+  queue = gt_subprocess_queue_new ();
+  g_assert_null (gt_subprocess_queue_get_shim_dir (queue));
+
+  if (!start_queue (queue))
+    return;
+
+  g_assert_nonnull (gt_subprocess_queue_get_shim_dir (queue));
+  link_path = g_build_filename (gt_subprocess_queue_get_shim_dir (queue),
+                                "fake-tool", NULL);
+  g_assert_true (g_file_test (link_path, G_FILE_TEST_IS_EXECUTABLE));
+
+  envp = gt_subprocess_queue_get_environ (queue, NULL);
+  g_assert_cmpstr (g_environ_getenv (envp, "PATH"), ==,
+                   gt_subprocess_queue_get_shim_dir (queue));
+
+  gt_subprocess_queue_assert_no_spawns (queue);
+  g_assert_false (gt_subprocess_queue_try_pop_spawn (queue, NULL));
+  g_assert_cmpuint (gt_subprocess_queue_get_n_spawns (queue, NULL), ==, 0);
+
+  gt_subprocess_queue_stop (queue);
+  g_assert_false (g_file_test (link_path, G_FILE_TEST_EXISTS));
+}
+
+/* Test that a spawn is intercepted and can be replied to with canned output
+ * and an exit status. */
+static void
+test_subprocess_queue_reply (void)
+{
+  g_autoptr(GtSubprocessQueue) queue = NULL;
+  g_autoptr(GSubprocessLauncher) launcher = NULL;
+  g_autoptr(GSubprocess) subprocess = NULL;
+  g_autoptr(GtSubprocessQueueSpawn) spawn = NULL;
+  g_autoptr(GAsyncResult) result = NULL;
+  g_autofree gchar *stdout_text = NULL;
+  g_autofree gchar *stderr_text = NULL;
+  const gchar * const argv[] = { "fake-tool", "--flag", "an argument", NULL };
+  g_autoptr(GError) local_error = NULL;
+
+  queue = gt_subprocess_queue_new ();
+  if (!start_queue (queue))
+    return;
+
+  launcher = gt_subprocess_queue_new_launcher (queue,
+                                               G_SUBPROCESS_FLAGS_STDOUT_PIPE |
+                                               G_SUBPROCESS_FLAGS_STDERR_PIPE);
+  g_subprocess_launcher_setenv (launcher, "FAKE_TOOL_MODE", "test", TRUE);
+  g_subprocess_launcher_set_cwd (launcher, "/");
+
+  subprocess = spawn_async (launcher, argv, &result);
+
+  spawn = gt_subprocess_queue_assert_pop_spawn (queue, "fake-tool", "--flag",
+                                                "an argument", NULL);
+  g_assert_cmpstr (gt_subprocess_queue_spawn_get_program (spawn), ==, "fake-tool");
+  g_assert_cmpstr (gt_subprocess_queue_spawn_get_cwd (spawn), ==, "/");
+  g_assert_cmpstr (g_environ_getenv ((gchar **) gt_subprocess_queue_spawn_get_environ (spawn),
+                                     "FAKE_TOOL_MODE"), ==, "test");
+  gt_subprocess_queue_spawn_reply (spawn, "some output\n", "a warning\n", 3);
+
+  while (result == NULL)
+    g_main_context_iteration (NULL, TRUE);
+
+  g_subprocess_communicate_utf8_finish (subprocess, result, &stdout_text,
+                                        &stderr_text, &local_error);
+  g_assert_no_error (local_error);
+  g_assert_cmpstr (stdout_text, ==, "some output\n");
+  g_assert_cmpstr (stderr_text, ==, "a warning\n");
+  g_assert_true (g_subprocess_get_if_exited (subprocess));
+  g_assert_cmpint (g_subprocess_get_exit_status (subprocess), ==, 3);
+
+  gt_subprocess_queue_assert_no_spawns (queue);
+}
+
+/* Test that spawns are counted per program, and that their latency is
+ * recorded. */
+static void
+test_subprocess_queue_counts (void)
+{
+  g_autoptr(GtSubprocessQueue) queue = NULL;
+  g_autoptr(GSubprocessLauncher) launcher = NULL;
+  g_autofree gchar *counts = NULL;
+  const gchar * const fake_argv[] = { "fake-tool", NULL };
+  const gchar * const other_argv[] = { "other-tool", "--version", NULL };
+  const gchar * const * const argvs[] = { fake_argv, other_argv, fake_argv };
+
+  queue = gt_subprocess_queue_new ();
+  if (!start_queue (queue))
+    return;
+
+  launcher = gt_subprocess_queue_new_launcher (queue, G_SUBPROCESS_FLAGS_NONE);
+
+  for (gsize i = 0; i < G_N_ELEMENTS (argvs); i++)
+    {
+      g_autoptr(GSubprocess) subprocess = NULL;
+      g_autoptr(GtSubprocessQueueSpawn) spawn = NULL;
+      g_autoptr(GError) local_error = NULL;
+
+      subprocess = g_subprocess_launcher_spawnv (launcher, argvs[i], &local_error);
+      g_assert_no_error (local_error);
+
+      g_assert_true (gt_subprocess_queue_pop_spawn (queue, &spawn));
+      g_assert_cmpstr (gt_subprocess_queue_spawn_get_program (spawn), ==, argvs[i][0]);
+      gt_subprocess_queue_spawn_reply (spawn, NULL, NULL, 0);
+
+      g_subprocess_wait_check (subprocess, NULL, &local_error);
+      g_assert_no_error (local_error);
+    }
+
+  g_assert_cmpuint (gt_subprocess_queue_get_n_spawns (queue, NULL), ==, 3);
+  g_assert_cmpuint (gt_subprocess_queue_get_n_spawns (queue, "fake-tool"), ==, 2);
+  g_assert_cmpuint (gt_subprocess_queue_get_n_spawns (queue, "other-tool"), ==, 1);
+  g_assert_cmpuint (gt_subprocess_queue_get_n_spawns (queue, "missing-tool"), ==, 0);
+  gt_subprocess_queue_assert_spawns_at_most (queue, NULL, 3);
+  gt_subprocess_queue_assert_spawns_at_most (queue, "other-tool", 1);
+
+  g_assert_cmpuint (gt_subprocess_queue_get_spawn_latency_ns (queue, 50.0), >, 0);
+  g_assert_cmpuint (gt_subprocess_queue_get_spawn_latency_ns (queue, 100.0), >=,
+                    gt_subprocess_queue_get_spawn_latency_ns (queue, 50.0));
+
+  counts = gt_subprocess_queue_format_counts (queue);
+  g_assert_nonnull (strstr (counts, "fake-tool: 2 spawns"));
+
+  gt_subprocess_queue_reset_counts (queue);
+  g_assert_cmpuint (gt_subprocess_queue_get_n_spawns (queue, NULL), ==, 0);
+  g_assert_cmpuint (gt_subprocess_queue_get_spawn_latency_ns (queue, 100.0), ==, 0);
+}
+
+/* Test that a shim which is never replied to exits when the queue is
+ * stopped. */
+static void
+test_subprocess_queue_stop_unanswered (void)
+{
+  g_autoptr(GtSubprocessQueue) queue = NULL;
+  g_autoptr(GSubprocessLauncher) launcher = NULL;
+  g_autoptr(GSubprocess) subprocess = NULL;
+  const gchar * const argv[] = { "fake-tool", NULL };
+  g_autoptr(GError) local_error = NULL;
+
+  queue = gt_subprocess_queue_new ();
+  if (!start_queue (queue))
+    return;
+
+  launcher = gt_subprocess_queue_new_launcher (queue, G_SUBPROCESS_FLAGS_STDERR_SILENCE);
+  subprocess = g_subprocess_launcher_spawnv (launcher, argv, &local_error);
+  g_assert_no_error (local_error);
+
+  /* Wait for the spawn to arrive, but don’t reply to it. */
+  g_assert_true (gt_subprocess_queue_pop_spawn (queue, NULL));
+  gt_subprocess_queue_stop (queue);
+
+  g_subprocess_wait (subprocess, NULL, &local_error);
+  g_assert_no_error (local_error);
+  g_assert_true (g_subprocess_get_if_exited (subprocess));
+  g_assert_cmpint (g_subprocess_get_exit_status (subprocess), ==, 127);
+}
+
+int
+main (int   argc,
+      char *argv[])
+{
+  setlocale (LC_ALL, "");
+
+  g_test_init (&argc, &argv, NULL);
+
+  g_test_add_func ("/subprocess-queue/construction", test_subprocess_queue_construction);
+  g_test_add_func ("/subprocess-queue/reply", test_subprocess_queue_reply);
+  g_test_add_func ("/subprocess-queue/counts", test_subprocess_queue_counts);
+  g_test_add_func ("/subprocess-queue/stop-unanswered", test_subprocess_queue_stop_unanswered);
+
+  return g_test_run ();
+}
@@ -0,0 +1,221 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ *
+ * Copyright © 2018 Endless Mobile, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#include <gio/gio.h>
+#include <glib.h>
+#include <glib/gstdio.h>
+#include <libglib-testing/test-runner.h>
+#include <locale.h>
+#include <signal.h>
+#include <string.h>
+#include <unistd.h>
+
+
+/* These test cases are run by gt_test_run_parallel(), with `GT_TEST_JOBS` set
+ * by the build system and the installed test metadata, so each should be run
+ * in a worker process. */
+static void
+test_test_runner_worker (void)
+{
+  g_assert_nonnull (g_getenv ("GT_TEST_PARALLEL_WORKER"));
+}
+
+/* Sleep for a while, so that the test cases have different durations for the
+ * runner to balance between the workers. */
+static void
+test_test_runner_sleep (gconstpointer test_data)
+{
+  g_test_message ("Sleeping in PID %d", (gint) getpid ());
+  g_usleep (GPOINTER_TO_UINT (test_data) * 1000);
+}
+
+static void
+test_test_runner_skip (void)
+{
+  g_test_skip ("Skipped deliberately");
+}
+
+/* Test that subprocess tests still work in a worker. */
+static void
+test_test_runner_subprocess (void)
+{
+  if (g_test_subprocess ())
+    {
+      g_printerr ("in subprocess");
+      return;
+    }
+
+  g_test_trap_subprocess (NULL, 0, 0);
+  g_test_trap_assert_passed ();
+  g_test_trap_assert_stderr ("in subprocess");
+}
+
+/* Environment variable which test_test_runner_crash() sets to run this program
+ * with the test cases below instead. */
+#define CRASH_ENV_VAR "TEST_RUNNER_CRASH"
+
+static void
+test_crash_crash (void)
+{
+  raise (SIGKILL);
+}
+
+static void
+test_crash_ok (void)
+{
+  g_test_message ("Running in PID %d", (gint) getpid ());
+}
+
+/* The crash test cases are all given the same duration, so the runner assigns
+ * them to its two workers alternately, and the first worker has two test cases
+ * left to run when it crashes. */
+static const gchar * const crash_test_paths[] =
+{
+  "/crash/crash",
+  "/crash/ok/1",
+  "/crash/ok/2",
+  "/crash/ok/3",
+  "/crash/ok/4",
+  "/crash/ok/5",
+};
+
+/* Run this program with the crash test cases, and return the TAP result lines
+ * from its output. */
+static gchar *
+run_crash_tests (const gchar *durations_path)
+{
+  g_autoptr(GSubprocessLauncher) launcher = NULL;
+  g_autoptr(GSubprocess) subprocess = NULL;
+  g_autofree gchar *program = NULL;
+  g_autofree gchar *stdout_buf = NULL;
+  g_auto(GStrv) lines = NULL;
+  g_autoptr(GString) results = g_string_new ("");
+  g_autoptr(GError) local_error = NULL;
+
+  program = g_file_read_link ("/proc/self/exe", &local_error);
+  g_assert_no_error (local_error);
+
+  launcher = g_subprocess_launcher_new (G_SUBPROCESS_FLAGS_STDOUT_PIPE);
+  g_subprocess_launcher_unsetenv (launcher, "GT_TEST_PARALLEL_WORKER");
+  g_subprocess_launcher_setenv (launcher, CRASH_ENV_VAR, "1", TRUE);
+  g_subprocess_launcher_setenv (launcher, "GT_TEST_JOBS", "2", TRUE);
+  g_subprocess_launcher_setenv (launcher, "GT_TEST_DURATIONS", durations_path, TRUE);
+
+  subprocess = g_subprocess_launcher_spawn (launcher, &local_error, program, NULL);
+  g_assert_no_error (local_error);
+
+  g_subprocess_communicate_utf8 (subprocess, NULL, NULL, &stdout_buf, NULL, &local_error);
+  g_assert_no_error (local_error);
+  g_test_message ("%s", stdout_buf);
+
+  /* The crash is reported as a failure. */
+  g_assert_true (g_subprocess_get_if_exited (subprocess));
+  g_assert_cmpint (g_subprocess_get_exit_status (subprocess), ==, 1);
+  g_assert_nonnull (strstr (stdout_buf, "# Worker was killed by signal"));
+
+  lines = g_strsplit (stdout_buf, "\n", -1);
+  for (gsize i = 0; lines[i] != NULL; i++)
+    {
+      if (g_str_has_prefix (lines[i], "ok ") || g_str_has_prefix (lines[i], "not ok "))
+        g_string_append_printf (results, "%s\n", lines[i]);
+    }
+
+  return g_string_free (g_steal_pointer (&results), FALSE);
+}
+
+/* Test that when a worker crashes, the test case it was running is reported as
+ * failed, the test cases it had not run yet are retried in a new worker, and
+ * the merged results are in registration order every time. */
+static void
+test_test_runner_crash (void)
+{
+  g_autofree gchar *tmp_dir = NULL;
+  g_autofree gchar *durations_path = NULL;
+  g_autoptr(GString) durations = g_string_new ("[Durations]\n");
+  g_autoptr(GString) expected = g_string_new ("");
+  g_autofree gchar *results1 = NULL;
+  g_autofree gchar *results2 = NULL;
+  g_autoptr(GError) local_error = NULL;
+
+  if (!g_file_test ("/proc/self/exe", G_FILE_TEST_EXISTS))
+    {
+      g_test_skip ("Test cases are only run in parallel on Linux");
+      return;
+    }
+
+  tmp_dir = g_dir_make_tmp ("libglib-testing-test-runner-XXXXXX", &local_error);
+  g_assert_no_error (local_error);
+  durations_path = g_build_filename (tmp_dir, "durations", NULL);
+
+  for (gsize i = 0; i < G_N_ELEMENTS (crash_test_paths); i++)
+    {
+      g_string_append_printf (durations, "%s=0.01\n", crash_test_paths[i]);
+      g_string_append_printf (expected, "%s %" G_GSIZE_FORMAT " %s\n",
+                              (i == 0) ? "not ok" : "ok", i + 1,
+                              crash_test_paths[i]);
+    }
+
+  g_file_set_contents (durations_path, durations->str, -1, &local_error);
+  g_assert_no_error (local_error);
+
+  results1 = run_crash_tests (durations_path);
+  g_assert_cmpstr (results1, ==, expected->str);
+
+  /* Running them again gives the same results in the same order. */
+  g_file_set_contents (durations_path, durations->str, -1, &local_error);
+  g_assert_no_error (local_error);
+
+  results2 = run_crash_tests (durations_path);
+  g_assert_cmpstr (results2, ==, results1);
+
+  g_unlink (durations_path);
+  g_rmdir (tmp_dir);
+}
+
+int
+main (int   argc,
+      char *argv[])
+{
+  setlocale (LC_ALL, "");
+
+  g_test_init (&argc, &argv, NULL);
+
+  if (g_getenv (CRASH_ENV_VAR) != NULL)
+    {
+      g_test_add_func (crash_test_paths[0], test_crash_crash);
+      for (gsize i = 1; i < G_N_ELEMENTS (crash_test_paths); i++)
+        g_test_add_func (crash_test_paths[i], test_crash_ok);
+
+      return gt_test_run_parallel ();
+    }
+
+  g_test_add_func ("/test-runner/worker", test_test_runner_worker);
+  g_test_add_data_func ("/test-runner/sleep/short", GUINT_TO_POINTER (10),
+                        test_test_runner_sleep);
+  g_test_add_data_func ("/test-runner/sleep/medium", GUINT_TO_POINTER (100),
+                        test_test_runner_sleep);
+  g_test_add_data_func ("/test-runner/sleep/long", GUINT_TO_POINTER (200),
+                        test_test_runner_sleep);
+  g_test_add_func ("/test-runner/skip", test_test_runner_skip);
+  g_test_add_func ("/test-runner/subprocess", test_test_runner_subprocess);
+  g_test_add_func ("/test-runner/crash", test_test_runner_crash);
+
+  return gt_test_run_parallel ();
+}
@@ -0,0 +1,153 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ *
+ * Copyright © 2018 Endless Mobile, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#include <glib.h>
+#include <libglib-testing/virtual-clock.h>
+#include <locale.h>
+
+
+/* Test that creating and destroying a virtual clock works. A basic smoketest. */
+static void
+test_virtual_clock_construction (void)
+{
+  g_autoptr(GtVirtualClock) vclock = NULL;
+  vclock = gt_virtual_clock_new (NULL);
+
+  g_assert_cmpint (gt_virtual_clock_get_offset (vclock), ==, 0);
+}
+
+static gboolean
+append_id_cb (gpointer user_data)
+{
+  GArray *fired = user_data;
+  guint id = g_source_get_id (g_main_current_source ());
+
+  g_array_append_val (fired, id);
+
+  return G_SOURCE_REMOVE;
+}
+
+/* Test that long timeouts fire without waiting for them in real time, and that
+ * they fire in the order of their timeouts rather than the order they were
+ * added in. */
+static void
+test_virtual_clock_auto_advance (void)
+{
+  g_autoptr(GMainContext) context = g_main_context_new ();
+  g_autoptr(GtVirtualClock) vclock = NULL;
+  g_autoptr(GArray) fired = g_array_new (FALSE, FALSE, sizeof (guint));
+  const guint timeouts_s[] = { 30, 10, 20 };
+  guint ids[G_N_ELEMENTS (timeouts_s)];
+  gint64 start_time, end_time;
+
+  vclock = gt_virtual_clock_new (context);
+
+  for (gsize i = 0; i < G_N_ELEMENTS (timeouts_s); i++)
+    {
+      g_autoptr(GSource) source = g_timeout_source_new_seconds (timeouts_s[i]);
+      g_source_set_callback (source, append_id_cb, fired, NULL);
+      ids[i] = g_source_attach (source, context);
+    }
+
+  start_time = g_get_monotonic_time ();
+
+  while (fired->len < G_N_ELEMENTS (timeouts_s))
+    g_main_context_iteration (context, TRUE);
+
+  end_time = g_get_monotonic_time ();
+
+  g_assert_cmpuint (g_array_index (fired, guint, 0), ==, ids[1]);
+  g_assert_cmpuint (g_array_index (fired, guint, 1), ==, ids[2]);
+  g_assert_cmpuint (g_array_index (fired, guint, 2), ==, ids[0]);
+
+  /* Virtual time should have advanced by about 30s, while real time should
+   * have advanced by much less. */
+  g_assert_cmpint (gt_virtual_clock_get_offset (vclock), >=, 29 * G_USEC_PER_SEC);
+  g_assert_cmpint (end_time - start_time, <, 10 * G_USEC_PER_SEC);
+}
+
+/* Test that virtual time is only advanced manually when auto-advance is
+ * disabled. */
+static void
+test_virtual_clock_manual_advance (void)
+{
+  g_autoptr(GMainContext) context = g_main_context_new ();
+  g_autoptr(GtVirtualClock) vclock = NULL;
+  g_autoptr(GArray) fired = g_array_new (FALSE, FALSE, sizeof (guint));
+  g_autoptr(GSource) source1 = NULL;
+  g_autoptr(GSource) source2 = NULL;
+  guint id1, id2;
+
+  vclock = gt_virtual_clock_new (context);
+  gt_virtual_clock_set_auto_advance (vclock, FALSE);
+
+  source1 = g_timeout_source_new (60 * 1000);
+  g_source_set_callback (source1, append_id_cb, fired, NULL);
+  id1 = g_source_attach (source1, context);
+
+  source2 = g_timeout_source_new (120 * 1000);
+  g_source_set_callback (source2, append_id_cb, fired, NULL);
+  id2 = g_source_attach (source2, context);
+
+  /* Nothing should fire on its own. */
+  g_usleep (50 * 1000);
+  while (g_main_context_iteration (context, FALSE));
+  g_assert_cmpuint (fired->len, ==, 0);
+
+  /* Advancing by less than the first timeout should not fire anything. */
+  gt_virtual_clock_advance (vclock, 30 * G_USEC_PER_SEC);
+  while (g_main_context_iteration (context, FALSE));
+  g_assert_cmpuint (fired->len, ==, 0);
+
+  /* Advancing to the next timeout should fire only it. */
+  g_assert_true (gt_virtual_clock_advance_to_next (vclock));
+  while (g_main_context_iteration (context, FALSE));
+  g_assert_cmpuint (fired->len, ==, 1);
+  g_assert_cmpuint (g_array_index (fired, guint, 0), ==, id1);
+
+  g_assert_true (gt_virtual_clock_advance_to_next (vclock));
+  while (g_main_context_iteration (context, FALSE));
+  g_assert_cmpuint (fired->len, ==, 2);
+  g_assert_cmpuint (g_array_index (fired, guint, 1), ==, id2);
+
+  /* No timeouts are left. */
+  g_assert_false (gt_virtual_clock_advance_to_next (vclock));
+  g_assert_cmpint (gt_virtual_clock_get_offset (vclock), >=, 119 * G_USEC_PER_SEC);
+  g_assert_cmpint (gt_virtual_clock_get_time (vclock), >=,
+                   g_get_monotonic_time () + 119 * G_USEC_PER_SEC);
+}
+
+int
+main (int   argc,
+      char *argv[])
+{
+  setlocale (LC_ALL, "");
+
+  g_test_init (&argc, &argv, NULL);
+
+  g_test_add_func ("/virtual-clock/construction",
+                   test_virtual_clock_construction);
+  g_test_add_func ("/virtual-clock/auto-advance",
+                   test_virtual_clock_auto_advance);
+  g_test_add_func ("/virtual-clock/manual-advance",
+                   test_virtual_clock_manual_advance);
+
+  return g_test_run ();
+}
@@ -0,0 +1,503 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ *
+ * Copyright © 2018 Endless Mobile, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#include "config.h"
+
+#include <glib.h>
+#include <libglib-testing/main-context-profiler-private.h>
+#include <libglib-testing/source-tracker-private.h>
+#include <libglib-testing/virtual-clock.h>
+
+
+/**
+ * SECTION:virtual-clock
+ * @short_description: Virtual time for timeout sources in a main context
+ * @stability: Unstable
+ * @include: libglib-testing/virtual-clock.h
+ *
+ * #GtVirtualClock allows code which uses timeouts to be tested without waiting
+ * for those timeouts in real time. It is installed on a #GMainContext, and
+ * whenever that context is otherwise idle, it advances virtual time to the
+ * next pending timeout source (as created by g_timeout_add() or
+ * g_timeout_source_new(), for example) so that it fires immediately. A test of
+ * a 30 second retry policy then runs in milliseconds, and the timeouts still
+ * fire in the same order as they would have done in real time.
+ *
+ * The context is considered idle once it has gone for the idle threshold (see
+ * gt_virtual_clock_set_idle_threshold()) without any other source becoming
+ * ready. This gives in-flight work, such as D-Bus replies coming from another
+ * thread, a chance to arrive before time is advanced past the timeouts which
+ * are waiting for them.
+ *
+ * Virtual time can also be advanced manually, using gt_virtual_clock_advance()
+ * or gt_virtual_clock_advance_to_next(), optionally with automatic advancing
+ * disabled using gt_virtual_clock_set_auto_advance().
+ *
+ * Virtual time only affects the timeout sources in the context: advancing it
+ * by some amount makes all the timeout sources in the context fire that much
+ * sooner. It does not affect g_get_monotonic_time(), so code under test which
+ * measures time itself will see real time. The current virtual time is
+ * available from gt_virtual_clock_get_time().
+ *
+ * To make a #GtDBusQueue’s delayed replies (from
+ * gt_dbus_queue_return_value_delayed()) respect virtual time, install a
+ * #GtVirtualClock on the context returned by
+ * gt_dbus_queue_get_server_context(). Installing one on the client context
+ * affects timeouts in the code under test while the test is blocked in
+ * gt_dbus_queue_pop_message() or similar.
+ *
+ * Only one #GtVirtualClock may be installed on a given #GMainContext at once.
+ *
+ * Since: 0.2.0
+ */
+
+/**
+ * GtVirtualClock:
+ *
+ * A virtual monotonic clock which controls when the timeout sources in a
+ * #GMainContext fire.
+ *
+ * Since: 0.2.0
+ */
+struct _GtVirtualClock
+{
+  GMainContext *context;  /* (owned) */
+  GSource *advance_source;  /* (owned) */
+};
+
+/* Lowest priority source which advances virtual time to the next pending
+ * timeout source once the context has been idle for the idle threshold.
+ *
+ * The clock’s state is stored here, rather than in #GtVirtualClock, so that
+ * it remains valid while the source is being prepared or dispatched in another
+ * thread (which holds a reference to the source) as gt_virtual_clock_free() is
+ * called. */
+typedef struct
+{
+  GSource source;
+
+  GMutex lock;
+  gint64 offset_us;  /* (locked-by lock); virtual time minus real time */
+  gboolean auto_advance;  /* (locked-by lock) */
+  guint idle_threshold_ms;  /* (locked-by lock) */
+
+  /* The timeout sources in the context. This has its own lock. */
+  GtSourceTracker *timeouts;  /* (owned) */
+
+  /* Only accessed from the thread iterating the context: */
+  gint64 prepare_time_us;
+  gboolean have_timers;
+  guint prepare_idle_threshold_ms;
+} AdvanceSource;
+
+/* Timeout sources are identified by their original #GSourceFuncs, in case a
+ * #GtMainContextProfiler has wrapped them. */
+static gboolean
+is_timeout_source (GSource  *source,
+                   gpointer  user_data)
+{
+  return (gt_main_context_profiler_get_source_funcs (source) == &g_timeout_funcs);
+}
+
+static void
+find_next_ready_time_cb (gpointer data,
+                         gpointer user_data)
+{
+  GSource *source = data;
+  gint64 *next_ready_time = user_data;
+  gint64 ready_time;
+
+  if (g_source_is_destroyed (source))
+    return;
+
+  ready_time = g_source_get_ready_time (source);
+
+  if (ready_time >= 0 && (*next_ready_time < 0 || ready_time < *next_ready_time))
+    *next_ready_time = ready_time;
+}
+
+/* Find the ready time of the pending timeout source which is due to fire
+ * soonest. Returns -1 if there are none. */
+static gint64
+advance_source_get_next_ready_time (AdvanceSource *self)
+{
+  gint64 next_ready_time = -1;
+
+  gt_source_tracker_update (self->timeouts);
+  gt_source_tracker_foreach (self->timeouts, find_next_ready_time_cb, &next_ready_time);
+
+  return next_ready_time;
+}
+
+static void
+bring_forward_cb (gpointer data,
+                  gpointer user_data)
+{
+  GSource *source = data;
+  gint64 delta_us = *((const gint64 *) user_data);
+  gint64 ready_time;
+
+  if (g_source_is_destroyed (source))
+    return;
+
+  ready_time = g_source_get_ready_time (source);
+
+  /* A ready time of 0 means ‘immediately’. */
+  if (ready_time >= 0)
+    g_source_set_ready_time (source, MAX (ready_time - delta_us, 0));
+}
+
+/* Advance virtual time by @delta_us, by bringing forward the ready times of
+ * all the timeout sources in @context. */
+static void
+advance_source_advance (AdvanceSource *self,
+                        GMainContext  *context,
+                        gint64         delta_us)
+{
+  g_mutex_lock (&self->lock);
+  self->offset_us += delta_us;
+  g_mutex_unlock (&self->lock);
+
+  gt_source_tracker_update (self->timeouts);
+  gt_source_tracker_foreach (self->timeouts, bring_forward_cb, &delta_us);
+
+  g_main_context_wakeup (context);
+}
+
+/* Advance virtual time to the ready time of the next timeout source in
+ * @context, if it’s in the future. Returns %FALSE if there are no timeout
+ * sources. */
+static gboolean
+advance_source_advance_to_next (AdvanceSource *self,
+                                GMainContext  *context)
+{
+  gint64 next_ready_time, now;
+
+  next_ready_time = advance_source_get_next_ready_time (self);
+  if (next_ready_time < 0)
+    return FALSE;
+
+  now = g_get_monotonic_time ();
+  if (next_ready_time > now)
+    advance_source_advance (self, context, next_ready_time - now);
+
+  return TRUE;
+}
+
+static gboolean
+advance_source_prepare (GSource *source,
+                        gint    *timeout)
+{
+  AdvanceSource *self = (AdvanceSource *) source;
+  gboolean auto_advance;
+  gint64 next_ready_time;
+
+  g_mutex_lock (&self->lock);
+  auto_advance = self->auto_advance;
+  self->prepare_idle_threshold_ms = self->idle_threshold_ms;
+  g_mutex_unlock (&self->lock);
+
+  *timeout = -1;
+  self->have_timers = FALSE;
+
+  if (!auto_advance)
+    return FALSE;
+
+  /* If the next timer is already due, it will fire by itself. */
+  next_ready_time = advance_source_get_next_ready_time (self);
+  self->prepare_time_us = g_get_monotonic_time ();
+  self->have_timers = (next_ready_time > self->prepare_time_us);
+
+  if (self->have_timers)
+    *timeout = (gint) self->prepare_idle_threshold_ms;
+
+  return FALSE;
+}
+
+static gboolean
+advance_source_check (GSource *source)
+{
+  AdvanceSource *self = (AdvanceSource *) source;
+  gint64 idle_time_us;
+
+  if (!self->have_timers)
+    return FALSE;
+
+  /* If the poll() in this main context iteration waited for the whole idle
+   * threshold, nothing else happened in the meantime. Allow for the poll
+   * timeout having been rounded to milliseconds. */
+  idle_time_us = g_get_monotonic_time () - self->prepare_time_us;
+
+  return (idle_time_us + 1000 >= (gint64) self->prepare_idle_threshold_ms * 1000);
+}
+
+static gboolean
+advance_source_dispatch (GSource     *source,
+                         GSourceFunc  callback,
+                         gpointer     user_data)
+{
+  AdvanceSource *self = (AdvanceSource *) source;
+
+  advance_source_advance_to_next (self, g_source_get_context (source));
+  self->have_timers = FALSE;
+
+  return G_SOURCE_CONTINUE;
+}
+
+static void
+advance_source_finalize (GSource *source)
+{
+  AdvanceSource *self = (AdvanceSource *) source;
+
+  g_clear_pointer (&self->timeouts, gt_source_tracker_free);
+  g_mutex_clear (&self->lock);
+}
+
+static GSourceFuncs advance_source_funcs =
+{
+  advance_source_prepare,
+  advance_source_check,
+  advance_source_dispatch,
+  advance_source_finalize,
+  NULL,
+  NULL,
+};
+
+/**
+ * gt_virtual_clock_new:
+ * @context: (nullable): a #GMainContext to install the clock on, or %NULL to
+ *    use the global default main context
+ *
+ * Create a new #GtVirtualClock and install it on @context. Virtual time starts
+ * equal to real monotonic time, and automatic advancing is enabled with an
+ * idle threshold of 5ms.
+ *
+ * Returns: (transfer full): a new #GtVirtualClock
+ * Since: 0.2.0
+ */
+GtVirtualClock *
+gt_virtual_clock_new (GMainContext *context)
+{
+  g_autoptr(GtVirtualClock) vclock = NULL;
+  AdvanceSource *advance_source;
+
+  vclock = g_new0 (GtVirtualClock, 1);
+  vclock->context = (context != NULL) ? g_main_context_ref (context) : g_main_context_ref (g_main_context_default ());
+
+  vclock->advance_source = g_source_new (&advance_source_funcs, sizeof (AdvanceSource));
+  advance_source = (AdvanceSource *) vclock->advance_source;
+  g_mutex_init (&advance_source->lock);
+  advance_source->auto_advance = TRUE;
+  advance_source->idle_threshold_ms = 5;
+  advance_source->timeouts = gt_source_tracker_new (vclock->context, is_timeout_source, NULL);
+
+  g_source_set_priority (vclock->advance_source, G_MAXINT);
+  g_source_set_name (vclock->advance_source, "GtVirtualClock advance");
+  g_source_attach (vclock->advance_source, vclock->context);
+
+  return g_steal_pointer (&vclock);
+}
+
+/**
+ * gt_virtual_clock_free:
+ * @self: (transfer full): a #GtVirtualClock
+ *
+ * Uninstall a #GtVirtualClock from its #GMainContext and free it. Any pending
+ * timeout sources in the context will keep the ready times they had, so will
+ * continue to fire at the virtual times they were scheduled for.
+ *
+ * Since: 0.2.0
+ */
+void
+gt_virtual_clock_free (GtVirtualClock *self)
+{
+  g_return_if_fail (self != NULL);
+
+  if (self->advance_source != NULL)
+    g_source_destroy (self->advance_source);
+  g_clear_pointer (&self->advance_source, g_source_unref);
+  g_clear_pointer (&self->context, g_main_context_unref);
+
+  g_free (self);
+}
+
+/**
+ * gt_virtual_clock_get_time:
+ * @self: a #GtVirtualClock
+ *
+ * Get the current virtual monotonic time. This is the real monotonic time (as
+ * returned by g_get_monotonic_time()) plus the total amount virtual time has
+ * been advanced by.
+ *
+ * This may be called from any thread.
+ *
+ * Returns: current virtual time, in microseconds
+ * Since: 0.2.0
+ */
+gint64
+gt_virtual_clock_get_time (GtVirtualClock *self)
+{
+  g_return_val_if_fail (self != NULL, 0);
+
+  return g_get_monotonic_time () + gt_virtual_clock_get_offset (self);
+}
+
+/**
+ * gt_virtual_clock_get_offset:
+ * @self: a #GtVirtualClock
+ *
+ * Get the total amount virtual time has been advanced by, relative to real
+ * time.
+ *
+ * This may be called from any thread.
+ *
+ * Returns: difference between virtual and real time, in microseconds
+ * Since: 0.2.0
+ */
+gint64
+gt_virtual_clock_get_offset (GtVirtualClock *self)
+{
+  AdvanceSource *advance_source;
+  gint64 offset_us;
+
+  g_return_val_if_fail (self != NULL, 0);
+
+  advance_source = (AdvanceSource *) self->advance_source;
+
+  g_mutex_lock (&advance_source->lock);
+  offset_us = advance_source->offset_us;
+  g_mutex_unlock (&advance_source->lock);
+
+  return offset_us;
+}
+
+/**
+ * gt_virtual_clock_advance:
+ * @self: a #GtVirtualClock
+ * @delta_us: amount to advance virtual time by, in microseconds; must be
+ *    non-negative
+ *
+ * Advance virtual time by @delta_us. All the pending timeout sources in the
+ * context will fire @delta_us sooner than they would have done, and any which
+ * are now due will fire on the next iteration of the context.
+ *
+ * This may be called from any thread.
+ *
+ * Since: 0.2.0
+ */
+void
+gt_virtual_clock_advance (GtVirtualClock *self,
+                          gint64          delta_us)
+{
+  g_return_if_fail (self != NULL);
+  g_return_if_fail (delta_us >= 0);
+
+  advance_source_advance ((AdvanceSource *) self->advance_source,
+                          self->context, delta_us);
+}
+
+/**
+ * gt_virtual_clock_advance_to_next:
+ * @self: a #GtVirtualClock
+ *
+ * Advance virtual time to when the next pending timeout source in the context
+ * is due to fire, so that it will fire on the next iteration of the context.
+ * If a timeout source is already due, or if there are no pending timeout
+ * sources, virtual time is not changed.
+ *
+ * This may be called from any thread.
+ *
+ * Returns: %TRUE if there was a pending timeout source, %FALSE otherwise
+ * Since: 0.2.0
+ */
+gboolean
+gt_virtual_clock_advance_to_next (GtVirtualClock *self)
+{
+  g_return_val_if_fail (self != NULL, FALSE);
+
+  return advance_source_advance_to_next ((AdvanceSource *) self->advance_source,
+                                         self->context);
+}
+
+/**
+ * gt_virtual_clock_set_auto_advance:
+ * @self: a #GtVirtualClock
+ * @auto_advance: %TRUE to advance virtual time automatically when the context
+ *    is idle, %FALSE to only advance it manually
+ *
+ * Set whether virtual time is advanced automatically when the context has been
+ * idle for the idle threshold. It is by default.
+ *
+ * This may be called from any thread.
+ *
+ * Since: 0.2.0
+ */
+void
+gt_virtual_clock_set_auto_advance (GtVirtualClock *self,
+                                   gboolean        auto_advance)
+{
+  AdvanceSource *advance_source;
+
+  g_return_if_fail (self != NULL);
+
+  advance_source = (AdvanceSource *) self->advance_source;
+
+  g_mutex_lock (&advance_source->lock);
+  advance_source->auto_advance = auto_advance;
+  g_mutex_unlock (&advance_source->lock);
+
+  g_main_context_wakeup (self->context);
+}
+
+/**
+ * gt_virtual_clock_set_idle_threshold:
+ * @self: a #GtVirtualClock
+ * @threshold_ms: idle threshold, in milliseconds
+ *
+ * Set how long the context must go without any sources becoming ready before
+ * virtual time is automatically advanced to the next pending timeout source.
+ * The default is 5ms.
+ *
+ * A lower threshold makes tests run faster, but increases the risk that
+ * virtual time is advanced while work which the test is waiting for (for
+ * example, a D-Bus method call being handled in another thread) is still in
+ * progress.
+ *
+ * This may be called from any thread.
+ *
+ * Since: 0.2.0
+ */
+void
+gt_virtual_clock_set_idle_threshold (GtVirtualClock *self,
+                                     guint           threshold_ms)
+{
+  AdvanceSource *advance_source;
+
+  g_return_if_fail (self != NULL);
+  g_return_if_fail (threshold_ms <= G_MAXINT);
+
+  advance_source = (AdvanceSource *) self->advance_source;
+
+  g_mutex_lock (&advance_source->lock);
+  advance_source->idle_threshold_ms = threshold_ms;
+  g_mutex_unlock (&advance_source->lock);
+
+  g_main_context_wakeup (self->context);
+}
@@ -0,0 +1,45 @@
+/* -*- mode: C; c-file-style: "gnu"; indent-tabs-mode: nil; -*-
+ *
+ * Copyright © 2018 Endless Mobile, Inc.
+ *
+ * This library is free software; you can redistribute it and/or
+ * modify it under the terms of the GNU Lesser General Public
+ * License as published by the Free Software Foundation; either
+ * version 2.1 of the License, or (at your option) any later version.
+ *
+ * This library is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the GNU
+ * Lesser General Public License for more details.
+ *
+ * You should have received a copy of the GNU Lesser General Public
+ * License along with this library; if not, write to the Free Software
+ * Foundation, Inc., 51 Franklin Street, Fifth Floor, Boston, MA  02110-1301  USA
+ *
+ */
+
+#pragma once
+
+#include <glib.h>
+
+G_BEGIN_DECLS
+
+typedef struct _GtVirtualClock GtVirtualClock;
+
+GtVirtualClock *gt_virtual_clock_new  (GMainContext   *context);
+void            gt_virtual_clock_free (GtVirtualClock *self);
+
+G_DEFINE_AUTOPTR_CLEANUP_FUNC (GtVirtualClock, gt_virtual_clock_free)
+
+gint64   gt_virtual_clock_get_time           (GtVirtualClock *self);
+gint64   gt_virtual_clock_get_offset         (GtVirtualClock *self);
+void     gt_virtual_clock_advance            (GtVirtualClock *self,
+                                              gint64          delta_us);
+gboolean gt_virtual_clock_advance_to_next    (GtVirtualClock *self);
+
+void     gt_virtual_clock_set_auto_advance   (GtVirtualClock *self,
+                                              gboolean        auto_advance);
+void     gt_virtual_clock_set_idle_threshold (GtVirtualClock *self,
+                                              guint           threshold_ms);
+
+G_END_DECLS